@@ -0,0 +1,241 @@
+#include "batch.hpp"
+#include <PI/p4info.h>
+#include <cassert>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include "devices.hpp"
+#include "helpers.hpp"
+#include "logger.hpp"
+
+namespace {
+
+struct DeviceTables {
+	std::unordered_map<pi_p4_id_t, TableHandle> tables;
+	BufferPool pool;
+};
+
+std::unordered_map<pi_dev_id_t, DeviceTables> deviceTables;
+
+typedef std::pair<pi_dev_id_t, pi_p4_id_t> TableKey;
+
+struct PendingRules {
+	p4table_t *table;
+	uint32_t firstIndex; ///< Index the first queued rule will have in the table
+	std::vector<p4rule_t*> rules;
+	std::unordered_set<std::string> keys; ///< Keys of the queued rules, see keyString
+};
+
+std::map<TableKey, PendingRules> pendingRules;
+
+/// Tables each session with an open batch queued rules for
+std::unordered_map<pi_session_handle_t, std::set<TableKey>> batches;
+
+/// Guards deviceTables, pendingRules and batches
+std::mutex batchMutex;
+typedef std::lock_guard<std::mutex> Lock;
+
+/**
+ *  \brief Bytes which identify the key of a rule among the rules of its table
+ */
+std::string keyString(const p4rule_t *rule) {
+	std::string result;
+	for (const p4key_elem_t *key = rule->key; key != NULL; key = key->next) {
+		result.append(reinterpret_cast<const char*>(key->value), key->value_size);
+		if (rule->engine == P4ENGINE_LPM) {
+			result.append(reinterpret_cast<const char*>(&(key->opt.prefix_len)), sizeof(key->opt.prefix_len));
+		}
+		else if (rule->engine == P4ENGINE_TERNARY) {
+			result.append(reinterpret_cast<const char*>(key->opt.mask), key->value_size);
+		}
+	}
+	return result;
+}
+
+/**
+ *  \brief Write the rules queued for a table, batchMutex must be held
+ */
+pi_status_t commitPending(const TableKey &key) {
+	auto it = pendingRules.find(key);
+	if (it == pendingRules.end()) return PI_STATUS_SUCCESS;
+
+	PendingRules pending = std::move(it->second);
+	pendingRules.erase(it);
+
+	pi_status_t result = PI_STATUS_SUCCESS;
+	for (std::size_t i = 0; i < pending.rules.size(); i++) {
+		uint32_t ruleIndex;
+		uint32_t status = p4table_insert_rule(pending.table, pending.rules[i], &ruleIndex, false);
+		if (status != P4DEV_OK) {
+			p4dev_err_stderr(status);
+			Logger::error("Cannot write batched rule " + std::to_string(i) + " of table " + std::to_string(key.second));
+			p4rule_free(pending.rules[i]);
+			if (result == PI_STATUS_SUCCESS) result = pi_status_t(PI_STATUS_TARGET_ERROR + status);
+			continue;
+		}
+
+		// The handle returned when the rule was queued is wrong, e.g. after a failed write
+		if (ruleIndex != pending.firstIndex + i) {
+			Logger::error("Batched rule written at index " + std::to_string(ruleIndex) + " instead of " + std::to_string(pending.firstIndex + i));
+			if (result == PI_STATUS_SUCCESS) result = PI_STATUS_TARGET_ERROR;
+		}
+	}
+
+	return result;
+}
+
+p4engine_type_t getEngine(const pi_p4info_t *info, pi_p4_id_t tableId) {
+	std::size_t matchFieldsSize = pi_p4info_table_num_match_fields(info, tableId);
+
+	p4engine_type_t engineType = P4ENGINE_UNKNOWN;
+	for (std::size_t i = 0; i < matchFieldsSize; i++) {
+		auto finfo = pi_p4info_table_match_field_info(info, tableId, i);
+		if (engineType == P4ENGINE_UNKNOWN) engineType = translateEngine(finfo->match_type);
+		else if (engineType != translateEngine(finfo->match_type)) return P4ENGINE_UNKNOWN;
+	}
+
+	return engineType;
+}
+
+}
+
+uint8_t *BufferPool::allocate(std::size_t size) {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (size > CHUNK_SIZE) {
+		chunks.emplace_back(new uint8_t[size]);
+		uint8_t *result = chunks.back().get();
+		// The rest of the previous chunk is lost, keys are never that large anyway
+		used = CHUNK_SIZE;
+		return result;
+	}
+
+	if (used + size > CHUNK_SIZE) {
+		chunks.emplace_back(new uint8_t[CHUNK_SIZE]);
+		used = 0;
+	}
+
+	uint8_t *result = chunks.back().get() + used;
+	used += size;
+	return result;
+}
+
+void BufferPool::clear() {
+	std::lock_guard<std::mutex> lock(mutex);
+	chunks.clear();
+	used = CHUNK_SIZE;
+}
+
+const TableHandle *TableManager::getTable(pi_dev_id_t devId, pi_p4_id_t tableId) {
+	Lock lock(batchMutex);
+	auto &tables = deviceTables[devId].tables;
+	auto it = tables.find(tableId);
+	if (it != tables.end()) return &(it->second);
+
+	const pi_p4info_t *info = infos[devId];
+	assert(info != NULL);
+
+	const char *tableName = pi_p4info_table_name_from_id(info, tableId);
+	p4table_t *table = p4device_get_table(&(devices[devId]), tableName);
+	if (table == NULL) {
+		Logger::error("Cannot get table with name: " + std::string(tableName));
+		return NULL;
+	}
+
+	TableHandle handle = { table, tableName, getEngine(info, tableId) };
+	return &(tables.emplace(tableId, handle).first->second);
+}
+
+BufferPool *TableManager::getPool(pi_dev_id_t devId) {
+	Lock lock(batchMutex);
+	return &(deviceTables[devId].pool);
+}
+
+void TableManager::clearTables(pi_dev_id_t devId) {
+	Lock lock(batchMutex);
+	deviceTables[devId].tables.clear();
+}
+
+void TableManager::freeDevice(pi_dev_id_t devId) {
+	Lock lock(batchMutex);
+	deviceTables.erase(devId);
+}
+
+void BatchManager::beginBatch(pi_session_handle_t session) {
+	Lock lock(batchMutex);
+	batches[session];
+}
+
+pi_status_t BatchManager::endBatch(pi_session_handle_t session) {
+	Lock lock(batchMutex);
+	auto it = batches.find(session);
+	if (it == batches.end()) return PI_STATUS_SUCCESS;
+
+	pi_status_t result = PI_STATUS_SUCCESS;
+	for (const auto &key : it->second) {
+		pi_status_t status = commitPending(key);
+		if (result == PI_STATUS_SUCCESS) result = status;
+	}
+	batches.erase(it);
+
+	return result;
+}
+
+bool BatchManager::inBatch(pi_session_handle_t session) {
+	Lock lock(batchMutex);
+	return batches.count(session) > 0;
+}
+
+pi_status_t BatchManager::queueRule(pi_session_handle_t session, pi_dev_id_t devId, pi_p4_id_t tableId, const TableHandle &table, p4rule_t *rule, pi_entry_handle_t *entryHandle) {
+	Lock lock(batchMutex);
+	uint32_t index;
+	if (p4table_find_rule(table.table, rule->key, &index) == P4DEV_OK) {
+		return pi_status_t(PI_STATUS_TARGET_ERROR + P4DEV_RULE_EXISTS);
+	}
+
+	TableKey key(devId, tableId);
+	auto &pending = pendingRules[key];
+	if (not pending.keys.insert(keyString(rule)).second) {
+		return pi_status_t(PI_STATUS_TARGET_ERROR + P4DEV_RULE_EXISTS);
+	}
+	if (pending.rules.empty()) {
+		pending.table = table.table;
+		pending.firstIndex = p4table_get_size(table.table);
+	}
+
+	*entryHandle = pending.firstIndex + pending.rules.size();
+	pending.rules.push_back(rule);
+	batches[session].insert(key);
+
+	return PI_STATUS_SUCCESS;
+}
+
+pi_status_t BatchManager::commitTable(pi_dev_id_t devId, pi_p4_id_t tableId) {
+	Lock lock(batchMutex);
+	return commitPending(TableKey(devId, tableId));
+}
+
+pi_status_t BatchManager::commitDevice(pi_dev_id_t devId) {
+	Lock lock(batchMutex);
+	pi_status_t result = PI_STATUS_SUCCESS;
+	auto it = pendingRules.lower_bound(TableKey(devId, 0));
+	while (it != pendingRules.end() and it->first.first == devId) {
+		TableKey key = (it++)->first;
+		pi_status_t status = commitPending(key);
+		if (result == PI_STATUS_SUCCESS) result = status;
+	}
+
+	return result;
+}
+
+void BatchManager::discardDevice(pi_dev_id_t devId) {
+	Lock lock(batchMutex);
+	auto it = pendingRules.lower_bound(TableKey(devId, 0));
+	while (it != pendingRules.end() and it->first.first == devId) {
+		for (auto *rule : it->second.rules) p4rule_free(rule);
+		it = pendingRules.erase(it);
+	}
+}
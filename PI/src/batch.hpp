@@ -0,0 +1,125 @@
+#ifndef BATCH_HPP_
+#define BATCH_HPP_
+
+#include <PI/pi.h>
+#include <p4dev.h>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/**
+ *  \brief Hands out the byte arrays of keys, masks and action parameters
+ *
+ *  \details libp4dev keeps pointers to these arrays for as long as the rule
+ *  exists in the device, so they are carved out of large chunks instead of
+ *  being allocated one by one, and are only released with the device. Safe to use
+ *  from several threads.
+ */
+class BufferPool {
+public:
+	uint8_t *allocate(std::size_t size);
+	void clear();
+
+private:
+	static const std::size_t CHUNK_SIZE = 64 * 1024;
+
+	std::mutex mutex;
+	std::vector<std::unique_ptr<uint8_t[]>> chunks;
+	std::size_t used = CHUNK_SIZE; ///< Bytes used in the last chunk
+};
+
+/**
+ *  \brief What is needed to write rules to a table, resolved once per table
+ */
+struct TableHandle {
+	p4table_t *table;
+	const char *name;
+	p4engine_type_t engine; ///< P4ENGINE_UNKNOWN if the match fields use different engines
+};
+
+class TableManager {
+public:
+	/**
+	 *  \brief Get the table with a given PI id, the handle is cached until the P4 Info of the device changes
+	 *
+	 *  \details The handle must not be used once the P4 Info changed, PI does not run table
+	 *  operations on a device while its config is updated.
+	 *
+	 *  \return NULL if the table does not exist in the device
+	 */
+	static const TableHandle *getTable(pi_dev_id_t devId, pi_p4_id_t tableId);
+
+	/**
+	 *  \brief Get the buffer pool used for the rules of a device
+	 */
+	static BufferPool *getPool(pi_dev_id_t devId);
+
+	/**
+	 *  \brief Forget the cached table handles, when the P4 Info of a device changes
+	 */
+	static void clearTables(pi_dev_id_t devId);
+
+	/**
+	 *  \brief Release everything held for a device, once its rules have been freed
+	 */
+	static void freeDevice(pi_dev_id_t devId);
+};
+
+/**
+ *  \brief Accumulates the rules added by a session between _pi_batch_begin and _pi_batch_end
+ *
+ *  \details Rules are queued per table, then written to the device table by table when
+ *  the batch ends. Entry handles are returned right away: libp4dev appends new rules at
+ *  the end of the table, so the handle of a queued rule is its future index. Any other
+ *  operation on a table first commits the rules queued for it, whichever the session,
+ *  so that handles stay valid and reads see every write.
+ *
+ *  All methods, and those of TableManager, can be called from several sessions at once.
+ */
+class BatchManager {
+public:
+	static void beginBatch(pi_session_handle_t session);
+
+	/**
+	 *  \brief Commit the rules queued by a session, no-op if there is no open batch
+	 *
+	 *  \return Status of the first write which failed, PI_STATUS_SUCCESS otherwise
+	 */
+	static pi_status_t endBatch(pi_session_handle_t session);
+
+	static bool inBatch(pi_session_handle_t session);
+
+	/**
+	 *  \brief Queue a rule for table 'tableId', to be written when the batch ends
+	 *
+	 *  \details The key is checked against the rules of the table and the rules queued for it,
+	 *  so that a duplicate is reported now rather than when the batch ends. The batch takes
+	 *  ownership of the rule only if the rule is queued.
+	 *
+	 *  \param [out] entryHandle Index the rule will have in the table
+	 *  \return PI_STATUS_TARGET_ERROR + P4DEV_RULE_EXISTS if the key is already used
+	 */
+	static pi_status_t queueRule(pi_session_handle_t session, pi_dev_id_t devId, pi_p4_id_t tableId, const TableHandle &table, p4rule_t *rule, pi_entry_handle_t *entryHandle);
+
+	/**
+	 *  \brief Write the rules queued for a table, if any
+	 *
+	 *  \details A rule which cannot be written is freed and the following rules are still written.
+	 *
+	 *  \return Status of the first write which failed, PI_STATUS_SUCCESS otherwise
+	 */
+	static pi_status_t commitTable(pi_dev_id_t devId, pi_p4_id_t tableId);
+
+	/**
+	 *  \brief Write the rules queued for all the tables of a device
+	 */
+	static pi_status_t commitDevice(pi_dev_id_t devId);
+
+	/**
+	 *  \brief Drop the rules queued for a device which is being removed
+	 */
+	static void discardDevice(pi_dev_id_t devId);
+};
+
+#endif
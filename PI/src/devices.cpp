@@ -1,4 +1,5 @@
 #include "devices.hpp"
+#include "batch.hpp"
 
 const int MAX_DEVICES = 2;
 
@@ -21,5 +22,10 @@ bool DeviceManager::reserveDevice(std::size_t index) {
 bool DeviceManager::freeDevice(std::size_t index) {
 	reserved[index] = false;
 	infos[index] = NULL;
+	BatchManager::discardDevice(index);
 	p4device_free(&(devices[index]));
+	// Key and parameter buffers are no longer referenced
+	TableManager::freeDevice(index);
+	
+	return true;
 }
\ No newline at end of file
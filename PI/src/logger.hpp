@@ -1,7 +1,9 @@
 #ifndef LOGGER_HPP_
 #define LOGGER_HPP_
 
+#ifndef DISABLE_DEBUG
 #define ENABLE_DEBUG
+#endif
 
 #include <iostream>
 #include <cstring>
@@ -20,8 +20,10 @@
 
 #include <PI/pi.h>
 #include <PI/target/pi_imp.h>
+#include <atomic>
 #include <iostream>
 #include <p4dev.h>
+#include "batch.hpp"
 #include "devices.hpp"
 #include "logger.hpp"
 #include "helpers.hpp"
@@ -61,6 +63,7 @@ pi_status_t _pi_assign_device(pi_dev_id_t dev_id, const pi_p4info_t *p4info, pi_
 	}
 	
 	infos[dev_id] = p4info;
+	TableManager::clearTables(dev_id);
 	
 	return PI_STATUS_SUCCESS;
 }
@@ -76,9 +79,12 @@ pi_status_t _pi_update_device_start(pi_dev_id_t dev_id, const pi_p4info_t *p4inf
 
 	Logger::debug("Ignoring new device data\n");
 
+	// Table ids may have changed
+	pi_status_t status = BatchManager::commitDevice(dev_id);
 	infos[dev_id] = p4info;
+	TableManager::clearTables(dev_id);
 
-	return PI_STATUS_SUCCESS;
+	return status;
 }
 
 pi_status_t _pi_update_device_end(pi_dev_id_t dev_id) {
@@ -104,30 +110,30 @@ pi_status_t _pi_destroy() {
 	return PI_STATUS_SUCCESS;
 }
 
-// Combo does not support transaction and has no use for the session_handle
+// Combo does not support transactions, session handles only identify batches
 pi_status_t _pi_session_init(pi_session_handle_t *session_handle) {
-	(void)session_handle;
+	static std::atomic<pi_session_handle_t> nextHandle(0);
 	Logger::debug("PI_session_init");
+	*session_handle = nextHandle++;
 	return PI_STATUS_SUCCESS;
 }
 
 pi_status_t _pi_session_cleanup(pi_session_handle_t session_handle) {
-	(void) session_handle;
 	Logger::debug("PI_session_cleanup");
-	return PI_STATUS_SUCCESS;
+	return BatchManager::endBatch(session_handle);
 }
 
 pi_status_t _pi_batch_begin(pi_session_handle_t session_handle) {
-	(void) session_handle;
 	Logger::debug("PI_batch_begin");
+	BatchManager::beginBatch(session_handle);
 	return PI_STATUS_SUCCESS;
 }
 
+// Rules are written synchronously, so hw_sync makes no difference
 pi_status_t _pi_batch_end(pi_session_handle_t session_handle, bool hw_sync) {
-	(void) session_handle;
 	(void) hw_sync;
 	Logger::debug("PI_batch_end");
-	return PI_STATUS_SUCCESS;
+	return BatchManager::endBatch(session_handle);
 }
 
 pi_status_t _pi_packetout_send(pi_dev_id_t dev_id, const char *pkt, size_t size) {
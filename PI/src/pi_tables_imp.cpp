@@ -24,27 +24,30 @@
 #include <PI/pi.h>
 #include <p4dev.h>
 #include <cstring>
+#include "batch.hpp"
 #include "devices.hpp"
 #include "helpers.hpp"
 #include "logger.hpp"
 
-p4rule_t *createRule(const char *tableName, const pi_p4info_t *info, pi_p4_id_t table_id) {
-	std::size_t matchFieldsSize = pi_p4info_table_num_match_fields(info, table_id);
+p4rule_t *createRule(const TableHandle &table) {
+	// Engine of rule was determined with the table handle
+	if (table.engine == P4ENGINE_UNKNOWN) return NULL;
 
-	// Determine engine of rule
-	p4engine_type_t engineType = P4ENGINE_UNKNOWN;
-	for (std::size_t i = 0; i < matchFieldsSize; i++) {
-		auto finfo = pi_p4info_table_match_field_info(info, table_id, i);
-		if (engineType == P4ENGINE_UNKNOWN) engineType = translateEngine(finfo->match_type);
-		else if (engineType != translateEngine(finfo->match_type)) return NULL;
-	}
-	if (engineType == P4ENGINE_UNKNOWN) return NULL;
-
-	p4rule_t *result = p4rule_create(tableName, engineType);
+	p4rule_t *result = p4rule_create(table.name, table.engine);
 	return result;
 }
 
-uint32_t createKeys(const pi_p4info_t *info, pi_p4_id_t table_id, const pi_match_key_t *match_key, p4key_elem_t **key) {
+/**
+ *  \brief Get a table before operating on it, once the rules batched for it have been written
+ */
+pi_status_t getTable(pi_dev_id_t devId, pi_p4_id_t tableId, const TableHandle **table) {
+	*table = TableManager::getTable(devId, tableId);
+	if (*table == NULL) return PI_STATUS_NETV_INVALID_OBJ_ID;
+
+	return BatchManager::commitTable(devId, tableId);
+}
+
+uint32_t createKeys(const pi_p4info_t *info, pi_p4_id_t table_id, const pi_match_key_t *match_key, BufferPool *pool, p4key_elem_t **key) {
 	const char *data = match_key->data;
 
 	uint8_t *value;
@@ -67,7 +70,7 @@ uint32_t createKeys(const pi_p4info_t *info, pi_p4_id_t table_id, const pi_match
 			break;
 
 		case PI_P4INFO_MATCH_TYPE_EXACT:
-			value = new uint8_t[bytewidth];
+			value = pool->allocate(bytewidth);
 			if (value == NULL) return P4DEV_ALLOCATE_ERROR;
 			memcpy(value, data, bytewidth);
 			data += bytewidth;
@@ -91,7 +94,7 @@ uint32_t createKeys(const pi_p4info_t *info, pi_p4_id_t table_id, const pi_match
 			break;
 
 		case PI_P4INFO_MATCH_TYPE_LPM:
-			value = new uint8_t[bytewidth];
+			value = pool->allocate(bytewidth);
 			if (value == NULL) return P4DEV_ALLOCATE_ERROR;
 			memcpy(value, data, bytewidth);
 			data += bytewidth;
@@ -109,8 +112,8 @@ uint32_t createKeys(const pi_p4info_t *info, pi_p4_id_t table_id, const pi_match
 			break;
 
 		case PI_P4INFO_MATCH_TYPE_TERNARY:
-			value = new uint8_t[bytewidth];
-			mask = new uint8_t[bytewidth];
+			value = pool->allocate(bytewidth);
+			mask = pool->allocate(bytewidth);
 
 			if (value == NULL or mask == NULL) return P4DEV_ALLOCATE_ERROR;
 
@@ -146,10 +149,10 @@ uint32_t createKeys(const pi_p4info_t *info, pi_p4_id_t table_id, const pi_match
 	return P4DEV_OK;
 }
 
-uint32_t addKeys(const pi_p4info_t *info, pi_p4_id_t table_id, const pi_match_key_t *match_key, p4rule_t *rule) {
+uint32_t addKeys(const pi_p4info_t *info, pi_p4_id_t table_id, const pi_match_key_t *match_key, BufferPool *pool, p4rule_t *rule) {
 	p4key_elem_t *key;
 	uint32_t status;
-	if ((status = createKeys(info, table_id, match_key, &key)) != P4DEV_OK) {
+	if ((status = createKeys(info, table_id, match_key, pool, &key)) != P4DEV_OK) {
 		return status;
 	}
 
@@ -158,7 +161,7 @@ uint32_t addKeys(const pi_p4info_t *info, pi_p4_id_t table_id, const pi_match_ke
 	return P4DEV_OK;
 }
 
-uint32_t createParams(const pi_p4info_t *info, const pi_p4_id_t actionID, const char *actionData, p4param_t **param) {
+uint32_t createParams(const pi_p4info_t *info, const pi_p4_id_t actionID, const char *actionData, BufferPool *pool, p4param_t **param) {
 	assert(info != NULL);
 	assert(actionData != NULL);
 	assert(param != NULL);
@@ -172,7 +175,7 @@ uint32_t createParams(const pi_p4info_t *info, const pi_p4_id_t actionID, const
 		size_t paramBitwidth = pi_p4info_action_param_bitwidth(info, actionID, paramIds[i]);
 		size_t paramBytewidth = (paramBitwidth + 7) / 8;
 
-		uint8_t *data = new uint8_t[paramBytewidth];
+		uint8_t *data = pool->allocate(paramBytewidth);
 		if (data == NULL) return P4DEV_ALLOCATE_ERROR;
 
 		memcpy(data, actionData, paramBytewidth);
@@ -196,7 +199,7 @@ uint32_t createParams(const pi_p4info_t *info, const pi_p4_id_t actionID, const
 	return P4DEV_OK;
 }
 
-uint32_t addAction(const pi_p4info_t *info, const pi_action_data_t *action_data, p4rule_t *rule) {
+uint32_t addAction(const pi_p4info_t *info, const pi_action_data_t *action_data, BufferPool *pool, p4rule_t *rule) {
 	assert(info);
 	assert(action_data);
 
@@ -208,7 +211,7 @@ uint32_t addAction(const pi_p4info_t *info, const pi_action_data_t *action_data,
 	if ((status = p4rule_add_action(rule, actionName)) != P4DEV_OK) return status;
 
 	p4param_t *params = NULL;
-	if ((status = createParams(info, actionID, actionData, &params)) != P4DEV_OK) return status;
+	if ((status = createParams(info, actionID, actionData, pool, &params)) != P4DEV_OK) return status;
 	
 	rule->params = params;
 
@@ -220,41 +223,54 @@ extern "C" {
 //! Adds an entry to a table. Trying to add an entry that already exists should
 //! return an error, unless the \p overwrite flag is set.
 pi_status_t _pi_table_entry_add(pi_session_handle_t session_handle, pi_dev_tgt_t dev_tgt, pi_p4_id_t table_id, const pi_match_key_t *match_key, const pi_table_entry_t *table_entry, int overwrite, pi_entry_handle_t *entry_handle) {
-	COMBO_UNUSED(session_handle); ///< No support for sessions
 	Logger::debug("PI_table_entry_add");
 	
 	const pi_p4info_t *info = infos[dev_tgt.dev_id];
 	assert(info != NULL);
 
-	// Retrieve table handle
-	const char *tableName = pi_p4info_table_name_from_id(info, table_id);
-	p4table_t *table = p4device_get_table(&(devices[dev_tgt.dev_id]), tableName);
-	if (table == NULL) {
-		Logger::error("Cannot get table with name: " + std::string(tableName));
-		return PI_STATUS_NETV_INVALID_OBJ_ID;
-	}
+	// Retrieve table handle, rules batched for the table are written only when needed
+	const TableHandle *table = TableManager::getTable(dev_tgt.dev_id, table_id);
+	if (table == NULL) return PI_STATUS_NETV_INVALID_OBJ_ID;
 	
 	// Initialize rule object
-	p4rule_t *rule = createRule(tableName, info, table_id);
+	p4rule_t *rule = createRule(*table);
 	if (rule == NULL) {
 		Logger::error("Cannot create rule\n");
 		return pi_status_t(PI_STATUS_TARGET_ERROR);
 	}
+	BufferPool *pool = TableManager::getPool(dev_tgt.dev_id);
 	uint32_t status;
-	if ((status = addKeys(info, table_id, match_key, rule)) != P4DEV_OK) {
+	if ((status = addKeys(info, table_id, match_key, pool, rule)) != P4DEV_OK) {
 		p4dev_err_stderr(status);
+		p4rule_free(rule);
 		return pi_status_t(PI_STATUS_TARGET_ERROR + status);
 	}
-	if ((status = addAction(info, table_entry->entry.action_data, rule)) != P4DEV_OK) {
+	if ((status = addAction(info, table_entry->entry.action_data, pool, rule)) != P4DEV_OK) {
 		p4dev_err_stderr(status);
+		p4rule_free(rule);
 		return pi_status_t(PI_STATUS_TARGET_ERROR + status);
 	}
+
+	// The index of an overwritten rule is only known once it is written
+	pi_status_t piStatus;
+	if (BatchManager::inBatch(session_handle) and not overwrite) {
+		piStatus = BatchManager::queueRule(session_handle, dev_tgt.dev_id, table_id, *table, rule, entry_handle);
+		if (piStatus != PI_STATUS_SUCCESS) p4rule_free(rule);
+		return piStatus;
+	}
+
+	piStatus = BatchManager::commitTable(dev_tgt.dev_id, table_id);
+	if (piStatus != PI_STATUS_SUCCESS) {
+		p4rule_free(rule);
+		return piStatus;
+	}
 	
 	// Insert rule to table
 	uint32_t ruleIndex;
-	status = p4table_insert_rule(table, rule, &ruleIndex, overwrite);
+	status = p4table_insert_rule(table->table, rule, &ruleIndex, overwrite);
 	if (status != P4DEV_OK) {
 		p4dev_err_stderr(status);
+		p4rule_free(rule);
 		return pi_status_t(PI_STATUS_TARGET_ERROR + status);
 	}
 
@@ -273,28 +289,25 @@ pi_status_t _pi_table_default_action_set(pi_session_handle_t session_handle, pi_
 	assert(info != NULL);
 
 	// Retrieve table handle
-	const char *tableName = pi_p4info_table_name_from_id(info, table_id);
-	p4table_t *table = p4device_get_table(&(devices[dev_tgt.dev_id]), tableName);
-	if (table == NULL) {
-		Logger::error("Cannot get table with name: " + std::string(tableName));
-		return PI_STATUS_NETV_INVALID_OBJ_ID;
-	}
+	const TableHandle *table;
+	pi_status_t piStatus = getTable(dev_tgt.dev_id, table_id, &table);
+	if (piStatus != PI_STATUS_SUCCESS) return piStatus;
 
 	// Initialize rule object
-	p4rule_t *rule = p4table_get_rule_template(table); // There might not be match engine, no need to check it
+	p4rule_t *rule = p4table_get_rule_template(table->table); // There might not be match engine, no need to check it
 	if (rule == NULL) {
 		Logger::error("Cannot create rule\n");
 		return pi_status_t(PI_STATUS_TARGET_ERROR);
 	}
 	p4rule_mark_default(rule);
 	uint32_t status;
-	if ((status = addAction(info, table_entry->entry.action_data, rule)) != P4DEV_OK) {
+	if ((status = addAction(info, table_entry->entry.action_data, TableManager::getPool(dev_tgt.dev_id), rule)) != P4DEV_OK) {
 		p4dev_err_stderr(status);
 		return pi_status_t(PI_STATUS_TARGET_ERROR + status);
 	}
 
 	// Insert rule to table
-	status = p4table_insert_default_rule(table, rule);
+	status = p4table_insert_default_rule(table->table, rule);
 	if (status != P4DEV_OK) {
 		p4dev_err_stderr(status);
 		return pi_status_t(PI_STATUS_TARGET_ERROR + status);
@@ -314,14 +327,11 @@ pi_status_t _pi_table_default_action_reset(pi_session_handle_t session_handle, p
 	assert(info != NULL);
 
 	// Retrieve table handle
-	const char *tableName = pi_p4info_table_name_from_id(info, table_id);
-	p4table_t *table = p4device_get_table(&(devices[dev_tgt.dev_id]), tableName);
-	if (table == NULL) {
-		Logger::error("Cannot get table with name: " + std::string(tableName));
-		return PI_STATUS_NETV_INVALID_OBJ_ID;
-	}
+	const TableHandle *table;
+	pi_status_t piStatus = getTable(dev_tgt.dev_id, table_id, &table);
+	if (piStatus != PI_STATUS_SUCCESS) return piStatus;
 
-	uint32_t status = p4table_reset_default_rule(table);
+	uint32_t status = p4table_reset_default_rule(table->table);
 	if (status != P4DEV_OK) {
 		p4dev_err_stderr(status);
 		return pi_status_t(PI_STATUS_TARGET_ERROR + status);
@@ -339,14 +349,11 @@ pi_status_t _pi_table_default_action_get(pi_session_handle_t session_handle, pi_
 	assert(info != NULL);
 
 	// Retrieve table handle
-	const char *tableName = pi_p4info_table_name_from_id(info, table_id);
-	p4table_t *table = p4device_get_table(&(devices[dev_id]), tableName);
-	if (table == NULL) {
-		Logger::error("Cannot get table with name: " + std::string(tableName));
-		return PI_STATUS_NETV_INVALID_OBJ_ID;
-	}
+	const TableHandle *table;
+	pi_status_t piStatus = getTable(dev_id, table_id, &table);
+	if (piStatus != PI_STATUS_SUCCESS) return piStatus;
 
-	p4rule_t *defaultRule = p4table_get_default_rule(table);
+	p4rule_t *defaultRule = p4table_get_default_rule(table->table);
 	if (defaultRule == NULL) {
 		Logger::error("No default rule set");
 		return PI_STATUS_TARGET_ERROR;
@@ -379,14 +386,11 @@ pi_status_t _pi_table_entry_delete(pi_session_handle_t session_handle, pi_dev_id
 	assert(info != NULL);
 
 	// Retrieve table handle
-	const char *tableName = pi_p4info_table_name_from_id(info, table_id);
-	p4table_t *table = p4device_get_table(&(devices[dev_id]), tableName);
-	if (table == NULL) {
-		Logger::error("Cannot get table with name: " + std::string(tableName));
-		return PI_STATUS_NETV_INVALID_OBJ_ID;
-	}
+	const TableHandle *table;
+	pi_status_t piStatus = getTable(dev_id, table_id, &table);
+	if (piStatus != PI_STATUS_SUCCESS) return piStatus;
 
-	uint32_t status = p4table_delete_rule(table, entry_handle);
+	uint32_t status = p4table_delete_rule(table->table, entry_handle);
 	if (status != P4DEV_OK) {
 		p4dev_err_stderr(status);
 		return pi_status_t(PI_STATUS_TARGET_ERROR + status);
@@ -405,27 +409,24 @@ pi_status_t _pi_table_entry_delete_wkey(pi_session_handle_t session_handle, pi_d
 	assert(info != NULL);
 
 	// Retrieve table handle
-	const char *tableName = pi_p4info_table_name_from_id(info, table_id);
-	p4table_t *table = p4device_get_table(&(devices[dev_id]), tableName);
-	if (table == NULL) {
-		Logger::error("Cannot get table with name: " + std::string(tableName));
-		return PI_STATUS_NETV_INVALID_OBJ_ID;
-	}
+	const TableHandle *table;
+	pi_status_t piStatus = getTable(dev_id, table_id, &table);
+	if (piStatus != PI_STATUS_SUCCESS) return piStatus;
 
 	p4key_elem_t *key;
 	uint32_t status, index;
-	if ((status = createKeys(info, table_id, match_key, &key))) {
+	if ((status = createKeys(info, table_id, match_key, TableManager::getPool(dev_id), &key))) {
 		p4dev_err_stderr(status);
 		return pi_status_t(PI_STATUS_TARGET_ERROR + status);
 	}
 
-	status = p4table_find_rule(table, key, &index);
+	status = p4table_find_rule(table->table, key, &index);
 	if (status != P4DEV_OK) {
 		p4dev_err_stderr(status);
 		return pi_status_t(PI_STATUS_TARGET_ERROR + status);
 	}
 
-	status = p4table_delete_rule(table, index);
+	status = p4table_delete_rule(table->table, index);
 	if (status != P4DEV_OK) {
 		p4dev_err_stderr(status);
 		return pi_status_t(PI_STATUS_TARGET_ERROR + status);
@@ -444,12 +445,9 @@ pi_status_t _pi_table_entry_modify(pi_session_handle_t session_handle, pi_dev_id
 	assert(info != NULL);
 
 	// Retrieve table handle
-	const char *tableName = pi_p4info_table_name_from_id(info, table_id);
-	p4table_t *table = p4device_get_table(&(devices[dev_id]), tableName);
-	if (table == NULL) {
-		Logger::error("Cannot get table with name: " + std::string(tableName));
-		return PI_STATUS_NETV_INVALID_OBJ_ID;
-	}
+	const TableHandle *table;
+	pi_status_t piStatus = getTable(dev_id, table_id, &table);
+	if (piStatus != PI_STATUS_SUCCESS) return piStatus;
 
 	pi_p4_id_t actionID = table_entry->entry.action_data->action_id;
 	const char *actionData = table_entry->entry.action_data->data;
@@ -457,12 +455,12 @@ pi_status_t _pi_table_entry_modify(pi_session_handle_t session_handle, pi_dev_id
 
 	p4param_t *params = NULL;
 	uint32_t status;
-	if ((status = createParams(info, actionID, actionData, &params)) != P4DEV_OK) {
+	if ((status = createParams(info, actionID, actionData, TableManager::getPool(dev_id), &params)) != P4DEV_OK) {
 		p4dev_err_stderr(status);
 		return pi_status_t(PI_STATUS_TARGET_ERROR + status);
 	}
 
-	status = p4table_modify_rule(table, entry_handle, actionName, params);
+	status = p4table_modify_rule(table->table, entry_handle, actionName, params);
 	if (status != P4DEV_OK)  {
 		p4dev_err_stderr(status);
 		return pi_status_t(PI_STATUS_TARGET_ERROR + status);
@@ -481,21 +479,18 @@ pi_status_t _pi_table_entry_modify_wkey(pi_session_handle_t session_handle, pi_d
 	assert(info != NULL);
 
 	// Retrieve table handle
-	const char *tableName = pi_p4info_table_name_from_id(info, table_id);
-	p4table_t *table = p4device_get_table(&(devices[dev_id]), tableName);
-	if (table == NULL) {
-		Logger::error("Cannot get table with name: " + std::string(tableName));
-		return PI_STATUS_NETV_INVALID_OBJ_ID;
-	}
+	const TableHandle *table;
+	pi_status_t piStatus = getTable(dev_id, table_id, &table);
+	if (piStatus != PI_STATUS_SUCCESS) return piStatus;
 
 	uint32_t status, index;
 	p4key_elem_t *key;
-	if ((status = createKeys(info, table_id, match_key, &key)) != P4DEV_OK) {
+	if ((status = createKeys(info, table_id, match_key, TableManager::getPool(dev_id), &key)) != P4DEV_OK) {
 		p4dev_err_stderr(status);
 		return pi_status_t(PI_STATUS_TARGET_ERROR + status);
 	}
 
-	status = p4table_find_rule(table, key, &index);
+	status = p4table_find_rule(table->table, key, &index);
 	if (status != P4DEV_OK) {
 		p4dev_err_stderr(status);
 		return pi_status_t(PI_STATUS_TARGET_ERROR + status);
@@ -506,12 +501,12 @@ pi_status_t _pi_table_entry_modify_wkey(pi_session_handle_t session_handle, pi_d
 	const char *actionName = pi_p4info_action_name_from_id(info, actionID);
 
 	p4param_t *params = NULL;
-	if ((status = createParams(info, actionID, actionData, &params)) != P4DEV_OK) {
+	if ((status = createParams(info, actionID, actionData, TableManager::getPool(dev_id), &params)) != P4DEV_OK) {
 		p4dev_err_stderr(status);
 		return pi_status_t(PI_STATUS_TARGET_ERROR + status);
 	}
 
-	status = p4table_modify_rule(table, index, actionName, params);
+	status = p4table_modify_rule(table->table, index, actionName, params);
 	if (status != P4DEV_OK) {
 		p4dev_err_stderr(status);
 		return pi_status_t(PI_STATUS_TARGET_ERROR + status);
@@ -529,14 +524,11 @@ pi_status_t _pi_table_entries_fetch(pi_session_handle_t session_handle, pi_dev_i
 	assert(info != NULL);
 
 	// Retrieve table handle
-	const char *tableName = pi_p4info_table_name_from_id(info, table_id);
-	p4table_t *table = p4device_get_table(&(devices[dev_id]), tableName);
-	if (table == NULL) {
-		Logger::error("Cannot get table with name: " + std::string(tableName));
-		return PI_STATUS_NETV_INVALID_OBJ_ID;
-	}
+	const TableHandle *table;
+	pi_status_t piStatus = getTable(dev_id, table_id, &table);
+	if (piStatus != PI_STATUS_SUCCESS) return piStatus;
 
-	res->num_entries = p4table_get_size(table);
+	res->num_entries = p4table_get_size(table->table);
 	size_t dataSize = 0U;
 	//res->p4info = info;
 	//res->num_direct_resources = 0;
@@ -555,7 +547,7 @@ pi_status_t _pi_table_entries_fetch(pi_session_handle_t session_handle, pi_dev_i
 	auto actionMap = computeActionSizes(info, actionIds, num_actions);
 
 	for (uint32_t i = 0; i < res->num_entries; i++) {
-		auto *rule = p4table_get_rule(table, i);
+		auto *rule = p4table_get_rule(table->table, i);
 		
 		dataSize += actionMap.at(rule->action).size;
 		dataSize += sizeof(s_pi_p4_id_t); // Action ID
@@ -571,7 +563,7 @@ pi_status_t _pi_table_entries_fetch(pi_session_handle_t session_handle, pi_dev_i
 	res->entries = data;
 
 	for (uint32_t i = 0; i < res->num_entries; i++) {
-		auto *rule = p4table_get_rule(table, i);
+		auto *rule = p4table_get_rule(table->table, i);
 
 		data += emit_entry_handle(data, i);
 		// We don't have priority yet
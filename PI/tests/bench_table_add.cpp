@@ -0,0 +1,132 @@
+/* Copyright 2013-present Barefoot Networks, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Measures how many rules per second _pi_table_entry_add writes to the mock
+ * libp4dev device (tests/mock), one rule at a time and in batches, and checks
+ * that the rules and the entry handles are the same either way.
+ *
+ * Usage: bench_table_add [number of rules] [batch size]
+ */
+
+#include <PI/int/pi_int.h>
+#include <PI/p4info.h>
+#include <PI/pi.h>
+#include <PI/target/pi_imp.h>
+#include <PI/target/pi_tables_imp.h>
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "devices.hpp"
+
+#define ASSERT_SUCCESS(call) do { pi_status_t rc = (call); (void)rc; assert(rc == PI_STATUS_SUCCESS); } while (0)
+
+typedef std::chrono::steady_clock Clock;
+
+const pi_dev_id_t DEV_ID = 0;
+
+struct Bench {
+	const pi_p4info_t *info;
+	pi_p4_id_t tableId;
+	pi_p4_id_t actionId;
+	std::vector<char> keyData;
+	std::vector<char> actionData;
+
+	/// Adds 'count' rules in batches of 'batchSize' rules, 0 meaning no batch
+	double run(size_t count, size_t batchSize, std::vector<pi_entry_handle_t> *handles) {
+		ASSERT_SUCCESS(_pi_assign_device(DEV_ID, info, NULL));
+		pi_session_handle_t session;
+		ASSERT_SUCCESS(_pi_session_init(&session));
+
+		pi_match_key_t matchKey;
+		matchKey.p4info = info;
+		matchKey.table_id = tableId;
+		matchKey.priority = 0;
+		matchKey.data_size = keyData.size();
+		matchKey.data = keyData.data();
+
+		pi_action_data_t action;
+		action.p4info = info;
+		action.action_id = actionId;
+		action.data_size = actionData.size();
+		action.data = actionData.data();
+
+		pi_table_entry_t entry;
+		std::memset(&entry, 0, sizeof(entry));
+		entry.entry_type = PI_ACTION_ENTRY_TYPE_DATA;
+		entry.entry.action_data = &action;
+
+		pi_dev_tgt_t devTgt;
+		devTgt.dev_id = DEV_ID;
+		devTgt.dev_pipe_mask = 0xffff;
+
+		handles->resize(count);
+		auto start = Clock::now();
+		for (size_t i = 0; i < count; i++) {
+			if (batchSize > 0 and i % batchSize == 0) ASSERT_SUCCESS(_pi_batch_begin(session));
+			// Big-endian key, each rule has a different one
+			for (size_t b = 0; b < keyData.size(); b++) {
+				keyData[keyData.size() - 1 - b] = static_cast<char>((i >> (8 * b)) & 0xff);
+			}
+			ASSERT_SUCCESS(_pi_table_entry_add(session, devTgt, tableId, &matchKey, &entry, 0, &(*handles)[i]));
+			if (batchSize > 0 and (i + 1 == count or (i + 1) % batchSize == 0)) ASSERT_SUCCESS(_pi_batch_end(session, true));
+		}
+		double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+		auto stats = p4dev_mock_get_stats(&(devices[DEV_ID]));
+		std::cout << (batchSize > 0 ? "Batches of " + std::to_string(batchSize) : std::string("No batch"))
+		          << ": " << static_cast<uint64_t>(count / seconds) << " rules/s, "
+		          << stats.table_lookups << " table lookups, "
+		          << stats.rule_writes << " rule writes\n";
+
+		pi_table_fetch_res_t res;
+		ASSERT_SUCCESS(_pi_table_entries_fetch(session, DEV_ID, tableId, &res));
+		assert(res.num_entries == count);
+		ASSERT_SUCCESS(_pi_table_entries_fetch_done(session, &res));
+
+		ASSERT_SUCCESS(_pi_session_cleanup(session));
+		ASSERT_SUCCESS(_pi_remove_device(DEV_ID));
+		return seconds;
+	}
+};
+
+int main(int argc, char *argv[]) {
+	size_t count = (argc > 1) ? std::stoul(argv[1]) : 100000;
+	size_t batchSize = (argc > 2) ? std::stoul(argv[2]) : 1000;
+
+	pi_p4info_t *info;
+	ASSERT_SUCCESS(pi_add_config_from_file(TESTDATADIR "/serialize.json", PI_CONFIG_TYPE_BMV2_JSON, &info));
+	ASSERT_SUCCESS(_pi_init(NULL));
+
+	Bench bench;
+	bench.info = info;
+	bench.tableId = pi_p4info_table_id_from_name(info, "forward");
+	bench.actionId = pi_p4info_action_id_from_name(info, "set_dmac");
+	bench.keyData.resize(pi_p4info_table_match_key_size(info, bench.tableId));
+	bench.actionData.assign(pi_p4info_action_data_size(info, bench.actionId), 0x0a);
+
+	std::vector<pi_entry_handle_t> singleHandles, batchHandles;
+	double single = bench.run(count, 0, &singleHandles);
+	double batched = bench.run(count, batchSize, &batchHandles);
+	assert(singleHandles == batchHandles);
+	std::cout << "Speedup: " << single / batched << "\n";
+
+	ASSERT_SUCCESS(_pi_destroy());
+	pi_destroy_config(info);
+	return 0;
+}
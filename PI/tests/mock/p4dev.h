@@ -0,0 +1,114 @@
+#ifndef P4DEV_MOCK_H_
+#define P4DEV_MOCK_H_
+
+/**
+ *  \file
+ *  \brief In-memory stand-in for the part of libp4dev used by the PI implementation
+ *
+ *  \details Put this directory first on the include path and link with p4dev_mock.cpp
+ *  instead of -lp4dev to run the PI implementation without a Combo card. Rules are
+ *  appended to their table and keep pointers to the byte arrays they were created with,
+ *  like in libp4dev.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define P4DEV_OK 0
+#define P4DEV_ERROR 1
+#define P4DEV_ALLOCATE_ERROR 2
+#define P4DEV_NOT_IMPLEMENTED 3
+#define P4DEV_RULE_EXISTS 4
+#define P4DEV_RULE_NOT_FOUND 5
+#define P4DEV_TABLE_FULL 6
+
+#define P4DEVICE_DEFAULT_COMPONENT "mock"
+
+typedef enum {
+	P4ENGINE_UNKNOWN,
+	P4ENGINE_EXACT,
+	P4ENGINE_LPM,
+	P4ENGINE_TERNARY
+} p4engine_type_t;
+
+typedef struct p4key_elem_s {
+	const char *name;
+	uint32_t value_size;
+	uint8_t *value;
+	union {
+		uint8_t *mask;
+		uint32_t prefix_len;
+	} opt;
+	struct p4key_elem_s *next;
+} p4key_elem_t;
+
+typedef struct p4param_s {
+	const char *param_name;
+	uint32_t value_size;
+	uint8_t *value;
+	struct p4param_s *next;
+} p4param_t;
+
+typedef struct {
+	const char *table_name;
+	p4engine_type_t engine;
+	p4key_elem_t *key;
+	char *action;
+	p4param_t *params;
+	bool def;
+} p4rule_t;
+
+typedef struct p4table_s p4table_t;
+
+typedef struct {
+	void *tables; ///< Tables of the device, created when first accessed
+} p4device_t;
+
+uint32_t p4device_init(p4device_t *dev, const char *path, uint32_t dev_id, const char *component);
+uint32_t p4device_reset(p4device_t *dev);
+void p4device_free(p4device_t *dev);
+p4table_t *p4device_get_table(p4device_t *dev, const char *name);
+
+p4rule_t *p4rule_create(const char *table_name, p4engine_type_t engine);
+uint32_t p4rule_add_key_element(p4rule_t *rule, p4key_elem_t *key);
+uint32_t p4rule_add_action(p4rule_t *rule, const char *action);
+void p4rule_mark_default(p4rule_t *rule);
+void p4rule_free(p4rule_t *rule);
+
+p4key_elem_t *p4key_exact_create(const char *name, uint32_t size, uint8_t *value);
+p4key_elem_t *p4key_lpm_create(const char *name, uint32_t size, uint8_t *value, uint32_t prefix_len);
+p4key_elem_t *p4key_ternary_create(const char *name, uint32_t size, uint8_t *value, uint8_t *mask);
+p4param_t *p4param_create(const char *name, uint32_t size, uint8_t *value);
+
+uint32_t p4table_insert_rule(p4table_t *table, p4rule_t *rule, uint32_t *index, bool overwrite);
+uint32_t p4table_find_rule(p4table_t *table, p4key_elem_t *key, uint32_t *index);
+uint32_t p4table_delete_rule(p4table_t *table, uint32_t index);
+uint32_t p4table_modify_rule(p4table_t *table, uint32_t index, const char *action, p4param_t *params);
+p4rule_t *p4table_get_rule(p4table_t *table, uint32_t index);
+uint32_t p4table_get_size(p4table_t *table);
+p4rule_t *p4table_get_rule_template(p4table_t *table);
+uint32_t p4table_insert_default_rule(p4table_t *table, p4rule_t *rule);
+uint32_t p4table_reset_default_rule(p4table_t *table);
+p4rule_t *p4table_get_default_rule(p4table_t *table);
+
+void p4dev_err_stderr(uint32_t code);
+
+/**
+ *  \brief Mock only: number of calls which reached the device since it was initialized
+ */
+typedef struct {
+	uint64_t table_lookups; ///< p4device_get_table
+	uint64_t rule_writes; ///< p4table_insert_rule
+} p4dev_mock_stats_t;
+
+p4dev_mock_stats_t p4dev_mock_get_stats(const p4device_t *dev);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
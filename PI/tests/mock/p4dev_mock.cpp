@@ -0,0 +1,268 @@
+#include "p4dev.h"
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct p4table_s {
+	std::string name;
+	std::vector<p4rule_t*> rules;
+	std::unordered_map<std::string, uint32_t> index; ///< Rule index by key
+	p4engine_type_t engine = P4ENGINE_UNKNOWN; ///< Engine of the rules
+	p4rule_t *defaultRule = NULL;
+	p4dev_mock_stats_t *stats;
+};
+
+namespace {
+
+struct MockDevice {
+	std::map<std::string, std::unique_ptr<p4table_t>> tables;
+	p4dev_mock_stats_t stats = {0, 0};
+};
+
+MockDevice *getDevice(const p4device_t *dev) {
+	return static_cast<MockDevice*>(dev->tables);
+}
+
+// Key and parameter values belong to the caller, only the elements are freed
+void freeRule(p4rule_t *rule) {
+	if (rule == NULL) return;
+	p4key_elem_t *key = rule->key;
+	while (key != NULL) {
+		p4key_elem_t *next = key->next;
+		delete key;
+		key = next;
+	}
+	p4param_t *param = rule->params;
+	while (param != NULL) {
+		p4param_t *next = param->next;
+		delete param;
+		param = next;
+	}
+	delete[] rule->action;
+	delete rule;
+}
+
+void clearTable(p4table_t *table) {
+	for (auto *rule : table->rules) freeRule(rule);
+	table->rules.clear();
+	table->index.clear();
+	table->engine = P4ENGINE_UNKNOWN;
+	freeRule(table->defaultRule);
+	table->defaultRule = NULL;
+}
+
+std::string keyString(const p4key_elem_t *key, p4engine_type_t engine) {
+	std::string result;
+	for (; key != NULL; key = key->next) {
+		result.append(reinterpret_cast<const char*>(key->value), key->value_size);
+		if (engine == P4ENGINE_LPM) {
+			result.append(reinterpret_cast<const char*>(&(key->opt.prefix_len)), sizeof(key->opt.prefix_len));
+		}
+		else if (engine == P4ENGINE_TERNARY) {
+			result.append(reinterpret_cast<const char*>(key->opt.mask), key->value_size);
+		}
+	}
+	return result;
+}
+
+void rebuildIndex(p4table_t *table) {
+	table->index.clear();
+	for (uint32_t i = 0; i < table->rules.size(); i++) {
+		table->index[keyString(table->rules[i]->key, table->engine)] = i;
+	}
+}
+
+p4key_elem_t *createKey(const char *name, uint32_t size, uint8_t *value) {
+	p4key_elem_t *key = new p4key_elem_t;
+	key->name = name;
+	key->value_size = size;
+	key->value = value;
+	key->opt.mask = NULL;
+	key->next = NULL;
+	return key;
+}
+
+}
+
+extern "C" {
+
+uint32_t p4device_init(p4device_t *dev, const char *path, uint32_t dev_id, const char *component) {
+	(void) path;
+	(void) dev_id;
+	(void) component;
+	dev->tables = new MockDevice();
+	return P4DEV_OK;
+}
+
+uint32_t p4device_reset(p4device_t *dev) {
+	for (auto &table : getDevice(dev)->tables) clearTable(table.second.get());
+	return P4DEV_OK;
+}
+
+void p4device_free(p4device_t *dev) {
+	if (dev->tables == NULL) return;
+	p4device_reset(dev);
+	delete getDevice(dev);
+	dev->tables = NULL;
+}
+
+p4table_t *p4device_get_table(p4device_t *dev, const char *name) {
+	MockDevice *device = getDevice(dev);
+	device->stats.table_lookups++;
+	auto &table = device->tables[name];
+	if (not table) {
+		table.reset(new p4table_t);
+		table->name = name;
+		table->stats = &(device->stats);
+	}
+	return table.get();
+}
+
+p4rule_t *p4rule_create(const char *table_name, p4engine_type_t engine) {
+	p4rule_t *rule = new p4rule_t;
+	rule->table_name = table_name;
+	rule->engine = engine;
+	rule->key = NULL;
+	rule->action = NULL;
+	rule->params = NULL;
+	rule->def = false;
+	return rule;
+}
+
+uint32_t p4rule_add_key_element(p4rule_t *rule, p4key_elem_t *key) {
+	rule->key = key;
+	return P4DEV_OK;
+}
+
+uint32_t p4rule_add_action(p4rule_t *rule, const char *action) {
+	delete[] rule->action;
+	rule->action = new char[std::strlen(action) + 1];
+	std::strcpy(rule->action, action);
+	return P4DEV_OK;
+}
+
+void p4rule_mark_default(p4rule_t *rule) {
+	rule->def = true;
+}
+
+void p4rule_free(p4rule_t *rule) {
+	freeRule(rule);
+}
+
+p4key_elem_t *p4key_exact_create(const char *name, uint32_t size, uint8_t *value) {
+	return createKey(name, size, value);
+}
+
+p4key_elem_t *p4key_lpm_create(const char *name, uint32_t size, uint8_t *value, uint32_t prefix_len) {
+	p4key_elem_t *key = createKey(name, size, value);
+	key->opt.prefix_len = prefix_len;
+	return key;
+}
+
+p4key_elem_t *p4key_ternary_create(const char *name, uint32_t size, uint8_t *value, uint8_t *mask) {
+	p4key_elem_t *key = createKey(name, size, value);
+	key->opt.mask = mask;
+	return key;
+}
+
+p4param_t *p4param_create(const char *name, uint32_t size, uint8_t *value) {
+	p4param_t *param = new p4param_t;
+	param->param_name = name;
+	param->value_size = size;
+	param->value = value;
+	param->next = NULL;
+	return param;
+}
+
+uint32_t p4table_insert_rule(p4table_t *table, p4rule_t *rule, uint32_t *index, bool overwrite) {
+	table->stats->rule_writes++;
+	if (table->engine == P4ENGINE_UNKNOWN) table->engine = rule->engine;
+	else if (table->engine != rule->engine) return P4DEV_ERROR;
+
+	uint32_t existing;
+	if (p4table_find_rule(table, rule->key, &existing) == P4DEV_OK) {
+		if (not overwrite) return P4DEV_RULE_EXISTS;
+		freeRule(table->rules[existing]);
+		table->rules[existing] = rule;
+		*index = existing;
+		return P4DEV_OK;
+	}
+
+	*index = table->rules.size();
+	table->index[keyString(rule->key, table->engine)] = *index;
+	table->rules.push_back(rule);
+	return P4DEV_OK;
+}
+
+uint32_t p4table_find_rule(p4table_t *table, p4key_elem_t *key, uint32_t *index) {
+	auto it = table->index.find(keyString(key, table->engine));
+	if (it == table->index.end()) return P4DEV_RULE_NOT_FOUND;
+	*index = it->second;
+	return P4DEV_OK;
+}
+
+// Following rules are moved up, indices stay contiguous as _pi_table_entries_fetch expects
+uint32_t p4table_delete_rule(p4table_t *table, uint32_t index) {
+	if (index >= table->rules.size()) return P4DEV_RULE_NOT_FOUND;
+	freeRule(table->rules[index]);
+	table->rules.erase(table->rules.begin() + index);
+	rebuildIndex(table);
+	return P4DEV_OK;
+}
+
+uint32_t p4table_modify_rule(p4table_t *table, uint32_t index, const char *action, p4param_t *params) {
+	if (index >= table->rules.size()) return P4DEV_RULE_NOT_FOUND;
+	p4rule_t *rule = table->rules[index];
+	p4rule_add_action(rule, action);
+	p4param_t *param = rule->params;
+	while (param != NULL) {
+		p4param_t *next = param->next;
+		delete param;
+		param = next;
+	}
+	rule->params = params;
+	return P4DEV_OK;
+}
+
+p4rule_t *p4table_get_rule(p4table_t *table, uint32_t index) {
+	if (index >= table->rules.size()) return NULL;
+	return table->rules[index];
+}
+
+uint32_t p4table_get_size(p4table_t *table) {
+	return table->rules.size();
+}
+
+p4rule_t *p4table_get_rule_template(p4table_t *table) {
+	return p4rule_create(table->name.c_str(), P4ENGINE_UNKNOWN);
+}
+
+uint32_t p4table_insert_default_rule(p4table_t *table, p4rule_t *rule) {
+	freeRule(table->defaultRule);
+	table->defaultRule = rule;
+	return P4DEV_OK;
+}
+
+uint32_t p4table_reset_default_rule(p4table_t *table) {
+	freeRule(table->defaultRule);
+	table->defaultRule = NULL;
+	return P4DEV_OK;
+}
+
+p4rule_t *p4table_get_default_rule(p4table_t *table) {
+	return table->defaultRule;
+}
+
+void p4dev_err_stderr(uint32_t code) {
+	std::fprintf(stderr, "p4dev mock error %u\n", code);
+}
+
+p4dev_mock_stats_t p4dev_mock_get_stats(const p4device_t *dev) {
+	return getDevice(dev)->stats;
+}
+
+}
@@ -26,6 +26,7 @@
 #include <mutex>
 #include <memory>
 #include <functional>
+#include <cstddef>
 
 namespace bm_apps {
 
@@ -37,6 +38,17 @@ class PacketInject {
   using PacketReceiveCb = std::function<void(int port_num, const char *buffer,
                                              int len, void *cookie)>;
 
+  struct Packet {
+    int port_num;
+    const char *buffer;
+    int len;
+  };
+
+  // addr is either a nanomsg address or shm://<path>, in which case packets
+  // are exchanged with bmv2 through shared-memory rings and the connection is
+  // established on the Unix socket <path> (bmv2 needs to be started with the
+  // same --packet-in address); the connection is made lazily and re-established
+  // if bmv2 is restarted
   explicit PacketInject(const std::string &addr);
 
   ~PacketInject();
@@ -47,6 +59,10 @@ class PacketInject {
 
   void send(int port_num, const char *buffer, int len);
 
+  // sends several packets at once, which is much cheaper than calling send()
+  // for each packet with the shm transport, as bmv2 is only notified once
+  void send_burst(const Packet *packets, size_t count);
+
   // these 4 port_* functions are optional, depending on receiver configuration
   void port_add(int port_num);
 
@@ -49,6 +49,7 @@
 #include "enums.h"
 #include "control_action.h"
 #include "device_id.h"
+#include "profiling.h"
 
 // forward declaration of Json::Value
 namespace Json {
@@ -107,6 +108,16 @@ class P4Objects {
                      std::set<header_field_pair>(),
                    const ForceArith &arith_objects = ForceArith());
 
+  // same as above, for a config which has already been parsed, e.g. when the
+  // same config is used for several contexts
+  int init_objects(const Json::Value &cfg_root,
+                   LookupStructureFactory *lookup_factory,
+                   device_id_t device_id = 0, cxt_id_t cxt_id = 0,
+                   std::shared_ptr<TransportIface> transport = nullptr,
+                   const std::set<header_field_pair> &required_fields =
+                     std::set<header_field_pair>(),
+                   const ForceArith &arith_objects = ForceArith());
+
   P4Objects(const P4Objects &other) = delete;
   P4Objects &operator=(const P4Objects &) = delete;
 
@@ -126,6 +137,55 @@ class P4Objects {
   void serialize(std::ostream *out) const;
   void deserialize(std::istream *in);
 
+  // binary snapshot, one section per table, action profile and meter array; if
+  // chunk_size is not 0, the tables are written chunk_size entries at a time,
+  // see MatchTableAbstract::serialize()
+  void serialize(SnapshotWriter *out, size_t chunk_size) const;
+  // returns false if the snapshot is invalid or does not match the objects
+  bool deserialize(SnapshotReader *in);
+
+  // returned by migrate_state()
+  struct MigrationStats {
+    size_t tables{0};
+    size_t entries{0};
+    // entries (and action profile members) whose action no longer exists or
+    // takes a different number of parameters, or which do not fit in the new
+    // table
+    size_t skipped_entries{0};
+    size_t action_profiles{0};
+    size_t counter_arrays{0};
+    size_t register_arrays{0};
+    size_t meter_arrays{0};
+  };
+
+  // Used for config swaps: copies the runtime state of old_objects (the
+  // previous configuration) which is compatible with these objects, so that
+  // traffic does not hit empty tables after the swap:
+  //   - the entries of the tables with the same name, type and match key (see
+  //     MatchTableAbstract::has_same_key()), including their TTL, direct
+  //     counters and direct meter rates, and the default entry if it was set
+  //     by the control plane; actions are matched by name
+  //   - the members and groups of the action profiles with the same name
+  //   - the counter, register and meter arrays with the same name and
+  //     dimensions
+  // Tables with const entries in the old program are not migrated. Meant to be
+  // called on a newly-loaded configuration, before it is exposed to the
+  // control plane.
+  MigrationStats migrate_state(const P4Objects &old_objects);
+
+  // Carries over the updates made by the packets processed by old_objects to
+  // the counters (including the direct counters of the migrated entries) and
+  // registers migrated by migrate_state(), since they were migrated: what
+  // these packets counted is added to the counters, and the registers they
+  // modified are copied, unless they were modified in these objects as
+  // well. Meant to be called once no packet uses old_objects any more, see
+  // P4ObjectsReaper; packets and the control plane may be using these objects
+  // in the meantime. Each register array is locked while it is updated.
+  void migrate_packet_state(const P4Objects &old_objects);
+
+  ProfilingStats get_profiling_stats() const;
+  void reset_profiling_stats();
+
   enum class IdLookupErrorCode {
     SUCCESS,
     INVALID_RESOURCE_TYPE,
@@ -481,6 +541,8 @@ class P4Objects {
 
   // meter arrays
   std::unordered_map<std::string, std::unique_ptr<MeterArray> > meter_arrays{};
+  // the meter arrays used as direct meters, which are indexed by entry handle
+  std::set<std::string> direct_meter_arrays{};
 
   // counter arrays
   std::unordered_map<std::string, std::unique_ptr<CounterArray> >
@@ -515,6 +577,28 @@ class P4Objects {
 
   ConfigOptionMap config_options{};
 
+  // set by migrate_state() for migrate_packet_state(), along with the values
+  // copied at the time; (bytes, packets) for the counters
+  using CounterValues = std::vector<
+    std::pair<Counter::counter_value_t, Counter::counter_value_t> >;
+  struct MigratedCounters {
+    std::string table_name;
+    // (old handle, new handle) for each migrated entry
+    std::vector<std::pair<entry_handle_t, entry_handle_t> > handles;
+    CounterValues values;
+  };
+  struct MigratedCounterArray {
+    std::string name;
+    CounterValues values;
+  };
+  struct MigratedRegisterArray {
+    std::string name;
+    std::vector<Data> values;
+  };
+  std::vector<MigratedCounters> migrated_direct_counters{};
+  std::vector<MigratedCounterArray> migrated_counter_arrays{};
+  std::vector<MigratedRegisterArray> migrated_register_arrays{};
+
   // maps primitive names to primitive instances
   std::unordered_map<std::string, std::unique_ptr<ActionPrimitive_>>
       primitives{};
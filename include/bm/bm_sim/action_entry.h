@@ -40,6 +40,8 @@ struct ActionEntry {
 
   void serialize(std::ostream *out) const;
   void deserialize(std::istream *in, const P4Objects &objs);
+  void serialize(SnapshotWriter *out) const;
+  void deserialize(SnapshotReader *in, const P4Objects &objs);
 
   friend std::ostream& operator<<(std::ostream &out, const ActionEntry &e) {
     e.dump(&out);
@@ -31,6 +31,7 @@
 #include "action_entry.h"
 #include "calculations.h"
 #include "handle_mgr.h"
+#include "lock_stats.h"
 #include "match_error_codes.h"
 #include "ras.h"
 
@@ -70,6 +71,8 @@ class ActionProfile : public NamedP4Object {
 
     void serialize(std::ostream *out) const;
     void deserialize(std::istream *in, const P4Objects &objs);
+    void serialize(SnapshotWriter *out) const;
+    void deserialize(SnapshotReader *in, const P4Objects &objs);
 
     static IndirectIndex make_mbr_index(unsigned int index) {
       assert(index <= _index_mask);
@@ -162,10 +165,12 @@ class ActionProfile : public NamedP4Object {
 
   void serialize(std::ostream *out) const;
   void deserialize(std::istream *in, const P4Objects &objs);
+  void serialize(SnapshotWriter *out) const;
+  void deserialize(SnapshotReader *in, const P4Objects &objs);
 
  private:
-  using ReadLock = boost::shared_lock<boost::shared_mutex>;
-  using WriteLock = boost::unique_lock<boost::shared_mutex>;
+  using ReadLock = boost::shared_lock<InstrumentedSharedMutex>;
+  using WriteLock = boost::unique_lock<InstrumentedSharedMutex>;
 
   class IndirectIndexRefCount {
    public:
@@ -205,6 +210,8 @@ class ActionProfile : public NamedP4Object {
 
     void serialize(std::ostream *out) const;
     void deserialize(std::istream *in);
+    void serialize(SnapshotWriter *out) const;
+    void deserialize(SnapshotReader *in);
 
    private:
     std::vector<count_t> mbr_count{};
@@ -230,6 +237,8 @@ class ActionProfile : public NamedP4Object {
 
     void serialize(std::ostream *out) const;
     void deserialize(std::istream *in);
+    void serialize(SnapshotWriter *out) const;
+    void deserialize(SnapshotReader *in);
 
    private:
     RandAccessUIntSet mbrs{};
@@ -293,7 +302,7 @@ class ActionProfile : public NamedP4Object {
                             const IndirectIndex &index) const;
 
  private:
-  mutable boost::shared_mutex t_mutex{};
+  mutable InstrumentedSharedMutex t_mutex{};
   bool with_selection;
   std::vector<ActionEntry> action_entries{};
   IndirectIndexRefCount index_ref_count{};
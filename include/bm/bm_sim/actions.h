@@ -84,11 +84,14 @@
 #include "named_p4object.h"
 #include "expressions.h"
 #include "stateful.h"
+#include "profiling.h"
 #include "_assert.h"
 
 namespace bm {
 
 class P4Objects;  // forward declaration for deserialize
+class SnapshotWriter;  // forward declarations for binary snapshots
+class SnapshotReader;
 
 // some forward declarations for needed p4 objects
 class Packet;
@@ -671,7 +674,16 @@ class ActionFn :  public NamedP4Object {
 
   size_t get_num_params() const;
 
+  // executions are counted every time the action is called through an
+  // ActionFnEntry, the execution time is sampled, see ProfilingCounters
+  ProfilingStats::Action get_profiling_stats() const;
+  void reset_profiling_stats();
+
  private:
+  enum ProfilingCounter : size_t {
+    PROF_EXECUTIONS, PROF_SAMPLES, PROF_NS, PROF_NB_COUNTERS
+  };
+
   std::vector<ActionPrimitiveCall> primitives{};
   std::vector<ActionParam> params{};
   RegisterSync register_sync{};
@@ -680,6 +692,7 @@ class ActionFn :  public NamedP4Object {
   std::vector<std::unique_ptr<ArithExpression> > expressions{};
   std::vector<std::string> strings{};
   size_t num_params;
+  ProfilingCounters profiling_counters{PROF_NB_COUNTERS};
 
  private:
   static size_t nb_data_tmps;
@@ -721,6 +734,8 @@ class ActionFnEntry {
 
   void serialize(std::ostream *out) const;
   void deserialize(std::istream *in, const P4Objects &objs);
+  void serialize(SnapshotWriter *out) const;
+  void deserialize(SnapshotReader *in, const P4Objects &objs);
 
   p4object_id_t get_action_id() const {
     if (!action_fn) return std::numeric_limits<p4object_id_t>::max();
@@ -0,0 +1,198 @@
+/* Copyright 2013-present Barefoot Networks, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Antonin Bas (antonin@barefootnetworks.com)
+ *
+ */
+
+//! @file aqm.h
+//! Active queue management algorithms which a target can attach to its egress
+//! queues. A QueueAQM object is meant to be associated with a single queue: the
+//! target calls QueueAQM::on_enqueue before inserting a packet into the queue
+//! and QueueAQM::on_dequeue after removing it, and drops or marks the packet
+//! according to the returned verdict. Both calls are O(1).
+
+#ifndef BM_BM_SIM_AQM_H_
+#define BM_BM_SIM_AQM_H_
+
+#include <atomic>
+#include <mutex>
+
+#include <cstdint>
+#include <cstddef>
+
+namespace bm {
+
+//! Active queue management for a single queue. Supported algorithms are RED
+//! (configuring different RED parameters for the different priority queues of
+//! a port gives WRED), CoDel (RFC 8289) and PIE (RFC 8033). ECN marking can be
+//! enabled for all of them, in which case ECN-capable packets are marked
+//! instead of being dropped (RED above its maximum threshold and PIE with a
+//! high drop probability will still drop them).
+//!
+//! RED makes its decision at enqueue time, based on an exponentially weighted
+//! average of the queue depth. CoDel makes its decision at dequeue time, based
+//! on the time spent by the packet in the queue. PIE makes its decision at
+//! enqueue time, using a drop probability which is periodically updated based
+//! on the queueing delay of dequeued packets.
+//!
+//! All methods are thread-safe.
+class QueueAQM {
+ public:
+  enum class Mode {
+    NONE,
+    RED,
+    CODEL,
+    PIE
+  };
+
+  enum class Verdict {
+    PASS,
+    MARK,
+    DROP
+  };
+
+  enum AQMErrorCode {
+    SUCCESS = 0,
+    INVALID_THRESHOLDS,
+    INVALID_PROBABILITY,
+    INVALID_WEIGHT,
+    INVALID_TIME_VALUE
+  };
+
+  struct RedConfig {
+    //! minimum threshold for the average queue depth, in packets
+    size_t min_th;
+    //! maximum threshold for the average queue depth, in packets
+    size_t max_th;
+    //! marking / dropping probability when the average depth reaches max_th
+    double max_p;
+    //! the weight of the moving average is `2^-weight_shift`
+    unsigned int weight_shift;
+    bool ecn;
+  };
+
+  struct CodelConfig {
+    //! acceptable standing queue delay, in microseconds
+    uint64_t target_us;
+    //! sliding window over which the minimum delay is computed, in microseconds
+    uint64_t interval_us;
+    bool ecn;
+  };
+
+  struct PieConfig {
+    //! target queueing delay, in microseconds
+    uint64_t target_us;
+    //! update period of the drop probability, in microseconds
+    uint64_t t_update_us;
+    //! burst allowance, in microseconds
+    uint64_t max_burst_us;
+    bool ecn;
+  };
+
+  struct Counters {
+    uint64_t drops;
+    uint64_t marks;
+  };
+
+  //! Weight recommended by the original RED paper (1/512)
+  static constexpr unsigned int default_red_weight_shift = 9u;
+
+  QueueAQM();
+
+  //! Disables AQM for this queue, every packet gets Verdict::PASS
+  void disable();
+
+  AQMErrorCode set_red(const RedConfig &config);
+  AQMErrorCode set_codel(const CodelConfig &config);
+  AQMErrorCode set_pie(const PieConfig &config);
+
+  //! Does not acquire the lock, so targets can cheaply skip the AQM logic
+  //! (e.g. ECN-capability checks) for queues without AQM
+  Mode get_mode() const;
+
+  //! To be called before a packet is inserted into the queue. \p qdepth is the
+  //! number of packets in the queue (not including this one), \p now_us is the
+  //! current time in microseconds and \p ecn_capable indicates whether the
+  //! packet is ECN-capable. If the verdict is Verdict::DROP, the packet should
+  //! not be enqueued.
+  Verdict on_enqueue(size_t qdepth, uint64_t now_us, bool ecn_capable);
+
+  //! To be called after a packet is removed from the queue. \p sojourn_us is
+  //! the time the packet spent in the queue, \p qdepth the number of packets
+  //! left in the queue.
+  Verdict on_dequeue(uint64_t sojourn_us, size_t qdepth, uint64_t now_us,
+                     bool ecn_capable);
+
+  Counters get_counters() const;
+  void reset_counters();
+
+ private:
+  struct RedState {
+    RedConfig config;
+    // average queue depth, fixed-point with avg_frac_bits fractional bits
+    uint64_t avg;
+    // number of packets since the last mark / drop
+    int count;
+  };
+
+  struct CodelState {
+    CodelConfig config;
+    uint64_t first_above_time;
+    uint64_t drop_next;
+    uint32_t count;
+    uint32_t lastcount;
+    bool dropping;
+  };
+
+  struct PieState {
+    PieConfig config;
+    double drop_prob;
+    double accu_prob;
+    uint64_t qdelay;
+    uint64_t qdelay_old;
+    uint64_t burst_allowance;
+    uint64_t last_update;
+  };
+
+  static constexpr unsigned int avg_frac_bits = 16u;
+
+  Verdict red_enqueue(size_t qdepth, bool ecn_capable);
+  Verdict codel_dequeue(uint64_t sojourn_us, size_t qdepth, uint64_t now_us,
+                        bool ecn_capable);
+  Verdict pie_enqueue(size_t qdepth, uint64_t now_us, bool ecn_capable);
+  void pie_update_prob();
+
+  uint64_t codel_control_law(uint64_t t) const;
+
+  Verdict congestion(bool ecn, bool ecn_capable);
+  Verdict drop();
+
+  // returns a random number in [0, 1)
+  double random_uniform();
+
+  mutable std::mutex mutex{};
+  std::atomic<Mode> mode{Mode::NONE};
+  RedState red{};
+  CodelState codel{};
+  PieState pie{};
+  Counters counters{};
+  uint64_t rng_state;
+};
+
+}  // namespace bm
+
+#endif  // BM_BM_SIM_AQM_H_
@@ -26,6 +26,7 @@
 #include "phv.h"
 #include "control_flow.h"
 #include "expressions.h"
+#include "profiling.h"
 
 namespace bm {
 
@@ -53,6 +54,9 @@ class Conditional
   // return pointer to next control flow node
   const ControlFlowNode *operator()(Packet *pkt) const override;
 
+  ProfilingStats::Conditional get_profiling_stats() const;
+  void reset_profiling_stats();
+
   Conditional(const Conditional &other) = delete;
   Conditional &operator=(const Conditional &other) = delete;
 
@@ -60,8 +64,13 @@ class Conditional
   Conditional &operator=(Conditional &&other) /*noexcept*/ = default;
 
  private:
+  enum ProfilingCounter : size_t {
+    PROF_EVALUATIONS, PROF_TRUE, PROF_NB_COUNTERS
+  };
+
   ControlFlowNode *true_next{nullptr};
   ControlFlowNode *false_next{nullptr};
+  ProfilingCounters profiling_counters{PROF_NB_COUNTERS};
 };
 
 }  // namespace bm
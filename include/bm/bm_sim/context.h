@@ -52,7 +52,12 @@
 #include <iosfwd>
 #include <mutex>
 #include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
 #include <string>
+#include <thread>
+#include <utility>
 #include <vector>
 #include <set>
 #include <typeindex>
@@ -66,6 +71,44 @@
 
 namespace bm {
 
+class PHVSourceIface;
+
+// Releases the P4Objects swapped out by Context::do_swap() once the last Packet
+// created with them is destroyed. Before that, the counter and register updates
+// made by these packets are carried over to the configuration which replaced
+// them, see P4Objects::migrate_packet_state(). This is done by a single
+// background thread, shared by all the contexts of a switch and started by the
+// first swap, since destroying a large configuration takes a while.
+class P4ObjectsReaper {
+ public:
+  // calls stop()
+  ~P4ObjectsReaper();
+
+  // new_objects is the configuration which replaced old_objects, if any
+  void retire(std::shared_ptr<P4Objects> old_objects,
+              std::shared_ptr<P4Objects> new_objects);
+
+  // releases the objects still in the queue and joins the thread, after which
+  // retire() does the work in the calling thread
+  void stop();
+
+  // what the background thread does for each call to retire()
+  static void release(std::shared_ptr<P4Objects> old_objects,
+                      std::shared_ptr<P4Objects> new_objects);
+
+ private:
+  using Retired =
+      std::pair<std::shared_ptr<P4Objects>, std::shared_ptr<P4Objects> >;
+
+  void loop();
+
+  std::mutex mutex{};
+  std::condition_variable cv{};
+  std::deque<Retired> queue{};
+  bool stopped{false};
+  std::thread thread{};
+};
+
 //! Provides safe access to an extern instance for control plane calls.
 class ExternSafeAccess {
  public:
@@ -96,6 +139,8 @@ class Context final {
 
   using ErrorCode = RuntimeInterface::ErrorCode;
 
+  using MtWriteOp = RuntimeInterface::MtWriteOp;
+
  public:
   // needs to be default constructible if I want to put it in a std::vector
   Context();
@@ -124,27 +169,59 @@ class Context final {
   // TODO(antonin): should I return shared_ptrs instead of raw_ptrs?
 
   //! Get a raw, non-owning pointer to the Pipeline object with P4 name \p
-  //! name. Return a nullptr if there is no pipeline with this name.
+  //! name. Return a nullptr if there is no pipeline with this name. The pointer
+  //! is invalidated by a configuration swap, see switch.h documentation.
   Pipeline *get_pipeline(const std::string &name) {
-    return p4objects->get_pipeline_rt(name);
+    return current_objects()->get_pipeline_rt(name);
   }
 
   //! Get a raw, non-owning pointer to the Parser object with P4 name \p
-  //! name. Return a nullptr if there is no parser with this name.
+  //! name. Return a nullptr if there is no parser with this name. The pointer
+  //! is invalidated by a configuration swap, see switch.h documentation.
   Parser *get_parser(const std::string &name) {
-    return p4objects->get_parser_rt(name);
+    return current_objects()->get_parser_rt(name);
   }
 
   //! Get a raw, non-owning pointer to the Deparser object with P4 name \p
-  //! name. Return a nullptr if there is no deparser with this name.
+  //! name. Return a nullptr if there is no deparser with this name. The pointer
+  //! is invalidated by a configuration swap, see switch.h documentation.
   Deparser *get_deparser(const std::string &name) {
-    return p4objects->get_deparser_rt(name);
+    return current_objects()->get_deparser_rt(name);
   }
 
   //! Get a raw, non-owning pointer to the FieldList object with id
-  //! \p field_list_id
+  //! \p field_list_id. The pointer is invalidated by a configuration swap, see
+  //! switch.h documentation.
   FieldList *get_field_list(const p4object_id_t field_list_id) {
-    return p4objects->get_field_list(field_list_id);
+    return current_objects()->get_field_list(field_list_id);
+  }
+
+  //! Get a raw, non-owning pointer to the Pipeline object with P4 name \p
+  //! name, in the configuration \p packet was created with. Unlike with
+  //! get_pipeline(const std::string &), the pointer remains valid for as long
+  //! as \p packet exists, even if the configuration is swapped out in the
+  //! meantime.
+  Pipeline *get_pipeline(const Packet &packet, const std::string &name) {
+    return packet_objects_of(packet)->get_pipeline_rt(name);
+  }
+
+  //! Same as get_pipeline(const Packet &, const std::string &), for the
+  //! Parser object with P4 name \p name.
+  Parser *get_parser(const Packet &packet, const std::string &name) {
+    return packet_objects_of(packet)->get_parser_rt(name);
+  }
+
+  //! Same as get_pipeline(const Packet &, const std::string &), for the
+  //! Deparser object with P4 name \p name.
+  Deparser *get_deparser(const Packet &packet, const std::string &name) {
+    return packet_objects_of(packet)->get_deparser_rt(name);
+  }
+
+  //! Same as get_pipeline(const Packet &, const std::string &), for the
+  //! FieldList object with id \p field_list_id.
+  FieldList *get_field_list(const Packet &packet,
+                            const p4object_id_t field_list_id) {
+    return packet_objects_of(packet)->get_field_list(field_list_id);
   }
 
   //! Obtain a pointer to an extern instance, wrapped inside an ExternSafeAccess
@@ -197,6 +274,9 @@ class Context final {
                   const std::string &action_name,
                   ActionData action_data);
 
+  MatchErrorCode
+  mt_write_entries(std::vector<MtWriteOp> *ops, bool atomic);
+
   MatchErrorCode
   mt_set_entry_ttl(const std::string &table_name,
                    entry_handle_t handle,
@@ -298,6 +378,12 @@ class Context final {
   std::vector<typename T::Entry>
   mt_get_entries(const std::string &table_name) const;
 
+  template <typename T>
+  MatchErrorCode
+  mt_get_entries(const std::string &table_name, size_t *cursor,
+                 size_t max_entries, std::vector<typename T::Entry> *entries,
+                 bool *more) const;
+
   template <typename T>
   MatchErrorCode
   mt_get_entry(const std::string &table_name, entry_handle_t handle,
@@ -324,6 +410,14 @@ class Context final {
   MatchErrorCode
   mt_reset_counters(const std::string &table_name);
 
+  MatchErrorCode
+  mt_read_all_counters(
+      const std::string &table_name,
+      std::vector<entry_handle_t> *handles,
+      std::vector<MatchTableAbstract::counter_value_t> *bytes,
+      std::vector<MatchTableAbstract::counter_value_t> *packets,
+      bool reset);
+
   MatchErrorCode
   mt_write_counters(const std::string &table_name,
                     entry_handle_t handle,
@@ -347,6 +441,20 @@ class Context final {
   Counter::CounterErrorCode
   reset_counters(const std::string &counter_name);
 
+  Counter::CounterErrorCode
+  read_counters_range(
+      const std::string &counter_name, size_t start, size_t end,
+      std::vector<MatchTableAbstract::counter_value_t> *bytes,
+      std::vector<MatchTableAbstract::counter_value_t> *packets,
+      bool reset);
+
+  Counter::CounterErrorCode
+  read_all_counters(
+      const std::string &counter_name,
+      std::vector<MatchTableAbstract::counter_value_t> *bytes,
+      std::vector<MatchTableAbstract::counter_value_t> *packets,
+      bool reset);
+
   Counter::CounterErrorCode
   write_counters(const std::string &counter_name,
                  size_t index,
@@ -366,6 +474,11 @@ class Context final {
   meter_get_rates(const std::string &meter_name, size_t idx,
                   std::vector<Meter::rate_config_t> *configs);
 
+  MeterErrorCode
+  meter_array_get_rates(
+      const std::string &meter_name,
+      std::vector<std::vector<Meter::rate_config_t> > *configs);
+
   RegisterErrorCode
   register_read(const std::string &register_name,
                 const size_t idx, Data *value);
@@ -425,6 +538,10 @@ class Context final {
 
   LearnEngineIface *get_learn_engine();
 
+  LearnEngineIface *get_learn_engine(const Packet &packet) {
+    return packet_objects_of(packet)->get_learn_engine();
+  }
+
   AgeingMonitorIface *get_ageing_monitor();
 
   void set_notifications_transport(std::shared_ptr<TransportIface> transport);
@@ -437,18 +554,22 @@ class Context final {
 
   using header_field_pair = P4Objects::header_field_pair;
   using ForceArith = P4Objects::ForceArith;
-  int init_objects(std::istream *is,
+  // the config is parsed once by SwitchWContexts for all the contexts
+  int init_objects(const Json::Value &cfg_root,
                    LookupStructureFactory * lookup_factory,
                    const std::set<header_field_pair> &required_fields =
                      std::set<header_field_pair>(),
                    const ForceArith &arith_objects = ForceArith());
 
+  // if migrate_state is true, the compatible state of the current objects is
+  // copied to the new ones, see P4Objects::migrate_state()
   ErrorCode load_new_config(
-      std::istream *is,
+      const Json::Value &cfg_root,
       LookupStructureFactory * lookup_factory,
       const std::set<header_field_pair> &required_fields =
         std::set<header_field_pair>(),
-      const ForceArith &arith_objects = ForceArith());
+      const ForceArith &arith_objects = ForceArith(),
+      bool migrate_state = false);
 
   ErrorCode swap_configs();
 
@@ -457,7 +578,41 @@ class Context final {
   ErrorCode serialize(std::ostream *out);
   ErrorCode deserialize(std::istream *in);
 
-  int do_swap();
+  // binary snapshot; if chunk_size is not 0, runtime requests are not blocked
+  // and the tables are written chunk_size entries at a time (see
+  // P4Objects::serialize())
+  ErrorCode serialize(SnapshotWriter *out, size_t chunk_size);
+  ErrorCode deserialize(SnapshotReader *in);
+
+  ProfilingStats get_profiling_stats() const;
+  void reset_profiling_stats();
+
+  // publishes the new objects to the packets created from now on, after
+  // setting their PHVFactory in phv_source; does not wait for the packets
+  // created with the old objects, which are given to the reaper when the last
+  // of them is destroyed
+  int do_swap(PHVSourceIface *phv_source);
+
+  // the objects swapped out by do_swap() are released by reaper
+  void set_reaper(std::shared_ptr<P4ObjectsReaper> reaper);
+
+  // what a new Packet refers to, see Packet::p4objects
+  std::shared_ptr<P4Objects> get_packet_objects() const {
+    return std::atomic_load(&packet_objects);
+  }
+
+  P4Objects *current_objects() const {
+    return get_packet_objects().get();
+  }
+
+  P4Objects *packet_objects_of(const Packet &packet) const {
+    return packet.p4objects ? packet.p4objects.get() : current_objects();
+  }
+
+  // the shared pointer given to packets for objects, its deleter hands objects
+  // to the reaper instead of destroying them
+  std::shared_ptr<P4Objects> make_packet_objects(
+      std::shared_ptr<P4Objects> objects) const;
 
   int swap_requested() { return swap_ordered; }
 
@@ -476,6 +631,11 @@ class Context final {
 
   std::shared_ptr<P4Objects> p4objects{nullptr};
   std::shared_ptr<P4Objects> p4objects_rt{nullptr};
+  // same objects as p4objects, accessed atomically since it is read by the
+  // packet processing threads while do_swap() writes it
+  std::shared_ptr<P4Objects> packet_objects{nullptr};
+
+  std::shared_ptr<P4ObjectsReaper> reaper{nullptr};
 
   std::unordered_map<std::type_index, std::shared_ptr<void> > components{};
 
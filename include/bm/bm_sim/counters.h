@@ -72,10 +72,20 @@ class Counter {
 
   CounterErrorCode reset_counter();
 
+  //! Reads and resets the counter. Each value is swapped atomically with 0, so
+  //! an increment concurrent with the call is counted in this read or in the
+  //! next one, but is never lost.
+  CounterErrorCode query_and_reset_counter(counter_value_t *bytes,
+                                           counter_value_t *packets);
+
   // in case something more general than reset is needed
   CounterErrorCode write_counter(counter_value_t bytes,
                                  counter_value_t packets);
 
+  // adds to both values atomically, used to carry over the increments made to
+  // the same counter in a configuration which was swapped out
+  CounterErrorCode add_counter(counter_value_t bytes, counter_value_t packets);
+
   void serialize(std::ostream *out) const;
   void deserialize(std::istream *in);
 
@@ -109,6 +119,15 @@ class CounterArray : public NamedP4Object {
 
   CounterErrorCode reset_counters();
 
+  //! Reads the counters with index in [\p start, \p end) into \p bytes and
+  //! \p packets, which are resized accordingly. If \p reset is true, each
+  //! counter is reset as it is read (see Counter::query_and_reset_counter()).
+  //! Returns Counter::INVALID_INDEX if the range is not valid.
+  CounterErrorCode read_counters(size_t start, size_t end,
+                                 std::vector<Counter::counter_value_t> *bytes,
+                                 std::vector<Counter::counter_value_t> *packets,
+                                 bool reset = false);
+
   //! Access the counter at position \p idx, asserts if bad \p idx
   Counter &get_counter(size_t idx) {
     return counters[idx];
@@ -38,8 +38,10 @@
 #include <functional>
 #include <string>
 #include <map>
+#include <utility>  // std::move
 
 #include "packet_handler.h"
+#include "pcap_replay.h"
 #include "port_monitor.h"
 
 namespace bm {
@@ -53,6 +55,28 @@ class DevMgrIface : public PacketDispatcherIface {
 
   static constexpr char kPortExtraInPcap[] = "in_pcap";
   static constexpr char kPortExtraOutPcap[] = "out_pcap";
+  // when capturing packets to the pcap files above, start a new file when the
+  // current one reaches that many bytes / after that many seconds
+  static constexpr char kPortExtraPcapRotateSize[] = "pcap_rotate_size";
+  static constexpr char kPortExtraPcapRotateInterval[] = "pcap_rotate_interval";
+  // use an AF_XDP socket for this port, the value is the XDP mode ("skb",
+  // "drv" or "zc"), see AfXdpPortMgr
+  static constexpr char kPortExtraAfXdp[] = "af_xdp";
+  // the NIC queue to bind the AF_XDP socket to, 0 by default
+  static constexpr char kPortExtraAfXdpQueue[] = "af_xdp_queue";
+  // generate packets in-process on this port instead of receiving them from an
+  // interface, the value is the rate ("fast", "<N>pps" or "<N>bps"); the other
+  // traffic_gen_* extras configure the generated packets, see
+  // TrafficGenPortMgr
+  static constexpr char kPortExtraTrafficGen[] = "traffic_gen";
+  static constexpr char kPortExtraTrafficGenFlows[] = "traffic_gen_flows";
+  static constexpr char kPortExtraTrafficGenSize[] = "traffic_gen_size";
+  static constexpr char kPortExtraTrafficGenRandomize[] =
+      "traffic_gen_randomize";
+  static constexpr char kPortExtraTrafficGenCount[] = "traffic_gen_count";
+  // count and drop the packets transmitted to this port, and measure their
+  // latency if they come from a traffic generator port
+  static constexpr char kPortExtraTrafficSink[] = "traffic_sink";
 
   struct PortInfo {
     PortInfo(port_t port_num, const std::string &iface_name,
@@ -85,6 +109,15 @@ class DevMgrIface : public PacketDispatcherIface {
     }
   };
 
+  //! A packet to transmit with transmit_burst(): the first \p len bytes of the
+  //! buffer data are sent (\p len can be smaller than the data size of the
+  //! buffer if the packet was truncated)
+  struct TxPacket {
+    port_t port_num;
+    PacketBuffer buffer;
+    int len;
+  };
+
   virtual ~DevMgrIface();
 
   ReturnCode port_add(const std::string &iface_name, port_t port_num,
@@ -99,11 +132,27 @@ class DevMgrIface : public PacketDispatcherIface {
     transmit_fn_(port_num, buffer, len);
   }
 
+  // same as transmit_fn, but the implementation takes ownership of the buffer,
+  // which lets it place the packet memory directly in a TX ring and release it
+  // on completion, instead of copying it
+  void transmit_buffer(port_t port_num, PacketBuffer &&buffer, int len) {
+    transmit_buffer_(port_num, std::move(buffer), len);
+  }
+
+  // transmits a batch of packets, which lets the implementation notify the
+  // kernel once for the whole batch; the buffers are consumed
+  void transmit_burst(TxPacket *packets, size_t count) {
+    transmit_burst_(packets, count);
+  }
+
   // start the thread that performs packet processing
   void start();
 
   ReturnCode set_packet_handler(const PacketHandler &handler, void *cookie);
 
+  ReturnCode set_packet_buffer_handler(const PacketBufferHandler &handler,
+                                       void *cookie) override;
+
   bool port_is_up(port_t port_num) const;
 
   ReturnCode register_status_cb(const PortStatus &type,
@@ -126,11 +175,19 @@ class DevMgrIface : public PacketDispatcherIface {
 
   virtual void transmit_fn_(port_t port_num, const char *buffer, int len) = 0;
 
+  // the default implementations rely on transmit_fn_
+  virtual void transmit_buffer_(port_t port_num, PacketBuffer &&buffer,
+                                int len);
+  virtual void transmit_burst_(TxPacket *packets, size_t count);
+
   virtual void start_() = 0;
 
   virtual ReturnCode set_packet_handler_(const PacketHandler &handler,
                                          void *cookie) = 0;
 
+  virtual ReturnCode set_packet_buffer_handler_(
+      const PacketBufferHandler &handler, void *cookie);
+
   virtual bool port_is_up_(port_t port_num) const = 0;
 
   virtual std::map<port_t, PortInfo> get_port_info_() const = 0;
@@ -161,23 +218,35 @@ class DevMgr : public PacketDispatcherIface {
   // meant for testing
   void set_dev_mgr(std::unique_ptr<DevMgrIface> my_pimp);
 
+  // nb_rx_threads is the number of threads receiving packets, each interface
+  // being handled by a single thread
   void set_dev_mgr_bmi(
+      device_id_t device_id,
+      std::shared_ptr<TransportIface> notifications_transport = nullptr,
+      int nb_rx_threads = 1);
+
+  // Same as set_dev_mgr_bmi, but uses Linux AF_PACKET sockets with
+  // memory-mapped TPACKET_V3 rings instead of libpcap. Linux only.
+  void set_dev_mgr_af_packet(
       device_id_t device_id,
       std::shared_ptr<TransportIface> notifications_transport = nullptr);
 
   // The interface names are instead interpreted as file names.
   // wait_time_in_seconds indicate how long the starting thread should
-  // wait before starting to process packets.
-  void set_dev_mgr_files(unsigned wait_time_in_seconds);
+  // wait before starting to process packets. The input files are replayed
+  // according to replay_config (by default once, as fast as possible).
+  void set_dev_mgr_files(
+      unsigned wait_time_in_seconds,
+      const PcapReplay::Config &replay_config = PcapReplay::Config());
 
-#ifdef BMNANOMSG_ON
   // if enforce ports is set to true, packets coming in on un-registered ports
-  // are dropped
+  // are dropped; addr is either a nanomsg address (only when bmv2 is built
+  // with nanomsg) or shm://<path of a Unix socket>, in which case packets are
+  // exchanged in batches through shared-memory rings
   void set_dev_mgr_packet_in(
       device_id_t device_id, const std::string &addr,
       std::shared_ptr<TransportIface> notifications_transport = nullptr,
       bool enforce_ports = false);
-#endif
 
   ReturnCode port_add(const std::string &iface_name, port_t port_num,
                       const PortExtras &port_extras);
@@ -194,9 +263,19 @@ class DevMgr : public PacketDispatcherIface {
   //! Transmits a data packet out of port \p port_num
   void transmit_fn(port_t port_num, const char *buffer, int len);
 
+  //! Transmits a batch of packets; the port backend takes ownership of the
+  //! packet buffers, which saves a copy for backends that can transmit
+  //! directly from the buffer memory. This is also much cheaper than calling
+  //! transmit_fn() for each packet, as the kernel can be notified once for the
+  //! whole batch.
+  void transmit_burst(DevMgrIface::TxPacket *packets, size_t count);
+
   ReturnCode set_packet_handler(const PacketHandler &handler, void *cookie)
       override;
 
+  ReturnCode set_packet_buffer_handler(const PacketBufferHandler &handler,
+                                       void *cookie) override;
+
   //! Register a callback function to be called every time the status of a port
   //! changes.
   ReturnCode register_status_cb(const PortStatus &type,
@@ -259,6 +259,15 @@ class HandleMgr {
     return const_iterator(this, index);
   }
 
+  // first handle greater than or equal to the given one
+  const_iterator lower_bound(handle_t handle) const {
+    Word_t index = handle;
+    int Rc_int;
+    J1F(Rc_int, handles, index);
+    if (!Rc_int) index = -1;
+    return const_iterator(this, index);
+  }
+
  private:
   Pvoid_t handles;
 };
@@ -0,0 +1,152 @@
+/* Copyright 2013-present Barefoot Networks, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Antonin Bas (antonin@barefootnetworks.com)
+ *
+ */
+
+//! @file latency_stats.h
+
+#ifndef BM_BM_SIM_LATENCY_STATS_H_
+#define BM_BM_SIM_LATENCY_STATS_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace bm {
+
+//! A histogram of latency values in nanoseconds, with the same log-linear
+//! bucketing as HdrHistogram: values below 128ns have their own bucket, above
+//! that each power of 2 is split in 64 buckets, which bounds the relative error
+//! of any reported value to 1/64 (about 1.6%). Values above kMaxValue (about 18
+//! minutes) are recorded as kMaxValue.
+class LatencyHistogram {
+ public:
+  static constexpr uint64_t kMaxValue = (1ull << 40) - 1;
+  static constexpr size_t kNbBuckets = 128 + (40 - 7) * 64;
+
+  LatencyHistogram();
+
+  void record(uint64_t value_ns) {
+    counts[bucket_index(value_ns)]++;
+    total_count++;
+    total_ns += value_ns;
+  }
+
+  //! Aggregate histograms (e.g. from several threads).
+  LatencyHistogram &operator +=(const LatencyHistogram &other);
+  //! Removes the values of an earlier snapshot of the same histogram.
+  LatencyHistogram &operator -=(const LatencyHistogram &other);
+
+  uint64_t get_count() const { return total_count; }
+  //! Returns 0 if the histogram is empty, as do the functions below.
+  uint64_t get_mean() const;
+  uint64_t get_min() const;
+  uint64_t get_max() const;
+  //! Returns the smallest value such that \p percentile percent of the values
+  //! are less than or equal to it (up to the bucket precision).
+  uint64_t get_value_at_percentile(double percentile) const;
+
+  static size_t bucket_index(uint64_t value_ns);
+  //! Smallest value which goes to bucket \p index.
+  static uint64_t bucket_lowest_value(size_t index);
+  //! Largest value which goes to bucket \p index.
+  static uint64_t bucket_highest_value(size_t index);
+
+  uint64_t get_bucket_count(size_t index) const { return counts[index]; }
+
+ private:
+  friend class LatencyStats;
+  friend class LockStats;
+
+  std::vector<uint64_t> counts;
+  uint64_t total_count{0};
+  uint64_t total_ns{0};
+};
+
+//! Always-on latency instrumentation for a target: it maintains one
+//! LatencyHistogram per stage (e.g. parser, ingress pipeline, ...), the stage
+//! names being chosen by the target. Each thread calling record() gets its own
+//! set of histograms, which it updates without any synchronization (a couple
+//! of relaxed atomic loads and stores), and the histograms of all the threads
+//! are merged when get_histograms() is called. The cost of the instrumentation
+//! is therefore mostly the cost of reading the clock with now_ns() (the
+//! steady clock, read through the vDSO on Linux).
+class LatencyStats {
+ public:
+  explicit LatencyStats(const std::vector<std::string> &stage_names);
+  ~LatencyStats();
+
+  static uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  size_t get_nb_stages() const { return stage_names.size(); }
+  const std::string &get_stage_name(size_t stage) const {
+    return stage_names.at(stage);
+  }
+
+  //! Record \p latency_ns for \p stage, from the calling thread. Does nothing
+  //! when the instrumentation is disabled.
+  void record(size_t stage, uint64_t latency_ns) {
+    if (!enabled.load(std::memory_order_relaxed)) return;
+    record_(stage, latency_ns);
+  }
+
+  //! Histograms of all the stages, merged over all the threads, since the
+  //! last call to reset().
+  std::vector<LatencyHistogram> get_histograms() const;
+
+  void reset();
+
+  //! Enabled by default. When disabled, record() returns right away, and so
+  //! should the target code computing the latency values (see is_enabled()).
+  void set_enabled(bool enable) { enabled = enable; }
+  bool is_enabled() const { return enabled.load(std::memory_order_relaxed); }
+
+  LatencyStats(const LatencyStats &other) = delete;
+  LatencyStats &operator=(const LatencyStats &other) = delete;
+
+ private:
+  struct ThreadHistograms;
+
+  void record_(size_t stage, uint64_t latency_ns);
+  ThreadHistograms *get_thread_histograms();
+  std::vector<LatencyHistogram> merge() const;
+
+  const std::vector<std::string> stage_names;
+  // identifies this instance in the per-thread cache, addresses can be reused
+  const uint64_t id;
+  std::atomic<bool> enabled{true};
+  mutable std::mutex mutex{};
+  std::unordered_map<std::thread::id, std::unique_ptr<ThreadHistograms> >
+      threads;
+  // subtracted from the merged histograms, set by reset()
+  std::vector<LatencyHistogram> baseline;
+};
+
+}  // namespace bm
+
+#endif  // BM_BM_SIM_LATENCY_STATS_H_
@@ -0,0 +1,241 @@
+/* Copyright 2013-present Barefoot Networks, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Antonin Bas (antonin@barefootnetworks.com)
+ *
+ */
+
+//! @file lock_stats.h
+
+#ifndef BM_BM_SIM_LOCK_STATS_H_
+#define BM_BM_SIM_LOCK_STATS_H_
+
+#include <boost/thread/shared_mutex.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "latency_stats.h"
+
+namespace bm {
+
+//! Acquisition wait time, hold time and contention count for one of the locks
+//! shared by the control plane and the data plane (match tables, action
+//! profiles, PRE, switch configuration). Instances are created by
+//! InstrumentedLockable, which is only used if bmv2 was configured with
+//! --enable-lock-stats; otherwise get_all() always returns an empty vector.
+class LockStats {
+ public:
+  enum Histogram { READ_WAIT = 0, READ_HOLD, WRITE_WAIT, WRITE_HOLD,
+                   NB_HISTOGRAMS };
+
+  struct Snapshot {
+    std::string name;
+    //! number of acquisitions which could not get the lock right away
+    uint64_t read_contended;
+    uint64_t write_contended;
+    //! indexed by Histogram, the number of acquisitions is the histogram count
+    std::vector<LatencyHistogram> histograms;
+  };
+
+  //! Registers the lock, so that it is included in get_all().
+  explicit LockStats(const std::string &name);
+  ~LockStats();
+
+  void record(Histogram histogram, uint64_t value_ns) {
+    auto index = LatencyHistogram::bucket_index(value_ns);
+    auto &h = histograms[histogram];
+    h.counts[index].fetch_add(1, std::memory_order_relaxed);
+    h.total_count.fetch_add(1, std::memory_order_relaxed);
+    h.total_ns.fetch_add(value_ns, std::memory_order_relaxed);
+  }
+
+  void record_contended(bool write) {
+    (write ? write_contended : read_contended).fetch_add(
+        1, std::memory_order_relaxed);
+  }
+
+  Snapshot get() const;
+  //! Values recorded concurrently with the reset may or may not be cleared.
+  void reset();
+
+  //! "read_wait", "read_hold", "write_wait" or "write_hold"
+  static const char *histogram_name(Histogram histogram);
+
+  //! Snapshots for all the instrumented locks, sorted by name (several locks
+  //! can have the same name if the switch has several contexts).
+  static std::vector<Snapshot> get_all();
+  static void reset_all();
+
+  LockStats(const LockStats &other) = delete;
+  LockStats &operator=(const LockStats &other) = delete;
+
+ private:
+  // shared by all threads, unlike LatencyStats, as a thread typically goes
+  // through many locks for each packet
+  struct AtomicHistogram {
+    AtomicHistogram();
+
+    std::unique_ptr<std::atomic<uint64_t>[]> counts;
+    std::atomic<uint64_t> total_count{0};
+    std::atomic<uint64_t> total_ns{0};
+  };
+
+  const std::string name;
+  AtomicHistogram histograms[NB_HISTOGRAMS];
+  std::atomic<uint64_t> read_contended{0};
+  std::atomic<uint64_t> write_contended{0};
+};
+
+//! Wraps a Lockable (and optionally SharedLockable) type, e.g. std::mutex or
+//! boost::shared_mutex, to record its wait and hold times in a LockStats
+//! instance. Nothing is recorded until set_name() has been called. The clock
+//! is only read for the wait time if the lock cannot be acquired right away.
+//! Do not use directly, use the InstrumentedMutex and InstrumentedSharedMutex
+//! aliases, which are the plain mutex types unless BMLOCKSTATS_ON is defined.
+template <typename Mutex>
+class InstrumentedLockable {
+ public:
+  void set_name(const std::string &name) { stats.reset(new LockStats(name)); }
+
+  void lock() {
+    if (!stats) return mutex.lock();
+    uint64_t wait_ns = 0;
+    if (mutex.try_lock()) {
+      hold_start_ns = LatencyStats::now_ns();
+    } else {
+      auto start = LatencyStats::now_ns();
+      mutex.lock();
+      hold_start_ns = LatencyStats::now_ns();
+      wait_ns = hold_start_ns - start;
+      stats->record_contended(true);
+    }
+    stats->record(LockStats::WRITE_WAIT, wait_ns);
+  }
+
+  bool try_lock() {
+    if (!mutex.try_lock()) return false;
+    if (stats) hold_start_ns = LatencyStats::now_ns();
+    return true;
+  }
+
+  void unlock() {
+    if (!stats) return mutex.unlock();
+    auto hold_ns = LatencyStats::now_ns() - hold_start_ns;
+    mutex.unlock();
+    stats->record(LockStats::WRITE_HOLD, hold_ns);
+  }
+
+  void lock_shared() {
+    if (!stats) return mutex.lock_shared();
+    uint64_t wait_ns = 0;
+    uint64_t now;
+    if (mutex.try_lock_shared()) {
+      now = LatencyStats::now_ns();
+    } else {
+      auto start = LatencyStats::now_ns();
+      mutex.lock_shared();
+      now = LatencyStats::now_ns();
+      wait_ns = now - start;
+      stats->record_contended(false);
+    }
+    SharedHolds::push(this, now);
+    stats->record(LockStats::READ_WAIT, wait_ns);
+  }
+
+  bool try_lock_shared() {
+    if (!mutex.try_lock_shared()) return false;
+    if (stats) SharedHolds::push(this, LatencyStats::now_ns());
+    return true;
+  }
+
+  void unlock_shared() {
+    if (!stats) return mutex.unlock_shared();
+    auto start = SharedHolds::pop(this);
+    mutex.unlock_shared();
+    if (start != 0)
+      stats->record(LockStats::READ_HOLD, LatencyStats::now_ns() - start);
+  }
+
+ private:
+  // Shared locks can be held by several threads at the same time, so the
+  // start of the hold is recorded per-thread. A thread rarely holds more than
+  // a few locks at a time; if it holds more than kMaxHolds, the hold times of
+  // the extra locks are not recorded.
+  struct SharedHolds {
+    static constexpr size_t kMaxHolds = 16;
+
+    struct Hold {
+      const void *lockable;
+      uint64_t start_ns;
+    };
+
+    static Hold *holds(size_t **nb_holds) {
+      static thread_local Hold holds_[kMaxHolds];
+      static thread_local size_t nb_holds_ = 0;
+      *nb_holds = &nb_holds_;
+      return holds_;
+    }
+
+    static void push(const void *lockable, uint64_t start_ns) {
+      size_t *nb_holds;
+      auto *h = holds(&nb_holds);
+      if (*nb_holds == kMaxHolds) return;
+      h[(*nb_holds)++] = {lockable, start_ns};
+    }
+
+    // returns 0 if the lock was not found
+    static uint64_t pop(const void *lockable) {
+      size_t *nb_holds;
+      auto *h = holds(&nb_holds);
+      for (size_t i = *nb_holds; i > 0; i--) {
+        if (h[i - 1].lockable != lockable) continue;
+        auto start_ns = h[i - 1].start_ns;
+        h[i - 1] = h[--(*nb_holds)];
+        return start_ns;
+      }
+      return 0;
+    }
+  };
+
+  Mutex mutex{};
+  std::unique_ptr<LockStats> stats{nullptr};
+  // only accessed by the thread holding the lock exclusively
+  uint64_t hold_start_ns{0};
+};
+
+#ifdef BMLOCKSTATS_ON
+using InstrumentedMutex = InstrumentedLockable<std::mutex>;
+using InstrumentedSharedMutex = InstrumentedLockable<boost::shared_mutex>;
+// std::condition_variable only works with std::mutex
+using InstrumentedConditionVariable = std::condition_variable_any;
+#define BM_LOCK_STATS_NAME(lockable, name) (lockable).set_name(name)
+#else
+using InstrumentedMutex = std::mutex;
+using InstrumentedSharedMutex = boost::shared_mutex;
+using InstrumentedConditionVariable = std::condition_variable;
+#define BM_LOCK_STATS_NAME(lockable, name)
+#endif
+
+}  // namespace bm
+
+#endif  // BM_BM_SIM_LOCK_STATS_H_
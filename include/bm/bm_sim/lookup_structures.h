@@ -105,6 +105,9 @@
 #ifndef BM_BM_SIM_LOOKUP_STRUCTURES_H_
 #define BM_BM_SIM_LOOKUP_STRUCTURES_H_
 
+#include <utility>
+#include <vector>
+
 #include "match_key_types.h"
 #include "bytecontainer.h"
 
@@ -141,6 +144,16 @@ class LookupStructure {
   //! with the given entry.
   virtual void add_entry(const K &key, internal_handle_t handle) = 0;
 
+  //! Store several entries at once, sorted by increasing handle, e.g. when
+  //! restoring a snapshot. The keys remain valid as long as the entries are in
+  //! the structure, like for add_entry(). The default implementation calls
+  //! add_entry() for each entry; override it if the data structure can be
+  //! built more efficiently in bulk.
+  virtual void add_entries(
+      const std::vector<std::pair<const K *, internal_handle_t> > &entries) {
+    for (const auto &e : entries) add_entry(*e.first, e.second);
+  }
+
   //! Remove a given entry from the structure. Has no effect if the entry
   //! does not exist.
   virtual void delete_entry(const K &key) = 0;
@@ -35,6 +35,8 @@
 #include "lookup_structures.h"
 #include "action_entry.h"
 #include "action_profile.h"
+#include "lock_stats.h"
+#include "profiling.h"
 
 namespace bm {
 
@@ -142,6 +144,15 @@ class MatchTableAbstract : public NamedP4Object {
   void serialize(std::ostream *out) const;
   void deserialize(std::istream *in, const P4Objects &objs);
 
+  // binary snapshot (see snapshot.h), written under the table read lock
+  void serialize(SnapshotWriter *out) const;
+  // same encoding, written max_entries at a time, starting from position
+  // *cursor (0 for the first call); the read lock is only held for one chunk,
+  // so if the table is modified between 2 calls, the snapshot may include some
+  // of the changes but not others. Returns false after the last chunk.
+  bool serialize(SnapshotWriter *out, size_t *cursor, size_t max_entries) const;
+  void deserialize(SnapshotReader *in, const P4Objects &objs);
+
   void set_next_node(p4object_id_t action_id, const ControlFlowNode *next_node);
   void set_next_node_hit(const ControlFlowNode *next_node);
   // one of set_next_node_miss / set_next_node_miss_default has to be called
@@ -160,9 +171,20 @@ class MatchTableAbstract : public NamedP4Object {
                                 counter_value_t *bytes,
                                 counter_value_t *packets) const;
   MatchErrorCode reset_counters();
+  // reads the direct counters of all the entries in one call; if reset is
+  // true, each counter is reset as it is read
+  MatchErrorCode query_all_counters(std::vector<entry_handle_t> *handles,
+                                    std::vector<counter_value_t> *bytes,
+                                    std::vector<counter_value_t> *packets,
+                                    bool reset = false);
   MatchErrorCode write_counters(entry_handle_t handle,
                                 counter_value_t bytes,
                                 counter_value_t packets);
+  // adds to the direct counter of the entry, see Counter::add_counter(); does
+  // not block the lookups
+  MatchErrorCode add_counters(entry_handle_t handle,
+                              counter_value_t bytes,
+                              counter_value_t packets);
 
   MatchErrorCode set_meter_rates(
       entry_handle_t handle,
@@ -175,9 +197,19 @@ class MatchTableAbstract : public NamedP4Object {
 
   void sweep_entries(std::vector<entry_handle_t> *entries) const;
 
+  // lookups and hits are counted for every packet, lookup and action times are
+  // sampled, see ProfilingCounters
+  ProfilingStats::Table get_profiling_stats() const;
+  void reset_profiling_stats();
+
   handle_iterator handles_begin() const;
   handle_iterator handles_end() const;
 
+  // true if other is of the same type and has the same match key (see
+  // MatchKeyBuilder::same_key_as()), in which case its entries can be migrated
+  // to this table when swapping configurations
+  bool has_same_key(const MatchTableAbstract &other) const;
+
   // meant to be called by P4Objects when loading the JSON
   // set_default_entry sets a default entry obtained from the JSON. You can make
   // sure that it cannot be changed by the control plane by using the is_const
@@ -193,8 +225,8 @@ class MatchTableAbstract : public NamedP4Object {
   MatchTableAbstract &operator=(MatchTableAbstract &&other) = delete;
 
  protected:
-  using ReadLock = boost::shared_lock<boost::shared_mutex>;
-  using WriteLock = boost::unique_lock<boost::shared_mutex>;
+  using ReadLock = boost::shared_lock<InstrumentedSharedMutex>;
+  using WriteLock = boost::unique_lock<InstrumentedSharedMutex>;
 
  protected:
   const ControlFlowNode *get_next_node(p4object_id_t action_id) const;
@@ -243,6 +275,9 @@ class MatchTableAbstract : public NamedP4Object {
 
   virtual void serialize_(std::ostream *out) const = 0;
   virtual void deserialize_(std::istream *in, const P4Objects &objs) = 0;
+  virtual bool serialize_(SnapshotWriter *out, size_t *cursor,
+                          size_t max_entries) const = 0;
+  virtual void deserialize_(SnapshotReader *in, const P4Objects &objs) = 0;
 
   virtual MatchErrorCode dump_entry_(std::ostream *out,
                                      entry_handle_t handle) const = 0;
@@ -275,8 +310,9 @@ class MatchTableAbstract : public NamedP4Object {
   std::string dump_entry_string_(entry_handle_t handle) const;
 
  private:
-  mutable boost::shared_mutex t_mutex{};
+  mutable InstrumentedSharedMutex t_mutex{};
   MatchUnitAbstract_ *match_unit_{nullptr};
+  ProfilingCounters profiling_counters;
 };
 
 // MatchTable is exposed to the runtime for configuration
@@ -289,6 +325,25 @@ class MatchTable : public MatchTableAbstract {
     int priority;
   };
 
+  // One operation of a batch passed to write_entries()
+  struct WriteOp {
+    enum class Type { ADD, MODIFY, DELETE };
+
+    Type type;
+    MatchTable *table;
+    // ADD only
+    std::vector<MatchKeyParam> match_key;
+    // ADD and MODIFY
+    const ActionFn *action_fn;
+    ActionData action_data;
+    // ADD only
+    int priority;
+    // MODIFY and DELETE; for ADD, set to the handle of the new entry
+    entry_handle_t handle;
+    // set by write_entries()
+    MatchErrorCode status;
+  };
+
  public:
   MatchTable(const std::string &name, p4object_id_t id,
              std::unique_ptr<MatchUnitAbstract<ActionEntry> > match_unit,
@@ -318,8 +373,20 @@ class MatchTable : public MatchTableAbstract {
 
   std::vector<Entry> get_entries() const;
 
+  // Retrieves the entries in chunks, to avoid holding the table lock (and
+  // blocking lookups) for the whole dump of a large table. Appends at most
+  // max_entries entries to entries, starting from position *cursor (0 for the
+  // first chunk), and updates *cursor for the next call. Returns false if
+  // there are no more entries after this chunk. An entry present during the
+  // whole iteration is returned exactly once.
+  bool get_entries(size_t *cursor, size_t max_entries,
+                   std::vector<Entry> *entries) const;
+
   MatchErrorCode get_default_entry(Entry *entry) const;
 
+  // false if the default entry is still the one from the P4 program
+  bool is_default_entry_modified() const;
+
   MatchTableType get_table_type() const override {
     return MatchTableType::SIMPLE;
   }
@@ -344,6 +411,21 @@ class MatchTable : public MatchTableAbstract {
 
   void set_immutable_entries();
 
+  bool has_immutable_entries() const { return immutable_entries; }
+
+  // Applies a batch of operations, which can target several tables, in
+  // order. The write lock of each table is acquired once for the whole batch
+  // instead of once per operation. The status of each operation is set in
+  // WriteOp::status and the function returns the status of the first failed
+  // operation (or SUCCESS). If atomic is false, a failed operation does not
+  // affect the other ones. If atomic is true, the batch is all-or-nothing:
+  // it stops at the first failed operation and the operations already applied
+  // are undone, in reverse order; the status of all the other operations is
+  // set to MatchErrorCode::BATCH_ABORTED. Note that an entry whose deletion is
+  // undone is added back with a new handle (written to WriteOp::handle) and
+  // loses its per-entry state (counters, meters, TTL).
+  static MatchErrorCode write_entries(std::vector<WriteOp> *ops, bool atomic);
+
  public:
   static std::unique_ptr<MatchTable> create(
       const std::string &match_type,
@@ -358,6 +440,9 @@ class MatchTable : public MatchTableAbstract {
 
   void serialize_(std::ostream *out) const override;
   void deserialize_(std::istream *in, const P4Objects &objs) override;
+  bool serialize_(SnapshotWriter *out, size_t *cursor,
+                  size_t max_entries) const override;
+  void deserialize_(SnapshotReader *in, const P4Objects &objs) override;
 
   MatchErrorCode dump_entry_(std::ostream *out,
                              entry_handle_t handle) const override;
@@ -366,6 +451,21 @@ class MatchTable : public MatchTableAbstract {
 
   MatchErrorCode get_entry_(entry_handle_t handle, Entry *entry) const;
 
+  // the internal versions do not acquire the lock
+  MatchErrorCode add_entry_(const std::vector<MatchKeyParam> &match_key,
+                            const ActionFn *action_fn,
+                            ActionData action_data,
+                            entry_handle_t *handle,
+                            int priority);
+  MatchErrorCode delete_entry_(entry_handle_t handle);
+  MatchErrorCode modify_entry_(entry_handle_t handle,
+                               const ActionFn *action_fn,
+                               ActionData action_data);
+
+  // applies a single operation of a batch, with the lock held; if undo is not
+  // nullptr, it is set to the operation which reverts this one
+  void write_entry_(WriteOp *op, WriteOp *undo);
+
  private:
   ActionEntry default_entry{};
   std::unique_ptr<MatchUnitAbstract<ActionEntry> > match_unit;
@@ -414,6 +514,10 @@ class MatchTableIndirect : public MatchTableAbstract {
 
   std::vector<Entry> get_entries() const;
 
+  // see MatchTable::get_entries(size_t *, size_t, std::vector<Entry> *)
+  bool get_entries(size_t *cursor, size_t max_entries,
+                   std::vector<Entry> *entries) const;
+
   MatchErrorCode get_default_entry(Entry *entry) const;
 
   MatchTableType get_table_type() const override {
@@ -445,6 +549,9 @@ class MatchTableIndirect : public MatchTableAbstract {
 
   void serialize_(std::ostream *out) const override;
   void deserialize_(std::istream *in, const P4Objects &objs) override;
+  bool serialize_(SnapshotWriter *out, size_t *cursor,
+                  size_t max_entries) const override;
+  void deserialize_(SnapshotReader *in, const P4Objects &objs) override;
 
   void dump_(std::ostream *stream) const;
 
@@ -501,6 +608,10 @@ class MatchTableIndirectWS : public MatchTableIndirect {
 
   std::vector<Entry> get_entries() const;
 
+  // see MatchTable::get_entries(size_t *, size_t, std::vector<Entry> *)
+  bool get_entries(size_t *cursor, size_t max_entries,
+                   std::vector<Entry> *entries) const;
+
   MatchErrorCode get_default_entry(Entry *entry) const;
 
   MatchTableType get_table_type() const override {
@@ -522,6 +633,9 @@ class MatchTableIndirectWS : public MatchTableIndirect {
  private:
   void serialize_(std::ostream *out) const override;
   void deserialize_(std::istream *in, const P4Objects &objs) override;
+  bool serialize_(SnapshotWriter *out, size_t *cursor,
+                  size_t max_entries) const override;
+  void deserialize_(SnapshotReader *in, const P4Objects &objs) override;
 
   MatchErrorCode dump_entry_(std::ostream *out,
                             entry_handle_t handle) const override;
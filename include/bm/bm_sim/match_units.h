@@ -42,6 +42,8 @@
 namespace bm {
 
 class P4Objects;  // forward declaration for deserialize
+class SnapshotWriter;  // forward declarations for binary snapshots
+class SnapshotReader;
 
 // using string and not ByteContainer for efficiency
 struct MatchKeyParam {
@@ -125,6 +127,11 @@ class MatchKeyBuilder {
 
   size_t max_name_size() const { return name_map.max_size(); }
 
+  // true if other has the same fields (compared by name, since header ids
+  // depend on the P4 program), in the same order, with the same match types,
+  // bitwidths and masks; used to migrate entries across configurations
+  bool same_key_as(const MatchKeyBuilder &other) const;
+
  private:
   struct KeyF {
     header_id_t header;
@@ -274,6 +281,10 @@ class MatchUnitAbstract_ {
 
   size_t get_nbytes_key() const { return nbytes_key; }
 
+  const MatchKeyBuilder &get_match_key_builder() const {
+    return match_key_builder;
+  }
+
   bool valid_handle(entry_handle_t handle) const;
 
   MatchUnit::EntryMeta &get_entry_meta(entry_handle_t handle);
@@ -297,6 +308,12 @@ class MatchUnitAbstract_ {
   handle_iterator handles_begin() const;
   handle_iterator handles_end() const;
 
+  // appends at most max_handles handles to chunk, starting from position
+  // *cursor (0 for the first call), and updates *cursor for the next call;
+  // returns false if there are no more handles after these ones
+  bool get_handles(size_t *cursor, size_t max_handles,
+                   std::vector<entry_handle_t> *chunk) const;
+
  protected:
   MatchErrorCode get_and_set_handle(internal_handle_t *handle);
   MatchErrorCode unset_handle(internal_handle_t handle);
@@ -400,6 +417,20 @@ class MatchUnitAbstract : public MatchUnitAbstract_ {
     deserialize_(in, objs);
   }
 
+  // binary snapshot: writes at most max_entries entries, starting from
+  // position *cursor (0 for the first call), and updates *cursor for the next
+  // call; returns false once all entries have been written
+  bool serialize(SnapshotWriter *out, size_t *cursor,
+                 size_t max_entries) const {
+    return serialize_(out, cursor, max_entries);
+  }
+
+  // replaces all the entries with the ones from the snapshot, which are
+  // inserted in the lookup structure in bulk
+  void deserialize(SnapshotReader *in, const P4Objects &objs) {
+    deserialize_(in, objs);
+  }
+
  private:
   virtual MatchErrorCode add_entry_(const std::vector<MatchKeyParam> &match_key,
                                     V value,  // by value for possible std::move
@@ -430,6 +461,9 @@ class MatchUnitAbstract : public MatchUnitAbstract_ {
 
   virtual void serialize_(std::ostream *out) const = 0;
   virtual void deserialize_(std::istream *in, const P4Objects &objs) = 0;
+  virtual bool serialize_(SnapshotWriter *out, size_t *cursor,
+                          size_t max_entries) const = 0;
+  virtual void deserialize_(SnapshotReader *in, const P4Objects &objs) = 0;
 };
 
 
@@ -482,6 +516,9 @@ class MatchUnitGeneric : public MatchUnitAbstract<V> {
 
   void serialize_(std::ostream *out) const override;
   void deserialize_(std::istream *in, const P4Objects &objs) override;
+  bool serialize_(SnapshotWriter *out, size_t *cursor,
+                  size_t max_entries) const override;
+  void deserialize_(SnapshotReader *in, const P4Objects &objs) override;
 
   MatchErrorCode build_entry_from_match_key(
       const std::vector<MatchKeyParam> &match_key, int priority,
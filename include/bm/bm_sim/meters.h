@@ -50,6 +50,9 @@ namespace bm {
 
 class Packet;
 
+class SnapshotWriter;  // forward declarations for binary snapshots
+class SnapshotReader;
+
 // I initially implemented this with template values: meter type and rate
 // count. I thought it would potentially speed up operations. However, it meant
 // I also had to use a virtual interface (e.g. to store in p4 objects / use in
@@ -147,6 +150,10 @@ class Meter {
 
   MeterErrorCode reset_rates();
 
+  MeterType get_type() const { return type; }
+
+  size_t get_rate_count() const { return rates.size(); }
+
   //! Executes the meter on the given packet. Returns an integral value in the
   //! range [0, N] (where N is the number of rates for this meter). A higher
   //! value means that the meter is "busier". For a classic trTCM:
@@ -159,6 +166,8 @@ class Meter {
 
   void serialize(std::ostream *out) const;
   void deserialize(std::istream *in);
+  void serialize(SnapshotWriter *out) const;
+  void deserialize(SnapshotReader *in);
 
  public:
   /* This is for testing purposes only, for more accurate tests */
@@ -295,6 +304,8 @@ class MeterArray : public NamedP4Object {
 
   void serialize(std::ostream *out) const;
   void deserialize(std::istream *in);
+  void serialize(SnapshotWriter *out) const;
+  void deserialize(SnapshotReader *in);
 
  private:
   std::vector<Meter> meters{};
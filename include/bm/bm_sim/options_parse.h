@@ -26,9 +26,11 @@
 #include <iosfwd>
 #include <string>
 #include <map>
+#include <vector>
 
 #include "device_id.h"
 #include "logger.h"
+#include "pcap_replay.h"
 #include "target_parser.h"
 
 namespace bm {
@@ -69,12 +71,35 @@ class OptionsParser {
   InterfaceList ifaces{};
   bool pcap{false};
   std::string pcap_dir{};
+  // capture to a single pcapng file instead of one pcap file per interface and
+  // direction
+  bool pcapng{false};
+  // start a new capture file after that many bytes / seconds, 0 means never
+  uint64_t pcap_rotate_size{0};
+  uint64_t pcap_rotate_interval{0};
   int thrift_port{0};
+  // "threaded" (one thread per connection), "thread-pool" or "nonblocking"
+  std::string thrift_server_type{"threaded"};
+  // size of the worker pool for the "thread-pool" and "nonblocking" servers
+  int thrift_workers{4};
   device_id_t device_id{};
   // if true read/write packets from files instead of interfaces
   bool use_files{false};
   // time to wait (in seconds) before starting packet processing
   int wait_time{0};
+  // how the input files are replayed when use_files is true
+  PcapReplay::Config replay_config{};
+  // if true use AF_PACKET mmap'd rings instead of libpcap for interfaces
+  bool use_af_packet{false};
+  // number of threads receiving packets from interfaces (libpcap only)
+  int rx_threads{1};
+  // AF_XDP mode and NIC queue for the ports which use AF_XDP instead of
+  // libpcap
+  std::map<uint32_t, std::string> af_xdp_modes{};
+  std::map<uint32_t, int> af_xdp_queues{};
+  // port extras for the virtual ports which generate / absorb packets
+  // in-process (see --traffic-gen and --traffic-sink)
+  std::map<uint32_t, std::map<std::string, std::string> > traffic_ports{};
   // if true read/write packets from nanomsg socket instead of interfaces
   bool packet_in{false};
   std::string packet_in_addr{};
@@ -90,6 +115,9 @@ class OptionsParser {
   std::string debugger_addr{};
   std::string state_file_path{};
   size_t dump_packet_data{0};
+  // CPU affinity and NUMA node for each thread class, see ThreadAffinity
+  std::map<std::string, std::vector<int> > thread_cpus{};
+  std::map<std::string, int> thread_numa_nodes{};
 };
 
 }  // namespace bm
@@ -43,6 +43,9 @@
 
 namespace bm {
 
+class FieldList;
+class P4Objects;
+
 //! Integral type used to identify a given data packet
 using packet_id_t = uint64_t;
 
@@ -98,6 +101,7 @@ class CopyIdGenerator {
 class Packet final {
   friend class SwitchWContexts;
   friend class Switch;
+  friend class Context;
 
  public:
   using clock = std::chrono::system_clock;
@@ -105,7 +109,7 @@ class Packet final {
   using buffer_state_t = PacketBuffer::state_t;
 
   //! Number of general purpose registers per packet
-  static constexpr size_t nb_registers = 2u;
+  static constexpr size_t nb_registers = 4u;
 
   static constexpr size_t INVALID_ENTRY_INDEX =
       std::numeric_limits<size_t>::max();
@@ -218,6 +222,11 @@ class Packet final {
 
   const PacketBuffer &get_packet_buffer() const { return buffer; }
 
+  //! Moves the packet data buffer out of the packet, e.g. to hand it over to a
+  //! port backend for transmission (see DevMgr::transmit_burst). Only the
+  //! packet metadata can be used after this call.
+  PacketBuffer release_packet_buffer() { return std::move(buffer); }
+
   uint64_t get_ingress_ts_ms() const { return ingress_ts_ms; }
 
   // TODO(antonin): use references instead?
@@ -274,9 +283,21 @@ class Packet final {
   //! @endcode
   //! if `new_cxt == cxt_id`, then this is a no-op,
   //! otherwise, release the old PHV and replace it with a new one, compatible
-  //! with the new context
+  //! with the new context. The Packet no longer refers to the configuration it
+  //! was created with (see Context::get_pipeline(const Packet &, const
+  //! std::string &)), it uses the current configuration of the new context.
   void change_context(cxt_id_t new_cxt);
 
+  //! Replaces the PHV of the packet with a fresh one from the PHV pool, in
+  //! which all headers are invalid and all metadata fields are set to `0`,
+  //! except for the fields included in \p preserved (if not `nullptr`), whose
+  //! values are carried over from the old PHV. The old PHV is given back to
+  //! the pool. Unlike the clone methods, this does not copy the packet data or
+  //! allocate a new Packet, which makes it a good fit for targets which
+  //! resubmit / recirculate packets: the Packet instance can just be moved
+  //! back to the beginning of the pipeline.
+  void reset_phv(FieldList *preserved = nullptr);
+
   //! Returns the id of the Context this packet currently belongs to
   cxt_id_t get_context() const { return cxt_id; }
 
@@ -304,7 +325,8 @@ class Packet final {
 
   //! Same as clone_no_phv(), but also changes the context id for the clone.
   //! See change_context() for more information on how a Packet instance belongs
-  //! to a specific Context
+  //! to a specific Context. The other clone methods keep the configuration the
+  //! Packet was created with.
   Packet clone_choose_context(cxt_id_t new_cxt) const;
   //! @copydoc clone_choose_context
   std::unique_ptr<Packet> clone_choose_context_ptr(cxt_id_t new_cxt) const;
@@ -335,7 +357,11 @@ class Packet final {
  private:
   Packet(cxt_id_t cxt_id, port_t ingress_port, packet_id_t id,
          copy_id_t copy_id, int ingress_length, PacketBuffer &&buffer,
-         PHVSourceIface *phv_source);
+         PHVSourceIface *phv_source,
+         std::shared_ptr<P4Objects> p4objects = nullptr);
+
+  // a PHV from the pool, which matches the configuration of the packet
+  std::unique_ptr<PHV> get_phv_from_source() const;
 
   void update_signature(uint64_t seed = 0);
   void set_ingress_ts();
@@ -363,13 +389,19 @@ class Packet final {
   clock::time_point ingress_ts{};
   uint64_t ingress_ts_ms{};
 
+  // the configuration the packet was created with, which stays alive as long
+  // as the packet (and its clones) even if it is swapped out; nullptr if the
+  // packet was not created by a SwitchWContexts instance
+  std::shared_ptr<P4Objects> p4objects{nullptr};
+
   std::unique_ptr<PHV> phv;
 
   PHVSourceIface *phv_source{nullptr};
 
   // General purpose registers available to a target, they can be written with
-  // Packet::set_register and read with Packet::get_register
-  std::array<uint64_t, nb_registers> registers;
+  // Packet::set_register and read with Packet::get_register; they are 0 in a
+  // new packet (including a clone)
+  std::array<uint64_t, nb_registers> registers{};
 
   // Used to store the index of the entry returned by the last match table
   // lookup; INVALID_ENTRY_INDEX if lookup was a miss.
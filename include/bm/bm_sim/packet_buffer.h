@@ -52,13 +52,17 @@ class PacketBuffer {
     size_t data_size;
   };
 
+  //! Called to give back the memory of a PacketBuffer which does not own its
+  //! memory, see PacketBuffer(char *, size_t, size_t, ReleaseFn, void *).
+  using ReleaseFn = void (*)(char *buffer, void *cookie);
+
  public:
   PacketBuffer() {}
 
   explicit PacketBuffer(size_t size)
     : size(size),
       data_size(0),
-      buffer(std::unique_ptr<char[]>(new char[size])),
+      buffer(new char[size], Deleter()),
       head(buffer.get() + size) {}
 
   //! Construct a PacketBuffer instance with capacity \p size, and copy the
@@ -77,11 +81,27 @@ class PacketBuffer {
   PacketBuffer(size_t size, const char *data, size_t data_size)
     : size(size),
       data_size(0),
-      buffer(std::unique_ptr<char[]>(new char[size])),
+      buffer(new char[size], Deleter()),
       head(buffer.get() + size) {
     std::copy(data, data + data_size, push(data_size));
   }
 
+  //! Construct a PacketBuffer instance using memory which is managed by
+  //! someone else, e.g. a frame which was filled by the NIC and which is handed
+  //! over to the switch by a port manager without a copy. The buffer starts at
+  //! \p buffer and has capacity \p size, its last \p data_size bytes are the
+  //! packet data; the bytes before the packet data are the headroom available
+  //! for new headers. When the PacketBuffer is destroyed, \p release is called
+  //! with \p buffer and \p cookie.
+  PacketBuffer(char *buffer, size_t size, size_t data_size, ReleaseFn release,
+               void *cookie)
+    : size(size),
+      data_size(data_size),
+      buffer(buffer, Deleter(release, cookie)),
+      head(buffer + size - data_size) {
+    assert(data_size <= size);
+  }
+
   char *start() const { return head; }
 
   char *end() const { return buffer.get() + size; }
@@ -111,6 +131,23 @@ class PacketBuffer {
 
   size_t get_data_size() const { return data_size; }
 
+  //! If the memory of this PacketBuffer is managed by \p release and \p
+  //! cookie (see PacketBuffer(char *, size_t, size_t, ReleaseFn, void *)),
+  //! gives up ownership of the memory and returns it; \p release will not be
+  //! called and the caller becomes responsible for the memory. This lets a port
+  //! backend which receives a PacketBuffer for transmission reuse its own
+  //! memory directly. Returns nullptr otherwise, in which case the PacketBuffer
+  //! is left unchanged.
+  char *release_memory(ReleaseFn release, void *cookie) {
+    const auto &deleter = buffer.get_deleter();
+    if (!buffer || deleter.release != release || deleter.cookie != cookie)
+      return nullptr;
+    size = 0;
+    data_size = 0;
+    head = nullptr;
+    return buffer.release();
+  }
+
   PacketBuffer clone(size_t end_bytes) const {
     assert(end_bytes <= data_size);
     PacketBuffer pb(size);
@@ -125,9 +162,26 @@ class PacketBuffer {
   PacketBuffer &operator=(PacketBuffer &&other) /*noexcept*/ = default;
 
  private:
+  struct Deleter {
+    Deleter() { }
+
+    Deleter(ReleaseFn release, void *cookie)
+        : release(release), cookie(cookie) { }
+
+    void operator()(char *p) const {
+      if (release)
+        release(p, cookie);
+      else
+        delete[] p;
+    }
+
+    ReleaseFn release{nullptr};
+    void *cookie{nullptr};
+  };
+
   size_t size{0};
   size_t data_size{0};
-  std::unique_ptr<char[]> buffer{nullptr};
+  std::unique_ptr<char[], Deleter> buffer{nullptr};
   char *head{nullptr};
 };
 
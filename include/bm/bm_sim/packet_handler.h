@@ -18,6 +18,8 @@
 
 #include <functional>
 
+#include "packet_buffer.h"
+
 namespace bm {
 
 class PacketDispatcherIface {
@@ -32,6 +34,21 @@ class PacketDispatcherIface {
 
   virtual ReturnCode set_packet_handler(const PacketHandler &handler,
                                         void* cookie) = 0;
+
+  // Optional handler which takes ownership of the packet data; it lets a
+  // dispatcher which can provide packets in their own buffers (e.g. AF_XDP
+  // UMEM frames) avoid the copy to a new PacketBuffer. Dispatchers which do not
+  // support it return UNSUPPORTED and keep using the PacketHandler.
+  using PacketBufferHandler = std::function<void(int port_num,
+                                                 PacketBuffer &&buffer,
+                                                 void* cookie)>;
+
+  virtual ReturnCode set_packet_buffer_handler(
+      const PacketBufferHandler &handler, void* cookie) {
+    (void) handler;
+    (void) cookie;
+    return ReturnCode::UNSUPPORTED;
+  }
 };
 
 class PacketReceiverIface {
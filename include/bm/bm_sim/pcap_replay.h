@@ -0,0 +1,124 @@
+/* Copyright 2013-present Barefoot Networks, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Antonin Bas (antonin@barefootnetworks.com)
+ *
+ */
+
+//! @file pcap_replay.h
+
+#ifndef BM_BM_SIM_PCAP_REPLAY_H_
+#define BM_BM_SIM_PCAP_REPLAY_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "packet_handler.h"
+
+namespace bm {
+
+//! Replays packets from a set of pcap files, each file being associated with a
+//! port. The files are memory-mapped and packets are passed to the packet
+//! handler directly from the mapping, without going through libpcap. Packets
+//! from different files are interleaved according to their timestamps. The
+//! replay engine is meant to be used to benchmark P4 programs offline.
+//!
+//! Packets are injected in bursts of at most Config::burst_size packets: the
+//! clock is only read once per burst, and a burst includes all the packets
+//! which are due at that time. When no packet is due, the replay thread
+//! busy-polls the clock, unless the next packet is due in more than
+//! kMaxBusyPollUs microseconds, in which case it sleeps first.
+class PcapReplay : public PacketDispatcherIface {
+ public:
+  enum class Mode {
+    //! inject packets as fast as possible
+    FAST,
+    //! respect the inter-packet gaps of the capture files
+    TIMED,
+    //! inject Config::rate packets per second
+    PPS,
+    //! inject Config::rate bits per second (packet data only)
+    BPS
+  };
+
+  struct Config {
+    Mode mode{Mode::FAST};
+    //! for PPS and BPS modes
+    uint64_t rate{0};
+    //! number of times the files are replayed, 0 means until stop() is called
+    unsigned int loops{1};
+    size_t burst_size{32};
+  };
+
+  struct Stats {
+    uint64_t packets;
+    uint64_t bytes;
+    //! time between the call to run() and the last injected burst
+    uint64_t duration_ns;
+  };
+
+  static constexpr uint64_t kMaxBusyPollUs = 200;
+
+  explicit PcapReplay(const Config &config);
+  ~PcapReplay();
+
+  //! Parses a replay specification, as used on the command line: "fast",
+  //! "timed", "<N>pps" or "<N>bps", where N can have a k, M or G suffix.
+  //! Returns false if the specification is invalid.
+  static bool parse_rate(const std::string &spec, Config *config);
+
+  //! Memory-maps the file and associates it with port \p port. Returns false
+  //! if the file cannot be mapped or is not a pcap file.
+  bool add_file(int port, const std::string &path);
+
+  //! Replays the files from the calling thread, returns when all the loops
+  //! have been replayed or when stop() is called.
+  void run();
+
+  //! Can be called from any thread.
+  void stop();
+
+  //! Can be called while run() is executing.
+  Stats get_stats() const;
+
+  ReturnCode set_packet_handler(const PacketHandler &handler,
+                                void *cookie) override;
+
+  PcapReplay(const PcapReplay &other) = delete;
+  PcapReplay &operator=(const PcapReplay &other) = delete;
+
+ private:
+  struct File;
+
+  bool next_packet(size_t *file_idx);
+  void reset_files();
+
+  Config config;
+  std::vector<std::unique_ptr<File> > files;
+  PacketHandler handler{};
+  void *cookie{nullptr};
+  std::atomic<bool> stop_replay{false};
+  std::atomic<uint64_t> packets{0};
+  std::atomic<uint64_t> bytes{0};
+  std::atomic<uint64_t> duration_ns{0};
+};
+
+}  // namespace bm
+
+#endif  // BM_BM_SIM_PCAP_REPLAY_H_
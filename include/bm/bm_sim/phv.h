@@ -288,6 +288,10 @@ class PHV {
   const std::string get_field_name(header_id_t header_index,
                                    int field_offset) const;
 
+  //! Returns the PHVFactory which created this PHV, or `nullptr` if it was not
+  //! created by a PHVFactory.
+  const PHVFactory *get_factory() const { return factory; }
+
  private:
   // To  be used only by PHVFactory
   // all headers need to be pushed back in order (according to header_index) !!!
@@ -329,6 +333,7 @@ class PHV {
   size_t capacity_unions{0};
   size_t capacity_union_stacks{0};
   Debugger::PacketId packet_id;
+  const PHVFactory *factory{nullptr};
 };
 
 class PHVFactory {
@@ -40,6 +40,10 @@ class PHVSourceIface {
 
   size_t phvs_in_use(cxt_id_t cxt);
 
+  // creates PHVs in the calling thread until \p count unused PHVs are
+  // available for context \p cxt
+  void reserve(cxt_id_t cxt, size_t count);
+
   static std::unique_ptr<PHVSourceIface> make_phv_source(size_t size = 1);
 
  private:
@@ -50,6 +54,11 @@ class PHVSourceIface {
   virtual void set_phv_factory_(cxt_id_t cxt, const PHVFactory *factory) = 0;
 
   virtual size_t phvs_in_use_(cxt_id_t cxt) = 0;
+
+  // optional, sources which do not pool PHVs have nothing to do
+  virtual void reserve_(cxt_id_t cxt, size_t count) {
+    (void) cxt; (void) count;
+  }
 };
 
 }  // namespace bm
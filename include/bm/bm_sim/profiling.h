@@ -0,0 +1,156 @@
+/* Copyright 2013-present Barefoot Networks, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Antonin Bas (antonin@barefootnetworks.com)
+ *
+ */
+
+//! @file profiling.h
+
+#ifndef BM_BM_SIM_PROFILING_H_
+#define BM_BM_SIM_PROFILING_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace bm {
+
+//! A fixed-size set of counters attached to a P4 object (match table, action,
+//! conditional) and updated by the packet processing threads. Each thread gets
+//! its own copy of the counters, which it updates without any read-modify-write
+//! atomic operation, and the copies are summed when the counters are read,
+//! which makes the counters cheap enough to be always on. Profiling can be
+//! turned off for the whole process with set_enabled().
+class ProfilingCounters {
+ public:
+  //! The first kMaxThreads - 1 threads updating the counters get their own
+  //! copy, the other threads share the last one (and update it atomically).
+  static constexpr size_t kMaxThreads = 64;
+  //! sample() returns true for 1 call out of kSamplingPeriod on average, it is
+  //! used to decide when to time a lookup or an action.
+  static constexpr uint32_t kSamplingPeriod = 64;
+
+  explicit ProfilingCounters(size_t nb_counters);
+  ~ProfilingCounters();
+
+  void add(size_t counter, uint64_t v) const {
+    auto index = thread_index();
+    auto *c = &get_thread_counters(index)[counter];
+    if (index + 1 < kMaxThreads)
+      c->store(c->load(std::memory_order_relaxed) + v,
+               std::memory_order_relaxed);
+    else
+      c->fetch_add(v, std::memory_order_relaxed);
+  }
+
+  //! Values of the counters summed over all threads, since the last call to
+  //! reset().
+  std::vector<uint64_t> get() const;
+
+  void reset();
+
+  //! Enabled by default. Callers are expected to check is_enabled() before
+  //! calling add() (and reading the clock).
+  static void set_enabled(bool enable);
+  static bool is_enabled() {
+    return enabled.load(std::memory_order_relaxed);
+  }
+
+  //! Per-thread pseudo-random sampling, independent of the call pattern.
+  static bool sample() {
+    // xorshift32
+    static thread_local uint32_t state = 0;
+    if (state == 0) state = seed();
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return (state % kSamplingPeriod) == 0;
+  }
+
+  ProfilingCounters(const ProfilingCounters &other) = delete;
+  ProfilingCounters &operator=(const ProfilingCounters &other) = delete;
+
+  ProfilingCounters(ProfilingCounters &&other) noexcept;
+  ProfilingCounters &operator=(ProfilingCounters &&other) noexcept;
+
+ private:
+  using ThreadCounters = std::atomic<uint64_t>;
+  struct Baseline;
+
+  static size_t thread_index() {
+    static thread_local size_t index = kMaxThreads;
+    if (index == kMaxThreads) index = next_thread_index();
+    return index;
+  }
+  static size_t next_thread_index();
+  static uint32_t seed();
+
+  ThreadCounters *get_thread_counters(size_t index) const {
+    auto *counters = threads[index].load(std::memory_order_acquire);
+    return counters ? counters : allocate_thread_counters(index);
+  }
+  ThreadCounters *allocate_thread_counters(size_t index) const;
+  // not including the baseline
+  std::vector<uint64_t> sum() const;
+
+  static std::atomic<bool> enabled;
+
+  size_t nb_counters;
+  std::unique_ptr<std::atomic<ThreadCounters *>[]> threads;
+  std::unique_ptr<Baseline> baseline;
+};
+
+//! Profiling data for the P4 objects of a Context, as returned by
+//! RuntimeInterface::get_profiling_stats(). The lookup and action times are
+//! measured on a sample of the packets (see ProfilingCounters::sample()), the
+//! counts are exact. All times are in nanoseconds.
+struct ProfilingStats {
+  struct Table {
+    std::string name;
+    uint64_t lookups;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t avg_lookup_ns;
+    uint64_t avg_action_ns;
+  };
+
+  struct Action {
+    std::string name;
+    uint64_t executions;
+    uint64_t avg_ns;
+    //! estimated from the average time and the number of executions
+    uint64_t total_ns;
+  };
+
+  struct Conditional {
+    std::string name;
+    uint64_t evaluations;
+    uint64_t true_count;
+  };
+
+  //! sorted by name
+  std::vector<Table> tables;
+  std::vector<Action> actions;
+  std::vector<Conditional> conditionals;
+};
+
+}  // namespace bm
+
+#endif  // BM_BM_SIM_PROFILING_H_
@@ -23,9 +23,12 @@
 #ifndef BM_BM_SIM_QUEUE_H_
 #define BM_BM_SIM_QUEUE_H_
 
+#include <algorithm>  // std::min
 #include <deque>
 #include <mutex>
 #include <condition_variable>
+#include <utility>  // std::move
+#include <vector>
 
 namespace bm {
 
@@ -99,6 +102,27 @@ class Queue {
     q_not_full.notify_one();
   }
 
+  //! Pops up to \p max_items elements from the back of the queue and appends
+  //! them to `*pItems`, in the order in which they would have been returned by
+  //! pop_back(). Blocks until at least one element is available and returns
+  //! the number of elements popped.
+  size_t pop_back(std::vector<T> *pItems, size_t max_items) {
+    std::unique_lock<std::mutex> lock(q_mutex);
+    while (!is_not_empty())
+      q_not_empty.wait(lock);
+    size_t n = std::min(max_items, queue.size());
+    for (size_t i = 0; i < n; i++) {
+      pItems->push_back(std::move(queue.back()));
+      queue.pop_back();
+    }
+    lock.unlock();
+    if (n > 1)
+      q_not_full.notify_all();
+    else
+      q_not_full.notify_one();
+    return n;
+  }
+
   //! Get queue occupancy
   size_t size() const {
     std::unique_lock<std::mutex> lock(q_mutex);
@@ -33,11 +33,16 @@
 #include <deque>
 #include <queue>
 #include <vector>
+#include <array>
 #include <mutex>
 #include <condition_variable>
 #include <chrono>
+#include <stdexcept>
+#include <utility>
 #include <algorithm>  // for std::max
 
+#include <cstdint>
+
 namespace bm {
 
 //! One of the most basic queueing block possible. Lets you choose (at runtime)
@@ -197,6 +202,49 @@ class QueueingLogic {
 };
 
 
+//! Statistics on the accuracy of the rate limiters implemented by the queueing
+//! logic classes below. For every element (or queue) which is delayed by a rate
+//! limiter, we record how late it was actually served compared to the time at
+//! which it became eligible. This includes both the wake-up latency of the
+//! worker thread and the time during which the worker was busy processing other
+//! elements.
+struct RateLimiterStats {
+  //! Number of histogram buckets
+  static constexpr size_t nb_buckets = 6;
+
+  //! Number of rate-limited elements served
+  uint64_t count{0};
+  //! Sum of the lateness of all the rate-limited elements, in nanoseconds
+  uint64_t total_late_ns{0};
+  //! Maximum lateness, in nanoseconds
+  uint64_t max_late_ns{0};
+  //! Lateness histogram; the upper bounds of the buckets are 1us, 10us, 100us,
+  //! 1ms and 10ms, and the last bucket includes everything above 10ms.
+  std::array<uint64_t, nb_buckets> buckets{};
+
+  //! Record an element which was served \p late after it became eligible.
+  void record(std::chrono::nanoseconds late) {
+    uint64_t late_ns = (late.count() > 0) ? late.count() : 0;
+    count++;
+    total_late_ns += late_ns;
+    max_late_ns = std::max(max_late_ns, late_ns);
+    size_t i = 0;
+    for (uint64_t bound = 1000; i < nb_buckets - 1; i++, bound *= 10) {
+      if (late_ns < bound) break;
+    }
+    buckets[i]++;
+  }
+
+  //! Aggregate statistics (e.g. from several worker threads).
+  RateLimiterStats &operator +=(const RateLimiterStats &other) {
+    count += other.count;
+    total_late_ns += other.total_late_ns;
+    max_late_ns = std::max(max_late_ns, other.max_late_ns);
+    for (size_t i = 0; i < nb_buckets; i++) buckets[i] += other.buckets[i];
+    return *this;
+  }
+};
+
 //! This class is slightly more advanced than QueueingLogic. The difference
 //! between the 2 is that this one offers the ability to rate-limit every
 //! logical queue, by providing a maximum number of elements consumed per
@@ -231,33 +279,13 @@ class QueueingLogicRL {
   //! `0` immediately. Otherwise, \p item will be copied to the front of the
   //! logical queue and the function will return `1`.
   int push_front(size_t queue_id, const T &item) {
-    size_t worker_id = map_to_worker(queue_id);
-    auto &q_info = queues_info.at(queue_id);
-    auto &w_info = workers_info.at(worker_id);
-    std::unique_lock<std::mutex> lock(w_info.q_mutex);
-    if (q_info.size >= q_info.capacity) return 0;
-    q_info.last_sent = get_next_tp(q_info);
-    // w_info.queue.emplace(item, queue_id, q_info.last_sent, id++);
-    w_info.queue.emplace(item, queue_id, q_info.last_sent);
-    q_info.size++;
-    w_info.q_not_empty.notify_one();
-    return 1;
+    return push_front_(queue_id, item);
   }
 
   //! Same as push_front(size_t queue_id, const T &item), but \p item is moved
   //! instead of copied.
   int push_front(size_t queue_id, T &&item) {
-    size_t worker_id = map_to_worker(queue_id);
-    auto &q_info = queues_info.at(queue_id);
-    auto &w_info = workers_info.at(worker_id);
-    std::unique_lock<std::mutex> lock(w_info.q_mutex);
-    if (q_info.size >= q_info.capacity) return 0;
-    q_info.last_sent = get_next_tp(q_info);
-    // w_info.queue.emplace(std::move(item), queue_id, q_info.last_sent, id++);
-    w_info.queue.emplace(std::move(item), queue_id, q_info.last_sent);
-    q_info.size++;
-    w_info.q_not_empty.notify_one();
-    return 1;
+    return push_front_(queue_id, std::move(item));
   }
 
   //! Retrieves the oldest element for the worker thread indentified by \p
@@ -267,23 +295,26 @@ class QueueingLogicRL {
   //! leave the queue according to the rate limiter.
   void pop_back(size_t worker_id, size_t *queue_id, T *pItem) {
     auto &w_info = workers_info.at(worker_id);
-    auto &queue = w_info.queue;
+    auto &heads = w_info.heads;
     std::unique_lock<std::mutex> lock(w_info.q_mutex);
     while (true) {
-      if (queue.size() == 0) {
+      if (heads.size() == 0) {
         w_info.q_not_empty.wait(lock);
       } else {
-        if (queue.top().send <= clock::now()) break;
-        w_info.q_not_empty.wait_until(lock, queue.top().send);
+        // copy needed: the heap may be modified while we wait
+        const auto send = heads.top().send;
+        if (send <= clock::now()) break;
+        w_info.q_not_empty.wait_until(lock, send);
       }
     }
-    *queue_id = queue.top().queue_id;
-    // TODO(antonin): improve / document this
-    // http://stackoverflow.com/questions/20149471/move-out-element-of-std-priority-queue-in-c11
-    *pItem = std::move(const_cast<QE &>(queue.top()).e);
-    queue.pop();
+    *queue_id = heads.top().queue_id;
+    heads.pop();
     auto &q_info = queues_info.at(*queue_id);
-    q_info.size--;
+    auto &qe = q_info.queue.front();
+    if (qe.shaped) w_info.stats.record(clock::now() - qe.send);
+    *pItem = std::move(qe.e);
+    q_info.queue.pop_front();
+    if (q_info.queue.size() > 0) push_head(&w_info, q_info, *queue_id);
   }
 
   //! @copydoc QueueingLogic::size
@@ -292,7 +323,7 @@ class QueueingLogicRL {
     auto &q_info = queues_info.at(queue_id);
     auto &w_info = workers_info.at(worker_id);
     std::unique_lock<std::mutex> lock(w_info.q_mutex);
-    return q_info.size;
+    return q_info.queue.size();
   }
 
   //! @copydoc QueueingLogic::set_capacity
@@ -318,6 +349,25 @@ class QueueingLogicRL {
     q_info.pkt_delay_ticks = duration_cast<ticks>(duration<double>(1. / pps));
   }
 
+  //! Returns the accuracy statistics of the rate limiter, aggregated over all
+  //! the worker threads.
+  RateLimiterStats get_rate_limiter_stats() const {
+    RateLimiterStats stats;
+    for (auto &w_info : workers_info) {
+      std::unique_lock<std::mutex> lock(w_info.q_mutex);
+      stats += w_info.stats;
+    }
+    return stats;
+  }
+
+  //! Resets the accuracy statistics of the rate limiter.
+  void reset_rate_limiter_stats() {
+    for (auto &w_info : workers_info) {
+      std::unique_lock<std::mutex> lock(w_info.q_mutex);
+      w_info.stats = RateLimiterStats();
+    }
+  }
+
   //! Deleted copy constructor
   QueueingLogicRL(const QueueingLogicRL &) = delete;
   //! Deleted copy assignment operator
@@ -335,30 +385,39 @@ class QueueingLogicRL {
   using clock = std::chrono::high_resolution_clock;
 
   struct QE {
-    // QE(T e, size_t queue_id, const clock::time_point &send, size_t id)
-    //     : e(std::move(e)), queue_id(queue_id), send(send), id(id) { }
-    QE(T e, size_t queue_id, const clock::time_point &send)
-        : e(std::move(e)), queue_id(queue_id), send(send) { }
+    QE(T e, const clock::time_point &send, uint64_t seq, bool shaped)
+        : e(std::move(e)), send(send), seq(seq), shaped(shaped) { }
 
     T e;
-    size_t queue_id;
     clock::time_point send;
-    // size_t id;
+    // used to break ties between elements of different logical queues
+    uint64_t seq;
+    // true if the element was delayed by the rate limiter
+    bool shaped;
   };
 
-  struct QEComp {
-    bool operator()(const QE &lhs, const QE &rhs) const {
-      // return (lhs.send == rhs.send) ? lhs.id > rhs.id : lhs.send > rhs.send;
-      return lhs.send > rhs.send;
+  // Elements of a given logical queue leave the queue in FIFO order, so the
+  // per-worker heap only needs to include the head element of each non-empty
+  // logical queue. The cost of a push / pop is therefore O(log n), n being the
+  // number of non-empty logical queues for the worker, and the next eligible
+  // element is always at the top of the heap.
+  struct HeadEntry {
+    clock::time_point send;
+    uint64_t seq;
+    size_t queue_id;
+  };
+
+  struct HeadComp {
+    bool operator()(const HeadEntry &lhs, const HeadEntry &rhs) const {
+      return (lhs.send == rhs.send) ? lhs.seq > rhs.seq : lhs.send > rhs.send;
     }
   };
 
-  // performance seems to be roughly the same for deque vs vector
-  using MyQ = std::priority_queue<QE, std::deque<QE>, QEComp>;
-  // using MyQ = std::priority_queue<QE, std::vector<QE>, QEComp>;
+  using HeadQ = std::priority_queue<HeadEntry, std::vector<HeadEntry>,
+                                    HeadComp>;
 
   struct QueueInfo {
-    size_t size{0};
+    std::deque<QE> queue{};
     size_t capacity{0};
     uint64_t queue_rate_pps{};
     // interesting to note that {0} fails with g++4.8, but not with g++4.9
@@ -369,13 +428,38 @@ class QueueingLogicRL {
   };
 
   struct WorkerInfo {
-    MyQ queue{};
+    HeadQ heads{};
+    uint64_t seq{0};
+    RateLimiterStats stats{};
     mutable std::mutex q_mutex{};
     mutable std::condition_variable q_not_empty{};
   };
 
-  clock::time_point get_next_tp(const QueueInfo &q_info) {
-    return std::max(clock::now(), q_info.last_sent + q_info.pkt_delay_ticks);
+  template <typename U>
+  int push_front_(size_t queue_id, U &&item) {
+    size_t worker_id = map_to_worker(queue_id);
+    auto &q_info = queues_info.at(queue_id);
+    auto &w_info = workers_info.at(worker_id);
+    std::unique_lock<std::mutex> lock(w_info.q_mutex);
+    if (q_info.queue.size() >= q_info.capacity) return 0;
+    auto now = clock::now();
+    q_info.last_sent = get_next_tp(q_info, now);
+    q_info.queue.emplace_back(std::forward<U>(item), q_info.last_sent,
+                              w_info.seq++, q_info.last_sent > now);
+    if (q_info.queue.size() == 1) push_head(&w_info, q_info, queue_id);
+    w_info.q_not_empty.notify_one();
+    return 1;
+  }
+
+  static void push_head(WorkerInfo *w_info, const QueueInfo &q_info,
+                        size_t queue_id) {
+    auto &qe = q_info.queue.front();
+    w_info->heads.push({qe.send, qe.seq, queue_id});
+  }
+
+  clock::time_point get_next_tp(const QueueInfo &q_info,
+                                const clock::time_point &now) {
+    return std::max(now, q_info.last_sent + q_info.pkt_delay_ticks);
   }
 
   size_t nb_queues;
@@ -383,7 +467,6 @@ class QueueingLogicRL {
   std::vector<QueueInfo> queues_info;
   std::vector<WorkerInfo> workers_info;
   FMap map_to_worker;
-  // size_t id{0};
 };
 
 
@@ -421,10 +504,9 @@ class QueueingLogicPriRL {
         map_to_worker(std::move(map_to_worker)),
         nb_priorities(nb_priorities) {
     auto now = clock::now();
-    for (size_t i = 0; i < nb_queues; i++) {
-      QueueInfoPri v = {0, capacity, 0, ticks::zero(), now};
-      queues_info.emplace_back(nb_priorities, v);
-    }
+    queues_info.reserve(nb_queues);
+    for (size_t i = 0; i < nb_queues; i++)
+      queues_info.emplace_back(nb_priorities, capacity, now);
   }
 
   //! If priority queue \p priority of logical queue \p queue_id is full, the
@@ -433,19 +515,7 @@ class QueueingLogicPriRL {
   //! are incorrect, an exception of type std::out_of_range will be thrown (same
   //! if the FMap object provided to the constructor does not behave correctly).
   int push_front(size_t queue_id, size_t priority, const T &item) {
-    size_t worker_id = map_to_worker(queue_id);
-    auto &q_info = queues_info.at(queue_id);
-    auto &w_info = workers_info.at(worker_id);
-    auto &q_info_pri = q_info.at(priority);
-    LockType lock(w_info.q_mutex);
-    if (q_info_pri.size >= q_info_pri.capacity) return 0;
-    q_info_pri.last_sent = get_next_tp(q_info_pri);
-    w_info.queues[priority].emplace(item, queue_id, q_info_pri.last_sent);
-    q_info_pri.size++;
-    q_info.size++;
-    w_info.size++;
-    w_info.q_not_empty.notify_one();
-    return 1;
+    return push_front_(queue_id, priority, item);
   }
 
   int push_front(size_t queue_id, const T &item) {
@@ -455,20 +525,7 @@ class QueueingLogicPriRL {
   //! Same as push_front(size_t queue_id, size_t priority, const T &item), but
   //! \p item is moved instead of copied.
   int push_front(size_t queue_id, size_t priority, T &&item) {
-    size_t worker_id = map_to_worker(queue_id);
-    auto &q_info = queues_info.at(queue_id);
-    auto &w_info = workers_info.at(worker_id);
-    auto &q_info_pri = q_info.at(priority);
-    LockType lock(w_info.q_mutex);
-    if (q_info_pri.size >= q_info_pri.capacity) return 0;
-    q_info_pri.last_sent = get_next_tp(q_info_pri);
-    w_info.queues[priority].emplace(std::move(item), queue_id,
-                                    q_info_pri.last_sent);
-    q_info_pri.size++;
-    q_info.size++;
-    w_info.size++;
-    w_info.q_not_empty.notify_one();
-    return 1;
+    return push_front_(queue_id, priority, std::move(item));
   }
 
   int push_front(size_t queue_id, T &&item) {
@@ -488,37 +545,46 @@ class QueueingLogicPriRL {
                 T *pItem) {
     auto &w_info = workers_info.at(worker_id);
     LockType lock(w_info.q_mutex);
-    MyQ *queue = nullptr;
     size_t pri;
+    clock::time_point now;
     while (true) {
-      if (w_info.size == 0) {
+      now = clock::now();
+      update_ready(&w_info, now);
+      if (w_info.ready != 0) {
+        pri = __builtin_ctz(w_info.ready);
+        break;
+      }
+      if (w_info.size == 0 || w_info.pending.size() == 0) {
         w_info.q_not_empty.wait(lock);
       } else {
-        auto now = clock::now();
-        auto next = clock::time_point::max();
-        for (pri = 0; pri < nb_priorities; pri++) {
-          auto &q = w_info.queues[pri];
-          if (q.size() == 0) continue;
-          if (q.top().send <= now) {
-            queue = &q;
-            break;
-          }
-          next = std::min(next, q.top().send);
-        }
-        if (queue) break;
+        // copy needed: the heap may be modified while we wait
+        const auto next = w_info.pending.top().send;
         w_info.q_not_empty.wait_until(lock, next);
       }
     }
-    *queue_id = queue->top().queue_id;
+    auto &heads = w_info.heads[pri];
+    *queue_id = heads.top().queue_id;
     *priority = pri;
-    // TODO(antonin): improve / document this
-    // http://stackoverflow.com/questions/20149471/move-out-element-of-std-priority-queue-in-c11
-    *pItem = std::move(const_cast<QE &>(queue->top()).e);
-    queue->pop();
+    heads.pop();
     auto &q_info = queues_info.at(*queue_id);
-    auto &q_info_pri = q_info.at(*priority);
-    q_info_pri.size--;
+    auto &q_info_pri = q_info.at(pri);
+    auto &qe = q_info_pri.queue.front();
+    if (qe.shaped) w_info.stats.record(now - qe.send);
+    *pItem = std::move(qe.e);
+    q_info_pri.queue.pop_front();
+    if (q_info_pri.queue.size() > 0) {
+      auto &next_qe = q_info_pri.queue.front();
+      heads.push({next_qe.send, next_qe.seq, *queue_id});
+    }
     q_info.size--;
+    w_info.size--;
+    // the priority queue remains ready iff its new head is eligible
+    if (heads.size() == 0) {
+      w_info.ready &= ~bit(pri);
+    } else if (heads.top().send > now) {
+      w_info.ready &= ~bit(pri);
+      w_info.pending.push({heads.top().send, pri});
+    }
   }
 
   //! Same as
@@ -548,7 +614,7 @@ class QueueingLogicPriRL {
     auto &q_info_pri = q_info.at(priority);
     auto &w_info = workers_info.at(worker_id);
     LockType lock(w_info.q_mutex);
-    return q_info.size;
+    return q_info_pri.queue.size();
   }
 
   //! Set the capacity of all the priority queues for logical queue \p queue_id
@@ -577,6 +643,24 @@ class QueueingLogicPriRL {
     for_one_q(queue_id, priority, SetRateFn(pps));
   }
 
+  //! @copydoc QueueingLogicRL::get_rate_limiter_stats
+  RateLimiterStats get_rate_limiter_stats() const {
+    RateLimiterStats stats;
+    for (auto &w_info : workers_info) {
+      LockType lock(w_info.q_mutex);
+      stats += w_info.stats;
+    }
+    return stats;
+  }
+
+  //! @copydoc QueueingLogicRL::reset_rate_limiter_stats
+  void reset_rate_limiter_stats() {
+    for (auto &w_info : workers_info) {
+      LockType lock(w_info.q_mutex);
+      w_info.stats = RateLimiterStats();
+    }
+  }
+
   //! Deleted copy constructor
   QueueingLogicPriRL(const QueueingLogicPriRL &) = delete;
   //! Deleted copy assignment operator
@@ -594,33 +678,69 @@ class QueueingLogicPriRL {
   using clock = std::chrono::high_resolution_clock;
 
   struct QE {
-    QE(T e, size_t queue_id, const clock::time_point &send)
-        : e(std::move(e)), queue_id(queue_id), send(send) { }
+    QE(T e, const clock::time_point &send, uint64_t seq, bool shaped)
+        : e(std::move(e)), send(send), seq(seq), shaped(shaped) { }
 
     T e;
+    clock::time_point send;
+    uint64_t seq;
+    bool shaped;
+  };
+
+  // As for QueueingLogicRL, each priority has a heap which only includes the
+  // head elements of the non-empty priority queues.
+  struct HeadEntry {
+    clock::time_point send;
+    uint64_t seq;
     size_t queue_id;
+  };
+
+  struct HeadComp {
+    bool operator()(const HeadEntry &lhs, const HeadEntry &rhs) const {
+      return (lhs.send == rhs.send) ? lhs.seq > rhs.seq : lhs.send > rhs.send;
+    }
+  };
+
+  using HeadQ = std::priority_queue<HeadEntry, std::vector<HeadEntry>,
+                                    HeadComp>;
+
+  // Priorities which have an eligible element are tracked with a bitmap, so
+  // that the highest one can be found in constant time. The other non-empty
+  // priorities have an entry in an eligible-time heap, which tells us when to
+  // wake up. Entries in that heap may be stale (they are validated when
+  // popped), but there is always at least one entry for a non-empty priority
+  // which is not ready, with a time lower or equal to its next eligible time.
+  struct PendingEntry {
     clock::time_point send;
+    size_t priority;
   };
 
-  struct QEComp {
-    bool operator()(const QE &lhs, const QE &rhs) const {
+  struct PendingComp {
+    bool operator()(const PendingEntry &lhs, const PendingEntry &rhs) const {
       return lhs.send > rhs.send;
     }
   };
 
-  using MyQ = std::priority_queue<QE, std::deque<QE>, QEComp>;
+  using PendingQ = std::priority_queue<PendingEntry, std::vector<PendingEntry>,
+                                       PendingComp>;
 
   struct QueueInfoPri {
-    size_t size;
-    size_t capacity;
-    uint64_t queue_rate_pps;
-    ticks pkt_delay_ticks;
-    clock::time_point last_sent;
+    std::deque<QE> queue{};
+    size_t capacity{0};
+    uint64_t queue_rate_pps{0};
+    ticks pkt_delay_ticks{ticks::zero()};
+    clock::time_point last_sent{};
   };
 
   struct QueueInfo : public std::vector<QueueInfoPri> {
-    QueueInfo(size_t nb_priorities, const QueueInfoPri &v)
-        : std::vector<QueueInfoPri>(nb_priorities, v) { }
+    QueueInfo(size_t nb_priorities, size_t capacity,
+              const clock::time_point &now)
+        : std::vector<QueueInfoPri>(nb_priorities) {
+      for (auto &q_info_pri : *this) {
+        q_info_pri.capacity = capacity;
+        q_info_pri.last_sent = now;
+      }
+    }
 
     size_t size{0};
   };
@@ -629,12 +749,61 @@ class QueueingLogicPriRL {
     mutable std::mutex q_mutex{};
     mutable std::condition_variable q_not_empty{};
     size_t size{0};
-    std::array<MyQ, 32> queues;
+    uint32_t ready{0};
+    uint64_t seq{0};
+    std::array<HeadQ, 32> heads;
+    PendingQ pending{};
+    RateLimiterStats stats{};
   };
 
-  clock::time_point get_next_tp(const QueueInfoPri &q_info_pri) {
-    return std::max(clock::now(),
-                    q_info_pri.last_sent + q_info_pri.pkt_delay_ticks);
+  static uint32_t bit(size_t priority) {
+    return 1u << priority;
+  }
+
+  template <typename U>
+  int push_front_(size_t queue_id, size_t priority, U &&item) {
+    size_t worker_id = map_to_worker(queue_id);
+    auto &q_info = queues_info.at(queue_id);
+    auto &w_info = workers_info.at(worker_id);
+    auto &q_info_pri = q_info.at(priority);
+    LockType lock(w_info.q_mutex);
+    if (q_info_pri.queue.size() >= q_info_pri.capacity) return 0;
+    auto now = clock::now();
+    auto send = get_next_tp(q_info_pri, now);
+    q_info_pri.last_sent = send;
+    auto seq = w_info.seq++;
+    q_info_pri.queue.emplace_back(std::forward<U>(item), send, seq, send > now);
+    if (q_info_pri.queue.size() == 1) {
+      w_info.heads[priority].push({send, seq, queue_id});
+      if (!(w_info.ready & bit(priority)))
+        w_info.pending.push({send, priority});
+    }
+    q_info.size++;
+    w_info.size++;
+    w_info.q_not_empty.notify_one();
+    return 1;
+  }
+
+  // moves the priorities which have become eligible from the pending heap to
+  // the ready bitmap
+  void update_ready(WorkerInfo *w_info, const clock::time_point &now) {
+    auto &pending = w_info->pending;
+    while (pending.size() > 0 && pending.top().send <= now) {
+      size_t pri = pending.top().priority;
+      pending.pop();
+      if (w_info->ready & bit(pri)) continue;
+      auto &heads = w_info->heads[pri];
+      if (heads.size() == 0) continue;
+      if (heads.top().send <= now)
+        w_info->ready |= bit(pri);
+      else
+        pending.push({heads.top().send, pri});
+    }
+  }
+
+  clock::time_point get_next_tp(const QueueInfoPri &q_info_pri,
+                                const clock::time_point &now) {
+    return std::max(now, q_info_pri.last_sent + q_info_pri.pkt_delay_ticks);
   }
 
   template <typename Function>
@@ -692,11 +861,656 @@ class QueueingLogicPriRL {
   size_t nb_workers;
   std::vector<QueueInfo> queues_info{};
   std::vector<WorkerInfo> workers_info{};
-  std::vector<MyQ> queues{};
   FMap map_to_worker;
   size_t nb_priorities;
 };
 
+//! This class is a more complete model of a traffic manager than
+//! QueueingLogicPriRL. As for QueueingLogicPriRL, each logical queue has
+//! several priority queues, priority `0` being the highest priority. However,
+//! rates are expressed in bits per second instead of elements per second: every
+//! element pushed to the queues comes with its size in bytes, which is used for
+//! shaping. Scheduling is done at 2 levels:
+//!   - the logical queues mapped to the same worker are served in a round-robin
+//!     fashion, with the exception that the logical queues which have not yet
+//!     reached their minimum rate are served first.
+//!   - within a logical queue, the priority queues which have not yet reached
+//!     their minimum rate are served first (in order of priority), then the
+//!     strict priority queues (in order of priority) and finally the remaining
+//!     queues, which share the bandwidth according to their weights using
+//!     Deficit Round Robin (DRR).
+//!
+//! A logical queue or a priority queue which exceeds its maximum rate is not
+//! eligible for service until it conforms to its rate again. Rather than
+//! scanning all the queues to find the next eligible element, this class keeps
+//! per-worker bitmaps of eligible queues and uses a timer wheel to know when a
+//! queue becomes eligible again, so each scheduling decision is done in
+//! constant time, regardless of the number of priority queues.
+//!
+//! By default, all priority queues are strict priority queues with no minimum
+//! or maximum rate, which means that the class behaves like QueueingLogicPriRL
+//! without rate-limiting. As for QueueingLogicRL, push_front() is not blocking:
+//! once a priority queue is full, subsequent incoming elements are dropped.
+//! Look at the documentation for QueueingLogic for more information about the
+//! template parameters (they are the same).
+template <typename T, typename FMap>
+class QueueingLogicHierarchical {
+  using MutexType = std::mutex;
+  using LockType = std::unique_lock<MutexType>;
+
+ public:
+  //! The maximum number of priority queues for each logical queue.
+  static constexpr size_t max_priorities = 32;
+  //! The number of bytes a DRR queue with weight `1` is allowed to send in
+  //! each round.
+  static constexpr size_t base_quantum = 1500;
+
+  //! See QueueingLogicPriRL::QueueingLogicPriRL(). \p nb_priorities cannot
+  //! exceed #max_priorities, otherwise an exception of type
+  //! std::invalid_argument will be thrown.
+  QueueingLogicHierarchical(size_t nb_queues, size_t nb_workers,
+                            size_t capacity, FMap map_to_worker,
+                            size_t nb_priorities = 2)
+      : nb_queues(nb_queues), nb_workers(nb_workers),
+        workers_info(nb_workers),
+        map_to_worker(std::move(map_to_worker)),
+        nb_priorities(nb_priorities) {
+    if (nb_priorities == 0 || nb_priorities > max_priorities)
+      throw std::invalid_argument("Invalid number of priority queues");
+    pri_mask = (nb_priorities == max_priorities) ?
+        ~0u : ((1u << nb_priorities) - 1);
+    queues_info.reserve(nb_queues);
+    for (size_t i = 0; i < nb_queues; i++)
+      queues_info.emplace_back(nb_priorities, capacity, pri_mask);
+  }
+
+  //! If priority queue \p priority of logical queue \p queue_id is full, the
+  //! function will return `0` immediately. Otherwise, \p item will be copied to
+  //! the queue and the function will return `1`. \p bytes is the size of \p
+  //! item, as used for shaping and DRR scheduling. If \p queue_id or \p
+  //! priority are incorrect, an exception of type std::out_of_range will be
+  //! thrown.
+  int push_front(size_t queue_id, size_t priority, size_t bytes,
+                 const T &item) {
+    return push_front_(queue_id, priority, bytes, item);
+  }
+
+  //! Same as
+  //! push_front(size_t queue_id, size_t priority, size_t bytes, const T &item),
+  //! but \p item is moved instead of copied.
+  int push_front(size_t queue_id, size_t priority, size_t bytes, T &&item) {
+    return push_front_(queue_id, priority, bytes, std::move(item));
+  }
+
+  //! Retrieves an element for the worker thread indentified by \p worker_id and
+  //! moves it to \p pItem. The id of the logical queue which contained this
+  //! element is copied to \p queue_id and the priority value of the served
+  //! queue is copied to \p priority. See the class description for the order in
+  //! which elements are served. If no element is eligible (either the queues
+  //! are empty or they have exceeded their maximum rate), the function will
+  //! block.
+  void pop_back(size_t worker_id, size_t *queue_id, size_t *priority,
+                T *pItem) {
+    auto &w_info = workers_info.at(worker_id);
+    LockType lock(w_info.q_mutex);
+    while (true) {
+      auto now = clock::now();
+      w_info.wheel.advance(now, [this, &w_info, &now](const Event &ev) {
+          on_event(&w_info, ev, now);
+      });
+      size_t qid;
+      if (next_ready(&w_info, &qid)) {
+        serve(&w_info, qid, now, priority, pItem);
+        *queue_id = qid;
+        return;
+      }
+      auto next = w_info.wheel.next_expiry();
+      if (w_info.size == 0 || next == clock::time_point::max())
+        w_info.q_not_empty.wait(lock);
+      else
+        w_info.q_not_empty.wait_until(lock, next);
+    }
+  }
+
+  //! Same as
+  //! pop_back(size_t worker_id, size_t *queue_id, size_t *priority, T *pItem),
+  //! but the priority of the popped element is discarded.
+  void pop_back(size_t worker_id, size_t *queue_id, T *pItem) {
+    size_t priority;
+    return pop_back(worker_id, queue_id, &priority, pItem);
+  }
+
+  //! @copydoc QueueingLogicPriRL::size(size_t) const
+  size_t size(size_t queue_id) const {
+    size_t worker_id = map_to_worker(queue_id);
+    auto &q_info = queues_info.at(queue_id);
+    auto &w_info = workers_info.at(worker_id);
+    LockType lock(w_info.q_mutex);
+    return q_info.size;
+  }
+
+  //! Get the occupancy of priority queue \p priority for logical queue with id
+  //! \p queue_id.
+  size_t size(size_t queue_id, size_t priority) const {
+    size_t worker_id = map_to_worker(queue_id);
+    auto &pq = queues_info.at(queue_id).pris.at(priority);
+    auto &w_info = workers_info.at(worker_id);
+    LockType lock(w_info.q_mutex);
+    return pq.queue.size();
+  }
+
+  //! Set the capacity of all the priority queues for logical queue \p queue_id
+  //! to \p c elements.
+  void set_capacity(size_t queue_id, size_t c) {
+    for (size_t pri = 0; pri < nb_priorities; pri++)
+      set_capacity(queue_id, pri, c);
+  }
+
+  //! Set the capacity of priority queue \p priority for logical queue \p
+  //! queue_id to \p c elements.
+  void set_capacity(size_t queue_id, size_t priority, size_t c) {
+    for_one_q(queue_id, priority, [c](PriQueue *pq) { pq->capacity = c; });
+  }
+
+  //! Serve priority queue \p priority of logical queue \p queue_id in strict
+  //! priority order. This is the default for all priority queues.
+  void set_strict_priority(size_t queue_id, size_t priority) {
+    for_one_q(queue_id, priority, [](PriQueue *pq) { pq->strict = true; });
+  }
+
+  //! Serve priority queue \p priority of logical queue \p queue_id with DRR,
+  //! using weight \p weight, which has to be strictly positive. In each DRR
+  //! round, the queue is allowed to send `weight * base_quantum` bytes.
+  void set_weight(size_t queue_id, size_t priority, uint32_t weight) {
+    if (weight == 0) throw std::invalid_argument("DRR weight cannot be 0");
+    for_one_q(queue_id, priority, [weight](PriQueue *pq) {
+        pq->strict = false;
+        pq->weight = weight;
+    });
+  }
+
+  //! Guarantee a rate of \p rate_bps bits per second to priority queue \p
+  //! priority of logical queue \p queue_id, with a burst size of \p burst_bytes
+  //! bytes. As long as the queue is below that rate, it will be served before
+  //! the other priority queues of the same logical queue. A rate of `0` removes
+  //! the guarantee.
+  void set_min_rate(size_t queue_id, size_t priority, uint64_t rate_bps,
+                    size_t burst_bytes) {
+    auto now = clock::now();
+    for_one_q(queue_id, priority,
+              [rate_bps, burst_bytes, &now](PriQueue *pq) {
+                pq->min_shaper.configure(rate_bps, burst_bytes, now);
+              });
+  }
+
+  //! Shape priority queue \p priority of logical queue \p queue_id to \p
+  //! rate_bps bits per second, with a burst size of \p burst_bytes bytes. A
+  //! rate of `0` removes the limit.
+  void set_max_rate(size_t queue_id, size_t priority, uint64_t rate_bps,
+                    size_t burst_bytes) {
+    auto now = clock::now();
+    for_one_q(queue_id, priority,
+              [rate_bps, burst_bytes, &now](PriQueue *pq) {
+                pq->max_shaper.configure(rate_bps, burst_bytes, now);
+              });
+  }
+
+  //! Same as set_min_rate(size_t, size_t, uint64_t, size_t) but applies to
+  //! logical queue \p queue_id as a whole. Logical queues below their minimum
+  //! rate are served before the other logical queues mapped to the same worker.
+  void set_min_rate(size_t queue_id, uint64_t rate_bps, size_t burst_bytes) {
+    auto now = clock::now();
+    for_logical_q(queue_id, [rate_bps, burst_bytes, &now](QueueInfo *q_info) {
+        q_info->min_shaper.configure(rate_bps, burst_bytes, now);
+    });
+  }
+
+  //! Same as set_max_rate(size_t, size_t, uint64_t, size_t) but applies to
+  //! logical queue \p queue_id as a whole.
+  void set_max_rate(size_t queue_id, uint64_t rate_bps, size_t burst_bytes) {
+    auto now = clock::now();
+    for_logical_q(queue_id, [rate_bps, burst_bytes, &now](QueueInfo *q_info) {
+        q_info->max_shaper.configure(rate_bps, burst_bytes, now);
+    });
+  }
+
+  //! Returns the accuracy statistics of the shapers, aggregated over all the
+  //! worker threads. For this class, the lateness is measured for every timer
+  //! event signaling that a shaped queue has become eligible again.
+  RateLimiterStats get_rate_limiter_stats() const {
+    RateLimiterStats stats;
+    for (auto &w_info : workers_info) {
+      LockType lock(w_info.q_mutex);
+      stats += w_info.stats;
+    }
+    return stats;
+  }
+
+  //! Resets the accuracy statistics of the shapers.
+  void reset_rate_limiter_stats() {
+    for (auto &w_info : workers_info) {
+      LockType lock(w_info.q_mutex);
+      w_info.stats = RateLimiterStats();
+    }
+  }
+
+  //! Deleted copy constructor
+  QueueingLogicHierarchical(const QueueingLogicHierarchical &) = delete;
+  //! Deleted copy assignment operator
+  QueueingLogicHierarchical &operator =(
+      const QueueingLogicHierarchical &) = delete;
+
+  //! Deleted move constructor
+  QueueingLogicHierarchical(QueueingLogicHierarchical &&) = delete;
+  //! Deleted move assignment operator
+  QueueingLogicHierarchical &&operator =(
+      QueueingLogicHierarchical &&) = delete;
+
+ private:
+  using ticks = std::chrono::nanoseconds;
+  // clock choice? switch to steady if observing re-ordering
+  // using clock = std::chrono::steady_clock;
+  using clock = std::chrono::high_resolution_clock;
+
+  // used as the priority value for timer events targetting the shapers of the
+  // logical queue itself
+  static constexpr uint32_t logical_queue_level = max_priorities;
+
+  // Byte-based shaper implemented as a GCRA (virtual scheduling), which is
+  // equivalent to a token bucket but only needs to be updated when an element
+  // is sent.
+  struct Shaper {
+    // 0 if the shaper is disabled
+    double ns_per_byte{0.};
+    ticks tau{ticks::zero()};
+    // theoretical arrival time
+    clock::time_point tat{};
+    bool conforming{true};
+    // incremented on each configuration change to invalidate pending events
+    uint32_t gen{0};
+
+    bool enabled() const { return ns_per_byte > 0.; }
+
+    void configure(uint64_t rate_bps, size_t burst_bytes,
+                   const clock::time_point &now) {
+      ns_per_byte = (rate_bps == 0) ? 0. : 8e9 / rate_bps;
+      tau = ticks(static_cast<ticks::rep>(burst_bytes * ns_per_byte));
+      tat = now;
+      conforming = true;
+      gen++;
+    }
+
+    clock::time_point next_conforming() const { return tat - tau; }
+
+    // returns true iff the shaper just stopped conforming, in which case the
+    // caller is responsible for scheduling a timer event at *next
+    bool consume(size_t bytes, const clock::time_point &now,
+                 clock::time_point *next) {
+      if (!enabled()) return false;
+      tat = std::max(tat, now) +
+          ticks(static_cast<ticks::rep>(bytes * ns_per_byte));
+      *next = next_conforming();
+      bool was_conforming = conforming;
+      conforming = (*next <= now);
+      return was_conforming && !conforming;
+    }
+  };
+
+  struct Event {
+    size_t queue_id;
+    uint32_t priority;
+    uint32_t gen;
+    bool is_min;
+    uint64_t tick;
+  };
+
+  // Hashed timer wheel with a fixed number of slots of 1us each. Events which
+  // are scheduled beyond the wheel horizon stay in their slot until the wheel
+  // has done enough revolutions.
+  class TimerWheel {
+   public:
+    using resolution = std::chrono::microseconds;
+
+    void schedule(const clock::time_point &tp, Event ev) {
+      ev.tick = std::max(ceil_tick(tp), cursor + 1);
+      size_t s = ev.tick & slot_mask;
+      slots[s].push_back(ev);
+      bitmap[s / 64] |= (static_cast<uint64_t>(1) << (s % 64));
+      count++;
+    }
+
+    // fires all the events which are due at time now; fn is not allowed to
+    // schedule new events
+    template <typename F>
+    void advance(const clock::time_point &now, F fn) {
+      uint64_t target = floor_tick(now);
+      if (target <= cursor) return;
+      if (count == 0) {
+        cursor = target;
+        return;
+      }
+      uint64_t n = std::min(target - cursor,
+                            static_cast<uint64_t>(nb_slots));
+      for (uint64_t t = cursor + 1; t <= cursor + n; t++) {
+        size_t s = t & slot_mask;
+        if (!(bitmap[s / 64] & (static_cast<uint64_t>(1) << (s % 64))))
+          continue;
+        auto &slot = slots[s];
+        size_t kept = 0;
+        for (size_t i = 0; i < slot.size(); i++) {
+          if (slot[i].tick <= target) {
+            count--;
+            fn(slot[i]);
+          } else {
+            slot[kept++] = slot[i];
+          }
+        }
+        slot.resize(kept);
+        if (kept == 0)
+          bitmap[s / 64] &= ~(static_cast<uint64_t>(1) << (s % 64));
+      }
+      cursor = target;
+    }
+
+    // returns the start of the next non-empty slot, which may be earlier than
+    // the first event if this event is more than one revolution away
+    clock::time_point next_expiry() const {
+      if (count == 0) return clock::time_point::max();
+      size_t start = (cursor + 1) & slot_mask;
+      size_t w = start / 64;
+      uint64_t bits = bitmap[w] & (~static_cast<uint64_t>(0) << (start % 64));
+      for (size_t i = 0; i <= nb_words; i++) {
+        if (bits) {
+          size_t s = w * 64 + __builtin_ctzll(bits);
+          uint64_t delta = (s - start) & slot_mask;
+          return clock::time_point(std::chrono::duration_cast<clock::duration>(
+              resolution(cursor + 1 + delta)));
+        }
+        w = (w + 1) % nb_words;
+        bits = bitmap[w];
+      }
+      return clock::time_point::max();
+    }
+
+   private:
+    static constexpr size_t nb_slots = 1024;
+    static constexpr size_t slot_mask = nb_slots - 1;
+    static constexpr size_t nb_words = nb_slots / 64;
+
+    static uint64_t floor_tick(const clock::time_point &tp) {
+      using std::chrono::duration_cast;
+      return duration_cast<resolution>(tp.time_since_epoch()).count();
+    }
+
+    static uint64_t ceil_tick(const clock::time_point &tp) {
+      using std::chrono::duration_cast;
+      auto t = duration_cast<resolution>(tp.time_since_epoch());
+      return (tp.time_since_epoch() > t) ? t.count() + 1 : t.count();
+    }
+
+    std::array<std::vector<Event>, nb_slots> slots{};
+    std::array<uint64_t, nb_words> bitmap{};
+    uint64_t cursor{floor_tick(clock::now())};
+    size_t count{0};
+  };
+
+  struct QE {
+    QE(T e, size_t bytes)
+        : e(std::move(e)), bytes(bytes) { }
+
+    T e;
+    size_t bytes;
+  };
+
+  struct PriQueue {
+    std::deque<QE> queue{};
+    size_t capacity{0};
+    bool strict{true};
+    uint32_t weight{1};
+    int64_t deficit{0};
+    Shaper min_shaper{};
+    Shaper max_shaper{};
+  };
+
+  enum class Ring { NONE, MIN, NORMAL };
+
+  struct QueueInfo {
+    QueueInfo(size_t nb_priorities, size_t capacity, uint32_t pri_mask)
+        : pris(nb_priorities), max_ok(pri_mask) {
+      for (auto &pq : pris) pq.capacity = capacity;
+    }
+
+    std::vector<PriQueue> pris;
+    size_t size{0};
+    // bitmaps indexed by priority
+    uint32_t nonempty{0};
+    // not exceeding max rate
+    uint32_t max_ok;
+    // below min rate
+    uint32_t min_ok{0};
+    uint32_t strict{~0u};
+    size_t drr_cur{0};
+    bool drr_credited{false};
+    Shaper min_shaper{};
+    Shaper max_shaper{};
+    Ring ring{Ring::NONE};
+    // used to detect stale ring entries
+    uint64_t ring_seq{0};
+  };
+
+  // logical queue id + ring_seq value at insertion time
+  using RingEntry = std::pair<size_t, uint64_t>;
+
+  struct WorkerInfo {
+    mutable MutexType q_mutex{};
+    mutable std::condition_variable q_not_empty{};
+    size_t size{0};
+    std::deque<RingEntry> ring_min{};
+    std::deque<RingEntry> ring{};
+    TimerWheel wheel{};
+    RateLimiterStats stats{};
+  };
+
+  static uint32_t bit(size_t priority) {
+    return 1u << priority;
+  }
+
+  static void assign_bit(uint32_t *mask, size_t priority, bool v) {
+    if (v)
+      *mask |= bit(priority);
+    else
+      *mask &= ~bit(priority);
+  }
+
+  // returns the first bit set in mask starting from position from, wrapping
+  // around if needed; mask cannot be 0
+  static size_t next_bit(uint32_t mask, size_t from) {
+    uint32_t hi = mask & (~0u << from);
+    return __builtin_ctz(hi ? hi : mask);
+  }
+
+  template <typename U>
+  int push_front_(size_t queue_id, size_t priority, size_t bytes, U &&item) {
+    size_t worker_id = map_to_worker(queue_id);
+    auto &q_info = queues_info.at(queue_id);
+    auto &w_info = workers_info.at(worker_id);
+    auto &pq = q_info.pris.at(priority);
+    LockType lock(w_info.q_mutex);
+    if (pq.queue.size() >= pq.capacity) return 0;
+    pq.queue.emplace_back(std::forward<U>(item), bytes);
+    q_info.nonempty |= bit(priority);
+    q_info.size++;
+    w_info.size++;
+    update_ring(&w_info, queue_id, &q_info);
+    w_info.q_not_empty.notify_one();
+    return 1;
+  }
+
+  Ring desired_ring(const QueueInfo &q_info) const {
+    if (!(q_info.nonempty & q_info.max_ok)) return Ring::NONE;
+    if (q_info.max_shaper.enabled() && !q_info.max_shaper.conforming)
+      return Ring::NONE;
+    if (q_info.min_shaper.enabled() && q_info.min_shaper.conforming)
+      return Ring::MIN;
+    return Ring::NORMAL;
+  }
+
+  void update_ring(WorkerInfo *w_info, size_t queue_id, QueueInfo *q_info) {
+    auto ring = desired_ring(*q_info);
+    if (ring == q_info->ring) return;
+    q_info->ring = ring;
+    q_info->ring_seq++;
+    if (ring == Ring::MIN)
+      w_info->ring_min.emplace_back(queue_id, q_info->ring_seq);
+    else if (ring == Ring::NORMAL)
+      w_info->ring.emplace_back(queue_id, q_info->ring_seq);
+  }
+
+  bool next_ready(WorkerInfo *w_info, size_t *queue_id) {
+    for (auto *ring : {&w_info->ring_min, &w_info->ring}) {
+      while (!ring->empty()) {
+        auto entry = ring->front();
+        ring->pop_front();
+        auto &q_info = queues_info[entry.first];
+        if (q_info.ring_seq != entry.second) continue;  // stale entry
+        q_info.ring = Ring::NONE;
+        q_info.ring_seq++;
+        *queue_id = entry.first;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  size_t select_priority(QueueInfo *q_info) {
+    uint32_t eligible = q_info->nonempty & q_info->max_ok;
+    uint32_t guaranteed = eligible & q_info->min_ok;
+    if (guaranteed) return __builtin_ctz(guaranteed);
+    uint32_t strict = eligible & q_info->strict;
+    if (strict) return __builtin_ctz(strict);
+    uint32_t drr = eligible & ~q_info->strict;
+    // the number of iterations is bounded by the number of DRR queues times
+    // the number of rounds needed to accumulate enough deficit for the element
+    // at the head of the queue
+    while (true) {
+      size_t pri = next_bit(drr, q_info->drr_cur);
+      auto &pq = q_info->pris[pri];
+      if (pri != q_info->drr_cur || !q_info->drr_credited) {
+        q_info->drr_cur = pri;
+        q_info->drr_credited = true;
+        pq.deficit += pq.weight * base_quantum;
+      }
+      auto bytes = static_cast<int64_t>(pq.queue.front().bytes);
+      if (bytes <= pq.deficit) {
+        pq.deficit -= bytes;
+        return pri;
+      }
+      q_info->drr_cur = (pri + 1) % nb_priorities;
+      q_info->drr_credited = false;
+    }
+  }
+
+  void refresh_bits(QueueInfo *q_info, size_t priority) {
+    auto &pq = q_info->pris[priority];
+    assign_bit(&q_info->max_ok, priority,
+               !pq.max_shaper.enabled() || pq.max_shaper.conforming);
+    assign_bit(&q_info->min_ok, priority,
+               pq.min_shaper.enabled() && pq.min_shaper.conforming);
+    assign_bit(&q_info->strict, priority, pq.strict);
+  }
+
+  void consume(WorkerInfo *w_info, Shaper *shaper, size_t queue_id,
+               uint32_t priority, bool is_min, size_t bytes,
+               const clock::time_point &now) {
+    clock::time_point next;
+    if (shaper->consume(bytes, now, &next)) {
+      w_info->wheel.schedule(
+          next, {queue_id, priority, shaper->gen, is_min, 0});
+    }
+  }
+
+  void serve(WorkerInfo *w_info, size_t queue_id, const clock::time_point &now,
+             size_t *priority, T *pItem) {
+    auto &q_info = queues_info[queue_id];
+    size_t pri = select_priority(&q_info);
+    auto &pq = q_info.pris[pri];
+    *priority = pri;
+    *pItem = std::move(pq.queue.front().e);
+    size_t bytes = pq.queue.front().bytes;
+    pq.queue.pop_front();
+    q_info.size--;
+    w_info->size--;
+    if (pq.queue.empty()) {
+      q_info.nonempty &= ~bit(pri);
+      pq.deficit = 0;
+      if (q_info.drr_cur == pri) q_info.drr_credited = false;
+    }
+    consume(w_info, &pq.max_shaper, queue_id, pri, false, bytes, now);
+    consume(w_info, &pq.min_shaper, queue_id, pri, true, bytes, now);
+    consume(w_info, &q_info.max_shaper, queue_id, logical_queue_level, false,
+            bytes, now);
+    consume(w_info, &q_info.min_shaper, queue_id, logical_queue_level, true,
+            bytes, now);
+    refresh_bits(&q_info, pri);
+    update_ring(w_info, queue_id, &q_info);
+  }
+
+  void on_event(WorkerInfo *w_info, const Event &ev,
+                const clock::time_point &now) {
+    auto &q_info = queues_info[ev.queue_id];
+    Shaper *shaper;
+    if (ev.priority == logical_queue_level) {
+      shaper = ev.is_min ? &q_info.min_shaper : &q_info.max_shaper;
+    } else {
+      auto &pq = q_info.pris[ev.priority];
+      shaper = ev.is_min ? &pq.min_shaper : &pq.max_shaper;
+    }
+    if (shaper->gen != ev.gen) return;  // shaper was re-configured
+    // the element may have been served after the event was scheduled (e.g.
+    // because of strict priority while the queue was above its min rate)
+    if (shaper->next_conforming() > now) {
+      w_info->wheel.schedule(shaper->next_conforming(), ev);
+      return;
+    }
+    w_info->stats.record(now - shaper->next_conforming());
+    shaper->conforming = true;
+    if (ev.priority != logical_queue_level) refresh_bits(&q_info, ev.priority);
+    update_ring(w_info, ev.queue_id, &q_info);
+  }
+
+  template <typename Function>
+  void for_one_q(size_t queue_id, size_t priority, Function fn) {
+    size_t worker_id = map_to_worker(queue_id);
+    auto &q_info = queues_info.at(queue_id);
+    auto &w_info = workers_info.at(worker_id);
+    auto &pq = q_info.pris.at(priority);
+    LockType lock(w_info.q_mutex);
+    fn(&pq);
+    refresh_bits(&q_info, priority);
+    update_ring(&w_info, queue_id, &q_info);
+    w_info.q_not_empty.notify_one();
+  }
+
+  template <typename Function>
+  void for_logical_q(size_t queue_id, Function fn) {
+    size_t worker_id = map_to_worker(queue_id);
+    auto &q_info = queues_info.at(queue_id);
+    auto &w_info = workers_info.at(worker_id);
+    LockType lock(w_info.q_mutex);
+    fn(&q_info);
+    update_ring(&w_info, queue_id, &q_info);
+    w_info.q_not_empty.notify_one();
+  }
+
+  size_t nb_queues;
+  size_t nb_workers;
+  std::vector<QueueInfo> queues_info{};
+  std::vector<WorkerInfo> workers_info{};
+  FMap map_to_worker;
+  size_t nb_priorities;
+  uint32_t pri_mask{0};
+};
+
 }  // namespace bm
 
 #endif  // BM_BM_SIM_QUEUEING_H_
@@ -28,6 +28,9 @@
 #include "action_profile.h"
 #include "match_tables.h"
 #include "device_id.h"
+#include "lock_stats.h"
+#include "profiling.h"
+#include "snapshot.h"
 
 namespace bm {
 
@@ -43,7 +46,30 @@ class RuntimeInterface {
     SUCCESS = 0,
     CONFIG_SWAP_DISABLED,
     ONGOING_SWAP,
-    NO_ONGOING_SWAP
+    NO_ONGOING_SWAP,
+    ONGOING_SNAPSHOT,
+    SNAPSHOT_FILE_ERROR,
+    INVALID_SNAPSHOT,
+    INVALID_CONFIG
+  };
+
+  // One operation of a batch passed to mt_write_entries()
+  struct MtWriteOp {
+    using Type = MatchTable::WriteOp::Type;
+
+    Type type;
+    std::string table_name;
+    // ADD only
+    std::vector<MatchKeyParam> match_key;
+    // ADD and MODIFY
+    std::string action_name;
+    ActionData action_data;
+    // ADD only, for ternary and range tables
+    int priority;
+    // MODIFY and DELETE; for ADD, set to the handle of the new entry
+    entry_handle_t handle;
+    // set by mt_write_entries()
+    MatchErrorCode status;
   };
 
  public:
@@ -100,6 +126,15 @@ class RuntimeInterface {
                    entry_handle_t handle,
                    unsigned int ttl_ms) = 0;
 
+  // Applies a batch of add / modify / delete operations to the direct tables
+  // of a context, taking the write lock of each table only once. See
+  // MatchTable::write_entries() for the semantics of atomic. The match
+  // keys and the action data in ops are moved from.
+  virtual MatchErrorCode
+  mt_write_entries(cxt_id_t cxt_id,
+                   std::vector<MtWriteOp> *ops,
+                   bool atomic) = 0;
+
   // action profiles
 
   virtual MatchErrorCode
@@ -226,6 +261,18 @@ class RuntimeInterface {
   mt_reset_counters(cxt_id_t cxt_id,
                     const std::string &table_name) = 0;
 
+  // Reads the direct counters of all the entries of a table in one call. If
+  // reset is true, each counter is reset as it is read, without losing the
+  // increments concurrent with the read.
+  virtual MatchErrorCode
+  mt_read_all_counters(
+      cxt_id_t cxt_id,
+      const std::string &table_name,
+      std::vector<entry_handle_t> *handles,
+      std::vector<MatchTableAbstract::counter_value_t> *bytes,
+      std::vector<MatchTableAbstract::counter_value_t> *packets,
+      bool reset) = 0;
+
   virtual MatchErrorCode
   mt_write_counters(cxt_id_t cxt_id,
                     const std::string &table_name,
@@ -259,6 +306,30 @@ class RuntimeInterface {
   mt_indirect_ws_get_entries(cxt_id_t cxt_id,
                              const std::string &table_name) const = 0;
 
+  // Chunked versions of the above, which do not hold the table lock for the
+  // whole dump. Appends at most max_entries entries to entries,
+  // starting from position *cursor (0 for the first chunk) and updates
+  // *cursor for the next call; *more is set to false after the last
+  // chunk. An entry present during the whole iteration is returned exactly
+  // once.
+  virtual MatchErrorCode
+  mt_get_entries(cxt_id_t cxt_id, const std::string &table_name,
+                 size_t *cursor, size_t max_entries,
+                 std::vector<MatchTable::Entry> *entries,
+                 bool *more) const = 0;
+
+  virtual MatchErrorCode
+  mt_indirect_get_entries(cxt_id_t cxt_id, const std::string &table_name,
+                          size_t *cursor, size_t max_entries,
+                          std::vector<MatchTableIndirect::Entry> *entries,
+                          bool *more) const = 0;
+
+  virtual MatchErrorCode
+  mt_indirect_ws_get_entries(cxt_id_t cxt_id, const std::string &table_name,
+                             size_t *cursor, size_t max_entries,
+                             std::vector<MatchTableIndirectWS::Entry> *entries,
+                             bool *more) const = 0;
+
   virtual MatchErrorCode
   mt_get_entry(cxt_id_t cxt_id, const std::string &table_name,
                entry_handle_t handle, MatchTable::Entry *entry) const = 0;
@@ -315,6 +386,25 @@ class RuntimeInterface {
   reset_counters(cxt_id_t cxt_id,
                  const std::string &counter_name) = 0;
 
+  // Reads the counters with index in [start, end) of a counter array in
+  // one call. If reset is true, each counter is reset as it is read,
+  // without losing the increments concurrent with the read.
+  virtual Counter::CounterErrorCode
+  read_counters_range(cxt_id_t cxt_id,
+                      const std::string &counter_name,
+                      size_t start, size_t end,
+                      std::vector<MatchTableAbstract::counter_value_t> *bytes,
+                      std::vector<MatchTableAbstract::counter_value_t> *packets,
+                      bool reset) = 0;
+
+  // Same as read_counters_range() for the whole counter array.
+  virtual Counter::CounterErrorCode
+  read_all_counters(cxt_id_t cxt_id,
+                    const std::string &counter_name,
+                    std::vector<MatchTableAbstract::counter_value_t> *bytes,
+                    std::vector<MatchTableAbstract::counter_value_t> *packets,
+                    bool reset) = 0;
+
   virtual Counter::CounterErrorCode
   write_counters(cxt_id_t cxt_id,
                  const std::string &counter_name,
@@ -338,6 +428,12 @@ class RuntimeInterface {
                   const std::string &meter_name, size_t idx,
                   std::vector<Meter::rate_config_t> *configs) = 0;
 
+  // Retrieves the rates of all the meters in a meter array in one call.
+  virtual MeterErrorCode
+  meter_array_get_rates(
+      cxt_id_t cxt_id, const std::string &meter_name,
+      std::vector<std::vector<Meter::rate_config_t> > *configs) = 0;
+
   virtual RegisterErrorCode
   register_read(cxt_id_t cxt_id,
                 const std::string &register_name,
@@ -395,6 +491,42 @@ class RuntimeInterface {
 
   virtual ErrorCode
   serialize(std::ostream *out) = 0;
+
+  // Writes a binary snapshot of the state (see snapshot.h) to a file on the
+  // switch host, which can be restored with --restore-state much faster than
+  // the output of serialize(). The file is written under a temporary name and
+  // renamed once complete. If background is false, runtime requests are
+  // blocked until the snapshot is written, like for serialize(). Otherwise,
+  // the snapshot is written by a separate thread and this function returns
+  // immediately; each table is then written a chunk of entries at a time,
+  // which means that tables modified during the snapshot may be captured in
+  // an intermediate state. Returns ONGOING_SNAPSHOT if a background snapshot
+  // is already running and SNAPSHOT_FILE_ERROR if the file cannot be written.
+  virtual ErrorCode
+  snapshot_state(const std::string &path, bool background) = 0;
+
+  // Status of the ongoing or last snapshot_state() call.
+  virtual SnapshotStatus
+  get_snapshot_status() const = 0;
+
+  virtual ProfilingStats
+  get_profiling_stats(cxt_id_t cxt_id) const = 0;
+
+  virtual void
+  reset_profiling_stats(cxt_id_t cxt_id) = 0;
+
+  // not per context, profiling is turned on / off for the whole process
+  virtual void
+  set_profiling_enabled(bool enabled) = 0;
+
+  // Wait time, hold time and contention count for the locks shared by the
+  // control plane and the data plane, for all contexts. Always empty unless
+  // bmv2 was configured with --enable-lock-stats.
+  virtual std::vector<LockStats::Snapshot>
+  get_lock_stats() const = 0;
+
+  virtual void
+  reset_lock_stats() = 0;
 };
 
 }  // namespace bm
@@ -0,0 +1,406 @@
+/* Copyright 2013-present Barefoot Networks, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Antonin Bas (antonin@barefootnetworks.com)
+ *
+ */
+
+//! @file shm_packet_ring.h
+//! Shared-memory transport for the packet-in port manager and for
+//! bm_apps::PacketInject, selected with a `shm://<unix socket path>` address.
+//! This header is shared by bmv2 and by the client library, it is only
+//! supported on Linux.
+
+#ifndef BM_BM_SIM_SHM_PACKET_RING_H_
+#define BM_BM_SIM_SHM_PACKET_RING_H_
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string>
+
+#ifdef __linux__
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace bm {
+
+//! Single-producer single-consumer ring of variable-size records, which lives
+//! in memory shared by 2 processes. Each record is a 16-byte header (the same
+//! information as in the nanomsg packet-in messages) followed by the packet
+//! data. The producer can write several records before publishing them with a
+//! single release store, and the consumer processes all the available records
+//! at once, so the cost of synchronization is amortized over a batch of
+//! packets. Doorbells (eventfds) are only rung when the other side is about to
+//! sleep, which means that no system call is made when both sides are busy.
+class ShmPacketRing {
+ public:
+  struct RecordHdr {
+    uint32_t type;
+    int32_t port;
+    int32_t more;
+    uint32_t len;
+  };
+
+  //! Marks the unused space at the end of the ring, when a record does not fit
+  static constexpr uint32_t kPadType = 0xffffffffu;
+
+  //! Shared state at the beginning of each ring, the producer and consumer
+  //! indices are in different cache lines
+  struct Control {
+    alignas(64) std::atomic<uint64_t> head;
+    std::atomic<uint32_t> consumer_waiting;
+    alignas(64) std::atomic<uint64_t> tail;
+    std::atomic<uint32_t> producer_waiting;
+  };
+
+  //! Size of the shared memory needed for a ring with \p data_size bytes of
+  //! records
+  static constexpr size_t region_size(size_t data_size) {
+    return sizeof(Control) + data_size;
+  }
+
+  //! \p data_size needs to be a power of 2; \p data_fd is the doorbell rung by
+  //! the producer, \p space_fd the one rung by the consumer. If \p reset is
+  //! true, the ring is initialized as empty (which must only be done by one
+  //! side, before the other one attaches to the ring).
+  void init(void *mem, size_t data_size, int data_fd, int space_fd,
+            bool reset) {
+    ctrl = static_cast<Control *>(mem);
+    data = static_cast<char *>(mem) + sizeof(Control);
+    size = data_size;
+    this->data_fd = data_fd;
+    this->space_fd = space_fd;
+    if (reset) {
+      new (ctrl) Control();
+      ctrl->head.store(0);
+      ctrl->tail.store(0);
+      ctrl->consumer_waiting.store(0);
+      ctrl->producer_waiting.store(0);
+    }
+    head = ctrl->head.load();
+    tail = ctrl->tail.load();
+  }
+
+  //! Maximum amount of packet data in a single record
+  size_t max_data_size() const { return size / 2 - sizeof(RecordHdr); }
+
+  // producer side
+
+  //! Copies a record to the ring, without making it visible to the consumer;
+  //! waits at most \p timeout_ms for free space. Returns false in case of
+  //! timeout or if the record is too large.
+  bool push(uint32_t type, int port, int more, const char *buffer,
+            uint32_t len, int timeout_ms) {
+    if (len > max_data_size()) return false;
+    size_t needed = record_size(len);
+    size_t pos = head & (size - 1);
+    size_t contiguous = size - pos;
+    size_t total = (contiguous < needed) ? contiguous + needed : needed;
+    while (size - (head - ctrl->tail.load(std::memory_order_acquire)) <
+           total) {
+      // the consumer may be waiting for the records we have not published yet
+      publish();
+      if (!wait(&ctrl->producer_waiting, space_fd, timeout_ms,
+                [this, total] {
+                  return size - (head - ctrl->tail.load()) >= total;
+                })) {
+        return false;
+      }
+    }
+    if (contiguous < needed) {
+      RecordHdr pad = {kPadType, 0, 0, 0};
+      std::memcpy(data + pos, &pad, sizeof(pad));
+      head += contiguous;
+      pos = 0;
+    }
+    RecordHdr hdr = {type, port, more, len};
+    std::memcpy(data + pos, &hdr, sizeof(hdr));
+    if (len > 0) std::memcpy(data + pos + sizeof(hdr), buffer, len);
+    head += needed;
+    return true;
+  }
+
+  //! Makes all the records pushed so far visible to the consumer
+  void publish() {
+    ctrl->head.store(head, std::memory_order_release);
+    notify(&ctrl->consumer_waiting, data_fd);
+  }
+
+  // consumer side
+
+  //! Calls \p fn(const RecordHdr &, const char *data) for at most \p max
+  //! available records, which are then released to the producer. Returns the
+  //! number of records processed.
+  template <typename F>
+  size_t consume(F &&fn, size_t max) {
+    uint64_t h = ctrl->head.load(std::memory_order_acquire);
+    size_t count = 0;
+    while (tail != h && count < max) {
+      size_t pos = tail & (size - 1);
+      RecordHdr hdr;
+      std::memcpy(&hdr, data + pos, sizeof(hdr));
+      if (hdr.type == kPadType) {
+        tail += size - pos;
+        continue;
+      }
+      // the memory is shared with another process, which we do not trust to
+      // produce well-formed records
+      if (record_size(hdr.len) > size - pos) {
+        tail = h;
+        break;
+      }
+      fn(hdr, data + pos + sizeof(hdr));
+      tail += record_size(hdr.len);
+      count++;
+    }
+    if (count > 0 || tail != ctrl->tail.load(std::memory_order_relaxed)) {
+      ctrl->tail.store(tail, std::memory_order_release);
+      notify(&ctrl->producer_waiting, space_fd);
+    }
+    return count;
+  }
+
+  //! Tells the producer that we are about to wait on consumer_fd(). Returns
+  //! false if records are already available, in which case we should not wait.
+  bool arm_consumer_wait() {
+    ctrl->consumer_waiting.store(1);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (ctrl->head.load() != tail) {
+      ctrl->consumer_waiting.store(0);
+      return false;
+    }
+    return true;
+  }
+
+  void disarm_consumer_wait() {
+    ctrl->consumer_waiting.store(0);
+    drain(data_fd);
+  }
+
+  //! Waits at most \p timeout_ms for records to be available
+  bool wait_for_data(int timeout_ms) {
+    return wait(&ctrl->consumer_waiting, data_fd, timeout_ms,
+                [this] { return ctrl->head.load() != tail; });
+  }
+
+  int consumer_fd() const { return data_fd; }
+
+ private:
+  static size_t record_size(size_t len) {
+    return (sizeof(RecordHdr) + len + 15) & ~static_cast<size_t>(15);
+  }
+
+  static void notify(std::atomic<uint32_t> *waiting, int fd) {
+    // pairs with the fence in wait(): either the other side sees our update
+    // before sleeping, or we see its flag and wake it up
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiting->load(std::memory_order_relaxed)) {
+      uint64_t one = 1;
+      if (write(fd, &one, sizeof(one)) < 0) { }
+    }
+  }
+
+  static void drain(int fd) {
+    uint64_t v;
+    while (read(fd, &v, sizeof(v)) > 0) { }
+  }
+
+  template <typename Ready>
+  static bool wait(std::atomic<uint32_t> *waiting, int fd, int timeout_ms,
+                   Ready ready) {
+    waiting->store(1);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    bool rv = ready();
+    if (!rv) {
+      struct pollfd pfd = {fd, POLLIN, 0};
+      poll(&pfd, 1, timeout_ms);
+      rv = ready();
+    }
+    waiting->store(0);
+    drain(fd);
+    return rv;
+  }
+
+  Control *ctrl{nullptr};
+  char *data{nullptr};
+  size_t size{0};
+  int data_fd{-1};
+  int space_fd{-1};
+  // local copies of the indices we own
+  uint64_t head{0};
+  uint64_t tail{0};
+};
+
+//! A pair of ShmPacketRing instances (one for each direction) in a memfd
+//! region, with their eventfd doorbells. The client (bm_apps::PacketInject)
+//! creates the channel and sends the file descriptors to bmv2 over a Unix
+//! socket, with SCM_RIGHTS.
+class ShmPacketChannel {
+ public:
+  //! Ring from the client to bmv2 (packets in, port messages)
+  static constexpr int kToSwitch = 0;
+  //! Ring from bmv2 to the client (packets out)
+  static constexpr int kFromSwitch = 1;
+
+  static constexpr size_t kDefaultRingSize = 1u << 22;
+
+  //! Extracts the Unix socket path from a `shm://<path>` address. Returns
+  //! false if \p addr does not use the shm scheme.
+  static bool parse_addr(const std::string &addr, std::string *path) {
+    static const std::string prefix("shm://");
+    if (addr.compare(0, prefix.size(), prefix) != 0) return false;
+    *path = addr.substr(prefix.size());
+    return true;
+  }
+
+  ~ShmPacketChannel() {
+    if (mem != MAP_FAILED) munmap(mem, mem_size);
+    for (int fd : fds) {
+      if (fd >= 0) close(fd);
+    }
+  }
+
+  //! Creates a new channel (client side). Returns nullptr and sets errno in
+  //! case of error.
+  static std::unique_ptr<ShmPacketChannel> create(
+      size_t ring_size = kDefaultRingSize) {
+    std::unique_ptr<ShmPacketChannel> channel(new ShmPacketChannel());
+    channel->ring_size = ring_size;
+    channel->fds[0] = memfd_create("bmv2-packet-in", MFD_CLOEXEC);
+    if (channel->fds[0] < 0) return nullptr;
+    if (ftruncate(channel->fds[0], channel->region_size())) return nullptr;
+    for (int i = 1; i < kNumFds; i++) {
+      channel->fds[i] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+      if (channel->fds[i] < 0) return nullptr;
+    }
+    if (!channel->map(true)) return nullptr;
+    return channel;
+  }
+
+  //! Sends the channel to bmv2 over the connected Unix socket \p sock.
+  //! Returns 0 on success, errno otherwise.
+  int send_to(int sock) const {
+    Setup setup = {kMagic, static_cast<uint64_t>(ring_size)};
+    struct iovec iov = {const_cast<Setup *>(&setup), sizeof(setup)};
+    char control[CMSG_SPACE(sizeof(fds))];
+    std::memset(control, 0, sizeof(control));
+    struct msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    std::memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+    return (sendmsg(sock, &msg, MSG_NOSIGNAL) < 0) ? errno : 0;
+  }
+
+  //! Receives a channel sent with send_to() (bmv2 side). Returns nullptr in
+  //! case of error.
+  static std::unique_ptr<ShmPacketChannel> receive_from(int sock) {
+    Setup setup;
+    struct iovec iov = {&setup, sizeof(setup)};
+    char control[CMSG_SPACE(sizeof(int) * kNumFds)];
+    struct msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    ssize_t rc = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    std::unique_ptr<ShmPacketChannel> channel(new ShmPacketChannel());
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg && cmsg->cmsg_level == SOL_SOCKET &&
+        cmsg->cmsg_type == SCM_RIGHTS &&
+        cmsg->cmsg_len == CMSG_LEN(sizeof(channel->fds))) {
+      std::memcpy(channel->fds, CMSG_DATA(cmsg), sizeof(channel->fds));
+    }
+    if (rc != static_cast<ssize_t>(sizeof(setup)) || setup.magic != kMagic ||
+        setup.ring_size == 0 || (setup.ring_size & (setup.ring_size - 1)) ||
+        channel->fds[0] < 0) {
+      return nullptr;
+    }
+    channel->ring_size = setup.ring_size;
+    struct stat st;
+    if (fstat(channel->fds[0], &st) ||
+        static_cast<size_t>(st.st_size) < channel->region_size()) {
+      return nullptr;
+    }
+    if (!channel->map(false)) return nullptr;
+    return channel;
+  }
+
+  ShmPacketRing &ring(int direction) { return rings[direction]; }
+
+  ShmPacketChannel(const ShmPacketChannel &other) = delete;
+  ShmPacketChannel &operator=(const ShmPacketChannel &other) = delete;
+
+ private:
+  // memfd, then data and space doorbells for each ring
+  static constexpr int kNumFds = 5;
+  static constexpr uint64_t kMagic = 0x626d76327368u;  // "bmv2sh"
+
+  struct Setup {
+    uint64_t magic;
+    uint64_t ring_size;
+  };
+
+  ShmPacketChannel() {
+    for (int &fd : fds) fd = -1;
+  }
+
+  size_t region_size() const {
+    return 2 * ShmPacketRing::region_size(ring_size);
+  }
+
+  bool map(bool reset) {
+    mem_size = region_size();
+    mem = mmap(nullptr, mem_size, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0],
+               0);
+    if (mem == MAP_FAILED) return false;
+    for (int i = 0; i < 2; i++) {
+      rings[i].init(static_cast<char *>(mem) +
+                    i * ShmPacketRing::region_size(ring_size),
+                    ring_size, fds[1 + 2 * i], fds[2 + 2 * i], reset);
+    }
+    return true;
+  }
+
+  int fds[kNumFds];
+  size_t ring_size{0};
+  void *mem{MAP_FAILED};
+  size_t mem_size{0};
+  ShmPacketRing rings[2];
+};
+
+}  // namespace bm
+
+#endif  // __linux__
+
+#endif  // BM_BM_SIM_SHM_PACKET_RING_H_
@@ -31,6 +31,7 @@
 #include <vector>
 
 #include "handle_mgr.h"
+#include "lock_stats.h"
 #include "pre.h"
 
 // forward declaration of Json::Value
@@ -88,7 +89,7 @@ class McSimplePre {
   static constexpr size_t LAG_MAP_SIZE = 256;
   using LagMap = McPre::Set<LAG_MAP_SIZE>;
 
-  McSimplePre() {}
+  McSimplePre() { BM_LOCK_STATS_NAME(mutex, "pre"); }
   McReturnCode mc_mgrp_create(const mgrp_t, mgrp_hdl_t *);
   McReturnCode mc_mgrp_destroy(const mgrp_hdl_t);
   McReturnCode mc_node_create(const rid_t,
@@ -190,7 +191,7 @@ class McSimplePre {
   std::unordered_map<l2_hdl_t, L2Entry> l2_entries{};
   HandleMgr l1_handles{};
   HandleMgr l2_handles{};
-  mutable boost::shared_mutex mutex{};
+  mutable InstrumentedSharedMutex mutex{};
 };
 
 }  // namespace bm
@@ -0,0 +1,192 @@
+/* Copyright 2013-present Barefoot Networks, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Antonin Bas (antonin@barefootnetworks.com)
+ *
+ */
+
+//! @file snapshot.h
+//! Binary state snapshots, an alternative to the text format produced by
+//! RuntimeInterface::serialize() which is much faster to restore for large
+//! tables. A snapshot file has the following layout (integers are stored in
+//! host byte order, so snapshots are not portable across architectures):
+//! @code
+//! header:  magic (8 bytes) | format version (u32) | config md5 (string)
+//!          | number of contexts (u32)
+//! context: number of sections (u32) | sections
+//! section: type (u8) | object name (string) | payload size (u64) | payload
+//! @endcode
+//! There is one section per match table, action profile and meter array. A
+//! string is encoded as its size (u32) followed by its bytes.
+
+#ifndef BM_BM_SIM_SNAPSHOT_H_
+#define BM_BM_SIM_SNAPSHOT_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iosfwd>
+#include <string>
+
+namespace bm {
+
+enum class SnapshotSection : uint8_t {
+  TABLE = 1,
+  ACTION_PROFILE = 2,
+  METER_ARRAY = 3
+};
+
+//! Serializes state to an output stream. Data is buffered until the end of the
+//! current section (or until flush() is called outside of a section), so that
+//! the section size can be written before its payload.
+class SnapshotWriter {
+ public:
+  static constexpr uint32_t kFormatVersion = 1;
+
+  explicit SnapshotWriter(std::ostream *out);
+
+  void write_header(const std::string &config_md5, size_t nb_cxts);
+
+  void write_u8(uint8_t v) { write_raw(&v, sizeof(v)); }
+  void write_u32(uint32_t v) { write_raw(&v, sizeof(v)); }
+  void write_i32(int32_t v) { write_raw(&v, sizeof(v)); }
+  void write_u64(uint64_t v) { write_raw(&v, sizeof(v)); }
+  void write_double(double v) { write_raw(&v, sizeof(v)); }
+  void write_bytes(const char *bytes, size_t nbytes) {
+    write_raw(bytes, nbytes);
+  }
+  void write_string(const std::string &s) {
+    write_u32(static_cast<uint32_t>(s.size()));
+    write_raw(s.data(), s.size());
+  }
+
+  void begin_section(SnapshotSection type, const std::string &name);
+  void end_section();
+
+  void flush();
+
+  //! false if writing to the output stream failed
+  bool good() const;
+
+  //! includes the data which has not been flushed yet
+  uint64_t get_bytes_written() const { return bytes_flushed + buffer.size(); }
+
+ private:
+  void write_raw(const void *data, size_t size) {
+    buffer.append(static_cast<const char *>(data), size);
+  }
+
+  std::ostream *out;
+  std::string buffer{};
+  uint64_t bytes_flushed{0};
+  // offset of the size field of the current section in buffer
+  size_t section_size_offset{0};
+  bool in_section{false};
+};
+
+//! Reads state from a snapshot held in memory (typically a MappedFile). Reads
+//! are bounds-checked: once a read goes past the end of the data, or if
+//! set_failed() is called because the data is inconsistent, good() returns
+//! false and all subsequent reads return 0 (or nullptr / an empty string).
+class SnapshotReader {
+ public:
+  SnapshotReader() = default;
+  SnapshotReader(const char *data, size_t size);
+
+  //! Returns true if the data starts with a snapshot header.
+  static bool is_snapshot(const char *data, size_t size);
+
+  //! Returns false if the magic number or the format version do not match.
+  bool read_header(std::string *config_md5, size_t *nb_cxts);
+
+  uint8_t read_u8() { return read_<uint8_t>(); }
+  uint32_t read_u32() { return read_<uint32_t>(); }
+  int32_t read_i32() { return read_<int32_t>(); }
+  uint64_t read_u64() { return read_<uint64_t>(); }
+  double read_double() { return read_<double>(); }
+  //! Returns a pointer to the next nbytes bytes of the snapshot data (no
+  //! copy), or nullptr if there are fewer bytes left.
+  const char *read_bytes(size_t nbytes) {
+    if (failed || nbytes > size - pos) {
+      failed = true;
+      return nullptr;
+    }
+    const char *p = data + pos;
+    pos += nbytes;
+    return p;
+  }
+  std::string read_string();
+
+  //! Reads a section header and sets payload to a reader limited to the
+  //! section payload, which is skipped in this reader.
+  bool next_section(SnapshotSection *type, std::string *name,
+                    SnapshotReader *payload);
+
+  bool good() const { return !failed; }
+  bool at_end() const { return pos == size; }
+  void set_failed() { failed = true; }
+
+ private:
+  template <typename T>
+  T read_() {
+    T v{};
+    const char *p = read_bytes(sizeof(T));
+    if (p) std::memcpy(&v, p, sizeof(T));
+    return v;
+  }
+
+  const char *data{nullptr};
+  size_t size{0};
+  size_t pos{0};
+  bool failed{false};
+};
+
+//! Read-only memory mapping of a whole file.
+class MappedFile {
+ public:
+  MappedFile() = default;
+  ~MappedFile();
+
+  //! Returns false if the file cannot be opened or mapped (e.g. if it is
+  //! empty).
+  bool open(const std::string &path);
+
+  const char *data() const { return static_cast<const char *>(addr); }
+  size_t size() const { return length; }
+
+  MappedFile(const MappedFile &other) = delete;
+  MappedFile &operator=(const MappedFile &other) = delete;
+
+ private:
+  void *addr{nullptr};
+  size_t length{0};
+};
+
+//! Status of the last binary snapshot, as returned by
+//! RuntimeInterface::get_snapshot_status().
+struct SnapshotStatus {
+  //! true if a background snapshot is running
+  bool in_progress{false};
+  std::string path{};
+  //! false if the last snapshot failed, or if there has been no snapshot yet
+  bool success{false};
+  uint64_t bytes{0};
+  uint64_t duration_ms{0};
+};
+
+}  // namespace bm
+
+#endif  // BM_BM_SIM_SNAPSHOT_H_
@@ -147,6 +147,9 @@ class RegisterArray : public NamedP4Object {
   //! includes)
   size_t size() const { return registers.size(); }
 
+  //! Return the bitwidth of the registers in the array
+  int get_bitwidth() const { return bitwidth; }
+
   void reset_state();
 
   //! Register your own notifier function. Every time a write operation is
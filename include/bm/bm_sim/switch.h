@@ -49,20 +49,22 @@
 //! Both switch classes support live swapping of P4-JSON configurations. To
 //! enable it you need to provide the correct flag to the constructor (see
 //! bm::SwitchWContexts::SwitchWContexts()). Swaps are ordered through the
-//! runtime interfaces. However, it is the target switch responsibility to
-//! decide when to "commit" the swap. This is because swapping configurations
-//! invalidate certain pointers that you may still be using. We plan on trying
-//! to make this more target-friendly in the future but it is not trivial. Here
-//! is an example of how the simple router target implements swapping:
+//! runtime interfaces and take effect immediately for the new packets: each
+//! Packet refers to the configuration it was created with, which is only
+//! released once the last Packet using it is gone. Targets should therefore
+//! look up the pipelines, parsers, deparsers, field lists and learning engine
+//! for each packet, using the methods which take a Packet as a parameter. For
+//! example, in the simple switch target:
 //! @code
-//! // swap is enabled, so update pointers if needed
-//! if (this->do_swap() == 0) {  // a swap took place
-//!   ingress_mau = this->get_pipeline("ingress");
-//!   egress_mau = this->get_pipeline("egress");
-//!   parser = this->get_parser("parser");
-//!   deparser = this->get_deparser("deparser");
-//! }
+//! Parser *parser = this->get_parser(*packet, "parser");
+//! Pipeline *ingress_mau = this->get_pipeline(*packet, "ingress");
+//! parser->parse(packet.get());
+//! ingress_mau->apply(packet.get());
 //! @endcode
+//! The pointers returned by the methods which do not take a Packet refer to the
+//! current configuration and are invalidated by a swap. Targets which keep them
+//! around need to refresh them when do_swap() returns 0, while making sure that
+//! no Packet from the previous configuration is processed with them.
 
 #ifndef BM_BM_SIM_SWITCH_H_
 #define BM_BM_SIM_SWITCH_H_
@@ -70,7 +72,9 @@
 #include <boost/thread/shared_mutex.hpp>
 
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <typeinfo>
 #include <typeindex>
 #include <set>
@@ -82,6 +86,7 @@
 #include "device_id.h"
 #include "queue.h"
 #include "learning.h"
+#include "lock_stats.h"
 #include "runtime_interface.h"
 #include "dev_mgr.h"
 #include "phv_source.h"
@@ -104,11 +109,26 @@ class SwitchWContexts : public DevMgr, public RuntimeInterface {
   friend class Switch;
 
  public:
+  //! What happens to the state (table entries, counters, registers, meters...)
+  //! of the current configuration when a new one is swapped in.
+  enum class SwapMode {
+    //! the new configuration starts with empty tables and cleared stateful
+    //! objects (default)
+    RESET_STATE,
+    //! the state is carried over to the new configuration for all the objects
+    //! which are compatible, see P4Objects::migrate_state()
+    MIGRATE_STATE
+  };
+
   //! To enable live swapping of P4-JSON configurations, enable_swap needs to be
   //! set to `true`. See switch.h documentation for more information on
   //! configuration swap.
   explicit SwitchWContexts(size_t nb_cxts = 1u, bool enable_swap = false);
 
+  //! Waits for the completion of the background snapshot and for the release
+  //! of the last swapped out configuration, if any.
+  ~SwitchWContexts();
+
   // TODO(antonin): return reference instead?
   //! Access a Context by context id, throws a std::out_of_range exception if
   //! \p cxt_id is invalid.
@@ -118,6 +138,10 @@ class SwitchWContexts : public DevMgr, public RuntimeInterface {
 
   int receive(port_t port_num, const char *buffer, int len);
 
+  //! Same as receive(port_t, const char *, int), for port managers which can
+  //! hand over the packet data without copying it.
+  int receive(port_t port_num, PacketBuffer &&buffer);
+
   //! Call this function when you are ready to process packets. This function
   //! will call start_and_return_() which you have to override in your switch
   //! implementation. Note that if the switch is started without a P4
@@ -129,6 +153,16 @@ class SwitchWContexts : public DevMgr, public RuntimeInterface {
   //! Returns the Thrift port used for the runtime RPC server.
   int get_runtime_port() const { return thrift_port; }
 
+  //! Returns the type of Thrift server to run for the runtime RPC service
+  //! ("threaded", "thread-pool" or "nonblocking").
+  const std::string &get_runtime_server_type() const {
+    return thrift_server_type;
+  }
+
+  //! Returns the number of worker threads for the runtime RPC server, ignored
+  //! by the "threaded" server.
+  int get_runtime_server_workers() const { return thrift_workers; }
+
   //! Returns the device id for this switch instance.
   device_id_t get_device_id() const { return device_id; }
 
@@ -147,6 +181,10 @@ class SwitchWContexts : public DevMgr, public RuntimeInterface {
   //! Disable JSON config swapping for the switch.
   void disable_config_swap();
 
+  //! Choose what happens to the state of the current configuration when a new
+  //! one is swapped in. Applies to the configurations loaded after the call.
+  void set_swap_mode(SwapMode mode);
+
   //! Specify that the field is required for this target switch, i.e. the field
   //! needs to be defined in the input JSON. This function is purely meant as a
   //! safeguard and you should use it for error checking. For example, the
@@ -262,12 +300,18 @@ class SwitchWContexts : public DevMgr, public RuntimeInterface {
   int swap_requested();
 
   //! Performs a configuration swap if one was requested by the control
-  //! plane. Returns `0` if a swap had indeed been requested, `1` otherwise. If
-  //! a swap was requested, the method will prevent new Packet instances from
-  //! being created and will block until all existing instances have been
-  //! destroyed. It will then perform the swap. Care should be taken when using
-  //! this function, as it invalidates some pointers that your target may still
-  //! be using. See switch.h documentation for more information.
+  //! plane. Returns `0` if a swap had indeed been requested, `1` otherwise. The
+  //! swap does not wait for the existing Packet instances, they keep using the
+  //! old configuration while the new ones use the new configuration. When the
+  //! last Packet using the old configuration is destroyed, what these packets
+  //! modified in the counters and registers migrated with
+  //! SwapMode::MIGRATE_STATE is carried over to the new configuration (the
+  //! rest of the state was copied when the configuration was loaded), and the
+  //! old configuration is released, all in a background thread. Note that
+  //! swap_configs() calls this method as well, so calling it from the target
+  //! is optional. Care should be taken when using this function, as it
+  //! invalidates the pointers returned by the methods which do not take a
+  //! Packet. See switch.h documentation for more information.
   int do_swap();
 
   //! Utility function which prevents new Packet instances from being
@@ -275,6 +319,15 @@ class SwitchWContexts : public DevMgr, public RuntimeInterface {
   //! destroyed in all contexts
   void block_until_no_more_packets();
 
+  //! Creates PHVs from the calling thread until \p count unused PHVs are
+  //! available in the PHV pool of each context. The new PHVs are allocated,
+  //! and therefore first touched, by the calling thread, i.e. on its NUMA
+  //! node; they are recycled through the pools when packets are destroyed. A
+  //! target can call this from the thread which consumes the packets after
+  //! ThreadAffinity::apply(). The pools are emptied by a swap, after which
+  //! PHVs are again created by the threads which receive packets.
+  void reserve_phvs(size_t count);
+
   //! Construct and return a Packet instance for the given \p cxt_id.
   std::unique_ptr<Packet> new_packet_ptr(cxt_id_t cxt_id, port_t ingress_port,
                                          packet_id_t id, int ingress_length,
@@ -293,6 +346,12 @@ class SwitchWContexts : public DevMgr, public RuntimeInterface {
     return contexts.at(cxt_id).get_learn_engine();
   }
 
+  //! Obtain a pointer to the LearnEngine of the configuration \p packet was
+  //! created with, in the Context of \p packet. See switch.h documentation.
+  LearnEngineIface *get_learn_engine(const Packet &packet) {
+    return contexts.at(packet.get_context()).get_learn_engine(packet);
+  }
+
   AgeingMonitorIface *get_ageing_monitor(cxt_id_t cxt_id) {
     return contexts.at(cxt_id).get_ageing_monitor();
   }
@@ -383,6 +442,13 @@ class SwitchWContexts : public DevMgr, public RuntimeInterface {
     return contexts.at(cxt_id).mt_set_entry_ttl(table_name, handle, ttl_ms);
   }
 
+  MatchErrorCode
+  mt_write_entries(cxt_id_t cxt_id,
+                   std::vector<MtWriteOp> *ops,
+                   bool atomic) override {
+    return contexts.at(cxt_id).mt_write_entries(ops, atomic);
+  }
+
   // action profiles
 
   MatchErrorCode
@@ -571,6 +637,33 @@ class SwitchWContexts : public DevMgr, public RuntimeInterface {
     return contexts.at(cxt_id).mt_get_entries<MatchTableIndirectWS>(table_name);
   }
 
+  MatchErrorCode
+  mt_get_entries(cxt_id_t cxt_id, const std::string &table_name,
+                 size_t *cursor, size_t max_entries,
+                 std::vector<MatchTable::Entry> *entries,
+                 bool *more) const override {
+    return contexts.at(cxt_id).mt_get_entries<MatchTable>(
+        table_name, cursor, max_entries, entries, more);
+  }
+
+  MatchErrorCode
+  mt_indirect_get_entries(cxt_id_t cxt_id, const std::string &table_name,
+                          size_t *cursor, size_t max_entries,
+                          std::vector<MatchTableIndirect::Entry> *entries,
+                          bool *more) const override {
+    return contexts.at(cxt_id).mt_get_entries<MatchTableIndirect>(
+        table_name, cursor, max_entries, entries, more);
+  }
+
+  MatchErrorCode
+  mt_indirect_ws_get_entries(cxt_id_t cxt_id, const std::string &table_name,
+                             size_t *cursor, size_t max_entries,
+                             std::vector<MatchTableIndirectWS::Entry> *entries,
+                             bool *more) const override {
+    return contexts.at(cxt_id).mt_get_entries<MatchTableIndirectWS>(
+        table_name, cursor, max_entries, entries, more);
+  }
+
   MatchErrorCode
   mt_get_entry(cxt_id_t cxt_id, const std::string &table_name,
                entry_handle_t handle, MatchTable::Entry *entry) const override {
@@ -661,6 +754,17 @@ class SwitchWContexts : public DevMgr, public RuntimeInterface {
     return contexts.at(cxt_id).mt_reset_counters(table_name);
   }
 
+  MatchErrorCode
+  mt_read_all_counters(
+      cxt_id_t cxt_id, const std::string &table_name,
+      std::vector<entry_handle_t> *handles,
+      std::vector<MatchTableAbstract::counter_value_t> *bytes,
+      std::vector<MatchTableAbstract::counter_value_t> *packets,
+      bool reset) override {
+    return contexts.at(cxt_id).mt_read_all_counters(
+        table_name, handles, bytes, packets, reset);
+  }
+
   MatchErrorCode
   mt_write_counters(cxt_id_t cxt_id,
                     const std::string &table_name,
@@ -701,6 +805,27 @@ class SwitchWContexts : public DevMgr, public RuntimeInterface {
     return contexts.at(cxt_id).reset_counters(counter_name);
   }
 
+  Counter::CounterErrorCode
+  read_counters_range(
+      cxt_id_t cxt_id, const std::string &counter_name,
+      size_t start, size_t end,
+      std::vector<MatchTableAbstract::counter_value_t> *bytes,
+      std::vector<MatchTableAbstract::counter_value_t> *packets,
+      bool reset) override {
+    return contexts.at(cxt_id).read_counters_range(
+        counter_name, start, end, bytes, packets, reset);
+  }
+
+  Counter::CounterErrorCode
+  read_all_counters(
+      cxt_id_t cxt_id, const std::string &counter_name,
+      std::vector<MatchTableAbstract::counter_value_t> *bytes,
+      std::vector<MatchTableAbstract::counter_value_t> *packets,
+      bool reset) override {
+    return contexts.at(cxt_id).read_all_counters(
+        counter_name, bytes, packets, reset);
+  }
+
   Counter::CounterErrorCode
   write_counters(cxt_id_t cxt_id,
                  const std::string &counter_name,
@@ -732,6 +857,13 @@ class SwitchWContexts : public DevMgr, public RuntimeInterface {
     return contexts.at(cxt_id).meter_get_rates(meter_name, idx, configs);
   }
 
+  MeterErrorCode
+  meter_array_get_rates(
+      cxt_id_t cxt_id, const std::string &meter_name,
+      std::vector<std::vector<Meter::rate_config_t> > *configs) override {
+    return contexts.at(cxt_id).meter_array_get_rates(meter_name, configs);
+  }
+
   RegisterErrorCode
   register_read(cxt_id_t cxt_id,
                 const std::string &register_name,
@@ -785,6 +917,37 @@ class SwitchWContexts : public DevMgr, public RuntimeInterface {
   RuntimeInterface::ErrorCode
   serialize(std::ostream *out) override;
 
+  RuntimeInterface::ErrorCode
+  snapshot_state(const std::string &path, bool background) override;
+
+  SnapshotStatus
+  get_snapshot_status() const override;
+
+  ProfilingStats
+  get_profiling_stats(cxt_id_t cxt_id) const override {
+    return contexts.at(cxt_id).get_profiling_stats();
+  }
+
+  void
+  reset_profiling_stats(cxt_id_t cxt_id) override {
+    contexts.at(cxt_id).reset_profiling_stats();
+  }
+
+  void
+  set_profiling_enabled(bool enabled) override {
+    ProfilingCounters::set_enabled(enabled);
+  }
+
+  std::vector<LockStats::Snapshot>
+  get_lock_stats() const override {
+    return LockStats::get_all();
+  }
+
+  void
+  reset_lock_stats() override {
+    LockStats::reset_all();
+  }
+
   RuntimeInterface::ErrorCode
   load_new_config(const std::string &new_config) override;
 
@@ -851,18 +1014,32 @@ class SwitchWContexts : public DevMgr, public RuntimeInterface {
   }
 
   int deserialize(std::istream *in);
+  int deserialize(SnapshotReader *in);
+  //! Accepts both the output of serialize() and binary snapshots written by
+  //! snapshot_state(); the latter are memory-mapped.
   int deserialize_from_file(const std::string &state_dump_path);
 
  private:
-  int init_objects(std::istream *is, device_id_t dev_id,
+  // cfg_root is nullptr for init_objects_empty()
+  int init_objects(const Json::Value *cfg_root, device_id_t dev_id,
                    std::shared_ptr<TransportIface> transport);
 
   void reset_target_state();
 
+  ErrorCode write_snapshot(std::ofstream *fs, const std::string &path,
+                           size_t chunk_size);
+
   //! Override in your switch implementation; it will be called every time a
   //! packet is received.
   virtual int receive_(port_t port_num, const char *buffer, int len) = 0;
 
+  //! Override in your switch implementation if you want to avoid a copy of the
+  //! packet data when the port manager supports it (e.g. AF_XDP ports). \p
+  //! buffer holds the packet data and the headroom available for new headers
+  //! may be smaller than what your receive_() implementation uses (but will be
+  //! at least 256 bytes). The default implementation calls receive_().
+  virtual int receive_buffer_(port_t port_num, PacketBuffer &&buffer);
+
   //! Override in your switch implementation; do all your initialization in this
   //! function (e.g. start processing threads) and call start_and_return() when
   //! you are ready to process packets. See start_and_return() for more
@@ -895,6 +1072,10 @@ class SwitchWContexts : public DevMgr, public RuntimeInterface {
   std::shared_ptr<LookupStructureFactory> lookup_factory{nullptr};
 
   bool enable_swap{false};
+  SwapMode swap_mode{SwapMode::RESET_STATE};
+  // releases the configurations swapped out by do_swap(), away from the packet
+  // processing threads
+  std::shared_ptr<P4ObjectsReaper> reaper{nullptr};
 
   std::unique_ptr<PHVSourceIface> phv_source{nullptr};
 
@@ -904,6 +1085,8 @@ class SwitchWContexts : public DevMgr, public RuntimeInterface {
   ForceArith arith_objects{};
 
   int thrift_port{};
+  std::string thrift_server_type{"threaded"};
+  int thrift_workers{4};
 
   device_id_t device_id{};
 
@@ -916,10 +1099,15 @@ class SwitchWContexts : public DevMgr, public RuntimeInterface {
 
   std::string current_config{"{}"};  // empty JSON config
   bool config_loaded{false};
-  mutable std::condition_variable config_loaded_cv{};
-  mutable std::mutex config_mutex{};
+  mutable InstrumentedConditionVariable config_loaded_cv{};
+  mutable InstrumentedMutex config_mutex{};
 
   std::string event_logger_addr{};
+
+  // protects snapshot_status, see snapshot_state()
+  mutable std::mutex snapshot_mutex{};
+  SnapshotStatus snapshot_status{};
+  std::thread snapshot_thread{};
 };
 
 
@@ -990,6 +1178,33 @@ class Switch : public SwitchWContexts {
     return get_context(0)->get_field_list(field_list_id);
   }
 
+  //! Return a raw, non-owning pointer to Pipeline \p name in the configuration
+  //! \p packet was created with. This pointer remains valid as long as \p
+  //! packet exists, even if a configuration swap is performed in the meantime.
+  //! Return a nullptr if there is no pipeline with this name.
+  Pipeline *get_pipeline(const Packet &packet, const std::string &name) {
+    return get_context(0)->get_pipeline(packet, name);
+  }
+
+  //! Same as get_pipeline(const Packet &, const std::string &), for Parser
+  //! \p name.
+  Parser *get_parser(const Packet &packet, const std::string &name) {
+    return get_context(0)->get_parser(packet, name);
+  }
+
+  //! Same as get_pipeline(const Packet &, const std::string &), for Deparser
+  //! \p name.
+  Deparser *get_deparser(const Packet &packet, const std::string &name) {
+    return get_context(0)->get_deparser(packet, name);
+  }
+
+  //! Same as get_pipeline(const Packet &, const std::string &), for the
+  //! FieldList with id \p field_list_id.
+  FieldList *get_field_list(const Packet &packet,
+                            const p4object_id_t field_list_id) {
+    return get_context(0)->get_field_list(packet, field_list_id);
+  }
+
   // Added for testing, other "object types" can be added if needed
   p4object_id_t get_table_id(const std::string &name) {
     return get_context(0)->get_table_id(name);
@@ -0,0 +1,94 @@
+/* Copyright 2013-present Barefoot Networks, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Antonin Bas (antonin@barefootnetworks.com)
+ *
+ */
+
+//! @file thread_affinity.h
+
+#ifndef BM_BM_SIM_THREAD_AFFINITY_H_
+#define BM_BM_SIM_THREAD_AFFINITY_H_
+
+#include <string>
+#include <vector>
+
+namespace bm {
+
+//! Process-wide CPU affinity and NUMA placement settings for the different
+//! classes of threads started by bmv2 and its targets. The settings are
+//! usually provided on the command line (see OptionsParser) and each thread
+//! calls apply() with its class name when it starts. The thread classes
+//! recognized by bmv2 are:
+//!   - `ingress`, `egress` and `transmit`: the packet processing threads of
+//! the target
+//!   - `packet_in`: the thread receiving packets from the packet-in nanomsg
+//! socket
+//!   - `port_rx`: the threads receiving packets from the interfaces (BMI
+//! receive threads, AF_PACKET and AF_XDP receive threads)
+//!   - `learning`: the threads sending learning notifications
+//!   - `ageing`: the thread sweeping match tables for expired entries
+//!
+//! When a NUMA node is configured for a thread class, apply() sets a
+//! preferred-node memory policy for the calling thread only: the memory this
+//! thread allocates is taken from that node when possible. When the `ingress`
+//! class is placed, the ingress thread of simple_switch and psa_switch fills
+//! the PHV pools after calling apply() (see SwitchWContexts::reserve_phvs()),
+//! so that the PHVs it consumes are first touched on its node; PHVs are
+//! recycled through the pools and stay there. Packet buffers are still
+//! allocated by the thread which receives the packet (e.g. `port_rx`) and the
+//! storage of the queues between threads (a std::deque of packet pointers) by
+//! whichever thread grows it. To keep this data local, the producer and
+//! consumer classes should be placed on the same node.
+class ThreadAffinity {
+ public:
+  //! Returns the list of thread classes which can be configured
+  static const std::vector<std::string> &thread_classes();
+
+  //! Returns true iff \p thread_class is one of thread_classes()
+  static bool is_valid_thread_class(const std::string &thread_class);
+
+  //! The threads of class \p thread_class are distributed round-robin over
+  //! the provided CPUs, each thread being pinned to a single CPU.
+  static void set_cpus(const std::string &thread_class,
+                       const std::vector<int> &cpus);
+
+  //! The threads of class \p thread_class can run on any CPU of the NUMA node
+  //! (unless set_cpus() was also called for this class) and allocate memory
+  //! from that node when possible.
+  static void set_numa_node(const std::string &thread_class, int node);
+
+  //! Returns true iff CPUs or a NUMA node were configured for \p
+  //! thread_class
+  static bool is_placed(const std::string &thread_class);
+
+  //! Removes all settings
+  static void clear();
+
+  //! Applies the settings for \p thread_class to the calling thread, \p
+  //! thread_idx is the index of the thread within its class (e.g. the egress
+  //! worker id). Returns 0 if successful or if there is nothing to do for this
+  //! class, a non-zero value otherwise (the error is also logged).
+  static int apply(const std::string &thread_class, size_t thread_idx = 0);
+
+  //! Parses a Linux-style CPU list such as `0-3,8,10-11`. Returns false if the
+  //! string is not a valid list.
+  static bool parse_cpu_list(const std::string &str, std::vector<int> *cpus);
+};
+
+}  // namespace bm
+
+#endif  // BM_BM_SIM_THREAD_AFFINITY_H_
@@ -40,15 +40,26 @@ typedef struct bmi_port_stats_s {
    returns. */
 typedef void (*bmi_packet_handler_t)(int port_num, const char *buffer, int len, void *cookie);
 
-int bmi_port_create_mgr(bmi_port_mgr_t **port_mgr);
+/* Packets are received by a pool of nb_rx_threads threads, each port being
+   owned by a single thread. */
+int bmi_port_create_mgr(bmi_port_mgr_t **port_mgr, int nb_rx_threads);
 
-/* Start running the port manager on its own thread */
+/* Start running the port manager on its own threads */
 int bmi_start_mgr(bmi_port_mgr_t *port_mgr);
 
 int bmi_set_packet_handler(bmi_port_mgr_t *port_mgr,
 			   bmi_packet_handler_t packet_handler,
 			   void *cookie);
 
+/* called by each receive thread when it starts, with the index of the thread
+   in [0, nb_rx_threads), e.g. to set its CPU affinity */
+typedef void (*bmi_thread_start_fn_t)(int thread_idx, void *cookie);
+
+/* must be called before bmi_start_mgr */
+int bmi_set_thread_start_fn(bmi_port_mgr_t *port_mgr,
+			    bmi_thread_start_fn_t thread_start_fn,
+			    void *cookie);
+
 int bmi_port_send(bmi_port_mgr_t *port_mgr,
 		  int port_num, const char *buffer, int len);
 
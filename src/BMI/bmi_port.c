@@ -30,6 +30,7 @@
 #include "BMI/bmi_port.h"
 
 #include <fcntl.h>
+#include <sys/epoll.h>
 #include <sys/stat.h>
 
 typedef struct bmi_port_s {
@@ -37,19 +38,39 @@ typedef struct bmi_port_s {
   int port_num;
   char *ifname;
   int fd;
-  pthread_mutex_t stats_lock;
+  /* index of the receive thread which owns the port */
+  int rx_thread;
+  /* only accessed with atomic builtins, no lock required */
   bmi_port_stats_t stats;
 } bmi_port_t;
 
 #define PORT_COUNT_MAX 512
 
+/* maximum number of packets read from a port before moving on to the next
+   ready port */
+#define RX_BURST_SIZE 32
+
+#define RX_MAX_EVENTS 64
+
+typedef struct bmi_rx_thread_s {
+  struct bmi_port_mgr_s *port_mgr;
+  int epoll_fd;
+  /* number of ports owned by this thread */
+  int nb_ports;
+  int thread_idx;
+  pthread_t thread;
+} bmi_rx_thread_t;
+
 typedef struct bmi_port_mgr_s {
   bmi_port_t ports_info[PORT_COUNT_MAX];
-  fd_set fds;
-  int max_fd;
   void *cookie;
   bmi_packet_handler_t packet_handler;
-  pthread_t select_thread;
+  bmi_thread_start_fn_t thread_start_fn;
+  void *thread_start_cookie;
+  int nb_rx_threads;
+  bmi_rx_thread_t *rx_threads;
+  int started;
+  int stop;
   /* We use a RW mutex to protect port_mgr and port state. Send & receive will
   acquire a read lock, while port_add and port_remove will acquire a write
   lock. Using a single mutex for the port_mgr is much easier than having one for
@@ -70,57 +91,65 @@ static inline bmi_port_t *get_port(bmi_port_mgr_t *port_mgr, int port_num) {
   return &port_mgr->ports_info[port_num];
 }
 
-static void *run_select(void *data) {
-  bmi_port_mgr_t *port_mgr = (bmi_port_mgr_t *) data;
-  int n;
-  int i;
-  bmi_port_t *port_info;
+static inline void stats_add(uint64_t *counter, uint64_t v) {
+  __atomic_fetch_add(counter, v, __ATOMIC_RELAXED);
+}
+
+/* reads up to RX_BURST_SIZE packets from the port, must be called with the read
+   lock held */
+static void port_receive_burst(bmi_port_mgr_t *port_mgr, int port_num) {
+  bmi_port_t *port_info = get_port(port_mgr, port_num);
   const char *pkt_data;
   int pkt_len;
-  fd_set fds;
-  int max_fd;
+  uint64_t packets = 0;
+  uint64_t octets = 0;
+  int i;
 
-  struct timeval timeout;
-  while(1) {
-    /* timeout is needed to update set */
-    timeout.tv_sec = 0;
-    timeout.tv_usec = 100000;
+  if(!port_in_use(port_info)) return;
+
+  /* the pcap handle is in non-blocking mode, bmi_interface_recv returns -1
+     when there is no packet left to read */
+  for(i = 0; i < RX_BURST_SIZE; i++) {
+    pkt_len = bmi_interface_recv(port_info->bmi, &pkt_data);
+    if(pkt_len < 0) break;
+    packets++;
+    octets += pkt_len;
+    if(port_mgr->packet_handler)
+      port_mgr->packet_handler(port_num, pkt_data, pkt_len, port_mgr->cookie);
+  }
 
-    /* copy the FD set for select call */
-    pthread_rwlock_rdlock(&port_mgr->lock);
-    fds = port_mgr->fds;
-    max_fd = port_mgr->max_fd;
-    pthread_rwlock_unlock(&port_mgr->lock);
+  if(packets > 0) {
+    stats_add(&port_info->stats.in_packets, packets);
+    stats_add(&port_info->stats.in_octets, octets);
+  }
+}
 
-    n = select(max_fd + 1, &fds, NULL, NULL, &timeout);
-    assert(n >= 0 || errno == EINTR);
+static void *run_rx_thread(void *data) {
+  bmi_rx_thread_t *rx_thread = (bmi_rx_thread_t *) data;
+  bmi_port_mgr_t *port_mgr = rx_thread->port_mgr;
+  struct epoll_event events[RX_MAX_EVENTS];
+  int n;
+  int i;
+
+  if(port_mgr->thread_start_fn)
+    port_mgr->thread_start_fn(rx_thread->thread_idx,
+                              port_mgr->thread_start_cookie);
 
-    /* the thread terminates */
-    if(max_fd == -1) return NULL;
+  while(!__atomic_load_n(&port_mgr->stop, __ATOMIC_ACQUIRE)) {
+    /* timeout is needed to check the stop flag */
+    n = epoll_wait(rx_thread->epoll_fd, events, RX_MAX_EVENTS, 100);
+    assert(n >= 0 || errno == EINTR);
 
     if(n <= 0) { // timeout or EINTR
       continue;
     }
 
+    /* a port may have been removed (and even re-added) since epoll_wait
+       returned, which is harmless: reads are non-blocking */
     pthread_rwlock_rdlock(&port_mgr->lock);
-
-    /* if we had a mutex for each port, there would potentially be a lot of
-    overhead to acquire / release the lock at each iteration - we would need to
-    hold the lock to call FD_ISSET... */
-    for(i = 0; n && i < PORT_COUNT_MAX; i++) {
-      port_info = get_port(port_mgr, i);
-      if(!FD_ISSET(port_info->fd, &fds)) continue;
-      --n;
-      if(!port_info->bmi) continue;
-      pkt_len = bmi_interface_recv(port_info->bmi, &pkt_data);
-      if(pkt_len < 0 || !port_mgr->packet_handler) continue;
-      port_mgr->packet_handler(i, pkt_data, pkt_len, port_mgr->cookie);
-      pthread_mutex_lock(&port_info->stats_lock);
-      port_info->stats.in_packets += 1;
-      port_info->stats.in_octets += pkt_len;
-      pthread_mutex_unlock(&port_info->stats_lock);
+    for(i = 0; i < n; i++) {
+      port_receive_burst(port_mgr, (int) events[i].data.u32);
     }
-
     pthread_rwlock_unlock(&port_mgr->lock);
   }
 
@@ -128,30 +157,53 @@ static void *run_select(void *data) {
 }
 
 int bmi_start_mgr(bmi_port_mgr_t* port_mgr) {
-  return pthread_create(&port_mgr->select_thread, NULL, run_select, port_mgr);
+  int i;
+  int exitCode;
+  for(i = 0; i < port_mgr->nb_rx_threads; i++) {
+    bmi_rx_thread_t *rx_thread = &port_mgr->rx_threads[i];
+    exitCode = pthread_create(&rx_thread->thread, NULL, run_rx_thread,
+                              rx_thread);
+    if (exitCode != 0) return exitCode;
+    port_mgr->started = i + 1;
+  }
+  return 0;
 }
 
-int bmi_port_create_mgr(bmi_port_mgr_t **port_mgr) {
+int bmi_port_create_mgr(bmi_port_mgr_t **port_mgr, int nb_rx_threads) {
+  if(!port_mgr || nb_rx_threads <= 0) return -1;
+
   bmi_port_mgr_t *port_mgr_ = malloc(sizeof(bmi_port_mgr_t));
   int exitCode;
-  if(!port_mgr) return -1;
+  if(!port_mgr_) return -1;
 
   memset(port_mgr_, 0, sizeof(bmi_port_mgr_t));
 
-  FD_ZERO(&port_mgr_->fds);
-
-  exitCode = pthread_rwlock_init(&port_mgr_->lock, NULL);
-  if (exitCode != 0)
-    return exitCode;
+  port_mgr_->rx_threads = calloc(nb_rx_threads, sizeof(bmi_rx_thread_t));
+  if(!port_mgr_->rx_threads) {
+    free(port_mgr_);
+    return -1;
+  }
+  port_mgr_->nb_rx_threads = nb_rx_threads;
 
   int i;
-  for(i = 0; i < PORT_COUNT_MAX; i++) {
-    bmi_port_t *port_info = get_port(port_mgr_, i);
-    exitCode = pthread_mutex_init(&port_info->stats_lock, NULL);
-    if (exitCode != 0)
+  for(i = 0; i < nb_rx_threads; i++) {
+    bmi_rx_thread_t *rx_thread = &port_mgr_->rx_threads[i];
+    rx_thread->port_mgr = port_mgr_;
+    rx_thread->thread_idx = i;
+    rx_thread->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if(rx_thread->epoll_fd < 0) {
+      exitCode = errno;
+      while(--i >= 0) close(port_mgr_->rx_threads[i].epoll_fd);
+      free(port_mgr_->rx_threads);
+      free(port_mgr_);
       return exitCode;
+    }
   }
 
+  exitCode = pthread_rwlock_init(&port_mgr_->lock, NULL);
+  if (exitCode != 0)
+    return exitCode;
+
   *port_mgr = port_mgr_;
   return 0;
 }
@@ -166,6 +218,15 @@ int bmi_set_packet_handler(bmi_port_mgr_t *port_mgr,
   return 0;
 }
 
+int bmi_set_thread_start_fn(bmi_port_mgr_t *port_mgr,
+                            bmi_thread_start_fn_t thread_start_fn,
+                            void *cookie) {
+  if(port_mgr->started) return -1;
+  port_mgr->thread_start_fn = thread_start_fn;
+  port_mgr->thread_start_cookie = cookie;
+  return 0;
+}
+
 int bmi_port_send(bmi_port_mgr_t *port_mgr,
                   int port_num, const char *buffer, int len) {
   if(!port_num_valid(port_num)) return -1;
@@ -179,10 +240,8 @@ int bmi_port_send(bmi_port_mgr_t *port_mgr,
 
   int exitCode = bmi_interface_send(port->bmi, buffer, len);
   if (!exitCode) {
-    pthread_mutex_lock(&port->stats_lock);
-    port->stats.out_packets += 1;
-    port->stats.out_octets += len;
-    pthread_mutex_unlock(&port->stats_lock);
+    stats_add(&port->stats.out_packets, 1);
+    stats_add(&port->stats.out_octets, len);
   }
 
   pthread_rwlock_unlock(&port_mgr->lock);
@@ -196,23 +255,41 @@ static int _bmi_port_interface_add(bmi_port_mgr_t *port_mgr,
                                    const char* pcap_output_dump) {
   bmi_port_t *port = get_port(port_mgr, port_num);
   if(port_in_use(port)) return -1;
-  port->ifname = strdup(ifname);
 
   bmi_interface_t *bmi;
   if(bmi_interface_create(&bmi, ifname) != 0) return -1;
 
+  /* the port is owned by the receive thread with the fewest ports */
+  int rx_thread = 0;
+  int i;
+  for(i = 1; i < port_mgr->nb_rx_threads; i++) {
+    if(port_mgr->rx_threads[i].nb_ports <
+       port_mgr->rx_threads[rx_thread].nb_ports)
+      rx_thread = i;
+  }
+
+  int fd = bmi_interface_get_fd(bmi);
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  event.data.u32 = (uint32_t) port_num;
+  if(epoll_ctl(port_mgr->rx_threads[rx_thread].epoll_fd, EPOLL_CTL_ADD, fd,
+               &event) != 0) {
+    bmi_interface_destroy(bmi);
+    return -1;
+  }
+
   if(pcap_input_dump) bmi_interface_add_dumper(bmi, pcap_input_dump, 1);
   if(pcap_output_dump) bmi_interface_add_dumper(bmi, pcap_output_dump, 0);
 
   port->bmi = bmi;
-
-  memset(&port->stats, 0, sizeof(port->stats));
-
-  int fd = bmi_interface_get_fd(port->bmi);
+  port->port_num = port_num;
+  port->ifname = strdup(ifname);
   port->fd = fd;
+  port->rx_thread = rx_thread;
+  port_mgr->rx_threads[rx_thread].nb_ports++;
 
-  if(fd > port_mgr->max_fd) port_mgr->max_fd = fd;
-  FD_SET(fd, &port_mgr->fds);
+  memset(&port->stats, 0, sizeof(port->stats));
 
   return 0;
 }
@@ -235,14 +312,17 @@ int bmi_port_interface_add(bmi_port_mgr_t *port_mgr,
 static int _bmi_port_interface_remove(bmi_port_mgr_t *port_mgr, int port_num) {
   bmi_port_t *port = get_port(port_mgr, port_num);
   if(!port_in_use(port)) return -1;
+
+  bmi_rx_thread_t *rx_thread = &port_mgr->rx_threads[port->rx_thread];
+  epoll_ctl(rx_thread->epoll_fd, EPOLL_CTL_DEL, port->fd, NULL);
+  rx_thread->nb_ports--;
+
   free(port->ifname);
 
   if(bmi_interface_destroy(port->bmi) != 0) return -1;
 
   memset(port, 0, sizeof(bmi_port_t));
 
-  FD_CLR(port->fd, &port_mgr->fds);
-
   return 0;
 }
 
@@ -263,16 +343,17 @@ int bmi_port_destroy_mgr(bmi_port_mgr_t *port_mgr) {
     if(port_in_use(port)) _bmi_port_interface_remove(port_mgr, i);
   }
 
-  port_mgr->max_fd = -1;  // used to signal the thread it needs to terminate
+  // signals the threads that they need to terminate
+  __atomic_store_n(&port_mgr->stop, 1, __ATOMIC_RELEASE);
   pthread_rwlock_unlock(&port_mgr->lock);
-  pthread_join(port_mgr->select_thread, NULL);
+  for(i = 0; i < port_mgr->started; i++)
+    pthread_join(port_mgr->rx_threads[i].thread, NULL);
 
-  for(i = 0; i < PORT_COUNT_MAX; i++) {
-    bmi_port_t *port = get_port(port_mgr, i);
-    pthread_mutex_destroy(&port->stats_lock);
-  }
+  for(i = 0; i < port_mgr->nb_rx_threads; i++)
+    close(port_mgr->rx_threads[i].epoll_fd);
 
   pthread_rwlock_destroy(&port_mgr->lock);
+  free(port_mgr->rx_threads);
   free(port_mgr);
 
   return 0;
@@ -326,9 +407,14 @@ int bmi_port_get_stats(bmi_port_mgr_t *port_mgr,
     return -1;
   }
 
-  pthread_mutex_lock(&port->stats_lock);
-  *port_stats = port->stats;
-  pthread_mutex_unlock(&port->stats_lock);
+  port_stats->in_packets =
+      __atomic_load_n(&port->stats.in_packets, __ATOMIC_RELAXED);
+  port_stats->in_octets =
+      __atomic_load_n(&port->stats.in_octets, __ATOMIC_RELAXED);
+  port_stats->out_packets =
+      __atomic_load_n(&port->stats.out_packets, __ATOMIC_RELAXED);
+  port_stats->out_octets =
+      __atomic_load_n(&port->stats.out_octets, __ATOMIC_RELAXED);
 
   pthread_rwlock_unlock(&port_mgr->lock);
 
@@ -348,11 +434,17 @@ int bmi_port_clear_stats(bmi_port_mgr_t *port_mgr,
     return -1;
   }
 
-  pthread_mutex_lock(&port->stats_lock);
+  bmi_port_stats_t stats;
+  stats.in_packets =
+      __atomic_exchange_n(&port->stats.in_packets, 0, __ATOMIC_RELAXED);
+  stats.in_octets =
+      __atomic_exchange_n(&port->stats.in_octets, 0, __ATOMIC_RELAXED);
+  stats.out_packets =
+      __atomic_exchange_n(&port->stats.out_packets, 0, __ATOMIC_RELAXED);
+  stats.out_octets =
+      __atomic_exchange_n(&port->stats.out_octets, 0, __ATOMIC_RELAXED);
   if (port_stats != NULL)
-    *port_stats = port->stats;
-  memset(&port->stats, 0, sizeof(port->stats));
-  pthread_mutex_unlock(&port->stats_lock);
+    *port_stats = stats;
 
   pthread_rwlock_unlock(&port_mgr->lock);
 
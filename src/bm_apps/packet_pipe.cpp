@@ -18,7 +18,9 @@
  *
  */
 
+
 #include <bm/bm_apps/packet_pipe.h>
+#include <bm/bm_sim/shm_packet_ring.h>
 
 #include <nanomsg/pair.h>
 
@@ -28,6 +30,10 @@
 #include <condition_variable>
 #include <memory>
 #include <iostream>
+#include <chrono>
+#include <cassert>
+#include <cstring>
+#include <functional>
 
 #include "nn.h"
 
@@ -43,17 +49,14 @@ struct packet_hdr_t {
 
 }  // namespace
 
-class PacketInjectImp final {
+// transport-independent part of the client, the subclasses implement
+// send_msg() and receive()
+class PacketInjectImp {
   using PacketReceiveCb = PacketInject::PacketReceiveCb;
+  using Packet = PacketInject::Packet;
 
  public:
-  explicit PacketInjectImp(const std::string &addr)
-      : addr(addr), s(AF_SP, NN_PAIR) {
-    s.connect(addr.c_str());
-    int rcv_timeout_ms = 100;
-    s.setsockopt(NN_SOL_SOCKET, NN_RCVTIMEO,
-                 &rcv_timeout_ms, sizeof(rcv_timeout_ms));
-  }
+  virtual ~PacketInjectImp() { }
 
   void start() {
     if (started || stop_receive_thread)
@@ -67,7 +70,7 @@ class PacketInjectImp final {
       std::unique_lock<std::mutex> lock(mutex);
       stop_receive_thread = true;
     }
-    receive_thread.join();
+    if (receive_thread.joinable()) receive_thread.join();
   }
 
   void set_packet_receiver(const PacketReceiveCb &cb, void *cookie) {
@@ -77,44 +80,33 @@ class PacketInjectImp final {
   }
 
   void send(int port_num, const char *buffer, int len) {
-    struct nn_msghdr msghdr;
-    std::memset(&msghdr, 0, sizeof(msghdr));
-    struct nn_iovec iov;
-
-    packet_hdr_t packet_hdr;
-    packet_hdr.type = MSG_TYPE_PACKET_IN;
-    packet_hdr.port = port_num;
-    packet_hdr.more = len;
-
-    // not sure I can do better than this here
-    void *msg = nn::allocmsg(sizeof(packet_hdr) + len, 0);
-    std::memcpy(msg, &packet_hdr, sizeof(packet_hdr));
-    std::memcpy(static_cast<char *>(msg) + sizeof(packet_hdr), buffer, len);
-    iov.iov_base = &msg;
-    iov.iov_len = NN_MSG;
-
-    msghdr.msg_iov = &iov;
-    msghdr.msg_iovlen = 1;
+    send_msg(MSG_TYPE_PACKET_IN, port_num, len, buffer, len);
+    if (log_packets)
+      std::cout << "packet send for port " << port_num << std::endl;
+  }
 
-    s.sendmsg(&msghdr, 0);
-    std::cout << "packet send for port " << port_num << std::endl;
+  virtual void send_burst(const Packet *packets, size_t count) {
+    for (size_t i = 0; i < count; i++)
+      send(packets[i].port_num, packets[i].buffer, packets[i].len);
   }
 
   // these 4 port_* functions are optional, depending on receiver configuration
   void port_add(int port_num) {
-    send_port_msg(MSG_TYPE_PORT_ADD, port_num, 0);
+    send_msg(MSG_TYPE_PORT_ADD, port_num, 0, nullptr, 0);
   }
 
   void port_remove(int port_num) {
-    send_port_msg(MSG_TYPE_PORT_REMOVE, port_num, 0);
+    send_msg(MSG_TYPE_PORT_REMOVE, port_num, 0, nullptr, 0);
   }
 
   void port_bring_up(int port_num) {
-    send_port_msg(MSG_TYPE_PORT_SET_STATUS, port_num, MSG_PORT_STATUS_UP);
+    send_msg(MSG_TYPE_PORT_SET_STATUS, port_num, MSG_PORT_STATUS_UP,
+             nullptr, 0);
   }
 
   void port_bring_down(int port_num) {
-    send_port_msg(MSG_TYPE_PORT_SET_STATUS, port_num, MSG_PORT_STATUS_DOWN);
+    send_msg(MSG_TYPE_PORT_SET_STATUS, port_num, MSG_PORT_STATUS_DOWN,
+             nullptr, 0);
   }
 
   int request_info(int port_num, int info_type, std::string *v) {
@@ -122,13 +114,13 @@ class PacketInjectImp final {
     std::unique_lock<std::mutex> request_lock(request_mutex);
     std::unique_lock<std::mutex> cvar_lock(request_cvar_mutex);
     rep_status = -1;
-    send_port_msg(MSG_TYPE_INFO_REQ, port_num, info_type);
+    send_msg(MSG_TYPE_INFO_REQ, port_num, info_type, nullptr, 0);
     while (rep_status == -1) request_cvar.wait(cvar_lock);
     *v = rep_v;
     return rep_status;
   }
 
- private:
+ protected:
   enum MsgType {
     MSG_TYPE_PORT_ADD = 0,
     MSG_TYPE_PORT_REMOVE,
@@ -144,29 +136,23 @@ class PacketInjectImp final {
     MSG_PORT_STATUS_UP
   };
 
-  void receive_loop();
-
-  void send_port_msg(MsgType type, int port_num, int more) {
-    struct nn_msghdr msghdr;
-    std::memset(&msghdr, 0, sizeof(msghdr));
-    struct nn_iovec iov;
+  using MsgHandler = std::function<void(int type, int port, int more,
+                                        const char *data)>;
 
-    packet_hdr_t packet_hdr;
-    packet_hdr.type = type;
-    packet_hdr.port = port_num;
-    packet_hdr.more = more;
+  virtual void send_msg(int type, int port, int more, const char *data,
+                        int len) = 0;
 
-    iov.iov_base = static_cast<void *>(&packet_hdr);
-    iov.iov_len = sizeof(packet_hdr);
-    msghdr.msg_iov = &iov;
-    msghdr.msg_iovlen = 1;
+  // waits at most 100ms for messages, and calls the handler for each message
+  // received
+  virtual void receive(const MsgHandler &handler) = 0;
 
-    s.sendmsg(&msghdr, 0);
-  }
+  // print a line for each packet sent / received
+  bool log_packets{false};
 
  private:
-  std::string addr;
-  nn::socket s;
+  void receive_loop();
+
+  void handle_msg(int type, int port, int more, const char *data);
 
   PacketReceiveCb cb_fn{};
   void *cb_cookie{nullptr};
@@ -185,60 +171,276 @@ class PacketInjectImp final {
 
 void
 PacketInjectImp::receive_loop() {
-  struct nn_msghdr msghdr;
-  struct nn_iovec iov;
-  packet_hdr_t packet_hdr;
-  void *msg = nullptr;
-  iov.iov_base = &msg;
-  iov.iov_len = NN_MSG;
-  std::memset(&msghdr, 0, sizeof(msghdr));
-  msghdr.msg_iov = &iov;
-  msghdr.msg_iovlen = 1;
+  auto handler = [this](int type, int port, int more, const char *data) {
+    handle_msg(type, port, more, data);
+  };
   while (true) {
-    if (s.recvmsg(&msghdr, 0) <= 0) {
+    {
       std::unique_lock<std::mutex> lock(mutex);
       if (stop_receive_thread) return;
-      continue;
     }
-    assert(msg);
+    receive(handler);
+  }
+}
+
+void
+PacketInjectImp::handle_msg(int type, int port, int more, const char *data) {
+  if (type == MSG_TYPE_INFO_REP) {
+    std::unique_lock<std::mutex> cvar_lock(request_cvar_mutex);
+    std::memcpy(&rep_status, data, sizeof(rep_status));
+    rep_v = "";
+    request_cvar.notify_one();
+  }
+
+  // I choose to make copies instead of holding the lock for the callback
+  PacketReceiveCb cb_fn_;
+  void *cb_cookie_;
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    // I don't believe this is expensive
+    cb_fn_ = cb_fn;
+    cb_cookie_ = cb_cookie;
+  }
+
+  if (cb_fn_) {
+    // others are ignored
+    if (type == MSG_TYPE_PACKET_OUT) {
+      if (log_packets)
+        std::cout << "packet in received on port " << port << std::endl;
+      cb_fn_(port, data, more, cb_cookie_);
+    }
+  }
+}
 
+namespace {
+
+class NnPacketInjectImp final : public PacketInjectImp {
+ public:
+  explicit NnPacketInjectImp(const std::string &addr)
+      : s(AF_SP, NN_PAIR) {
+    s.connect(addr.c_str());
+    int rcv_timeout_ms = 100;
+    s.setsockopt(NN_SOL_SOCKET, NN_RCVTIMEO,
+                 &rcv_timeout_ms, sizeof(rcv_timeout_ms));
+    log_packets = true;
+  }
+
+ private:
+  void send_msg(int type, int port, int more, const char *data,
+                int len) override {
+    struct nn_msghdr msghdr;
+    std::memset(&msghdr, 0, sizeof(msghdr));
+    struct nn_iovec iov;
+
+    packet_hdr_t packet_hdr;
+    packet_hdr.type = type;
+    packet_hdr.port = port;
+    packet_hdr.more = more;
+
+    // not sure I can do better than this here
+    void *msg = nn::allocmsg(sizeof(packet_hdr) + len, 0);
+    std::memcpy(msg, &packet_hdr, sizeof(packet_hdr));
+    if (len > 0)
+      std::memcpy(static_cast<char *>(msg) + sizeof(packet_hdr), data, len);
+    iov.iov_base = &msg;
+    iov.iov_len = NN_MSG;
+
+    msghdr.msg_iov = &iov;
+    msghdr.msg_iovlen = 1;
+
+    s.sendmsg(&msghdr, 0);
+  }
+
+  void receive(const MsgHandler &handler) override {
+    struct nn_msghdr msghdr;
+    struct nn_iovec iov;
+    packet_hdr_t packet_hdr;
+    void *msg = nullptr;
+    iov.iov_base = &msg;
+    iov.iov_len = NN_MSG;
+    std::memset(&msghdr, 0, sizeof(msghdr));
+    msghdr.msg_iov = &iov;
+    msghdr.msg_iovlen = 1;
+    if (s.recvmsg(&msghdr, 0) <= 0) return;
+    assert(msg);
     std::memcpy(&packet_hdr, msg, sizeof(packet_hdr));
+    handler(packet_hdr.type, packet_hdr.port, packet_hdr.more,
+            static_cast<char *>(msg) + sizeof(packet_hdr));
+    nn::freemsg(msg);
+  }
+
+  nn::socket s;
+};
+
+#ifdef __linux__
+
+using bm::ShmPacketChannel;
+using bm::ShmPacketRing;
+
+class ShmPacketInjectImp final : public PacketInjectImp {
+  using Packet = PacketInject::Packet;
+
+ public:
+  explicit ShmPacketInjectImp(const std::string &path)
+      : path(path) { }
+
+  ~ShmPacketInjectImp() override {
+    disconnect();
+  }
+
+  void send_burst(const Packet *packets, size_t count) override {
+    std::unique_lock<std::mutex> lock(tx_mutex);
+    auto channel = connect();
+    if (!channel) return;
+    auto &ring = channel->ring(ShmPacketChannel::kToSwitch);
+    for (size_t i = 0; i < count; i++) {
+      const auto &p = packets[i];
+      if (!push(channel.get(), MSG_TYPE_PACKET_IN, p.port_num, p.len,
+                p.buffer, p.len)) {
+        break;
+      }
+    }
+    ring.publish();
+  }
 
-    if (packet_hdr.type == MSG_TYPE_INFO_REP) {
-      std::unique_lock<std::mutex> cvar_lock(request_cvar_mutex);
-      std::memcpy(&rep_status,
-                  reinterpret_cast<char *>(msg) + sizeof(packet_hdr),
-                  sizeof(rep_status));
-      rep_v = "";
-      request_cvar.notify_one();
+ private:
+  static constexpr int kConnectTimeoutMs = 5000;
+  static constexpr size_t kMaxBurst = 256;
+
+  void send_msg(int type, int port, int more, const char *data,
+                int len) override {
+    std::unique_lock<std::mutex> lock(tx_mutex);
+    auto channel = connect();
+    if (!channel) return;
+    if (push(channel.get(), type, port, more, data, len))
+      channel->ring(ShmPacketChannel::kToSwitch).publish();
+  }
+
+  // waits for space in the ring as long as bmv2 is connected
+  bool push(ShmPacketChannel *channel, int type, int port, int more,
+            const char *data, int len) {
+    auto &ring = channel->ring(ShmPacketChannel::kToSwitch);
+    while (!ring.push(type, port, more, data, len, 100)) {
+      if (static_cast<size_t>(len) > ring.max_data_size()) {
+        std::cerr << "packet too large for shm ring\n";
+        return false;
+      }
+      if (get_channel().get() != channel) return false;
     }
+    return true;
+  }
 
-    // I choose to make copies instead of holding the lock for the callback
-    PacketReceiveCb cb_fn_;
-    void *cb_cookie_;
-    {
-      std::unique_lock<std::mutex> lock(mutex);
-      // I don't believe this is expensive
-      cb_fn_ = cb_fn;
-      cb_cookie_ = cb_cookie;
+  void receive(const MsgHandler &handler) override {
+    auto channel = get_channel();
+    if (!channel) {
+      // connect as soon as bmv2 is ready, so that we can receive packets even
+      // if we never send any
+      std::unique_lock<std::mutex> lock(tx_mutex);
+      if (!connect_once()) {
+        lock.unlock();
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      }
+      return;
     }
+    auto &ring = channel->ring(ShmPacketChannel::kFromSwitch);
+    auto fn = [&handler](const ShmPacketRing::RecordHdr &hdr,
+                         const char *data) {
+      handler(hdr.type, hdr.port, hdr.more, data);
+    };
+    if (ring.consume(fn, kMaxBurst) > 0) return;
+    if (!ring.arm_consumer_wait()) return;
+    struct pollfd pfds[2] = {{ring.consumer_fd(), POLLIN, 0},
+                             {get_sock(), POLLIN, 0}};
+    poll(pfds, 2, 100);
+    ring.disarm_consumer_wait();
+    if (pfds[1].revents) {
+      // bmv2 never sends anything on the socket after the setup, so this
+      // means it went away
+      disconnect();
+    }
+  }
+
+  std::shared_ptr<ShmPacketChannel> get_channel() const {
+    std::unique_lock<std::mutex> lock(channel_mutex);
+    return channel;
+  }
+
+  int get_sock() const {
+    std::unique_lock<std::mutex> lock(channel_mutex);
+    return sock;
+  }
 
-    if (cb_fn_) {
-      // others are ignored
-      if (packet_hdr.type == MSG_TYPE_PACKET_OUT) {
-        char *data = static_cast<char *>(msg) + sizeof(packet_hdr);
-        std::cout << "packet in received on port " << packet_hdr.port
-                  << std::endl;
-        cb_fn_(packet_hdr.port, data, packet_hdr.more, cb_cookie_);
+  // tx_mutex must be held; retries until bmv2 is ready or the timeout expires
+  std::shared_ptr<ShmPacketChannel> connect() {
+    using clock = std::chrono::steady_clock;
+    auto deadline = clock::now() + std::chrono::milliseconds(kConnectTimeoutMs);
+    while (!connect_once()) {
+      if (clock::now() > deadline) {
+        std::cerr << "cannot connect to bmv2 on " << path << "\n";
+        return nullptr;
       }
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
     }
-    nn::freemsg(msg);
-    msg = nullptr;
+    return get_channel();
+  }
+
+  // tx_mutex must be held
+  bool connect_once() {
+    if (get_channel()) return true;
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0) return false;
+    struct sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    std::shared_ptr<ShmPacketChannel> new_channel;
+    if (::connect(fd, reinterpret_cast<struct sockaddr *>(&addr),
+                  sizeof(addr)) == 0) {
+      new_channel = ShmPacketChannel::create();
+    }
+    if (!new_channel || new_channel->send_to(fd) != 0) {
+      close(fd);
+      return false;
+    }
+    std::unique_lock<std::mutex> lock(channel_mutex);
+    sock = fd;
+    channel = std::move(new_channel);
+    return true;
   }
+
+  void disconnect() {
+    std::unique_lock<std::mutex> lock(channel_mutex);
+    if (sock >= 0) close(sock);
+    sock = -1;
+    channel.reset();
+  }
+
+  std::string path;
+  int sock{-1};
+  std::shared_ptr<ShmPacketChannel> channel{nullptr};
+  mutable std::mutex channel_mutex{};
+  std::mutex tx_mutex{};
+};
+
+constexpr int ShmPacketInjectImp::kConnectTimeoutMs;
+constexpr size_t ShmPacketInjectImp::kMaxBurst;
+
+#endif  // __linux__
+
+PacketInjectImp *
+make_packet_inject(const std::string &addr) {
+#ifdef __linux__
+  std::string shm_path;
+  if (ShmPacketChannel::parse_addr(addr, &shm_path))
+    return new ShmPacketInjectImp(shm_path);
+#endif
+  return new NnPacketInjectImp(addr);
 }
 
+}  // namespace
+
 PacketInject::PacketInject(const std::string &addr):
-    pimp(new PacketInjectImp(addr)) { }
+    pimp(make_packet_inject(addr)) { }
 
 PacketInject::~PacketInject() {
   pimp->stop();
@@ -259,6 +461,11 @@ PacketInject::send(int port_num, const char *buffer, int len) {
   pimp->send(port_num, buffer, len);
 }
 
+void
+PacketInject::send_burst(const Packet *packets, size_t count) {
+  pimp->send_burst(packets, count);
+}
+
 void
 PacketInject::port_add(int port_num) {
   pimp->port_add(port_num);
@@ -33,6 +33,9 @@ using namespace bm;
 using mbr_hdl_t = RuntimeInterface::mbr_hdl_t;
 using grp_hdl_t = RuntimeInterface::grp_hdl_t;
 
+// defined in server.cpp, which owns the Thrift server
+void get_runtime_server_stats(BmRuntimeServerStats *stats);
+
 class StandardHandler : virtual public StandardIf {
 public:
   StandardHandler(SwitchWContexts *sw)
@@ -92,6 +95,8 @@ public:
         return TableOperationErrorCode::IMMUTABLE_TABLE_ENTRIES;
       case MatchErrorCode::BAD_ACTION_DATA:
         return TableOperationErrorCode::BAD_ACTION_DATA;
+      case MatchErrorCode::BATCH_ABORTED:
+        return TableOperationErrorCode::BATCH_ABORTED;
       case MatchErrorCode::ERROR:
         return TableOperationErrorCode::ERROR;
       default:
@@ -287,6 +292,43 @@ public:
     }
   }
 
+  void bm_mt_write_entries(std::vector<BmMtWriteResult> & _return, const int32_t cxt_id, const std::vector<BmMtWriteOp> & ops, const bool atomic) {
+    Logger::get()->trace("bm_mt_write_entries");
+    std::vector<RuntimeInterface::MtWriteOp> bm_ops(ops.size());
+    for (size_t i = 0; i < ops.size(); i++) {
+      const auto &op = ops[i];
+      auto &bm_op = bm_ops[i];
+      switch(op.type) {
+        case BmMtWriteOpType::ADD:
+          bm_op.type = RuntimeInterface::MtWriteOp::Type::ADD;
+          break;
+        case BmMtWriteOpType::MODIFY:
+          bm_op.type = RuntimeInterface::MtWriteOp::Type::MODIFY;
+          break;
+        case BmMtWriteOpType::DELETE:
+          bm_op.type = RuntimeInterface::MtWriteOp::Type::DELETE;
+          break;
+        default:
+          assert(0 && "wrong type");
+      }
+      bm_op.table_name = op.table_name;
+      build_match_key(bm_op.match_key, op.match_key);
+      bm_op.action_name = op.action_name;
+      for(const std::string &d : op.action_data) {
+        bm_op.action_data.push_back_action_data(d.data(), d.size());
+      }
+      bm_op.priority = op.options.priority;
+      bm_op.handle = op.entry_handle;
+    }
+    switch_->mt_write_entries(cxt_id, &bm_ops, atomic);
+    _return.resize(bm_ops.size());
+    for (size_t i = 0; i < bm_ops.size(); i++) {
+      _return[i].entry_handle = bm_ops[i].handle;
+      if (bm_ops[i].status != MatchErrorCode::SUCCESS)
+        _return[i].__set_error(get_exception_code(bm_ops[i].status));
+    }
+  }
+
   void bm_mt_set_entry_ttl(const int32_t cxt_id, const std::string& table_name, const BmEntryHandle entry_handle, const int32_t timeout_ms) {
     Logger::get()->trace("bm_mt_set_entry_ttl");
     MatchErrorCode error_code = switch_->mt_set_entry_ttl(
@@ -513,6 +555,23 @@ public:
     _return.packets = (int64_t) packets;
   }
 
+  void bm_mt_read_all_counters(BmMtCounterValues& _return, const int32_t cxt_id, const std::string& table_name, const bool read_and_clear) {
+    Logger::get()->trace("bm_mt_read_all_counters");
+    std::vector<entry_handle_t> handles;
+    std::vector<MatchTable::counter_value_t> bytes;
+    std::vector<MatchTable::counter_value_t> packets;
+    MatchErrorCode error_code = switch_->mt_read_all_counters(
+        cxt_id, table_name, &handles, &bytes, &packets, read_and_clear);
+    if(error_code != MatchErrorCode::SUCCESS) {
+      InvalidTableOperation ito;
+      ito.code = get_exception_code(error_code);
+      throw ito;
+    }
+    _return.entry_handles.assign(handles.begin(), handles.end());
+    _return.bytes.assign(bytes.begin(), bytes.end());
+    _return.packets.assign(packets.begin(), packets.end());
+  }
+
   void bm_mt_reset_counters(const int32_t cxt_id, const std::string& table_name) {
     Logger::get()->trace("bm_mt_reset_counters");
     MatchErrorCode error_code = switch_->mt_reset_counters(
@@ -609,6 +668,39 @@ public:
     }
   }
 
+  template <typename M,
+            MatchErrorCode (RuntimeInterface::*GetFn)(
+                cxt_id_t, const std::string &, size_t *, size_t,
+                std::vector<typename M::Entry> *, bool *) const>
+  void get_entries_chunk_common(cxt_id_t cxt_id, const std::string &table_name,
+                                int64_t cursor, int32_t max_entries,
+                                BmMtEntriesChunk &_return) {
+    if (cursor < 0 || max_entries <= 0) {
+      InvalidTableOperation ito;
+      ito.code = TableOperationErrorCode::ERROR;
+      throw ito;
+    }
+    size_t cursor_ = static_cast<size_t>(cursor);
+    std::vector<typename M::Entry> entries;
+    bool more;
+    auto rc = std::bind(GetFn, switch_, cxt_id, table_name, &cursor_,
+                        static_cast<size_t>(max_entries), &entries, &more)();
+    if(rc != MatchErrorCode::SUCCESS) {
+      InvalidTableOperation ito;
+      ito.code = get_exception_code(rc);
+      throw ito;
+    }
+    _return.entries.reserve(entries.size());
+    for (const auto &entry : entries) {
+      BmMtEntry e;
+      copy_match_part_entry(&e, entry);
+      build_action_entry(&e.action_entry, entry);
+      copy_entry_life_info(&e, entry);
+      _return.entries.push_back(std::move(e));
+    }
+    _return.next_cursor = more ? static_cast<int64_t>(cursor_) : -1;
+  }
+
   template <typename M,
             MatchErrorCode (RuntimeInterface::*GetFn)(
                 cxt_id_t, const std::string &, entry_handle_t, typename M::Entry *) const>
@@ -648,6 +740,33 @@ public:
     }
   }
 
+  void bm_mt_get_entries_chunk(BmMtEntriesChunk& _return, const int32_t cxt_id, const std::string& table_name, const int64_t cursor, const int32_t max_entries) {
+    Logger::get()->trace("bm_mt_get_entries_chunk");
+    switch (switch_->mt_get_type(cxt_id, table_name)) {
+      case MatchTableType::NONE:
+        {
+          InvalidTableOperation ito;
+          ito.code = TableOperationErrorCode::INVALID_TABLE_NAME;
+          throw ito;
+        }
+      case MatchTableType::SIMPLE:
+        get_entries_chunk_common<MatchTable,
+                                 &RuntimeInterface::mt_get_entries>(
+            cxt_id, table_name, cursor, max_entries, _return);
+        break;
+      case MatchTableType::INDIRECT:
+        get_entries_chunk_common<MatchTableIndirect,
+                                 &RuntimeInterface::mt_indirect_get_entries>(
+            cxt_id, table_name, cursor, max_entries, _return);
+        break;
+      case MatchTableType::INDIRECT_WS:
+        get_entries_chunk_common<MatchTableIndirectWS,
+                                 &RuntimeInterface::mt_indirect_ws_get_entries>(
+            cxt_id, table_name, cursor, max_entries, _return);
+        break;
+    }
+  }
+
   void bm_mt_get_entry(BmMtEntry& _return, const int32_t cxt_id, const std::string& table_name, const BmEntryHandle entry_handle) {
     Logger::get()->trace("bm_mt_get_entry");
     switch (switch_->mt_get_type(cxt_id, table_name)) {
@@ -834,6 +953,42 @@ public:
     _return.packets = (int64_t) packets;
   }
 
+  void bm_counter_read_range(BmCounterValues& _return, const int32_t cxt_id, const std::string& counter_name, const int32_t start, const int32_t end_, const bool read_and_clear) {
+    Logger::get()->trace("bm_counter_read_range");
+    if (start < 0 || end_ < 0) {
+      InvalidCounterOperation ico;
+      ico.code = CounterOperationErrorCode::INVALID_INDEX;
+      throw ico;
+    }
+    std::vector<MatchTable::counter_value_t> bytes;
+    std::vector<MatchTable::counter_value_t> packets;
+    Counter::CounterErrorCode error_code = switch_->read_counters_range(
+        cxt_id, counter_name, static_cast<size_t>(start),
+        static_cast<size_t>(end_), &bytes, &packets, read_and_clear);
+    if(error_code != Counter::CounterErrorCode::SUCCESS) {
+      InvalidCounterOperation ico;
+      ico.code = (CounterOperationErrorCode::type) error_code;
+      throw ico;
+    }
+    _return.bytes.assign(bytes.begin(), bytes.end());
+    _return.packets.assign(packets.begin(), packets.end());
+  }
+
+  void bm_counter_read_all(BmCounterValues& _return, const int32_t cxt_id, const std::string& counter_name, const bool read_and_clear) {
+    Logger::get()->trace("bm_counter_read_all");
+    std::vector<MatchTable::counter_value_t> bytes;
+    std::vector<MatchTable::counter_value_t> packets;
+    Counter::CounterErrorCode error_code = switch_->read_all_counters(
+        cxt_id, counter_name, &bytes, &packets, read_and_clear);
+    if(error_code != Counter::CounterErrorCode::SUCCESS) {
+      InvalidCounterOperation ico;
+      ico.code = (CounterOperationErrorCode::type) error_code;
+      throw ico;
+    }
+    _return.bytes.assign(bytes.begin(), bytes.end());
+    _return.packets.assign(packets.begin(), packets.end());
+  }
+
   void bm_counter_reset_all(const int32_t cxt_id, const std::string& counter_name) {
     Logger::get()->trace("bm_counter_reset_all");
     Counter::CounterErrorCode error_code = switch_->reset_counters(
@@ -977,6 +1132,27 @@ public:
     }
   }
 
+  void bm_meter_array_get_rates(std::vector<std::vector<BmMeterRateConfig> > & _return, const int32_t cxt_id, const std::string& meter_array_name) {
+    Logger::get()->trace("bm_meter_array_get_rates");
+    std::vector<std::vector<Meter::rate_config_t> > configs;
+    Meter::MeterErrorCode error_code = switch_->meter_array_get_rates(
+        cxt_id, meter_array_name, &configs);
+    if(error_code != Meter::MeterErrorCode::SUCCESS) {
+      InvalidMeterOperation imo;
+      imo.code = (MeterOperationErrorCode::type) error_code;
+      throw imo;
+    }
+    _return.resize(configs.size());
+    for (size_t i = 0; i < configs.size(); i++) {
+      const auto &rates = configs[i];
+      _return[i].resize(rates.size());
+      for (size_t j = 0; j < rates.size(); j++) {
+        _return[i][j].units_per_micros = rates[j].info_rate;
+        _return[i][j].burst_size = rates[j].burst_size;
+      }
+    }
+  }
+
   BmRegisterValue bm_register_read(const int32_t cxt_id, const std::string& register_array_name, const int32_t index) {
     Logger::get()->trace("bm_register_read");
     Data value; // make it thread_local ?
@@ -1114,6 +1290,11 @@ public:
     }
   }
 
+  void bm_mgmt_get_runtime_server_stats(BmRuntimeServerStats& _return) {
+    Logger::get()->trace("bm_mgmt_get_runtime_server_stats");
+    get_runtime_server_stats(&_return);
+  }
+
   void bm_set_crc16_custom_parameters(const int32_t cxt_id, const std::string& calc_name, const BmCrc16Config& crc16_config) {
     Logger::get()->trace("bm_set_crc16_custom_parameters");
     CustomCrcMgr<uint16_t>::crc_config_t c;
@@ -1213,6 +1394,97 @@ public:
     _return.append(stream.str());
   }
 
+  void bm_snapshot_state(const std::string& path, const bool background) {
+    Logger::get()->trace("bm_snapshot_state");
+    RuntimeInterface::ErrorCode error_code =
+      switch_->snapshot_state(path, background);
+    if(error_code != RuntimeInterface::ErrorCode::SUCCESS) {
+      InvalidSnapshotOperation iso;
+      iso.code = (SnapshotOperationErrorCode::type) error_code;
+      throw iso;
+    }
+  }
+
+  void bm_get_snapshot_status(BmSnapshotStatus& _return) {
+    Logger::get()->trace("bm_get_snapshot_status");
+    auto status = switch_->get_snapshot_status();
+    _return.in_progress = status.in_progress;
+    _return.path = status.path;
+    _return.success = status.success;
+    _return.bytes = status.bytes;
+    _return.duration_ms = status.duration_ms;
+  }
+
+  void bm_get_profile(BmProfile& _return, const int32_t cxt_id) {
+    Logger::get()->trace("bm_get_profile");
+    auto stats = switch_->get_profiling_stats(cxt_id);
+    for (const auto &t : stats.tables) {
+      BmTableProfile table;
+      table.name = t.name;
+      table.lookups = static_cast<int64_t>(t.lookups);
+      table.hits = static_cast<int64_t>(t.hits);
+      table.misses = static_cast<int64_t>(t.misses);
+      table.avg_lookup_ns = static_cast<int64_t>(t.avg_lookup_ns);
+      table.avg_action_ns = static_cast<int64_t>(t.avg_action_ns);
+      _return.tables.push_back(std::move(table));
+    }
+    for (const auto &a : stats.actions) {
+      BmActionProfile action;
+      action.name = a.name;
+      action.executions = static_cast<int64_t>(a.executions);
+      action.avg_ns = static_cast<int64_t>(a.avg_ns);
+      action.total_ns = static_cast<int64_t>(a.total_ns);
+      _return.actions.push_back(std::move(action));
+    }
+    for (const auto &c : stats.conditionals) {
+      BmConditionalProfile conditional;
+      conditional.name = c.name;
+      conditional.evaluations = static_cast<int64_t>(c.evaluations);
+      conditional.true_count = static_cast<int64_t>(c.true_count);
+      _return.conditionals.push_back(std::move(conditional));
+    }
+  }
+
+  void bm_reset_profile(const int32_t cxt_id) {
+    Logger::get()->trace("bm_reset_profile");
+    switch_->reset_profiling_stats(cxt_id);
+  }
+
+  void bm_set_profiling_enabled(const bool enabled) {
+    Logger::get()->trace("bm_set_profiling_enabled");
+    switch_->set_profiling_enabled(enabled);
+  }
+
+  void bm_get_lock_stats(std::vector<BmLockStats> &_return) {
+    Logger::get()->trace("bm_get_lock_stats");
+    auto copy_histogram = [](const LatencyHistogram &h, BmLockHistogram *to) {
+      to->count = static_cast<int64_t>(h.get_count());
+      to->min_ns = static_cast<int64_t>(h.get_min());
+      to->mean_ns = static_cast<int64_t>(h.get_mean());
+      to->max_ns = static_cast<int64_t>(h.get_max());
+      to->p50_ns = static_cast<int64_t>(h.get_value_at_percentile(50.));
+      to->p90_ns = static_cast<int64_t>(h.get_value_at_percentile(90.));
+      to->p99_ns = static_cast<int64_t>(h.get_value_at_percentile(99.));
+      to->p999_ns = static_cast<int64_t>(h.get_value_at_percentile(99.9));
+    };
+    for (const auto &s : switch_->get_lock_stats()) {
+      BmLockStats stats;
+      stats.name = s.name;
+      stats.read_contended = static_cast<int64_t>(s.read_contended);
+      stats.write_contended = static_cast<int64_t>(s.write_contended);
+      copy_histogram(s.histograms[LockStats::READ_WAIT], &stats.read_wait);
+      copy_histogram(s.histograms[LockStats::READ_HOLD], &stats.read_hold);
+      copy_histogram(s.histograms[LockStats::WRITE_WAIT], &stats.write_wait);
+      copy_histogram(s.histograms[LockStats::WRITE_HOLD], &stats.write_hold);
+      _return.push_back(std::move(stats));
+    }
+  }
+
+  void bm_reset_lock_stats() {
+    Logger::get()->trace("bm_reset_lock_stats");
+    switch_->reset_lock_stats();
+  }
+
 private:
   SwitchWContexts *switch_;
 };
@@ -22,24 +22,48 @@
 #include <p4thrift/protocol/TBinaryProtocol.h>
 #include <p4thrift/server/TSimpleServer.h>
 #include <p4thrift/server/TThreadedServer.h>
+#include <p4thrift/server/TThreadPoolServer.h>
 #include <p4thrift/transport/TServerSocket.h>
 #include <p4thrift/transport/TBufferTransports.h>
 #include <p4thrift/processor/TMultiplexedProcessor.h>
+#include <p4thrift/concurrency/ThreadManager.h>
+#include <p4thrift/concurrency/PlatformThreadFactory.h>
+#ifdef HAVE_THRIFT_NONBLOCKING
+#include <p4thrift/server/TNonblockingServer.h>
+#endif
 
 namespace thrift_provider = p4::thrift;
 #else
 #include <thrift/protocol/TBinaryProtocol.h>
 #include <thrift/server/TSimpleServer.h>
 #include <thrift/server/TThreadedServer.h>
+#include <thrift/server/TThreadPoolServer.h>
 #include <thrift/transport/TServerSocket.h>
 #include <thrift/transport/TBufferTransports.h>
 #include <thrift/processor/TMultiplexedProcessor.h>
+#include <thrift/concurrency/ThreadManager.h>
+#ifdef HAVE_THRIFT_THREADFACTORY_H
+#include <thrift/concurrency/ThreadFactory.h>
+#else
+#include <thrift/concurrency/PlatformThreadFactory.h>
+#endif
+#ifdef HAVE_THRIFT_NONBLOCKING
+#include <thrift/server/TNonblockingServer.h>
+// Thrift versions which come with stdcxx.h (0.11 and later) take a
+// TNonblockingServerSocket instead of a port number
+#ifdef HAVE_THRIFT_STDCXX_H
+#include <thrift/transport/TNonblockingServerSocket.h>
+#endif
+#endif
 
 namespace thrift_provider = apache::thrift;
 #endif
 
+#include <atomic>
+#include <chrono>
 #include <iostream>
 #include <mutex>
+#include <string>
 #include <thread>
 
 #include <bm/bm_sim/switch.h>
@@ -54,6 +78,13 @@ using namespace ::thrift_provider;
 using namespace ::thrift_provider::protocol;
 using namespace ::thrift_provider::transport;
 using namespace ::thrift_provider::server;
+using namespace ::thrift_provider::concurrency;
+
+#ifdef HAVE_THRIFT_THREADFACTORY_H
+using ThreadFactoryImpl = ThreadFactory;
+#else
+using ThreadFactoryImpl = PlatformThreadFactory;
+#endif
 
 using ::bm_runtime::standard::StandardProcessor;
 using ::bm_runtime::simple_pre::SimplePreProcessor;
@@ -75,6 +106,10 @@ namespace simple_pre_lag {
 shared_ptr<SimplePreLAGIf> get_handler(bm::SwitchWContexts *switch_);
 }  // namespace simple_pre_lag
 
+namespace standard {
+void get_runtime_server_stats(BmRuntimeServerStats *stats);
+}  // namespace standard
+
 bm::SwitchWContexts *switch_;
 TMultiplexedProcessor *processor_;
 
@@ -90,6 +125,117 @@ bool switch_has_component() {
   return (switch_->get_cxt_component<T>(0) != nullptr);
 }
 
+// Counters updated by all the server threads and read by the
+// bm_mgmt_get_runtime_server_stats RPC
+struct ServerStats {
+  std::atomic<int64_t> open_connections{0};
+  std::atomic<int64_t> active_requests{0};
+  std::atomic<int64_t> max_pending_requests{0};
+  std::atomic<uint64_t> total_requests{0};
+  std::atomic<uint64_t> processing_ns{0};
+};
+
+ServerStats server_stats;
+std::string server_type;
+// null for the "threaded" server
+shared_ptr<ThreadManager> thread_manager{nullptr};
+
+// Wraps the multiplexed processor to collect statistics about the requests,
+// whatever the type of server. For the "nonblocking" server, process() is
+// called by the worker threads once the request has been dequeued, so this is
+// when we sample the number of requests still waiting for a worker.
+class InstrumentedProcessor : public TProcessor {
+ public:
+  explicit InstrumentedProcessor(shared_ptr<TProcessor> processor)
+      : processor(processor) { }
+
+  bool process(shared_ptr<TProtocol> in, shared_ptr<TProtocol> out,
+               void *connection_context) override {
+    using clock = std::chrono::steady_clock;
+    if (thread_manager) {
+      auto pending = static_cast<int64_t>(thread_manager->pendingTaskCount());
+      auto max = server_stats.max_pending_requests.load();
+      while (pending > max &&
+             !server_stats.max_pending_requests.compare_exchange_weak(
+                 max, pending)) { }
+    }
+    server_stats.active_requests++;
+    auto start = clock::now();
+    bool rv = processor->process(in, out, connection_context);
+    auto end = clock::now();
+    server_stats.active_requests--;
+    server_stats.total_requests++;
+    server_stats.processing_ns += std::chrono::duration_cast<
+        std::chrono::nanoseconds>(end - start).count();
+    return rv;
+  }
+
+ private:
+  shared_ptr<TProcessor> processor;
+};
+
+class ConnectionCounter : public TServerEventHandler {
+ public:
+  void *createContext(shared_ptr<TProtocol> input,
+                      shared_ptr<TProtocol> output) override {
+    (void) input; (void) output;
+    server_stats.open_connections++;
+    return nullptr;
+  }
+
+  void deleteContext(void *server_context, shared_ptr<TProtocol> input,
+                     shared_ptr<TProtocol> output) override {
+    (void) server_context; (void) input; (void) output;
+    server_stats.open_connections--;
+  }
+};
+
+shared_ptr<ThreadManager> make_thread_manager(int workers) {
+  auto manager = ThreadManager::newSimpleThreadManager(workers);
+  manager->threadFactory(
+      shared_ptr<ThreadFactoryImpl>(new ThreadFactoryImpl()));
+  manager->start();
+  return manager;
+}
+
+shared_ptr<TServer> make_server(int port,
+                                shared_ptr<TProcessor> processor) {
+  shared_ptr<TTransportFactory> transportFactory(new TBufferedTransportFactory());
+  shared_ptr<TProtocolFactory> protocolFactory(new TBinaryProtocolFactory());
+  int workers = switch_->get_runtime_server_workers();
+
+  if (server_type == "thread-pool") {
+    thread_manager = make_thread_manager(workers);
+    shared_ptr<TServerTransport> serverTransport(new TServerSocket(port));
+    return shared_ptr<TServer>(new TThreadPoolServer(
+        processor, serverTransport, transportFactory, protocolFactory,
+        thread_manager));
+  }
+
+  if (server_type == "nonblocking") {
+#ifdef HAVE_THRIFT_NONBLOCKING
+    thread_manager = make_thread_manager(workers);
+#ifdef HAVE_THRIFT_STDCXX_H
+    shared_ptr<TNonblockingServerSocket> serverSocket(
+        new TNonblockingServerSocket(port));
+    return shared_ptr<TServer>(new TNonblockingServer(
+        processor, protocolFactory, serverSocket, thread_manager));
+#else
+    return shared_ptr<TServer>(new TNonblockingServer(
+        processor, protocolFactory, port, thread_manager));
+#endif
+#else
+    std::cerr << "bmv2 was built without support for the nonblocking Thrift "
+              << "server (it requires libthriftnb and libevent)\n";
+    std::exit(1);
+#endif
+  }
+
+  shared_ptr<TServerTransport> serverTransport(new TServerSocket(port));
+  return shared_ptr<TServer>(new TThreadedServer(
+      processor, serverTransport, transportFactory, protocolFactory));
+}
+
 int serve(int port) {
   shared_ptr<TMultiplexedProcessor> processor(new TMultiplexedProcessor());
   processor_ = processor.get();
@@ -116,9 +262,11 @@ int serve(int port) {
     );
   }
 
-  shared_ptr<TServerTransport> serverTransport(new TServerSocket(port));
-  shared_ptr<TTransportFactory> transportFactory(new TBufferedTransportFactory());
-  shared_ptr<TProtocolFactory> protocolFactory(new TBinaryProtocolFactory());
+  server_type = switch_->get_runtime_server_type();
+  auto server = make_server(
+      port, shared_ptr<TProcessor>(new InstrumentedProcessor(processor)));
+  server->setServerEventHandler(
+      shared_ptr<TServerEventHandler>(new ConnectionCounter()));
 
   {
     std::unique_lock<std::mutex> lock(m_ready);
@@ -126,10 +274,8 @@ int serve(int port) {
     cv_ready.notify_one();
   }
 
-  TThreadedServer server(processor, serverTransport, transportFactory,
-                         protocolFactory);
   try {
-    server.serve();
+    server->serve();
   } catch (const transport::TTransportException &e) {
     std::cerr << "Thrift returned an exception when trying to bind to port "
               << port << "\n"
@@ -143,6 +289,25 @@ int serve(int port) {
 
 }  // namespace
 
+namespace standard {
+
+void get_runtime_server_stats(BmRuntimeServerStats *stats) {
+  stats->server_type = server_type;
+  stats->workers = thread_manager ? thread_manager->workerCount() : 0;
+  stats->idle_workers = thread_manager ? thread_manager->idleWorkerCount() : 0;
+  stats->open_connections = server_stats.open_connections;
+  stats->active_requests = server_stats.active_requests;
+  stats->pending_requests =
+      thread_manager ? thread_manager->pendingTaskCount() : 0;
+  stats->max_pending_requests = server_stats.max_pending_requests;
+  uint64_t total_requests = server_stats.total_requests;
+  stats->total_requests = total_requests;
+  stats->avg_processing_ns = (total_requests == 0) ?
+      0 : server_stats.processing_ns / total_requests;
+}
+
+}  // namespace standard
+
 int start_server(bm::SwitchWContexts *sw, int port) {
   switch_ = sw;
   std::thread server_thread(serve, port);
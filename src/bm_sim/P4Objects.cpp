@@ -20,15 +20,22 @@
 
 #include <bm/bm_sim/P4Objects.h>
 #include <bm/bm_sim/phv.h>
+#include <bm/bm_sim/snapshot.h>
 
+#include <algorithm>
 #include <iostream>
 #include <istream>
+#include <limits>
 #include <ostream>
 #include <string>
 #include <tuple>
+#include <thread>
 #include <vector>
 #include <set>
+#include <stdexcept>
+#include <unordered_map>
 #include <unordered_set>
+#include <utility>
 #include <exception>
 
 #include "jsoncpp/json.h"
@@ -1417,6 +1424,7 @@ P4Objects::init_meter_arrays(const Json::Value &cfg_root,
       DirectMeterArray direct_meter =
           {get_meter_array(name), header_id, field_offset};
       direct_meters.emplace(name, direct_meter);
+      direct_meter_arrays.insert(name);
     }
   }
 }
@@ -1585,6 +1593,12 @@ P4Objects::init_pipelines(const Json::Value &cfg_root,
                           InitState *init_state) {
   auto &direct_meters = init_state->direct_meters;
 
+  // for the old JSON format, in which tables refer to actions by name; like
+  // get_one_action_with_name(), we pick the first action in actions_map order
+  std::unordered_map<std::string, ActionFn *> actions_by_name;
+  for (const auto &e : actions_map)
+    actions_by_name.emplace(e.second->get_name(), e.second.get());
+
   DupIdChecker dup_id_checker("pipeline");
   const Json::Value &cfg_pipelines = cfg_root["pipelines"];
   for (const auto &cfg_pipeline : cfg_pipelines) {
@@ -1832,7 +1846,9 @@ P4Objects::init_pipelines(const Json::Value &cfg_root,
           action_name = action->get_name();
         } else {
           action_name = cfg_action.asString();
-          action = get_one_action_with_name(action_name); assert(action);
+          auto it = actions_by_name.find(action_name);
+          action = (it == actions_by_name.end()) ? nullptr : it->second;
+          assert(action);
           action_id = action->get_id();
         }
 
@@ -2135,8 +2151,23 @@ P4Objects::init_objects(std::istream *is,
                         const std::set<header_field_pair> &required_fields,
                         const ForceArith &arith_objects) {
   Json::Value cfg_root;
-  (*is) >> cfg_root;
+  Json::CharReaderBuilder builder;
+  std::string error_msg;
+  if (!Json::parseFromStream(builder, *is, &cfg_root, &error_msg)) {
+    outstream << "Invalid JSON: " << error_msg;
+    return 1;
+  }
+  return init_objects(cfg_root, lookup_factory, device_id, cxt_id,
+                      notifications_transport, required_fields, arith_objects);
+}
 
+int
+P4Objects::init_objects(const Json::Value &cfg_root,
+                        LookupStructureFactory *lookup_factory,
+                        device_id_t device_id, cxt_id_t cxt_id,
+                        std::shared_ptr<TransportIface> notifications_transport,
+                        const std::set<header_field_pair> &required_fields,
+                        const ForceArith &arith_objects) {
   if (!notifications_transport) {
     this->notifications_transport = std::shared_ptr<TransportIface>(
         TransportIface::make_dummy());
@@ -2293,6 +2324,41 @@ P4Objects::serialize(std::ostream *out) const {
   }
 }
 
+namespace {
+
+template <typename T>
+void sort_by_name(std::vector<T> *v) {
+  std::sort(v->begin(), v->end(),
+            [](const T &s1, const T &s2) { return s1.name < s2.name; });
+}
+
+}  // namespace
+
+ProfilingStats
+P4Objects::get_profiling_stats() const {
+  ProfilingStats stats;
+  for (const auto &e : match_action_tables_map) {
+    stats.tables.push_back(
+        e.second->get_match_table()->get_profiling_stats());
+  }
+  for (const auto &e : actions_map)
+    stats.actions.push_back(e.second->get_profiling_stats());
+  for (const auto &e : conditionals_map)
+    stats.conditionals.push_back(e.second->get_profiling_stats());
+  sort_by_name(&stats.tables);
+  sort_by_name(&stats.actions);
+  sort_by_name(&stats.conditionals);
+  return stats;
+}
+
+void
+P4Objects::reset_profiling_stats() {
+  for (const auto &e : match_action_tables_map)
+    e.second->get_match_table()->reset_profiling_stats();
+  for (const auto &e : actions_map) e.second->reset_profiling_stats();
+  for (const auto &e : conditionals_map) e.second->reset_profiling_stats();
+}
+
 void
 P4Objects::deserialize(std::istream *in) {
   for (const auto &e : match_action_tables_map) {
@@ -2306,6 +2372,458 @@ P4Objects::deserialize(std::istream *in) {
   }
 }
 
+void
+P4Objects::serialize(SnapshotWriter *out, size_t chunk_size) const {
+  out->write_u32(static_cast<uint32_t>(match_action_tables_map.size() +
+                                       action_profiles_map.size() +
+                                       meter_arrays.size()));
+  for (const auto &e : match_action_tables_map) {
+    const auto *table = e.second->get_match_table();
+    out->begin_section(SnapshotSection::TABLE, e.first);
+    if (chunk_size == 0) {
+      table->serialize(out);
+    } else {
+      size_t cursor = 0;
+      // give the waiting writers (control plane) a chance to get the lock
+      while (table->serialize(out, &cursor, chunk_size))
+        std::this_thread::yield();
+    }
+    out->end_section();
+  }
+  for (const auto &e : action_profiles_map) {
+    out->begin_section(SnapshotSection::ACTION_PROFILE, e.first);
+    e.second->serialize(out);
+    out->end_section();
+  }
+  for (const auto &e : meter_arrays) {
+    out->begin_section(SnapshotSection::METER_ARRAY, e.first);
+    e.second->serialize(out);
+    out->end_section();
+  }
+}
+
+// sections are looked up by name, so they can be in any order
+bool
+P4Objects::deserialize(SnapshotReader *in) {
+  auto nb_sections = in->read_u32();
+  for (size_t i = 0; i < nb_sections; i++) {
+    SnapshotSection type;
+    std::string name;
+    SnapshotReader payload;
+    if (!in->next_section(&type, &name, &payload)) return false;
+    // unknown action / control node names and ids throw std::out_of_range
+    try {
+      if (type == SnapshotSection::TABLE) {
+        auto it = match_action_tables_map.find(name);
+        if (it == match_action_tables_map.end()) return false;
+        it->second->get_match_table()->deserialize(&payload, *this);
+      } else if (type == SnapshotSection::ACTION_PROFILE) {
+        auto it = action_profiles_map.find(name);
+        if (it == action_profiles_map.end()) return false;
+        it->second->deserialize(&payload, *this);
+      } else if (type == SnapshotSection::METER_ARRAY) {
+        auto it = meter_arrays.find(name);
+        if (it == meter_arrays.end()) return false;
+        it->second->deserialize(&payload);
+      } else {
+        return false;
+      }
+    } catch (const std::out_of_range &) {
+      return false;
+    }
+    if (!payload.good() || !payload.at_end()) return false;
+  }
+  return in->good();
+}
+
+namespace {
+
+using HandlePairs = std::vector<std::pair<entry_handle_t, entry_handle_t> >;
+using CounterValues = std::vector<
+  std::pair<Counter::counter_value_t, Counter::counter_value_t> >;
+
+// the direct counters of the migrated entries, with the values copied
+struct EntryCounters {
+  HandlePairs handles;
+  CounterValues values;
+};
+
+// new handles of the members and groups of a migrated action profile
+struct MigratedActionProfile {
+  const ActionProfile *new_profile;
+  std::unordered_map<ActionProfile::mbr_hdl_t, ActionProfile::mbr_hdl_t> mbrs;
+  std::unordered_map<ActionProfile::grp_hdl_t, ActionProfile::grp_hdl_t> grps;
+};
+
+// copies the state attached to an entry but not part of it; the entries with
+// direct counters are appended to counters
+void
+migrate_entry_state(const MatchTableAbstract &old_table,
+                    MatchTableAbstract *new_table,
+                    const MatchTableAbstract::EntryCommon &old_entry,
+                    entry_handle_t new_handle, EntryCounters *counters) {
+  if (old_entry.timeout_ms > 0)
+    new_table->set_entry_ttl(new_handle, old_entry.timeout_ms);
+  MatchTableAbstract::counter_value_t bytes, packets;
+  if (old_table.query_counters(old_entry.handle, &bytes, &packets) ==
+      MatchErrorCode::SUCCESS &&
+      new_table->write_counters(new_handle, bytes, packets) ==
+      MatchErrorCode::SUCCESS) {
+    counters->handles.emplace_back(old_entry.handle, new_handle);
+    counters->values.emplace_back(bytes, packets);
+  }
+  std::vector<Meter::rate_config_t> rates;
+  if (old_table.get_meter_rates(old_entry.handle, &rates) ==
+      MatchErrorCode::SUCCESS && !rates.empty()) {
+    new_table->set_meter_rates(new_handle, rates);
+  }
+}
+
+void
+migrate_entries(const MatchTable &old_table, MatchTable *new_table,
+                const P4Objects &new_objects, P4Objects::MigrationStats *stats,
+                EntryCounters *counters) {
+  const auto &table_name = new_table->get_name();
+  for (auto &entry : old_table.get_entries()) {
+    const ActionFn *action_fn = new_objects.get_action_rt(
+        table_name, entry.action_fn->get_name());
+    entry_handle_t handle;
+    if (!action_fn ||
+        new_table->add_entry(entry.match_key, action_fn,
+                             std::move(entry.action_data), &handle,
+                             entry.priority) != MatchErrorCode::SUCCESS) {
+      stats->skipped_entries++;
+      continue;
+    }
+    stats->entries++;
+    migrate_entry_state(old_table, new_table, entry, handle, counters);
+  }
+  MatchTable::Entry default_entry;
+  if (old_table.is_default_entry_modified() &&
+      old_table.get_default_entry(&default_entry) == MatchErrorCode::SUCCESS) {
+    const ActionFn *action_fn = new_objects.get_action_rt(
+        table_name, default_entry.action_fn->get_name());
+    // fails if the default action is const in the new program
+    if (action_fn) {
+      new_table->set_default_action(action_fn,
+                                    std::move(default_entry.action_data));
+    }
+  }
+}
+
+void
+migrate_entries(const MatchTableIndirect &old_table,
+                MatchTableIndirect *new_table,
+                const MigratedActionProfile &profile,
+                P4Objects::MigrationStats *stats,
+                EntryCounters *counters) {
+  for (const auto &entry : old_table.get_entries()) {
+    auto it = profile.mbrs.find(entry.mbr);
+    entry_handle_t handle;
+    if (it == profile.mbrs.end() ||
+        new_table->add_entry(entry.match_key, it->second, &handle,
+                             entry.priority) != MatchErrorCode::SUCCESS) {
+      stats->skipped_entries++;
+      continue;
+    }
+    stats->entries++;
+    migrate_entry_state(old_table, new_table, entry, handle, counters);
+  }
+  MatchTableIndirect::Entry default_entry;
+  if (old_table.get_default_entry(&default_entry) == MatchErrorCode::SUCCESS) {
+    auto it = profile.mbrs.find(default_entry.mbr);
+    if (it != profile.mbrs.end()) new_table->set_default_member(it->second);
+  }
+}
+
+void
+migrate_entries(const MatchTableIndirectWS &old_table,
+                MatchTableIndirectWS *new_table,
+                const MigratedActionProfile &profile,
+                P4Objects::MigrationStats *stats,
+                EntryCounters *counters) {
+  // an entry points to a group iff its member handle is invalid
+  const auto no_mbr =
+      std::numeric_limits<MatchTableIndirectWS::mbr_hdl_t>::max();
+  for (const auto &entry : old_table.get_entries()) {
+    entry_handle_t handle;
+    MatchErrorCode rc = MatchErrorCode::ERROR;
+    if (entry.mbr != no_mbr) {
+      auto it = profile.mbrs.find(entry.mbr);
+      if (it != profile.mbrs.end()) {
+        rc = new_table->add_entry(entry.match_key, it->second, &handle,
+                                  entry.priority);
+      }
+    } else {
+      auto it = profile.grps.find(entry.grp);
+      if (it != profile.grps.end()) {
+        rc = new_table->add_entry_ws(entry.match_key, it->second, &handle,
+                                     entry.priority);
+      }
+    }
+    if (rc != MatchErrorCode::SUCCESS) {
+      stats->skipped_entries++;
+      continue;
+    }
+    stats->entries++;
+    migrate_entry_state(old_table, new_table, entry, handle, counters);
+  }
+  MatchTableIndirectWS::Entry default_entry;
+  if (old_table.get_default_entry(&default_entry) == MatchErrorCode::SUCCESS) {
+    if (default_entry.mbr != no_mbr) {
+      auto it = profile.mbrs.find(default_entry.mbr);
+      if (it != profile.mbrs.end()) new_table->set_default_member(it->second);
+    } else {
+      auto it = profile.grps.find(default_entry.grp);
+      if (it != profile.grps.end()) new_table->set_default_group(it->second);
+    }
+  }
+}
+
+// members whose action cannot be migrated are dropped, including from their
+// groups
+void
+migrate_action_profile(const ActionProfile &old_profile,
+                       ActionProfile *new_profile,
+                       const P4Objects &new_objects,
+                       P4Objects::MigrationStats *stats,
+                       MigratedActionProfile *migrated) {
+  migrated->new_profile = new_profile;
+  for (auto &member : old_profile.get_members()) {
+    const ActionFn *action_fn = new_objects.get_action_for_action_profile_rt(
+        new_profile->get_name(), member.action_fn->get_name());
+    ActionProfile::mbr_hdl_t mbr;
+    if (!action_fn ||
+        new_profile->add_member(action_fn, std::move(member.action_data),
+                                &mbr) != MatchErrorCode::SUCCESS) {
+      stats->skipped_entries++;
+      continue;
+    }
+    migrated->mbrs.emplace(member.mbr, mbr);
+  }
+  for (const auto &group : old_profile.get_groups()) {
+    ActionProfile::grp_hdl_t grp;
+    if (new_profile->create_group(&grp) != MatchErrorCode::SUCCESS) continue;
+    migrated->grps.emplace(group.grp, grp);
+    for (const auto mbr : group.mbr_handles) {
+      auto it = migrated->mbrs.find(mbr);
+      if (it != migrated->mbrs.end())
+        new_profile->add_member_to_group(it->second, grp);
+    }
+  }
+}
+
+void
+copy_counters(const CounterArray &old_array, CounterArray *new_array,
+              CounterValues *copied) {
+  copied->reserve(old_array.size());
+  for (size_t i = 0; i < old_array.size(); i++) {
+    Counter::counter_value_t bytes, packets;
+    old_array.get_counter(i).query_counter(&bytes, &packets);
+    new_array->get_counter(i).write_counter(bytes, packets);
+    copied->emplace_back(bytes, packets);
+  }
+}
+
+void
+copy_registers(const RegisterArray &old_array, RegisterArray *new_array,
+               std::vector<Data> *copied) {
+  auto old_lock = old_array.unique_lock();
+  auto new_lock = new_array->unique_lock();
+  copied->reserve(old_array.size());
+  for (size_t i = 0; i < old_array.size(); i++) {
+    (*new_array)[i].set(old_array[i]);
+    copied->emplace_back(old_array[i]);
+  }
+}
+
+// only the packets can modify the old objects after the copy, their counters
+// can only have increased
+
+void
+add_counter_updates(const CounterArray &old_array, CounterArray *new_array,
+                    const CounterValues &copied) {
+  for (size_t i = 0; i < old_array.size(); i++) {
+    Counter::counter_value_t bytes, packets;
+    old_array.get_counter(i).query_counter(&bytes, &packets);
+    if (bytes == copied[i].first && packets == copied[i].second) continue;
+    new_array->get_counter(i).add_counter(bytes - copied[i].first,
+                                          packets - copied[i].second);
+  }
+}
+
+void
+add_direct_counter_updates(const MatchTableAbstract &old_table,
+                           MatchTableAbstract *new_table,
+                           const HandlePairs &handles,
+                           const CounterValues &copied) {
+  for (size_t i = 0; i < handles.size(); i++) {
+    MatchTableAbstract::counter_value_t bytes, packets;
+    if (old_table.query_counters(handles[i].first, &bytes, &packets) !=
+        MatchErrorCode::SUCCESS) {
+      continue;
+    }
+    if (bytes == copied[i].first && packets == copied[i].second) continue;
+    // fails if the entry has been deleted since
+    new_table->add_counters(handles[i].second, bytes - copied[i].first,
+                            packets - copied[i].second);
+  }
+}
+
+// a register written by packets in both objects keeps its new value
+void
+copy_register_updates(const RegisterArray &old_array, RegisterArray *new_array,
+                      const std::vector<Data> &copied) {
+  auto old_lock = old_array.unique_lock();
+  auto new_lock = new_array->unique_lock();
+  for (size_t i = 0; i < old_array.size(); i++) {
+    if (old_array[i] != copied[i] && (*new_array)[i] == copied[i])
+      (*new_array)[i].set(old_array[i]);
+  }
+}
+
+}  // namespace
+
+P4Objects::MigrationStats
+P4Objects::migrate_state(const P4Objects &old_objects) {
+  MigrationStats stats;
+
+  // action profiles first, the entries of indirect tables refer to them
+  std::unordered_map<std::string, MigratedActionProfile> migrated_profiles;
+  for (const auto &e : old_objects.action_profiles_map) {
+    auto it = action_profiles_map.find(e.first);
+    if (it == action_profiles_map.end() ||
+        it->second->has_selection() != e.second->has_selection()) {
+      continue;
+    }
+    migrate_action_profile(*e.second, it->second.get(), *this, &stats,
+                           &migrated_profiles[e.first]);
+    stats.action_profiles++;
+  }
+
+  for (const auto &e : old_objects.match_action_tables_map) {
+    auto it = match_action_tables_map.find(e.first);
+    if (it == match_action_tables_map.end()) continue;
+    const auto *old_table = e.second->get_match_table();
+    auto *new_table = it->second->get_match_table();
+    if (!new_table->has_same_key(*old_table)) continue;
+    EntryCounters entry_counters;
+    switch (old_table->get_table_type()) {
+      case MatchTableType::SIMPLE:
+        {
+          const auto *old_t = static_cast<const MatchTable *>(old_table);
+          // const entries are part of the P4 program
+          if (old_t->has_immutable_entries()) continue;
+          migrate_entries(*old_t, static_cast<MatchTable *>(new_table), *this,
+                          &stats, &entry_counters);
+        }
+        break;
+      case MatchTableType::INDIRECT:
+      case MatchTableType::INDIRECT_WS:
+        {
+          const auto *old_t = static_cast<const MatchTableIndirect *>(
+              old_table);
+          auto *new_t = static_cast<MatchTableIndirect *>(new_table);
+          auto profile_it = migrated_profiles.find(
+              old_t->get_action_profile()->get_name());
+          if (profile_it == migrated_profiles.end() ||
+              profile_it->second.new_profile != new_t->get_action_profile()) {
+            continue;
+          }
+          if (old_table->get_table_type() == MatchTableType::INDIRECT) {
+            migrate_entries(*old_t, new_t, profile_it->second, &stats,
+                            &entry_counters);
+          } else {
+            migrate_entries(
+                *static_cast<const MatchTableIndirectWS *>(old_table),
+                static_cast<MatchTableIndirectWS *>(new_table),
+                profile_it->second, &stats, &entry_counters);
+          }
+        }
+        break;
+      case MatchTableType::NONE:
+        continue;
+    }
+    stats.tables++;
+    if (!entry_counters.handles.empty()) {
+      migrated_direct_counters.push_back(
+          {e.first, std::move(entry_counters.handles),
+           std::move(entry_counters.values)});
+    }
+  }
+
+  for (const auto &e : old_objects.counter_arrays) {
+    auto it = counter_arrays.find(e.first);
+    if (it == counter_arrays.end() || it->second->size() != e.second->size())
+      continue;
+    MigratedCounterArray migrated{e.first, {}};
+    copy_counters(*e.second, it->second.get(), &migrated.values);
+    migrated_counter_arrays.push_back(std::move(migrated));
+    stats.counter_arrays++;
+  }
+
+  for (const auto &e : old_objects.register_arrays) {
+    auto it = register_arrays.find(e.first);
+    if (it == register_arrays.end() ||
+        it->second->size() != e.second->size() ||
+        it->second->get_bitwidth() != e.second->get_bitwidth()) {
+      continue;
+    }
+    MigratedRegisterArray migrated{e.first, {}};
+    copy_registers(*e.second, it->second.get(), &migrated.values);
+    migrated_register_arrays.push_back(std::move(migrated));
+    stats.register_arrays++;
+  }
+
+  // direct meters were migrated with the table entries
+  for (const auto &e : old_objects.meter_arrays) {
+    auto it = meter_arrays.find(e.first);
+    if (it == meter_arrays.end() || direct_meter_arrays.count(e.first) ||
+        old_objects.direct_meter_arrays.count(e.first)) {
+      continue;
+    }
+    const auto &old_array = *e.second;
+    auto &new_array = *it->second;
+    if (new_array.size() != old_array.size()) continue;
+    if (old_array.size() > 0 &&
+        (new_array.get_meter(0).get_type() !=
+         old_array.get_meter(0).get_type() ||
+         new_array.get_meter(0).get_rate_count() !=
+         old_array.get_meter(0).get_rate_count())) {
+      continue;
+    }
+    for (size_t i = 0; i < old_array.size(); i++) {
+      const auto rates = old_array.get_meter(i).get_rates();
+      if (!rates.empty()) new_array.get_meter(i).set_rates(rates);
+    }
+    stats.meter_arrays++;
+  }
+
+  return stats;
+}
+
+void
+P4Objects::migrate_packet_state(const P4Objects &old_objects) {
+  for (const auto &migrated : migrated_direct_counters) {
+    add_direct_counter_updates(
+        *old_objects.get_abstract_match_table(migrated.table_name),
+        get_abstract_match_table(migrated.table_name), migrated.handles,
+        migrated.values);
+  }
+  for (const auto &migrated : migrated_counter_arrays) {
+    add_counter_updates(*old_objects.get_counter_array(migrated.name),
+                        get_counter_array(migrated.name), migrated.values);
+  }
+  for (const auto &migrated : migrated_register_arrays) {
+    copy_register_updates(*old_objects.get_register_array(migrated.name),
+                          get_register_array(migrated.name), migrated.values);
+  }
+  // only needed once
+  migrated_direct_counters.clear();
+  migrated_counter_arrays.clear();
+  migrated_register_arrays.clear();
+}
+
 namespace {
 
 template <typename T>
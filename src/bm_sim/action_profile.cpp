@@ -22,6 +22,7 @@
 #include <bm/bm_sim/action_profile.h>
 #include <bm/bm_sim/logger.h>
 #include <bm/bm_sim/packet.h>
+#include <bm/bm_sim/snapshot.h>
 
 #include <iostream>
 #include <string>
@@ -48,6 +49,27 @@ ActionProfile::IndirectIndexRefCount::deserialize(std::istream *in) {
   for (auto &c : grp_count) (*in) >> c;
 }
 
+void
+ActionProfile::IndirectIndexRefCount::serialize(SnapshotWriter *out) const {
+  out->write_u32(static_cast<uint32_t>(mbr_count.size()));
+  for (const auto c : mbr_count) out->write_u32(c);
+  out->write_u32(static_cast<uint32_t>(grp_count.size()));
+  for (const auto c : grp_count) out->write_u32(c);
+}
+
+// the sizes are not trusted, the loops stop at the end of the snapshot data
+void
+ActionProfile::IndirectIndexRefCount::deserialize(SnapshotReader *in) {
+  auto s = in->read_u32();
+  mbr_count.clear();
+  for (size_t i = 0; i < s && in->good(); i++)
+    mbr_count.push_back(in->read_u32());
+  s = in->read_u32();
+  grp_count.clear();
+  for (size_t i = 0; i < s && in->good(); i++)
+    grp_count.push_back(in->read_u32());
+}
+
 
 void
 ActionProfile::IndirectIndex::serialize(std::ostream *out) const {
@@ -61,6 +83,18 @@ ActionProfile::IndirectIndex::deserialize(std::istream *in,
   (*in) >> index;
 }
 
+void
+ActionProfile::IndirectIndex::serialize(SnapshotWriter *out) const {
+  out->write_u32(index);
+}
+
+void
+ActionProfile::IndirectIndex::deserialize(SnapshotReader *in,
+                                          const P4Objects &objs) {
+  (void) objs;
+  index = in->read_u32();
+}
+
 
 MatchErrorCode
 ActionProfile::GroupInfo::add_member(mbr_hdl_t mbr) {
@@ -104,6 +138,18 @@ ActionProfile::GroupInfo::deserialize(std::istream *in) {
   }
 }
 
+void
+ActionProfile::GroupInfo::serialize(SnapshotWriter *out) const {
+  out->write_u32(static_cast<uint32_t>(size()));
+  for (const auto mbr : mbrs) out->write_u32(mbr);
+}
+
+void
+ActionProfile::GroupInfo::deserialize(SnapshotReader *in) {
+  auto s = in->read_u32();
+  for (size_t i = 0; i < s && in->good(); i++) add_member(in->read_u32());
+}
+
 
 void
 ActionProfile::GroupMgr::add_member_to_group(grp_hdl_t grp, mbr_hdl_t mbr) {
@@ -162,7 +208,9 @@ ActionProfile::GroupMgr::clear() {
 ActionProfile::ActionProfile(const std::string &name, p4object_id_t id,
                              bool with_selection)
     : NamedP4Object(name, id),
-      with_selection(with_selection) { }
+      with_selection(with_selection) {
+  BM_LOCK_STATS_NAME(t_mutex, "action_profile:" + name);
+}
 
 const ActionEntry &
 ActionProfile::lookup(const Packet &pkt, const IndirectIndex &index) const {
@@ -581,6 +629,57 @@ ActionProfile::deserialize(std::istream *in, const P4Objects &objs) {
   }
 }
 
+void
+ActionProfile::serialize(SnapshotWriter *out) const {
+  ReadLock lock = lock_read();
+  out->write_u32(static_cast<uint32_t>(action_entries.size()));
+  out->write_u32(static_cast<uint32_t>(num_members));
+  for (const auto h : mbr_handles) {
+    out->write_u32(h);
+    action_entries.at(h).serialize(out);
+  }
+  index_ref_count.serialize(out);
+  out->write_u32(static_cast<uint32_t>(num_groups));
+  for (const auto h : grp_handles) {
+    out->write_u32(h);
+    grp_mgr.at(h).serialize(out);
+  }
+}
+
+// like for the text format, we assume the action profile is empty
+void
+ActionProfile::deserialize(SnapshotReader *in, const P4Objects &objs) {
+  WriteLock lock = lock_write();
+  action_entries.resize(in->read_u32());
+  num_members = in->read_u32();
+  for (size_t i = 0; i < num_members && in->good(); i++) {
+    mbr_hdl_t mbr_hdl = in->read_u32();
+    if (mbr_hdl >= action_entries.size() || mbr_handles.set_handle(mbr_hdl)) {
+      in->set_failed();
+      return;
+    }
+    action_entries[mbr_hdl].deserialize(in, objs);
+  }
+  index_ref_count.deserialize(in);
+  num_groups = in->read_u32();
+  // the group handles are in increasing order, but there may be gaps
+  grp_hdl_t next_grp_hdl = 0;
+  for (size_t i = 0; i < num_groups && in->good(); i++) {
+    grp_hdl_t grp_hdl = in->read_u32();
+    if (grp_handles.set_handle(grp_hdl)) {
+      in->set_failed();
+      return;
+    }
+    for (; next_grp_hdl < grp_hdl; next_grp_hdl++)
+      grp_mgr.insert_group(next_grp_hdl);
+    grp_mgr.insert_group(grp_hdl);
+    next_grp_hdl = grp_hdl + 1;
+    grp_mgr.at(grp_hdl).deserialize(in);
+    for (const auto mbr : grp_mgr.at(grp_hdl))
+      grp_selector->add_member_to_group(grp_hdl, mbr);
+  }
+}
+
 void
 ActionProfile::dump_entry(std::ostream *out, const IndirectIndex &index) const {
   if (index.is_mbr()) {
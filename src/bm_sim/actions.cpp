@@ -21,9 +21,11 @@
 #include <bm/bm_sim/actions.h>
 #include <bm/bm_sim/debugger.h>
 #include <bm/bm_sim/event_logger.h>
+#include <bm/bm_sim/latency_stats.h>
 #include <bm/bm_sim/P4Objects.h>
 #include <bm/bm_sim/packet.h>
 #include <bm/bm_sim/logger.h>
+#include <bm/bm_sim/snapshot.h>
 
 #include <string>
 #include <vector>
@@ -238,6 +240,23 @@ ActionFn::get_num_params() const {
   return num_params;
 }
 
+ProfilingStats::Action
+ActionFn::get_profiling_stats() const {
+  auto values = profiling_counters.get();
+  ProfilingStats::Action stats;
+  stats.name = get_name();
+  stats.executions = values[PROF_EXECUTIONS];
+  auto samples = values[PROF_SAMPLES];
+  stats.avg_ns = samples ? values[PROF_NS] / samples : 0;
+  stats.total_ns = stats.avg_ns * stats.executions;
+  return stats;
+}
+
+void
+ActionFn::reset_profiling_stats() {
+  profiling_counters.reset();
+}
+
 namespace core {
 
 extern int _bm_core_primitives_import();
@@ -336,12 +355,25 @@ ActionFnEntry::operator()(Packet *pkt) const {
       Debugger::PacketId::make(pkt->get_packet_id(), pkt->get_copy_id()),
       DBG_CTR_ACTION | action_fn->get_id());
 
+  const bool profiling = ProfilingCounters::is_enabled();
+  const bool timed = profiling && ProfilingCounters::sample();
+  uint64_t start_ns = timed ? LatencyStats::now_ns() : 0;
+
   {
     RegisterSync::RegisterLocks RL;
     action_fn->register_sync.lock(&RL);
     execute(pkt);
   }
 
+  if (profiling) {
+    auto &counters = action_fn->profiling_counters;
+    counters.add(ActionFn::PROF_EXECUTIONS, 1);
+    if (timed) {
+      counters.add(ActionFn::PROF_SAMPLES, 1);
+      counters.add(ActionFn::PROF_NS, LatencyStats::now_ns() - start_ns);
+    }
+  }
+
   DEBUGGER_NOTIFY_CTR(
       Debugger::PacketId::make(pkt->get_packet_id(), pkt->get_copy_id()),
       DBG_CTR_EXIT(DBG_CTR_ACTION) | action_fn->get_id());
@@ -391,6 +423,36 @@ ActionFnEntry::deserialize(std::istream *in, const P4Objects &objs) {
   }
 }
 
+void
+ActionFnEntry::serialize(SnapshotWriter *out) const {
+  if (action_fn == nullptr) {
+    out->write_i32(-1);
+    return;
+  }
+  out->write_i32(action_fn->id);
+  out->write_u32(static_cast<uint32_t>(action_data.size()));
+  for (const Data &d : action_data.action_data)
+    out->write_string(d.get_string());
+}
+
+// an unknown action id throws std::out_of_range, like for the text format
+void
+ActionFnEntry::deserialize(SnapshotReader *in, const P4Objects &objs) {
+  auto id = static_cast<p4object_id_t>(in->read_i32());
+  if (id == -1 || !in->good()) {
+    action_fn = nullptr;
+    return;
+  }
+  action_fn = objs.get_action_by_id(id);
+  auto s = in->read_u32();
+  for (size_t i = 0; i < s; i++) {
+    auto nbytes = in->read_u32();
+    const char *bytes = in->read_bytes(nbytes);
+    if (!bytes) return;
+    push_back_action_data(Data(bytes, nbytes));
+  }
+}
+
 thread_local Packet *ActionPrimitive_::pkt = nullptr;
 thread_local PHV *ActionPrimitive_::phv = nullptr;
 
@@ -0,0 +1,1019 @@
+/* Copyright 2013-present Barefoot Networks, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Antonin Bas (antonin@barefootnetworks.com)
+ *
+ */
+
+#include <bm/bm_sim/logger.h>
+#include <bm/bm_sim/packet_buffer.h>
+#include <bm/bm_sim/thread_affinity.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "af_xdp.h"
+
+#ifdef __linux__
+
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+#include <net/if.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+namespace bm {
+
+namespace {
+
+// Each port has its own UMEM of kNumFrames frames of kFrameSize bytes. The
+// first kNumRxFrames frames are used for reception (they circulate between
+// the fill ring, the RX ring and the switch), the other ones for transmission
+// (they circulate between the TX ring and the completion ring). When the
+// switch sends a packet out of the port it was received on, the RX frame is
+// placed directly in the TX ring and goes back to the fill ring on completion.
+constexpr uint32_t kFrameSize = 4096u;
+constexpr uint32_t kNumFrames = 4096u;
+constexpr uint32_t kFillRingSize = 2048u;
+constexpr uint32_t kRxRingSize = 2048u;
+constexpr uint32_t kTxRingSize = 1024u;
+constexpr uint32_t kCompRingSize = 1024u;
+constexpr uint32_t kNumTxFrames = kTxRingSize;
+constexpr uint32_t kNumRxFrames = kNumFrames - kNumTxFrames;
+// reserved by us in each frame, in addition to the XDP_PACKET_HEADROOM
+// reserved by the kernel; it is available to the switch to push new headers
+constexpr uint32_t kFrameHeadroom = 256u;
+// maximum number of RX frames held by the switch at any given time; above
+// that, packets are copied and their frame is recycled immediately, so that
+// the fill ring never runs dry
+constexpr uint32_t kMaxOutstandingFrames = kNumRxFrames - kFillRingSize;
+constexpr uint32_t kRxBurstSize = 64u;
+// see dev_mgr_af_packet.cpp
+constexpr uint32_t kTxBatchSize = 32u;
+constexpr int kTxWaitMs = 10;
+constexpr int kTxWaitTries = 10;
+
+template <typename T>
+T
+load_acquire(T *ptr) {
+  return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+
+template <typename T>
+void
+store_release(T *ptr, T v) {
+  __atomic_store_n(ptr, v, __ATOMIC_RELEASE);
+}
+
+int
+sys_bpf(enum bpf_cmd cmd, union bpf_attr *attr) {
+  return static_cast<int>(syscall(SYS_bpf, cmd, attr, sizeof(*attr)));
+}
+
+struct bpf_insn
+make_insn(uint8_t code, uint8_t dst, uint8_t src, int16_t off, int32_t imm) {
+  struct bpf_insn insn;
+  std::memset(&insn, 0, sizeof(insn));
+  insn.code = code;
+  insn.dst_reg = dst;
+  insn.src_reg = src;
+  insn.off = off;
+  insn.imm = imm;
+  return insn;
+}
+
+// Loads the following XDP program, which redirects every packet to the AF_XDP
+// socket registered in the XSKMAP for its RX queue, and lets the packet go
+// through the kernel stack if there is none:
+//   return bpf_redirect_map(&xsks_map, ctx->rx_queue_index, XDP_PASS);
+// We assemble it by hand so that we do not need to depend on libbpf and on a
+// BPF compiler.
+int
+load_xdp_prog(int map_fd, std::string *log) {
+  struct bpf_insn insns[] = {
+    // r2 = ctx->rx_queue_index
+    make_insn(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_1,
+              offsetof(struct xdp_md, rx_queue_index), 0),
+    // r1 = xsks_map (64-bit immediate, takes 2 instructions)
+    make_insn(BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0,
+              map_fd),
+    make_insn(0, 0, 0, 0, 0),
+    // r3 = XDP_PASS (action if there is no socket for this queue)
+    make_insn(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_3, 0, 0, XDP_PASS),
+    make_insn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map),
+    make_insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+  };
+  static const char license[] = "Apache-2.0";
+  std::vector<char> log_buf(4096, 0);
+
+  union bpf_attr attr;
+  std::memset(&attr, 0, sizeof(attr));
+  attr.prog_type = BPF_PROG_TYPE_XDP;
+  attr.insns = reinterpret_cast<uintptr_t>(insns);
+  attr.insn_cnt = sizeof(insns) / sizeof(insns[0]);
+  attr.license = reinterpret_cast<uintptr_t>(license);
+  attr.log_buf = reinterpret_cast<uintptr_t>(log_buf.data());
+  attr.log_size = log_buf.size();
+  attr.log_level = 1;
+  int fd = sys_bpf(BPF_PROG_LOAD, &attr);
+  if (fd < 0) log->assign(log_buf.data());
+  return fd;
+}
+
+// An AF_XDP socket bound to one queue of an interface, with its UMEM and its 4
+// rings. The instance is reference counted because the switch can hold UMEM
+// frames (in PacketBuffer instances) after the port has been removed; the
+// memory is released with the last frame.
+class XskPort {
+ public:
+  XskPort(DevMgrIface::port_t port_num, const std::string &iface_name,
+          const std::string &mode, uint32_t queue_id)
+      : port_num(port_num), iface_name(iface_name), mode(mode),
+        queue_id(queue_id) { }
+
+  XskPort(const XskPort &other) = delete;
+  XskPort &operator=(const XskPort &other) = delete;
+
+  // returns 0 on success, errno otherwise; in case of error, a description of
+  // the failing step is stored in \p what
+  int open(std::string *what);
+
+  void ref() { refs.fetch_add(1, std::memory_order_relaxed); }
+
+  void unref() {
+    if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) delete this;
+  }
+
+  // detaches the XDP program, packets are no longer redirected to the socket
+  void detach() {
+    if (link_fd >= 0) close(link_fd);
+    link_fd = -1;
+  }
+
+  // Processes at most kRxBurstSize packets from the RX ring, returns the number
+  // of packets processed. Only called by the receive thread.
+  uint32_t receive(
+      const PacketDispatcherIface::PacketHandler &handler, void *cookie,
+      const PacketDispatcherIface::PacketBufferHandler &buffer_handler,
+      void *buffer_cookie);
+
+  // Copies the packet to a free TX frame. Returns true if the caller needs to
+  // make sure that flush() will be called.
+  bool send(const char *buffer, int len);
+
+  // Same as send(), but if the buffer is one of our RX frames, the frame is
+  // transmitted without a copy.
+  bool send_buffer(PacketBuffer *buffer, int len);
+
+  void flush() {
+    std::unique_lock<std::mutex> lock(tx_mutex);
+    flush_();
+  }
+
+  bool is_up() const {
+    std::ifstream fs("/sys/class/net/" + iface_name + "/operstate");
+    std::string state;
+    return fs && (fs >> state) && state == "up";
+  }
+
+  int get_fd() const { return fd; }
+
+  DevMgrIface::PortStats get_stats() const {
+    return DevMgrIface::PortStats::make(
+        in_packets.load(), in_octets.load(),
+        out_packets.load(), out_octets.load());
+  }
+
+  DevMgrIface::PortStats clear_stats() {
+    return DevMgrIface::PortStats::make(
+        in_packets.exchange(0), in_octets.exchange(0),
+        out_packets.exchange(0), out_octets.exchange(0));
+  }
+
+ private:
+  struct Ring {
+    uint32_t *producer{nullptr};
+    uint32_t *consumer{nullptr};
+    uint32_t *flags{nullptr};
+    void *descs{nullptr};
+    uint32_t size{0};
+    void *map{MAP_FAILED};
+    size_t map_size{0};
+
+    template <typename T>
+    T *desc(uint32_t idx) const {
+      return static_cast<T *>(descs) + (idx & (size - 1));
+    }
+  };
+
+  // only called through unref()
+  ~XskPort();
+
+  int map_ring(Ring *ring, const struct xdp_ring_offset &off, uint32_t size,
+               size_t desc_size, off_t pgoff);
+  int attach(std::string *what);
+  void refill();
+  void reclaim_tx_frames();
+  bool check_tx_size(int len);
+  bool wait_for_tx_slot(bool need_frame);
+  bool push_tx_desc(uint64_t addr, int len);
+  void flush_();
+
+  static void release_frame(char *buffer, void *cookie);
+
+  DevMgrIface::port_t port_num;
+  std::string iface_name;
+  std::string mode;
+  uint32_t queue_id;
+  int ifindex{0};
+  int fd{-1};
+  int map_fd{-1};
+  int prog_fd{-1};
+  int link_fd{-1};
+  char *umem{nullptr};
+  size_t umem_size{static_cast<size_t>(kNumFrames) * kFrameSize};
+  Ring fill{};
+  Ring comp{};
+  Ring rx{};
+  Ring tx{};
+  std::atomic<int> refs{1};
+  // RX frames which can be given to the kernel, only accessed by the receive
+  // thread
+  std::vector<uint64_t> rx_free{};
+  // RX frames returned by the switch, from any thread
+  std::mutex released_mutex{};
+  std::vector<uint64_t> released{};
+  std::atomic<uint32_t> outstanding{0};
+  std::mutex tx_mutex{};
+  std::vector<uint64_t> tx_free{};
+  // free TX ring entries; RX frames sent without a copy use an entry but no TX
+  // frame
+  uint32_t tx_slots{kTxRingSize};
+  uint32_t tx_pending{0};
+  std::atomic<uint64_t> in_packets{0};
+  std::atomic<uint64_t> in_octets{0};
+  std::atomic<uint64_t> out_packets{0};
+  std::atomic<uint64_t> out_octets{0};
+  std::atomic<uint64_t> tx_drops{0};
+};
+
+XskPort::~XskPort() {
+  detach();
+  if (prog_fd >= 0) close(prog_fd);
+  if (map_fd >= 0) close(map_fd);
+  for (auto *ring : {&fill, &comp, &rx, &tx}) {
+    if (ring->map != MAP_FAILED) munmap(ring->map, ring->map_size);
+  }
+  if (fd >= 0) close(fd);
+  if (umem) munmap(umem, umem_size);
+}
+
+int
+XskPort::map_ring(Ring *ring, const struct xdp_ring_offset &off, uint32_t size,
+                  size_t desc_size, off_t pgoff) {
+  ring->map_size = off.desc + size * desc_size;
+  ring->map = mmap(nullptr, ring->map_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, fd, pgoff);
+  if (ring->map == MAP_FAILED) return errno;
+  auto *base = static_cast<char *>(ring->map);
+  ring->producer = reinterpret_cast<uint32_t *>(base + off.producer);
+  ring->consumer = reinterpret_cast<uint32_t *>(base + off.consumer);
+  ring->flags = reinterpret_cast<uint32_t *>(base + off.flags);
+  ring->descs = base + off.desc;
+  ring->size = size;
+  return 0;
+}
+
+int
+XskPort::open(std::string *what) {
+  ifindex = if_nametoindex(iface_name.c_str());
+  if (ifindex == 0) {
+    *what = "no such interface";
+    return errno;
+  }
+
+  *what = "AF_XDP socket creation";
+  fd = socket(AF_XDP, SOCK_RAW | SOCK_CLOEXEC, 0);
+  if (fd < 0) return errno;
+
+  *what = "UMEM allocation";
+  void *mem = mmap(nullptr, umem_size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  if (mem == MAP_FAILED) return errno;
+  umem = static_cast<char *>(mem);
+
+  *what = "UMEM registration";
+  struct xdp_umem_reg umem_reg;
+  std::memset(&umem_reg, 0, sizeof(umem_reg));
+  umem_reg.addr = reinterpret_cast<uintptr_t>(umem);
+  umem_reg.len = umem_size;
+  umem_reg.chunk_size = kFrameSize;
+  umem_reg.headroom = kFrameHeadroom;
+  if (setsockopt(fd, SOL_XDP, XDP_UMEM_REG, &umem_reg, sizeof(umem_reg)))
+    return errno;
+
+  *what = "ring creation";
+  const std::pair<int, uint32_t> ring_sizes[] = {
+    {XDP_UMEM_FILL_RING, kFillRingSize},
+    {XDP_UMEM_COMPLETION_RING, kCompRingSize},
+    {XDP_RX_RING, kRxRingSize},
+    {XDP_TX_RING, kTxRingSize}};
+  for (const auto &p : ring_sizes) {
+    if (setsockopt(fd, SOL_XDP, p.first, &p.second, sizeof(p.second)))
+      return errno;
+  }
+
+  *what = "ring mapping";
+  struct xdp_mmap_offsets off;
+  socklen_t optlen = sizeof(off);
+  if (getsockopt(fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen)) return errno;
+  int error;
+  if ((error = map_ring(&fill, off.fr, kFillRingSize, sizeof(uint64_t),
+                        XDP_UMEM_PGOFF_FILL_RING)) ||
+      (error = map_ring(&comp, off.cr, kCompRingSize, sizeof(uint64_t),
+                        XDP_UMEM_PGOFF_COMPLETION_RING)) ||
+      (error = map_ring(&rx, off.rx, kRxRingSize, sizeof(struct xdp_desc),
+                        XDP_PGOFF_RX_RING)) ||
+      (error = map_ring(&tx, off.tx, kTxRingSize, sizeof(struct xdp_desc),
+                        XDP_PGOFF_TX_RING))) {
+    return error;
+  }
+
+  rx_free.reserve(kNumRxFrames);
+  for (uint32_t i = 0; i < kNumRxFrames; i++)
+    rx_free.push_back(static_cast<uint64_t>(i) * kFrameSize);
+  released.reserve(kNumRxFrames);
+  tx_free.reserve(kNumTxFrames);
+  for (uint32_t i = kNumRxFrames; i < kNumFrames; i++)
+    tx_free.push_back(static_cast<uint64_t>(i) * kFrameSize);
+  refill();
+
+  *what = "socket bind";
+  struct sockaddr_xdp addr;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sxdp_family = AF_XDP;
+  addr.sxdp_ifindex = ifindex;
+  addr.sxdp_queue_id = queue_id;
+  addr.sxdp_flags = XDP_USE_NEED_WAKEUP;
+  addr.sxdp_flags |= (mode == "zc") ? XDP_ZEROCOPY : XDP_COPY;
+  if (bind(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)))
+    return errno;
+
+  return attach(what);
+}
+
+int
+XskPort::attach(std::string *what) {
+  union bpf_attr attr;
+
+  *what = "XSKMAP creation";
+  std::memset(&attr, 0, sizeof(attr));
+  attr.map_type = BPF_MAP_TYPE_XSKMAP;
+  attr.key_size = sizeof(uint32_t);
+  attr.value_size = sizeof(uint32_t);
+  attr.max_entries = queue_id + 1;
+  map_fd = sys_bpf(BPF_MAP_CREATE, &attr);
+  if (map_fd < 0) return errno;
+
+  *what = "XSKMAP update";
+  uint32_t key = queue_id;
+  uint32_t value = static_cast<uint32_t>(fd);
+  std::memset(&attr, 0, sizeof(attr));
+  attr.map_fd = map_fd;
+  attr.key = reinterpret_cast<uintptr_t>(&key);
+  attr.value = reinterpret_cast<uintptr_t>(&value);
+  attr.flags = BPF_ANY;
+  if (sys_bpf(BPF_MAP_UPDATE_ELEM, &attr)) return errno;
+
+  std::string log;
+  prog_fd = load_xdp_prog(map_fd, &log);
+  if (prog_fd < 0) {
+    *what = "XDP program load (" + log + ")";
+    return errno;
+  }
+
+  // the program is detached automatically when link_fd is closed, including
+  // when the process exits
+  *what = "XDP program attach";
+  std::memset(&attr, 0, sizeof(attr));
+  attr.link_create.prog_fd = prog_fd;
+  attr.link_create.target_ifindex = ifindex;
+  attr.link_create.attach_type = BPF_XDP;
+  attr.link_create.flags = (mode == "skb") ?
+      XDP_FLAGS_SKB_MODE : XDP_FLAGS_DRV_MODE;
+  link_fd = sys_bpf(BPF_LINK_CREATE, &attr);
+  if (link_fd < 0) return errno;
+
+  return 0;
+}
+
+// gives as many free RX frames as possible back to the kernel
+void
+XskPort::refill() {
+  {
+    std::unique_lock<std::mutex> lock(released_mutex);
+    rx_free.insert(rx_free.end(), released.begin(), released.end());
+    released.clear();
+  }
+  if (rx_free.empty()) return;
+
+  uint32_t prod = *fill.producer;
+  uint32_t cons = load_acquire(fill.consumer);
+  uint32_t n = std::min(static_cast<size_t>(fill.size - (prod - cons)),
+                        rx_free.size());
+  for (uint32_t i = 0; i < n; i++) {
+    *fill.desc<uint64_t>(prod + i) = rx_free.back();
+    rx_free.pop_back();
+  }
+  if (n == 0) return;
+  store_release(fill.producer, prod + n);
+  if (load_acquire(fill.flags) & XDP_RING_NEED_WAKEUP)
+    recvfrom(fd, nullptr, 0, MSG_DONTWAIT, nullptr, nullptr);
+}
+
+void
+XskPort::release_frame(char *buffer, void *cookie) {
+  auto *port = static_cast<XskPort *>(cookie);
+  {
+    std::unique_lock<std::mutex> lock(port->released_mutex);
+    port->released.push_back(static_cast<uint64_t>(buffer - port->umem));
+  }
+  port->outstanding.fetch_sub(1, std::memory_order_relaxed);
+  port->unref();
+}
+
+uint32_t
+XskPort::receive(
+    const PacketDispatcherIface::PacketHandler &handler, void *cookie,
+    const PacketDispatcherIface::PacketBufferHandler &buffer_handler,
+    void *buffer_cookie) {
+  refill();
+
+  uint32_t cons = *rx.consumer;
+  uint32_t n = std::min(load_acquire(rx.producer) - cons, kRxBurstSize);
+  for (uint32_t i = 0; i < n; i++) {
+    const auto *desc = rx.desc<struct xdp_desc>(cons + i);
+    uint64_t frame = desc->addr & ~static_cast<uint64_t>(kFrameSize - 1);
+    size_t offset = desc->addr - frame;
+    in_packets.fetch_add(1, std::memory_order_relaxed);
+    in_octets.fetch_add(desc->len, std::memory_order_relaxed);
+
+    if (buffer_handler &&
+        outstanding.load(std::memory_order_relaxed) < kMaxOutstandingFrames) {
+      // zero-copy: the frame is returned to us by release_frame once the
+      // switch is done with the packet
+      outstanding.fetch_add(1, std::memory_order_relaxed);
+      ref();
+      buffer_handler(port_num,
+                     PacketBuffer(umem + frame, offset + desc->len, desc->len,
+                                  &XskPort::release_frame, this),
+                     buffer_cookie);
+    } else {
+      if (handler) {
+        handler(port_num, umem + desc->addr, static_cast<int>(desc->len),
+                cookie);
+      }
+      rx_free.push_back(frame);
+    }
+  }
+  if (n > 0) store_release(rx.consumer, cons + n);
+  return n;
+}
+
+void
+XskPort::reclaim_tx_frames() {
+  uint32_t cons = *comp.consumer;
+  uint32_t n = load_acquire(comp.producer) - cons;
+  size_t nb_rx_frames = 0;
+  for (uint32_t i = 0; i < n; i++) {
+    uint64_t addr = *comp.desc<uint64_t>(cons + i);
+    uint64_t frame = addr & ~static_cast<uint64_t>(kFrameSize - 1);
+    if (frame < static_cast<uint64_t>(kNumRxFrames) * kFrameSize) {
+      // an RX frame sent without a copy, see send_buffer()
+      std::unique_lock<std::mutex> lock(released_mutex);
+      released.push_back(frame);
+      nb_rx_frames++;
+    } else {
+      tx_free.push_back(frame);
+    }
+  }
+  if (n == 0) return;
+  store_release(comp.consumer, cons + n);
+  tx_slots += n;
+  outstanding.fetch_sub(nb_rx_frames, std::memory_order_relaxed);
+}
+
+bool
+XskPort::check_tx_size(int len) {
+  if (len <= 0 || static_cast<uint32_t>(len) > kFrameSize) {
+    Logger::get()->error("Cannot send packet of size {} on port {}",
+                         len, port_num);
+    tx_drops.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  return true;
+}
+
+// tx_mutex must be held
+bool
+XskPort::wait_for_tx_slot(bool need_frame) {
+  reclaim_tx_frames();
+  int tries = 0;
+  while (tx_slots == 0 || (need_frame && tx_free.empty())) {
+    flush_();
+    if (++tries > kTxWaitTries) {
+      tx_drops.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    struct pollfd pfd = {fd, POLLOUT, 0};
+    poll(&pfd, 1, kTxWaitMs);
+    reclaim_tx_frames();
+  }
+  return true;
+}
+
+// tx_mutex must be held; returns true if the caller needs to make sure that
+// flush() will be called
+bool
+XskPort::push_tx_desc(uint64_t addr, int len) {
+  uint32_t prod = *tx.producer;
+  auto *desc = tx.desc<struct xdp_desc>(prod);
+  desc->addr = addr;
+  desc->len = len;
+  desc->options = 0;
+  store_release(tx.producer, prod + 1);
+  tx_slots--;
+  out_packets.fetch_add(1, std::memory_order_relaxed);
+  out_octets.fetch_add(len, std::memory_order_relaxed);
+
+  if (++tx_pending >= kTxBatchSize) {
+    flush_();
+    return false;
+  }
+  return tx_pending == 1;
+}
+
+bool
+XskPort::send(const char *buffer, int len) {
+  if (!check_tx_size(len)) return false;
+
+  std::unique_lock<std::mutex> lock(tx_mutex);
+  if (!wait_for_tx_slot(true)) return false;
+  uint64_t frame = tx_free.back();
+  tx_free.pop_back();
+  std::memcpy(umem + frame, buffer, len);
+  return push_tx_desc(frame, len);
+}
+
+bool
+XskPort::send_buffer(PacketBuffer *buffer, int len) {
+  char *data = buffer->start();
+  if (len <= 0 || data < umem ||
+      data >= umem + static_cast<size_t>(kNumRxFrames) * kFrameSize) {
+    return send(data, len);
+  }
+
+  std::unique_lock<std::mutex> lock(tx_mutex);
+  if (!wait_for_tx_slot(false)) return false;
+  // the frame now belongs to the TX ring, it is returned to the fill ring by
+  // reclaim_tx_frames; the reference taken for the frame in receive() is
+  // dropped right away, the caller holds one
+  if (!buffer->release_memory(&XskPort::release_frame, this)) {
+    lock.unlock();
+    return send(data, len);
+  }
+  unref();
+  return push_tx_desc(static_cast<uint64_t>(data - umem), len);
+}
+
+void
+XskPort::flush_() {
+  if (tx_pending == 0) return;
+  // in copy mode, the kernel always needs to be kicked; in zero-copy mode, only
+  // when the driver asks for it
+  if ((mode != "zc" || (load_acquire(tx.flags) & XDP_RING_NEED_WAKEUP)) &&
+      sendto(fd, nullptr, 0, MSG_DONTWAIT, nullptr, 0) < 0 &&
+      errno != EAGAIN && errno != EBUSY && errno != ENOBUFS &&
+      errno != ENETDOWN) {
+    Logger::get()->error("Error when sending packets on port {}: {}",
+                         port_num, std::strerror(errno));
+  }
+  tx_pending = 0;
+}
+
+struct XskPortUnref {
+  void operator()(XskPort *port) const { port->unref(); }
+};
+
+}  // namespace
+
+class AfXdpPortMgr::Imp {
+ public:
+  Imp() {
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd < 0) {
+      Logger::get()->critical("Could not create eventfd for AF_XDP port "
+                              "manager");
+      std::exit(1);
+    }
+  }
+
+  ~Imp() {
+    if (started) {
+      stop_receive_thread = true;
+      wake();
+      receive_thread.join();
+    }
+    for (auto &p : ports) p.second->detach();
+    close(wake_fd);
+  }
+
+  ReturnCode port_add(const std::string &iface_name, port_t port_num,
+                      const PortExtras &port_extras) {
+    const auto &mode = port_extras.at(DevMgrIface::kPortExtraAfXdp);
+    if (mode != "skb" && mode != "drv" && mode != "zc") {
+      Logger::get()->error("Invalid AF_XDP mode '{}' for port {}, expected "
+                           "'skb', 'drv' or 'zc'", mode, port_num);
+      return ReturnCode::ERROR;
+    }
+    uint32_t queue_id = 0;
+    auto it_queue = port_extras.find(DevMgrIface::kPortExtraAfXdpQueue);
+    if (it_queue != port_extras.end()) {
+      char *end;
+      auto v = std::strtoul(it_queue->second.c_str(), &end, 0);
+      if (it_queue->second.empty() || *end != '\0' || v > 0xffff) {
+        Logger::get()->error("Invalid AF_XDP queue '{}' for port {}",
+                             it_queue->second, port_num);
+        return ReturnCode::ERROR;
+      }
+      queue_id = static_cast<uint32_t>(v);
+    }
+
+    {
+      Lock lock(mutex);
+      if (ports.find(port_num) != ports.end()) return ReturnCode::ERROR;
+    }
+
+    std::shared_ptr<XskPort> port(
+        new XskPort(port_num, iface_name, mode, queue_id), XskPortUnref());
+    std::string what;
+    int error = port->open(&what);
+    if (error) {
+      Logger::get()->error("Cannot open AF_XDP socket on interface {}, {} "
+                           "failed: {}", iface_name, what,
+                           std::strerror(error));
+      return ReturnCode::ERROR;
+    }
+    Logger::get()->info("Port {} uses AF_XDP socket on interface {} (queue {}, "
+                        "mode {})", port_num, iface_name, queue_id, mode);
+
+    {
+      Lock lock(mutex);
+      ports.emplace(port_num, std::move(port));
+      nb_ports = ports.size();
+      ports_changed = true;
+    }
+    wake();
+    return ReturnCode::SUCCESS;
+  }
+
+  bool port_remove(port_t port_num) {
+    std::shared_ptr<XskPort> port;
+    {
+      Lock lock(mutex);
+      auto it = ports.find(port_num);
+      if (it == ports.end()) return false;
+      port = std::move(it->second);
+      ports.erase(it);
+      nb_ports = ports.size();
+      ports_changed = true;
+    }
+    // stop the redirection of packets to the socket right away, the socket
+    // itself is closed once the receive thread and the switch release their
+    // references
+    port->detach();
+    wake();
+    return true;
+  }
+
+  std::shared_ptr<XskPort> get_port(port_t port_num) const {
+    // fast path for the ports which do not use AF_XDP
+    if (nb_ports.load(std::memory_order_relaxed) == 0) return nullptr;
+    Lock lock(mutex);
+    auto it = ports.find(port_num);
+    return (it == ports.end()) ? nullptr : it->second;
+  }
+
+  void transmit(XskPort *port, const char *buffer, int len) {
+    if (port->send(buffer, len)) {
+      if (!flush_requested.exchange(true)) wake();
+    }
+  }
+
+  void transmit_buffer(XskPort *port, PacketBuffer *buffer, int len) {
+    if (port->send_buffer(buffer, len)) {
+      if (!flush_requested.exchange(true)) wake();
+    }
+  }
+
+  void flush() {
+    if (nb_ports.load(std::memory_order_relaxed) == 0) return;
+    Lock lock(mutex);
+    for (auto &p : ports) p.second->flush();
+  }
+
+  void start() {
+    if (started) return;
+    started = true;
+    receive_thread = std::thread(&Imp::receive_loop, this);
+  }
+
+  PacketHandler packet_handler{};
+  void *packet_handler_cookie{nullptr};
+  PacketBufferHandler packet_buffer_handler{};
+  void *packet_buffer_handler_cookie{nullptr};
+
+ private:
+  using Mutex = std::mutex;
+  using Lock = std::lock_guard<std::mutex>;
+
+  void wake() {
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+      Logger::get()->error("Cannot wake AF_XDP receive thread");
+  }
+
+  void receive_loop();
+
+  std::map<port_t, std::shared_ptr<XskPort> > ports{};
+  std::atomic<size_t> nb_ports{0};
+  mutable Mutex mutex{};
+  bool ports_changed{false};
+  int wake_fd{-1};
+  std::atomic<bool> flush_requested{false};
+  std::atomic<bool> stop_receive_thread{false};
+  bool started{false};
+  std::thread receive_thread{};
+};
+
+void
+AfXdpPortMgr::Imp::receive_loop() {
+  ThreadAffinity::apply("port_rx");
+  // the first entry is always the eventfd used to wake up the thread
+  std::vector<struct pollfd> pfds;
+  std::vector<std::shared_ptr<XskPort> > my_ports;
+  bool busy = false;
+  bool update = true;
+  while (!stop_receive_thread) {
+    if (update) {
+      Lock lock(mutex);
+      my_ports.clear();
+      pfds.assign(1, {wake_fd, POLLIN, 0});
+      for (const auto &p : ports) {
+        my_ports.push_back(p.second);
+        pfds.push_back({p.second->get_fd(), POLLIN, 0});
+      }
+      ports_changed = false;
+    }
+
+    // when the switch holds frames, we wake up regularly to give them back to
+    // the kernel even if no packet is received
+    if (!busy) {
+      int rc = poll(pfds.data(), pfds.size(), 10);
+      if (rc < 0 && errno != EINTR) {
+        Logger::get()->error("Error in AF_XDP receive thread: {}",
+                             std::strerror(errno));
+      }
+    }
+    if (busy || (pfds[0].revents & POLLIN)) {
+      uint64_t v;
+      while (read(wake_fd, &v, sizeof(v)) > 0) { }
+      Lock lock(mutex);
+      update = ports_changed;
+    }
+
+    if (flush_requested.exchange(false)) {
+      for (auto &port : my_ports) port->flush();
+    }
+
+    busy = false;
+    for (auto &port : my_ports) {
+      if (port->receive(packet_handler, packet_handler_cookie,
+                        packet_buffer_handler, packet_buffer_handler_cookie))
+        busy = true;
+    }
+  }
+}
+
+AfXdpPortMgr::AfXdpPortMgr()
+    : pimp(new Imp()) { }
+
+AfXdpPortMgr::~AfXdpPortMgr() = default;
+
+PacketDispatcherIface::ReturnCode
+AfXdpPortMgr::port_add(const std::string &iface_name, port_t port_num,
+                       const PortExtras &port_extras) {
+  return pimp->port_add(iface_name, port_num, port_extras);
+}
+
+bool
+AfXdpPortMgr::port_remove(port_t port_num) {
+  return pimp->port_remove(port_num);
+}
+
+bool
+AfXdpPortMgr::transmit(port_t port_num, const char *buffer, int len) {
+  auto port = pimp->get_port(port_num);
+  if (!port) return false;
+  pimp->transmit(port.get(), buffer, len);
+  return true;
+}
+
+bool
+AfXdpPortMgr::transmit_buffer(port_t port_num, PacketBuffer *buffer, int len) {
+  auto port = pimp->get_port(port_num);
+  if (!port) return false;
+  pimp->transmit_buffer(port.get(), buffer, len);
+  return true;
+}
+
+void
+AfXdpPortMgr::flush() {
+  pimp->flush();
+}
+
+bool
+AfXdpPortMgr::port_is_up(port_t port_num, bool *is_up) const {
+  auto port = pimp->get_port(port_num);
+  if (!port) return false;
+  *is_up = port->is_up();
+  return true;
+}
+
+bool
+AfXdpPortMgr::get_port_stats(port_t port_num, PortStats *stats) const {
+  auto port = pimp->get_port(port_num);
+  if (!port) return false;
+  *stats = port->get_stats();
+  return true;
+}
+
+bool
+AfXdpPortMgr::clear_port_stats(port_t port_num, PortStats *stats) {
+  auto port = pimp->get_port(port_num);
+  if (!port) return false;
+  *stats = port->clear_stats();
+  return true;
+}
+
+void
+AfXdpPortMgr::set_packet_handler(const PacketHandler &handler, void *cookie) {
+  pimp->packet_handler = handler;
+  pimp->packet_handler_cookie = cookie;
+}
+
+void
+AfXdpPortMgr::set_packet_buffer_handler(const PacketBufferHandler &handler,
+                                        void *cookie) {
+  pimp->packet_buffer_handler = handler;
+  pimp->packet_buffer_handler_cookie = cookie;
+}
+
+void
+AfXdpPortMgr::start() {
+  pimp->start();
+}
+
+}  // namespace bm
+
+#else  // __linux__
+
+namespace bm {
+
+class AfXdpPortMgr::Imp { };
+
+AfXdpPortMgr::AfXdpPortMgr() = default;
+
+AfXdpPortMgr::~AfXdpPortMgr() = default;
+
+PacketDispatcherIface::ReturnCode
+AfXdpPortMgr::port_add(const std::string &iface_name, port_t port_num,
+                       const PortExtras &port_extras) {
+  (void) iface_name;
+  (void) port_extras;
+  Logger::get()->error("Cannot add port {}: AF_XDP is only supported on Linux",
+                       port_num);
+  return ReturnCode::ERROR;
+}
+
+bool
+AfXdpPortMgr::port_remove(port_t port_num) {
+  (void) port_num;
+  return false;
+}
+
+bool
+AfXdpPortMgr::transmit(port_t port_num, const char *buffer, int len) {
+  (void) port_num;
+  (void) buffer;
+  (void) len;
+  return false;
+}
+
+bool
+AfXdpPortMgr::transmit_buffer(port_t port_num, PacketBuffer *buffer, int len) {
+  (void) port_num;
+  (void) buffer;
+  (void) len;
+  return false;
+}
+
+void
+AfXdpPortMgr::flush() { }
+
+bool
+AfXdpPortMgr::port_is_up(port_t port_num, bool *is_up) const {
+  (void) port_num;
+  (void) is_up;
+  return false;
+}
+
+bool
+AfXdpPortMgr::get_port_stats(port_t port_num, PortStats *stats) const {
+  (void) port_num;
+  (void) stats;
+  return false;
+}
+
+bool
+AfXdpPortMgr::clear_port_stats(port_t port_num, PortStats *stats) {
+  (void) port_num;
+  (void) stats;
+  return false;
+}
+
+void
+AfXdpPortMgr::set_packet_handler(const PacketHandler &handler, void *cookie) {
+  (void) handler;
+  (void) cookie;
+}
+
+void
+AfXdpPortMgr::set_packet_buffer_handler(const PacketBufferHandler &handler,
+                                        void *cookie) {
+  (void) handler;
+  (void) cookie;
+}
+
+void
+AfXdpPortMgr::start() { }
+
+}  // namespace bm
+
+#endif  // __linux__
+
+namespace bm {
+
+bool
+AfXdpPortMgr::is_requested(const PortExtras &port_extras) {
+  return port_extras.find(DevMgrIface::kPortExtraAfXdp) != port_extras.end();
+}
+
+}  // namespace bm
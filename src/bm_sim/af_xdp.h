@@ -0,0 +1,96 @@
+/* Copyright 2013-present Barefoot Networks, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Antonin Bas (antonin@barefootnetworks.com)
+ *
+ */
+
+#ifndef BM_SIM_AF_XDP_H_
+#define BM_SIM_AF_XDP_H_
+
+#include <bm/bm_sim/dev_mgr.h>
+
+#include <memory>
+#include <string>
+
+namespace bm {
+
+// Manages the ports which use AF_XDP sockets instead of the default I/O
+// mechanism of a port manager. A port is selected for AF_XDP by the
+// DevMgrIface::kPortExtraAfXdp port extra, whose value is the XDP mode:
+//   - "skb": generic XDP, works with any interface (including veth) and is
+//     meant for testing
+//   - "drv": native XDP, data is copied between the NIC buffers and the UMEM
+//   - "zc": native XDP with zero-copy, the NIC writes directly to the UMEM
+// Each port gets its own UMEM, shared by its fill, completion, RX and TX rings,
+// as well as a minimal XDP program redirecting all packets from the chosen NIC
+// queue to the socket. When the switch supports it (see
+// PacketDispatcherIface::set_packet_buffer_handler), received packets are
+// handed over in their UMEM frame, without a copy; the frame goes back to the
+// fill ring when the switch is done with the packet.
+// Only supported on Linux; elsewhere port_add always fails.
+class AfXdpPortMgr {
+ public:
+  using port_t = DevMgrIface::port_t;
+  using PortExtras = DevMgrIface::PortExtras;
+  using PortStats = DevMgrIface::PortStats;
+  using ReturnCode = PacketDispatcherIface::ReturnCode;
+  using PacketHandler = PacketDispatcherIface::PacketHandler;
+  using PacketBufferHandler = PacketDispatcherIface::PacketBufferHandler;
+
+  AfXdpPortMgr();
+  ~AfXdpPortMgr();
+
+  // returns true if the port extras select AF_XDP for the port
+  static bool is_requested(const PortExtras &port_extras);
+
+  ReturnCode port_add(const std::string &iface_name, port_t port_num,
+                      const PortExtras &port_extras);
+
+  // the following methods return false if the port is not an AF_XDP port, in
+  // which case the caller should handle it
+  bool port_remove(port_t port_num);
+  bool transmit(port_t port_num, const char *buffer, int len);
+  // takes ownership of the buffer if the port is an AF_XDP port; if the buffer
+  // is a frame received on the same port, it is transmitted without a copy
+  bool transmit_buffer(port_t port_num, PacketBuffer *buffer, int len);
+  bool port_is_up(port_t port_num, bool *is_up) const;
+  bool get_port_stats(port_t port_num, PortStats *stats) const;
+  bool clear_port_stats(port_t port_num, PortStats *stats);
+
+  // transmitted packets are normally handed over to the kernel by the receive
+  // thread, in batches; this does it right away for all the ports, from the
+  // calling thread (e.g. at the end of a burst of packets)
+  void flush();
+
+  void set_packet_handler(const PacketHandler &handler, void *cookie);
+  void set_packet_buffer_handler(const PacketBufferHandler &handler,
+                                 void *cookie);
+
+  // starts the thread receiving packets from the AF_XDP sockets
+  void start();
+
+  AfXdpPortMgr(const AfXdpPortMgr &other) = delete;
+  AfXdpPortMgr &operator=(const AfXdpPortMgr &other) = delete;
+
+ private:
+  class Imp;
+  std::unique_ptr<Imp> pimp;
+};
+
+}  // namespace bm
+
+#endif  // BM_SIM_AF_XDP_H_
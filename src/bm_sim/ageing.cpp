@@ -22,6 +22,7 @@
 #include <bm/bm_sim/match_tables.h>
 #include <bm/bm_sim/packet.h>
 #include <bm/bm_sim/logger.h>
+#include <bm/bm_sim/thread_affinity.h>
 
 #include <string>
 #include <thread>
@@ -136,6 +137,7 @@ AgeingMonitor::reset_state() {
 
 void
 AgeingMonitor::sweep_loop() {
+  ThreadAffinity::apply("ageing");
   using std::chrono::milliseconds;
   auto tp = clock::now();
   std::unique_lock<std::mutex> lock(mutex);
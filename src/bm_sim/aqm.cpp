@@ -0,0 +1,314 @@
+/* Copyright 2013-present Barefoot Networks, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Antonin Bas (antonin@barefootnetworks.com)
+ *
+ */
+
+#include <bm/bm_sim/aqm.h>
+
+#include <cmath>
+
+namespace bm {
+
+using AQMErrorCode = QueueAQM::AQMErrorCode;
+using Verdict = QueueAQM::Verdict;
+
+constexpr unsigned int QueueAQM::default_red_weight_shift;
+constexpr unsigned int QueueAQM::avg_frac_bits;
+
+namespace {
+
+// constants from RFC 8033
+constexpr double pie_alpha = 0.125;
+constexpr double pie_beta = 1.25;
+constexpr double pie_mark_ecn_th = 0.1;
+constexpr uint64_t pie_max_qdelay_us = 250000;
+
+}  // namespace
+
+QueueAQM::QueueAQM()
+    : rng_state(0x9E3779B97F4A7C15ull ^ reinterpret_cast<uintptr_t>(this)) {
+  if (rng_state == 0) rng_state = 1;
+}
+
+void
+QueueAQM::disable() {
+  std::unique_lock<std::mutex> lock(mutex);
+  mode = Mode::NONE;
+}
+
+AQMErrorCode
+QueueAQM::set_red(const RedConfig &config) {
+  if (config.max_th == 0 || config.min_th >= config.max_th)
+    return INVALID_THRESHOLDS;
+  if (!(config.max_p > 0.0 && config.max_p <= 1.0))
+    return INVALID_PROBABILITY;
+  if (config.weight_shift == 0 || config.weight_shift >= avg_frac_bits)
+    return INVALID_WEIGHT;
+  std::unique_lock<std::mutex> lock(mutex);
+  red = RedState();
+  red.config = config;
+  red.count = -1;
+  mode = Mode::RED;
+  return SUCCESS;
+}
+
+AQMErrorCode
+QueueAQM::set_codel(const CodelConfig &config) {
+  if (config.target_us == 0 || config.interval_us == 0)
+    return INVALID_TIME_VALUE;
+  std::unique_lock<std::mutex> lock(mutex);
+  codel = CodelState();
+  codel.config = config;
+  mode = Mode::CODEL;
+  return SUCCESS;
+}
+
+AQMErrorCode
+QueueAQM::set_pie(const PieConfig &config) {
+  if (config.target_us == 0 || config.t_update_us == 0)
+    return INVALID_TIME_VALUE;
+  std::unique_lock<std::mutex> lock(mutex);
+  pie = PieState();
+  pie.config = config;
+  pie.burst_allowance = config.max_burst_us;
+  mode = Mode::PIE;
+  return SUCCESS;
+}
+
+QueueAQM::Mode
+QueueAQM::get_mode() const {
+  return mode.load();
+}
+
+Verdict
+QueueAQM::on_enqueue(size_t qdepth, uint64_t now_us, bool ecn_capable) {
+  if (mode.load() == Mode::NONE) return Verdict::PASS;
+  std::unique_lock<std::mutex> lock(mutex);
+  switch (mode.load()) {
+    case Mode::RED:
+      return red_enqueue(qdepth, ecn_capable);
+    case Mode::PIE:
+      return pie_enqueue(qdepth, now_us, ecn_capable);
+    default:
+      return Verdict::PASS;
+  }
+}
+
+Verdict
+QueueAQM::on_dequeue(uint64_t sojourn_us, size_t qdepth, uint64_t now_us,
+                     bool ecn_capable) {
+  if (mode.load() == Mode::NONE) return Verdict::PASS;
+  std::unique_lock<std::mutex> lock(mutex);
+  switch (mode.load()) {
+    case Mode::CODEL:
+      return codel_dequeue(sojourn_us, qdepth, now_us, ecn_capable);
+    case Mode::PIE:
+      // PIE uses the sojourn time of the last dequeued packet as its estimate
+      // of the current queueing delay
+      pie.qdelay = sojourn_us;
+      return Verdict::PASS;
+    default:
+      return Verdict::PASS;
+  }
+}
+
+QueueAQM::Counters
+QueueAQM::get_counters() const {
+  std::unique_lock<std::mutex> lock(mutex);
+  return counters;
+}
+
+void
+QueueAQM::reset_counters() {
+  std::unique_lock<std::mutex> lock(mutex);
+  counters = Counters();
+}
+
+Verdict
+QueueAQM::congestion(bool ecn, bool ecn_capable) {
+  if (ecn && ecn_capable) {
+    counters.marks++;
+    return Verdict::MARK;
+  }
+  return drop();
+}
+
+Verdict
+QueueAQM::drop() {
+  counters.drops++;
+  return Verdict::DROP;
+}
+
+double
+QueueAQM::random_uniform() {
+  // xorshift64*
+  rng_state ^= rng_state >> 12;
+  rng_state ^= rng_state << 25;
+  rng_state ^= rng_state >> 27;
+  uint64_t v = rng_state * 0x2545F4914F6CDD1Dull;
+  return (v >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// See "Random Early Detection Gateways for Congestion Avoidance" (Floyd &
+// Jacobson, 1993). The average is computed with integer arithmetic, the
+// probability with a floating point division, so the cost is constant.
+Verdict
+QueueAQM::red_enqueue(size_t qdepth, bool ecn_capable) {
+  const auto &config = red.config;
+  const uint64_t q = static_cast<uint64_t>(qdepth) << avg_frac_bits;
+  if (q >= red.avg)
+    red.avg += (q - red.avg) >> config.weight_shift;
+  else
+    red.avg -= (red.avg - q) >> config.weight_shift;
+
+  const uint64_t min_th = static_cast<uint64_t>(config.min_th) << avg_frac_bits;
+  const uint64_t max_th = static_cast<uint64_t>(config.max_th) << avg_frac_bits;
+  if (red.avg < min_th) {
+    red.count = -1;
+    return Verdict::PASS;
+  }
+  if (red.avg >= max_th) {
+    red.count = 0;
+    return drop();
+  }
+  red.count++;
+  double p_b = config.max_p * static_cast<double>(red.avg - min_th) /
+      static_cast<double>(max_th - min_th);
+  double p_a = (red.count * p_b >= 1.0) ? 1.0 : p_b / (1.0 - red.count * p_b);
+  if (random_uniform() < p_a) {
+    red.count = 0;
+    return congestion(config.ecn, ecn_capable);
+  }
+  return Verdict::PASS;
+}
+
+uint64_t
+QueueAQM::codel_control_law(uint64_t t) const {
+  return t + static_cast<uint64_t>(
+      codel.config.interval_us / std::sqrt(static_cast<double>(codel.count)));
+}
+
+// Follows the pseudo-code from RFC 8289, with one difference: the RFC drops as
+// many packets as required by the control law in a single dequeue, while we
+// make a decision for a single packet. The queue is considered to be nearly
+// empty when it holds no packet (instead of less than one MTU).
+Verdict
+QueueAQM::codel_dequeue(uint64_t sojourn_us, size_t qdepth, uint64_t now_us,
+                        bool ecn_capable) {
+  const auto &config = codel.config;
+  bool ok_to_drop = false;
+  if (sojourn_us < config.target_us || qdepth == 0) {
+    codel.first_above_time = 0;
+  } else if (codel.first_above_time == 0) {
+    codel.first_above_time = now_us + config.interval_us;
+  } else if (now_us >= codel.first_above_time) {
+    ok_to_drop = true;
+  }
+
+  if (codel.dropping) {
+    if (!ok_to_drop) {
+      codel.dropping = false;
+      return Verdict::PASS;
+    }
+    if (now_us >= codel.drop_next) {
+      codel.count++;
+      codel.drop_next = codel_control_law(codel.drop_next);
+      return congestion(config.ecn, ecn_capable);
+    }
+    return Verdict::PASS;
+  }
+
+  if (ok_to_drop) {
+    codel.dropping = true;
+    // if we were in the dropping state recently, start from the previous drop
+    // rate instead of starting over
+    uint32_t delta = codel.count - codel.lastcount;
+    codel.count = (delta > 1 &&
+                   now_us < codel.drop_next + 16 * config.interval_us) ?
+        delta : 1;
+    codel.drop_next = codel_control_law(now_us);
+    codel.lastcount = codel.count;
+    return congestion(config.ecn, ecn_capable);
+  }
+  return Verdict::PASS;
+}
+
+// RFC 8033, section 4.2; the probability is updated lazily on enqueue instead
+// of from a timer
+void
+QueueAQM::pie_update_prob() {
+  const auto &config = pie.config;
+  const double target = config.target_us * 1e-6;
+  const double qdelay = pie.qdelay * 1e-6;
+  const double qdelay_old = pie.qdelay_old * 1e-6;
+  double p = pie_alpha * (qdelay - target) + pie_beta * (qdelay - qdelay_old);
+  if (pie.drop_prob < 0.000001)
+    p /= 2048;
+  else if (pie.drop_prob < 0.00001)
+    p /= 512;
+  else if (pie.drop_prob < 0.0001)
+    p /= 128;
+  else if (pie.drop_prob < 0.001)
+    p /= 32;
+  else if (pie.drop_prob < 0.01)
+    p /= 8;
+  else if (pie.drop_prob < 0.1)
+    p /= 2;
+  else if (p > 0.02)
+    p = 0.02;
+  pie.drop_prob += p;
+  if (pie.qdelay > pie_max_qdelay_us) pie.drop_prob += 0.02;
+  if (pie.qdelay == 0 && pie.qdelay_old == 0) pie.drop_prob *= 0.98;
+  if (pie.drop_prob < 0.0) pie.drop_prob = 0.0;
+  if (pie.drop_prob > 1.0) pie.drop_prob = 1.0;
+
+  pie.burst_allowance = (pie.burst_allowance > config.t_update_us) ?
+      pie.burst_allowance - config.t_update_us : 0;
+  if (pie.drop_prob == 0.0 && 2 * pie.qdelay < config.target_us &&
+      2 * pie.qdelay_old < config.target_us) {
+    pie.burst_allowance = config.max_burst_us;
+  }
+  pie.qdelay_old = pie.qdelay;
+}
+
+Verdict
+QueueAQM::pie_enqueue(size_t qdepth, uint64_t now_us, bool ecn_capable) {
+  const auto &config = pie.config;
+  if (qdepth == 0) pie.qdelay = 0;
+  if (now_us >= pie.last_update + config.t_update_us) {
+    pie_update_prob();
+    pie.last_update = now_us;
+  }
+
+  if (pie.burst_allowance > 0) return Verdict::PASS;
+  if (2 * pie.qdelay_old < config.target_us && pie.drop_prob < 0.2)
+    return Verdict::PASS;
+  if (qdepth <= 2) return Verdict::PASS;
+
+  // de-randomization (RFC 8033, section 5.1)
+  if (pie.drop_prob == 0.0) pie.accu_prob = 0.0;
+  pie.accu_prob += pie.drop_prob;
+  if (pie.accu_prob < 0.85) return Verdict::PASS;
+  if (pie.accu_prob < 8.5 && random_uniform() >= pie.drop_prob)
+    return Verdict::PASS;
+  pie.accu_prob = 0.0;
+  return congestion(config.ecn && pie.drop_prob <= pie_mark_ecn_th,
+                    ecn_capable);
+}
+
+}  // namespace bm
@@ -37,6 +37,10 @@ Conditional::operator()(Packet *pkt) const {
   PHV *phv = pkt->get_phv();
   bool result = eval(*phv);
   BMELOG(condition_eval, *pkt, *this, result);
+  if (ProfilingCounters::is_enabled()) {
+    profiling_counters.add(PROF_EVALUATIONS, 1);
+    if (result) profiling_counters.add(PROF_TRUE, 1);
+  }
 
   // It would be nicer to see the following additional info in the log:
   //
@@ -56,4 +60,19 @@ Conditional::operator()(Packet *pkt) const {
   return result ? true_next : false_next;
 }
 
+ProfilingStats::Conditional
+Conditional::get_profiling_stats() const {
+  auto values = profiling_counters.get();
+  ProfilingStats::Conditional stats;
+  stats.name = get_name();
+  stats.evaluations = values[PROF_EVALUATIONS];
+  stats.true_count = values[PROF_TRUE];
+  return stats;
+}
+
+void
+Conditional::reset_profiling_stats() {
+  profiling_counters.reset();
+}
+
 }  // namespace bm
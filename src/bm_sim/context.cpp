@@ -19,6 +19,8 @@
  */
 
 #include <bm/bm_sim/context.h>
+#include <bm/bm_sim/logger.h>
+#include <bm/bm_sim/phv_source.h>
 
 #include <iostream>
 #include <string>
@@ -27,9 +29,97 @@
 
 namespace bm {
 
+P4ObjectsReaper::~P4ObjectsReaper() {
+  stop();
+}
+
+void
+P4ObjectsReaper::retire(std::shared_ptr<P4Objects> old_objects,
+                        std::shared_ptr<P4Objects> new_objects) {
+  std::unique_lock<std::mutex> lock(mutex);
+  if (stopped) {
+    lock.unlock();
+    release(std::move(old_objects), std::move(new_objects));
+    return;
+  }
+  if (!thread.joinable()) thread = std::thread(&P4ObjectsReaper::loop, this);
+  queue.emplace_back(std::move(old_objects), std::move(new_objects));
+  lock.unlock();
+  cv.notify_one();
+}
+
+void
+P4ObjectsReaper::stop() {
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    stopped = true;
+  }
+  cv.notify_one();
+  if (thread.joinable()) thread.join();
+}
+
+void
+P4ObjectsReaper::release(std::shared_ptr<P4Objects> old_objects,
+                         std::shared_ptr<P4Objects> new_objects) {
+  // no-op if the state was not migrated
+  if (new_objects) new_objects->migrate_packet_state(*old_objects);
+  // new_objects may be the last reference to a configuration which was itself
+  // swapped out, in which case it is queued now that it is up-to-date
+}
+
+void
+P4ObjectsReaper::loop() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    cv.wait(lock, [this] { return stopped || !queue.empty(); });
+    if (queue.empty()) return;
+    Retired retired = std::move(queue.front());
+    queue.pop_front();
+    lock.unlock();
+    release(std::move(retired.first), std::move(retired.second));
+    lock.lock();
+  }
+}
+
+namespace {
+
+// deleter of the shared pointers to P4Objects held by the packets, see
+// Context::make_packet_objects()
+struct RetireP4Objects {
+  std::shared_ptr<P4Objects> objects;
+  // set by Context::do_swap(); it is a packet pointer as well, which means
+  // that these objects are retired before the new ones
+  std::shared_ptr<P4Objects> new_objects;
+  std::shared_ptr<P4ObjectsReaper> reaper;
+
+  void operator()(P4Objects *) {
+    if (reaper)
+      reaper->retire(std::move(objects), std::move(new_objects));
+    else
+      P4ObjectsReaper::release(std::move(objects), std::move(new_objects));
+  }
+};
+
+}  // namespace
+
 Context::Context() {
   p4objects = std::make_shared<P4Objects>(std::cout, true);
   p4objects_rt = p4objects;
+  packet_objects = make_packet_objects(p4objects);
+}
+
+std::shared_ptr<P4Objects>
+Context::make_packet_objects(std::shared_ptr<P4Objects> objects) const {
+  P4Objects *ptr = objects.get();
+  return std::shared_ptr<P4Objects>(
+      ptr, RetireP4Objects{std::move(objects), nullptr, reaper});
+}
+
+void
+Context::set_reaper(std::shared_ptr<P4ObjectsReaper> reaper) {
+  this->reaper = std::move(reaper);
+  // called before any packet is created
+  packet_objects = make_packet_objects(p4objects);
 }
 
 // ---------- runtime interfaces ----------
@@ -123,6 +213,62 @@ Context::mt_modify_entry(const std::string &table_name,
   return table->modify_entry(handle, action, std::move(action_data));
 }
 
+MatchErrorCode
+Context::mt_write_entries(std::vector<MtWriteOp> *ops, bool atomic) {
+  boost::shared_lock<boost::shared_mutex> lock(request_mutex);
+  // name resolution errors are handled here, before any table is locked
+  std::vector<MatchTable::WriteOp> table_ops;
+  std::vector<size_t> indices;
+  table_ops.reserve(ops->size());
+  indices.reserve(ops->size());
+  MatchErrorCode rc = MatchErrorCode::SUCCESS;
+  for (size_t i = 0; i < ops->size(); i++) {
+    auto &op = (*ops)[i];
+    op.status = MatchErrorCode::SUCCESS;
+    auto abstract_table = p4objects_rt->get_abstract_match_table_rt(
+        op.table_name);
+    auto table = dynamic_cast<MatchTable *>(abstract_table);
+    const ActionFn *action = nullptr;
+    if (!abstract_table)
+      op.status = MatchErrorCode::INVALID_TABLE_NAME;
+    else if (!table)
+      op.status = MatchErrorCode::WRONG_TABLE_TYPE;
+    else if (op.type != MtWriteOp::Type::DELETE &&
+             !(action = p4objects_rt->get_action_rt(op.table_name,
+                                                    op.action_name)))
+      op.status = MatchErrorCode::INVALID_ACTION_NAME;
+    if (op.status != MatchErrorCode::SUCCESS) {
+      if (rc == MatchErrorCode::SUCCESS) rc = op.status;
+      continue;
+    }
+    table_ops.push_back({op.type, table, std::move(op.match_key), action,
+                         std::move(op.action_data), op.priority, op.handle,
+                         MatchErrorCode::SUCCESS});
+    indices.push_back(i);
+  }
+
+  if (atomic && rc != MatchErrorCode::SUCCESS) {
+    for (auto &op : *ops) {
+      if (op.status == MatchErrorCode::SUCCESS)
+        op.status = MatchErrorCode::BATCH_ABORTED;
+    }
+    return rc;
+  }
+
+  MatchTable::write_entries(&table_ops, atomic);
+  for (size_t i = 0; i < table_ops.size(); i++) {
+    auto &op = (*ops)[indices[i]];
+    op.handle = table_ops[i].handle;
+    op.status = table_ops[i].status;
+  }
+  for (const auto &op : *ops) {
+    if (op.status != MatchErrorCode::SUCCESS &&
+        op.status != MatchErrorCode::BATCH_ABORTED)
+      return op.status;
+  }
+  return MatchErrorCode::SUCCESS;
+}
+
 MatchErrorCode
 Context::mt_set_entry_ttl(const std::string &table_name,
                           entry_handle_t handle,
@@ -381,6 +527,19 @@ Context::mt_reset_counters(const std::string &table_name) {
   return abstract_table->reset_counters();
 }
 
+MatchErrorCode
+Context::mt_read_all_counters(
+    const std::string &table_name,
+    std::vector<entry_handle_t> *handles,
+    std::vector<MatchTableAbstract::counter_value_t> *bytes,
+    std::vector<MatchTableAbstract::counter_value_t> *packets,
+    bool reset) {
+  boost::shared_lock<boost::shared_mutex> lock(request_mutex);
+  auto abstract_table = p4objects_rt->get_abstract_match_table_rt(table_name);
+  if (!abstract_table) return MatchErrorCode::INVALID_TABLE_NAME;
+  return abstract_table->query_all_counters(handles, bytes, packets, reset);
+}
+
 MatchErrorCode
 Context::mt_write_counters(const std::string &table_name,
                            entry_handle_t handle,
@@ -440,6 +599,35 @@ Context::mt_get_entries<MatchTableIndirect>(const std::string &) const;
 template std::vector<MatchTableIndirectWS::Entry>
 Context::mt_get_entries<MatchTableIndirectWS>(const std::string &) const;
 
+template <typename T>
+MatchErrorCode
+Context::mt_get_entries(const std::string &table_name, size_t *cursor,
+                        size_t max_entries,
+                        std::vector<typename T::Entry> *entries,
+                        bool *more) const {
+  boost::shared_lock<boost::shared_mutex> lock(request_mutex);
+  auto abstract_table = p4objects_rt->get_abstract_match_table_rt(table_name);
+  if (!abstract_table) return MatchErrorCode::INVALID_TABLE_NAME;
+  auto table = dynamic_cast<T *>(abstract_table);
+  if (!table) return MatchErrorCode::WRONG_TABLE_TYPE;
+  *more = table->get_entries(cursor, max_entries, entries);
+  return MatchErrorCode::SUCCESS;
+}
+
+// explicit instantiation
+template MatchErrorCode
+Context::mt_get_entries<MatchTable>(
+    const std::string &, size_t *, size_t, std::vector<MatchTable::Entry> *,
+    bool *) const;
+template MatchErrorCode
+Context::mt_get_entries<MatchTableIndirect>(
+    const std::string &, size_t *, size_t,
+    std::vector<MatchTableIndirect::Entry> *, bool *) const;
+template MatchErrorCode
+Context::mt_get_entries<MatchTableIndirectWS>(
+    const std::string &, size_t *, size_t,
+    std::vector<MatchTableIndirectWS::Entry> *, bool *) const;
+
 template <typename T>
 MatchErrorCode
 Context::mt_get_entry(const std::string &table_name,
@@ -535,6 +723,33 @@ Context::reset_counters(const std::string &counter_name) {
   return counter_array->reset_counters();
 }
 
+Counter::CounterErrorCode
+Context::read_counters_range(
+    const std::string &counter_name, size_t start, size_t end,
+    std::vector<MatchTableAbstract::counter_value_t> *bytes,
+    std::vector<MatchTableAbstract::counter_value_t> *packets,
+    bool reset) {
+  boost::shared_lock<boost::shared_mutex> lock(request_mutex);
+  CounterArray *counter_array = p4objects_rt->get_counter_array_rt(
+      counter_name);
+  if (!counter_array) return Counter::INVALID_COUNTER_NAME;
+  return counter_array->read_counters(start, end, bytes, packets, reset);
+}
+
+Counter::CounterErrorCode
+Context::read_all_counters(
+    const std::string &counter_name,
+    std::vector<MatchTableAbstract::counter_value_t> *bytes,
+    std::vector<MatchTableAbstract::counter_value_t> *packets,
+    bool reset) {
+  boost::shared_lock<boost::shared_mutex> lock(request_mutex);
+  CounterArray *counter_array = p4objects_rt->get_counter_array_rt(
+      counter_name);
+  if (!counter_array) return Counter::INVALID_COUNTER_NAME;
+  return counter_array->read_counters(
+      0, counter_array->size(), bytes, packets, reset);
+}
+
 Counter::CounterErrorCode
 Context::write_counters(const std::string &counter_name, size_t idx,
                         MatchTableAbstract::counter_value_t bytes,
@@ -580,6 +795,20 @@ Context::meter_get_rates(
   return Meter::SUCCESS;
 }
 
+Context::MeterErrorCode
+Context::meter_array_get_rates(
+    const std::string &meter_name,
+    std::vector<std::vector<Meter::rate_config_t> > *configs) {
+  boost::shared_lock<boost::shared_mutex> lock(request_mutex);
+  MeterArray *meter_array = p4objects_rt->get_meter_array_rt(meter_name);
+  if (!meter_array) return Meter::INVALID_METER_NAME;
+  configs->clear();
+  configs->reserve(meter_array->size());
+  for (size_t idx = 0; idx < meter_array->size(); idx++)
+    configs->push_back(meter_array->get_meter(idx).get_rates());
+  return Meter::SUCCESS;
+}
+
 Context::RegisterErrorCode
 Context::register_read(const std::string &register_name,
                        const size_t idx, Data *value) {
@@ -694,12 +923,12 @@ template CustomCrcErrorCode Context::set_crc_custom_parameters<uint32_t>(
 
 LearnEngineIface *
 Context::get_learn_engine() {
-  return p4objects->get_learn_engine();
+  return current_objects()->get_learn_engine();
 }
 
 AgeingMonitorIface *
 Context::get_ageing_monitor() {
-  return p4objects->get_ageing_monitor();
+  return current_objects()->get_ageing_monitor();
 }
 
 PHVFactory &
@@ -736,31 +965,49 @@ Context::set_force_arith(bool v) {
 }
 
 int
-Context::init_objects(std::istream *is,
+Context::init_objects(const Json::Value &cfg_root,
                       LookupStructureFactory *lookup_factory,
                       const std::set<header_field_pair> &required_fields,
                       const ForceArith &arith_objects) {
   // initally p4objects_rt == p4objects, so this works
-  int status = p4objects_rt->init_objects(is, lookup_factory, device_id, cxt_id,
-                                          notifications_transport,
+  int status = p4objects_rt->init_objects(cfg_root, lookup_factory, device_id,
+                                          cxt_id, notifications_transport,
                                           required_fields, arith_objects);
   if (status) return status;
   if (force_arith)
-    get_phv_factory().enable_all_arith();
+    p4objects_rt->get_phv_factory().enable_all_arith();
   return 0;
 }
 
 Context::ErrorCode
 Context::load_new_config(
-    std::istream *is,
+    const Json::Value &cfg_root,
     LookupStructureFactory *lookup_factory,
     const std::set<header_field_pair> &required_fields,
-    const ForceArith &arith_objects) {
+    const ForceArith &arith_objects,
+    bool migrate_state) {
   boost::unique_lock<boost::shared_mutex> lock(request_mutex);
   // check that there is no ongoing config swap
   if (p4objects != p4objects_rt) return ErrorCode::ONGOING_SWAP;
   p4objects_rt = std::make_shared<P4Objects>(std::cout, true);
-  init_objects(is, lookup_factory, required_fields, arith_objects);
+  if (init_objects(cfg_root, lookup_factory, required_fields, arith_objects)) {
+    p4objects_rt = p4objects;
+    return ErrorCode::INVALID_CONFIG;
+  }
+  // done here and not when swapping, so that it does not delay traffic; the
+  // control plane cannot modify the old objects any more, only the packets
+  // can, and their updates are carried over once the last of them is gone (see
+  // P4ObjectsReaper)
+  if (migrate_state) {
+    auto stats = p4objects_rt->migrate_state(*p4objects);
+    Logger::get()->info(
+        "Context {}: migrated {} entries ({} skipped) in {} tables, "
+        "{} action profiles, {} counter arrays, {} register arrays and "
+        "{} meter arrays to the new config",
+        cxt_id, stats.entries, stats.skipped_entries, stats.tables,
+        stats.action_profiles, stats.counter_arrays, stats.register_arrays,
+        stats.meter_arrays);
+  }
   return ErrorCode::SUCCESS;
 }
 
@@ -780,6 +1027,18 @@ Context::reset_state() {
   return ErrorCode::SUCCESS;
 }
 
+ProfilingStats
+Context::get_profiling_stats() const {
+  boost::shared_lock<boost::shared_mutex> lock(request_mutex);
+  return p4objects_rt->get_profiling_stats();
+}
+
+void
+Context::reset_profiling_stats() {
+  boost::shared_lock<boost::shared_mutex> lock(request_mutex);
+  p4objects_rt->reset_profiling_stats();
+}
+
 Context::ErrorCode
 Context::serialize(std::ostream *out) {
   boost::unique_lock<boost::shared_mutex> lock(request_mutex);
@@ -799,11 +1058,42 @@ Context::deserialize(std::istream *in) {
   return ErrorCode::SUCCESS;
 }
 
+Context::ErrorCode
+Context::serialize(SnapshotWriter *out, size_t chunk_size) {
+  if (chunk_size == 0) {
+    boost::unique_lock<boost::shared_mutex> lock(request_mutex);
+    p4objects_rt->serialize(out, 0);
+  } else {
+    // prevents config swaps, but not table updates
+    boost::shared_lock<boost::shared_mutex> lock(request_mutex);
+    p4objects_rt->serialize(out, chunk_size);
+  }
+  return ErrorCode::SUCCESS;
+}
+
+Context::ErrorCode
+Context::deserialize(SnapshotReader *in) {
+  boost::unique_lock<boost::shared_mutex> lock(request_mutex);
+  if (!p4objects_rt->deserialize(in)) return ErrorCode::INVALID_SNAPSHOT;
+  return ErrorCode::SUCCESS;
+}
+
 int
-Context::do_swap() {
+Context::do_swap(PHVSourceIface *phv_source) {
   if (!swap_ordered) return 1;
   boost::unique_lock<boost::shared_mutex> lock(request_mutex);
+  if (!swap_ordered) return 1;
+  // until the new objects are published, the new packets replace the PHV they
+  // get from the pool with one of the old objects, see Packet::Packet()
+  phv_source->set_phv_factory(cxt_id, &p4objects_rt->get_phv_factory());
+  auto new_packet_objects = make_packet_objects(p4objects_rt);
+  std::get_deleter<RetireP4Objects>(packet_objects)->new_objects =
+      new_packet_objects;
+  // from now on, only packet_objects owns the old objects
   p4objects = p4objects_rt;
+  // the old objects are retired when the last packet using them is destroyed,
+  // possibly right now
+  std::atomic_store(&packet_objects, std::move(new_packet_objects));
   swap_ordered = false;
   return 0;
 }
@@ -21,6 +21,7 @@
 #include <bm/bm_sim/counters.h>
 
 #include <iostream>
+#include <vector>
 
 namespace bm {
 
@@ -38,6 +39,14 @@ Counter::reset_counter() {
   return SUCCESS;
 }
 
+Counter::CounterErrorCode
+Counter::query_and_reset_counter(counter_value_t *bytes,
+                                 counter_value_t *packets) {
+  *bytes = this->bytes.exchange(0u);
+  *packets = this->packets.exchange(0u);
+  return SUCCESS;
+}
+
 Counter::CounterErrorCode
 Counter::write_counter(counter_value_t bytes, counter_value_t packets) {
   this->bytes = bytes;
@@ -45,6 +54,13 @@ Counter::write_counter(counter_value_t bytes, counter_value_t packets) {
   return SUCCESS;
 }
 
+Counter::CounterErrorCode
+Counter::add_counter(counter_value_t bytes, counter_value_t packets) {
+  this->bytes += bytes;
+  this->packets += packets;
+  return SUCCESS;
+}
+
 void
 Counter::serialize(std::ostream *out) const {
   (*out) << bytes << " " << packets << "\n";
@@ -65,4 +81,24 @@ CounterArray::reset_counters() {
   return Counter::SUCCESS;
 }
 
+Counter::CounterErrorCode
+CounterArray::read_counters(size_t start, size_t end,
+                            std::vector<Counter::counter_value_t> *bytes,
+                            std::vector<Counter::counter_value_t> *packets,
+                            bool reset) {
+  if (start > end || end > size()) return Counter::INVALID_INDEX;
+  bytes->resize(end - start);
+  packets->resize(end - start);
+  for (size_t idx = start; idx < end; idx++) {
+    auto &c = counters[idx];
+    auto *b = &(*bytes)[idx - start];
+    auto *p = &(*packets)[idx - start];
+    if (reset)
+      c.query_and_reset_counter(b, p);
+    else
+      c.query_counter(b, p);
+  }
+  return Counter::SUCCESS;
+}
+
 }  // namespace bm
@@ -21,9 +21,12 @@
 #include <bm/bm_sim/dev_mgr.h>
 #include <bm/bm_sim/logger.h>
 #include <bm/bm_sim/pcap_file.h>
+#include <bm/bm_sim/pcap_replay.h>
 
 #include <cassert>
 #include <algorithm>  // std::min
+#include <chrono>
+#include <condition_variable>
 #include <thread>
 #include <mutex>
 #include <string>
@@ -38,18 +41,40 @@ namespace bm {
 
 constexpr char DevMgrIface::kPortExtraInPcap[];
 constexpr char DevMgrIface::kPortExtraOutPcap[];
+constexpr char DevMgrIface::kPortExtraPcapRotateSize[];
+constexpr char DevMgrIface::kPortExtraPcapRotateInterval[];
+constexpr char DevMgrIface::kPortExtraAfXdp[];
+constexpr char DevMgrIface::kPortExtraAfXdpQueue[];
+constexpr char DevMgrIface::kPortExtraTrafficGen[];
+constexpr char DevMgrIface::kPortExtraTrafficGenFlows[];
+constexpr char DevMgrIface::kPortExtraTrafficGenSize[];
+constexpr char DevMgrIface::kPortExtraTrafficGenRandomize[];
+constexpr char DevMgrIface::kPortExtraTrafficGenCount[];
+constexpr char DevMgrIface::kPortExtraTrafficSink[];
 
 ////////////////////////////////////////////////////////////////////////////////
 
-// Implementation which uses Pcap files to read/write packets
+// Implementation which uses Pcap files to read/write packets; the input files
+// are replayed by a PcapReplay instance
 class FilesDevMgrImp : public DevMgrIface {
  public:
-  FilesDevMgrImp(bool respectTiming, unsigned wait_time_in_seconds)
-      : reader(respectTiming, wait_time_in_seconds) {
+  FilesDevMgrImp(const PcapReplay::Config &replay_config,
+                 unsigned wait_time_in_seconds)
+      : replay(replay_config), wait_time_in_seconds(wait_time_in_seconds) {
     p_monitor = PortMonitorIface::make_dummy();
   }
 
  private:
+  ~FilesDevMgrImp() override {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    stop_cv.notify_all();
+    replay.stop();
+    if (replay_thread.joinable()) replay_thread.join();
+  }
+
   ReturnCode port_add_(const std::string &iface_name, port_t port_num,
                        const PortExtras &port_extras) override {
     UNUSED(iface_name);
@@ -59,7 +84,8 @@ class FilesDevMgrImp : public DevMgrIface {
       Logger::get()->critical("Missing pcap file when adding port");
       return ReturnCode::ERROR;
     }
-    reader.addFile(port_num, it_in_pcap->second);
+    if (!replay.add_file(port_num, it_in_pcap->second))
+      return ReturnCode::ERROR;
     writer.addFile(port_num, it_out_pcap->second);
 
     PortInfo p_info(port_num, iface_name, port_extras);
@@ -81,14 +107,22 @@ class FilesDevMgrImp : public DevMgrIface {
   }
 
   void start_() override {
-    reader_thread = std::thread(&PcapFilesReader::start, &reader);
-    reader_thread.detach();
+    replay_thread = std::thread([this]() {
+      // give the switch some time to initialize
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (stop_cv.wait_for(lock, std::chrono::seconds(wait_time_in_seconds),
+                             [this]() { return stopping; })) {
+          return;
+        }
+      }
+      replay.run();
+    });
   }
 
   ReturnCode set_packet_handler_(const PacketHandler &handler, void *cookie)
       override {
-    reader.set_packet_handler(handler, cookie);
-    return ReturnCode::SUCCESS;
+    return replay.set_packet_handler(handler, cookie);
   }
 
   bool port_is_up_(port_t port) const override {
@@ -105,9 +139,12 @@ class FilesDevMgrImp : public DevMgrIface {
   using Mutex = std::mutex;
   using Lock = std::lock_guard<std::mutex>;
 
-  PcapFilesReader reader;
+  PcapReplay replay;
   PcapFilesWriter writer;
-  std::thread reader_thread;
+  unsigned wait_time_in_seconds;
+  std::thread replay_thread;
+  std::condition_variable stop_cv;
+  bool stopping{false};
   mutable Mutex mutex;
   std::map<port_t, DevMgrIface::PortInfo> port_info;
 };
@@ -141,11 +178,40 @@ DevMgrIface::start() {
   start_();
 }
 
+void
+DevMgrIface::transmit_buffer_(port_t port_num, PacketBuffer &&buffer,
+                              int len) {  // default implementation
+  transmit_fn_(port_num, buffer.start(), len);
+}
+
+void
+DevMgrIface::transmit_burst_(TxPacket *packets,
+                             size_t count) {  // default implementation
+  for (size_t i = 0; i < count; i++) {
+    auto &p = packets[i];
+    transmit_buffer_(p.port_num, std::move(p.buffer), p.len);
+  }
+}
+
 PacketDispatcherIface::ReturnCode
 DevMgrIface::set_packet_handler(const PacketHandler &handler, void *cookie) {
   return set_packet_handler_(handler, cookie);
 }
 
+PacketDispatcherIface::ReturnCode
+DevMgrIface::set_packet_buffer_handler(const PacketBufferHandler &handler,
+                                       void *cookie) {
+  return set_packet_buffer_handler_(handler, cookie);
+}
+
+PacketDispatcherIface::ReturnCode
+DevMgrIface::set_packet_buffer_handler_(const PacketBufferHandler &handler,
+                                        void *cookie) {  // default
+  UNUSED(handler);
+  UNUSED(cookie);
+  return ReturnCode::UNSUPPORTED;
+}
+
 bool
 DevMgrIface::port_is_up(port_t port_num) const {
   return port_is_up_(port_num);
@@ -199,10 +265,11 @@ DevMgr::set_dev_mgr(std::unique_ptr<DevMgrIface> my_pimp) {
 }
 
 void
-DevMgr::set_dev_mgr_files(unsigned wait_time_in_seconds) {
+DevMgr::set_dev_mgr_files(unsigned wait_time_in_seconds,
+                          const PcapReplay::Config &replay_config) {
   assert(!pimp);
   pimp = std::unique_ptr<DevMgrIface>(new FilesDevMgrImp(
-      false /* no real-time packet replay */, wait_time_in_seconds));
+      replay_config, wait_time_in_seconds));
 }
 
 void
@@ -232,6 +299,20 @@ DevMgr::transmit_fn(port_t port_num, const char *buffer, int len) {
   pimp->transmit_fn(port_num, buffer, len);
 }
 
+void
+DevMgr::transmit_burst(DevMgrIface::TxPacket *packets, size_t count) {
+  assert(pimp);
+  if (dump_packet_data > 0) {
+    for (size_t i = 0; i < count; i++) {
+      const auto &p = packets[i];
+      Logger::get()->info("Sending packet of length {} on port {}: {}",
+                          p.len, p.port_num,
+                          sample_packet_data(p.buffer.start(), p.len));
+    }
+  }
+  pimp->transmit_burst(packets, count);
+}
+
 PacketDispatcherIface::ReturnCode
 DevMgr::port_remove(port_t port_num) {
   assert(pimp);
@@ -248,6 +329,13 @@ DevMgr::set_packet_handler(const PacketHandler &handler, void *cookie) {
   return pimp->set_packet_handler(handler, cookie);
 }
 
+PacketDispatcherIface::ReturnCode
+DevMgr::set_packet_buffer_handler(const PacketBufferHandler &handler,
+                                  void *cookie) {
+  assert(pimp);
+  return pimp->set_packet_buffer_handler(handler, cookie);
+}
+
 PacketDispatcherIface::ReturnCode
 DevMgr::register_status_cb(const PortStatus &type,
                            const PortStatusCb &port_cb) {
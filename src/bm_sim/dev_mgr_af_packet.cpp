@@ -0,0 +1,652 @@
+/* Copyright 2013-present Barefoot Networks, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Antonin Bas (antonin@barefootnetworks.com)
+ *
+ */
+
+#include <bm/bm_sim/dev_mgr.h>
+#include <bm/bm_sim/logger.h>
+#include <bm/bm_sim/thread_affinity.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+
+#include <arpa/inet.h>
+#include <linux/if_packet.h>
+#include <net/ethernet.h>
+#include <net/if.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "pcap_capture.h"
+
+namespace bm {
+
+// Implementation which uses Linux AF_PACKET sockets with memory-mapped
+// TPACKET_V3 rings (PACKET_MMAP) to send / receive packets. Compared to the
+// BMI (libpcap) implementation:
+//   - received packets are read directly from the RX ring, which the kernel
+//     fills one block at a time; a block is returned to the kernel once all
+//     its packets have been processed
+//   - packets are transmitted by copying them into the TX ring, the kernel is
+//     only notified (with sendto) once per batch of frames
+// I am putting this in its own cpp file to keep the Linux-specific code in one
+// place.
+
+namespace {
+
+// RX ring: kRxBlockNr blocks of kRxBlockSize bytes per port. A block is
+// retired by the kernel when it is full or after kRxBlockTimeoutMs.
+constexpr unsigned int kRxBlockSize = 1u << 18;
+constexpr unsigned int kRxBlockNr = 16u;
+constexpr unsigned int kRxFrameSize = 1u << 11;
+constexpr unsigned int kRxBlockTimeoutMs = 1u;
+// maximum number of RX blocks processed for a port before moving on to the
+// next port
+constexpr unsigned int kRxBlocksPerRound = 4u;
+// TX ring: kTxFrameNr frames per port, the frame size depends on the MTU
+constexpr unsigned int kTxFrameNr = 512u;
+constexpr unsigned int kTxMinFrameSize = 1u << 11;
+constexpr unsigned int kTxMinBlockSize = 1u << 16;
+// the kernel is notified when that many frames are pending; otherwise the
+// receive thread notifies it as soon as it gets a chance
+constexpr unsigned int kTxBatchSize = 32u;
+// how long we are willing to wait for a TX frame to become available
+constexpr int kTxWaitMs = 10;
+constexpr int kTxWaitTries = 10;
+
+constexpr size_t kTxDataOffset = TPACKET_ALIGN(sizeof(struct tpacket3_hdr));
+
+unsigned int
+next_pow2(unsigned int v) {
+  unsigned int p = 1;
+  while (p < v) p <<= 1;
+  return p;
+}
+
+template <typename T>
+T
+load_acquire(T *ptr) {
+  return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+
+template <typename T>
+void
+store_release(T *ptr, T v) {
+  __atomic_store_n(ptr, v, __ATOMIC_RELEASE);
+}
+
+class AfPacketPort {
+ public:
+  AfPacketPort(DevMgrIface::port_t port_num, const std::string &iface_name)
+      : port_num(port_num), iface_name(iface_name) { }
+
+  ~AfPacketPort() {
+    if (ring != MAP_FAILED) munmap(ring, ring_size);
+    if (fd >= 0) close(fd);
+  }
+
+  AfPacketPort(const AfPacketPort &other) = delete;
+  AfPacketPort &operator=(const AfPacketPort &other) = delete;
+
+  // returns 0 on success, errno otherwise
+  int open() {
+    fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+    if (fd < 0) return errno;
+
+    int ifindex = if_nametoindex(iface_name.c_str());
+    if (ifindex == 0) return errno;
+
+    int version = TPACKET_V3;
+    if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)))
+      return errno;
+    // malformed frames are skipped instead of blocking the TX ring
+    int loss = 1;
+    if (setsockopt(fd, SOL_PACKET, PACKET_LOSS, &loss, sizeof(loss)))
+      return errno;
+    // best effort, not supported by older kernels
+    int bypass = 1;
+    setsockopt(fd, SOL_PACKET, PACKET_QDISC_BYPASS, &bypass, sizeof(bypass));
+
+    struct tpacket_req3 rx_req;
+    std::memset(&rx_req, 0, sizeof(rx_req));
+    rx_req.tp_block_size = kRxBlockSize;
+    rx_req.tp_block_nr = kRxBlockNr;
+    rx_req.tp_frame_size = kRxFrameSize;
+    rx_req.tp_frame_nr = (kRxBlockSize / kRxFrameSize) * kRxBlockNr;
+    rx_req.tp_retire_blk_tov = kRxBlockTimeoutMs;
+    if (setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &rx_req, sizeof(rx_req)))
+      return errno;
+
+    // a TX frame needs to accommodate the largest frame the interface can send
+    unsigned int mtu = 1500;
+    struct ifreq ifr;
+    std::memset(&ifr, 0, sizeof(ifr));
+    std::strncpy(ifr.ifr_name, iface_name.c_str(), IFNAMSIZ - 1);
+    if (ioctl(fd, SIOCGIFMTU, &ifr) == 0) mtu = ifr.ifr_mtu;
+    tx_frame_size = std::max(
+        kTxMinFrameSize,
+        next_pow2(mtu + ETH_HLEN + 4 /* VLAN */ + kTxDataOffset));
+    unsigned int tx_block_size = std::max(kTxMinBlockSize, tx_frame_size);
+    unsigned int frames_per_block = tx_block_size / tx_frame_size;
+    tx_frame_nr = std::max(kTxFrameNr, frames_per_block);
+
+    struct tpacket_req3 tx_req;
+    std::memset(&tx_req, 0, sizeof(tx_req));
+    tx_req.tp_block_size = tx_block_size;
+    tx_req.tp_block_nr = tx_frame_nr / frames_per_block;
+    tx_req.tp_frame_size = tx_frame_size;
+    tx_req.tp_frame_nr = tx_frame_nr;
+    if (setsockopt(fd, SOL_PACKET, PACKET_TX_RING, &tx_req, sizeof(tx_req)))
+      return errno;
+
+    rx_ring_size = static_cast<size_t>(kRxBlockSize) * kRxBlockNr;
+    ring_size = rx_ring_size +
+        static_cast<size_t>(tx_block_size) * tx_req.tp_block_nr;
+    ring = mmap(nullptr, ring_size, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_LOCKED | MAP_POPULATE, fd, 0);
+    if (ring == MAP_FAILED) {
+      // MAP_LOCKED may fail because of RLIMIT_MEMLOCK
+      ring = mmap(nullptr, ring_size, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, fd, 0);
+    }
+    if (ring == MAP_FAILED) return errno;
+    rx_ring = static_cast<char *>(ring);
+    tx_ring = rx_ring + rx_ring_size;
+
+    struct sockaddr_ll addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = htons(ETH_P_ALL);
+    addr.sll_ifindex = ifindex;
+    if (bind(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)))
+      return errno;
+
+    struct packet_mreq mreq;
+    std::memset(&mreq, 0, sizeof(mreq));
+    mreq.mr_ifindex = ifindex;
+    mreq.mr_type = PACKET_MR_PROMISC;
+    if (setsockopt(fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq, sizeof(mreq)))
+      return errno;
+
+    return 0;
+  }
+
+  // the capture needs to outlive the port
+  void set_capture(PcapCapture *capture) {
+    pcap = capture;
+  }
+
+  // Processes at most kRxBlocksPerRound blocks from the RX ring, returns the
+  // number of blocks processed. Only called by the receive thread.
+  unsigned int receive(const PacketDispatcherIface::PacketHandler &handler,
+                       void *cookie) {
+    unsigned int nb_blocks = 0;
+    for (; nb_blocks < kRxBlocksPerRound; nb_blocks++) {
+      auto *block = reinterpret_cast<struct tpacket_block_desc *>(
+          rx_ring + static_cast<size_t>(rx_block_idx) * kRxBlockSize);
+      auto *bh = &block->hdr.bh1;
+      if (!(load_acquire(&bh->block_status) & TP_STATUS_USER)) break;
+
+      auto *ptr = reinterpret_cast<char *>(block) + bh->offset_to_first_pkt;
+      for (uint32_t i = 0; i < bh->num_pkts; i++) {
+        auto *hdr = reinterpret_cast<struct tpacket3_hdr *>(ptr);
+        auto *sll = reinterpret_cast<struct sockaddr_ll *>(
+            ptr + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+        // we do not process packets sent by other sockets bound to the
+        // interface (our own packets are not looped back by the kernel), and
+        // we ignore truncated packets like the BMI implementation
+        if (sll->sll_pkttype != PACKET_OUTGOING &&
+            hdr->tp_snaplen == hdr->tp_len) {
+          const char *data = ptr + hdr->tp_mac;
+          int len = static_cast<int>(hdr->tp_snaplen);
+          if (pcap) pcap->capture(port_num, PcapCapture::Direction::IN,
+                                  data, len);
+          in_packets.fetch_add(1, std::memory_order_relaxed);
+          in_octets.fetch_add(len, std::memory_order_relaxed);
+          if (handler) handler(port_num, data, len, cookie);
+        }
+        ptr += hdr->tp_next_offset;
+      }
+
+      // all the packets in the block have been consumed (the handler copies
+      // the data), give the whole block back to the kernel
+      store_release(&bh->block_status,
+                    static_cast<uint32_t>(TP_STATUS_KERNEL));
+      rx_block_idx = (rx_block_idx + 1) % kRxBlockNr;
+    }
+    return nb_blocks;
+  }
+
+  // Copies the packet to the next TX frame. Returns true if the caller needs to
+  // make sure that flush() will be called (i.e. the frame is the first one
+  // pending since the last flush).
+  bool send(const char *buffer, int len) {
+    if (len <= 0 ||
+        static_cast<size_t>(len) > tx_frame_size - kTxDataOffset) {
+      Logger::get()->error("Cannot send packet of size {} on port {}",
+                           len, port_num);
+      tx_drops.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+
+    std::unique_lock<std::mutex> lock(tx_mutex);
+    char *frame = tx_ring + static_cast<size_t>(tx_frame_idx) * tx_frame_size;
+    auto *hdr = reinterpret_cast<struct tpacket3_hdr *>(frame);
+    int tries = 0;
+    while (load_acquire(&hdr->tp_status) != TP_STATUS_AVAILABLE) {
+      // the ring is full, let the kernel drain it; the frames may have been
+      // marked as pending by an earlier flush which failed, so we always call
+      // sendto
+      kick_();
+      if (++tries > kTxWaitTries) {
+        tx_drops.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+      struct pollfd pfd = {fd, POLLOUT, 0};
+      poll(&pfd, 1, kTxWaitMs);
+    }
+
+    if (pcap) pcap->capture(port_num, PcapCapture::Direction::OUT, buffer, len);
+    std::memcpy(frame + kTxDataOffset, buffer, len);
+    hdr->tp_len = len;
+    hdr->tp_snaplen = len;
+    hdr->tp_next_offset = 0;
+    store_release(&hdr->tp_status,
+                  static_cast<uint32_t>(TP_STATUS_SEND_REQUEST));
+    tx_frame_idx = (tx_frame_idx + 1) % tx_frame_nr;
+    out_packets.fetch_add(1, std::memory_order_relaxed);
+    out_octets.fetch_add(len, std::memory_order_relaxed);
+
+    if (++tx_pending >= kTxBatchSize) return !flush_();
+    return tx_pending == 1;
+  }
+
+  // Returns false if some frames could not be handed to the kernel yet (its
+  // queue is full), in which case flush() needs to be called again later.
+  bool flush() {
+    std::unique_lock<std::mutex> lock(tx_mutex);
+    return flush_();
+  }
+
+  bool is_up() const {
+    std::ifstream fs("/sys/class/net/" + iface_name + "/operstate");
+    std::string state;
+    return fs && (fs >> state) && state == "up";
+  }
+
+  int get_fd() const { return fd; }
+
+  DevMgrIface::PortStats get_stats() const {
+    return DevMgrIface::PortStats::make(
+        in_packets.load(), in_octets.load(),
+        out_packets.load(), out_octets.load());
+  }
+
+  DevMgrIface::PortStats clear_stats() {
+    return DevMgrIface::PortStats::make(
+        in_packets.exchange(0), in_octets.exchange(0),
+        out_packets.exchange(0), out_octets.exchange(0));
+  }
+
+ private:
+  bool flush_() {
+    if (tx_pending == 0) return true;
+    return kick_();
+  }
+
+  // non-blocking: the kernel sends all the frames marked with
+  // TP_STATUS_SEND_REQUEST; if it cannot, frames stay in the ring and
+  // tx_pending is left as is so that they are sent with the next flush. Returns
+  // false if the kernel queue is full and a retry is worth it.
+  bool kick_() {
+    if (sendto(fd, nullptr, 0, MSG_DONTWAIT, nullptr, 0) < 0) {
+      if (errno == EAGAIN || errno == ENOBUFS) return false;
+      Logger::get()->error("Error when sending packets on port {}: {}",
+                           port_num, std::strerror(errno));
+      return true;
+    }
+    tx_pending = 0;
+    return true;
+  }
+
+  DevMgrIface::port_t port_num;
+  std::string iface_name;
+  int fd{-1};
+  void *ring{MAP_FAILED};
+  size_t ring_size{0};
+  size_t rx_ring_size{0};
+  char *rx_ring{nullptr};
+  char *tx_ring{nullptr};
+  unsigned int rx_block_idx{0};
+  unsigned int tx_frame_size{0};
+  unsigned int tx_frame_nr{0};
+  unsigned int tx_frame_idx{0};
+  unsigned int tx_pending{0};
+  std::mutex tx_mutex{};
+  PcapCapture *pcap{nullptr};
+  std::atomic<uint64_t> in_packets{0};
+  std::atomic<uint64_t> in_octets{0};
+  std::atomic<uint64_t> out_packets{0};
+  std::atomic<uint64_t> out_octets{0};
+  std::atomic<uint64_t> tx_drops{0};
+};
+
+}  // namespace
+
+class AfPacketDevMgrImp : public DevMgrIface {
+ public:
+  AfPacketDevMgrImp(device_id_t device_id,
+                    std::shared_ptr<TransportIface> notifications_transport) {
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd < 0) {
+      Logger::get()->critical("Could not create eventfd for AF_PACKET port "
+                              "manager");
+      std::exit(1);
+    }
+
+    p_monitor = PortMonitorIface::make_active(device_id,
+                                              notifications_transport);
+  }
+
+ private:
+  using Mutex = std::mutex;
+  using Lock = std::lock_guard<std::mutex>;
+
+  ~AfPacketDevMgrImp() override {
+    // the port monitor calls port_is_up_, it needs to be stopped before the
+    // ports are destroyed
+    p_monitor->stop();
+    if (started) {
+      stop_receive_thread = true;
+      wake();
+      receive_thread.join();
+    }
+    close(wake_fd);
+  }
+
+  ReturnCode port_add_(const std::string &iface_name, port_t port_num,
+                       const PortExtras &port_extras) override {
+    {
+      Lock lock(mutex);
+      if (ports.find(port_num) != ports.end()) return ReturnCode::ERROR;
+    }
+
+    std::shared_ptr<AfPacketPort> port(
+        new AfPacketPort(port_num, iface_name));
+    int error = port->open();
+    if (error) {
+      Logger::get()->error("Cannot open AF_PACKET socket on interface {}: {}",
+                           iface_name, std::strerror(error));
+      return ReturnCode::ERROR;
+    }
+
+    if (PcapCapture::is_requested(port_extras)) {
+      auto *pcap = get_capture();
+      if (!pcap->port_add(port_num, iface_name, port_extras))
+        return ReturnCode::ERROR;
+      port->set_capture(pcap);
+    }
+
+    PortInfo p_info(port_num, iface_name, port_extras);
+
+    {
+      Lock lock(mutex);
+      ports.emplace(port_num, std::move(port));
+      port_info.emplace(port_num, std::move(p_info));
+      ports_changed = true;
+    }
+    wake();
+
+    return ReturnCode::SUCCESS;
+  }
+
+  ReturnCode port_remove_(port_t port_num) override {
+    PcapCapture *pcap;
+    {
+      Lock lock(mutex);
+      if (ports.erase(port_num) == 0) return ReturnCode::ERROR;
+      port_info.erase(port_num);
+      ports_changed = true;
+      pcap = capture.get();
+    }
+    if (pcap) pcap->port_remove(port_num);
+    // the socket is closed once the receive thread releases its reference
+    wake();
+    return ReturnCode::SUCCESS;
+  }
+
+  void transmit_fn_(port_t port_num, const char *buffer, int len) override {
+    std::shared_ptr<AfPacketPort> port;
+    {
+      Lock lock(mutex);
+      auto it = ports.find(port_num);
+      if (it == ports.end()) return;
+      port = it->second;
+    }
+    if (port->send(buffer, len)) {
+      // defer the flush to the receive thread, which gives us a chance to
+      // batch more frames if the target is transmitting a burst
+      if (!flush_requested.exchange(true)) wake();
+    }
+  }
+
+  // the frames are copied to the TX rings (the kernel needs to own the TX ring
+  // memory, so we cannot use the packet buffers directly) and each port is
+  // notified once, at the end of the burst
+  void transmit_burst_(TxPacket *packets, size_t count) override {
+    std::vector<std::shared_ptr<AfPacketPort> > burst_ports;
+    {
+      Lock lock(mutex);
+      for (size_t i = 0; i < count; i++) {
+        auto it = ports.find(packets[i].port_num);
+        burst_ports.push_back(it == ports.end() ? nullptr : it->second);
+      }
+    }
+    for (size_t i = 0; i < count; i++) {
+      if (burst_ports[i])
+        burst_ports[i]->send(packets[i].buffer.start(), packets[i].len);
+    }
+    std::sort(burst_ports.begin(), burst_ports.end());
+    burst_ports.erase(std::unique(burst_ports.begin(), burst_ports.end()),
+                      burst_ports.end());
+    bool retry = false;
+    for (auto &port : burst_ports) {
+      if (port && !port->flush()) retry = true;
+    }
+    // the receive thread keeps flushing until the kernel takes the frames
+    if (retry && !flush_requested.exchange(true)) wake();
+  }
+
+  void start_() override {
+    started = true;
+    receive_thread = std::thread(&AfPacketDevMgrImp::receive_loop, this);
+  }
+
+  ReturnCode set_packet_handler_(const PacketHandler &handler, void *cookie)
+      override {
+    packet_handler = handler;
+    packet_handler_cookie = cookie;
+    return ReturnCode::SUCCESS;
+  }
+
+  bool port_is_up_(port_t port_num) const override {
+    std::shared_ptr<AfPacketPort> port;
+    {
+      Lock lock(mutex);
+      auto it = ports.find(port_num);
+      if (it == ports.end()) return false;
+      port = it->second;
+    }
+    return port->is_up();
+  }
+
+  std::map<port_t, PortInfo> get_port_info_() const override {
+    std::map<port_t, PortInfo> info;
+    {
+      Lock lock(mutex);
+      info = port_info;
+    }
+    for (auto &pi : info) {
+      pi.second.is_up = port_is_up_(pi.first);
+    }
+    return info;
+  }
+
+  PortStats get_port_stats_(port_t port_num) const override {
+    Lock lock(mutex);
+    auto it = ports.find(port_num);
+    if (it == ports.end()) return PortStats::make(0, 0, 0, 0);
+    return it->second->get_stats();
+  }
+
+  PortStats clear_port_stats_(port_t port_num) override {
+    Lock lock(mutex);
+    auto it = ports.find(port_num);
+    if (it == ports.end()) return PortStats::make(0, 0, 0, 0);
+    return it->second->clear_stats();
+  }
+
+  void wake() {
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+      Logger::get()->error("Cannot wake AF_PACKET receive thread");
+  }
+
+  void receive_loop();
+
+  // created with the first captured port and only destroyed with the
+  // AfPacketDevMgrImp instance
+  PcapCapture *get_capture() {
+    Lock lock(mutex);
+    if (!capture) capture.reset(new PcapCapture());
+    return capture.get();
+  }
+
+  // declared first so that it outlives the ports
+  std::unique_ptr<PcapCapture> capture{nullptr};
+  std::map<port_t, std::shared_ptr<AfPacketPort> > ports{};
+  std::map<port_t, PortInfo> port_info{};
+  mutable Mutex mutex{};
+  bool ports_changed{false};
+  PacketHandler packet_handler{};
+  void *packet_handler_cookie{nullptr};
+  int wake_fd{-1};
+  std::atomic<bool> flush_requested{false};
+  std::atomic<bool> stop_receive_thread{false};
+  bool started{false};
+  std::thread receive_thread{};
+};
+
+void
+AfPacketDevMgrImp::receive_loop() {
+  ThreadAffinity::apply("port_rx");
+  // the first entry is always the eventfd used to wake up the thread
+  std::vector<struct pollfd> pfds;
+  std::vector<std::shared_ptr<AfPacketPort> > my_ports;
+  bool busy = false;
+  bool update = true;
+  // some TX frames could not be handed to the kernel in the last flush
+  bool tx_retry = false;
+  while (!stop_receive_thread) {
+    if (update) {
+      Lock lock(mutex);
+      my_ports.clear();
+      pfds.assign(1, {wake_fd, POLLIN, 0});
+      for (const auto &p : ports) {
+        my_ports.push_back(p.second);
+        pfds.push_back({p.second->get_fd(), POLLIN, 0});
+      }
+      ports_changed = false;
+    }
+
+    // when there is still work to do, we skip the system call and go back to
+    // processing the rings immediately
+    if (!busy) {
+      int rc = poll(pfds.data(), pfds.size(), tx_retry ? kTxWaitMs : -1);
+      if (rc < 0 && errno != EINTR) {
+        Logger::get()->error("Error in AF_PACKET receive thread: {}",
+                             std::strerror(errno));
+      }
+    }
+    if (busy || (pfds[0].revents & POLLIN)) {
+      uint64_t v;
+      while (read(wake_fd, &v, sizeof(v)) > 0) { }
+      Lock lock(mutex);
+      update = ports_changed;
+    }
+
+    if (flush_requested.exchange(false) || tx_retry) {
+      tx_retry = false;
+      for (auto &port : my_ports) {
+        if (!port->flush()) tx_retry = true;
+      }
+    }
+
+    busy = false;
+    for (auto &port : my_ports) {
+      if (port->receive(packet_handler, packet_handler_cookie) > 0)
+        busy = true;
+    }
+  }
+}
+
+void
+DevMgr::set_dev_mgr_af_packet(
+    device_id_t device_id,
+    std::shared_ptr<TransportIface> notifications_transport) {
+  assert(!pimp);
+  pimp = std::unique_ptr<DevMgrIface>(
+      new AfPacketDevMgrImp(device_id, notifications_transport));
+}
+
+}  // namespace bm
+
+#else  // __linux__
+
+namespace bm {
+
+void
+DevMgr::set_dev_mgr_af_packet(
+    device_id_t device_id,
+    std::shared_ptr<TransportIface> notifications_transport) {
+  (void) device_id;
+  (void) notifications_transport;
+  Logger::get()->critical("AF_PACKET port manager is only supported on Linux");
+  std::exit(1);
+}
+
+}  // namespace bm
+
+#endif  // __linux__
@@ -20,12 +20,20 @@
 
 #include <bm/bm_sim/dev_mgr.h>
 #include <bm/bm_sim/logger.h>
+#include <bm/bm_sim/thread_affinity.h>
 
+#include <atomic>
 #include <cassert>
 #include <cstdlib>
 #include <mutex>
 #include <map>
+#include <memory>
 #include <string>
+#include <utility>
+
+#include "af_xdp.h"
+#include "pcap_capture.h"
+#include "traffic_gen.h"
 
 extern "C" {
 #include "BMI/bmi_port.h"
@@ -41,14 +49,28 @@ namespace bm {
 // I am putting this in its own cpp file to avoid having to link with the BMI
 // library in other DevMgr tests
 
+// Ports for which the kPortExtraAfXdp port extra is provided use an AF_XDP
+// socket instead of libpcap, see AfXdpPortMgr
+
+// Ports for which the kPortExtraTrafficGen or kPortExtraTrafficSink port extra
+// is provided are virtual ports which generate / absorb packets in-process,
+// see TrafficGenPortMgr
+
+// Packets are captured to the pcap files given in the port extras by a
+// PcapCapture instance, not by the BMI library, which writes and flushes each
+// packet from the datapath threads
+
 class BmiDevMgrImp : public DevMgrIface {
  public:
   BmiDevMgrImp(device_id_t device_id,
-               std::shared_ptr<TransportIface> notifications_transport) {
-    if (bmi_port_create_mgr(&port_mgr)) {
+               std::shared_ptr<TransportIface> notifications_transport,
+               int nb_rx_threads) {
+    if (bmi_port_create_mgr(&port_mgr, nb_rx_threads)) {
       Logger::get()->critical("Could not initialize BMI port manager");
       std::exit(1);
     }
+    bmi_set_thread_start_fn(port_mgr, &BmiDevMgrImp::bmi_thread_start,
+                            nullptr);
 
     p_monitor = PortMonitorIface::make_active(device_id,
                                               notifications_transport);
@@ -56,20 +78,38 @@ class BmiDevMgrImp : public DevMgrIface {
 
  private:
   ~BmiDevMgrImp() override {
+    // the port monitor calls port_is_up_, which may use xdp_mgr
+    p_monitor->stop();
     bmi_port_destroy_mgr(port_mgr);
+    // the AF_XDP receive thread may be capturing packets, it needs to be
+    // stopped before capture_owner is destroyed, same for the traffic
+    // generator thread
+    xdp_mgr_owner.reset();
+    gen_mgr_owner.reset();
   }
 
   ReturnCode port_add_(const std::string &iface_name, port_t port_num,
                        const PortExtras &port_extras) override {
-    auto it_in_pcap = port_extras.find(kPortExtraInPcap);
-    auto it_out_pcap = port_extras.find(kPortExtraOutPcap);
-    const char *in_pcap = (it_in_pcap == port_extras.end()) ?
-        NULL : it_in_pcap->second.c_str();
-    const char *out_pcap = (it_out_pcap == port_extras.end()) ?
-        NULL : it_out_pcap->second.c_str();
-    if (bmi_port_interface_add(port_mgr, iface_name.c_str(), port_num, in_pcap,
-                               out_pcap))
-      return ReturnCode::ERROR;
+    // the capture is set up first so that the first packets are not missed
+    PcapCapture *pcap = nullptr;
+    if (PcapCapture::is_requested(port_extras)) {
+      pcap = get_capture();
+      if (!pcap->port_add(port_num, iface_name, port_extras))
+        return ReturnCode::ERROR;
+    }
+
+    auto rc = ReturnCode::SUCCESS;
+    if (TrafficGenPortMgr::is_requested(port_extras))
+      rc = get_gen_mgr()->port_add(iface_name, port_num, port_extras);
+    else if (AfXdpPortMgr::is_requested(port_extras))
+      rc = get_xdp_mgr()->port_add(iface_name, port_num, port_extras);
+    else if (bmi_port_interface_add(port_mgr, iface_name.c_str(), port_num,
+                                    NULL, NULL))
+      rc = ReturnCode::ERROR;
+    if (rc != ReturnCode::SUCCESS) {
+      if (pcap) pcap->port_remove(port_num);
+      return rc;
+    }
 
     PortInfo p_info(port_num, iface_name, port_extras);
 
@@ -80,9 +120,16 @@ class BmiDevMgrImp : public DevMgrIface {
   }
 
   ReturnCode port_remove_(port_t port_num) override {
-    if (bmi_port_interface_remove(port_mgr, port_num))
+    auto *gen = gen_mgr.load();
+    auto *xdp = xdp_mgr.load();
+    if (!(gen && gen->port_remove(port_num)) &&
+        !(xdp && xdp->port_remove(port_num)) &&
+        bmi_port_interface_remove(port_mgr, port_num))
       return ReturnCode::ERROR;
 
+    auto *pcap = capture.load();
+    if (pcap) pcap->port_remove(port_num);
+
     Lock lock(mutex);
     port_info.erase(port_num);
 
@@ -90,30 +137,84 @@ class BmiDevMgrImp : public DevMgrIface {
   }
 
   void transmit_fn_(port_t port_num, const char *buffer, int len) override {
+    capture_out(port_num, buffer, len);
+    auto *gen = gen_mgr.load();
+    if (gen && gen->transmit(port_num, buffer, len)) return;
+    auto *xdp = xdp_mgr.load();
+    if (xdp && xdp->transmit(port_num, buffer, len)) return;
     bmi_port_send(port_mgr, port_num, buffer, len);
   }
 
+  void transmit_buffer_(port_t port_num, PacketBuffer &&buffer,
+                        int len) override {
+    capture_out(port_num, buffer.start(), len);
+    auto *gen = gen_mgr.load();
+    if (gen && gen->transmit(port_num, buffer.start(), len)) return;
+    auto *xdp = xdp_mgr.load();
+    if (xdp && xdp->transmit_buffer(port_num, &buffer, len)) return;
+    bmi_port_send(port_mgr, port_num, buffer.start(), len);
+  }
+
+  void transmit_burst_(TxPacket *packets, size_t count) override {
+    auto *gen = gen_mgr.load();
+    auto *xdp = xdp_mgr.load();
+    for (size_t i = 0; i < count; i++) {
+      auto &p = packets[i];
+      capture_out(p.port_num, p.buffer.start(), p.len);
+      if (gen && gen->transmit(p.port_num, p.buffer.start(), p.len)) continue;
+      if (xdp && xdp->transmit_buffer(p.port_num, &p.buffer, p.len)) continue;
+      bmi_port_send(port_mgr, p.port_num, p.buffer.start(), p.len);
+    }
+    // the AF_XDP sockets are notified once for the whole burst
+    if (xdp) xdp->flush();
+  }
+
   void start_() override {
     assert(port_mgr);
     if (bmi_start_mgr(port_mgr))
       Logger::get()->critical("Could not start BMI port manager");
+    Lock lock(mutex);
+    started = true;
+    if (xdp_mgr_owner) xdp_mgr_owner->start();
+    if (gen_mgr_owner) gen_mgr_owner->start();
   }
 
   ReturnCode set_packet_handler_(const PacketHandler &handler, void *cookie)
       override {
-    using function_t = void(int, const char *, int, void *);
     function_t * const*ptr_fun = handler.target<function_t *>();
     assert(ptr_fun);
     assert(*ptr_fun);
-    if (bmi_set_packet_handler(port_mgr, *ptr_fun, cookie)) {
+    // received packets go through bmi_receive, which captures them
+    bmi_handler = *ptr_fun;
+    bmi_handler_cookie = cookie;
+    if (bmi_set_packet_handler(port_mgr, &BmiDevMgrImp::bmi_receive, this)) {
       Logger::get()->critical("Could not set BMI packet handler");
       return ReturnCode::ERROR;
     }
+    Lock lock(mutex);
+    packet_handler = handler;
+    packet_handler_cookie = cookie;
+    if (xdp_mgr_owner) set_xdp_handlers();
+    if (gen_mgr_owner) set_gen_handler();
+    return ReturnCode::SUCCESS;
+  }
+
+  // only AF_XDP ports can hand over packets without a copy
+  ReturnCode set_packet_buffer_handler_(const PacketBufferHandler &handler,
+                                        void *cookie) override {
+    Lock lock(mutex);
+    packet_buffer_handler = handler;
+    packet_buffer_handler_cookie = cookie;
+    if (xdp_mgr_owner) set_xdp_handlers();
     return ReturnCode::SUCCESS;
   }
 
   bool port_is_up_(port_t port) const override {
     bool is_up = false;
+    auto *gen = gen_mgr.load();
+    if (gen && gen->port_is_up(port, &is_up)) return is_up;
+    auto *xdp = xdp_mgr.load();
+    if (xdp && xdp->port_is_up(port, &is_up)) return is_up;
     assert(port_mgr);
     int rval = bmi_port_interface_is_up(port_mgr, port, &is_up);
     is_up &= !(rval);
@@ -133,6 +234,11 @@ class BmiDevMgrImp : public DevMgrIface {
   }
 
   PortStats get_port_stats_(port_t port) const override {
+    PortStats stats;
+    auto *gen = gen_mgr.load();
+    if (gen && gen->get_port_stats(port, &stats)) return stats;
+    auto *xdp = xdp_mgr.load();
+    if (xdp && xdp->get_port_stats(port, &stats)) return stats;
     bmi_port_stats_t port_stats;
     bmi_port_get_stats(port_mgr, port, &port_stats);
     return {port_stats.in_packets, port_stats.in_octets,
@@ -140,6 +246,11 @@ class BmiDevMgrImp : public DevMgrIface {
   }
 
   PortStats clear_port_stats_(port_t port) override {
+    PortStats stats;
+    auto *gen = gen_mgr.load();
+    if (gen && gen->clear_port_stats(port, &stats)) return stats;
+    auto *xdp = xdp_mgr.load();
+    if (xdp && xdp->clear_port_stats(port, &stats)) return stats;
     bmi_port_stats_t port_stats;
     bmi_port_clear_stats(port_mgr, port, &port_stats);
     return {port_stats.in_packets, port_stats.in_octets,
@@ -149,19 +260,128 @@ class BmiDevMgrImp : public DevMgrIface {
  private:
   using Mutex = std::mutex;
   using Lock = std::lock_guard<std::mutex>;
+  using function_t = void(int, const char *, int, void *);
+
+  static void bmi_thread_start(int thread_idx, void *cookie) {
+    (void) cookie;
+    ThreadAffinity::apply("port_rx", static_cast<size_t>(thread_idx));
+  }
+
+  static void bmi_receive(int port_num, const char *buffer, int len,
+                          void *cookie) {
+    auto *self = static_cast<BmiDevMgrImp *>(cookie);
+    auto *pcap = self->capture.load(std::memory_order_acquire);
+    if (pcap) pcap->capture(port_num, PcapCapture::Direction::IN, buffer, len);
+    self->bmi_handler(port_num, buffer, len, self->bmi_handler_cookie);
+  }
+
+  void capture_out(port_t port_num, const char *buffer, int len) {
+    auto *pcap = capture.load(std::memory_order_acquire);
+    if (pcap) pcap->capture(port_num, PcapCapture::Direction::OUT, buffer, len);
+  }
+
+  // wraps the switch packet handler so that the packets received on AF_XDP or
+  // virtual ports are captured before being passed on to the switch
+  PacketHandler capturing_handler(const PacketHandler &handler) {
+    return [this, handler](int port_num, const char *buffer, int len,
+                           void *cookie) {
+      auto *pcap = capture.load(std::memory_order_acquire);
+      if (pcap)
+        pcap->capture(port_num, PcapCapture::Direction::IN, buffer, len);
+      handler(port_num, buffer, len, cookie);
+    };
+  }
+
+  // must be called with the mutex held
+  void set_xdp_handlers() {
+    if (packet_handler) {
+      xdp_mgr_owner->set_packet_handler(capturing_handler(packet_handler),
+                                        packet_handler_cookie);
+    }
+    if (packet_buffer_handler) {
+      auto handler = packet_buffer_handler;
+      xdp_mgr_owner->set_packet_buffer_handler(
+          [this, handler](int port_num, PacketBuffer &&buffer, void *cookie) {
+            auto *pcap = capture.load(std::memory_order_acquire);
+            if (pcap) {
+              pcap->capture(port_num, PcapCapture::Direction::IN,
+                            buffer.start(), buffer.get_data_size());
+            }
+            handler(port_num, std::move(buffer), cookie);
+          }, packet_buffer_handler_cookie);
+    }
+  }
+
+  // created with the first AF_XDP port and only destroyed with the
+  // BmiDevMgrImp instance, which is why xdp_mgr can be read without the mutex
+  // on the transmit path
+  AfXdpPortMgr *get_xdp_mgr() {
+    Lock lock(mutex);
+    if (!xdp_mgr_owner) {
+      xdp_mgr_owner.reset(new AfXdpPortMgr());
+      set_xdp_handlers();
+      if (started) xdp_mgr_owner->start();
+      xdp_mgr = xdp_mgr_owner.get();
+    }
+    return xdp_mgr;
+  }
+
+  // must be called with the mutex held
+  void set_gen_handler() {
+    if (packet_handler) {
+      gen_mgr_owner->set_packet_handler(capturing_handler(packet_handler),
+                                        packet_handler_cookie);
+    }
+  }
+
+  // created with the first virtual port, like xdp_mgr
+  TrafficGenPortMgr *get_gen_mgr() {
+    Lock lock(mutex);
+    if (!gen_mgr_owner) {
+      gen_mgr_owner.reset(new TrafficGenPortMgr());
+      set_gen_handler();
+      if (started) gen_mgr_owner->start();
+      gen_mgr = gen_mgr_owner.get();
+    }
+    return gen_mgr;
+  }
+
+  // created with the first captured port, like xdp_mgr
+  PcapCapture *get_capture() {
+    Lock lock(mutex);
+    if (!capture_owner) {
+      capture_owner.reset(new PcapCapture());
+      capture = capture_owner.get();
+    }
+    return capture;
+  }
 
   bmi_port_mgr_t *port_mgr{nullptr};
   mutable Mutex mutex;
   std::map<port_t, DevMgrIface::PortInfo> port_info;
+  std::unique_ptr<AfXdpPortMgr> xdp_mgr_owner{nullptr};
+  std::atomic<AfXdpPortMgr *> xdp_mgr{nullptr};
+  std::unique_ptr<TrafficGenPortMgr> gen_mgr_owner{nullptr};
+  std::atomic<TrafficGenPortMgr *> gen_mgr{nullptr};
+  PacketHandler packet_handler{};
+  void *packet_handler_cookie{nullptr};
+  PacketBufferHandler packet_buffer_handler{};
+  void *packet_buffer_handler_cookie{nullptr};
+  function_t *bmi_handler{nullptr};
+  void *bmi_handler_cookie{nullptr};
+  bool started{false};
+  std::unique_ptr<PcapCapture> capture_owner{nullptr};
+  std::atomic<PcapCapture *> capture{nullptr};
 };
 
 void
 DevMgr::set_dev_mgr_bmi(
     device_id_t device_id,
-    std::shared_ptr<TransportIface> notifications_transport) {
+    std::shared_ptr<TransportIface> notifications_transport,
+    int nb_rx_threads) {
   assert(!pimp);
   pimp = std::unique_ptr<DevMgrIface>(
-      new BmiDevMgrImp(device_id, notifications_transport));
+      new BmiDevMgrImp(device_id, notifications_transport, nb_rx_threads));
 }
 
 }  // namespace bm
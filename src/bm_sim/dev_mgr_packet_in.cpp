@@ -18,37 +18,302 @@
  *
  */
 
-#ifdef BMNANOMSG_ON
-
 #include <bm/bm_sim/dev_mgr.h>
 #include <bm/bm_sim/logger.h>
-#include <bm/bm_sim/nn.h>
-
-#include <nanomsg/pair.h>
+#include <bm/bm_sim/shm_packet_ring.h>
+#include <bm/bm_sim/thread_affinity.h>
 
 #include <atomic>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
 #include <thread>
 #include <mutex>
 #include <string>
 #include <map>
 
+#ifdef BMNANOMSG_ON
+#include <bm/bm_sim/nn.h>
+
+#include <nanomsg/pair.h>
+#endif
+
 namespace bm {
 
 // private implementation
 
-// Implementation which uses a nanomsg PAIR socket to receive / send packets
-// TODO(antonin): moved lower-level NN code to separate class ?
+namespace {
+
+// How PacketInDevMgrImp exchanges messages with the other side; messages are
+// made of the 3 integers of the header (see PacketInDevMgrImp::packet_hdr_t)
+// followed by optional data.
+class PacketInTransport {
+ public:
+  using MsgHandler = std::function<void(int type, int port, int more,
+                                        const char *data)>;
+
+  virtual ~PacketInTransport() { }
+
+  virtual void send(int type, int port, int more, const char *data,
+                    int len) = 0;
+
+  // sends one message of the given type for each packet
+  virtual void send_burst(int type, const DevMgrIface::TxPacket *packets,
+                          size_t count) {
+    for (size_t i = 0; i < count; i++) {
+      const auto &p = packets[i];
+      send(type, p.port_num, p.len, p.buffer.start(), p.len);
+    }
+  }
+
+  // waits at most 100ms for messages, and calls the handler for each message
+  // received
+  virtual void receive(const MsgHandler &handler) = 0;
+};
+
+#ifdef BMNANOMSG_ON
+
+// Uses a nanomsg PAIR socket, with one message per packet
+class NnPacketInTransport : public PacketInTransport {
+ public:
+  explicit NnPacketInTransport(const std::string &addr)
+      : s(AF_SP, NN_PAIR) {
+    s.bind(addr.c_str());
+    int rcv_timeout_ms = 100;
+    s.setsockopt(NN_SOL_SOCKET, NN_RCVTIMEO,
+                 &rcv_timeout_ms, sizeof(rcv_timeout_ms));
+  }
+
+  void send(int type, int port, int more, const char *data, int len) override {
+    struct nn_msghdr msghdr;
+    std::memset(&msghdr, 0, sizeof(msghdr));
+    struct nn_iovec iov;
+
+    int hdr[3] = {type, port, more};
+
+    // not sure I can do better than this here
+    void *msg = nn::allocmsg(sizeof(hdr) + len, 0);
+    std::memcpy(msg, hdr, sizeof(hdr));
+    if (len > 0)
+      std::memcpy(static_cast<char *>(msg) + sizeof(hdr), data, len);
+    iov.iov_base = &msg;
+    iov.iov_len = NN_MSG;
+
+    msghdr.msg_iov = &iov;
+    msghdr.msg_iovlen = 1;
+
+    s.sendmsg(&msghdr, 0);
+  }
+
+  void receive(const MsgHandler &handler) override {
+    struct nn_msghdr msghdr;
+    struct nn_iovec iov;
+    void *msg = nullptr;
+    iov.iov_base = &msg;
+    iov.iov_len = NN_MSG;
+    std::memset(&msghdr, 0, sizeof(msghdr));
+    msghdr.msg_iov = &iov;
+    msghdr.msg_iovlen = 1;
+    int rc = s.recvmsg(&msghdr, 0);
+    if (rc < 0) return;
+    assert(msg);
+    int hdr[3];
+    std::memcpy(hdr, msg, sizeof(hdr));
+    handler(hdr[0], hdr[1], hdr[2], static_cast<char *>(msg) + sizeof(hdr));
+    nn::freemsg(msg);
+  }
+
+ private:
+  nn::socket s;
+};
+
+#endif  // BMNANOMSG_ON
+
+#ifdef __linux__
+
+// Uses shared-memory rings (see ShmPacketChannel), set up by the client when
+// it connects to the Unix socket. Only one client is served at a time, a new
+// connection replaces the previous one.
+class ShmPacketInTransport : public PacketInTransport {
+ public:
+  explicit ShmPacketInTransport(const std::string &path)
+      : path(path) {
+    listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    struct sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (listen_fd < 0 || path.size() >= sizeof(addr.sun_path)) {
+      Logger::get()->critical("Cannot create packet-in socket {}", path);
+      std::exit(1);
+    }
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    unlink(path.c_str());
+    if (bind(listen_fd, reinterpret_cast<struct sockaddr *>(&addr),
+             sizeof(addr)) || listen(listen_fd, 1)) {
+      Logger::get()->critical("Cannot bind packet-in socket {}: {}",
+                              path, std::strerror(errno));
+      std::exit(1);
+    }
+  }
+
+  ~ShmPacketInTransport() override {
+    disconnect();
+    close(listen_fd);
+    unlink(path.c_str());
+  }
+
+  // called by the switch threads, serialized with a mutex since the ring only
+  // supports a single producer
+  void send(int type, int port, int more, const char *data, int len) override {
+    std::unique_lock<std::mutex> lock(tx_mutex);
+    auto channel = get_channel();
+    if (!channel) return;
+    if (push(channel, type, port, more, data, len))
+      channel->ring(ShmPacketChannel::kFromSwitch).publish();
+  }
+
+  // the other side is only notified once for the whole burst
+  void send_burst(int type, const DevMgrIface::TxPacket *packets,
+                  size_t count) override {
+    std::unique_lock<std::mutex> lock(tx_mutex);
+    auto channel = get_channel();
+    if (!channel) return;
+    for (size_t i = 0; i < count; i++) {
+      const auto &p = packets[i];
+      if (!push(channel, type, p.port_num, p.len, p.buffer.start(), p.len))
+        break;
+    }
+    channel->ring(ShmPacketChannel::kFromSwitch).publish();
+  }
+
+  // only called by the receive thread
+  void receive(const MsgHandler &handler) override {
+    auto channel = get_channel();
+    if (channel) {
+      auto &ring = channel->ring(ShmPacketChannel::kToSwitch);
+      auto fn = [&handler](const ShmPacketRing::RecordHdr &hdr,
+                           const char *data) {
+        handler(hdr.type, hdr.port, hdr.more, data);
+      };
+      // no need to wait if there was something to do
+      if (ring.consume(fn, kMaxBurst) > 0) return;
+    }
+
+    struct pollfd pfds[3] = {{listen_fd, POLLIN, 0}, {conn_fd, POLLIN, 0},
+                             {-1, POLLIN, 0}};
+    bool armed = false;
+    if (channel) {
+      auto &ring = channel->ring(ShmPacketChannel::kToSwitch);
+      if (!ring.arm_consumer_wait()) return;
+      armed = true;
+      pfds[2].fd = ring.consumer_fd();
+    }
+    poll(pfds, 3, 100);
+    if (armed)
+      channel->ring(ShmPacketChannel::kToSwitch).disarm_consumer_wait();
+
+    if (pfds[1].revents) {
+      // the client never sends anything on the socket after the setup, so
+      // this means it went away
+      Logger::get()->info("Packet-in client disconnected from {}", path);
+      disconnect();
+    }
+    if (pfds[0].revents & POLLIN) accept_client();
+  }
+
+ private:
+  static constexpr size_t kMaxBurst = 256;
+
+  // tx_mutex must be held
+  bool push(const std::shared_ptr<ShmPacketChannel> &channel, int type,
+            int port, int more, const char *data, int len) {
+    auto &ring = channel->ring(ShmPacketChannel::kFromSwitch);
+    // we do not want to drop packets if the client is slow, but we give up if
+    // the client goes away
+    while (!ring.push(type, port, more, data, len, 100)) {
+      if (static_cast<size_t>(len) > ring.max_data_size() ||
+          get_channel() != channel) {
+        Logger::get()->error("Cannot send packet-in message of size {}", len);
+        return false;
+      }
+    }
+    return true;
+  }
+
+  std::shared_ptr<ShmPacketChannel> get_channel() const {
+    std::unique_lock<std::mutex> lock(channel_mutex);
+    return channel;
+  }
+
+  void accept_client() {
+    int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0) return;
+    std::shared_ptr<ShmPacketChannel> new_channel(
+        ShmPacketChannel::receive_from(fd));
+    if (!new_channel) {
+      Logger::get()->error("Invalid packet-in client setup on {}", path);
+      close(fd);
+      return;
+    }
+    disconnect();
+    Logger::get()->info("Packet-in client connected to {}", path);
+    std::unique_lock<std::mutex> lock(channel_mutex);
+    conn_fd = fd;
+    channel = std::move(new_channel);
+  }
+
+  void disconnect() {
+    std::unique_lock<std::mutex> lock(channel_mutex);
+    if (conn_fd >= 0) close(conn_fd);
+    conn_fd = -1;
+    channel.reset();
+  }
+
+  std::string path;
+  int listen_fd{-1};
+  int conn_fd{-1};
+  std::shared_ptr<ShmPacketChannel> channel{nullptr};
+  mutable std::mutex channel_mutex{};
+  std::mutex tx_mutex{};
+};
+
+constexpr size_t ShmPacketInTransport::kMaxBurst;
+
+#endif  // __linux__
+
+std::unique_ptr<PacketInTransport>
+make_transport(const std::string &addr) {
+#ifdef __linux__
+  std::string shm_path;
+  if (ShmPacketChannel::parse_addr(addr, &shm_path)) {
+    return std::unique_ptr<PacketInTransport>(
+        new ShmPacketInTransport(shm_path));
+  }
+#endif
+#ifdef BMNANOMSG_ON
+  return std::unique_ptr<PacketInTransport>(new NnPacketInTransport(addr));
+#else
+  Logger::get()->critical("Packet-in address {} is not supported, only "
+                          "shm://<path> can be used without nanomsg", addr);
+  std::exit(1);
+#endif
+}
+
+}  // namespace
+
+// Implementation which receives / sends packets, as well as port management
+// messages, through an IPC transport: a nanomsg PAIR socket or, if the address
+// is of the form shm://<path>, shared-memory rings
 class PacketInDevMgrImp : public DevMgrIface {
  public:
   explicit PacketInDevMgrImp(
       device_id_t device_id, const std::string &addr,
       std::shared_ptr<TransportIface> notifications_transport,
       bool enforce_ports = false)
-      : addr(addr), s(AF_SP, NN_PAIR), enforce_ports(enforce_ports) {
-    s.bind(addr.c_str());
-    int rcv_timeout_ms = 100;
-    s.setsockopt(NN_SOL_SOCKET, NN_RCVTIMEO,
-                 &rcv_timeout_ms, sizeof(rcv_timeout_ms));
+      : addr(addr), enforce_ports(enforce_ports) {
+    s = make_transport(addr);
 
     p_monitor = PortMonitorIface::make_passive(device_id,
                                                notifications_transport);
@@ -83,6 +348,10 @@ class PacketInDevMgrImp : public DevMgrIface {
 
   void transmit_fn_(port_t port_num, const char *buffer, int len) override;
 
+  void transmit_burst_(TxPacket *packets, size_t count) override {
+    s->send_burst(MSG_TYPE_PACKET_OUT, packets, count);
+  }
+
   void start_() override {
     if (started || stop_receive_thread)
       return;
@@ -182,15 +451,15 @@ class PacketInDevMgrImp : public DevMgrIface {
     int more;
   } __attribute__((packed));
 
-  void handle_msg(void *msg);
-  void handle_info_req_msg(void *msg);
+  void handle_msg(int type, int port, int more, const char *data);
+  void handle_info_req_msg(int port, int more);
 
  private:
   using Mutex = std::mutex;
   using Lock = std::lock_guard<std::mutex>;
 
   std::string addr{};
-  nn::socket s;
+  std::unique_ptr<PacketInTransport> s{nullptr};
   PacketHandler pkt_handler{};
   void *pkt_cookie{nullptr};
   std::thread receive_thread{};
@@ -206,59 +475,33 @@ class PacketInDevMgrImp : public DevMgrIface {
 void
 PacketInDevMgrImp::transmit_fn_(port_t port_num,
                                 const char *buffer, int len) {
-  struct nn_msghdr msghdr;
-  std::memset(&msghdr, 0, sizeof(msghdr));
-  struct nn_iovec iov;
-
-  packet_hdr_t packet_hdr;
-  packet_hdr.type = MSG_TYPE_PACKET_OUT;
-  packet_hdr.port = port_num;
-  packet_hdr.more = len;
-
-  // not sure I can do better than this here
-  void *msg = nn::allocmsg(sizeof(packet_hdr) + len, 0);
-  std::memcpy(msg, &packet_hdr, sizeof(packet_hdr));
-  std::memcpy(static_cast<char *>(msg) + sizeof(packet_hdr), buffer, len);
-  iov.iov_base = &msg;
-  iov.iov_len = NN_MSG;
-
-  msghdr.msg_iov = &iov;
-  msghdr.msg_iovlen = 1;
-
-  s.sendmsg(&msghdr, 0);
+  s->send(MSG_TYPE_PACKET_OUT, port_num, len, buffer, len);
   BMLOG_TRACE("Packet out sent for port {}", port_num);
 }
 
 void
-PacketInDevMgrImp::handle_info_req_msg(void *msg) {
-  struct msg_t : packet_hdr_t {
-    int info_status;
-  } __attribute__((packed));
-  msg_t rep;
-  std::memcpy(&rep, msg, sizeof(packet_hdr_t));
-  rep.type = MSG_TYPE_INFO_REP;
-  rep.info_status = MSG_INFO_STATUS_NOT_SUPPORTED;
-  s.send(&rep, sizeof(rep), 0);
+PacketInDevMgrImp::handle_info_req_msg(int port, int more) {
+  int info_status = MSG_INFO_STATUS_NOT_SUPPORTED;
+  s->send(MSG_TYPE_INFO_REP, port, more,
+          reinterpret_cast<const char *>(&info_status), sizeof(info_status));
 }
 
 void
-PacketInDevMgrImp::handle_msg(void *msg) {
-  packet_hdr_t packet_hdr;
-  std::memcpy(&packet_hdr, msg, sizeof(packet_hdr));
-  switch (packet_hdr.type) {
+PacketInDevMgrImp::handle_msg(int type, int port, int more, const char *data) {
+  switch (type) {
     case MSG_TYPE_PORT_ADD:
-      do_port_add(packet_hdr.port);
+      do_port_add(port);
       break;
     case MSG_TYPE_PORT_REMOVE:
-      do_port_remove(packet_hdr.port);
+      do_port_remove(port);
       break;
     case MSG_TYPE_PORT_SET_STATUS:
-      switch (packet_hdr.more) {
+      switch (more) {
         case MSG_PORT_STATUS_DOWN:
-          do_port_set_status(packet_hdr.port, PortStatus::PORT_DOWN);
+          do_port_set_status(port, PortStatus::PORT_DOWN);
           break;
         case MSG_PORT_STATUS_UP:
-          do_port_set_status(packet_hdr.port, PortStatus::PORT_UP);
+          do_port_set_status(port, PortStatus::PORT_UP);
           break;
         default:
           Logger::get()->error("Unknown port status requested");
@@ -267,21 +510,20 @@ PacketInDevMgrImp::handle_msg(void *msg) {
       break;
     case MSG_TYPE_PACKET_IN:
       if (enforce_ports) {
-        auto it = port_info.find(packet_hdr.port);
+        auto it = port_info.find(port);
         if (it == port_info.end() || !it->second.is_up)
           break;
       }
       if (pkt_handler) {
-        char *data = static_cast<char *>(msg) + sizeof(packet_hdr);
-        BMLOG_TRACE("Packet in received on port {}", packet_hdr.port);
-        pkt_handler(packet_hdr.port, data, packet_hdr.more, pkt_cookie);
+        BMLOG_TRACE("Packet in received on port {}", port);
+        pkt_handler(port, data, more, pkt_cookie);
       }
       break;
     case MSG_TYPE_PACKET_OUT:
       Logger::get()->error("Invalid PACKET_OUT message received");
       break;
     case MSG_TYPE_INFO_REQ:
-      handle_info_req_msg(msg);
+      handle_info_req_msg(port, more);
       break;
     case MSG_TYPE_INFO_REP:
       Logger::get()->error("Invalid INFO_REP message received");
@@ -294,22 +536,12 @@ PacketInDevMgrImp::handle_msg(void *msg) {
 
 void
 PacketInDevMgrImp::receive_loop() {
-  struct nn_msghdr msghdr;
-  struct nn_iovec iov;
-  void *msg = nullptr;
-  iov.iov_base = &msg;
-  iov.iov_len = NN_MSG;
-  std::memset(&msghdr, 0, sizeof(msghdr));
-  msghdr.msg_iov = &iov;
-  msghdr.msg_iovlen = 1;
-  while (!stop_receive_thread) {
-    int rc = s.recvmsg(&msghdr, 0);
-    if (rc < 0) continue;
-    assert(msg);
-    handle_msg(msg);
-    nn::freemsg(msg);
-    msg = nullptr;
-  }
+  ThreadAffinity::apply("packet_in");
+
+  auto handler = [this](int type, int port, int more, const char *data) {
+    handle_msg(type, port, more, data);
+  };
+  while (!stop_receive_thread) s->receive(handler);
 }
 
 void
@@ -324,5 +556,3 @@ DevMgr::set_dev_mgr_packet_in(
 }
 
 }  // namespace bm
-
-#endif  // BMNANOMSG_ON
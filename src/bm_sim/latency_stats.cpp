@@ -0,0 +1,213 @@
+/* Copyright 2013-present Barefoot Networks, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Antonin Bas (antonin@barefootnetworks.com)
+ *
+ */
+
+#include <bm/bm_sim/latency_stats.h>
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+namespace bm {
+
+constexpr uint64_t LatencyHistogram::kMaxValue;
+constexpr size_t LatencyHistogram::kNbBuckets;
+
+namespace {
+
+// values below 2^kSubBucketBits have their own bucket, above that each power of
+// 2 is split in 2^(kSubBucketBits - 1) buckets
+constexpr int kSubBucketBits = 7;
+constexpr uint64_t kSubBucketCount = 1u << kSubBucketBits;
+constexpr uint64_t kSubBucketHalfCount = kSubBucketCount / 2;
+
+}  // namespace
+
+LatencyHistogram::LatencyHistogram()
+    : counts(kNbBuckets, 0) { }
+
+size_t
+LatencyHistogram::bucket_index(uint64_t value_ns) {
+  if (value_ns < kSubBucketCount) return value_ns;
+  value_ns = std::min(value_ns, kMaxValue);
+  int msb = 63 - __builtin_clzll(value_ns);
+  int shift = msb - (kSubBucketBits - 1);
+  return kSubBucketCount + (msb - kSubBucketBits) * kSubBucketHalfCount +
+      ((value_ns >> shift) - kSubBucketHalfCount);
+}
+
+uint64_t
+LatencyHistogram::bucket_lowest_value(size_t index) {
+  if (index < kSubBucketCount) return index;
+  auto i = index - kSubBucketCount;
+  int msb = static_cast<int>(i / kSubBucketHalfCount) + kSubBucketBits;
+  auto sub_bucket = kSubBucketHalfCount + i % kSubBucketHalfCount;
+  return sub_bucket << (msb - (kSubBucketBits - 1));
+}
+
+uint64_t
+LatencyHistogram::bucket_highest_value(size_t index) {
+  if (index + 1 >= kNbBuckets) return kMaxValue;
+  return bucket_lowest_value(index + 1) - 1;
+}
+
+LatencyHistogram &
+LatencyHistogram::operator +=(const LatencyHistogram &other) {
+  for (size_t i = 0; i < kNbBuckets; i++) counts[i] += other.counts[i];
+  total_count += other.total_count;
+  total_ns += other.total_ns;
+  return *this;
+}
+
+LatencyHistogram &
+LatencyHistogram::operator -=(const LatencyHistogram &other) {
+  for (size_t i = 0; i < kNbBuckets; i++) counts[i] -= other.counts[i];
+  total_count -= other.total_count;
+  total_ns -= other.total_ns;
+  return *this;
+}
+
+uint64_t
+LatencyHistogram::get_mean() const {
+  return (total_count == 0) ? 0 : total_ns / total_count;
+}
+
+uint64_t
+LatencyHistogram::get_min() const {
+  for (size_t i = 0; i < kNbBuckets; i++)
+    if (counts[i] > 0) return bucket_lowest_value(i);
+  return 0;
+}
+
+uint64_t
+LatencyHistogram::get_max() const {
+  for (size_t i = kNbBuckets; i > 0; i--)
+    if (counts[i - 1] > 0) return bucket_highest_value(i - 1);
+  return 0;
+}
+
+uint64_t
+LatencyHistogram::get_value_at_percentile(double percentile) const {
+  if (total_count == 0) return 0;
+  percentile = std::min(std::max(percentile, 0.0), 100.0);
+  auto target = static_cast<uint64_t>(
+      std::ceil(percentile / 100.0 * static_cast<double>(total_count)));
+  target = std::max<uint64_t>(target, 1);
+  uint64_t cumulative = 0;
+  for (size_t i = 0; i < kNbBuckets; i++) {
+    cumulative += counts[i];
+    if (cumulative >= target) return bucket_highest_value(i);
+  }
+  return get_max();
+}
+
+// Only written by the thread which owns it; other threads may read it at any
+// time, hence the atomics, which are only accessed with relaxed loads and
+// stores (no read-modify-write operation).
+struct LatencyStats::ThreadHistograms {
+  explicit ThreadHistograms(size_t nb_stages)
+      : counts(nb_stages * LatencyHistogram::kNbBuckets),
+        total_counts(nb_stages), total_ns(nb_stages) { }
+
+  static void increment(std::atomic<uint64_t> *v, uint64_t inc) {
+    v->store(v->load(std::memory_order_relaxed) + inc,
+             std::memory_order_relaxed);
+  }
+
+  void record(size_t stage, uint64_t latency_ns) {
+    auto index = LatencyHistogram::bucket_index(latency_ns);
+    increment(&counts[stage * LatencyHistogram::kNbBuckets + index], 1);
+    increment(&total_counts[stage], 1);
+    increment(&total_ns[stage], latency_ns);
+  }
+
+  void add_to(size_t stage, LatencyHistogram *histogram) const {
+    const auto *c = &counts[stage * LatencyHistogram::kNbBuckets];
+    for (size_t i = 0; i < LatencyHistogram::kNbBuckets; i++)
+      histogram->counts[i] += c[i].load(std::memory_order_relaxed);
+    histogram->total_count +=
+        total_counts[stage].load(std::memory_order_relaxed);
+    histogram->total_ns += total_ns[stage].load(std::memory_order_relaxed);
+  }
+
+  // value-initialized, i.e. zero
+  std::vector<std::atomic<uint64_t> > counts;
+  std::vector<std::atomic<uint64_t> > total_counts;
+  std::vector<std::atomic<uint64_t> > total_ns;
+};
+
+namespace {
+
+std::atomic<uint64_t> next_latency_stats_id{1};
+
+}  // namespace
+
+LatencyStats::LatencyStats(const std::vector<std::string> &stage_names)
+    : stage_names(stage_names), id(next_latency_stats_id++), threads(),
+      baseline(stage_names.size()) { }
+
+LatencyStats::~LatencyStats() = default;
+
+LatencyStats::ThreadHistograms *
+LatencyStats::get_thread_histograms() {
+  // most of the time, a thread only records values for a single instance
+  static thread_local uint64_t cached_id = 0;
+  static thread_local ThreadHistograms *cached = nullptr;
+  if (cached_id == id) return cached;
+  std::lock_guard<std::mutex> lock(mutex);
+  auto &histograms = threads[std::this_thread::get_id()];
+  if (!histograms) histograms.reset(new ThreadHistograms(get_nb_stages()));
+  cached_id = id;
+  cached = histograms.get();
+  return cached;
+}
+
+void
+LatencyStats::record_(size_t stage, uint64_t latency_ns) {
+  get_thread_histograms()->record(stage, latency_ns);
+}
+
+std::vector<LatencyHistogram>
+LatencyStats::merge() const {
+  std::vector<LatencyHistogram> histograms(get_nb_stages());
+  for (const auto &t : threads) {
+    for (size_t stage = 0; stage < histograms.size(); stage++)
+      t.second->add_to(stage, &histograms[stage]);
+  }
+  return histograms;
+}
+
+std::vector<LatencyHistogram>
+LatencyStats::get_histograms() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto histograms = merge();
+  for (size_t stage = 0; stage < histograms.size(); stage++)
+    histograms[stage] -= baseline[stage];
+  return histograms;
+}
+
+void
+LatencyStats::reset() {
+  // the per-thread histograms cannot be cleared safely from another thread
+  std::lock_guard<std::mutex> lock(mutex);
+  baseline = merge();
+}
+
+}  // namespace bm
@@ -24,6 +24,7 @@
 #include <bm/bm_sim/phv.h>
 #include <bm/bm_sim/bytecontainer.h>
 #include <bm/bm_sim/transport.h>
+#include <bm/bm_sim/thread_affinity.h>
 
 #include <string>
 #include <vector>
@@ -457,6 +458,7 @@ LearnEngine::LearnList::buffer_transmit() {
 
 void
 LearnEngine::LearnList::buffer_transmit_loop() {
+  ThreadAffinity::apply("learning", list_id);
   while (true) {
     buffer_transmit();
     if (stop_transmit_thread) return;
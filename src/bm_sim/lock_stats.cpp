@@ -0,0 +1,132 @@
+/* Copyright 2013-present Barefoot Networks, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Antonin Bas (antonin@barefootnetworks.com)
+ *
+ */
+
+#include <bm/bm_sim/lock_stats.h>
+
+#include <algorithm>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace bm {
+
+namespace {
+
+struct Registry {
+  std::mutex mutex{};
+  std::set<LockStats *> locks{};
+};
+
+// never destroyed, locks may be destroyed after the end of main()
+Registry *get_registry() {
+  static Registry *registry = new Registry();
+  return registry;
+}
+
+}  // namespace
+
+LockStats::AtomicHistogram::AtomicHistogram()
+    // value-initialization, i.e. 0
+    : counts(new std::atomic<uint64_t>[LatencyHistogram::kNbBuckets]()) { }
+
+LockStats::LockStats(const std::string &name)
+    : name(name) {
+  auto *registry = get_registry();
+  std::lock_guard<std::mutex> lock(registry->mutex);
+  registry->locks.insert(this);
+}
+
+LockStats::~LockStats() {
+  auto *registry = get_registry();
+  std::lock_guard<std::mutex> lock(registry->mutex);
+  registry->locks.erase(this);
+}
+
+LockStats::Snapshot
+LockStats::get() const {
+  Snapshot snapshot;
+  snapshot.name = name;
+  snapshot.read_contended = read_contended.load();
+  snapshot.write_contended = write_contended.load();
+  snapshot.histograms.resize(NB_HISTOGRAMS);
+  for (size_t i = 0; i < NB_HISTOGRAMS; i++) {
+    const auto &from = histograms[i];
+    auto &to = snapshot.histograms[i];
+    for (size_t b = 0; b < LatencyHistogram::kNbBuckets; b++)
+      to.counts[b] = from.counts[b].load(std::memory_order_relaxed);
+    to.total_count = from.total_count.load(std::memory_order_relaxed);
+    to.total_ns = from.total_ns.load(std::memory_order_relaxed);
+  }
+  return snapshot;
+}
+
+void
+LockStats::reset() {
+  for (auto &h : histograms) {
+    for (size_t b = 0; b < LatencyHistogram::kNbBuckets; b++)
+      h.counts[b].store(0, std::memory_order_relaxed);
+    h.total_count = 0;
+    h.total_ns = 0;
+  }
+  read_contended = 0;
+  write_contended = 0;
+}
+
+const char *
+LockStats::histogram_name(Histogram histogram) {
+  switch (histogram) {
+    case READ_WAIT:
+      return "read_wait";
+    case READ_HOLD:
+      return "read_hold";
+    case WRITE_WAIT:
+      return "write_wait";
+    case WRITE_HOLD:
+      return "write_hold";
+    default:
+      break;
+  }
+  return "";
+}
+
+std::vector<LockStats::Snapshot>
+LockStats::get_all() {
+  std::vector<Snapshot> snapshots;
+  {
+    auto *registry = get_registry();
+    std::lock_guard<std::mutex> lock(registry->mutex);
+    for (const auto *stats : registry->locks)
+      snapshots.push_back(stats->get());
+  }
+  std::stable_sort(snapshots.begin(), snapshots.end(),
+                   [](const Snapshot &s1, const Snapshot &s2) {
+                     return s1.name < s2.name; });
+  return snapshots;
+}
+
+void
+LockStats::reset_all() {
+  auto *registry = get_registry();
+  std::lock_guard<std::mutex> lock(registry->mutex);
+  for (auto *stats : registry->locks) stats->reset();
+}
+
+}  // namespace bm
@@ -27,6 +27,7 @@
 #include <unordered_map>
 #include <vector>
 #include <tuple>
+#include <utility>
 #include <limits>
 #include <list>
 #include <mutex>
@@ -130,6 +131,14 @@ class ExactMap : public ExactLookupStructure {
     entries_map[key.data] = handle;  // key is copied, which is not great
   }
 
+  void add_entries(
+      const std::vector<std::pair<const ExactMatchKey *, internal_handle_t> > &
+      entries) override {
+    // at most one rehash
+    entries_map.reserve(entries_map.size() + entries.size());
+    for (const auto &e : entries) entries_map[e.first->data] = e.second;
+  }
+
   void delete_entry(const ExactMatchKey &key) override {
     entries_map.erase(key.data);
   }
@@ -328,6 +337,32 @@ class EntryList {
     update_use_cache();
   }
 
+  // if the list is empty, the entries are chained in handle order directly and
+  // the cache is only invalidated once
+  void add_entries(const std::vector<
+      std::pair<const K *, internal_handle_t> > &new_entries) {
+    if (head != nullptr) {
+      for (const auto &e : new_entries) add(*e.first, e.second);
+      return;
+    }
+    Entry *prev = nullptr;
+    for (const auto &e : new_entries) {
+      Entry &entry = entries.at(e.second);
+      entry.priority = e.first->priority;
+      entry.key = e.first;
+      entry.prev = prev;
+      entry.next = nullptr;
+      if (prev)
+        prev->next = &entry;
+      else
+        head = &entry;
+      prev = &entry;
+    }
+    entries_count += new_entries.size();
+    if (cache_activated()) cache.invalidate_all();
+    update_use_cache();
+  }
+
   void delete_entry(const K &key) {
     auto entry = find_entry(key);
     assert(entry);
@@ -419,6 +454,12 @@ class TernaryMap : public TernaryLookupStructure {
     entry_list.add(key, handle);
   }
 
+  void add_entries(const std::vector<std::pair<const TernaryMatchKey *,
+                                               internal_handle_t> > &entries)
+      override {
+    entry_list.add_entries(entries);
+  }
+
   void delete_entry(const TernaryMatchKey &key) override {
     entry_list.delete_entry(key);
   }
@@ -476,6 +517,11 @@ class RangeMap : public RangeLookupStructure {
     entry_list.add(key, handle);
   }
 
+  void add_entries(const std::vector<
+      std::pair<const RangeMatchKey *, internal_handle_t> > &entries) override {
+    entry_list.add_entries(entries);
+  }
+
   void delete_entry(const RangeMatchKey &key) override {
     entry_list.delete_entry(key);
   }
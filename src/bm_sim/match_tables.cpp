@@ -20,11 +20,14 @@
 
 #include <bm/bm_sim/_assert.h>
 #include <bm/bm_sim/match_tables.h>
+#include <bm/bm_sim/latency_stats.h>
 #include <bm/bm_sim/logger.h>
 #include <bm/bm_sim/event_logger.h>
 #include <bm/bm_sim/lookup_structures.h>
 #include <bm/bm_sim/P4Objects.h>
+#include <bm/bm_sim/snapshot.h>
 
+#include <algorithm>  // std::sort, std::unique
 #include <string>
 #include <vector>
 #include <iostream>
@@ -34,6 +37,12 @@ namespace bm {
 
 namespace {
 
+// indices of the profiling counters of a table
+enum TableProfilingCounter : size_t {
+  PROF_LOOKUPS, PROF_HITS, PROF_SAMPLES, PROF_LOOKUP_NS, PROF_ACTION_NS,
+  PROF_NB_COUNTERS
+};
+
 template <typename V>
 std::unique_ptr<MatchUnitAbstract<V> >
 create_match_unit(const std::string match_type, const size_t size,
@@ -83,13 +92,29 @@ ActionEntry::deserialize(std::istream *in, const P4Objects &objs) {
   }
 }
 
+void
+ActionEntry::serialize(SnapshotWriter *out) const {
+  action_fn.serialize(out);
+  out->write_string(next_node ? next_node->get_name() : "");
+}
+
+void
+ActionEntry::deserialize(SnapshotReader *in, const P4Objects &objs) {
+  action_fn.deserialize(in, objs);
+  auto next_node_name = in->read_string();
+  next_node = next_node_name.empty() ?
+      nullptr : objs.get_control_node(next_node_name);
+}
+
 MatchTableAbstract::MatchTableAbstract(
     const std::string &name, p4object_id_t id,
     bool with_counters, bool with_ageing,
     MatchUnitAbstract_ *mu)
     : NamedP4Object(name, id),
       with_counters(with_counters), with_ageing(with_ageing),
-      match_unit_(mu) { }
+      match_unit_(mu), profiling_counters(PROF_NB_COUNTERS) {
+  BM_LOCK_STATS_NAME(t_mutex, "match_table:" + name);
+}
 
 const ControlFlowNode *
 MatchTableAbstract::apply_action(Packet *pkt) {
@@ -100,8 +125,14 @@ MatchTableAbstract::apply_action(Packet *pkt) {
   auto lock = lock_read();
   auto lock_impl = lock_impl_read();
 
+  const bool profiling = ProfilingCounters::is_enabled();
+  const bool timed = profiling && ProfilingCounters::sample();
+  uint64_t lookup_start_ns = timed ? LatencyStats::now_ns() : 0;
+
   const ActionEntry &action_entry = lookup(*pkt, &hit, &handle, &next_node);
 
+  uint64_t lookup_end_ns = timed ? LatencyStats::now_ns() : 0;
+
   // TODO(antonin): I hate this part, which requires this class to know that the
   // lower 24 bits of the handle are used as an index. Is is expected that few
   // people will ever use this index, but it is required for the implementation
@@ -135,11 +166,43 @@ MatchTableAbstract::apply_action(Packet *pkt) {
 
   BMLOG_DEBUG_PKT(*pkt, "Action entry is {}", action_entry);
 
+  uint64_t action_start_ns = timed ? LatencyStats::now_ns() : 0;
+
   action_entry.action_fn(pkt);
 
+  if (profiling) {
+    profiling_counters.add(PROF_LOOKUPS, 1);
+    if (hit) profiling_counters.add(PROF_HITS, 1);
+    if (timed) {
+      profiling_counters.add(PROF_SAMPLES, 1);
+      profiling_counters.add(PROF_LOOKUP_NS, lookup_end_ns - lookup_start_ns);
+      profiling_counters.add(PROF_ACTION_NS,
+                             LatencyStats::now_ns() - action_start_ns);
+    }
+  }
+
   return next_node;
 }
 
+ProfilingStats::Table
+MatchTableAbstract::get_profiling_stats() const {
+  auto values = profiling_counters.get();
+  ProfilingStats::Table stats;
+  stats.name = get_name();
+  stats.lookups = values[PROF_LOOKUPS];
+  stats.hits = values[PROF_HITS];
+  stats.misses = stats.lookups - stats.hits;
+  auto samples = values[PROF_SAMPLES];
+  stats.avg_lookup_ns = samples ? values[PROF_LOOKUP_NS] / samples : 0;
+  stats.avg_action_ns = samples ? values[PROF_ACTION_NS] / samples : 0;
+  return stats;
+}
+
+void
+MatchTableAbstract::reset_profiling_stats() {
+  profiling_counters.reset();
+}
+
 void
 MatchTableAbstract::reset_state(bool reset_default_entry) {
   auto lock = lock_write();
@@ -188,6 +251,31 @@ MatchTableAbstract::deserialize(std::istream *in, const P4Objects &objs) {
   deserialize_(in, objs);
 }
 
+void
+MatchTableAbstract::serialize(SnapshotWriter *out) const {
+  size_t cursor = 0;
+  serialize(out, &cursor, std::numeric_limits<size_t>::max());
+}
+
+// the table-level state comes first, so that it is written with the first chunk
+bool
+MatchTableAbstract::serialize(SnapshotWriter *out, size_t *cursor,
+                              size_t max_entries) const {
+  auto lock = lock_read();
+  if (*cursor == 0)
+    out->write_string(next_node_miss ? next_node_miss->get_name() : "");
+  return serialize_(out, cursor, max_entries);
+}
+
+void
+MatchTableAbstract::deserialize(SnapshotReader *in, const P4Objects &objs) {
+  auto lock = lock_write();
+  auto next_node_miss_name = in->read_string();
+  if (!next_node_miss_name.empty())
+    next_node_miss = objs.get_control_node(next_node_miss_name);
+  deserialize_(in, objs);
+}
+
 void
 MatchTableAbstract::set_next_node(p4object_id_t action_id,
                                   const ControlFlowNode *next_node) {
@@ -249,6 +337,32 @@ MatchTableAbstract::reset_counters() {
   return MatchErrorCode::SUCCESS;
 }
 
+MatchErrorCode
+MatchTableAbstract::query_all_counters(std::vector<entry_handle_t> *handles,
+                                       std::vector<counter_value_t> *bytes,
+                                       std::vector<counter_value_t> *packets,
+                                       bool reset) {
+  // the counters are atomic, the read lock is enough to protect the handles
+  auto lock = lock_read();
+  if (!with_counters) return MatchErrorCode::COUNTERS_DISABLED;
+  auto num_entries = match_unit_->get_num_entries();
+  handles->clear();
+  handles->reserve(num_entries);
+  bytes->resize(num_entries);
+  packets->resize(num_entries);
+  size_t idx = 0;
+  for (auto it = match_unit_->handles_begin();
+       it != match_unit_->handles_end(); ++it, ++idx) {
+    handles->push_back(*it);
+    MatchUnit::EntryMeta &meta = match_unit_->get_entry_meta(*it);
+    if (reset)
+      meta.counter.query_and_reset_counter(&(*bytes)[idx], &(*packets)[idx]);
+    else
+      meta.counter.query_counter(&(*bytes)[idx], &(*packets)[idx]);
+  }
+  return MatchErrorCode::SUCCESS;
+}
+
 MatchErrorCode
 MatchTableAbstract::write_counters(entry_handle_t handle,
                                    counter_value_t bytes,
@@ -262,6 +376,19 @@ MatchTableAbstract::write_counters(entry_handle_t handle,
   return MatchErrorCode::SUCCESS;
 }
 
+MatchErrorCode
+MatchTableAbstract::add_counters(entry_handle_t handle,
+                                 counter_value_t bytes,
+                                 counter_value_t packets) {
+  // the counter values are atomic, the lock only protects the entry
+  auto lock = lock_read();
+  if (!with_counters) return MatchErrorCode::COUNTERS_DISABLED;
+  if (!is_valid_handle(handle)) return MatchErrorCode::INVALID_HANDLE;
+  MatchUnit::EntryMeta &meta = match_unit_->get_entry_meta(handle);
+  meta.counter.add_counter(bytes, packets);
+  return MatchErrorCode::SUCCESS;
+}
+
 MatchErrorCode
 MatchTableAbstract::set_meter_rates(
     entry_handle_t handle,
@@ -311,6 +438,13 @@ MatchTableAbstract::handles_end() const {
   return handle_iterator(this, match_unit_->handles_end());
 }
 
+bool
+MatchTableAbstract::has_same_key(const MatchTableAbstract &other) const {
+  return get_table_type() == other.get_table_type() &&
+      match_unit_->get_match_key_builder().same_key_as(
+          other.match_unit_->get_match_key_builder());
+}
+
 const ControlFlowNode *
 MatchTableAbstract::get_next_node(p4object_id_t action_id) const {
   if (has_next_node_hit)
@@ -368,10 +502,10 @@ MatchTable::lookup(const Packet &pkt, bool *hit, entry_handle_t *handle,
 }
 
 MatchErrorCode
-MatchTable::add_entry(const std::vector<MatchKeyParam> &match_key,
-                      const ActionFn *action_fn,
-                      ActionData action_data,  // move it
-                      entry_handle_t *handle, int priority) {
+MatchTable::add_entry_(const std::vector<MatchKeyParam> &match_key,
+                       const ActionFn *action_fn,
+                       ActionData action_data,  // move it
+                       entry_handle_t *handle, int priority) {
   if (immutable_entries) return MatchErrorCode::IMMUTABLE_TABLE_ENTRIES;
 
   if (action_data.size() != action_fn->get_num_params())
@@ -380,15 +514,23 @@ MatchTable::add_entry(const std::vector<MatchKeyParam> &match_key,
 
   const ControlFlowNode *next_node = get_next_node(action_fn->get_id());
 
+  return match_unit->add_entry(
+      match_key,
+      ActionEntry(std::move(action_fn_entry), next_node),
+      handle, priority);
+}
+
+MatchErrorCode
+MatchTable::add_entry(const std::vector<MatchKeyParam> &match_key,
+                      const ActionFn *action_fn,
+                      ActionData action_data,  // move it
+                      entry_handle_t *handle, int priority) {
   MatchErrorCode rc = MatchErrorCode::SUCCESS;
 
   {
     auto lock = lock_write();
-
-    rc = match_unit->add_entry(
-        match_key,
-        ActionEntry(std::move(action_fn_entry), next_node),
-        handle, priority);
+    rc = add_entry_(match_key, action_fn, std::move(action_data), handle,
+                    priority);
   }
 
   // because we let go of the lock, there is a possibility of the entry being
@@ -410,14 +552,18 @@ MatchTable::add_entry(const std::vector<MatchKeyParam> &match_key,
 }
 
 MatchErrorCode
-MatchTable::delete_entry(entry_handle_t handle) {
+MatchTable::delete_entry_(entry_handle_t handle) {
   if (immutable_entries) return MatchErrorCode::IMMUTABLE_TABLE_ENTRIES;
+  return match_unit->delete_entry(handle);
+}
 
+MatchErrorCode
+MatchTable::delete_entry(entry_handle_t handle) {
   MatchErrorCode rc = MatchErrorCode::SUCCESS;
 
   {
     auto lock = lock_write();
-    rc = match_unit->delete_entry(handle);
+    rc = delete_entry_(handle);
   }
 
   if (rc == MatchErrorCode::SUCCESS) {
@@ -431,8 +577,8 @@ MatchTable::delete_entry(entry_handle_t handle) {
 }
 
 MatchErrorCode
-MatchTable::modify_entry(entry_handle_t handle,
-                         const ActionFn *action_fn, ActionData action_data) {
+MatchTable::modify_entry_(entry_handle_t handle,
+                          const ActionFn *action_fn, ActionData action_data) {
   if (immutable_entries) return MatchErrorCode::IMMUTABLE_TABLE_ENTRIES;
 
   if (action_data.size() != action_fn->get_num_params())
@@ -441,12 +587,18 @@ MatchTable::modify_entry(entry_handle_t handle,
 
   const ControlFlowNode *next_node = get_next_node(action_fn->get_id());
 
+  return match_unit->modify_entry(
+      handle, ActionEntry(std::move(action_fn_entry), next_node));
+}
+
+MatchErrorCode
+MatchTable::modify_entry(entry_handle_t handle,
+                         const ActionFn *action_fn, ActionData action_data) {
   MatchErrorCode rc = MatchErrorCode::SUCCESS;
 
   {
     auto lock = lock_write();
-    rc = match_unit->modify_entry(
-        handle, ActionEntry(std::move(action_fn_entry), next_node));
+    rc = modify_entry_(handle, action_fn, std::move(action_data));
   }
 
   if (rc == MatchErrorCode::SUCCESS) {
@@ -460,6 +612,91 @@ MatchTable::modify_entry(entry_handle_t handle,
   return rc;
 }
 
+void
+MatchTable::write_entry_(WriteOp *op, WriteOp *undo) {
+  Entry entry{};
+  // we need a copy of the entry to be able to undo a modify or a delete
+  if (undo && op->type != WriteOp::Type::ADD) {
+    op->status = get_entry_(op->handle, &entry);
+    if (op->status != MatchErrorCode::SUCCESS) return;
+  }
+
+  switch (op->type) {
+    case WriteOp::Type::ADD:
+      op->status = add_entry_(op->match_key, op->action_fn,
+                              std::move(op->action_data), &op->handle,
+                              op->priority);
+      if (undo) undo->type = WriteOp::Type::DELETE;
+      break;
+    case WriteOp::Type::MODIFY:
+      op->status = modify_entry_(op->handle, op->action_fn,
+                                 std::move(op->action_data));
+      if (undo) undo->type = WriteOp::Type::MODIFY;
+      break;
+    case WriteOp::Type::DELETE:
+      op->status = delete_entry_(op->handle);
+      if (undo) undo->type = WriteOp::Type::ADD;
+      break;
+  }
+
+  if (op->status != MatchErrorCode::SUCCESS) {
+    BMLOG_ERROR("Error when trying to write entry {} in table '{}'",
+                op->handle, get_name());
+    return;
+  }
+  BMLOG_DEBUG("Wrote entry {} in table '{}'", op->handle, get_name());
+
+  if (!undo) return;
+  undo->table = this;
+  undo->handle = op->handle;
+  undo->match_key = std::move(entry.match_key);
+  undo->action_fn = entry.action_fn;
+  undo->action_data = std::move(entry.action_data);
+  undo->priority = entry.priority;
+}
+
+MatchErrorCode
+MatchTable::write_entries(std::vector<WriteOp> *ops, bool atomic) {
+  // we acquire the locks in a consistent order to avoid deadlocks between
+  // concurrent batches
+  std::vector<MatchTable *> tables;
+  for (const auto &op : *ops) tables.push_back(op.table);
+  std::sort(tables.begin(), tables.end());
+  tables.erase(std::unique(tables.begin(), tables.end()), tables.end());
+  std::vector<WriteLock> locks;
+  locks.reserve(tables.size());
+  for (auto *table : tables) locks.push_back(table->lock_write());
+
+  if (!atomic) {
+    MatchErrorCode rc = MatchErrorCode::SUCCESS;
+    for (auto &op : *ops) {
+      op.table->write_entry_(&op, nullptr);
+      if (rc == MatchErrorCode::SUCCESS) rc = op.status;
+    }
+    return rc;
+  }
+
+  std::vector<WriteOp> undos(ops->size());
+  size_t failed = 0;
+  for (; failed < ops->size(); failed++) {
+    auto &op = (*ops)[failed];
+    op.table->write_entry_(&op, &undos[failed]);
+    if (op.status != MatchErrorCode::SUCCESS) break;
+  }
+  if (failed == ops->size()) return MatchErrorCode::SUCCESS;
+
+  for (size_t i = failed; i > 0; i--) {
+    auto &undo = undos[i - 1];
+    undo.table->write_entry_(&undo, nullptr);
+    // cannot fail as we have held the locks since the operation was applied
+    assert(undo.status == MatchErrorCode::SUCCESS);
+    (*ops)[i - 1].handle = undo.handle;
+  }
+  for (size_t i = 0; i < ops->size(); i++)
+    if (i != failed) (*ops)[i].status = MatchErrorCode::BATCH_ABORTED;
+  return (*ops)[failed].status;
+}
+
 MatchErrorCode
 MatchTable::set_default_action(const ActionFn *action_fn,
                                ActionData action_data) {
@@ -574,6 +811,23 @@ MatchTable::get_entries() const {
   return entries;
 }
 
+bool
+MatchTable::get_entries(size_t *cursor, size_t max_entries,
+                        std::vector<Entry> *entries) const {
+  auto lock = lock_read();
+  std::vector<entry_handle_t> handles;
+  handles.reserve(std::min(max_entries, get_num_entries()));
+  bool more = match_unit->get_handles(cursor, max_entries, &handles);
+  size_t idx = entries->size();
+  entries->resize(idx + handles.size());
+  for (auto handle : handles) {
+    MatchErrorCode rc = get_entry_(handle, &(*entries)[idx++]);
+    _BM_UNUSED(rc);
+    assert(rc == MatchErrorCode::SUCCESS);
+  }
+  return more;
+}
+
 MatchErrorCode
 MatchTable::get_default_entry(Entry *entry) const {
   auto lock = lock_read();
@@ -583,6 +837,16 @@ MatchTable::get_default_entry(Entry *entry) const {
   return MatchErrorCode::SUCCESS;
 }
 
+bool
+MatchTable::is_default_entry_modified() const {
+  auto lock = lock_read();
+  const auto &current = default_entry.action_fn;
+  const auto &from_program = default_default_entry.action_fn;
+  return current.get_action_fn() != from_program.get_action_fn() ||
+      current.get_action_data().action_data !=
+      from_program.get_action_data().action_data;
+}
+
 MatchErrorCode
 MatchTable::dump_entry_(std::ostream *out, entry_handle_t handle) const {
   MatchErrorCode rc;
@@ -631,6 +895,19 @@ MatchTable::deserialize_(std::istream *in, const P4Objects &objs) {
   default_entry.deserialize(in, objs);
 }
 
+bool
+MatchTable::serialize_(SnapshotWriter *out, size_t *cursor,
+                       size_t max_entries) const {
+  if (*cursor == 0) default_entry.serialize(out);
+  return match_unit->serialize(out, cursor, max_entries);
+}
+
+void
+MatchTable::deserialize_(SnapshotReader *in, const P4Objects &objs) {
+  default_entry.deserialize(in, objs);
+  match_unit->deserialize(in, objs);
+}
+
 
 std::unique_ptr<MatchTable>
 MatchTable::create(const std::string &match_type,
@@ -911,6 +1188,23 @@ MatchTableIndirect::get_entries() const {
   return entries;
 }
 
+bool
+MatchTableIndirect::get_entries(size_t *cursor, size_t max_entries,
+                                std::vector<Entry> *entries) const {
+  auto lock = lock_read();
+  std::vector<entry_handle_t> handles;
+  handles.reserve(std::min(max_entries, get_num_entries()));
+  bool more = match_unit->get_handles(cursor, max_entries, &handles);
+  size_t idx = entries->size();
+  entries->resize(idx + handles.size());
+  for (auto handle : handles) {
+    MatchErrorCode rc = get_entry_(handle, &(*entries)[idx++]);
+    _BM_UNUSED(rc);
+    assert(rc == MatchErrorCode::SUCCESS);
+  }
+  return more;
+}
+
 MatchErrorCode
 MatchTableIndirect::get_default_entry(Entry *entry) const {
   auto lock = lock_read();
@@ -958,6 +1252,23 @@ MatchTableIndirect::deserialize_(std::istream *in, const P4Objects &objs) {
   if (default_set) default_index.deserialize(in, objs);
 }
 
+bool
+MatchTableIndirect::serialize_(SnapshotWriter *out, size_t *cursor,
+                               size_t max_entries) const {
+  if (*cursor == 0) {
+    out->write_u8(default_set);
+    if (default_set) default_index.serialize(out);
+  }
+  return match_unit->serialize(out, cursor, max_entries);
+}
+
+void
+MatchTableIndirect::deserialize_(SnapshotReader *in, const P4Objects &objs) {
+  default_set = in->read_u8();
+  if (default_set) default_index.deserialize(in, objs);
+  match_unit->deserialize(in, objs);
+}
+
 
 MatchTableIndirectWS::MatchTableIndirectWS(
     const std::string &name, p4object_id_t id,
@@ -1147,6 +1458,23 @@ MatchTableIndirectWS::get_entries() const {
   return entries;
 }
 
+bool
+MatchTableIndirectWS::get_entries(size_t *cursor, size_t max_entries,
+                                  std::vector<Entry> *entries) const {
+  auto lock = lock_read();
+  std::vector<entry_handle_t> handles;
+  handles.reserve(std::min(max_entries, get_num_entries()));
+  bool more = match_unit->get_handles(cursor, max_entries, &handles);
+  size_t idx = entries->size();
+  entries->resize(idx + handles.size());
+  for (auto handle : handles) {
+    MatchErrorCode rc = get_entry_(handle, &(*entries)[idx++]);
+    _BM_UNUSED(rc);
+    assert(rc == MatchErrorCode::SUCCESS);
+  }
+  return more;
+}
+
 MatchErrorCode
 MatchTableIndirectWS::get_default_entry(Entry *entry) const {
   auto lock = lock_read();
@@ -1177,4 +1505,15 @@ MatchTableIndirectWS::deserialize_(std::istream *in, const P4Objects &objs) {
   MatchTableIndirect::deserialize_(in, objs);
 }
 
+bool
+MatchTableIndirectWS::serialize_(SnapshotWriter *out, size_t *cursor,
+                                 size_t max_entries) const {
+  return MatchTableIndirect::serialize_(out, cursor, max_entries);
+}
+
+void
+MatchTableIndirectWS::deserialize_(SnapshotReader *in, const P4Objects &objs) {
+  MatchTableIndirect::deserialize_(in, objs);
+}
+
 }  // namespace bm
@@ -25,9 +25,11 @@
 #include <bm/bm_sim/match_key_types.h>
 #include <bm/bm_sim/logger.h>
 #include <bm/bm_sim/lookup_structures.h>
+#include <bm/bm_sim/snapshot.h>
 
 #include <limits>
 #include <string>
+#include <utility>
 #include <vector>
 #include <algorithm>  // for std::copy, std::max
 #include <iostream>
@@ -142,6 +144,23 @@ MatchKeyBuilder::build() {
   built = true;
 }
 
+bool
+MatchKeyBuilder::same_key_as(const MatchKeyBuilder &other) const {
+  if (key_input.size() != other.key_input.size()) return false;
+  // build() re-orders key_input, but not masks and names; the 2 keys are
+  // re-ordered the same way iff inv_mapping is the same
+  if (built != other.built || inv_mapping != other.inv_mapping) return false;
+  for (size_t i = 0; i < key_input.size(); i++) {
+    if (key_input[i].mtype != other.key_input[i].mtype ||
+        key_input[i].nbits != other.key_input[i].nbits) {
+      return false;
+    }
+    if (masks[i] != other.masks[i]) return false;
+    if (name_map.get(i) != other.name_map.get(i)) return false;
+  }
+  return true;
+}
+
 // This function is in charge of re-organizing the input key on the fly to
 // satisfy the implementation requirements (e.g. LPM matches last...). At the
 // same time we keep track of the original order thanks to key_mapping (for
@@ -638,6 +657,19 @@ MatchUnitAbstract_::handles_end() const {
   return handle_iterator(this, handles.end());
 }
 
+bool
+MatchUnitAbstract_::get_handles(size_t *cursor, size_t max_handles,
+                                std::vector<entry_handle_t> *chunk) const {
+  // the cursor is an internal handle, which remains meaningful even if the
+  // corresponding entry is deleted between 2 calls
+  auto it = handles.lower_bound(*cursor);
+  for (; it != handles.end() && max_handles > 0; ++it, --max_handles)
+    chunk->push_back(HANDLE_SET(entry_meta.at(*it).version, *it));
+  if (it == handles.end()) return false;
+  *cursor = *it;
+  return true;
+}
+
 MatchUnitAbstract_::MatchUnitAbstract_(size_t size,
                                        const MatchKeyBuilder &key_builder)
     : size(size), nbytes_key(key_builder.get_nbytes_key()),
@@ -1165,6 +1197,119 @@ MatchUnitGeneric<K, V>::deserialize_(std::istream *in, const P4Objects &objs) {
   if (this->direct_meters) this->direct_meters->deserialize(in);
 }
 
+namespace {
+
+// the key data and the mask are nbytes_key bytes long
+void serialize_key(const ExactMatchKey &key, SnapshotWriter *out) {
+  (void) key; (void) out;
+}
+
+void serialize_key(const LPMMatchKey &key, SnapshotWriter *out) {
+  out->write_i32(key.prefix_length);
+}
+
+void serialize_key(const TernaryMatchKey &key, SnapshotWriter *out) {
+  out->write_bytes(key.mask.data(), key.mask.size());
+  out->write_i32(key.priority);
+}
+
+void serialize_key(const RangeMatchKey &key, SnapshotWriter *out) {
+  serialize_key(static_cast<const TernaryMatchKey &>(key), out);
+  out->write_u32(static_cast<uint32_t>(key.range_widths.size()));
+  for (const auto w : key.range_widths) out->write_u32(w);
+}
+
+void deserialize_key(ExactMatchKey *key, size_t nbytes_key,
+                     SnapshotReader *in) {
+  (void) key; (void) nbytes_key; (void) in;
+}
+
+void deserialize_key(LPMMatchKey *key, size_t nbytes_key, SnapshotReader *in) {
+  (void) nbytes_key;
+  key->prefix_length = in->read_i32();
+}
+
+void deserialize_key(TernaryMatchKey *key, size_t nbytes_key,
+                     SnapshotReader *in) {
+  const char *mask = in->read_bytes(nbytes_key);
+  if (mask) key->mask = ByteContainer(mask, nbytes_key);
+  key->priority = in->read_i32();
+}
+
+void deserialize_key(RangeMatchKey *key, size_t nbytes_key,
+                     SnapshotReader *in) {
+  deserialize_key(static_cast<TernaryMatchKey *>(key), nbytes_key, in);
+  auto s = in->read_u32();
+  for (size_t i = 0; i < s && in->good(); i++)
+    key->range_widths.push_back(in->read_u32());
+}
+
+}  // namespace
+
+// Each entry is preceded by a 1 byte marker and the list of entries ends with
+// a 0 marker, which lets the entries be written in several chunks (number of
+// entries not known in advance). Direct meters are written with the entry
+// they belong to.
+template <typename K, typename V>
+bool
+MatchUnitGeneric<K, V>::serialize_(SnapshotWriter *out, size_t *cursor,
+                                   size_t max_entries) const {
+  auto it = this->handles.lower_bound(*cursor);
+  for (; it != this->handles.end() && max_entries > 0; ++it, --max_entries) {
+    internal_handle_t handle_ = *it;
+    const Entry &entry = entries[handle_];
+    const EntryMeta &meta = this->entry_meta[handle_];
+    out->write_u8(1);
+    out->write_u32(handle_);
+    out->write_u32(entry.key.version);
+    out->write_bytes(entry.key.data.data(), entry.key.data.size());
+    serialize_key(entry.key, out);
+    entry.value.serialize(out);
+    out->write_u32(meta.timeout_ms);
+    if (this->direct_meters) this->direct_meters->at(handle_).serialize(out);
+  }
+  if (it == this->handles.end()) {
+    out->write_u8(0);
+    return false;
+  }
+  *cursor = *it;
+  return true;
+}
+
+template <typename K, typename V>
+void
+MatchUnitGeneric<K, V>::deserialize_(SnapshotReader *in,
+                                     const P4Objects &objs) {
+  this->reset_state();
+  std::vector<std::pair<const K *, internal_handle_t> > loaded;
+  while (in->good() && in->read_u8() == 1) {
+    internal_handle_t handle_ = in->read_u32();
+    if (handle_ >= this->size || this->handles.set_handle(handle_)) {
+      in->set_failed();
+      break;
+    }
+    Entry &entry = entries[handle_];
+    entry.key.version = in->read_u32();
+    const char *key_data = in->read_bytes(this->nbytes_key);
+    if (key_data) entry.key.data = ByteContainer(key_data, this->nbytes_key);
+    deserialize_key(&entry.key, this->nbytes_key, in);
+    entry.value.deserialize(in, objs);
+    EntryMeta &meta = this->entry_meta[handle_];
+    meta.reset();
+    meta.version = entry.key.version;
+    meta.timeout_ms = in->read_u32();
+    if (this->direct_meters) this->direct_meters->at(handle_).deserialize(in);
+    loaded.emplace_back(&entry.key, handle_);
+  }
+  // an invalid snapshot leaves the match unit empty
+  if (!in->good()) {
+    this->reset_state();
+    return;
+  }
+  this->num_entries = loaded.size();
+  lookup_structure->add_entries(loaded);
+}
+
 // explicit template instantiation
 
 // I did not think I had to explicitly instantiate MatchUnitAbstract, because it
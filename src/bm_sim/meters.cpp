@@ -21,6 +21,7 @@
 #include <bm/bm_sim/meters.h>
 #include <bm/bm_sim/logger.h>
 #include <bm/bm_sim/packet.h>
+#include <bm/bm_sim/snapshot.h>
 
 #include <algorithm>
 #include <vector>
@@ -128,6 +129,32 @@ Meter::deserialize(std::istream *in) {
   }
 }
 
+void
+Meter::serialize(SnapshotWriter *out) const {
+  auto lock = unique_lock();
+  out->write_u8(configured);
+  if (configured) {
+    for (const auto &rate : rates) {
+      out->write_double(rate.info_rate);
+      out->write_u64(rate.burst_size);
+    }
+  }
+}
+
+void
+Meter::deserialize(SnapshotReader *in) {
+  auto lock = unique_lock();
+  configured = in->read_u8();
+  if (configured) {
+    for (size_t i = 0; i < rates.size(); i++) {
+      rate_config_t config;
+      config.info_rate = in->read_double();
+      config.burst_size = in->read_u64();
+      set_rate(i, config);
+    }
+  }
+}
+
 void
 Meter::reset_global_clock() {
   time_init = Meter::clock::now();
@@ -185,4 +212,19 @@ MeterArray::deserialize(std::istream *in) {
   for (auto &m : meters) m.deserialize(in);
 }
 
+void
+MeterArray::serialize(SnapshotWriter *out) const {
+  out->write_u32(static_cast<uint32_t>(meters.size()));
+  for (const auto &m : meters) m.serialize(out);
+}
+
+void
+MeterArray::deserialize(SnapshotReader *in) {
+  if (in->read_u32() != meters.size()) {
+    in->set_failed();
+    return;
+  }
+  for (auto &m : meters) m.deserialize(in);
+}
+
 }  // namespace bm
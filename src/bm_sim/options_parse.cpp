@@ -19,13 +19,17 @@
  */
 
 #include <bm/bm_sim/options_parse.h>
+#include <bm/bm_sim/dev_mgr.h>
 #include <bm/bm_sim/event_logger.h>
 #include <bm/bm_sim/logger.h>
 #include <bm/bm_sim/P4Objects.h>
+#include <bm/bm_sim/thread_affinity.h>
 
 #include <boost/filesystem.hpp>
 #include <boost/program_options.hpp>
 
+#include <algorithm>  // std::replace
+#include <map>
 #include <vector>
 #include <string>
 #include <iostream>
@@ -48,6 +52,65 @@ struct interface {
   uint32_t port{};
 };
 
+namespace {
+
+// <port-num>:<key>=<value>[,<key>=<value>...], see the --traffic-gen help
+// string; the values are copied as is into the port extras, except for '+',
+// which is replaced with ','
+bool
+parse_traffic_gen(
+    const std::string &v,
+    std::map<uint32_t, std::map<std::string, std::string> > *traffic_ports) {
+  static const std::map<std::string, std::string> keys = {
+    {"rate", DevMgrIface::kPortExtraTrafficGen},
+    {"flows", DevMgrIface::kPortExtraTrafficGenFlows},
+    {"size", DevMgrIface::kPortExtraTrafficGenSize},
+    {"randomize", DevMgrIface::kPortExtraTrafficGenRandomize},
+    {"count", DevMgrIface::kPortExtraTrafficGenCount}};
+  auto colon = v.find(':');
+  int port = -1;
+  try {
+    size_t pos;
+    port = std::stoi(v.substr(0, colon), &pos);
+    if (pos != v.substr(0, colon).size()) port = -1;
+  } catch (...) { }
+  if (port < 0) return false;
+  std::map<std::string, std::string> extras;
+  extras[DevMgrIface::kPortExtraTrafficGen] = "fast";
+  std::istringstream stream(
+      (colon == std::string::npos) ? "" : v.substr(colon + 1));
+  std::string param;
+  while (std::getline(stream, param, ',')) {
+    auto eq = param.find('=');
+    if (eq == std::string::npos) return false;
+    auto it = keys.find(param.substr(0, eq));
+    if (it == keys.end()) return false;
+    auto value = param.substr(eq + 1);
+    std::replace(value.begin(), value.end(), '+', ',');
+    extras[it->second] = value;
+  }
+  (*traffic_ports)[port].insert(extras.begin(), extras.end());
+  return true;
+}
+
+#ifdef BMTHRIFT_ON
+bool
+check_thrift_server_options(const std::string &type, int workers,
+                            std::ostream *outstream) {
+  if (type != "threaded" && type != "thread-pool" && type != "nonblocking") {
+    *outstream << "Error: invalid value '" << type << "' for --thrift-server\n";
+    return false;
+  }
+  if (workers <= 0) {
+    *outstream << "Error: --thrift-workers needs to be a positive integer\n";
+    return false;
+  }
+  return true;
+}
+#endif
+
+}  // namespace
+
 void validate(boost::any& v,  // NOLINT(runtime/references)
               const std::vector<std::string> &values,
               interface* /* target_type */,
@@ -98,18 +161,73 @@ OptionsParser::parse(int argc, char *argv[], TargetParserIface *tp,
        "Generate pcap files for interfaces. "
        "Argument is optional and is the directory where pcap files should be "
        "written. If omitted, files will be written in current directory.")
+      ("pcapng", "With --pcap, capture the packets of all interfaces to a "
+       "single pcapng file (device_<device-id>.pcapng), in which each "
+       "interface has its own interface id and the direction of each packet "
+       "is recorded, instead of one pcap file per interface and direction")
+      ("pcap-rotate-size", po::value<uint64_t>(),
+       "With --pcap, start a new capture file when the current one reaches "
+       "this size (in MB)")
+      ("pcap-rotate-interval", po::value<uint64_t>(),
+       "With --pcap, start a new capture file when the current one has been "
+       "open for this many seconds")
       ("use-files", po::value<int>(), "Read/write packets from files "
        "(interface X corresponds to two files X_in.pcap and X_out.pcap). "
        "Argument is the time to wait (in seconds) before starting to process "
        "the packet files.")
-#ifdef BMNANOMSG_ON
+      ("replay-rate", po::value<std::string>(),
+       "With --use-files, rate at which the input files are replayed: 'fast' "
+       "(as fast as possible, the default), 'timed' (respect the timestamps "
+       "of the packets), '<N>pps' or '<N>bps' (N can have a k, M or G "
+       "suffix). The files are memory-mapped and packets from all the files "
+       "are interleaved according to their timestamps")
+      ("replay-loops", po::value<unsigned int>(),
+       "With --use-files, number of times the input files are replayed "
+       "(default is 1, 0 means forever)")
+      ("use-af-packet", "Send / receive packets on interfaces using AF_PACKET "
+       "sockets with memory-mapped rings instead of libpcap (Linux only)")
+      ("af-xdp", po::value<std::vector<std::string> >()->composing(),
+       "<port-num>:<mode>[:<queue>]; send / receive packets on the interface "
+       "attached as <port-num> using an AF_XDP socket bound to NIC queue "
+       "<queue> (default 0) instead of libpcap (Linux only). <mode> is 'skb' "
+       "(generic XDP, works with any interface), 'drv' (native XDP) or 'zc' "
+       "(native XDP with zero-copy). Can appear multiple times")
+      ("traffic-gen", po::value<std::vector<std::string> >()->composing(),
+       "<port-num>:<key>=<value>[,<key>=<value>...]; the port (which still "
+       "needs to be given with --interface, e.g. -i 1@gen1) generates "
+       "Ethernet / IPv4 / UDP packets in-process. Keys are 'rate' ('fast', "
+       "the default, '<N>pps' or '<N>bps', N can have a k, M or G suffix), "
+       "'flows' (number of flows, default 1), 'size' ('<N>', '<min>-<max>' or "
+       "'imix', default 64), 'randomize' (fields which get a random value in "
+       "each packet, separated by '+', among src_mac, dst_mac, src_ip, dst_ip, "
+       "src_port and dst_port) and 'count' (number of packets to generate, "
+       "default is no limit). Can appear multiple times")
+      ("traffic-sink", po::value<std::vector<uint32_t> >()->composing(),
+       "<port-num>; packets sent to the port (which still needs to be given "
+       "with --interface) are counted and dropped, and their latency is "
+       "measured if they come from a --traffic-gen port. Throughput and "
+       "latency are logged every second. Can appear multiple times")
+      ("rx-threads", po::value<int>(),
+       "Number of threads receiving packets from the interfaces when using "
+       "libpcap (default is 1); each interface is handled by a single thread")
       ("packet-in", po::value<std::string>(),
-       "Enable receiving packet on this (nanomsg) socket. "
-       "The --interface options will be ignored.")
-#endif
+       "Enable receiving packet on this (nanomsg) socket, or through "
+       "shared-memory rings set up over a Unix socket if the address is "
+       "shm://<path>. The --interface options will be ignored.")
 #ifdef BMTHRIFT_ON
       ("thrift-port", po::value<int>(),
        "TCP port on which to run the Thrift runtime server")
+      ("thrift-server", po::value<std::string>(),
+       "Type of Thrift runtime server: 'threaded' (the default, one thread per "
+       "connection), 'thread-pool' (connections are served by a bounded pool "
+       "of threads; each open connection holds a worker until it is closed, "
+       "so with N workers the N+1th concurrent client waits for one of the "
+       "others to disconnect) or 'nonblocking' (a single I/O "
+       "thread dispatches requests to a bounded pool of workers; clients need "
+       "to use the framed transport, e.g. runtime_CLI.py --thrift-framed)")
+      ("thrift-workers", po::value<int>(),
+       "Number of worker threads for the 'thread-pool' and 'nonblocking' "
+       "Thrift servers (default is 4)")
 #endif
       ("device-id", po::value<device_id_t>(),
        "Device ID, used to identify the device in IPC messages (default 0)")
@@ -150,6 +268,18 @@ OptionsParser::parse(int argc, char *argv[], TargetParserIface *tp,
        "<major>.<minor>; all bmv2 JSON versions with the same <major> version "
        "number are also supported.")
       ("no-p4", "Enable the switch to start without an inout configuration")
+      ("cpu-affinity",
+       po::value<std::vector<std::string> >()->composing(),
+       "<thread class>:<cpu list>; pin the threads of the given class to the "
+       "given CPUs (e.g. 'egress:2-5'), one CPU per thread in round-robin "
+       "order. Can appear multiple times. Thread classes are: ingress, "
+       "egress, transmit, packet_in, port_rx, learning, ageing.")
+      ("numa-node",
+       po::value<std::vector<std::string> >()->composing(),
+       "<thread class>:<node>; run the threads of the given class on the "
+       "given NUMA node and allocate their memory from it (only the memory "
+       "allocated by these threads; the ingress thread also allocates the "
+       "PHVs). Can appear multiple times.")
       ;  // NOLINT(whitespace/semicolon)
 
   po::options_description hidden;
@@ -343,6 +473,20 @@ OptionsParser::parse(int argc, char *argv[], TargetParserIface *tp,
     }
   }
 
+  if (vm.count("pcapng") || vm.count("pcap-rotate-size") ||
+      vm.count("pcap-rotate-interval")) {
+    if (!pcap) {
+      outstream << "Error: --pcapng, --pcap-rotate-size and "
+                << "--pcap-rotate-interval require --pcap\n";
+      exit(1);
+    }
+    pcapng = vm.count("pcapng") > 0;
+    if (vm.count("pcap-rotate-size"))
+      pcap_rotate_size = vm["pcap-rotate-size"].as<uint64_t>() << 20;
+    if (vm.count("pcap-rotate-interval"))
+      pcap_rotate_interval = vm["pcap-rotate-interval"].as<uint64_t>();
+  }
+
   if (vm.count("use-files")) {
     use_files = true;
     wait_time = vm["use-files"].as<int>();
@@ -350,20 +494,109 @@ OptionsParser::parse(int argc, char *argv[], TargetParserIface *tp,
       wait_time = 0;
   }
 
-#ifdef BMNANOMSG_ON
+  if (vm.count("replay-rate") || vm.count("replay-loops")) {
+    if (!use_files) {
+      outstream << "Error: --replay-rate and --replay-loops require "
+                << "--use-files\n";
+      exit(1);
+    }
+    if (vm.count("replay-rate") &&
+        !PcapReplay::parse_rate(vm["replay-rate"].as<std::string>(),
+                                &replay_config)) {
+      outstream << "Error: invalid value '"
+                << vm["replay-rate"].as<std::string>()
+                << "' for --replay-rate\n";
+      exit(1);
+    }
+    if (vm.count("replay-loops"))
+      replay_config.loops = vm["replay-loops"].as<unsigned int>();
+  }
+
   if (vm.count("packet-in")) {
     packet_in = true;
     packet_in_addr = vm["packet-in"].as<std::string>();
     // very important to clear interface list
     ifaces.clear();
   }
-#endif
 
   if (use_files && packet_in) {
     outstream << "Error: --use-files and --packet-in are exclusive\n";
     exit(1);
   }
 
+  if (vm.count("use-af-packet")) {
+    if (use_files || packet_in) {
+      outstream << "Error: --use-af-packet cannot be used with --use-files or "
+                << "--packet-in\n";
+      exit(1);
+    }
+    use_af_packet = true;
+  }
+
+  if (vm.count("af-xdp")) {
+    if (use_files || packet_in || use_af_packet) {
+      outstream << "Error: --af-xdp cannot be used with --use-files, "
+                << "--packet-in or --use-af-packet\n";
+      exit(1);
+    }
+    for (const auto &v : vm["af-xdp"].as<std::vector<std::string> >()) {
+      std::istringstream stream(v);
+      std::string port_str, mode, queue_str;
+      std::getline(stream, port_str, ':');
+      std::getline(stream, mode, ':');
+      std::getline(stream, queue_str);
+      int port = -1, queue_id = queue_str.empty() ? 0 : -1;
+      try {
+        size_t pos;
+        port = std::stoi(port_str, &pos);
+        if (pos != port_str.size()) port = -1;
+        if (!queue_str.empty()) {
+          queue_id = std::stoi(queue_str, &pos);
+          if (pos != queue_str.size()) queue_id = -1;
+        }
+      } catch (...) { }
+      if (port < 0 || queue_id < 0 ||
+          (mode != "skb" && mode != "drv" && mode != "zc")) {
+        outstream << "Error: invalid value '" << v << "' for --af-xdp, "
+                  << "expected <port-num>:<skb|drv|zc>[:<queue>]\n";
+        exit(1);
+      }
+      af_xdp_modes[port] = mode;
+      af_xdp_queues[port] = queue_id;
+    }
+  }
+
+  if (vm.count("traffic-gen") || vm.count("traffic-sink")) {
+    if (use_files || packet_in || use_af_packet) {
+      outstream << "Error: --traffic-gen and --traffic-sink cannot be used "
+                << "with --use-files, --packet-in or --use-af-packet\n";
+      exit(1);
+    }
+  }
+
+  if (vm.count("traffic-gen")) {
+    for (const auto &v : vm["traffic-gen"].as<std::vector<std::string> >()) {
+      if (!parse_traffic_gen(v, &traffic_ports)) {
+        outstream << "Error: invalid value '" << v << "' for --traffic-gen, "
+                  << "expected <port-num>:<key>=<value>[,<key>=<value>...]\n";
+        exit(1);
+      }
+    }
+  }
+
+  if (vm.count("traffic-sink")) {
+    for (auto port : vm["traffic-sink"].as<std::vector<uint32_t> >())
+      traffic_ports[port][DevMgrIface::kPortExtraTrafficSink] = "1";
+  }
+
+  if (vm.count("rx-threads")) {
+    rx_threads = vm["rx-threads"].as<int>();
+    if (rx_threads <= 0) {
+      outstream << "Error: --rx-threads needs to be a positive integer\n";
+      exit(1);
+    }
+  }
+
   if (vm.count("debugger-addr")) {
     debugger = true;
     debugger_addr = vm["debugger-addr"].as<std::string>();
@@ -383,8 +616,66 @@ OptionsParser::parse(int argc, char *argv[], TargetParserIface *tp,
               << std::endl;
     thrift_port = default_thrift_port;
   }
+
+  if (vm.count("thrift-server"))
+    thrift_server_type = vm["thrift-server"].as<std::string>();
+  if (vm.count("thrift-workers"))
+    thrift_workers = vm["thrift-workers"].as<int>();
+  if (!check_thrift_server_options(thrift_server_type, thrift_workers,
+                                   &outstream)) {
+    exit(1);
+  }
 #endif
 
+  auto split_thread_option = [&outstream](const std::string &option,
+                                          const std::string &v,
+                                          std::string *thread_class) {
+    auto colon = v.find(':');
+    if (colon == std::string::npos) {
+      outstream << "Invalid value '" << v << "' for '--" << option
+                << "', expected <thread class>:<value>\n";
+      exit(1);
+    }
+    *thread_class = v.substr(0, colon);
+    if (!ThreadAffinity::is_valid_thread_class(*thread_class)) {
+      outstream << "Unknown thread class '" << *thread_class << "' for '--"
+                << option << "'\n";
+      exit(1);
+    }
+    return v.substr(colon + 1);
+  };
+
+  if (vm.count("cpu-affinity")) {
+    for (const auto &v : vm["cpu-affinity"].as<std::vector<std::string> >()) {
+      std::string thread_class;
+      auto cpu_list = split_thread_option("cpu-affinity", v, &thread_class);
+      std::vector<int> cpus;
+      if (!ThreadAffinity::parse_cpu_list(cpu_list, &cpus)) {
+        outstream << "Invalid CPU list '" << cpu_list << "'\n";
+        exit(1);
+      }
+      thread_cpus[thread_class] = cpus;
+    }
+  }
+
+  if (vm.count("numa-node")) {
+    for (const auto &v : vm["numa-node"].as<std::vector<std::string> >()) {
+      std::string thread_class;
+      auto node_str = split_thread_option("numa-node", v, &thread_class);
+      int node = -1;
+      try {
+        size_t pos;
+        node = std::stoi(node_str, &pos);
+        if (pos != node_str.size()) node = -1;
+      } catch (...) { }
+      if (node < 0) {
+        outstream << "Invalid NUMA node '" << node_str << "'\n";
+        exit(1);
+      }
+      thread_numa_nodes[thread_class] = node;
+    }
+  }
+
   if (vm.count("restore-state")) {
     state_file_path = vm["restore-state"].as<std::string>();
   }
@@ -20,6 +20,8 @@
 
 #include <bm/bm_sim/packet.h>
 #include <bm/bm_sim/phv.h>
+#include <bm/bm_sim/field_lists.h>
+#include <bm/bm_sim/P4Objects.h>
 
 #include <algorithm>  // for swap
 #include <atomic>
@@ -91,14 +93,16 @@ Packet::set_ingress_ts() {
 
 Packet::Packet(cxt_id_t cxt_id, port_t ingress_port, packet_id_t id,
                copy_id_t copy_id, int ingress_length, PacketBuffer &&buffer,
-               PHVSourceIface *phv_source)
+               PHVSourceIface *phv_source,
+               std::shared_ptr<P4Objects> p4objects)
     : cxt_id(cxt_id), ingress_port(ingress_port), packet_id(id),
       copy_id(copy_id), ingress_length(ingress_length),
-      buffer(std::move(buffer)), phv_source(phv_source) {
+      buffer(std::move(buffer)), p4objects(std::move(p4objects)),
+      phv_source(phv_source) {
   assert(phv_source);
   update_signature();
   set_ingress_ts();
-  phv = phv_source->get(cxt_id);
+  phv = get_phv_from_source();
   phv->set_packet_id(packet_id, copy_id);
   DEBUGGER_PACKET_IN(PacketId::make(packet_id, copy_id), ingress_port);
 }
@@ -119,6 +123,16 @@ Packet::~Packet() {
   }
 }
 
+std::unique_ptr<PHV>
+Packet::get_phv_from_source() const {
+  std::unique_ptr<PHV> new_phv = phv_source->get(cxt_id);
+  // during a config swap, the pool moves on to the new configuration before
+  // the new packets do, see SwitchWContexts::do_swap()
+  if (p4objects && new_phv->get_factory() != &p4objects->get_phv_factory())
+    new_phv = p4objects->get_phv_factory().create();
+  return new_phv;
+}
+
 void
 Packet::change_context(cxt_id_t new_cxt) {
   if (cxt_id == new_cxt) return;
@@ -126,8 +140,22 @@ Packet::change_context(cxt_id_t new_cxt) {
   phv->reset();
   phv->reset_header_stacks();
   phv_source->release(cxt_id, std::move(phv));
-  phv = phv_source->get(new_cxt);
+  p4objects = nullptr;
   cxt_id = new_cxt;
+  phv = get_phv_from_source();
+}
+
+void
+Packet::reset_phv(FieldList *preserved) {
+  assert(phv);
+  std::unique_ptr<PHV> new_phv = get_phv_from_source();
+  new_phv->set_packet_id(packet_id, copy_id);
+  new_phv->reset_metadata();
+  if (preserved) preserved->copy_fields_between_phvs(new_phv.get(), phv.get());
+  phv->reset();
+  phv->reset_header_stacks();
+  phv_source->release(cxt_id, std::move(phv));
+  phv = std::move(new_phv);
 }
 
 /* It is important to understand that with NRVO, the following are "equivalent"
@@ -152,7 +180,7 @@ Packet
 Packet::clone_with_phv() const {
   copy_id_t new_copy_id = copy_id_gen->add_one(packet_id);
   Packet pkt(cxt_id, ingress_port, packet_id, new_copy_id, ingress_length,
-             buffer.clone(buffer.get_data_size()), phv_source);
+             buffer.clone(buffer.get_data_size()), phv_source, p4objects);
   pkt.phv->copy_headers(*phv);
   // return std::move(pkt);
   // Enable NRVO
@@ -168,7 +196,7 @@ Packet
 Packet::clone_with_phv_reset_metadata() const {
   copy_id_t new_copy_id = copy_id_gen->add_one(packet_id);
   Packet pkt(cxt_id, ingress_port, packet_id, new_copy_id, ingress_length,
-             buffer.clone(buffer.get_data_size()), phv_source);
+             buffer.clone(buffer.get_data_size()), phv_source, p4objects);
   // TODO(antonin): optimize this
   pkt.phv->copy_headers(*phv);
   pkt.phv->reset_metadata();
@@ -186,7 +214,8 @@ Packet
 Packet::clone_choose_context(cxt_id_t new_cxt) const {
   copy_id_t new_copy_id = copy_id_gen->add_one(packet_id);
   Packet pkt(new_cxt, ingress_port, packet_id, new_copy_id, ingress_length,
-             buffer.clone(buffer.get_data_size()), phv_source);
+             buffer.clone(buffer.get_data_size()), phv_source,
+             (new_cxt == cxt_id) ? p4objects : nullptr);
   // return std::move(pkt);
   // Enable NRVO
   return pkt;
@@ -218,6 +247,7 @@ Packet::Packet(Packet &&other) noexcept
       ingress_ts(other.ingress_ts), ingress_ts_ms(other.ingress_ts_ms),
   phv_source(other.phv_source), registers(other.registers) {
   buffer = std::move(other.buffer);
+  p4objects = std::move(other.p4objects);
   phv = std::move(other.phv);
 }
 
@@ -237,6 +267,8 @@ Packet::operator=(Packet &&other) noexcept {
   registers = other.registers;
 
   std::swap(buffer, other.buffer);
+  // the PHV and the configuration it comes from go together
+  std::swap(p4objects, other.p4objects);
   std::swap(phv, other.phv);
 
   return *this;
@@ -0,0 +1,650 @@
+/* Copyright 2013-present Barefoot Networks, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Antonin Bas (antonin@barefootnetworks.com)
+ *
+ */
+
+#include <bm/bm_sim/logger.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "pcap_capture.h"
+
+namespace bm {
+
+constexpr size_t PcapCapture::kDefaultRingSize;
+constexpr PcapCapture::port_t PcapCapture::kMaxPorts;
+
+namespace {
+
+// Each record in the ring starts with this header and records are aligned to
+// the size of the header, which guarantees that there is always enough room
+// for a padding record at the end of the ring.
+struct RecordHdr {
+  // written last by the producer, reset to kRecordFree by the consumer
+  uint32_t state;
+  // size of the record, including the header and the alignment padding
+  uint32_t size;
+  uint64_t ts_ns;
+  uint32_t port_num;
+  uint32_t caplen;
+  uint32_t len;
+  uint32_t dir;
+};
+
+static_assert(sizeof(RecordHdr) == 32, "Unexpected size for RecordHdr");
+
+constexpr uint32_t kRecordFree = 0;
+constexpr uint32_t kRecordPacket = 1;
+constexpr uint32_t kRecordPadding = 2;
+constexpr size_t kRecordAlign = sizeof(RecordHdr);
+
+constexpr size_t kMinRingSize = 1u << 16;
+constexpr uint32_t kSnapLen = 65535;
+constexpr uint32_t kLinkTypeEthernet = 1;
+// the consumer gives space back to the producers at least that often
+constexpr size_t kRecordsPerTailUpdate = 64;
+// the data buffered for a file is written when it reaches kWriteBlockSize, or
+// at the latest kWriteInterval after the previous write
+constexpr size_t kWriteBlockSize = 1u << 20;
+constexpr std::chrono::milliseconds kWriteInterval(500);
+constexpr std::chrono::milliseconds kDropReportInterval(1000);
+// how long the writer thread waits when the ring is empty
+constexpr std::chrono::milliseconds kIdleWait(1);
+
+// pcapng block types and options
+constexpr uint32_t kPcapngSHB = 0x0A0D0D0A;
+constexpr uint32_t kPcapngIDB = 0x00000001;
+constexpr uint32_t kPcapngEPB = 0x00000006;
+constexpr uint32_t kPcapngByteOrderMagic = 0x1A2B3C4D;
+constexpr uint16_t kPcapngOptEnd = 0;
+constexpr uint16_t kPcapngOptIfName = 2;
+constexpr uint16_t kPcapngOptIfTsresol = 9;
+constexpr uint16_t kPcapngOptEpbFlags = 2;
+constexpr uint32_t kPcapngEpbInbound = 1;
+constexpr uint32_t kPcapngEpbOutbound = 2;
+// fixed size of an EPB, including the epb_flags option
+constexpr size_t kPcapngEPBOverhead = 44;
+
+template <typename T>
+T
+load_acquire(T *ptr) {
+  return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+
+template <typename T>
+void
+store_release(T *ptr, T v) {
+  __atomic_store_n(ptr, v, __ATOMIC_RELEASE);
+}
+
+size_t
+round_up(size_t v, size_t align) {
+  return (v + align - 1) / align * align;
+}
+
+template <typename T>
+void
+append(std::vector<char> *buffer, const T &v) {
+  const char *p = reinterpret_cast<const char *>(&v);
+  buffer->insert(buffer->end(), p, p + sizeof(v));
+}
+
+// pcapng data and options are padded to 32 bits
+void
+append_padded(std::vector<char> *buffer, const char *data, size_t len) {
+  buffer->insert(buffer->end(), data, data + len);
+  buffer->insert(buffer->end(), round_up(len, 4) - len, 0);
+}
+
+bool
+ends_with(const std::string &s, const std::string &suffix) {
+  return s.size() >= suffix.size() &&
+      s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// "dir/X_in.pcap" -> "dir/X_in.<index>.pcap"
+std::string
+rotated_path(const std::string &path, unsigned int index) {
+  if (index == 0) return path;
+  auto slash = path.find_last_of('/');
+  auto dot = path.find_last_of('.');
+  auto base = (slash == std::string::npos) ? 0 : slash + 1;
+  if (dot == std::string::npos || dot <= base)
+    return path + "." + std::to_string(index);
+  return path.substr(0, dot) + "." + std::to_string(index) + path.substr(dot);
+}
+
+bool
+parse_extra(const DevMgrIface::PortExtras &port_extras, const char *key,
+            uint64_t *v) {
+  *v = 0;
+  auto it = port_extras.find(key);
+  if (it == port_extras.end()) return true;
+  try {
+    size_t pos;
+    *v = std::stoull(it->second, &pos);
+    return pos == it->second.size();
+  } catch (...) {
+    return false;
+  }
+}
+
+}  // namespace
+
+class PcapCapture::Imp {
+ public:
+  explicit Imp(size_t ring_size) {
+    size = kMinRingSize;
+    while (size < ring_size) size <<= 1;
+    ring.reset(new char[size]());
+    max_caplen = std::min(kSnapLen, static_cast<uint32_t>(size / 4));
+    port_flags.reset(new std::atomic<uint8_t>[kMaxPorts]());
+    writer_thread = std::thread(&Imp::writer_loop, this);
+  }
+
+  ~Imp() {
+    {
+      Lock lock(mutex);
+      stop = true;
+    }
+    writer_cv.notify_one();
+    writer_thread.join();
+    Lock lock(mutex);
+    drain_all();
+    for (auto &p : files) close_file(p.second.get());
+    report_drops();
+  }
+
+  bool port_add(port_t port_num, const std::string &iface_name,
+                const PortExtras &port_extras) {
+    if (port_num >= kMaxPorts) {
+      Logger::get()->error("Cannot capture packets for port {}, port numbers "
+                           "must be smaller than {}", port_num, kMaxPorts);
+      return false;
+    }
+    uint64_t rotate_size, rotate_interval;
+    if (!parse_extra(port_extras, DevMgrIface::kPortExtraPcapRotateSize,
+                     &rotate_size) ||
+        !parse_extra(port_extras, DevMgrIface::kPortExtraPcapRotateInterval,
+                     &rotate_interval)) {
+      Logger::get()->error("Invalid pcap rotation settings for port {}",
+                           port_num);
+      return false;
+    }
+
+    Lock lock(mutex);
+    if (ports.find(port_num) != ports.end()) return false;
+    PortFiles port_files;
+    const char *keys[2] = {DevMgrIface::kPortExtraInPcap,
+                           DevMgrIface::kPortExtraOutPcap};
+    uint8_t flags = 0;
+    for (int d = 0; d < 2; d++) {
+      auto it = port_extras.find(keys[d]);
+      if (it == port_extras.end()) continue;
+      auto *file = get_file(it->second, rotate_size, rotate_interval);
+      if (!file) {
+        release_files(port_files);
+        return false;
+      }
+      file->refs++;
+      port_files.files[d] = file;
+      flags |= 1u << d;
+      // a pcapng file used for both directions only needs one interface
+      if (d == 1 && port_files.files[0] == file)
+        port_files.if_ids[d] = port_files.if_ids[0];
+      else if (file->pcapng)
+        port_files.if_ids[d] = add_interface(file, iface_name);
+    }
+    ports.emplace(port_num, port_files);
+    port_flags[port_num].store(flags, std::memory_order_release);
+    return true;
+  }
+
+  void port_remove(port_t port_num) {
+    if (port_num < kMaxPorts)
+      port_flags[port_num].store(0, std::memory_order_release);
+    Lock lock(mutex);
+    auto it = ports.find(port_num);
+    if (it == ports.end()) return;
+    drain_all();
+    release_files(it->second);
+    ports.erase(it);
+  }
+
+  void capture(port_t port_num, Direction dir, const char *data, int len) {
+    if (port_num >= kMaxPorts || len <= 0) return;
+    auto d = static_cast<uint32_t>(dir);
+    if (!(port_flags[port_num].load(std::memory_order_acquire) & (1u << d)))
+      return;
+    auto caplen = std::min(static_cast<uint32_t>(len), max_caplen);
+    auto record_size = round_up(sizeof(RecordHdr) + caplen, kRecordAlign);
+    uint64_t pos;
+    if (!reserve(record_size, &pos)) {
+      drops.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    auto *hdr = record_at(pos);
+    hdr->size = static_cast<uint32_t>(record_size);
+    hdr->ts_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    hdr->port_num = port_num;
+    hdr->caplen = caplen;
+    hdr->len = static_cast<uint32_t>(len);
+    hdr->dir = d;
+    std::memcpy(hdr + 1, data, caplen);
+    store_release(&hdr->state, kRecordPacket);
+  }
+
+  void flush() {
+    Lock lock(mutex);
+    drain_all();
+    for (auto &p : files) write_out(p.second.get());
+  }
+
+  uint64_t get_drops() const {
+    return drops.load(std::memory_order_relaxed);
+  }
+
+ private:
+  using Mutex = std::mutex;
+  using Lock = std::unique_lock<std::mutex>;
+  using clock = std::chrono::steady_clock;
+
+  // only accessed with the mutex held
+  struct File {
+    std::string path{};
+    bool pcapng{false};
+    uint64_t rotate_size{0};
+    uint64_t rotate_interval{0};
+    int fd{-1};
+    unsigned int index{0};
+    // size of the current file, including the data which is still buffered
+    uint64_t size{0};
+    uint64_t nb_packets{0};
+    clock::time_point opened{};
+    std::vector<char> buffer{};
+    // pcapng interfaces, the index in the vector is the interface id
+    std::vector<std::string> interfaces{};
+    int refs{0};
+  };
+
+  struct PortFiles {
+    File *files[2]{nullptr, nullptr};
+    uint32_t if_ids[2]{0, 0};
+  };
+
+  RecordHdr *record_at(uint64_t pos) const {
+    return reinterpret_cast<RecordHdr *>(ring.get() + (pos & (size - 1)));
+  }
+
+  // Reserves record_size contiguous bytes in the ring for the calling thread;
+  // if there is not enough room before the end of the ring, a padding record
+  // is inserted and the record starts at the beginning of the ring.
+  bool reserve(size_t record_size, uint64_t *pos) {
+    uint64_t h = head.load(std::memory_order_relaxed);
+    size_t padding;
+    do {
+      size_t contiguous = size - (h & (size - 1));
+      padding = (contiguous < record_size) ? contiguous : 0;
+      if (h + padding + record_size - tail.load(std::memory_order_acquire) >
+          size)
+        return false;
+    } while (!head.compare_exchange_weak(h, h + padding + record_size,
+                                         std::memory_order_relaxed));
+    if (padding > 0) {
+      auto *hdr = record_at(h);
+      hdr->size = static_cast<uint32_t>(padding);
+      store_release(&hdr->state, kRecordPadding);
+      h += padding;
+    }
+    *pos = h;
+    return true;
+  }
+
+  // Consumes all the committed records at the tail of the ring and returns how
+  // many were consumed. Must be called with the mutex held.
+  size_t drain() {
+    uint64_t t = tail.load(std::memory_order_relaxed);
+    size_t nb_records = 0;
+    while (true) {
+      auto *hdr = record_at(t);
+      auto state = load_acquire(&hdr->state);
+      if (state == kRecordFree) break;
+      auto record_size = hdr->size;
+      if (state == kRecordPacket)
+        write_packet(*hdr, reinterpret_cast<const char *>(hdr + 1));
+      // a future record may start at any aligned offset of this one
+      auto *base = reinterpret_cast<char *>(hdr);
+      for (size_t offset = 0; offset < record_size; offset += kRecordAlign)
+        reinterpret_cast<RecordHdr *>(base + offset)->state = kRecordFree;
+      t += record_size;
+      if (++nb_records % kRecordsPerTailUpdate == 0)
+        tail.store(t, std::memory_order_release);
+    }
+    tail.store(t, std::memory_order_release);
+    return nb_records;
+  }
+
+  // Consumes all the records reserved so far, waiting for the producers to
+  // commit them if needed. Must be called with the mutex held.
+  void drain_all() {
+    uint64_t target = head.load(std::memory_order_acquire);
+    while (tail.load(std::memory_order_relaxed) < target) {
+      if (drain() == 0) std::this_thread::yield();
+    }
+  }
+
+  void writer_loop() {
+    auto last_write = clock::now();
+    auto last_drop_report = last_write;
+    Lock lock(mutex);
+    while (!stop) {
+      size_t nb_records = drain();
+      auto now = clock::now();
+      if (now - last_write >= kWriteInterval) {
+        for (auto &p : files) {
+          auto *file = p.second.get();
+          if (file->rotate_interval > 0 && file->nb_packets > 0 &&
+              now - file->opened >=
+              std::chrono::seconds(file->rotate_interval)) {
+            rotate(file);
+          } else {
+            write_out(file);
+          }
+        }
+        last_write = now;
+      }
+      if (now - last_drop_report >= kDropReportInterval) {
+        report_drops();
+        last_drop_report = now;
+      }
+      if (nb_records == 0)
+        writer_cv.wait_for(lock, kIdleWait, [this]{ return stop; });
+    }
+  }
+
+  void report_drops() {
+    auto nb_drops = drops.load(std::memory_order_relaxed);
+    if (nb_drops == reported_drops) return;
+    Logger::get()->warn("Pcap capture ring full, {} packets were not captured "
+                        "({} since the beginning)",
+                        nb_drops - reported_drops, nb_drops);
+    reported_drops = nb_drops;
+  }
+
+  File *get_file(const std::string &path, uint64_t rotate_size,
+                 uint64_t rotate_interval) {
+    auto it = files.find(path);
+    if (it != files.end()) return it->second.get();
+    std::unique_ptr<File> file(new File());
+    file->path = path;
+    file->pcapng = ends_with(path, ".pcapng");
+    file->rotate_size = rotate_size;
+    file->rotate_interval = rotate_interval;
+    if (!open_file(file.get())) return nullptr;
+    auto *ptr = file.get();
+    files.emplace(path, std::move(file));
+    return ptr;
+  }
+
+  void release_files(const PortFiles &port_files) {
+    for (int d = 0; d < 2; d++) {
+      auto *file = port_files.files[d];
+      if (!file || --file->refs > 0) continue;
+      close_file(file);
+      auto path = file->path;
+      files.erase(path);
+    }
+  }
+
+  bool open_file(File *file) {
+    auto path = rotated_path(file->path, file->index);
+    file->fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                    0644);
+    if (file->fd < 0) {
+      Logger::get()->error("Cannot open pcap file '{}': {}",
+                           path, std::strerror(errno));
+      return false;
+    }
+    file->opened = clock::now();
+    file->nb_packets = 0;
+    if (file->pcapng) {
+      append_pcapng_shb(&file->buffer);
+      for (const auto &name : file->interfaces)
+        append_pcapng_idb(&file->buffer, name);
+    } else {
+      append_pcap_header(&file->buffer);
+    }
+    file->size = file->buffer.size();
+    return true;
+  }
+
+  void write_out(File *file) {
+    size_t offset = 0;
+    while (file->fd >= 0 && offset < file->buffer.size()) {
+      auto rc = write(file->fd, file->buffer.data() + offset,
+                      file->buffer.size() - offset);
+      if (rc < 0 && errno == EINTR) continue;
+      if (rc < 0) {
+        // the packets captured for this file from now on are discarded
+        Logger::get()->error("Cannot write to pcap file '{}': {}",
+                             rotated_path(file->path, file->index),
+                             std::strerror(errno));
+        close(file->fd);
+        file->fd = -1;
+        break;
+      }
+      offset += rc;
+    }
+    file->buffer.clear();
+  }
+
+  void close_file(File *file) {
+    write_out(file);
+    if (file->fd >= 0) close(file->fd);
+    file->fd = -1;
+  }
+
+  void rotate(File *file) {
+    close_file(file);
+    file->index++;
+    open_file(file);
+  }
+
+  uint32_t add_interface(File *file, const std::string &iface_name) {
+    file->interfaces.push_back(iface_name);
+    auto size_before = file->buffer.size();
+    append_pcapng_idb(&file->buffer, iface_name);
+    file->size += file->buffer.size() - size_before;
+    return static_cast<uint32_t>(file->interfaces.size() - 1);
+  }
+
+  void write_packet(const RecordHdr &hdr, const char *data) {
+    auto it = ports.find(hdr.port_num);
+    // the port may have been removed since the packet was captured
+    if (it == ports.end()) return;
+    auto *file = it->second.files[hdr.dir];
+    if (!file || file->fd < 0) return;
+    size_t packet_size = file->pcapng ?
+        kPcapngEPBOverhead + round_up(hdr.caplen, 4) : 16 + hdr.caplen;
+    if (file->rotate_size > 0 && file->nb_packets > 0 &&
+        file->size + packet_size > file->rotate_size) {
+      rotate(file);
+      if (file->fd < 0) return;
+    }
+    if (file->pcapng)
+      append_pcapng_epb(&file->buffer, hdr, it->second.if_ids[hdr.dir], data);
+    else
+      append_pcap_record(&file->buffer, hdr, data);
+    file->size += packet_size;
+    file->nb_packets++;
+    if (file->buffer.size() >= kWriteBlockSize) write_out(file);
+  }
+
+  static void append_pcap_header(std::vector<char> *buffer) {
+    append<uint32_t>(buffer, 0xa1b2c3d4);  // microsecond resolution
+    append<uint16_t>(buffer, 2);
+    append<uint16_t>(buffer, 4);
+    append<int32_t>(buffer, 0);
+    append<uint32_t>(buffer, 0);
+    append<uint32_t>(buffer, kSnapLen);
+    append<uint32_t>(buffer, kLinkTypeEthernet);
+  }
+
+  static void append_pcap_record(std::vector<char> *buffer,
+                                 const RecordHdr &hdr, const char *data) {
+    append<uint32_t>(buffer, static_cast<uint32_t>(hdr.ts_ns / 1000000000));
+    append<uint32_t>(buffer,
+                     static_cast<uint32_t>((hdr.ts_ns / 1000) % 1000000));
+    append<uint32_t>(buffer, hdr.caplen);
+    append<uint32_t>(buffer, hdr.len);
+    buffer->insert(buffer->end(), data, data + hdr.caplen);
+  }
+
+  static void append_pcapng_shb(std::vector<char> *buffer) {
+    append<uint32_t>(buffer, kPcapngSHB);
+    append<uint32_t>(buffer, 28);
+    append<uint32_t>(buffer, kPcapngByteOrderMagic);
+    append<uint16_t>(buffer, 1);
+    append<uint16_t>(buffer, 0);
+    append<int64_t>(buffer, -1);  // section length not specified
+    append<uint32_t>(buffer, 28);
+  }
+
+  static void append_pcapng_idb(std::vector<char> *buffer,
+                                const std::string &iface_name) {
+    // type, length, link type, reserved, snaplen, if_name (optional),
+    // if_tsresol, opt_endofopt, length
+    size_t name_opt_size = iface_name.empty() ?
+        0 : 4 + round_up(iface_name.size(), 4);
+    auto block_size = static_cast<uint32_t>(32 + name_opt_size);
+    append<uint32_t>(buffer, kPcapngIDB);
+    append<uint32_t>(buffer, block_size);
+    append<uint16_t>(buffer, static_cast<uint16_t>(kLinkTypeEthernet));
+    append<uint16_t>(buffer, 0);
+    append<uint32_t>(buffer, kSnapLen);
+    if (!iface_name.empty()) {
+      append<uint16_t>(buffer, kPcapngOptIfName);
+      append<uint16_t>(buffer, static_cast<uint16_t>(iface_name.size()));
+      append_padded(buffer, iface_name.data(), iface_name.size());
+    }
+    // timestamps are in nanoseconds
+    append<uint16_t>(buffer, kPcapngOptIfTsresol);
+    append<uint16_t>(buffer, 1);
+    const char tsresol[1] = {9};
+    append_padded(buffer, tsresol, sizeof(tsresol));
+    append<uint16_t>(buffer, kPcapngOptEnd);
+    append<uint16_t>(buffer, 0);
+    append<uint32_t>(buffer, block_size);
+  }
+
+  static void append_pcapng_epb(std::vector<char> *buffer,
+                                const RecordHdr &hdr, uint32_t if_id,
+                                const char *data) {
+    auto block_size = static_cast<uint32_t>(
+        kPcapngEPBOverhead + round_up(hdr.caplen, 4));
+    append<uint32_t>(buffer, kPcapngEPB);
+    append<uint32_t>(buffer, block_size);
+    append<uint32_t>(buffer, if_id);
+    append<uint32_t>(buffer, static_cast<uint32_t>(hdr.ts_ns >> 32));
+    append<uint32_t>(buffer, static_cast<uint32_t>(hdr.ts_ns));
+    append<uint32_t>(buffer, hdr.caplen);
+    append<uint32_t>(buffer, hdr.len);
+    append_padded(buffer, data, hdr.caplen);
+    append<uint16_t>(buffer, kPcapngOptEpbFlags);
+    append<uint16_t>(buffer, 4);
+    append<uint32_t>(buffer, (hdr.dir == 0) ?
+                     kPcapngEpbInbound : kPcapngEpbOutbound);
+    append<uint16_t>(buffer, kPcapngOptEnd);
+    append<uint16_t>(buffer, 0);
+    append<uint32_t>(buffer, block_size);
+  }
+
+  // the ring: head is where the next record will be reserved, tail is where
+  // the next record will be consumed; both only ever increase
+  std::unique_ptr<char[]> ring{nullptr};
+  size_t size{0};
+  uint32_t max_caplen{0};
+  std::atomic<uint64_t> head{0};
+  std::atomic<uint64_t> tail{0};
+  // bit 0: captured on ingress, bit 1: captured on egress
+  std::unique_ptr<std::atomic<uint8_t>[]> port_flags{nullptr};
+  std::atomic<uint64_t> drops{0};
+  uint64_t reported_drops{0};
+
+  Mutex mutex{};
+  std::map<std::string, std::unique_ptr<File> > files{};
+  std::map<port_t, PortFiles> ports{};
+  std::condition_variable writer_cv{};
+  bool stop{false};
+  std::thread writer_thread{};
+};
+
+PcapCapture::PcapCapture(size_t ring_size)
+    : pimp(new Imp(ring_size)) { }
+
+PcapCapture::~PcapCapture() = default;
+
+bool
+PcapCapture::is_requested(const PortExtras &port_extras) {
+  return port_extras.find(DevMgrIface::kPortExtraInPcap) != port_extras.end() ||
+      port_extras.find(DevMgrIface::kPortExtraOutPcap) != port_extras.end();
+}
+
+bool
+PcapCapture::port_add(port_t port_num, const std::string &iface_name,
+                      const PortExtras &port_extras) {
+  return pimp->port_add(port_num, iface_name, port_extras);
+}
+
+void
+PcapCapture::port_remove(port_t port_num) {
+  pimp->port_remove(port_num);
+}
+
+void
+PcapCapture::capture(port_t port_num, Direction dir, const char *data,
+                     int len) {
+  pimp->capture(port_num, dir, data, len);
+}
+
+void
+PcapCapture::flush() {
+  pimp->flush();
+}
+
+uint64_t
+PcapCapture::get_drops() const {
+  return pimp->get_drops();
+}
+
+}  // namespace bm
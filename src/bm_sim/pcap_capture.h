@@ -0,0 +1,96 @@
+/* Copyright 2013-present Barefoot Networks, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Antonin Bas (antonin@barefootnetworks.com)
+ *
+ */
+
+#ifndef BM_SIM_PCAP_CAPTURE_H_
+#define BM_SIM_PCAP_CAPTURE_H_
+
+#include <bm/bm_sim/dev_mgr.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace bm {
+
+// Captures the packets received / transmitted by the ports of a port manager
+// to pcap or pcapng files, without doing any file I/O on the datapath. The
+// datapath threads copy each packet, along with a timestamp, to a lock-free
+// ring shared by all the ports; a dedicated writer thread drains the ring and
+// writes the files in large blocks. When the ring is full the packet is not
+// captured and a drop counter is incremented instead; drops are reported
+// periodically in the logs.
+// The files are selected with the following port extras:
+//   - DevMgrIface::kPortExtraInPcap / DevMgrIface::kPortExtraOutPcap: the files
+//     for received / transmitted packets. A file whose name ends with
+//     ".pcapng" is written in the pcapng format and can be shared by several
+//     ports and by both directions: each port gets its own interface
+//     description block and the direction of each packet is recorded in its
+//     epb_flags option. Otherwise the classic pcap format is used.
+//   - DevMgrIface::kPortExtraPcapRotateSize /
+//     DevMgrIface::kPortExtraPcapRotateInterval: a new file is started when the
+//     current one reaches that many bytes / has been open for that many
+//     seconds. The n-th new file for "dir/X_in.pcap" is "dir/X_in.<n>.pcap".
+class PcapCapture {
+ public:
+  using port_t = DevMgrIface::port_t;
+  using PortExtras = DevMgrIface::PortExtras;
+
+  enum class Direction { IN, OUT };
+
+  static constexpr size_t kDefaultRingSize = 1u << 24;
+  // only ports with a smaller port number can be captured
+  static constexpr port_t kMaxPorts = 4096u;
+
+  explicit PcapCapture(size_t ring_size = kDefaultRingSize);
+  // all the packets captured so far are written before the files are closed
+  ~PcapCapture();
+
+  // returns true if the port extras request a capture for the port
+  static bool is_requested(const PortExtras &port_extras);
+
+  // returns false if the port cannot be captured (e.g. a file cannot be
+  // opened), in which case nothing is captured for the port
+  bool port_add(port_t port_num, const std::string &iface_name,
+                const PortExtras &port_extras);
+  // the packets already captured for the port are written before the function
+  // returns
+  void port_remove(port_t port_num);
+
+  // can be called concurrently by any number of threads; does nothing if the
+  // port is not captured in this direction
+  void capture(port_t port_num, Direction dir, const char *data, int len);
+
+  // waits for all the packets captured so far to be written to the files
+  void flush();
+
+  // number of packets which could not be captured because the ring was full
+  uint64_t get_drops() const;
+
+  PcapCapture(const PcapCapture &other) = delete;
+  PcapCapture &operator=(const PcapCapture &other) = delete;
+
+ private:
+  class Imp;
+  std::unique_ptr<Imp> pimp;
+};
+
+}  // namespace bm
+
+#endif  // BM_SIM_PCAP_CAPTURE_H_
@@ -0,0 +1,344 @@
+/* Copyright 2013-present Barefoot Networks, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Antonin Bas (antonin@barefootnetworks.com)
+ *
+ */
+
+#include <bm/bm_sim/pcap_replay.h>
+#include <bm/bm_sim/logger.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <thread>
+
+namespace bm {
+
+constexpr uint64_t PcapReplay::kMaxBusyPollUs;
+
+namespace {
+
+using clock = std::chrono::steady_clock;
+
+constexpr uint32_t kMagicUs = 0xa1b2c3d4;
+constexpr uint32_t kMagicNs = 0xa1b23c4d;
+constexpr size_t kGlobalHeaderSize = 24;
+constexpr size_t kRecordHeaderSize = 16;
+// upper bound for a single sleep, so that stop() is not delayed too much
+constexpr std::chrono::milliseconds kMaxSleep(100);
+
+uint32_t
+bswap32(uint32_t v) {
+  return ((v & 0xff) << 24) | ((v & 0xff00) << 8) |
+      ((v >> 8) & 0xff00) | (v >> 24);
+}
+
+}  // namespace
+
+// A memory-mapped pcap file and the position of the replay in this file
+struct PcapReplay::File {
+  ~File() {
+    if (data != MAP_FAILED) munmap(const_cast<char *>(data), size);
+  }
+
+  uint32_t read_u32(size_t offset) const {
+    uint32_t v;
+    std::memcpy(&v, data + offset, sizeof(v));
+    return swapped ? bswap32(v) : v;
+  }
+
+  void reset() {
+    offset = kGlobalHeaderSize;
+    at_end = false;
+    advance();
+  }
+
+  // moves to the next packet, sets at_end if there is none
+  void advance() {
+    if (offset + kRecordHeaderSize > size) {
+      if (offset != size)
+        Logger::get()->warn("Pcap replay: {} is truncated", path);
+      at_end = true;
+      return;
+    }
+    uint64_t ts_sec = read_u32(offset);
+    uint64_t ts_frac = read_u32(offset + 4);
+    // packets are injected with the captured data only
+    caplen = read_u32(offset + 8);
+    if (caplen > size - offset - kRecordHeaderSize) {
+      Logger::get()->warn("Pcap replay: {} is truncated", path);
+      at_end = true;
+      return;
+    }
+    ts_ns = ts_sec * 1000000000u + (nanosecond ? ts_frac : ts_frac * 1000u);
+    packet = data + offset + kRecordHeaderSize;
+    offset += kRecordHeaderSize + caplen;
+  }
+
+  int port{0};
+  std::string path{};
+  const char *data{static_cast<const char *>(MAP_FAILED)};
+  size_t size{0};
+  bool swapped{false};
+  bool nanosecond{false};
+  // offset of the next record
+  size_t offset{0};
+  bool at_end{true};
+  // current packet
+  const char *packet{nullptr};
+  uint32_t caplen{0};
+  uint64_t ts_ns{0};
+};
+
+PcapReplay::PcapReplay(const Config &config)
+    : config(config) {
+  if (this->config.burst_size == 0) this->config.burst_size = 1;
+  if ((config.mode == Mode::PPS || config.mode == Mode::BPS) &&
+      config.rate == 0) {
+    Logger::get()->warn("Pcap replay: no rate given, replaying packets as "
+                        "fast as possible");
+    this->config.mode = Mode::FAST;
+  }
+}
+
+PcapReplay::~PcapReplay() = default;
+
+bool
+PcapReplay::parse_rate(const std::string &spec, Config *config) {
+  if (spec == "fast") {
+    config->mode = Mode::FAST;
+    return true;
+  }
+  if (spec == "timed") {
+    config->mode = Mode::TIMED;
+    return true;
+  }
+  if (spec.size() <= 3) return false;
+  auto unit = spec.substr(spec.size() - 3);
+  if (unit == "pps")
+    config->mode = Mode::PPS;
+  else if (unit == "bps")
+    config->mode = Mode::BPS;
+  else
+    return false;
+  auto number = spec.substr(0, spec.size() - 3);
+  uint64_t multiplier = 1;
+  switch (number.empty() ? '\0' : number.back()) {
+    case 'k': multiplier = 1000u; break;
+    case 'M': multiplier = 1000000u; break;
+    case 'G': multiplier = 1000000000u; break;
+    default: break;
+  }
+  if (multiplier != 1) number.pop_back();
+  if (number.empty() ||
+      number.find_first_not_of("0123456789") != std::string::npos)
+    return false;
+  try {
+    config->rate = std::stoull(number) * multiplier;
+  } catch (...) {
+    return false;
+  }
+  return config->rate > 0;
+}
+
+bool
+PcapReplay::add_file(int port, const std::string &path) {
+  std::unique_ptr<File> file(new File());
+  file->port = port;
+  file->path = path;
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    Logger::get()->error("Pcap replay: cannot open {}: {}",
+                         path, std::strerror(errno));
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 ||
+      static_cast<size_t>(st.st_size) < kGlobalHeaderSize) {
+    Logger::get()->error("Pcap replay: {} is not a pcap file", path);
+    close(fd);
+    return false;
+  }
+  file->size = static_cast<size_t>(st.st_size);
+  void *data = mmap(nullptr, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    Logger::get()->error("Pcap replay: cannot map {}: {}",
+                         path, std::strerror(errno));
+    return false;
+  }
+  file->data = static_cast<const char *>(data);
+  // the file is read sequentially, this lets the kernel read ahead
+  madvise(data, file->size, MADV_SEQUENTIAL);
+
+  uint32_t magic;
+  std::memcpy(&magic, file->data, sizeof(magic));
+  if (magic == kMagicUs || magic == kMagicNs) {
+    file->nanosecond = (magic == kMagicNs);
+  } else if (bswap32(magic) == kMagicUs || bswap32(magic) == kMagicNs) {
+    file->swapped = true;
+    file->nanosecond = (bswap32(magic) == kMagicNs);
+  } else {
+    Logger::get()->error("Pcap replay: {} is not a pcap file", path);
+    return false;
+  }
+  file->reset();
+  files.push_back(std::move(file));
+  return true;
+}
+
+void
+PcapReplay::reset_files() {
+  for (auto &file : files) file->reset();
+}
+
+// Linear scan; we could use a priority queue, but this is more efficient for a
+// small number of files. Ties are broken by the order in which files were
+// added.
+bool
+PcapReplay::next_packet(size_t *file_idx) {
+  const File *earliest = nullptr;
+  for (size_t i = 0; i < files.size(); i++) {
+    const auto *file = files[i].get();
+    if (file->at_end) continue;
+    if (!earliest || file->ts_ns < earliest->ts_ns) {
+      earliest = file;
+      *file_idx = i;
+    }
+  }
+  return earliest != nullptr;
+}
+
+void
+PcapReplay::run() {
+  if (!handler) {
+    Logger::get()->error("Pcap replay: no packet handler set");
+    return;
+  }
+
+  const double ns_per_unit = (config.mode == Mode::PPS ||
+                              config.mode == Mode::BPS) ?
+      1e9 / static_cast<double>(config.rate) : 0.0;
+  auto start = clock::now();
+  auto now = start;
+  // PPS and BPS schedules do not restart with each loop
+  uint64_t sent_packets = 0;
+  uint64_t sent_bits = 0;
+  uint64_t burst_bytes = 0;
+  size_t burst_count = 0;
+
+  auto publish_stats = [&](clock::time_point t) {
+    packets.store(sent_packets, std::memory_order_relaxed);
+    bytes.fetch_add(burst_bytes, std::memory_order_relaxed);
+    duration_ns.store(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        t - start).count(), std::memory_order_relaxed);
+    burst_bytes = 0;
+  };
+
+  for (unsigned int loop = 0;
+       (config.loops == 0 || loop < config.loops) && !stop_replay; loop++) {
+    if (loop > 0) reset_files();
+    size_t idx;
+    if (!next_packet(&idx)) break;
+    // for TIMED mode, each loop starts when the previous one ends
+    const uint64_t loop_first_ts = files[idx]->ts_ns;
+    const auto loop_start = now;
+
+    while (!stop_replay && next_packet(&idx)) {
+      auto *file = files[idx].get();
+      clock::time_point due = now;
+      switch (config.mode) {
+        case Mode::FAST:
+          break;
+        case Mode::TIMED:
+          due = loop_start + std::chrono::nanoseconds(
+              file->ts_ns - std::min(file->ts_ns, loop_first_ts));
+          break;
+        case Mode::PPS:
+          due = start + std::chrono::nanoseconds(static_cast<uint64_t>(
+              sent_packets * ns_per_unit));
+          break;
+        case Mode::BPS:
+          due = start + std::chrono::nanoseconds(static_cast<uint64_t>(
+              sent_bits * ns_per_unit));
+          break;
+      }
+
+      // the packet is not part of the current burst, wait for it
+      if (due > now) {
+        publish_stats(now);
+        burst_count = 0;
+        while ((now = clock::now()) < due && !stop_replay) {
+          auto remaining = due - now;
+          if (remaining > std::chrono::microseconds(kMaxBusyPollUs)) {
+            std::this_thread::sleep_for(std::min<clock::duration>(
+                remaining - std::chrono::microseconds(kMaxBusyPollUs),
+                kMaxSleep));
+          }
+        }
+        if (stop_replay) break;
+      }
+
+      handler(file->port, file->packet, static_cast<int>(file->caplen),
+              cookie);
+      sent_packets++;
+      sent_bits += static_cast<uint64_t>(file->caplen) * 8;
+      burst_bytes += file->caplen;
+      file->advance();
+
+      if (++burst_count == config.burst_size) {
+        now = clock::now();
+        publish_stats(now);
+        burst_count = 0;
+      }
+    }
+  }
+
+  now = clock::now();
+  publish_stats(now);
+  auto stats = get_stats();
+  Logger::get()->info("Pcap replay: {} packets ({} bytes) in {} us",
+                      stats.packets, stats.bytes, stats.duration_ns / 1000);
+}
+
+void
+PcapReplay::stop() {
+  stop_replay = true;
+}
+
+PcapReplay::Stats
+PcapReplay::get_stats() const {
+  return {packets.load(std::memory_order_relaxed),
+          bytes.load(std::memory_order_relaxed),
+          duration_ns.load(std::memory_order_relaxed)};
+}
+
+PacketDispatcherIface::ReturnCode
+PcapReplay::set_packet_handler(const PacketHandler &handler, void *cookie) {
+  this->handler = handler;
+  this->cookie = cookie;
+  return ReturnCode::SUCCESS;
+}
+
+}  // namespace bm
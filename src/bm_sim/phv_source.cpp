@@ -35,9 +35,10 @@ class PHVSourceContextPools : public PHVSourceIface {
  private:
   class PHVPool {
    public:
+    // may be called while packets still use PHVs from the previous factory,
+    // see SwitchWContexts::do_swap()
     void set_phv_factory(const PHVFactory *factory) {
       std::unique_lock<std::mutex> lock(mutex);
-      assert(count == 0);
       phv_factory = factory;
       phvs.clear();
     }
@@ -46,8 +47,9 @@ class PHVSourceContextPools : public PHVSourceIface {
       std::unique_lock<std::mutex> lock(mutex);
       count++;
       if (phvs.size() == 0) {
+        const PHVFactory *factory = phv_factory;
         lock.unlock();
-        return phv_factory->create();
+        return factory->create();
       }
       std::unique_ptr<PHV> phv = std::move(phvs.back());
       phvs.pop_back();
@@ -57,6 +59,12 @@ class PHVSourceContextPools : public PHVSourceIface {
     void release(std::unique_ptr<PHV> phv) {
       std::unique_lock<std::mutex> lock(mutex);
       count--;
+      // the PHVs from a previous factory are not reused, their headers refer
+      // to a configuration which is about to be released
+      if (phv->get_factory() != phv_factory) {
+        lock.unlock();
+        return;
+      }
       phvs.push_back(std::move(phv));
     }
 
@@ -65,6 +73,24 @@ class PHVSourceContextPools : public PHVSourceIface {
       return count;
     }
 
+    void reserve(size_t count) {
+      std::unique_lock<std::mutex> lock(mutex);
+      const PHVFactory *factory = phv_factory;
+      if (factory == nullptr || phvs.size() >= count) return;
+      size_t nb_missing = count - phvs.size();
+      lock.unlock();
+      // the PHVs are created outside of the lock, by the calling thread, so
+      // that their memory is allocated on its NUMA node
+      std::vector<std::unique_ptr<PHV> > new_phvs;
+      new_phvs.reserve(nb_missing);
+      for (size_t i = 0; i < nb_missing; i++)
+        new_phvs.push_back(factory->create());
+      lock.lock();
+      // the factory may have been changed by a swap in the meantime
+      if (factory != phv_factory) return;
+      for (auto &phv : new_phvs) phvs.push_back(std::move(phv));
+    }
+
    private:
     mutable std::mutex mutex{};
     std::vector<std::unique_ptr<PHV> > phvs{};
@@ -88,6 +114,10 @@ class PHVSourceContextPools : public PHVSourceIface {
     return phv_pools.at(cxt).phvs_in_use();
   }
 
+  void reserve_(cxt_id_t cxt, size_t count) override {
+    phv_pools.at(cxt).reserve(count);
+  }
+
   std::vector<PHVPool> phv_pools;
 };
 
@@ -109,6 +139,11 @@ PHVSourceIface::phvs_in_use(cxt_id_t cxt) {
   return phvs_in_use_(cxt);
 }
 
+void
+PHVSourceIface::reserve(cxt_id_t cxt, size_t count) {
+  reserve_(cxt, count);
+}
+
 std::unique_ptr<PHVSourceIface>
 PHVSourceIface::make_phv_source(size_t size) {
   return std::unique_ptr<PHVSourceContextPools>(
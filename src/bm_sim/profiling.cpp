@@ -0,0 +1,139 @@
+/* Copyright 2013-present Barefoot Networks, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Antonin Bas (antonin@barefootnetworks.com)
+ *
+ */
+
+#include <bm/bm_sim/profiling.h>
+
+#include <algorithm>
+#include <mutex>
+#include <random>
+#include <utility>
+#include <vector>
+
+namespace bm {
+
+constexpr size_t ProfilingCounters::kMaxThreads;
+constexpr uint32_t ProfilingCounters::kSamplingPeriod;
+
+std::atomic<bool> ProfilingCounters::enabled{true};
+
+namespace {
+
+std::atomic<size_t> thread_index_counter{0};
+
+// the copies of the counters for the different threads are allocated
+// separately, we round up their size to a cache line to limit false sharing
+constexpr size_t kCountersPerCacheLine = 64 / sizeof(uint64_t);
+
+}  // namespace
+
+// reset() cannot clear the per-thread copies safely, so we remember the values
+// at the time of the reset instead
+struct ProfilingCounters::Baseline {
+  explicit Baseline(size_t nb_counters)
+      : values(nb_counters, 0) { }
+
+  std::mutex mutex{};
+  std::vector<uint64_t> values;
+};
+
+ProfilingCounters::ProfilingCounters(size_t nb_counters)
+    : nb_counters(nb_counters),
+      threads(new std::atomic<ThreadCounters *>[kMaxThreads]),
+      baseline(new Baseline(nb_counters)) {
+  for (size_t i = 0; i < kMaxThreads; i++) threads[i] = nullptr;
+}
+
+ProfilingCounters::~ProfilingCounters() {
+  // may have been moved from
+  if (!threads) return;
+  for (size_t i = 0; i < kMaxThreads; i++) delete[] threads[i].load();
+}
+
+ProfilingCounters::ProfilingCounters(ProfilingCounters &&other) noexcept
+    = default;
+
+ProfilingCounters &
+ProfilingCounters::operator=(ProfilingCounters &&other) noexcept {
+  // our counters are released when other is destroyed
+  std::swap(nb_counters, other.nb_counters);
+  threads.swap(other.threads);
+  baseline.swap(other.baseline);
+  return *this;
+}
+
+size_t
+ProfilingCounters::next_thread_index() {
+  return std::min(thread_index_counter++, kMaxThreads - 1);
+}
+
+uint32_t
+ProfilingCounters::seed() {
+  std::random_device rd;
+  uint32_t s = rd();
+  return (s == 0) ? 1 : s;
+}
+
+ProfilingCounters::ThreadCounters *
+ProfilingCounters::allocate_thread_counters(size_t index) const {
+  auto size = (nb_counters + kCountersPerCacheLine - 1) /
+      kCountersPerCacheLine * kCountersPerCacheLine;
+  // value-initialization, i.e. 0
+  auto *counters = new ThreadCounters[std::max<size_t>(size, 1)]();
+  ThreadCounters *expected = nullptr;
+  // only the last slot can be shared by several threads
+  if (!threads[index].compare_exchange_strong(expected, counters)) {
+    delete[] counters;
+    return expected;
+  }
+  return counters;
+}
+
+void
+ProfilingCounters::set_enabled(bool enable) {
+  enabled = enable;
+}
+
+std::vector<uint64_t>
+ProfilingCounters::sum() const {
+  std::vector<uint64_t> values(nb_counters, 0);
+  for (size_t i = 0; i < kMaxThreads; i++) {
+    const auto *counters = threads[i].load(std::memory_order_acquire);
+    if (!counters) continue;
+    for (size_t c = 0; c < nb_counters; c++)
+      values[c] += counters[c].load(std::memory_order_relaxed);
+  }
+  return values;
+}
+
+std::vector<uint64_t>
+ProfilingCounters::get() const {
+  std::lock_guard<std::mutex> lock(baseline->mutex);
+  auto values = sum();
+  for (size_t c = 0; c < nb_counters; c++) values[c] -= baseline->values[c];
+  return values;
+}
+
+void
+ProfilingCounters::reset() {
+  std::lock_guard<std::mutex> lock(baseline->mutex);
+  baseline->values = sum();
+}
+
+}  // namespace bm
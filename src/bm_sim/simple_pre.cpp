@@ -33,7 +33,7 @@ namespace bm {
 
 McSimplePre::McReturnCode
 McSimplePre::mc_mgrp_create(const mgrp_t mgid, mgrp_hdl_t *mgrp_hdl) {
-  boost::unique_lock<boost::shared_mutex> lock(mutex);
+  boost::unique_lock<InstrumentedSharedMutex> lock(mutex);
   size_t num_entries = mgid_entries.size();
   if (num_entries >= MGID_TABLE_SIZE) {
     Logger::get()->error("mgrp create failed, mgid table full");
@@ -48,7 +48,7 @@ McSimplePre::mc_mgrp_create(const mgrp_t mgid, mgrp_hdl_t *mgrp_hdl) {
 
 McSimplePre::McReturnCode
 McSimplePre::mc_mgrp_destroy(mgrp_hdl_t mgrp_hdl) {
-  boost::unique_lock<boost::shared_mutex> lock(mutex);
+  boost::unique_lock<InstrumentedSharedMutex> lock(mutex);
   mgid_entries.erase(mgrp_hdl);
   Logger::get()->debug("mgrp node deleted for mgid {}", mgrp_hdl);
   return SUCCESS;
@@ -58,7 +58,7 @@ McSimplePre::McReturnCode
 McSimplePre::mc_node_create(const rid_t rid,
                             const PortMap &portmap,
                             l1_hdl_t *l1_hdl) {
-  boost::unique_lock<boost::shared_mutex> lock(mutex);
+  boost::unique_lock<InstrumentedSharedMutex> lock(mutex);
   l2_hdl_t l2_hdl;
   size_t num_l1_entries = l1_entries.size();
   size_t num_l2_entries = l2_entries.size();
@@ -89,7 +89,7 @@ McSimplePre::mc_node_create(const rid_t rid,
 McSimplePre::McReturnCode
 McSimplePre::mc_node_associate(const mgrp_hdl_t mgrp_hdl,
                                const l1_hdl_t l1_hdl) {
-  boost::unique_lock<boost::shared_mutex> lock(mutex);
+  boost::unique_lock<InstrumentedSharedMutex> lock(mutex);
   if (!l1_handles.valid_handle(l1_hdl)) {
     Logger::get()->error("node associate failed, invalid l1 handle");
     return INVALID_L1_HANDLE;
@@ -115,7 +115,7 @@ McSimplePre::mc_node_associate(const mgrp_hdl_t mgrp_hdl,
 McSimplePre::McReturnCode
 McSimplePre::mc_node_dissociate(const mgrp_hdl_t mgrp_hdl,
                                 const l1_hdl_t l1_hdl) {
-  boost::unique_lock<boost::shared_mutex> lock(mutex);
+  boost::unique_lock<InstrumentedSharedMutex> lock(mutex);
   if (!l1_handles.valid_handle(l1_hdl)) {
     Logger::get()->error("node dissociate failed, invalid l1 handle");
     return INVALID_L1_HANDLE;
@@ -140,7 +140,7 @@ McSimplePre::mc_node_dissociate(const mgrp_hdl_t mgrp_hdl,
 
 McSimplePre::McReturnCode
 McSimplePre::mc_node_destroy(const l1_hdl_t l1_hdl) {
-  boost::unique_lock<boost::shared_mutex> lock(mutex);
+  boost::unique_lock<InstrumentedSharedMutex> lock(mutex);
   rid_t rid;
   if (!l1_handles.valid_handle(l1_hdl)) {
     Logger::get()->error("node destroy failed, invalid l1 handle");
@@ -168,7 +168,7 @@ McSimplePre::mc_node_destroy(const l1_hdl_t l1_hdl) {
 McSimplePre::McReturnCode
 McSimplePre::mc_node_update(const l1_hdl_t l1_hdl,
                             const PortMap &port_map) {
-  boost::unique_lock<boost::shared_mutex> lock(mutex);
+  boost::unique_lock<InstrumentedSharedMutex> lock(mutex);
   if (!l1_handles.valid_handle(l1_hdl)) {
     Logger::get()->error("node update failed, invalid l1 handle");
     return INVALID_L1_HANDLE;
@@ -240,7 +240,7 @@ McSimplePre::mc_get_entries() const {
   Json::Value root(Json::objectValue);
 
   {
-    boost::unique_lock<boost::shared_mutex> lock(mutex);
+    boost::unique_lock<InstrumentedSharedMutex> lock(mutex);
     get_entries_common(&root);
   }
 
@@ -261,7 +261,7 @@ McSimplePre::reset_state_() {
 void
 McSimplePre::reset_state() {
   Logger::get()->debug("resetting PRE state");
-  boost::unique_lock<boost::shared_mutex> lock(mutex);
+  boost::unique_lock<InstrumentedSharedMutex> lock(mutex);
   reset_state_();
 }
 
@@ -270,7 +270,7 @@ McSimplePre::replicate(const McSimplePre::McIn ingress_info) const {
   std::vector<McSimplePre::McOut> egress_info_list;
   egress_port_t port_id;
   McSimplePre::McOut egress_info;
-  boost::shared_lock<boost::shared_mutex> lock(mutex);
+  boost::shared_lock<InstrumentedSharedMutex> lock(mutex);
   auto mgid_it = mgid_entries.find(ingress_info.mgid);
   if (mgid_it == mgid_entries.end()) {
     Logger::get()->warn("Replication requested for mgid {}, which is not known "
@@ -0,0 +1,149 @@
+/* Copyright 2013-present Barefoot Networks, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Antonin Bas (antonin@barefootnetworks.com)
+ *
+ */
+
+#include <bm/bm_sim/snapshot.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <ostream>
+#include <string>
+
+namespace bm {
+
+constexpr uint32_t SnapshotWriter::kFormatVersion;
+
+namespace {
+
+constexpr char kMagic[8] = {'B', 'M', 'V', '2', 'S', 'N', 'A', 'P'};
+
+}  // namespace
+
+SnapshotWriter::SnapshotWriter(std::ostream *out)
+    : out(out) { }
+
+void
+SnapshotWriter::write_header(const std::string &config_md5, size_t nb_cxts) {
+  write_bytes(kMagic, sizeof(kMagic));
+  write_u32(kFormatVersion);
+  write_string(config_md5);
+  write_u32(static_cast<uint32_t>(nb_cxts));
+}
+
+void
+SnapshotWriter::begin_section(SnapshotSection type, const std::string &name) {
+  assert(!in_section);
+  write_u8(static_cast<uint8_t>(type));
+  write_string(name);
+  section_size_offset = buffer.size();
+  write_u64(0);
+  in_section = true;
+}
+
+void
+SnapshotWriter::end_section() {
+  assert(in_section);
+  uint64_t size = buffer.size() - section_size_offset - sizeof(uint64_t);
+  buffer.replace(section_size_offset, sizeof(size),
+                 reinterpret_cast<const char *>(&size), sizeof(size));
+  in_section = false;
+  flush();
+}
+
+void
+SnapshotWriter::flush() {
+  if (in_section) return;
+  out->write(buffer.data(), buffer.size());
+  bytes_flushed += buffer.size();
+  buffer.clear();
+}
+
+bool
+SnapshotWriter::good() const {
+  return out->good();
+}
+
+SnapshotReader::SnapshotReader(const char *data, size_t size)
+    : data(data), size(size) { }
+
+bool
+SnapshotReader::is_snapshot(const char *data, size_t size) {
+  return size >= sizeof(kMagic) &&
+      std::memcmp(data, kMagic, sizeof(kMagic)) == 0;
+}
+
+bool
+SnapshotReader::read_header(std::string *config_md5, size_t *nb_cxts) {
+  const char *magic = read_bytes(sizeof(kMagic));
+  if (!magic || std::memcmp(magic, kMagic, sizeof(kMagic)) != 0) return false;
+  if (read_u32() != SnapshotWriter::kFormatVersion) return false;
+  *config_md5 = read_string();
+  *nb_cxts = read_u32();
+  return good();
+}
+
+std::string
+SnapshotReader::read_string() {
+  auto s = read_u32();
+  const char *p = read_bytes(s);
+  return p ? std::string(p, s) : std::string();
+}
+
+bool
+SnapshotReader::next_section(SnapshotSection *type, std::string *name,
+                             SnapshotReader *payload) {
+  *type = static_cast<SnapshotSection>(read_u8());
+  *name = read_string();
+  auto s = read_u64();
+  const char *p = read_bytes(s);
+  if (!p) return false;
+  *payload = SnapshotReader(p, s);
+  return true;
+}
+
+MappedFile::~MappedFile() {
+  if (addr) munmap(addr, length);
+}
+
+bool
+MappedFile::open(const std::string &path) {
+  assert(!addr);
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    return false;
+  }
+  void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // the mapping remains valid after the file descriptor is closed
+  close(fd);
+  if (p == MAP_FAILED) return false;
+  // the snapshot is read once, from beginning to end
+  madvise(p, st.st_size, MADV_SEQUENTIAL);
+  addr = p;
+  length = st.st_size;
+  return true;
+}
+
+}  // namespace bm
@@ -28,14 +28,22 @@
 #include <bm/bm_sim/debugger.h>
 #include <bm/bm_sim/event_logger.h>
 #include <bm/bm_sim/packet.h>
+#include <bm/bm_sim/thread_affinity.h>
 
 #include <cassert>
+#include <chrono>
+#include <cstdio>
 #include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 #include <iostream>
 #include <streambuf>
 
+#include "jsoncpp/json.h"
 #include "md5.h"
 
 namespace fs = boost::filesystem;
@@ -49,14 +57,27 @@ packet_handler(int port_num, const char *buffer, int len, void *cookie) {
   static_cast<SwitchWContexts *>(cookie)->receive(port_num, buffer, len);
 }
 
+static void
+packet_buffer_handler(int port_num, PacketBuffer &&buffer, void *cookie) {
+  static_cast<SwitchWContexts *>(cookie)->receive(port_num, std::move(buffer));
+}
+
 // TODO(antonin): maybe a factory method would be more appropriate for Switch
 SwitchWContexts::SwitchWContexts(size_t nb_cxts, bool enable_swap)
   : DevMgr(),
     nb_cxts(nb_cxts), contexts(nb_cxts), enable_swap(enable_swap),
+    reaper(std::make_shared<P4ObjectsReaper>()),
     phv_source(PHVSourceIface::make_phv_source(nb_cxts)) {
   for (size_t i = 0; i < nb_cxts; i++) {
     contexts.at(i).set_cxt_id(i);
+    contexts.at(i).set_reaper(reaper);
   }
+  BM_LOCK_STATS_NAME(config_mutex, "switch_config");
+}
+
+SwitchWContexts::~SwitchWContexts() {
+  if (snapshot_thread.joinable()) snapshot_thread.join();
+  reaper->stop();
 }
 
 LookupStructureFactory SwitchWContexts::default_lookup_factory {};
@@ -70,10 +91,28 @@ SwitchWContexts::receive(port_t port_num, const char *buffer, int len) {
   return receive_(port_num, buffer, len);
 }
 
+int
+SwitchWContexts::receive(port_t port_num, PacketBuffer &&buffer) {
+  if (dump_packet_data > 0) {
+    Logger::get()->info(
+        "Received packet of length {} on port {}: {}",
+        buffer.get_data_size(), port_num,
+        sample_packet_data(buffer.start(),
+                           static_cast<int>(buffer.get_data_size())));
+  }
+  return receive_buffer_(port_num, std::move(buffer));
+}
+
+int
+SwitchWContexts::receive_buffer_(port_t port_num, PacketBuffer &&buffer) {
+  return receive_(port_num, buffer.start(),
+                  static_cast<int>(buffer.get_data_size()));
+}
+
 void
 SwitchWContexts::start_and_return() {
   {
-    std::unique_lock<std::mutex> config_lock(config_mutex);
+    std::unique_lock<InstrumentedMutex> config_lock(config_mutex);
     if (!config_loaded && !enable_swap) {
       Logger::get()->error(
           "The switch was started with no P4 and config swap is disabled");
@@ -108,6 +147,11 @@ SwitchWContexts::enable_config_swap() {
   enable_swap = true;
 }
 
+void
+SwitchWContexts::set_swap_mode(SwapMode mode) {
+  swap_mode = mode;
+}
+
 void
 SwitchWContexts::disable_config_swap() {
   enable_swap = false;
@@ -130,8 +174,25 @@ SwitchWContexts::force_arith_header(const std::string &header_name) {
   arith_objects.add_header(header_name);
 }
 
+namespace {
+
+// the config is parsed once, and the same Json::Value is used for all contexts
+bool parse_config(const std::string &config, Json::Value *cfg_root) {
+  Json::CharReaderBuilder builder;
+  std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+  std::string error_msg;
+  if (reader->parse(config.data(), config.data() + config.size(), cfg_root,
+                    &error_msg)) {
+    return true;
+  }
+  std::cout << "Invalid JSON config: " << error_msg;
+  return false;
+}
+
+}  // namespace
+
 int
-SwitchWContexts::init_objects(std::istream *is, device_id_t dev_id,
+SwitchWContexts::init_objects(const Json::Value *cfg_root, device_id_t dev_id,
                               std::shared_ptr<TransportIface> transport) {
   int status = 0;
 
@@ -148,11 +209,9 @@ SwitchWContexts::init_objects(std::istream *is, device_id_t dev_id,
     auto &cxt = contexts.at(cxt_id);
     cxt.set_device_id(device_id);
     cxt.set_notifications_transport(notifications_transport);
-    if (is != nullptr) {
-      status = cxt.init_objects(is, get_lookup_factory(),
+    if (cfg_root != nullptr) {
+      status = cxt.init_objects(*cfg_root, get_lookup_factory(),
                                 required_fields, arith_objects);
-      is->clear();
-      is->seekg(0, std::ios::beg);
       if (status != 0) return status;
     }
     phv_source->set_phv_factory(cxt_id, &cxt.get_phv_factory());
@@ -170,13 +229,18 @@ SwitchWContexts::init_objects(const std::string &json_path, device_id_t dev_id,
     return 1;
   }
 
-  int status = init_objects(&fs, dev_id, transport);
+  std::ostringstream ss;
+  ss << fs.rdbuf();
+  std::string config = ss.str();
+  Json::Value cfg_root;
+  if (!parse_config(config, &cfg_root)) return 1;
+
+  int status = init_objects(&cfg_root, dev_id, transport);
   if (status != 0) return status;
 
   {
-    std::unique_lock<std::mutex> config_lock(config_mutex);
-    current_config = std::string((std::istreambuf_iterator<char>(fs)),
-                                 std::istreambuf_iterator<char>());
+    std::unique_lock<InstrumentedMutex> config_lock(config_mutex);
+    current_config = std::move(config);
     config_loaded = true;
   }
 
@@ -229,6 +293,12 @@ SwitchWContexts::init_from_options_parser(
   }
 #endif
 
+  // has to be before init_objects, which may start learning / ageing threads
+  for (const auto &p : parser.thread_cpus)
+    ThreadAffinity::set_cpus(p.first, p.second);
+  for (const auto &p : parser.thread_numa_nodes)
+    ThreadAffinity::set_numa_node(p.first, p.second);
+
   event_logger_addr = parser.event_logger_addr;
 
   if (parser.console_logging)
@@ -248,13 +318,13 @@ SwitchWContexts::init_from_options_parser(
   if (my_dev_mgr != nullptr)
     set_dev_mgr(std::move(my_dev_mgr));
   else if (parser.use_files)
-    set_dev_mgr_files(parser.wait_time);
-#ifdef BMNANOMSG_ON
+    set_dev_mgr_files(parser.wait_time, parser.replay_config);
+  else if (parser.use_af_packet)
+    set_dev_mgr_af_packet(device_id, transport);
   else if (parser.packet_in)
     set_dev_mgr_packet_in(device_id, parser.packet_in_addr, transport);
-#endif
   else
-    set_dev_mgr_bmi(device_id, transport);
+    set_dev_mgr_bmi(device_id, transport, parser.rx_threads);
 
   for (const auto &iface : parser.ifaces) {
     std::cout << "Adding interface " << iface.second
@@ -268,21 +338,23 @@ SwitchWContexts::init_from_options_parser(
       inFile = iface.second + "_in.pcap";
       outFile = iface.second + "_out.pcap";
     } else if (parser.pcap) {
-      // using the same file creates 2 issues:
-      // 1. hard to distinguish direction (incoming vs outgoing)
-      // 2. in current BMI code we open 2 file descriptors for the same file
-      // which lead to file corruption.
-      // Issue 2 may be fixed by detecting that we are using the same file and
-      // using a single file descriptor (assuming that fwrite is thread-safe),
-      // but I believe there is calue in having 2 different files.
+      // with the classic pcap format, it is hard to distinguish the direction
+      // (incoming vs outgoing) of packets captured to the same file, so we use
+      // 2 different files; pcapng records the direction and the interface of
+      // each packet, so a single file is used for all interfaces
       assert(!parser.pcap_dir.empty());
       fs::path pcap_dir(parser.pcap_dir);
-      auto inFilePath = pcap_dir / fs::path(iface.second + "_in.pcap");
-      inFile = inFilePath.string();
-      auto outFilePath = pcap_dir / fs::path(iface.second + "_out.pcap");
-      outFile = outFilePath.string();
-      // inFile = iface.second + ".pcap";
-      // outFile = inFile;
+      if (parser.pcapng) {
+        auto filePath = pcap_dir / fs::path(
+            "device_" + std::to_string(parser.device_id) + ".pcapng");
+        inFile = filePath.string();
+        outFile = inFile;
+      } else {
+        auto inFilePath = pcap_dir / fs::path(iface.second + "_in.pcap");
+        inFile = inFilePath.string();
+        auto outFilePath = pcap_dir / fs::path(iface.second + "_out.pcap");
+        outFile = outFilePath.string();
+      }
     }
 
     PortExtras port_extras;
@@ -290,9 +362,28 @@ SwitchWContexts::init_from_options_parser(
       port_extras.emplace(DevMgrIface::kPortExtraInPcap, inFile);
     if (!outFile.empty())
       port_extras.emplace(DevMgrIface::kPortExtraOutPcap, outFile);
+    if (!parser.use_files && parser.pcap_rotate_size > 0) {
+      port_extras.emplace(DevMgrIface::kPortExtraPcapRotateSize,
+                          std::to_string(parser.pcap_rotate_size));
+    }
+    if (!parser.use_files && parser.pcap_rotate_interval > 0) {
+      port_extras.emplace(DevMgrIface::kPortExtraPcapRotateInterval,
+                          std::to_string(parser.pcap_rotate_interval));
+    }
+    auto it_xdp = parser.af_xdp_modes.find(iface.first);
+    if (it_xdp != parser.af_xdp_modes.end()) {
+      port_extras.emplace(DevMgrIface::kPortExtraAfXdp, it_xdp->second);
+      port_extras.emplace(DevMgrIface::kPortExtraAfXdpQueue,
+                          std::to_string(parser.af_xdp_queues.at(iface.first)));
+    }
+    auto it_traffic = parser.traffic_ports.find(iface.first);
+    if (it_traffic != parser.traffic_ports.end())
+      port_extras.insert(it_traffic->second.begin(), it_traffic->second.end());
     port_add(iface.second, iface.first, port_extras);
   }
   thrift_port = parser.thrift_port;
+  thrift_server_type = parser.thrift_server_type;
+  thrift_workers = parser.thrift_workers;
 
   if (parser.state_file_path != "") {
     status = deserialize_from_file(parser.state_file_path);
@@ -303,6 +394,8 @@ SwitchWContexts::init_from_options_parser(
 
   // TODO(unknown): is this the right place to do this?
   set_packet_handler(packet_handler, static_cast<void *>(this));
+  // UNSUPPORTED if the port manager cannot provide packets without a copy
+  set_packet_buffer_handler(packet_buffer_handler, static_cast<void *>(this));
 
   return status;
 }
@@ -320,16 +413,16 @@ SwitchWContexts::init_from_options_parser(
 RuntimeInterface::ErrorCode
 SwitchWContexts::load_new_config(const std::string &new_config) {
   if (!enable_swap) return ErrorCode::CONFIG_SWAP_DISABLED;
-  std::istringstream ss(new_config);
+  Json::Value cfg_root;
+  if (!parse_config(new_config, &cfg_root)) return ErrorCode::INVALID_CONFIG;
   for (auto &cxt : contexts) {
-    ErrorCode rc = cxt.load_new_config(&ss, get_lookup_factory(),
-                                       required_fields, arith_objects);
+    ErrorCode rc = cxt.load_new_config(
+        cfg_root, get_lookup_factory(), required_fields, arith_objects,
+        swap_mode == SwapMode::MIGRATE_STATE);
     if (rc != ErrorCode::SUCCESS) return rc;
-    ss.clear();
-    ss.seekg(0, std::ios::beg);
   }
   {
-    std::unique_lock<std::mutex> config_lock(config_mutex);
+    std::unique_lock<InstrumentedMutex> config_lock(config_mutex);
     current_config = new_config;
   }
   return ErrorCode::SUCCESS;
@@ -343,11 +436,10 @@ SwitchWContexts::swap_configs() {
     if (rc != ErrorCode::SUCCESS) return rc;
   }
   {
-    std::unique_lock<std::mutex> config_lock(config_mutex);
+    std::unique_lock<InstrumentedMutex> config_lock(config_mutex);
     if (!config_loaded) config_loaded = true;
-    int error = do_swap();
-    _BM_UNUSED(error);
-    assert(!error);
+    // returns 1 if the target called do_swap() first, which is fine
+    do_swap();
   }
   config_loaded_cv.notify_one();
   return ErrorCode::SUCCESS;
@@ -371,7 +463,7 @@ const char serialization_format_version_str[] = "06062016_0";
 
 RuntimeInterface::ErrorCode
 SwitchWContexts::serialize(std::ostream *out) {
-  std::unique_lock<std::mutex> config_lock(config_mutex);
+  std::unique_lock<InstrumentedMutex> config_lock(config_mutex);
   (*out) << serialization_format_version_str << "\n";
   std::string md5sum = get_config_md5_();
   (*out) << md5sum << "\n";
@@ -405,8 +497,39 @@ SwitchWContexts::deserialize(std::istream *in) {
   return 0;
 }
 
+int
+SwitchWContexts::deserialize(SnapshotReader *in) {
+  std::string md5sum_expected = get_config_md5();
+  std::string md5sum;
+  size_t snapshot_nb_cxts;
+  if (!in->read_header(&md5sum, &snapshot_nb_cxts)) {
+    std::cout << "state snapshot has an incompatible version\n";
+    return 1;
+  }
+  if (md5sum != md5sum_expected || snapshot_nb_cxts != nb_cxts) {
+    std::cout << "state snapshot does not match JSON config input\n";
+    return 1;
+  }
+  for (auto &cxt : contexts) {
+    ErrorCode rc = cxt.deserialize(in);
+    if (rc != ErrorCode::SUCCESS) {
+      std::cout << "state snapshot is invalid\n";
+      return 1;
+    }
+  }
+  return 0;
+}
+
 int
 SwitchWContexts::deserialize_from_file(const std::string &state_dump_path) {
+  {
+    MappedFile snapshot;
+    if (snapshot.open(state_dump_path) &&
+        SnapshotReader::is_snapshot(snapshot.data(), snapshot.size())) {
+      SnapshotReader reader(snapshot.data(), snapshot.size());
+      return deserialize(&reader);
+    }
+  }
   std::ifstream fs(state_dump_path, std::ios::in);
   // TODO(antonin): use logger functions?
   if (!fs) {
@@ -417,6 +540,91 @@ SwitchWContexts::deserialize_from_file(const std::string &state_dump_path) {
   return deserialize(&fs);
 }
 
+namespace {
+
+// number of entries written at a time by background snapshots, which only hold
+// the table lock for that long
+constexpr size_t kSnapshotChunkSize = 1024;
+
+}  // namespace
+
+RuntimeInterface::ErrorCode
+SwitchWContexts::snapshot_state(const std::string &path, bool background) {
+  std::unique_lock<std::mutex> lock(snapshot_mutex);
+  if (snapshot_status.in_progress) return ErrorCode::ONGOING_SNAPSHOT;
+  // the previous background snapshot, if any, is done
+  if (snapshot_thread.joinable()) snapshot_thread.join();
+  snapshot_status = SnapshotStatus();
+  snapshot_status.path = path;
+  // an existing snapshot is only replaced once the new one is complete
+  std::shared_ptr<std::ofstream> fs(new std::ofstream(
+      path + ".tmp", std::ios::out | std::ios::binary | std::ios::trunc));
+  if (!*fs) return ErrorCode::SNAPSHOT_FILE_ERROR;
+  snapshot_status.in_progress = true;
+  if (background) {
+    snapshot_thread = std::thread([this, fs, path]() {
+        write_snapshot(fs.get(), path, kSnapshotChunkSize);
+    });
+    return ErrorCode::SUCCESS;
+  }
+  lock.unlock();
+  return write_snapshot(fs.get(), path, 0);
+}
+
+RuntimeInterface::ErrorCode
+SwitchWContexts::write_snapshot(std::ofstream *fs, const std::string &path,
+                                size_t chunk_size) {
+  using std::chrono::duration_cast;
+  using std::chrono::milliseconds;
+  auto start = std::chrono::steady_clock::now();
+  SnapshotWriter writer(fs);
+  // a consistent snapshot holds config_mutex throughout, like serialize(); a
+  // background snapshot is discarded if a new config is loaded in the meantime
+  std::unique_lock<InstrumentedMutex> config_lock(config_mutex);
+  auto md5sum = get_config_md5_();
+  if (chunk_size != 0) config_lock.unlock();
+  writer.write_header(md5sum, nb_cxts);
+  ErrorCode rc = ErrorCode::SUCCESS;
+  for (auto &cxt : contexts) {
+    rc = cxt.serialize(&writer, chunk_size);
+    if (rc != ErrorCode::SUCCESS) break;
+  }
+  if (config_lock.owns_lock()) {
+    config_lock.unlock();
+  } else if (rc == ErrorCode::SUCCESS && get_config_md5() != md5sum) {
+    rc = ErrorCode::ONGOING_SWAP;
+  }
+  writer.flush();
+  fs->close();
+  auto tmp_path = path + ".tmp";
+  if (rc == ErrorCode::SUCCESS &&
+      (fs->fail() || std::rename(tmp_path.c_str(), path.c_str()) != 0)) {
+    rc = ErrorCode::SNAPSHOT_FILE_ERROR;
+  }
+  if (rc != ErrorCode::SUCCESS) std::remove(tmp_path.c_str());
+
+  auto duration_ms = duration_cast<milliseconds>(
+      std::chrono::steady_clock::now() - start).count();
+  if (rc == ErrorCode::SUCCESS) {
+    Logger::get()->info("Wrote state snapshot to {} ({} bytes) in {} ms",
+                        path, writer.get_bytes_written(), duration_ms);
+  } else {
+    Logger::get()->error("Failed to write state snapshot to {}", path);
+  }
+  std::unique_lock<std::mutex> lock(snapshot_mutex);
+  snapshot_status.in_progress = false;
+  snapshot_status.success = (rc == ErrorCode::SUCCESS);
+  snapshot_status.bytes = writer.get_bytes_written();
+  snapshot_status.duration_ms = duration_ms;
+  return rc;
+}
+
+SnapshotStatus
+SwitchWContexts::get_snapshot_status() const {
+  std::unique_lock<std::mutex> lock(snapshot_mutex);
+  return snapshot_status;
+}
+
 int
 SwitchWContexts::swap_requested() {
   for (auto &cxt : contexts) {
@@ -436,23 +644,20 @@ SwitchWContexts::block_until_no_more_packets() {
   }
 }
 
+void
+SwitchWContexts::reserve_phvs(size_t count) {
+  for (cxt_id_t cxt_id = 0; cxt_id < nb_cxts; cxt_id++)
+    phv_source->reserve(cxt_id, count);
+}
+
 int
 SwitchWContexts::do_swap() {
   int rc = 1;
   if (!enable_swap || !swap_requested()) return rc;
-  boost::unique_lock<boost::shared_mutex> lock(process_packet_mutex);
-  for (cxt_id_t cxt_id = 0; cxt_id < nb_cxts; cxt_id++) {
-    auto &cxt = contexts[cxt_id];
-    if (!cxt.swap_requested()) continue;
-    // Wait until no more packets exist for this context
-    while (phv_source->phvs_in_use(cxt_id) > 0) {
-      std::this_thread::yield();
-    }
-    int swap_done = cxt.do_swap();
-    if (swap_done == 0)
-      phv_source->set_phv_factory(cxt_id, &cxt.get_phv_factory());
-    rc &= swap_done;
-  }
+  // packets keep being created and processed during the swap, the ones which
+  // already exist keep using the old configuration (see Context::do_swap())
+  for (auto &cxt : contexts) rc &= cxt.do_swap(phv_source.get());
+  if (rc) return rc;
 #ifdef BMDEBUG_ON
   Debugger::get()->config_change();
 #endif
@@ -462,7 +667,7 @@ SwitchWContexts::do_swap() {
 
 std::string
 SwitchWContexts::get_config() const {
-  std::unique_lock<std::mutex> config_lock(config_mutex);
+  std::unique_lock<InstrumentedMutex> config_lock(config_mutex);
   return current_config;
 }
 
@@ -478,7 +683,7 @@ SwitchWContexts::get_config_md5_() const {
 
 std::string
 SwitchWContexts::get_config_md5() const {
-  std::unique_lock<std::mutex> config_lock(config_mutex);
+  std::unique_lock<InstrumentedMutex> config_lock(config_mutex);
   return get_config_md5_();
 }
 
@@ -513,7 +718,7 @@ SwitchWContexts::new_packet_ptr(cxt_id_t cxt_id, port_t ingress_port,
   boost::shared_lock<boost::shared_mutex> lock(process_packet_mutex);
   return std::unique_ptr<Packet>(new Packet(
       cxt_id, ingress_port, id, 0u, ingress_length, std::move(buffer),
-      phv_source.get()));
+      phv_source.get(), contexts.at(cxt_id).get_packet_objects()));
 }
 
 Packet
@@ -523,7 +728,8 @@ SwitchWContexts::new_packet(cxt_id_t cxt_id, port_t ingress_port,
                             PacketBuffer &&buffer) {
   boost::shared_lock<boost::shared_mutex> lock(process_packet_mutex);
   return Packet(cxt_id, ingress_port, id, 0u, ingress_length,
-                std::move(buffer), phv_source.get());
+                std::move(buffer), phv_source.get(),
+                contexts.at(cxt_id).get_packet_objects());
 }
 
 int
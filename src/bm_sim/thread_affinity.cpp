@@ -0,0 +1,208 @@
+/* Copyright 2013-present Barefoot Networks, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Antonin Bas (antonin@barefootnetworks.com)
+ *
+ */
+
+#include <bm/bm_sim/thread_affinity.h>
+#include <bm/bm_sim/logger.h>
+
+#include <algorithm>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace bm {
+
+namespace {
+
+struct Placement {
+  std::vector<int> cpus{};
+  int numa_node{-1};
+};
+
+std::mutex placements_mutex;
+std::unordered_map<std::string, Placement> placements;
+
+#ifdef __linux__
+
+// from linux/mempolicy.h, we do not want to depend on libnuma for this
+constexpr int kMpolPreferred = 1;
+
+bool read_node_cpus(int node, std::vector<int> *cpus) {
+  std::ifstream fs("/sys/devices/system/node/node" + std::to_string(node) +
+                   "/cpulist");
+  std::string cpulist;
+  if (!fs || !std::getline(fs, cpulist)) return false;
+  return ThreadAffinity::parse_cpu_list(cpulist, cpus);
+}
+
+int set_preferred_node(int node) {
+#ifdef SYS_set_mempolicy
+  constexpr size_t bits_per_word = 8 * sizeof(unsigned long);  // NOLINT
+  std::vector<unsigned long> mask(node / bits_per_word + 1, 0);  // NOLINT
+  mask[node / bits_per_word] |= 1ul << (node % bits_per_word);
+  return syscall(SYS_set_mempolicy, kMpolPreferred, mask.data(),
+                 mask.size() * bits_per_word + 1) == 0 ? 0 : 1;
+#else
+  (void) node;
+  return 1;
+#endif
+}
+
+#endif  // __linux__
+
+}  // namespace
+
+const std::vector<std::string> &
+ThreadAffinity::thread_classes() {
+  static const std::vector<std::string> classes = {
+    "ingress", "egress", "transmit", "packet_in", "port_rx", "learning",
+    "ageing"};
+  return classes;
+}
+
+bool
+ThreadAffinity::is_valid_thread_class(const std::string &thread_class) {
+  const auto &classes = thread_classes();
+  return std::find(classes.begin(), classes.end(), thread_class) !=
+      classes.end();
+}
+
+void
+ThreadAffinity::set_cpus(const std::string &thread_class,
+                         const std::vector<int> &cpus) {
+  std::unique_lock<std::mutex> lock(placements_mutex);
+  placements[thread_class].cpus = cpus;
+}
+
+void
+ThreadAffinity::set_numa_node(const std::string &thread_class, int node) {
+  std::unique_lock<std::mutex> lock(placements_mutex);
+  placements[thread_class].numa_node = node;
+}
+
+bool
+ThreadAffinity::is_placed(const std::string &thread_class) {
+  std::unique_lock<std::mutex> lock(placements_mutex);
+  auto it = placements.find(thread_class);
+  return it != placements.end() &&
+      (!it->second.cpus.empty() || it->second.numa_node >= 0);
+}
+
+void
+ThreadAffinity::clear() {
+  std::unique_lock<std::mutex> lock(placements_mutex);
+  placements.clear();
+}
+
+int
+ThreadAffinity::apply(const std::string &thread_class, size_t thread_idx) {
+  Placement placement;
+  {
+    std::unique_lock<std::mutex> lock(placements_mutex);
+    auto it = placements.find(thread_class);
+    if (it == placements.end()) return 0;
+    placement = it->second;
+  }
+
+#ifdef __linux__
+  int rc = 0;
+  std::vector<int> cpus;
+  if (!placement.cpus.empty()) {
+    cpus.push_back(placement.cpus[thread_idx % placement.cpus.size()]);
+  } else if (placement.numa_node >= 0 &&
+             !read_node_cpus(placement.numa_node, &cpus)) {
+    Logger::get()->error("Cannot read CPU list for NUMA node {}",
+                         placement.numa_node);
+    rc = 1;
+  }
+
+  if (!cpus.empty()) {
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    for (int cpu : cpus) {
+      if (cpu < CPU_SETSIZE) CPU_SET(cpu, &cpuset);
+    }
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset)) {
+      Logger::get()->error("Cannot set CPU affinity of {} thread {}",
+                           thread_class, thread_idx);
+      rc = 1;
+    }
+  }
+
+  if (placement.numa_node >= 0 && set_preferred_node(placement.numa_node)) {
+    Logger::get()->error("Cannot set NUMA memory policy of {} thread {}",
+                         thread_class, thread_idx);
+    rc = 1;
+  }
+
+  if (rc == 0) {
+    Logger::get()->debug("Applied CPU / NUMA placement to {} thread {}",
+                         thread_class, thread_idx);
+  }
+  return rc;
+#else
+  (void) thread_idx;
+  Logger::get()->warn("Thread placement is only supported on Linux");
+  return 1;
+#endif  // __linux__
+}
+
+bool
+ThreadAffinity::parse_cpu_list(const std::string &str,
+                               std::vector<int> *cpus) {
+  // std::getline does not return a trailing empty element
+  if (!str.empty() && str.back() == ',') return false;
+  std::vector<int> result;
+  std::istringstream stream(str);
+  std::string range;
+  while (std::getline(stream, range, ',')) {
+    if (range.empty()) return false;
+    auto dash = range.find('-');
+    int first, last;
+    try {
+      size_t pos;
+      first = std::stoi(range.substr(0, dash), &pos);
+      if (pos != std::min(dash, range.size())) return false;
+      last = first;
+      if (dash != std::string::npos) {
+        last = std::stoi(range.substr(dash + 1), &pos);
+        if (pos != range.size() - dash - 1) return false;
+      }
+    } catch (...) {
+      return false;
+    }
+    if (first < 0 || last < first) return false;
+    for (int cpu = first; cpu <= last; cpu++) result.push_back(cpu);
+  }
+  if (result.empty()) return false;
+  cpus->swap(result);
+  return true;
+}
+
+}  // namespace bm
@@ -0,0 +1,732 @@
+/* Copyright 2013-present Barefoot Networks, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Antonin Bas (antonin@barefootnetworks.com)
+ *
+ */
+
+#include <bm/bm_sim/logger.h>
+#include <bm/bm_sim/pcap_replay.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "traffic_gen.h"
+
+namespace bm {
+
+constexpr size_t TrafficGenPortMgr::kMinPacketSize;
+constexpr size_t TrafficGenPortMgr::kMaxPacketSize;
+constexpr size_t TrafficGenPortMgr::kBurstSize;
+
+namespace {
+
+using clock = std::chrono::steady_clock;
+
+constexpr size_t kEthernetHeaderSize = 14;
+constexpr size_t kIpv4HeaderSize = 20;
+constexpr size_t kUdpHeaderSize = 8;
+constexpr size_t kHeadersSize =
+    kEthernetHeaderSize + kIpv4HeaderSize + kUdpHeaderSize;
+// magic number (4 bytes), sequence number (4 bytes), timestamp in ns (8 bytes)
+constexpr size_t kTrailerSize = 16;
+constexpr uint32_t kTrailerMagic = 0x62746730;  // "btg0"
+constexpr uint32_t kBaseSrcIp = 0x0a000001;  // 10.0.0.1
+constexpr uint32_t kBaseDstIp = 0x0a000101;  // 10.0.1.1
+constexpr uint16_t kBaseSrcPort = 1024;
+constexpr uint16_t kDstPort = 5001;
+
+constexpr std::chrono::microseconds kMaxBusyPoll(200);
+// upper bound for a single wait, so that the stats are logged on time
+constexpr std::chrono::milliseconds kMaxSleep(100);
+constexpr std::chrono::seconds kLogInterval(1);
+
+static_assert(kHeadersSize + kTrailerSize <=
+              TrafficGenPortMgr::kMinPacketSize,
+              "Minimum packet size too small");
+
+enum RandomField : unsigned int {
+  SRC_MAC = 1 << 0,
+  DST_MAC = 1 << 1,
+  SRC_IP = 1 << 2,
+  DST_IP = 1 << 3,
+  SRC_PORT = 1 << 4,
+  DST_PORT = 1 << 5,
+};
+
+uint64_t
+now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      clock::now().time_since_epoch()).count();
+}
+
+bool
+parse_uint(const std::string &s, uint64_t *v) {
+  if (s.empty() || s.find_first_not_of("0123456789") != std::string::npos)
+    return false;
+  char *end;
+  errno = 0;
+  *v = std::strtoull(s.c_str(), &end, 10);
+  return errno == 0 && *end == '\0';
+}
+
+void
+write_be(char *dst, uint64_t v, size_t nbytes) {
+  for (size_t i = 0; i < nbytes; i++)
+    dst[i] = static_cast<char>(v >> (8 * (nbytes - 1 - i)));
+}
+
+uint64_t
+read_be(const char *src, size_t nbytes) {
+  uint64_t v = 0;
+  for (size_t i = 0; i < nbytes; i++)
+    v = (v << 8) | static_cast<unsigned char>(src[i]);
+  return v;
+}
+
+uint16_t
+ipv4_checksum(const char *hdr) {
+  uint32_t sum = 0;
+  for (size_t i = 0; i < kIpv4HeaderSize; i += 2)
+    sum += static_cast<uint32_t>(read_be(hdr + i, 2));
+  while (sum >> 16) sum = (sum & 0xffff) + (sum >> 16);
+  return static_cast<uint16_t>(~sum);
+}
+
+// xorshift64*, much cheaper than the standard library engines and good enough
+// to randomize header fields
+class Rng {
+ public:
+  explicit Rng(uint64_t seed)
+      : state(seed * 0x9e3779b97f4a7c15ULL + 1) { }
+
+  uint64_t next() {
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 0x2545f4914f6cdd1dULL;
+  }
+
+ private:
+  uint64_t state;
+};
+
+struct SizeDistribution {
+  enum class Type { FIXED, UNIFORM, IMIX };
+
+  bool parse(const std::string &spec) {
+    if (spec == "imix") {
+      type = Type::IMIX;
+      return true;
+    }
+    auto dash = spec.find('-');
+    if (dash == std::string::npos) {
+      type = Type::FIXED;
+      if (!parse_uint(spec, &min)) return false;
+      max = min;
+    } else {
+      type = Type::UNIFORM;
+      if (!parse_uint(spec.substr(0, dash), &min) ||
+          !parse_uint(spec.substr(dash + 1), &max) || max < min)
+        return false;
+    }
+    return min >= TrafficGenPortMgr::kMinPacketSize &&
+        max <= TrafficGenPortMgr::kMaxPacketSize;
+  }
+
+  size_t pick(Rng *rng) const {
+    switch (type) {
+      case Type::FIXED:
+        return min;
+      case Type::UNIFORM:
+        return min + rng->next() % (max - min + 1);
+      case Type::IMIX: {
+        auto v = rng->next() % 12;
+        return (v < 7) ? 64 : ((v < 11) ? 576 : 1500);
+      }
+    }
+    return min;
+  }
+
+  Type type{Type::FIXED};
+  uint64_t min{64};
+  uint64_t max{64};
+};
+
+void
+atomic_min(std::atomic<uint64_t> *a, uint64_t v) {
+  auto cur = a->load(std::memory_order_relaxed);
+  while (v < cur && !a->compare_exchange_weak(cur, v,
+                                              std::memory_order_relaxed)) { }
+}
+
+void
+atomic_max(std::atomic<uint64_t> *a, uint64_t v) {
+  auto cur = a->load(std::memory_order_relaxed);
+  while (v > cur && !a->compare_exchange_weak(cur, v,
+                                              std::memory_order_relaxed)) { }
+}
+
+}  // namespace
+
+class TrafficGenPortMgr::Imp {
+ public:
+  ~Imp() {
+    {
+      Lock lock(mutex);
+      stop_gen_thread = true;
+    }
+    cv.notify_all();
+    if (gen_thread.joinable()) gen_thread.join();
+  }
+
+  ReturnCode port_add(const std::string &iface_name, port_t port_num,
+                      const PortExtras &port_extras) {
+    std::shared_ptr<Port> port(new Port(port_num, iface_name));
+    auto it_gen = port_extras.find(DevMgrIface::kPortExtraTrafficGen);
+    if (it_gen != port_extras.end() && !port->configure_gen(port_extras))
+      return ReturnCode::ERROR;
+    port->sink = (port_extras.count(DevMgrIface::kPortExtraTrafficSink) > 0);
+
+    {
+      Lock lock(mutex);
+      if (ports.find(port_num) != ports.end()) return ReturnCode::ERROR;
+      ports.emplace(port_num, port);
+      nb_ports = ports.size();
+      ports_changed = true;
+    }
+    cv.notify_all();
+    Logger::get()->info("Port {} ({}) is a virtual port: {}", port_num,
+                        iface_name, port->describe());
+    return ReturnCode::SUCCESS;
+  }
+
+  bool port_remove(port_t port_num) {
+    std::shared_ptr<Port> port;
+    {
+      Lock lock(mutex);
+      auto it = ports.find(port_num);
+      if (it == ports.end()) return false;
+      port = std::move(it->second);
+      ports.erase(it);
+      nb_ports = ports.size();
+      ports_changed = true;
+    }
+    // the generator thread may still hold a reference to the port
+    port->removed = true;
+    cv.notify_all();
+    if (port->sink) log_sink_stats(*port, "");
+    return true;
+  }
+
+  bool transmit(port_t port_num, const char *buffer, int len) {
+    auto port = get_port(port_num);
+    if (!port) return false;
+    port->out_packets.fetch_add(1, std::memory_order_relaxed);
+    port->out_octets.fetch_add(len, std::memory_order_relaxed);
+    if (!port->sink || len < static_cast<int>(kTrailerSize)) return true;
+    const char *trailer = buffer + len - kTrailerSize;
+    if (read_be(trailer, 4) != kTrailerMagic) return true;
+    auto ts = read_be(trailer + 8, 8);
+    auto now = now_ns();
+    if (now < ts) return true;
+    auto latency = now - ts;
+    port->latency_samples.fetch_add(1, std::memory_order_relaxed);
+    port->latency_sum_ns.fetch_add(latency, std::memory_order_relaxed);
+    atomic_min(&port->latency_min_ns, latency);
+    atomic_max(&port->latency_max_ns, latency);
+    return true;
+  }
+
+  bool port_is_up(port_t port_num, bool *is_up) const {
+    if (!get_port(port_num)) return false;
+    *is_up = true;
+    return true;
+  }
+
+  bool get_port_stats(port_t port_num, PortStats *stats) const {
+    auto port = get_port(port_num);
+    if (!port) return false;
+    *stats = PortStats::make(
+        port->in_packets.load(std::memory_order_relaxed),
+        port->in_octets.load(std::memory_order_relaxed),
+        port->out_packets.load(std::memory_order_relaxed),
+        port->out_octets.load(std::memory_order_relaxed));
+    return true;
+  }
+
+  bool clear_port_stats(port_t port_num, PortStats *stats) {
+    auto port = get_port(port_num);
+    if (!port) return false;
+    *stats = PortStats::make(
+        port->in_packets.exchange(0, std::memory_order_relaxed),
+        port->in_octets.exchange(0, std::memory_order_relaxed),
+        port->out_packets.exchange(0, std::memory_order_relaxed),
+        port->out_octets.exchange(0, std::memory_order_relaxed));
+    return true;
+  }
+
+  bool get_sink_stats(port_t port_num, SinkStats *stats) const {
+    auto port = get_port(port_num);
+    if (!port || !port->sink) return false;
+    *stats = port->get_sink_stats();
+    return true;
+  }
+
+  void set_packet_handler(const PacketHandler &handler, void *cookie) {
+    Lock lock(mutex);
+    packet_handler = handler;
+    packet_handler_cookie = cookie;
+    ports_changed = true;
+    cv.notify_all();
+  }
+
+  void start() {
+    Lock lock(mutex);
+    if (gen_thread.joinable()) return;
+    gen_thread = std::thread(&Imp::gen_loop, this);
+  }
+
+ private:
+  using Mutex = std::mutex;
+  using Lock = std::lock_guard<std::mutex>;
+  using UniqueLock = std::unique_lock<std::mutex>;
+
+  struct Port {
+    Port(port_t port_num, const std::string &iface_name)
+        : port_num(port_num), iface_name(iface_name), rng(port_num) { }
+
+    bool configure_gen(const PortExtras &port_extras);
+    std::string describe() const;
+    void build_packet(size_t size, uint64_t ts);
+    SinkStats get_sink_stats() const;
+
+    // returns the time at which the next packet should be generated
+    clock::time_point next_due(clock::time_point now) const {
+      switch (mode) {
+        case PcapReplay::Mode::PPS:
+          return start + std::chrono::nanoseconds(
+              static_cast<uint64_t>(seq * ns_per_unit));
+        case PcapReplay::Mode::BPS:
+          return start + std::chrono::nanoseconds(
+              static_cast<uint64_t>(sent_bits * ns_per_unit));
+        default:
+          return now;
+      }
+    }
+
+    bool done() const {
+      return removed || (count > 0 && seq >= count);
+    }
+
+    port_t port_num;
+    std::string iface_name;
+    bool gen{false};
+    bool sink{false};
+    std::atomic<bool> removed{false};
+
+    // generator configuration
+    PcapReplay::Mode mode{PcapReplay::Mode::FAST};
+    uint64_t rate{0};
+    double ns_per_unit{0.};
+    uint64_t flows{1};
+    SizeDistribution size_distribution{};
+    unsigned int randomize{0};
+    uint64_t count{0};
+
+    // generator state, only accessed by the generator thread
+    std::vector<char> packet{};
+    Rng rng;
+    uint64_t seq{0};
+    uint64_t sent_bits{0};
+    bool started{false};
+    clock::time_point start{};
+    uint64_t logged_packets{0};
+    uint64_t logged_octets{0};
+    SinkStats logged_sink_stats{};
+
+    std::atomic<uint64_t> in_packets{0};
+    std::atomic<uint64_t> in_octets{0};
+    std::atomic<uint64_t> out_packets{0};
+    std::atomic<uint64_t> out_octets{0};
+    std::atomic<uint64_t> latency_samples{0};
+    std::atomic<uint64_t> latency_sum_ns{0};
+    std::atomic<uint64_t> latency_min_ns{
+      std::numeric_limits<uint64_t>::max()};
+    std::atomic<uint64_t> latency_max_ns{0};
+  };
+
+  std::shared_ptr<Port> get_port(port_t port_num) const {
+    // fast path for the ports which are not virtual ports
+    if (nb_ports.load(std::memory_order_relaxed) == 0) return nullptr;
+    Lock lock(mutex);
+    auto it = ports.find(port_num);
+    return (it == ports.end()) ? nullptr : it->second;
+  }
+
+  // generates the packets which are due for the port, at most kBurstSize of
+  // them; returns the time at which the next packet is due
+  clock::time_point generate(Port *port, clock::time_point now,
+                             const PacketHandler &handler, void *cookie);
+
+  // logs the throughput since the last call, from the generator thread
+  void log_rates(Port *port, double seconds);
+  static void log_sink_stats(const Port &port, const std::string &rate);
+
+  void gen_loop();
+
+  std::map<port_t, std::shared_ptr<Port> > ports{};
+  std::atomic<size_t> nb_ports{0};
+  mutable Mutex mutex{};
+  std::condition_variable cv{};
+  // written with the mutex held, so that the generator thread cannot miss a
+  // notification
+  std::atomic<bool> ports_changed{false};
+  std::atomic<bool> stop_gen_thread{false};
+  PacketHandler packet_handler{};
+  void *packet_handler_cookie{nullptr};
+  std::thread gen_thread{};
+};
+
+bool
+TrafficGenPortMgr::Imp::Port::configure_gen(const PortExtras &port_extras) {
+  auto error = [this](const std::string &what, const std::string &value) {
+    Logger::get()->error("Invalid traffic generator {} '{}' for port {}",
+                         what, value, port_num);
+    return false;
+  };
+
+  gen = true;
+  const auto &rate_spec = port_extras.at(DevMgrIface::kPortExtraTrafficGen);
+  PcapReplay::Config config;
+  if (!PcapReplay::parse_rate(rate_spec, &config) ||
+      config.mode == PcapReplay::Mode::TIMED)
+    return error("rate", rate_spec);
+  mode = config.mode;
+  rate = config.rate;
+  if (rate > 0) ns_per_unit = 1e9 / static_cast<double>(rate);
+
+  auto it = port_extras.find(DevMgrIface::kPortExtraTrafficGenFlows);
+  if (it != port_extras.end() && (!parse_uint(it->second, &flows) ||
+                                  flows == 0 || flows > (1u << 24)))
+    return error("flow count", it->second);
+
+  it = port_extras.find(DevMgrIface::kPortExtraTrafficGenSize);
+  if (it != port_extras.end() && !size_distribution.parse(it->second))
+    return error("packet size", it->second);
+
+  it = port_extras.find(DevMgrIface::kPortExtraTrafficGenRandomize);
+  if (it != port_extras.end()) {
+    static const std::map<std::string, RandomField> fields = {
+      {"src_mac", SRC_MAC}, {"dst_mac", DST_MAC}, {"src_ip", SRC_IP},
+      {"dst_ip", DST_IP}, {"src_port", SRC_PORT}, {"dst_port", DST_PORT}};
+    std::istringstream stream(it->second);
+    std::string field;
+    while (std::getline(stream, field, ',')) {
+      auto it_field = fields.find(field);
+      if (it_field == fields.end()) return error("random field", field);
+      randomize |= it_field->second;
+    }
+  }
+
+  it = port_extras.find(DevMgrIface::kPortExtraTrafficGenCount);
+  if (it != port_extras.end() && !parse_uint(it->second, &count))
+    return error("packet count", it->second);
+
+  // the template: everything but the fields which change with each packet
+  packet.assign(kMaxPacketSize, 0);
+  char *eth = packet.data();
+  write_be(eth, 0x020000000002ULL, 6);
+  write_be(eth + 6, 0x020000000001ULL, 6);
+  write_be(eth + 12, 0x0800, 2);
+  char *ip = eth + kEthernetHeaderSize;
+  ip[0] = 0x45;
+  ip[8] = 64;  // TTL
+  ip[9] = 17;  // UDP
+  write_be(ip + 16, kBaseDstIp, 4);
+  char *udp = ip + kIpv4HeaderSize;
+  write_be(udp + 2, kDstPort, 2);
+  for (size_t i = kHeadersSize; i < packet.size(); i++)
+    packet[i] = static_cast<char>(i);
+  return true;
+}
+
+std::string
+TrafficGenPortMgr::Imp::Port::describe() const {
+  std::ostringstream stream;
+  if (gen) {
+    stream << "traffic generator (";
+    switch (mode) {
+      case PcapReplay::Mode::PPS: stream << rate << " pps"; break;
+      case PcapReplay::Mode::BPS: stream << rate << " bps"; break;
+      default: stream << "as fast as possible"; break;
+    }
+    stream << ", " << flows << " flow(s)";
+    if (count > 0) stream << ", " << count << " packets";
+    stream << ")";
+  }
+  if (sink) stream << (gen ? " and " : "") << "traffic sink";
+  return stream.str();
+}
+
+void
+TrafficGenPortMgr::Imp::Port::build_packet(size_t size, uint64_t ts) {
+  auto flow = seq % flows;
+  char *eth = packet.data();
+  char *ip = eth + kEthernetHeaderSize;
+  char *udp = ip + kIpv4HeaderSize;
+  // keep the individual / group bit cleared for random MAC addresses
+  if (randomize & DST_MAC) {
+    write_be(eth, rng.next() & 0xfeffffffffffULL, 6);
+  }
+  if (randomize & SRC_MAC) {
+    write_be(eth + 6, rng.next() & 0xfeffffffffffULL, 6);
+  }
+  write_be(ip + 2, size - kEthernetHeaderSize, 2);
+  write_be(ip + 12, (randomize & SRC_IP) ? rng.next() : kBaseSrcIp + flow, 4);
+  if (randomize & DST_IP) write_be(ip + 16, rng.next(), 4);
+  write_be(ip + 10, 0, 2);
+  write_be(ip + 10, ipv4_checksum(ip), 2);
+  write_be(udp, (randomize & SRC_PORT) ?
+           rng.next() : kBaseSrcPort + flow % (0x10000 - kBaseSrcPort), 2);
+  if (randomize & DST_PORT) write_be(udp + 2, rng.next(), 2);
+  write_be(udp + 4, size - kEthernetHeaderSize - kIpv4HeaderSize, 2);
+  // no UDP checksum
+  char *trailer = eth + size - kTrailerSize;
+  write_be(trailer, kTrailerMagic, 4);
+  write_be(trailer + 4, seq, 4);
+  write_be(trailer + 8, ts, 8);
+}
+
+TrafficGenPortMgr::SinkStats
+TrafficGenPortMgr::Imp::Port::get_sink_stats() const {
+  SinkStats stats;
+  stats.packets = out_packets.load(std::memory_order_relaxed);
+  stats.bytes = out_octets.load(std::memory_order_relaxed);
+  stats.latency_samples = latency_samples.load(std::memory_order_relaxed);
+  stats.latency_min_ns = 0;
+  stats.latency_avg_ns = 0;
+  stats.latency_max_ns = 0;
+  if (stats.latency_samples > 0) {
+    stats.latency_min_ns = latency_min_ns.load(std::memory_order_relaxed);
+    stats.latency_avg_ns =
+        latency_sum_ns.load(std::memory_order_relaxed) / stats.latency_samples;
+    stats.latency_max_ns = latency_max_ns.load(std::memory_order_relaxed);
+  }
+  return stats;
+}
+
+clock::time_point
+TrafficGenPortMgr::Imp::generate(Port *port, clock::time_point now,
+                                 const PacketHandler &handler, void *cookie) {
+  if (!port->started) {
+    port->started = true;
+    port->start = now;
+  }
+  // all the packets in a burst get the same timestamp
+  const auto ts = now_ns();
+  for (size_t i = 0; i < kBurstSize; i++) {
+    if (port->done()) return clock::time_point::max();
+    auto due = port->next_due(now);
+    if (due > now) return due;
+    auto size = port->size_distribution.pick(&port->rng);
+    port->build_packet(size, ts);
+    handler(port->port_num, port->packet.data(), static_cast<int>(size),
+            cookie);
+    port->seq++;
+    port->sent_bits += size * 8;
+    port->in_packets.fetch_add(1, std::memory_order_relaxed);
+    port->in_octets.fetch_add(size, std::memory_order_relaxed);
+  }
+  return port->done() ? clock::time_point::max() : now;
+}
+
+namespace {
+
+std::string
+describe_rate(uint64_t packets, uint64_t octets, double seconds) {
+  std::ostringstream stream;
+  stream.precision(3);
+  stream << std::fixed << packets / seconds / 1e6 << " Mpps, "
+         << octets * 8 / seconds / 1e6 << " Mbps";
+  return stream.str();
+}
+
+}  // namespace
+
+void
+TrafficGenPortMgr::Imp::log_rates(Port *port, double seconds) {
+  if (port->gen) {
+    auto packets = port->in_packets.load(std::memory_order_relaxed);
+    auto octets = port->in_octets.load(std::memory_order_relaxed);
+    // the stats may have been cleared in the meantime
+    if (packets > port->logged_packets) {
+      Logger::get()->info("Traffic generator on port {}: {}", port->port_num,
+                          describe_rate(packets - port->logged_packets,
+                                        octets - port->logged_octets,
+                                        seconds));
+    }
+    port->logged_packets = packets;
+    port->logged_octets = octets;
+  }
+  if (port->sink) {
+    auto stats = port->get_sink_stats();
+    auto &prev = port->logged_sink_stats;
+    if (stats.packets > prev.packets) {
+      log_sink_stats(*port, describe_rate(stats.packets - prev.packets,
+                                          stats.bytes - prev.bytes, seconds));
+    }
+    prev = stats;
+  }
+}
+
+void
+TrafficGenPortMgr::Imp::log_sink_stats(const Port &port,
+                                       const std::string &rate) {
+  auto stats = port.get_sink_stats();
+  Logger::get()->info("Traffic sink on port {}: {}{} packets, latency (us) "
+                      "min {} / avg {} / max {}", port.port_num,
+                      rate.empty() ? rate : rate + ", ", stats.packets,
+                      stats.latency_min_ns / 1000.,
+                      stats.latency_avg_ns / 1000.,
+                      stats.latency_max_ns / 1000.);
+}
+
+void
+TrafficGenPortMgr::Imp::gen_loop() {
+  std::vector<std::shared_ptr<Port> > my_ports;
+  PacketHandler handler;
+  void *cookie = nullptr;
+  auto next_log = clock::now() + kLogInterval;
+  bool update = true;
+  while (true) {
+    if (update) {
+      Lock lock(mutex);
+      if (stop_gen_thread) break;
+      my_ports.clear();
+      for (const auto &p : ports) my_ports.push_back(p.second);
+      handler = packet_handler;
+      cookie = packet_handler_cookie;
+      ports_changed = false;
+      update = false;
+    }
+
+    auto now = clock::now();
+    auto next_due = clock::time_point::max();
+    if (handler) {
+      for (auto &port : my_ports) {
+        if (!port->gen || port->done()) continue;
+        next_due = std::min(next_due, generate(port.get(), now, handler,
+                                               cookie));
+      }
+    }
+
+    now = clock::now();
+    if (now >= next_log) {
+      auto seconds = std::chrono::duration<double>(
+          now - next_log + kLogInterval).count();
+      for (auto &port : my_ports) {
+        if (!port->removed) log_rates(port.get(), seconds);
+      }
+      next_log = now + kLogInterval;
+    }
+
+    // busy-poll when the next packet is due soon, otherwise sleep until then,
+    // unless the ports change in the meantime
+    if (next_due - now <= kMaxBusyPoll) {
+      update = ports_changed || stop_gen_thread;
+      continue;
+    }
+    auto wait = std::min<clock::duration>(
+        std::min(next_due - now - kMaxBusyPoll, next_log - now), kMaxSleep);
+    UniqueLock lock(mutex);
+    update = cv.wait_for(lock, wait, [this]() {
+        return ports_changed || stop_gen_thread; });
+  }
+}
+
+TrafficGenPortMgr::TrafficGenPortMgr()
+    : pimp(new Imp()) { }
+
+TrafficGenPortMgr::~TrafficGenPortMgr() = default;
+
+bool
+TrafficGenPortMgr::is_requested(const PortExtras &port_extras) {
+  return port_extras.count(DevMgrIface::kPortExtraTrafficGen) > 0 ||
+      port_extras.count(DevMgrIface::kPortExtraTrafficSink) > 0;
+}
+
+PacketDispatcherIface::ReturnCode
+TrafficGenPortMgr::port_add(const std::string &iface_name, port_t port_num,
+                            const PortExtras &port_extras) {
+  return pimp->port_add(iface_name, port_num, port_extras);
+}
+
+bool
+TrafficGenPortMgr::port_remove(port_t port_num) {
+  return pimp->port_remove(port_num);
+}
+
+bool
+TrafficGenPortMgr::transmit(port_t port_num, const char *buffer, int len) {
+  return pimp->transmit(port_num, buffer, len);
+}
+
+bool
+TrafficGenPortMgr::port_is_up(port_t port_num, bool *is_up) const {
+  return pimp->port_is_up(port_num, is_up);
+}
+
+bool
+TrafficGenPortMgr::get_port_stats(port_t port_num, PortStats *stats) const {
+  return pimp->get_port_stats(port_num, stats);
+}
+
+bool
+TrafficGenPortMgr::clear_port_stats(port_t port_num, PortStats *stats) {
+  return pimp->clear_port_stats(port_num, stats);
+}
+
+bool
+TrafficGenPortMgr::get_sink_stats(port_t port_num, SinkStats *stats) const {
+  return pimp->get_sink_stats(port_num, stats);
+}
+
+void
+TrafficGenPortMgr::set_packet_handler(const PacketHandler &handler,
+                                      void *cookie) {
+  pimp->set_packet_handler(handler, cookie);
+}
+
+void
+TrafficGenPortMgr::start() {
+  pimp->start();
+}
+
+}  // namespace bm
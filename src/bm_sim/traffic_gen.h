@@ -0,0 +1,125 @@
+/* Copyright 2013-present Barefoot Networks, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Antonin Bas (antonin@barefootnetworks.com)
+ *
+ */
+
+#ifndef BM_SIM_TRAFFIC_GEN_H_
+#define BM_SIM_TRAFFIC_GEN_H_
+
+#include <bm/bm_sim/dev_mgr.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace bm {
+
+// Manages virtual ports which generate and / or absorb packets in-process,
+// which makes it possible to benchmark a switch without NICs or an external
+// traffic generator.
+//
+// A generator port is selected by the DevMgrIface::kPortExtraTrafficGen port
+// extra, whose value is the rate: "fast" (as fast as possible), or
+// "<N>[k|M|G]pps" / "<N>[k|M|G]bps". The packets are Ethernet / IPv4 / UDP
+// packets built from a template, with the following optional port extras:
+//   - kPortExtraTrafficGenFlows: number of flows (default 1), packets are
+//     spread round-robin over the flows, which differ by their IPv4 source
+//     address and UDP source port
+//   - kPortExtraTrafficGenSize: packet size, either "<N>", "<min>-<max>"
+//     (uniform distribution) or "imix" (64, 576 and 1500 bytes in a 7:4:1
+//     ratio); sizes exclude the FCS and must be in [kMinPacketSize,
+//     kMaxPacketSize], default is 64
+//   - kPortExtraTrafficGenRandomize: comma-separated list of fields which get
+//     a random value in each packet, among "src_mac", "dst_mac", "src_ip",
+//     "dst_ip", "src_port" and "dst_port"
+//   - kPortExtraTrafficGenCount: number of packets after which the port stops
+//     generating, 0 (the default) means no limit
+// The random generator of each port is seeded with the port number, so the
+// sequence of packets is reproducible. All generator ports are served by a
+// single thread, which injects packets in bursts and busy-polls the clock
+// between bursts when the next one is close.
+//
+// A sink port is selected by the DevMgrIface::kPortExtraTrafficSink port extra
+// (its value is ignored). Packets transmitted to a sink port are counted and
+// dropped. Generated packets end with a trailer carrying the time at which
+// they were generated, which the sink uses to measure the latency through the
+// switch; the trailer is at the end of the packet so that the measurement
+// still works if the switch adds or removes headers. A port can be both a
+// generator and a sink. Throughput and latency are logged every second.
+class TrafficGenPortMgr {
+ public:
+  using port_t = DevMgrIface::port_t;
+  using PortExtras = DevMgrIface::PortExtras;
+  using PortStats = DevMgrIface::PortStats;
+  using ReturnCode = PacketDispatcherIface::ReturnCode;
+  using PacketHandler = PacketDispatcherIface::PacketHandler;
+
+  struct SinkStats {
+    uint64_t packets;
+    uint64_t bytes;
+    // number of packets which carried a generator timestamp, the latency
+    // values are computed over these packets only
+    uint64_t latency_samples;
+    uint64_t latency_min_ns;
+    uint64_t latency_avg_ns;
+    uint64_t latency_max_ns;
+  };
+
+  // Ethernet + IPv4 + UDP headers and the timestamp trailer
+  static constexpr size_t kMinPacketSize = 60;
+  static constexpr size_t kMaxPacketSize = 9216;
+  static constexpr size_t kBurstSize = 32;
+
+  TrafficGenPortMgr();
+  ~TrafficGenPortMgr();
+
+  // returns true if the port extras select a generator or sink port
+  static bool is_requested(const PortExtras &port_extras);
+
+  ReturnCode port_add(const std::string &iface_name, port_t port_num,
+                      const PortExtras &port_extras);
+
+  // the following methods return false if the port is not a generator or sink
+  // port, in which case the caller should handle it
+  bool port_remove(port_t port_num);
+  // for a sink port, the packet is accounted for and dropped
+  bool transmit(port_t port_num, const char *buffer, int len);
+  bool port_is_up(port_t port_num, bool *is_up) const;
+  // generated packets are counted as input packets of the port, packets
+  // absorbed by a sink as output packets
+  bool get_port_stats(port_t port_num, PortStats *stats) const;
+  bool clear_port_stats(port_t port_num, PortStats *stats);
+  bool get_sink_stats(port_t port_num, SinkStats *stats) const;
+
+  void set_packet_handler(const PacketHandler &handler, void *cookie);
+
+  // starts the thread generating packets
+  void start();
+
+  TrafficGenPortMgr(const TrafficGenPortMgr &other) = delete;
+  TrafficGenPortMgr &operator=(const TrafficGenPortMgr &other) = delete;
+
+ private:
+  class Imp;
+  std::unique_ptr<Imp> pimp;
+};
+
+}  // namespace bm
+
+#endif  // BM_SIM_TRAFFIC_GEN_H_
@@ -31,6 +31,7 @@
 
 #include <unistd.h>
 
+#include <atomic>
 #include <iostream>
 #include <memory>
 #include <thread>
@@ -63,7 +64,7 @@ class SimpleSwitch : public Switch {
   }
 
   int receive_(port_t port_num, const char *buffer, int len) override {
-    static int pkt_id = 0;
+    static std::atomic<int> pkt_id{0};
 
     auto packet = new_packet_ptr(port_num, pkt_id++, len,
                                  bm::PacketBuffer(2048, buffer, len));
@@ -21,12 +21,14 @@
 #include <bm/bm_sim/parser.h>
 #include <bm/bm_sim/tables.h>
 #include <bm/bm_sim/logger.h>
+#include <bm/bm_sim/thread_affinity.h>
 
 #include <unistd.h>
 
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <vector>
 
 #include "psa_switch.h"
 
@@ -64,12 +66,12 @@ REGISTER_HASH(bmv2_hash);
 
 extern int import_primitives();
 
-packet_id_t PsaSwitch::packet_id = 0;
+std::atomic<packet_id_t> PsaSwitch::packet_id{0};
 
 PsaSwitch::PsaSwitch(port_t max_port, bool enable_swap)
   : Switch(enable_swap),
     max_port(max_port),
-    input_buffer(1024),
+    input_buffer(input_buffer_size),
 #ifdef SSWITCH_PRIORITY_QUEUEING_ON
     egress_buffers(max_port, nb_egress_threads,
                    64, EgressThreadMapper(nb_egress_threads),
@@ -108,17 +110,22 @@ PsaSwitch::PsaSwitch(port_t max_port, bool enable_swap)
 
 int
 PsaSwitch::receive_(port_t port_num, const char *buffer, int len) {
-  // this is a good place to call this, because blocking this thread will not
-  // block the processing of existing packet instances, which is a requirement
+  // we limit the packet buffer to original size + 512 bytes, which means we
+  // cannot add more than 512 bytes of header data to the packet, which should
+  // be more than enough
+  return receive_buffer_(port_num, PacketBuffer(len + 512, buffer, len));
+}
+
+int
+PsaSwitch::receive_buffer_(port_t port_num, PacketBuffer &&buffer) {
+  // the existing packet instances keep the configuration they were created
+  // with, the ones created from now on use the new one
   if (do_swap() == 0) {
     check_queueing_metadata();
   }
 
-  // we limit the packet buffer to original size + 512 bytes, which means we
-  // cannot add more than 512 bytes of header data to the packet, which should
-  // be more than enough
-  auto packet = new_packet_ptr(port_num, packet_id++, len,
-                               bm::PacketBuffer(len + 512, buffer, len));
+  int len = static_cast<int>(buffer.get_data_size());
+  auto packet = new_packet_ptr(port_num, packet_id++, len, std::move(buffer));
 
   BMELOG(packet_in, *packet);
 
@@ -220,19 +227,37 @@ PsaSwitch::get_time_since_epoch_us() const {
 void
 PsaSwitch::set_transmit_fn(TransmitFn fn) {
   my_transmit_fn = std::move(fn);
+  custom_transmit_fn = true;
 }
 
 void
 PsaSwitch::transmit_thread() {
-  while (1) {
-    std::unique_ptr<Packet> packet;
-    output_buffer.pop_back(&packet);
-    if (packet == nullptr) break;
-    BMELOG(packet_out, *packet);
-    BMLOG_DEBUG_PKT(*packet, "Transmitting packet of size {} out of port {}",
-                    packet->get_data_size(), packet->get_egress_port());
-    my_transmit_fn(packet->get_egress_port(), packet->get_packet_id(),
-                   packet->data(), packet->get_data_size());
+  bm::ThreadAffinity::apply("transmit");
+  std::vector<std::unique_ptr<Packet> > packets;
+  std::vector<bm::DevMgrIface::TxPacket> burst;
+  bool done = false;
+  while (!done) {
+    output_buffer.pop_back(&packets, transmit_burst_size);
+    for (auto &packet : packets) {
+      if (packet == nullptr) {
+        done = true;
+        break;
+      }
+      BMELOG(packet_out, *packet);
+      BMLOG_DEBUG_PKT(*packet, "Transmitting packet of size {} out of port {}",
+                      packet->get_data_size(), packet->get_egress_port());
+      if (custom_transmit_fn) {
+        my_transmit_fn(packet->get_egress_port(), packet->get_packet_id(),
+                       packet->data(), packet->get_data_size());
+      } else {
+        port_t port = packet->get_egress_port();
+        int len = packet->get_data_size();
+        burst.push_back({port, packet->release_packet_buffer(), len});
+      }
+    }
+    if (!burst.empty()) transmit_burst(burst.data(), burst.size());
+    burst.clear();
+    packets.clear();
   }
 }
 
@@ -282,7 +307,7 @@ PsaSwitch::copy_field_list_and_set_type(
     PktInstanceType copy_type, p4object_id_t field_list_id) {
   PHV *phv_copy = packet_copy->get_phv();
   phv_copy->reset_metadata();
-  FieldList *field_list = this->get_field_list(field_list_id);
+  FieldList *field_list = this->get_field_list(*packet, field_list_id);
   field_list->copy_fields_between_phvs(phv_copy, packet->get_phv());
   phv_copy->get_field("standard_metadata.instance_type").set(copy_type);
 }
@@ -305,6 +330,11 @@ PsaSwitch::check_queueing_metadata() {
 
 void
 PsaSwitch::ingress_thread() {
+  bm::ThreadAffinity::apply("ingress");
+  // the PHVs are used the most by this thread, we allocate them here so that
+  // they are local to it
+  if (bm::ThreadAffinity::is_placed("ingress"))
+    reserve_phvs(input_buffer_size);
   PHV *phv;
 
   while (1) {
@@ -312,9 +342,8 @@ PsaSwitch::ingress_thread() {
     input_buffer.pop_back(&packet);
     if (packet == nullptr) break;
 
-    // TODO(antonin): only update these if swapping actually happened?
-    Parser *parser = this->get_parser("parser");
-    Pipeline *ingress_mau = this->get_pipeline("ingress");
+    Parser *parser = this->get_parser(*packet, "parser");
+    Pipeline *ingress_mau = this->get_pipeline(*packet, "ingress");
 
     phv = packet->get_phv();
 
@@ -384,7 +413,7 @@ PsaSwitch::ingress_thread() {
 
     // LEARNING
     if (learn_id > 0) {
-      get_learn_engine()->learn(learn_id, *packet.get());
+      get_learn_engine(*packet)->learn(learn_id, *packet.get());
     }
 
     // RESUBMIT
@@ -447,6 +476,7 @@ PsaSwitch::ingress_thread() {
 
 void
 PsaSwitch::egress_thread(size_t worker_id) {
+  bm::ThreadAffinity::apply("egress", worker_id);
   PHV *phv;
 
   while (1) {
@@ -460,8 +490,8 @@ PsaSwitch::egress_thread(size_t worker_id) {
 #endif
     if (packet == nullptr) break;
 
-    Deparser *deparser = this->get_deparser("deparser");
-    Pipeline *egress_mau = this->get_pipeline("egress");
+    Deparser *deparser = this->get_deparser(*packet, "deparser");
+    Pipeline *egress_mau = this->get_pipeline(*packet, "egress");
 
     phv = packet->get_phv();
 
@@ -505,7 +535,7 @@ PsaSwitch::egress_thread(size_t worker_id) {
         std::unique_ptr<Packet> packet_copy =
             packet->clone_with_phv_reset_metadata_ptr();
         PHV *phv_copy = packet_copy->get_phv();
-        FieldList *field_list = this->get_field_list(field_list_id);
+        FieldList *field_list = this->get_field_list(*packet, field_list_id);
         field_list->copy_fields_between_phvs(phv_copy, phv);
         phv_copy->get_field("standard_metadata.instance_type")
             .set(PKT_INSTANCE_TYPE_EGRESS_CLONE);
@@ -529,7 +559,7 @@ PsaSwitch::egress_thread(size_t worker_id) {
         BMLOG_DEBUG_PKT(*packet, "Recirculating packet");
         p4object_id_t field_list_id = f_recirc.get_int();
         f_recirc.set(0);
-        FieldList *field_list = this->get_field_list(field_list_id);
+        FieldList *field_list = this->get_field_list(*packet, field_list_id);
         // TODO(antonin): just like for resubmit, there is no need for a copy
         // here, but it is more convenient for this first prototype
         std::unique_ptr<Packet> packet_copy = packet->clone_no_phv_ptr();
@@ -28,6 +28,7 @@
 #include <bm/bm_sim/event_logger.h>
 #include <bm/bm_sim/simple_pre_lag.h>
 
+#include <atomic>
 #include <memory>
 #include <chrono>
 #include <thread>
@@ -54,6 +55,7 @@ using ticks = std::chrono::nanoseconds;
 using bm::Switch;
 using bm::Queue;
 using bm::Packet;
+using bm::PacketBuffer;
 using bm::PHV;
 using bm::Parser;
 using bm::Deparser;
@@ -83,6 +85,8 @@ class PsaSwitch : public Switch {
 
   int receive_(port_t port_num, const char *buffer, int len) override;
 
+  int receive_buffer_(port_t port_num, PacketBuffer &&buffer) override;
+
   void start_and_return_() override;
 
   void reset_target_state_() override;
@@ -117,11 +121,17 @@ class PsaSwitch : public Switch {
     return (packet_id-1);
   }
 
+  // when a custom transmit function is set, the transmit thread calls it for
+  // each packet; otherwise packets are handed over to the port backend in
+  // bursts of at most transmit_burst_size packets, without copying them
   void set_transmit_fn(TransmitFn fn);
 
  private:
   static constexpr size_t nb_egress_threads = 4u;
-  static packet_id_t packet_id;
+  static constexpr size_t transmit_burst_size = 32u;
+  static constexpr size_t input_buffer_size = 1024u;
+  // atomic because the port manager may receive packets on several threads
+  static std::atomic<packet_id_t> packet_id;
 
   enum PktInstanceType {
     PKT_INSTANCE_TYPE_NORMAL,
@@ -182,6 +192,7 @@ class PsaSwitch : public Switch {
   egress_buffers;
   Queue<std::unique_ptr<Packet> > output_buffer;
   TransmitFn my_transmit_fn;
+  bool custom_transmit_fn{false};
   std::shared_ptr<McSimplePreLAG> pre;
   clock::time_point start;
   std::unordered_map<mirror_id_t, port_t> mirroring_map;
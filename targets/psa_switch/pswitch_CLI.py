@@ -85,7 +85,7 @@ def main():
     services.extend(PsaSwitchAPI.get_thrift_services())
 
     standard_client, mc_client, pswitch_client = runtime_CLI.thrift_connect(
-        args.thrift_ip, args.thrift_port, services
+        args.thrift_ip, args.thrift_port, services, args.thrift_framed
     )
 
     runtime_CLI.load_json_config(standard_client, args.json)
@@ -30,6 +30,7 @@
 
 #include <unistd.h>
 
+#include <atomic>
 #include <iostream>
 #include <memory>
 #include <thread>
@@ -55,10 +56,7 @@ class SimpleSwitch : public Switch {
   }
 
   int receive_(port_t port_num, const char *buffer, int len) override {
-    static int pkt_id = 0;
-
-    if (this->do_swap() == 0)  // a swap took place
-      swap_happened = true;
+    static std::atomic<int> pkt_id{0};
 
     auto packet = new_packet_ptr(port_num, pkt_id++, len,
                                  bm::PacketBuffer(2048, buffer, len));
@@ -83,7 +81,6 @@ class SimpleSwitch : public Switch {
  private:
   Queue<std::unique_ptr<Packet> > input_buffer;
   Queue<std::unique_ptr<Packet> > output_buffer;
-  bool swap_happened{false};
 };
 
 void SimpleSwitch::transmit_thread() {
@@ -99,10 +96,6 @@ void SimpleSwitch::transmit_thread() {
 }
 
 void SimpleSwitch::pipeline_thread() {
-  Pipeline *ingress_mau = this->get_pipeline("ingress");
-  Pipeline *egress_mau = this->get_pipeline("egress");
-  Parser *parser = this->get_parser("parser");
-  Deparser *deparser = this->get_deparser("deparser");
   PHV *phv;
 
   while (1) {
@@ -110,20 +103,18 @@ void SimpleSwitch::pipeline_thread() {
     input_buffer.pop_back(&packet);
     phv = packet->get_phv();
 
+    // swap is enabled, the packet may use a configuration which has been
+    // swapped out since it was received
+    Pipeline *ingress_mau = this->get_pipeline(*packet, "ingress");
+    Pipeline *egress_mau = this->get_pipeline(*packet, "egress");
+    Parser *parser = this->get_parser(*packet, "parser");
+    Deparser *deparser = this->get_deparser(*packet, "deparser");
+
     int ingress_port = packet->get_ingress_port();
     (void) ingress_port;
     BMLOG_DEBUG_PKT(*packet, "Processing packet received on port {}",
                     ingress_port);
 
-    // update pointers if needed
-    if (swap_happened) {  // a swap took place
-      ingress_mau = this->get_pipeline("ingress");
-      egress_mau = this->get_pipeline("egress");
-      parser = this->get_parser("parser");
-      deparser = this->get_deparser("deparser");
-      swap_happened = false;
-    }
-
     parser->parse(packet.get());
     ingress_mau->apply(packet.get());
 
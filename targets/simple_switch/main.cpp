@@ -43,6 +43,9 @@ class SimpleSwitchParser : public bm::TargetParserBasic {
   SimpleSwitchParser() {
     add_flag_option("enable-swap",
                     "enable JSON swapping at runtime");
+    add_flag_option("swap-migrate-state",
+                    "carry table entries, counters, registers and meters over "
+                    "to the new JSON when swapping");
 #ifdef BM_ENABLE_MODULES
     add_string_option(load_modules_option,
                       "load the given .so files as modules");
@@ -91,6 +94,14 @@ class SimpleSwitchParser : public bm::TargetParserBasic {
     if (get_flag_option("enable-swap", &enable_swap) != ReturnCode::SUCCESS)
       std::exit(1);
     if (enable_swap) simple_switch->enable_config_swap();
+    bool migrate_state = false;
+    if (get_flag_option("swap-migrate-state", &migrate_state) !=
+        ReturnCode::SUCCESS)
+      std::exit(1);
+    if (migrate_state) {
+      simple_switch->set_swap_mode(
+          bm::SwitchWContexts::SwapMode::MIGRATE_STATE);
+    }
   }
 };
 
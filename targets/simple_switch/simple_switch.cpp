@@ -21,12 +21,14 @@
 #include <bm/bm_sim/parser.h>
 #include <bm/bm_sim/tables.h>
 #include <bm/bm_sim/logger.h>
+#include <bm/bm_sim/thread_affinity.h>
 
 #include <unistd.h>
 
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <vector>
 
 #include "simple_switch.h"
 
@@ -64,12 +66,12 @@ REGISTER_HASH(bmv2_hash);
 
 extern int import_primitives();
 
-packet_id_t SimpleSwitch::packet_id = 0;
+std::atomic<packet_id_t> SimpleSwitch::packet_id{0};
 
 SimpleSwitch::SimpleSwitch(port_t max_port, bool enable_swap)
   : Switch(enable_swap),
     max_port(max_port),
-    input_buffer(1024),
+    input_buffer(input_buffer_size),
 #ifdef SSWITCH_PRIORITY_QUEUEING_ON
     egress_buffers(max_port, nb_egress_threads,
                    64, EgressThreadMapper(nb_egress_threads),
@@ -78,6 +80,7 @@ SimpleSwitch::SimpleSwitch(port_t max_port, bool enable_swap)
     egress_buffers(max_port, nb_egress_threads,
                    64, EgressThreadMapper(nb_egress_threads)),
 #endif
+    egress_aqm(max_port * nb_queues_per_port),
     output_buffer(128),
     // cannot use std::bind because of a clang bug
     // https://stackoverflow.com/questions/32030141/is-this-incorrect-use-of-stdbind-or-a-compiler-bug
@@ -87,7 +90,9 @@ SimpleSwitch::SimpleSwitch(port_t max_port, bool enable_swap)
         this->transmit_fn(port_num, buffer, len);
     }),
     pre(new McSimplePreLAG()),
-    start(clock::now()) {
+    start(clock::now()),
+    latency_stats({"receive", "parser", "ingress", "queueing", "egress",
+                   "deparser", "transmit", "total"}) {
   add_component<McSimplePreLAG>(pre);
 
   add_required_field("standard_metadata", "ingress_port");
@@ -105,20 +110,32 @@ SimpleSwitch::SimpleSwitch(port_t max_port, bool enable_swap)
 }
 
 #define PACKET_LENGTH_REG_IDX 0
+// time at which the packet was last enqueued in the egress buffers
+#define PACKET_ENQ_TS_REG_IDX 1
+// time at which the packet was received and at which its current stage
+// started, for the latency histograms (bm::LatencyStats::now_ns()), 0 when
+// unknown
+#define PACKET_RX_NS_REG_IDX 2
+#define PACKET_STAGE_NS_REG_IDX 3
 
 int
 SimpleSwitch::receive_(port_t port_num, const char *buffer, int len) {
-  // this is a good place to call this, because blocking this thread will not
-  // block the processing of existing packet instances, which is a requirement
+  // we limit the packet buffer to original size + 512 bytes, which means we
+  // cannot add more than 512 bytes of header data to the packet, which should
+  // be more than enough
+  return receive_buffer_(port_num, PacketBuffer(len + 512, buffer, len));
+}
+
+int
+SimpleSwitch::receive_buffer_(port_t port_num, PacketBuffer &&buffer) {
+  // the existing packet instances keep the configuration they were created
+  // with, the ones created from now on use the new one
   if (do_swap() == 0) {
     check_queueing_metadata();
   }
 
-  // we limit the packet buffer to original size + 512 bytes, which means we
-  // cannot add more than 512 bytes of header data to the packet, which should
-  // be more than enough
-  auto packet = new_packet_ptr(port_num, packet_id++, len,
-                               bm::PacketBuffer(len + 512, buffer, len));
+  int len = static_cast<int>(buffer.get_data_size());
+  auto packet = new_packet_ptr(port_num, packet_id++, len, std::move(buffer));
 
   BMELOG(packet_in, *packet);
 
@@ -137,6 +154,12 @@ SimpleSwitch::receive_(port_t port_num, const char *buffer, int len) {
   Field &f_instance_type = phv->get_field("standard_metadata.instance_type");
   f_instance_type.set(PKT_INSTANCE_TYPE_NORMAL);
 
+  if (latency_stats.is_enabled()) {
+    auto now = bm::LatencyStats::now_ns();
+    packet->set_register(PACKET_RX_NS_REG_IDX, now);
+    packet->set_register(PACKET_STAGE_NS_REG_IDX, now);
+  }
+
   if (phv->has_field("intrinsic_metadata.ingress_global_timestamp")) {
     phv->get_field("intrinsic_metadata.ingress_global_timestamp")
         .set(get_ts().count());
@@ -160,7 +183,9 @@ SimpleSwitch::start_and_return_() {
 SimpleSwitch::~SimpleSwitch() {
   input_buffer.push_front(nullptr);
   for (size_t i = 0; i < nb_egress_threads; i++) {
-#ifdef SSWITCH_PRIORITY_QUEUEING_ON
+#if defined(SSWITCH_HIERARCHICAL_TM_ON)
+    egress_buffers.push_front(i, 0, 0, nullptr);
+#elif defined(SSWITCH_PRIORITY_QUEUEING_ON)
     egress_buffers.push_front(i, 0, nullptr);
 #else
     egress_buffers.push_front(i, nullptr);
@@ -194,8 +219,17 @@ SimpleSwitch::set_all_egress_queue_depths(const size_t depth_pkts) {
 
 int
 SimpleSwitch::set_egress_queue_rate(size_t port, const uint64_t rate_pps) {
+#ifdef SSWITCH_HIERARCHICAL_TM_ON
+  _BM_UNUSED(port);
+  _BM_UNUSED(rate_pps);
+  bm::Logger::get()->error(
+      "Packet rates are not supported by the hierarchical traffic manager, "
+      "use byte rates instead");
+  return 1;
+#else
   egress_buffers.set_rate(port, rate_pps);
   return 0;
+#endif
 }
 
 int
@@ -206,6 +240,227 @@ SimpleSwitch::set_all_egress_queue_rates(const uint64_t rate_pps) {
   return 0;
 }
 
+#ifdef SSWITCH_HIERARCHICAL_TM_ON
+
+bool
+SimpleSwitch::check_tm_queue(size_t port, size_t priority) const {
+  if (port >= max_port) {
+    bm::Logger::get()->error("Invalid egress port {}", port);
+    return false;
+  }
+  if (priority >= SSWITCH_PRIORITY_QUEUEING_NB_QUEUES) {
+    bm::Logger::get()->error("Invalid priority {}", priority);
+    return false;
+  }
+  return true;
+}
+
+// the P4 priority value is reversed when pushing to egress_buffers (see
+// enqueue), we need to do the same here
+#define SSWITCH_TM_PRIORITY(priority) \
+  (SSWITCH_PRIORITY_QUEUEING_NB_QUEUES - 1 - (priority))
+
+int
+SimpleSwitch::set_egress_queue_strict_priority(size_t port, size_t priority) {
+  if (!check_tm_queue(port, priority)) return 1;
+  egress_buffers.set_strict_priority(port, SSWITCH_TM_PRIORITY(priority));
+  return 0;
+}
+
+int
+SimpleSwitch::set_egress_queue_weight(size_t port, size_t priority,
+                                      const uint32_t weight) {
+  if (!check_tm_queue(port, priority)) return 1;
+  if (weight == 0) {
+    bm::Logger::get()->error("DRR weight needs to be strictly positive");
+    return 1;
+  }
+  egress_buffers.set_weight(port, SSWITCH_TM_PRIORITY(priority), weight);
+  return 0;
+}
+
+int
+SimpleSwitch::set_egress_queue_min_rate(size_t port, size_t priority,
+                                        const uint64_t rate_bps,
+                                        const size_t burst_bytes) {
+  if (!check_tm_queue(port, priority)) return 1;
+  egress_buffers.set_min_rate(port, SSWITCH_TM_PRIORITY(priority), rate_bps,
+                              burst_bytes);
+  return 0;
+}
+
+int
+SimpleSwitch::set_egress_queue_max_rate(size_t port, size_t priority,
+                                        const uint64_t rate_bps,
+                                        const size_t burst_bytes) {
+  if (!check_tm_queue(port, priority)) return 1;
+  egress_buffers.set_max_rate(port, SSWITCH_TM_PRIORITY(priority), rate_bps,
+                              burst_bytes);
+  return 0;
+}
+
+int
+SimpleSwitch::set_egress_port_min_rate(size_t port, const uint64_t rate_bps,
+                                       const size_t burst_bytes) {
+  if (!check_tm_queue(port, 0)) return 1;
+  egress_buffers.set_min_rate(port, rate_bps, burst_bytes);
+  return 0;
+}
+
+int
+SimpleSwitch::set_egress_port_max_rate(size_t port, const uint64_t rate_bps,
+                                       const size_t burst_bytes) {
+  if (!check_tm_queue(port, 0)) return 1;
+  egress_buffers.set_max_rate(port, rate_bps, burst_bytes);
+  return 0;
+}
+
+#undef SSWITCH_TM_PRIORITY
+
+#else
+
+namespace {
+
+int tm_not_enabled() {
+  bm::Logger::get()->error(
+      "The hierarchical traffic manager is not enabled, you need to compile "
+      "simple_switch with SSWITCH_HIERARCHICAL_TM_ON");
+  return 1;
+}
+
+}  // namespace
+
+int
+SimpleSwitch::set_egress_queue_strict_priority(size_t, size_t) {
+  return tm_not_enabled();
+}
+
+int
+SimpleSwitch::set_egress_queue_weight(size_t, size_t, const uint32_t) {
+  return tm_not_enabled();
+}
+
+int
+SimpleSwitch::set_egress_queue_min_rate(size_t, size_t, const uint64_t,
+                                        const size_t) {
+  return tm_not_enabled();
+}
+
+int
+SimpleSwitch::set_egress_queue_max_rate(size_t, size_t, const uint64_t,
+                                        const size_t) {
+  return tm_not_enabled();
+}
+
+int
+SimpleSwitch::set_egress_port_min_rate(size_t, const uint64_t, const size_t) {
+  return tm_not_enabled();
+}
+
+int
+SimpleSwitch::set_egress_port_max_rate(size_t, const uint64_t, const size_t) {
+  return tm_not_enabled();
+}
+
+#endif  // SSWITCH_HIERARCHICAL_TM_ON
+
+bm::RateLimiterStats
+SimpleSwitch::get_egress_queue_rate_limiter_stats() const {
+  return egress_buffers.get_rate_limiter_stats();
+}
+
+int
+SimpleSwitch::reset_egress_queue_rate_limiter_stats() {
+  egress_buffers.reset_rate_limiter_stats();
+  return 0;
+}
+
+bm::QueueAQM *
+SimpleSwitch::get_egress_queue_aqm(size_t port, size_t priority) {
+  if (port >= max_port || priority >= nb_queues_per_port) return nullptr;
+  return &egress_aqm[port * nb_queues_per_port + priority];
+}
+
+const bm::QueueAQM *
+SimpleSwitch::get_egress_queue_aqm(size_t port, size_t priority) const {
+  if (port >= max_port || priority >= nb_queues_per_port) return nullptr;
+  return &egress_aqm[port * nb_queues_per_port + priority];
+}
+
+bool
+SimpleSwitch::is_ecn_capable(PHV *phv) const {
+  // ECT(0), ECT(1) or CE
+  return phv->has_field("intrinsic_metadata.ecn") &&
+      phv->get_field("intrinsic_metadata.ecn").get_uint() != 0;
+}
+
+void
+SimpleSwitch::ecn_mark(PHV *phv) const {
+  // CE codepoint; only called for ECN-capable packets, so the field exists
+  phv->get_field("intrinsic_metadata.ecn").set(3);
+}
+
+int
+SimpleSwitch::set_egress_queue_red(size_t port, size_t priority,
+                                   const size_t min_th, const size_t max_th,
+                                   const double max_p, const bool ecn) {
+  auto *aqm = get_egress_queue_aqm(port, priority);
+  if (!aqm) return 1;
+  bm::QueueAQM::RedConfig config;
+  config.min_th = min_th;
+  config.max_th = max_th;
+  config.max_p = max_p;
+  config.weight_shift = bm::QueueAQM::default_red_weight_shift;
+  config.ecn = ecn;
+  return aqm->set_red(config);
+}
+
+int
+SimpleSwitch::set_egress_queue_codel(size_t port, size_t priority,
+                                     const uint64_t target_us,
+                                     const uint64_t interval_us,
+                                     const bool ecn) {
+  auto *aqm = get_egress_queue_aqm(port, priority);
+  if (!aqm) return 1;
+  return aqm->set_codel({target_us, interval_us, ecn});
+}
+
+int
+SimpleSwitch::set_egress_queue_pie(size_t port, size_t priority,
+                                   const uint64_t target_us,
+                                   const uint64_t t_update_us,
+                                   const uint64_t max_burst_us,
+                                   const bool ecn) {
+  auto *aqm = get_egress_queue_aqm(port, priority);
+  if (!aqm) return 1;
+  return aqm->set_pie({target_us, t_update_us, max_burst_us, ecn});
+}
+
+int
+SimpleSwitch::disable_egress_queue_aqm(size_t port, size_t priority) {
+  auto *aqm = get_egress_queue_aqm(port, priority);
+  if (!aqm) return 1;
+  aqm->disable();
+  return 0;
+}
+
+int
+SimpleSwitch::get_egress_queue_aqm_counters(
+    size_t port, size_t priority, bm::QueueAQM::Counters *counters) const {
+  const auto *aqm = get_egress_queue_aqm(port, priority);
+  if (!aqm) return 1;
+  *counters = aqm->get_counters();
+  return 0;
+}
+
+int
+SimpleSwitch::reset_egress_queue_aqm_counters(size_t port, size_t priority) {
+  auto *aqm = get_egress_queue_aqm(port, priority);
+  if (!aqm) return 1;
+  aqm->reset_counters();
+  return 0;
+}
+
 uint64_t
 SimpleSwitch::get_time_elapsed_us() const {
   return get_ts().count();
@@ -220,19 +475,42 @@ SimpleSwitch::get_time_since_epoch_us() const {
 void
 SimpleSwitch::set_transmit_fn(TransmitFn fn) {
   my_transmit_fn = std::move(fn);
+  custom_transmit_fn = true;
 }
 
 void
 SimpleSwitch::transmit_thread() {
-  while (1) {
-    std::unique_ptr<Packet> packet;
-    output_buffer.pop_back(&packet);
-    if (packet == nullptr) break;
-    BMELOG(packet_out, *packet);
-    BMLOG_DEBUG_PKT(*packet, "Transmitting packet of size {} out of port {}",
-                    packet->get_data_size(), packet->get_egress_port());
-    my_transmit_fn(packet->get_egress_port(), packet->get_packet_id(),
-                   packet->data(), packet->get_data_size());
+  bm::ThreadAffinity::apply("transmit");
+  std::vector<std::unique_ptr<Packet> > packets;
+  std::vector<bm::DevMgrIface::TxPacket> burst;
+  bool done = false;
+  while (!done) {
+    output_buffer.pop_back(&packets, transmit_burst_size);
+    for (auto &packet : packets) {
+      if (packet == nullptr) {
+        done = true;
+        break;
+      }
+      BMELOG(packet_out, *packet);
+      BMLOG_DEBUG_PKT(*packet, "Transmitting packet of size {} out of port {}",
+                      packet->get_data_size(), packet->get_egress_port());
+      if (custom_transmit_fn) {
+        my_transmit_fn(packet->get_egress_port(), packet->get_packet_id(),
+                       packet->data(), packet->get_data_size());
+      } else {
+        port_t port = packet->get_egress_port();
+        int len = packet->get_data_size();
+        burst.push_back({port, packet->release_packet_buffer(), len});
+      }
+    }
+    if (!burst.empty()) transmit_burst(burst.data(), burst.size());
+    burst.clear();
+    if (latency_stats.is_enabled()) {
+      auto now = bm::LatencyStats::now_ns();
+      for (auto &packet : packets)
+        if (packet) record_transmit_latency(packet.get(), now);
+    }
+    packets.clear();
   }
 }
 
@@ -253,12 +531,6 @@ SimpleSwitch::enqueue(port_t egress_port, std::unique_ptr<Packet> &&packet) {
 
     PHV *phv = packet->get_phv();
 
-    if (with_queueing_metadata) {
-      phv->get_field("queueing_metadata.enq_timestamp").set(get_ts().count());
-      phv->get_field("queueing_metadata.enq_qdepth")
-          .set(egress_buffers.size(egress_port));
-    }
-
 #ifdef SSWITCH_PRIORITY_QUEUEING_ON
     size_t priority = phv->has_field(SSWITCH_PRIORITY_QUEUEING_SRC) ?
         phv->get_field(SSWITCH_PRIORITY_QUEUEING_SRC).get<size_t>() : 0u;
@@ -266,15 +538,56 @@ SimpleSwitch::enqueue(port_t egress_port, std::unique_ptr<Packet> &&packet) {
       bm::Logger::get()->error("Priority out of range, dropping packet");
       return;
     }
+    size_t qdepth = egress_buffers.size(
+        egress_port, SSWITCH_PRIORITY_QUEUEING_NB_QUEUES - 1 - priority);
+#else
+    size_t priority = 0u;
+    size_t qdepth = egress_buffers.size(egress_port);
+#endif
+
+    uint64_t now = get_ts().count();
+    packet->set_register(PACKET_ENQ_TS_REG_IDX, now);
+
+    auto *aqm = get_egress_queue_aqm(egress_port, priority);
+    if (aqm->get_mode() != bm::QueueAQM::Mode::NONE) {
+      switch (aqm->on_enqueue(qdepth, now, is_ecn_capable(phv))) {
+        case bm::QueueAQM::Verdict::DROP:
+          BMLOG_DEBUG_PKT(*packet, "Dropping packet at enqueue (AQM)");
+          return;
+        case bm::QueueAQM::Verdict::MARK:
+          BMLOG_DEBUG_PKT(*packet, "ECN-marking packet at enqueue (AQM)");
+          ecn_mark(phv);
+          break;
+        default:
+          break;
+      }
+    }
+
+    if (with_queueing_metadata) {
+      phv->get_field("queueing_metadata.enq_timestamp").set(now);
+      phv->get_field("queueing_metadata.enq_qdepth")
+          .set(egress_buffers.size(egress_port));
+    }
+
+    start_latency_stage(packet.get());
+
+#ifdef SSWITCH_PRIORITY_QUEUEING_ON
+#ifdef SSWITCH_HIERARCHICAL_TM_ON
+    size_t packet_size = packet->get_register(PACKET_LENGTH_REG_IDX);
+    egress_buffers.push_front(
+        egress_port, SSWITCH_PRIORITY_QUEUEING_NB_QUEUES - 1 - priority,
+        packet_size, std::move(packet));
+#else
     egress_buffers.push_front(
         egress_port, SSWITCH_PRIORITY_QUEUEING_NB_QUEUES - 1 - priority,
         std::move(packet));
+#endif
 #else
     egress_buffers.push_front(egress_port, std::move(packet));
 #endif
 }
 
-// used for ingress cloning, resubmit
+// used for ingress cloning
 void
 SimpleSwitch::copy_field_list_and_set_type(
     const std::unique_ptr<Packet> &packet,
@@ -282,11 +595,44 @@ SimpleSwitch::copy_field_list_and_set_type(
     PktInstanceType copy_type, p4object_id_t field_list_id) {
   PHV *phv_copy = packet_copy->get_phv();
   phv_copy->reset_metadata();
-  FieldList *field_list = this->get_field_list(field_list_id);
+  FieldList *field_list = this->get_field_list(*packet, field_list_id);
   field_list->copy_fields_between_phvs(phv_copy, packet->get_phv());
   phv_copy->get_field("standard_metadata.instance_type").set(copy_type);
 }
 
+void
+SimpleSwitch::start_latency_stage(Packet *packet) {
+  packet->set_register(
+      PACKET_STAGE_NS_REG_IDX,
+      latency_stats.is_enabled() ? bm::LatencyStats::now_ns() : 0);
+}
+
+void
+SimpleSwitch::end_latency_stage(Packet *packet, LatencyStage stage) {
+  if (!latency_stats.is_enabled()) return;
+  auto now = bm::LatencyStats::now_ns();
+  // 0 if the packet was received or enqueued while the instrumentation was
+  // disabled
+  auto stage_start = packet->get_register(PACKET_STAGE_NS_REG_IDX);
+  if (stage_start != 0 && now >= stage_start)
+    latency_stats.record(static_cast<size_t>(stage), now - stage_start);
+  packet->set_register(PACKET_STAGE_NS_REG_IDX, now);
+}
+
+void
+SimpleSwitch::record_transmit_latency(Packet *packet, uint64_t now_ns) {
+  auto stage_start = packet->get_register(PACKET_STAGE_NS_REG_IDX);
+  if (stage_start != 0 && now_ns >= stage_start) {
+    latency_stats.record(static_cast<size_t>(LatencyStage::TRANSMIT),
+                         now_ns - stage_start);
+  }
+  auto rx = packet->get_register(PACKET_RX_NS_REG_IDX);
+  if (rx != 0 && now_ns >= rx) {
+    latency_stats.record(static_cast<size_t>(LatencyStage::TOTAL),
+                         now_ns - rx);
+  }
+}
+
 void
 SimpleSwitch::check_queueing_metadata() {
   // TODO(antonin): add qid in required fields
@@ -305,6 +651,11 @@ SimpleSwitch::check_queueing_metadata() {
 
 void
 SimpleSwitch::ingress_thread() {
+  bm::ThreadAffinity::apply("ingress");
+  // the PHVs are used the most by this thread, we allocate them here so that
+  // they are local to it
+  if (bm::ThreadAffinity::is_placed("ingress"))
+    reserve_phvs(input_buffer_size);
   PHV *phv;
 
   while (1) {
@@ -312,9 +663,8 @@ SimpleSwitch::ingress_thread() {
     input_buffer.pop_back(&packet);
     if (packet == nullptr) break;
 
-    // TODO(antonin): only update these if swapping actually happened?
-    Parser *parser = this->get_parser("parser");
-    Pipeline *ingress_mau = this->get_pipeline("ingress");
+    Parser *parser = this->get_parser(*packet, "parser");
+    Pipeline *ingress_mau = this->get_pipeline(*packet, "ingress");
 
     phv = packet->get_phv();
 
@@ -330,10 +680,14 @@ SimpleSwitch::ingress_thread() {
        kind of looks hacky though. Maybe a better solution would be to have the
        parser leave the buffer unchanged, and move the pop logic to the
        deparser. TODO? */
+    end_latency_stage(packet.get(), LatencyStage::RECEIVE);
+
     const Packet::buffer_state_t packet_in_state = packet->save_buffer_state();
     parser->parse(packet.get());
+    end_latency_stage(packet.get(), LatencyStage::PARSER);
 
     ingress_mau->apply(packet.get());
+    end_latency_stage(packet.get(), LatencyStage::INGRESS);
 
     packet->reset_exit();
 
@@ -384,7 +738,7 @@ SimpleSwitch::ingress_thread() {
 
     // LEARNING
     if (learn_id > 0) {
-      get_learn_engine()->learn(learn_id, *packet.get());
+      get_learn_engine(*packet)->learn(learn_id, *packet.get());
     }
 
     // RESUBMIT
@@ -397,13 +751,13 @@ SimpleSwitch::ingress_thread() {
         packet->restore_buffer_state(packet_in_state);
         p4object_id_t field_list_id = f_resubmit.get_int();
         f_resubmit.set(0);
-        // TODO(antonin): a copy is not needed here, but I don't yet have an
-        // optimized way of doing this
-        std::unique_ptr<Packet> packet_copy = packet->clone_no_phv_ptr();
-        copy_field_list_and_set_type(packet, packet_copy,
-                                     PKT_INSTANCE_TYPE_RESUBMIT,
-                                     field_list_id);
-        input_buffer.push_front(std::move(packet_copy));
+        // no copy needed, the packet is moved back to the input buffer with a
+        // fresh PHV in which only the field list is preserved
+        packet->reset_phv(this->get_field_list(*packet, field_list_id));
+        packet->get_phv()->get_field("standard_metadata.instance_type")
+            .set(PKT_INSTANCE_TYPE_RESUBMIT);
+        packet->set_register(PACKET_LENGTH_REG_IDX, packet->get_data_size());
+        input_buffer.push_front(std::move(packet));
         continue;
       }
     }
@@ -425,6 +779,8 @@ SimpleSwitch::ingress_thread() {
         f_instance_type.set(PKT_INSTANCE_TYPE_REPLICATION);
         std::unique_ptr<Packet> packet_copy = packet->clone_with_phv_ptr();
         packet_copy->set_register(PACKET_LENGTH_REG_IDX, packet_size);
+        packet_copy->set_register(PACKET_RX_NS_REG_IDX,
+                                  packet->get_register(PACKET_RX_NS_REG_IDX));
         enqueue(egress_port, std::move(packet_copy));
       }
       f_instance_type.set(instance_type);
@@ -447,6 +803,7 @@ SimpleSwitch::ingress_thread() {
 
 void
 SimpleSwitch::egress_thread(size_t worker_id) {
+  bm::ThreadAffinity::apply("egress", worker_id);
   PHV *phv;
 
   while (1) {
@@ -460,30 +817,51 @@ SimpleSwitch::egress_thread(size_t worker_id) {
 #endif
     if (packet == nullptr) break;
 
-    Deparser *deparser = this->get_deparser("deparser");
-    Pipeline *egress_mau = this->get_pipeline("egress");
+    Deparser *deparser = this->get_deparser(*packet, "deparser");
+    Pipeline *egress_mau = this->get_pipeline(*packet, "egress");
 
     phv = packet->get_phv();
 
+    end_latency_stage(packet.get(), LatencyStage::QUEUEING);
+
     if (phv->has_field("intrinsic_metadata.egress_global_timestamp")) {
       phv->get_field("intrinsic_metadata.egress_global_timestamp")
           .set(get_ts().count());
     }
 
+    uint64_t now = get_ts().count();
+    uint64_t deq_timedelta = now - packet->get_register(PACKET_ENQ_TS_REG_IDX);
+
+#ifdef SSWITCH_PRIORITY_QUEUEING_ON
+    size_t p4_priority = SSWITCH_PRIORITY_QUEUEING_NB_QUEUES - 1 - priority;
+#else
+    size_t p4_priority = 0u;
+#endif
+    auto *aqm = get_egress_queue_aqm(port, p4_priority);
+    if (aqm->get_mode() != bm::QueueAQM::Mode::NONE) {
+#ifdef SSWITCH_PRIORITY_QUEUEING_ON
+      size_t qdepth = egress_buffers.size(port, priority);
+#else
+      size_t qdepth = egress_buffers.size(port);
+#endif
+      auto verdict = aqm->on_dequeue(deq_timedelta, qdepth, now,
+                                     is_ecn_capable(phv));
+      if (verdict == bm::QueueAQM::Verdict::DROP) {
+        BMLOG_DEBUG_PKT(*packet, "Dropping packet at dequeue (AQM)");
+        continue;
+      } else if (verdict == bm::QueueAQM::Verdict::MARK) {
+        BMLOG_DEBUG_PKT(*packet, "ECN-marking packet at dequeue (AQM)");
+        ecn_mark(phv);
+      }
+    }
+
     if (with_queueing_metadata) {
-      auto enq_timestamp =
-          phv->get_field("queueing_metadata.enq_timestamp").get<ts_res::rep>();
-      phv->get_field("queueing_metadata.deq_timedelta").set(
-          get_ts().count() - enq_timestamp);
+      phv->get_field("queueing_metadata.deq_timedelta").set(deq_timedelta);
       phv->get_field("queueing_metadata.deq_qdepth").set(
           egress_buffers.size(port));
       if (phv->has_field("queueing_metadata.qid")) {
         auto &qid_f = phv->get_field("queueing_metadata.qid");
-#ifdef SSWITCH_PRIORITY_QUEUEING_ON
-        qid_f.set(SSWITCH_PRIORITY_QUEUEING_NB_QUEUES - 1 - priority);
-#else
-        qid_f.set(0);
-#endif
+        qid_f.set(p4_priority);
       }
     }
 
@@ -496,6 +874,7 @@ SimpleSwitch::egress_thread(size_t worker_id) {
         packet->get_register(PACKET_LENGTH_REG_IDX));
 
     egress_mau->apply(packet.get());
+    end_latency_stage(packet.get(), LatencyStage::EGRESS);
 
     Field &f_clone_spec = phv->get_field("standard_metadata.clone_spec");
     unsigned int clone_spec = f_clone_spec.get_uint();
@@ -510,7 +889,7 @@ SimpleSwitch::egress_thread(size_t worker_id) {
         std::unique_ptr<Packet> packet_copy =
             packet->clone_with_phv_reset_metadata_ptr();
         PHV *phv_copy = packet_copy->get_phv();
-        FieldList *field_list = this->get_field_list(field_list_id);
+        FieldList *field_list = this->get_field_list(*packet, field_list_id);
         field_list->copy_fields_between_phvs(phv_copy, phv);
         phv_copy->get_field("standard_metadata.instance_type")
             .set(PKT_INSTANCE_TYPE_EGRESS_CLONE);
@@ -526,6 +905,7 @@ SimpleSwitch::egress_thread(size_t worker_id) {
     }
 
     deparser->deparse(packet.get());
+    end_latency_stage(packet.get(), LatencyStage::DEPARSER);
 
     // RECIRCULATE
     if (phv->has_field("intrinsic_metadata.recirculate_flag")) {
@@ -534,22 +914,17 @@ SimpleSwitch::egress_thread(size_t worker_id) {
         BMLOG_DEBUG_PKT(*packet, "Recirculating packet");
         p4object_id_t field_list_id = f_recirc.get_int();
         f_recirc.set(0);
-        FieldList *field_list = this->get_field_list(field_list_id);
-        // TODO(antonin): just like for resubmit, there is no need for a copy
-        // here, but it is more convenient for this first prototype
-        std::unique_ptr<Packet> packet_copy = packet->clone_no_phv_ptr();
-        PHV *phv_copy = packet_copy->get_phv();
-        phv_copy->reset_metadata();
-        field_list->copy_fields_between_phvs(phv_copy, phv);
-        phv_copy->get_field("standard_metadata.instance_type")
+        // just like for resubmit, the packet is moved back to the input buffer
+        // with a fresh PHV, there is no need for a copy
+        packet->reset_phv(this->get_field_list(*packet, field_list_id));
+        phv = packet->get_phv();
+        phv->get_field("standard_metadata.instance_type")
             .set(PKT_INSTANCE_TYPE_RECIRC);
-        size_t packet_size = packet_copy->get_data_size();
-        packet_copy->set_register(PACKET_LENGTH_REG_IDX, packet_size);
-        phv_copy->get_field("standard_metadata.packet_length").set(packet_size);
-        // TODO(antonin): really it may be better to create a new packet here or
-        // to fold this functionality into the Packet class?
-        packet_copy->set_ingress_length(packet_size);
-        input_buffer.push_front(std::move(packet_copy));
+        size_t packet_size = packet->get_data_size();
+        packet->set_register(PACKET_LENGTH_REG_IDX, packet_size);
+        phv->get_field("standard_metadata.packet_length").set(packet_size);
+        packet->set_ingress_length(packet_size);
+        input_buffer.push_front(std::move(packet));
         continue;
       }
     }
@@ -21,6 +21,8 @@
 #ifndef SIMPLE_SWITCH_SIMPLE_SWITCH_H_
 #define SIMPLE_SWITCH_SIMPLE_SWITCH_H_
 
+#include <bm/bm_sim/aqm.h>
+#include <bm/bm_sim/latency_stats.h>
 #include <bm/bm_sim/queue.h>
 #include <bm/bm_sim/queueing.h>
 #include <bm/bm_sim/packet.h>
@@ -28,6 +30,7 @@
 #include <bm/bm_sim/event_logger.h>
 #include <bm/bm_sim/simple_pre_lag.h>
 
+#include <atomic>
 #include <memory>
 #include <chrono>
 #include <thread>
@@ -42,6 +45,17 @@
 // PRIORITY 0 IS THE LOWEST PRIORITY
 // #define SSWITCH_PRIORITY_QUEUEING_ON
 
+// TODO(antonin)
+// experimental support for a hierarchical traffic manager (strict priority and
+// DRR scheduling between priority queues, byte-based min / max rates for each
+// queue and each port), see bm::QueueingLogicHierarchical
+// to enable it, uncomment this flag (it implies priority queueing)
+// #define SSWITCH_HIERARCHICAL_TM_ON
+
+#ifdef SSWITCH_HIERARCHICAL_TM_ON
+#define SSWITCH_PRIORITY_QUEUEING_ON
+#endif
+
 #ifdef SSWITCH_PRIORITY_QUEUEING_ON
 #define SSWITCH_PRIORITY_QUEUEING_NB_QUEUES 8
 #define SSWITCH_PRIORITY_QUEUEING_SRC "intrinsic_metadata.priority"
@@ -54,6 +68,7 @@ using ticks = std::chrono::nanoseconds;
 using bm::Switch;
 using bm::Queue;
 using bm::Packet;
+using bm::PacketBuffer;
 using bm::PHV;
 using bm::Parser;
 using bm::Deparser;
@@ -72,6 +87,17 @@ class SimpleSwitch : public Switch {
   using TransmitFn = std::function<void(port_t, packet_id_t,
                                         const char *, int)>;
 
+  // the stages for which latency histograms are recorded (see
+  // get_latency_stats()); receive is the time spent in the input buffer
+  // (including after a resubmit or a recirculation), queueing the time spent in
+  // the egress buffers, and transmit the time between the end of the deparser
+  // and the packet being handed over to the port backend; total goes from the
+  // reception of the packet to its transmission (mirrored packets are not
+  // included)
+  enum class LatencyStage {
+    RECEIVE, PARSER, INGRESS, QUEUEING, EGRESS, DEPARSER, TRANSMIT, TOTAL
+  };
+
  private:
   using clock = std::chrono::high_resolution_clock;
 
@@ -83,6 +109,8 @@ class SimpleSwitch : public Switch {
 
   int receive_(port_t port_num, const char *buffer, int len) override;
 
+  int receive_buffer_(port_t port_num, PacketBuffer &&buffer) override;
+
   void start_and_return_() override;
 
   void reset_target_state_() override;
@@ -106,6 +134,48 @@ class SimpleSwitch : public Switch {
   int set_egress_queue_rate(size_t port, const uint64_t rate_pps);
   int set_all_egress_queue_rates(const uint64_t rate_pps);
 
+  // the following are only supported when the hierarchical traffic manager is
+  // enabled (SSWITCH_HIERARCHICAL_TM_ON), they return a non-zero value
+  // otherwise; priority values are the ones used in the P4 program
+  int set_egress_queue_strict_priority(size_t port, size_t priority);
+  int set_egress_queue_weight(size_t port, size_t priority,
+                              const uint32_t weight);
+  int set_egress_queue_min_rate(size_t port, size_t priority,
+                                const uint64_t rate_bps,
+                                const size_t burst_bytes);
+  int set_egress_queue_max_rate(size_t port, size_t priority,
+                                const uint64_t rate_bps,
+                                const size_t burst_bytes);
+  int set_egress_port_min_rate(size_t port, const uint64_t rate_bps,
+                               const size_t burst_bytes);
+  int set_egress_port_max_rate(size_t port, const uint64_t rate_bps,
+                               const size_t burst_bytes);
+
+  // accuracy of the egress queues rate limiters, aggregated over all ports
+  bm::RateLimiterStats get_egress_queue_rate_limiter_stats() const;
+  int reset_egress_queue_rate_limiter_stats();
+
+  // active queue management for the egress queues, see bm::QueueAQM; when
+  // priority queueing is not enabled, priority must be 0; thresholds are in
+  // packets and times in microseconds
+  int set_egress_queue_red(size_t port, size_t priority, const size_t min_th,
+                           const size_t max_th, const double max_p,
+                           const bool ecn);
+  int set_egress_queue_codel(size_t port, size_t priority,
+                             const uint64_t target_us,
+                             const uint64_t interval_us, const bool ecn);
+  int set_egress_queue_pie(size_t port, size_t priority,
+                           const uint64_t target_us,
+                           const uint64_t t_update_us,
+                           const uint64_t max_burst_us, const bool ecn);
+  int disable_egress_queue_aqm(size_t port, size_t priority);
+  int get_egress_queue_aqm_counters(size_t port, size_t priority,
+                                    bm::QueueAQM::Counters *counters) const;
+  int reset_egress_queue_aqm_counters(size_t port, size_t priority);
+
+  // the histograms are indexed by LatencyStage
+  bm::LatencyStats &get_latency_stats() { return latency_stats; }
+
   // returns the number of microseconds elapsed since the switch started
   uint64_t get_time_elapsed_us() const;
 
@@ -117,11 +187,23 @@ class SimpleSwitch : public Switch {
     return (packet_id-1);
   }
 
+  // when a custom transmit function is set, the transmit thread calls it for
+  // each packet; otherwise packets are handed over to the port backend in
+  // bursts of at most transmit_burst_size packets, without copying them
   void set_transmit_fn(TransmitFn fn);
 
  private:
   static constexpr size_t nb_egress_threads = 4u;
-  static packet_id_t packet_id;
+  static constexpr size_t transmit_burst_size = 32u;
+  static constexpr size_t input_buffer_size = 1024u;
+#ifdef SSWITCH_PRIORITY_QUEUEING_ON
+  static constexpr size_t nb_queues_per_port =
+      SSWITCH_PRIORITY_QUEUEING_NB_QUEUES;
+#else
+  static constexpr size_t nb_queues_per_port = 1u;
+#endif
+  // atomic because the port manager may receive packets on several threads
+  static std::atomic<packet_id_t> packet_id;
 
   enum PktInstanceType {
     PKT_INSTANCE_TYPE_NORMAL,
@@ -170,22 +252,44 @@ class SimpleSwitch : public Switch {
 
   void check_queueing_metadata();
 
+  // the end of a stage is the start of the next one
+  void start_latency_stage(Packet *packet);
+  void end_latency_stage(Packet *packet, LatencyStage stage);
+  void record_transmit_latency(Packet *packet, uint64_t now_ns);
+
+  // returns nullptr if the port or the priority is invalid
+  bm::QueueAQM *get_egress_queue_aqm(size_t port, size_t priority);
+  const bm::QueueAQM *get_egress_queue_aqm(size_t port, size_t priority) const;
+  // ECN-capability is read from the optional intrinsic_metadata.ecn field
+  bool is_ecn_capable(PHV *phv) const;
+  void ecn_mark(PHV *phv) const;
+
+#ifdef SSWITCH_HIERARCHICAL_TM_ON
+  bool check_tm_queue(size_t port, size_t priority) const;
+#endif
+
  private:
   port_t max_port;
   std::vector<std::thread> threads_;
   Queue<std::unique_ptr<Packet> > input_buffer;
-#ifdef SSWITCH_PRIORITY_QUEUEING_ON
+#if defined(SSWITCH_HIERARCHICAL_TM_ON)
+  bm::QueueingLogicHierarchical<std::unique_ptr<Packet>, EgressThreadMapper>
+#elif defined(SSWITCH_PRIORITY_QUEUEING_ON)
   bm::QueueingLogicPriRL<std::unique_ptr<Packet>, EgressThreadMapper>
 #else
   bm::QueueingLogicRL<std::unique_ptr<Packet>, EgressThreadMapper>
 #endif
   egress_buffers;
+  // one per egress queue, indexed by port * nb_queues_per_port + priority
+  std::vector<bm::QueueAQM> egress_aqm;
   Queue<std::unique_ptr<Packet> > output_buffer;
   TransmitFn my_transmit_fn;
+  bool custom_transmit_fn{false};
   std::shared_ptr<McSimplePreLAG> pre;
   clock::time_point start;
   std::unordered_map<mirror_id_t, port_t> mirroring_map;
   bool with_queueing_metadata{false};
+  bm::LatencyStats latency_stats;
 };
 
 #endif  // SIMPLE_SWITCH_SIMPLE_SWITCH_H_
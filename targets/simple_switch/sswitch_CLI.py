@@ -57,6 +57,146 @@ class SimpleSwitchAPI(runtime_CLI.RuntimeAPI):
         else:
             self.sswitch_client.set_all_egress_queue_rates(rate)
 
+    def do_set_queue_strict_priority(self, line):
+        "Serve egress queue in strict priority order (hierarchical TM only): set_queue_strict_priority <egress_port> <priority>"
+        args = line.split()
+        port, priority = int(args[0]), int(args[1])
+        self.sswitch_client.set_egress_queue_strict_priority(port, priority)
+
+    def do_set_queue_weight(self, line):
+        "Serve egress queue with DRR using the given weight (hierarchical TM only): set_queue_weight <egress_port> <priority> <weight>"
+        args = line.split()
+        port, priority, weight = int(args[0]), int(args[1]), int(args[2])
+        self.sswitch_client.set_egress_queue_weight(port, priority, weight)
+
+    def do_set_queue_min_rate(self, line):
+        "Set guaranteed rate of egress queue (hierarchical TM only): set_queue_min_rate <egress_port> <priority> <rate_bps> [<burst_bytes>]"
+        args = line.split()
+        port, priority, rate = int(args[0]), int(args[1]), int(args[2])
+        burst = int(args[3]) if len(args) > 3 else 1500
+        self.sswitch_client.set_egress_queue_min_rate(port, priority, rate, burst)
+
+    def do_set_queue_max_rate(self, line):
+        "Set maximum rate of egress queue (hierarchical TM only): set_queue_max_rate <egress_port> <priority> <rate_bps> [<burst_bytes>]"
+        args = line.split()
+        port, priority, rate = int(args[0]), int(args[1]), int(args[2])
+        burst = int(args[3]) if len(args) > 3 else 1500
+        self.sswitch_client.set_egress_queue_max_rate(port, priority, rate, burst)
+
+    def do_set_port_min_rate(self, line):
+        "Set guaranteed rate of egress port (hierarchical TM only): set_port_min_rate <egress_port> <rate_bps> [<burst_bytes>]"
+        args = line.split()
+        port, rate = int(args[0]), int(args[1])
+        burst = int(args[2]) if len(args) > 2 else 1500
+        self.sswitch_client.set_egress_port_min_rate(port, rate, burst)
+
+    def do_set_port_max_rate(self, line):
+        "Set maximum rate of egress port (hierarchical TM only): set_port_max_rate <egress_port> <rate_bps> [<burst_bytes>]"
+        args = line.split()
+        port, rate = int(args[0]), int(args[1])
+        burst = int(args[2]) if len(args) > 2 else 1500
+        self.sswitch_client.set_egress_port_max_rate(port, rate, burst)
+
+    def do_get_queue_rate_limiter_stats(self, line):
+        "Show how late rate-limited packets leave the egress queues: get_queue_rate_limiter_stats"
+        stats = self.sswitch_client.get_egress_queue_rate_limiter_stats()
+        print "rate-limited packets:", stats.count
+        if stats.count == 0:
+            return
+        print "average lateness (ns):", stats.total_late_ns / stats.count
+        print "max lateness (ns):", stats.max_late_ns
+        bounds = ["< 1us", "< 10us", "< 100us", "< 1ms", "< 10ms", ">= 10ms"]
+        for bound, count in zip(bounds, stats.buckets):
+            print "{:>8}: {}".format(bound, count)
+
+    def do_reset_queue_rate_limiter_stats(self, line):
+        "Reset egress queues rate limiter stats: reset_queue_rate_limiter_stats"
+        self.sswitch_client.reset_egress_queue_rate_limiter_stats()
+
+    def _parse_aqm_args(self, line):
+        args = line.split()
+        ecn = len(args) > 0 and args[-1] == "ecn"
+        if ecn:
+            args = args[:-1]
+        return args, ecn
+
+    def _check_aqm_rc(self, rc):
+        if rc != 0:
+            print "Invalid egress queue or AQM parameters"
+
+    def do_set_queue_red(self, line):
+        "Enable RED / WRED on egress queue (priority is 0 without priority queueing): set_queue_red <egress_port> <priority> <min_th_pkts> <max_th_pkts> <max_p> [ecn]"
+        args, ecn = self._parse_aqm_args(line)
+        port, priority = int(args[0]), int(args[1])
+        min_th, max_th, max_p = int(args[2]), int(args[3]), float(args[4])
+        self._check_aqm_rc(self.sswitch_client.set_egress_queue_red(
+            port, priority, min_th, max_th, max_p, ecn))
+
+    def do_set_queue_codel(self, line):
+        "Enable CoDel on egress queue: set_queue_codel <egress_port> <priority> [<target_us> <interval_us>] [ecn]"
+        args, ecn = self._parse_aqm_args(line)
+        port, priority = int(args[0]), int(args[1])
+        target = int(args[2]) if len(args) > 2 else 5000
+        interval = int(args[3]) if len(args) > 3 else 100000
+        self._check_aqm_rc(self.sswitch_client.set_egress_queue_codel(
+            port, priority, target, interval, ecn))
+
+    def do_set_queue_pie(self, line):
+        "Enable PIE on egress queue: set_queue_pie <egress_port> <priority> [<target_us> <t_update_us> <max_burst_us>] [ecn]"
+        args, ecn = self._parse_aqm_args(line)
+        port, priority = int(args[0]), int(args[1])
+        target = int(args[2]) if len(args) > 2 else 15000
+        t_update = int(args[3]) if len(args) > 3 else 15000
+        max_burst = int(args[4]) if len(args) > 4 else 150000
+        self._check_aqm_rc(self.sswitch_client.set_egress_queue_pie(
+            port, priority, target, t_update, max_burst, ecn))
+
+    def do_disable_queue_aqm(self, line):
+        "Disable active queue management on egress queue: disable_queue_aqm <egress_port> <priority>"
+        args = line.split()
+        port, priority = int(args[0]), int(args[1])
+        self._check_aqm_rc(
+            self.sswitch_client.disable_egress_queue_aqm(port, priority))
+
+    def do_get_queue_aqm_counters(self, line):
+        "Show packets dropped / ECN-marked by active queue management on egress queue: get_queue_aqm_counters <egress_port> <priority>"
+        args = line.split()
+        port, priority = int(args[0]), int(args[1])
+        counters = self.sswitch_client.get_egress_queue_aqm_counters(
+            port, priority)
+        print "drops:", counters.drops
+        print "marks:", counters.marks
+
+    def do_reset_queue_aqm_counters(self, line):
+        "Reset active queue management counters of egress queue: reset_queue_aqm_counters <egress_port> <priority>"
+        args = line.split()
+        port, priority = int(args[0]), int(args[1])
+        self._check_aqm_rc(
+            self.sswitch_client.reset_egress_queue_aqm_counters(port, priority))
+
+    def do_show_latency_stats(self, line):
+        "Show per-stage latency (in microseconds) of the packets going through the switch: show_latency_stats"
+        stats = self.sswitch_client.get_latency_stats()
+        columns = ["count", "min", "mean", "p50", "p90", "p99", "p99.9", "max"]
+        print "{:<10}".format("stage") + \
+            "".join(["{:>12}".format(c) for c in columns])
+        for s in stats:
+            values = [s.min_ns, s.mean_ns, s.p50_ns, s.p90_ns, s.p99_ns,
+                      s.p999_ns, s.max_ns]
+            print "{:<10}{:>12}".format(s.stage, s.count) + \
+                "".join(["{:>12.3f}".format(v / 1000.) for v in values])
+
+    def do_reset_latency_stats(self, line):
+        "Reset per-stage latency stats: reset_latency_stats"
+        self.sswitch_client.reset_latency_stats()
+
+    def do_set_latency_stats(self, line):
+        "Enable / disable per-stage latency stats (enabled by default): set_latency_stats on|off"
+        if line.strip() not in ["on", "off"]:
+            print "Expected 'on' or 'off'"
+            return
+        self.sswitch_client.set_latency_stats_enabled(line.strip() == "on")
+
     def do_mirroring_add(self, line):
         "Add mirroring mapping: mirroring_add <mirror_id> <egress_port>"
         args = line.split()
@@ -85,7 +225,7 @@ def main():
     services.extend(SimpleSwitchAPI.get_thrift_services())
 
     standard_client, mc_client, sswitch_client = runtime_CLI.thrift_connect(
-        args.thrift_ip, args.thrift_port, services
+        args.thrift_ip, args.thrift_port, services, args.thrift_framed
     )
 
     runtime_CLI.load_json_config(standard_client, args.json)
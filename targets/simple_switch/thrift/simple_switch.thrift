@@ -21,6 +21,33 @@
 namespace cpp sswitch_runtime
 namespace py sswitch_runtime
 
+// see bm::RateLimiterStats
+struct QueueRateLimiterStats {
+  1:i64 count;
+  2:i64 total_late_ns;
+  3:i64 max_late_ns;
+  4:list<i64> buckets;
+}
+
+// see bm::QueueAQM
+struct QueueAQMCounters {
+  1:i64 drops;
+  2:i64 marks;
+}
+
+// see bm::LatencyHistogram; all values are in nanoseconds
+struct LatencyHistogramStats {
+  1:string stage;
+  2:i64 count;
+  3:i64 min_ns;
+  4:i64 mean_ns;
+  5:i64 max_ns;
+  6:i64 p50_ns;
+  7:i64 p90_ns;
+  8:i64 p99_ns;
+  9:i64 p999_ns;
+}
+
 service SimpleSwitch {
 
   i32 mirroring_mapping_add(1:i32 mirror_id, 2:i32 egress_port);
@@ -32,6 +59,43 @@ service SimpleSwitch {
   i32 set_egress_queue_rate(1:i32 port_num, 2:i64 rate_pps);
   i32 set_all_egress_queue_rates(1:i64 rate_pps);
 
+  // only supported if simple_switch was compiled with the hierarchical traffic
+  // manager (SSWITCH_HIERARCHICAL_TM_ON); rates are in bits per second
+  i32 set_egress_queue_strict_priority(1:i32 port_num, 2:i32 priority);
+  i32 set_egress_queue_weight(1:i32 port_num, 2:i32 priority, 3:i32 weight);
+  i32 set_egress_queue_min_rate(1:i32 port_num, 2:i32 priority,
+                                3:i64 rate_bps, 4:i32 burst_bytes);
+  i32 set_egress_queue_max_rate(1:i32 port_num, 2:i32 priority,
+                                3:i64 rate_bps, 4:i32 burst_bytes);
+  i32 set_egress_port_min_rate(1:i32 port_num, 2:i64 rate_bps,
+                               3:i32 burst_bytes);
+  i32 set_egress_port_max_rate(1:i32 port_num, 2:i64 rate_bps,
+                               3:i32 burst_bytes);
+
+  QueueRateLimiterStats get_egress_queue_rate_limiter_stats();
+  i32 reset_egress_queue_rate_limiter_stats();
+
+  // active queue management; priority must be 0 if simple_switch was not
+  // compiled with priority queueing; thresholds are in packets and times in
+  // microseconds
+  i32 set_egress_queue_red(1:i32 port_num, 2:i32 priority, 3:i32 min_th,
+                           4:i32 max_th, 5:double max_p, 6:bool ecn);
+  i32 set_egress_queue_codel(1:i32 port_num, 2:i32 priority,
+                             3:i64 target_us, 4:i64 interval_us, 5:bool ecn);
+  i32 set_egress_queue_pie(1:i32 port_num, 2:i32 priority, 3:i64 target_us,
+                           4:i64 t_update_us, 5:i64 max_burst_us,
+                           6:bool ecn);
+  i32 disable_egress_queue_aqm(1:i32 port_num, 2:i32 priority);
+  QueueAQMCounters get_egress_queue_aqm_counters(1:i32 port_num,
+                                                 2:i32 priority);
+  i32 reset_egress_queue_aqm_counters(1:i32 port_num, 2:i32 priority);
+
+  // per-stage latency of the packets going through the switch, since the last
+  // reset; see SimpleSwitch::LatencyStage for the list of stages
+  list<LatencyHistogramStats> get_latency_stats();
+  i32 reset_latency_stats();
+  i32 set_latency_stats_enabled(1:bool enabled);
+
   // these methods are here as an experiment, prefer get_time_elapsed_us() when
   // possible
   i64 get_time_elapsed_us();
@@ -39,6 +39,8 @@ namespace thrift_provider = apache::thrift;
 #include <bm/bm_sim/switch.h>
 #include <bm/bm_sim/logger.h>
 
+#include <vector>
+
 #include "simple_switch.h"
 
 namespace sswitch_runtime {
@@ -93,6 +95,162 @@ class SimpleSwitchHandler : virtual public SimpleSwitchIf {
     return switch_->set_all_egress_queue_rates(static_cast<uint64_t>(rate_pps));
   }
 
+  int32_t set_egress_queue_strict_priority(const int32_t port_num,
+                                           const int32_t priority) {
+    bm::Logger::get()->trace("set_egress_queue_strict_priority");
+    return switch_->set_egress_queue_strict_priority(port_num, priority);
+  }
+
+  int32_t set_egress_queue_weight(const int32_t port_num,
+                                  const int32_t priority,
+                                  const int32_t weight) {
+    bm::Logger::get()->trace("set_egress_queue_weight");
+    return switch_->set_egress_queue_weight(port_num, priority,
+                                            static_cast<uint32_t>(weight));
+  }
+
+  int32_t set_egress_queue_min_rate(const int32_t port_num,
+                                    const int32_t priority,
+                                    const int64_t rate_bps,
+                                    const int32_t burst_bytes) {
+    bm::Logger::get()->trace("set_egress_queue_min_rate");
+    return switch_->set_egress_queue_min_rate(
+        port_num, priority, static_cast<uint64_t>(rate_bps),
+        static_cast<uint32_t>(burst_bytes));
+  }
+
+  int32_t set_egress_queue_max_rate(const int32_t port_num,
+                                    const int32_t priority,
+                                    const int64_t rate_bps,
+                                    const int32_t burst_bytes) {
+    bm::Logger::get()->trace("set_egress_queue_max_rate");
+    return switch_->set_egress_queue_max_rate(
+        port_num, priority, static_cast<uint64_t>(rate_bps),
+        static_cast<uint32_t>(burst_bytes));
+  }
+
+  int32_t set_egress_port_min_rate(const int32_t port_num,
+                                   const int64_t rate_bps,
+                                   const int32_t burst_bytes) {
+    bm::Logger::get()->trace("set_egress_port_min_rate");
+    return switch_->set_egress_port_min_rate(
+        port_num, static_cast<uint64_t>(rate_bps),
+        static_cast<uint32_t>(burst_bytes));
+  }
+
+  int32_t set_egress_port_max_rate(const int32_t port_num,
+                                   const int64_t rate_bps,
+                                   const int32_t burst_bytes) {
+    bm::Logger::get()->trace("set_egress_port_max_rate");
+    return switch_->set_egress_port_max_rate(
+        port_num, static_cast<uint64_t>(rate_bps),
+        static_cast<uint32_t>(burst_bytes));
+  }
+
+  void get_egress_queue_rate_limiter_stats(QueueRateLimiterStats &_return) {
+    bm::Logger::get()->trace("get_egress_queue_rate_limiter_stats");
+    auto stats = switch_->get_egress_queue_rate_limiter_stats();
+    _return.count = static_cast<int64_t>(stats.count);
+    _return.total_late_ns = static_cast<int64_t>(stats.total_late_ns);
+    _return.max_late_ns = static_cast<int64_t>(stats.max_late_ns);
+    _return.buckets.assign(stats.buckets.begin(), stats.buckets.end());
+  }
+
+  int32_t reset_egress_queue_rate_limiter_stats() {
+    bm::Logger::get()->trace("reset_egress_queue_rate_limiter_stats");
+    return switch_->reset_egress_queue_rate_limiter_stats();
+  }
+
+  int32_t set_egress_queue_red(const int32_t port_num, const int32_t priority,
+                               const int32_t min_th, const int32_t max_th,
+                               const double max_p, const bool ecn) {
+    bm::Logger::get()->trace("set_egress_queue_red");
+    return switch_->set_egress_queue_red(port_num, priority, min_th, max_th,
+                                         max_p, ecn);
+  }
+
+  int32_t set_egress_queue_codel(const int32_t port_num,
+                                 const int32_t priority,
+                                 const int64_t target_us,
+                                 const int64_t interval_us,
+                                 const bool ecn) {
+    bm::Logger::get()->trace("set_egress_queue_codel");
+    return switch_->set_egress_queue_codel(
+        port_num, priority, static_cast<uint64_t>(target_us),
+        static_cast<uint64_t>(interval_us), ecn);
+  }
+
+  int32_t set_egress_queue_pie(const int32_t port_num, const int32_t priority,
+                               const int64_t target_us,
+                               const int64_t t_update_us,
+                               const int64_t max_burst_us,
+                               const bool ecn) {
+    bm::Logger::get()->trace("set_egress_queue_pie");
+    return switch_->set_egress_queue_pie(
+        port_num, priority, static_cast<uint64_t>(target_us),
+        static_cast<uint64_t>(t_update_us),
+        static_cast<uint64_t>(max_burst_us), ecn);
+  }
+
+  int32_t disable_egress_queue_aqm(const int32_t port_num,
+                                   const int32_t priority) {
+    bm::Logger::get()->trace("disable_egress_queue_aqm");
+    return switch_->disable_egress_queue_aqm(port_num, priority);
+  }
+
+  void get_egress_queue_aqm_counters(QueueAQMCounters &_return,
+                                     const int32_t port_num,
+                                     const int32_t priority) {
+    bm::Logger::get()->trace("get_egress_queue_aqm_counters");
+    bm::QueueAQM::Counters counters;
+    if (switch_->get_egress_queue_aqm_counters(port_num, priority,
+                                               &counters)) {
+      bm::Logger::get()->error("Invalid egress queue ({}, {})",
+                               port_num, priority);
+      return;
+    }
+    _return.drops = static_cast<int64_t>(counters.drops);
+    _return.marks = static_cast<int64_t>(counters.marks);
+  }
+
+  int32_t reset_egress_queue_aqm_counters(const int32_t port_num,
+                                          const int32_t priority) {
+    bm::Logger::get()->trace("reset_egress_queue_aqm_counters");
+    return switch_->reset_egress_queue_aqm_counters(port_num, priority);
+  }
+
+  void get_latency_stats(std::vector<LatencyHistogramStats> &_return) {
+    bm::Logger::get()->trace("get_latency_stats");
+    auto &latency_stats = switch_->get_latency_stats();
+    auto histograms = latency_stats.get_histograms();
+    for (size_t stage = 0; stage < histograms.size(); stage++) {
+      const auto &h = histograms[stage];
+      LatencyHistogramStats stats;
+      stats.stage = latency_stats.get_stage_name(stage);
+      stats.count = static_cast<int64_t>(h.get_count());
+      stats.min_ns = static_cast<int64_t>(h.get_min());
+      stats.mean_ns = static_cast<int64_t>(h.get_mean());
+      stats.max_ns = static_cast<int64_t>(h.get_max());
+      stats.p50_ns = static_cast<int64_t>(h.get_value_at_percentile(50.));
+      stats.p90_ns = static_cast<int64_t>(h.get_value_at_percentile(90.));
+      stats.p99_ns = static_cast<int64_t>(h.get_value_at_percentile(99.));
+      stats.p999_ns = static_cast<int64_t>(h.get_value_at_percentile(99.9));
+      _return.push_back(std::move(stats));
+    }
+  }
+
+  int32_t reset_latency_stats() {
+    bm::Logger::get()->trace("reset_latency_stats");
+    switch_->get_latency_stats().reset();
+    return 0;
+  }
+
+  int32_t set_latency_stats_enabled(const bool enabled) {
+    bm::Logger::get()->trace("set_latency_stats_enabled");
+    switch_->get_latency_stats().set_enabled(enabled);
+    return 0;
+  }
+
   int64_t get_time_elapsed_us() {
     bm::Logger::get()->trace("get_time_elapsed_us");
     // cast from unsigned to signed
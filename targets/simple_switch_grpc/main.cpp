@@ -42,6 +42,16 @@ main(int argc, char* argv[]) {
       "dp-grpc-server-addr",
       "use a gRPC channel to inject and receive dataplane packets; "
       "bind this gRPC server to given address, e.g. 0.0.0.0:50052");
+  simple_switch_parser.add_uint_option(
+      "packet-io-queue-size",
+      "max number of packets waiting to be sent to gRPC clients (packet-in "
+      "and dataplane gRPC channel), packets are dropped when the queue is "
+      "full and the drops are logged as warnings [default is 1024]");
+  simple_switch_parser.add_uint_option(
+      "cpu-port-rate-limit",
+      "max number of packets per second sent to the CPU port, in bursts of up "
+      "to one second worth of packets; packets in excess are dropped and "
+      "logged as warnings [default is no limit]");
 
   bm::OptionsParser parser;
   parser.parse(argc, argv, &simple_switch_parser);
@@ -81,8 +91,34 @@ main(int argc, char* argv[]) {
       std::exit(1);
   }
 
+  uint32_t packet_io_queue_size = 0;
+  {
+    auto rc = simple_switch_parser.get_uint_option(
+        "packet-io-queue-size", &packet_io_queue_size);
+    if (rc == bm::TargetParserBasic::ReturnCode::OPTION_NOT_PROVIDED)
+      packet_io_queue_size = 1024;
+    else if (rc != bm::TargetParserBasic::ReturnCode::SUCCESS ||
+             packet_io_queue_size == 0)
+      std::exit(1);
+  }
+
+  uint32_t cpu_port_rate_limit = 0;
+  {
+    auto rc = simple_switch_parser.get_uint_option(
+        "cpu-port-rate-limit", &cpu_port_rate_limit);
+    if (rc == bm::TargetParserBasic::ReturnCode::OPTION_NOT_PROVIDED)
+      cpu_port_rate_limit = 0;
+    else if (rc != bm::TargetParserBasic::ReturnCode::SUCCESS)
+      std::exit(1);
+  }
+
   auto &runner = sswitch_grpc::SimpleSwitchGrpcRunner::get_instance(
       512, !disable_swap_flag, grpc_server_addr, cpu_port, dp_grpc_server_addr);
+  runner.set_packet_io_queue_size(packet_io_queue_size);
+  if (cpu_port > 0 && cpu_port_rate_limit > 0) {
+    runner.set_port_rate_limit(cpu_port, cpu_port_rate_limit,
+                               cpu_port_rate_limit);
+  }
   int status = runner.init_and_start(parser);
   if (status != 0) std::exit(status);
 
@@ -36,11 +36,20 @@
 
 #include <p4/bm/dataplane_interface.grpc.pb.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
 #include <map>
 #include <memory>
 #include <mutex>
 #include <string>
+#include <thread>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include "simple_switch.h"
 
@@ -69,82 +78,382 @@ using grpc::StatusCode;
 
 using ServerReaderWriter = grpc::ServerReaderWriter<
   p4::bm::PacketStreamResponse, p4::bm::PacketStreamRequest>;
+using BatchServerReaderWriter = grpc::ServerReaderWriter<
+  p4::bm::PacketStreamBatchResponse, p4::bm::PacketStreamBatchRequest>;
+
+namespace {
+
+// maximum number of packets written to a gRPC stream in one go
+constexpr size_t max_packets_per_write = 64;
+
+// minimum time between 2 warnings about dropped packets
+constexpr std::chrono::milliseconds drop_report_interval(1000);
+
+// Counts the packets dropped for a given reason and logs the count at warn
+// level, at most once per drop_report_interval so that the log is not flooded;
+// drops not logged yet are logged by the next call to report() once the
+// interval has elapsed. The caller is responsible for synchronization.
+class DropReporter {
+ public:
+  using port_t = bm::DevMgrIface::port_t;
+
+  explicit DropReporter(std::string reason)
+      : reason(std::move(reason)) { }
+
+  void drop(port_t port) {
+    total++;
+    last_port = port;
+    report();
+  }
+
+  // force ignores drop_report_interval, e.g. on shutdown
+  void report(bool force = false) {
+    if (total == reported) return;
+    auto now = Clock::now();
+    if (!force && now - last_report < drop_report_interval) return;
+    bm::Logger::get()->warn(
+        "{} packets sent to gRPC were dropped ({} since the beginning): {}, "
+        "last one was sent to port {}",
+        total - reported, total, reason, last_port);
+    reported = total;
+    last_report = now;
+  }
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  const std::string reason;
+  uint64_t total{0};
+  uint64_t reported{0};
+  port_t last_port{0};
+  Clock::time_point last_report{};
+};
+
+}  // namespace
+
+// Bounded queue between the switch threads transmitting packets and the thread
+// writing them to gRPC. push() never blocks: when the queue is full the packet
+// is dropped and counted, so that a slow gRPC client cannot stall the switch.
+class PacketSendQueue {
+ public:
+  using port_t = bm::DevMgrIface::port_t;
+
+  struct Packet {
+    port_t port;
+    uint64_t id;
+    std::string data;
+  };
+
+  PacketSendQueue(size_t capacity, const std::string &name)
+      : capacity(capacity), reporter(name + " full") { }
+
+  // returns false if the packet was dropped, which is only counted as a drop if
+  // the queue is open
+  bool push(Packet &&packet) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (closed) return false;
+    if (packets.size() >= capacity) {
+      counters[packet.port].drops++;
+      reporter.drop(packet.port);
+      return false;
+    }
+    packets.push_back(std::move(packet));
+    lock.unlock();
+    not_empty.notify_one();
+    return true;
+  }
+
+  // Waits until there is at least one packet in the queue and moves up to
+  // max_packets of them to the back of *out. Packets still queued when the
+  // queue is closed are returned as well; once there are none left, returns
+  // false.
+  bool pop(std::vector<Packet> *out, size_t max_packets) {
+    std::unique_lock<std::mutex> lock(mutex);
+    not_empty.wait(lock, [this] { return !packets.empty() || closed; });
+    reporter.report();
+    if (packets.empty()) return false;
+    size_t n = std::min(max_packets, packets.size());
+    for (size_t i = 0; i < n; i++) {
+      counters[packets.front().port].sent++;
+      out->push_back(std::move(packets.front()));
+      packets.pop_front();
+    }
+    return true;
+  }
+
+  void open() {
+    std::unique_lock<std::mutex> lock(mutex);
+    closed = false;
+  }
+
+  void close() {
+    std::unique_lock<std::mutex> lock(mutex);
+    reporter.report(true);
+    closed = true;
+    lock.unlock();
+    not_empty.notify_all();
+  }
+
+  void add_stats(port_t port,
+                 SimpleSwitchGrpcRunner::PacketIoStats *stats) const {
+    std::unique_lock<std::mutex> lock(mutex);
+    auto it = counters.find(port);
+    if (it == counters.end()) return;
+    stats->sent += it->second.sent;
+    stats->queue_drops += it->second.drops;
+  }
+
+ private:
+  struct Counters {
+    uint64_t sent;
+    uint64_t drops;
+  };
+
+  const size_t capacity;
+  DropReporter reporter;
+  mutable std::mutex mutex{};
+  std::condition_variable not_empty{};
+  std::deque<Packet> packets{};
+  bool closed{true};
+  // value-initialized to 0s if the port key is not found in the map
+  std::unordered_map<port_t, Counters> counters{};
+};
+
+// Token bucket per port, for the packets sent to gRPC clients.
+class PortRateLimiter {
+ public:
+  using port_t = bm::DevMgrIface::port_t;
+
+  ~PortRateLimiter() {
+    reporter.report(true);
+  }
+
+  void set_rate(port_t port, uint64_t pps, uint64_t burst) {
+    Lock lock(mutex);
+    if (pps == 0) {
+      buckets.erase(port);
+    } else {
+      auto &bucket = buckets[port];
+      bucket.pps = static_cast<double>(pps);
+      bucket.burst = static_cast<double>(std::max<uint64_t>(burst, 1));
+      bucket.tokens = bucket.burst;
+      bucket.last = Clock::now();
+    }
+    has_limits = !buckets.empty();
+  }
+
+  // returns false if the packet exceeds the rate of the port and has to be
+  // dropped
+  bool allow(port_t port) {
+    // no lock in the common case in which no rate limit is configured
+    if (!has_limits) return true;
+    Lock lock(mutex);
+    auto it = buckets.find(port);
+    if (it == buckets.end()) return true;
+    auto &bucket = it->second;
+    auto now = Clock::now();
+    std::chrono::duration<double> elapsed = now - bucket.last;
+    bucket.last = now;
+    bucket.tokens = std::min(bucket.burst,
+                             bucket.tokens + elapsed.count() * bucket.pps);
+    if (bucket.tokens < 1.0) {
+      drops[port]++;
+      reporter.drop(port);
+      return false;
+    }
+    bucket.tokens -= 1.0;
+    reporter.report();
+    return true;
+  }
+
+  uint64_t get_drops(port_t port) const {
+    Lock lock(mutex);
+    auto it = drops.find(port);
+    return (it == drops.end()) ? 0 : it->second;
+  }
+
+ private:
+  using Lock = std::lock_guard<std::mutex>;
+  using Clock = std::chrono::steady_clock;
+
+  struct Bucket {
+    double pps;
+    double burst;
+    double tokens;
+    Clock::time_point last;
+  };
+
+  mutable std::mutex mutex{};
+  std::atomic<bool> has_limits{false};
+  std::unordered_map<port_t, Bucket> buckets{};
+  std::unordered_map<port_t, uint64_t> drops{};
+  DropReporter reporter{"over the rate limit of the port"};
+};
 
 class DataplaneInterfaceServiceImpl
     : public p4::bm::DataplaneInterface::Service,
       public bm::DevMgrIface {
  public:
-  explicit DataplaneInterfaceServiceImpl(bm::device_id_t device_id)
-      : device_id(device_id) {
+  DataplaneInterfaceServiceImpl(bm::device_id_t device_id,
+                                size_t send_queue_size)
+      : device_id(device_id),
+        send_queue(send_queue_size, "dataplane send queue") {
     p_monitor = bm::PortMonitorIface::make_passive(device_id);
   }
 
   void my_transmit_fn(port_t port_num, packet_id_t pkt_id, const char *buffer,
                       int len) {
-    p4::bm::PacketStreamResponse response;
-    response.set_device_id(device_id);
-    response.set_port(port_num);
-    response.set_packet(buffer, len);
-    Lock lock(mutex);
-    if (packet_id_translation.find(pkt_id) != packet_id_translation.end()) {
-      response.set_id(packet_id_translation[pkt_id]);
+    PacketSendQueue::Packet packet{port_num, 0, std::string(buffer, len)};
+    {
+      Lock lock(mutex);
+      if (!active) return;
+      auto it = packet_id_translation.find(pkt_id);
+      if (it != packet_id_translation.end()) packet.id = it->second;
     }
-    if (active) {
-      stream->Write(response);
-      auto &stats = ports_stats[port_num];
-      stats.out_packets += 1;
-      stats.out_octets += len;
+    // the packet is written to the stream by the session writer thread
+    if (!send_queue.push(std::move(packet))) {
+      BMLOG_DEBUG("Dropping packet sent to port {}, send queue full", port_num);
     }
   }
 
+  void add_send_stats(port_t port,
+                      SimpleSwitchGrpcRunner::PacketIoStats *stats) const {
+    send_queue.add_stats(port, stats);
+  }
+
  private:
   using Lock = std::lock_guard<std::mutex>;
+  using Packets = std::vector<PacketSendQueue::Packet>;
+  // returns false if the stream is broken
+  using WriteFn = std::function<bool(Packets *)>;
+
+  void fill_response(PacketSendQueue::Packet *packet,
+                     p4::bm::PacketStreamResponse *response) const {
+    response->set_id(packet->id);
+    response->set_device_id(device_id);
+    response->set_port(packet->port);
+    response->set_packet(std::move(packet->data));
+  }
 
   Status PacketStream(ServerContext *context,
                       ServerReaderWriter *stream) override {
-    {
-      Lock lock(mutex);
-      if (!started)
-        return Status(StatusCode::UNAVAILABLE, "not ready");
-      if (active) {
-        return Status(StatusCode::RESOURCE_EXHAUSTED,
-                      "only one client authorized at a time");
+    _BM_UNUSED(context);
+    auto write_fn = [this, stream](Packets *packets) {
+      p4::bm::PacketStreamResponse response;
+      for (size_t i = 0; i < packets->size(); i++) {
+        fill_response(&(*packets)[i], &response);
+        // let gRPC coalesce the messages until the last one
+        grpc::WriteOptions options;
+        if (i + 1 < packets->size()) options.set_buffer_hint();
+        if (!stream->Write(response, options)) return false;
       }
-      active = true;
-      this->context = context;
-      this->stream = stream;
-    }
+      return true;
+    };
+    auto status = start_session(write_fn);
+    if (!status.ok()) return status;
     p4::bm::PacketStreamRequest request;
-    while (this->stream->Read(&request)) {
-      if (request.device_id() != device_id) {
-        continue;
-      }
-      const auto &packet = request.packet();
-      if (packet.empty()) continue;
-      if (!pkt_handler) continue;
-      {
+    while (stream->Read(&request)) {
+      Lock lock(mutex);
+      receive_packet(request);
+    }
+    end_session();
+    return Status::OK;
+  }
+
+  Status PacketStreamBatch(ServerContext *context,
+                           BatchServerReaderWriter *stream) override {
+    _BM_UNUSED(context);
+    auto write_fn = [this, stream](Packets *packets) {
+      p4::bm::PacketStreamBatchResponse response;
+      for (auto &packet : *packets)
+        fill_response(&packet, response.add_packets());
+      return stream->Write(response);
+    };
+    auto status = start_session(write_fn);
+    if (!status.ok()) return status;
+    p4::bm::PacketStreamBatchRequest request;
+    while (stream->Read(&request)) {
+      // the mutex is not held for the whole batch, since transmitting packets
+      // requires it too
+      for (const auto &packet_request : request.packets()) {
         Lock lock(mutex);
-        pkt_handler(request.port(), packet.data(), packet.size(), pkt_cookie);
-        // Get the packet id of newly created packet and save it in
-        // packet_id_translation map. The map will be used to populate the id
-        // field of the transmitted packet.
-        if (request.id() != 0) {
-          // grpc service has a single thread. get_packet_id() will return the
-          // packet id of the newly received packet.
-          packet_id_translation[SimpleSwitch::get_packet_id()] = request.id();
-        }
-        // PortStats is a POD struct; it will be value-initialized to 0s if the
-        // port key is not found in the map.
-        auto &stats = ports_stats[request.port()];
-        stats.in_packets += 1;
-        stats.in_octets += packet.size();
+        receive_packet(packet_request);
       }
     }
+    end_session();
+    return Status::OK;
+  }
+
+  Status start_session(const WriteFn &write_fn) {
+    Lock lock(mutex);
+    if (!started)
+      return Status(StatusCode::UNAVAILABLE, "not ready");
+    if (active) {
+      return Status(StatusCode::RESOURCE_EXHAUSTED,
+                    "only one client authorized at a time");
+    }
+    active = true;
+    send_queue.open();
+    writer_thread = std::thread(
+        &DataplaneInterfaceServiceImpl::write_packets, this, write_fn);
+    return Status::OK;
+  }
+
+  void end_session() {
     auto &runner = sswitch_grpc::SimpleSwitchGrpcRunner::get_instance();
     runner.block_until_all_packets_processed();
+    // the writer thread sends the packets still in the queue before exiting
+    send_queue.close();
+    writer_thread.join();
     Lock lock(mutex);
     active = false;
-    return Status::OK;
+  }
+
+  void write_packets(const WriteFn &write_fn) {
+    Packets packets;
+    // write_fn moves the packet data to the gRPC messages
+    std::vector<size_t> sizes;
+    bool stream_ok = true;
+    while (send_queue.pop(&packets, max_packets_per_write)) {
+      // once the stream is broken, packets are discarded until the session
+      // ends
+      if (stream_ok) {
+        for (const auto &packet : packets) sizes.push_back(packet.data.size());
+        stream_ok = write_fn(&packets);
+      }
+      if (stream_ok) {
+        Lock lock(mutex);
+        for (size_t i = 0; i < packets.size(); i++) {
+          auto &stats = ports_stats[packets[i].port];
+          stats.out_packets += 1;
+          stats.out_octets += sizes[i];
+        }
+      }
+      packets.clear();
+      sizes.clear();
+    }
+  }
+
+  // must be called with the mutex held
+  void receive_packet(const p4::bm::PacketStreamRequest &request) {
+    if (request.device_id() != device_id) return;
+    const auto &packet = request.packet();
+    if (packet.empty()) return;
+    if (!pkt_handler) return;
+    pkt_handler(request.port(), packet.data(), packet.size(), pkt_cookie);
+    // Get the packet id of newly created packet and save it in
+    // packet_id_translation map. The map will be used to populate the id
+    // field of the transmitted packet.
+    if (request.id() != 0) {
+      // grpc service has a single thread. get_packet_id() will return the
+      // packet id of the newly received packet.
+      packet_id_translation[SimpleSwitch::get_packet_id()] = request.id();
+    }
+    // PortStats is a POD struct; it will be value-initialized to 0s if the
+    // port key is not found in the map.
+    auto &stats = ports_stats[request.port()];
+    stats.in_packets += 1;
+    stats.in_octets += packet.size();
   }
 
   Status SetPortOperStatus(
@@ -226,13 +535,13 @@ class DataplaneInterfaceServiceImpl
   }
 
   bm::device_id_t device_id;
-  // protects the shared state (active) and prevents concurrent Write calls by
-  // different threads
+  // protects the shared state (active, stats, ...); only the writer thread of
+  // the session writes to the stream
   mutable std::mutex mutex{};
   bool started{false};
   bool active{false};
-  ServerContext *context{nullptr};
-  ServerReaderWriter *stream{nullptr};
+  PacketSendQueue send_queue;
+  std::thread writer_thread{};
   PacketHandler pkt_handler{};
   void *pkt_cookie{nullptr};
   std::unordered_map<port_t, bool> ports_oper_status{};
@@ -249,7 +558,9 @@ SimpleSwitchGrpcRunner::SimpleSwitchGrpcRunner(bm::DevMgrIface::port_t max_port,
       grpc_server_addr(grpc_server_addr), cpu_port(cpu_port),
       dp_grpc_server_addr(dp_grpc_server_addr),
       dp_service(nullptr),
-      dp_grpc_server(nullptr) {
+      dp_grpc_server(nullptr),
+      packet_io_queue_size(1024),
+      rate_limiter(new PortRateLimiter()) {
   DeviceMgr::init(256);
 }
 
@@ -257,7 +568,8 @@ int
 SimpleSwitchGrpcRunner::init_and_start(const bm::OptionsParser &parser) {
   std::unique_ptr<bm::DevMgrIface> my_dev_mgr = nullptr;
   if (!dp_grpc_server_addr.empty()) {
-    dp_service = new DataplaneInterfaceServiceImpl(parser.device_id);
+    dp_service = new DataplaneInterfaceServiceImpl(parser.device_id,
+                                                   packet_io_queue_size);
     grpc::ServerBuilder builder;
     builder.SetSyncServerOption(
       grpc::ServerBuilder::SyncServerOption::NUM_CQS, 1);
@@ -318,14 +630,40 @@ SimpleSwitchGrpcRunner::init_and_start(const bm::OptionsParser &parser) {
     }
   }
 
+  // packet-in messages are sent to the P4Runtime client by a separate thread,
+  // so that the switch does not wait for gRPC
+  packet_in_queue.reset(new PacketSendQueue(packet_io_queue_size,
+                                            "packet-in queue"));
+  packet_in_queue->open();
+  packet_in_thread = std::thread([this]() {
+    std::vector<PacketSendQueue::Packet> packets;
+    while (packet_in_queue->pop(&packets, max_packets_per_write)) {
+      for (const auto &packet : packets) {
+        BMLOG_DEBUG("Transmitting packet-in");
+        auto status = pi_packetin_receive(simple_switch->get_device_id(),
+                                          packet.data.data(),
+                                          packet.data.size());
+        if (status != PI_STATUS_SUCCESS)
+          bm::Logger::get()->error("Error when transmitting packet-in");
+      }
+      packets.clear();
+    }
+  });
+
   auto transmit_fn = [this](bm::DevMgrIface::port_t port_num,
                             packet_id_t pkt_id, const char *buf, int len) {
+    bool to_grpc = (cpu_port > 0 && port_num == cpu_port) ||
+        dp_service != nullptr;
+    if (to_grpc && !rate_limiter->allow(port_num)) {
+      BMLOG_DEBUG("Dropping packet sent to port {}, over rate limit",
+                  port_num);
+      return;
+    }
     if (cpu_port > 0 && port_num == cpu_port) {
-      BMLOG_DEBUG("Transmitting packet-in");
-      auto status = pi_packetin_receive(simple_switch->get_device_id(),
-                                        buf, static_cast<size_t>(len));
-      if (status != PI_STATUS_SUCCESS)
-        bm::Logger::get()->error("Error when transmitting packet-in");
+      PacketSendQueue::Packet packet{port_num, 0, std::string(buf, len)};
+      if (!packet_in_queue->push(std::move(packet))) {
+        BMLOG_DEBUG("Dropping packet-in, send queue full");
+      }
     } else if (dp_service != nullptr) {
       // need pkt_id for gRPC dp service, so we have to call the my_transmit_fn
       // directly
@@ -391,9 +729,38 @@ SimpleSwitchGrpcRunner::wait() {
 void
 SimpleSwitchGrpcRunner::shutdown() {
   if (!dp_grpc_server_addr.empty()) dp_grpc_server->Shutdown();
+  stop_packet_in_thread();
   PIGrpcServerShutdown();
 }
 
+void
+SimpleSwitchGrpcRunner::stop_packet_in_thread() {
+  if (!packet_in_thread.joinable()) return;
+  // pending packet-in messages are sent before the thread exits
+  packet_in_queue->close();
+  packet_in_thread.join();
+}
+
+void
+SimpleSwitchGrpcRunner::set_packet_io_queue_size(size_t queue_size) {
+  packet_io_queue_size = queue_size;
+}
+
+void
+SimpleSwitchGrpcRunner::set_port_rate_limit(bm::DevMgrIface::port_t port,
+                                            uint64_t pps, uint64_t burst) {
+  rate_limiter->set_rate(port, pps, burst);
+}
+
+SimpleSwitchGrpcRunner::PacketIoStats
+SimpleSwitchGrpcRunner::get_packet_io_stats(
+    bm::DevMgrIface::port_t port) const {
+  PacketIoStats stats{0, 0, rate_limiter->get_drops(port)};
+  if (packet_in_queue != nullptr) packet_in_queue->add_stats(port, &stats);
+  if (dp_service != nullptr) dp_service->add_send_stats(port, &stats);
+  return stats;
+}
+
 int
 SimpleSwitchGrpcRunner::mirroring_mapping_add(int mirror_id,
   bm::DevMgrIface::port_t egress_port) {
@@ -406,6 +773,7 @@ SimpleSwitchGrpcRunner::block_until_all_packets_processed() {
 }
 
 SimpleSwitchGrpcRunner::~SimpleSwitchGrpcRunner() {
+  stop_packet_in_thread();
   PIGrpcServerCleanup();
   DeviceMgr::destroy();
 }
@@ -23,8 +23,10 @@
 
 #include <bm/bm_sim/dev_mgr.h>
 
+#include <cstdint>
 #include <memory>
 #include <string>
+#include <thread>
 
 class SimpleSwitch;
 
@@ -46,6 +48,10 @@ class SysrepoDriver;
 
 class DataplaneInterfaceServiceImpl;
 
+class PacketSendQueue;
+
+class PortRateLimiter;
+
 class SimpleSwitchGrpcRunner {
  public:
   // there is no real need for a singleton here, except for the fact that we use
@@ -72,6 +78,28 @@ class SimpleSwitchGrpcRunner {
                             bm::DevMgrIface::port_t egress_port);
   void block_until_all_packets_processed();
 
+  // Packets sent to gRPC clients (packet-in through P4Runtime and packets sent
+  // on the dataplane gRPC channel) are handed over to a separate thread through
+  // a queue of this size. When the queue is full, packets are dropped instead
+  // of blocking the switch. Must be called before init_and_start.
+  void set_packet_io_queue_size(size_t queue_size);
+  // Limits the rate of packets sent to gRPC clients through the given port,
+  // e.g. the CPU port; packets exceeding the rate are dropped. A rate of 0
+  // packets per second removes the limit.
+  void set_port_rate_limit(bm::DevMgrIface::port_t port, uint64_t pps,
+                           uint64_t burst);
+
+  struct PacketIoStats {
+    // packets handed over to gRPC
+    uint64_t sent;
+    // packets dropped because the send queue was full
+    uint64_t queue_drops;
+    // packets dropped by the rate limit of the port
+    uint64_t rate_limit_drops;
+  };
+  // Counters for packets sent to gRPC clients through the given port
+  PacketIoStats get_packet_io_stats(bm::DevMgrIface::port_t port) const;
+
  private:
   SimpleSwitchGrpcRunner(bm::DevMgrIface::port_t max_port = 512,
                          bool enable_swap = false,
@@ -83,6 +111,8 @@ class SimpleSwitchGrpcRunner {
   void port_status_cb(bm::DevMgrIface::port_t port,
                       const bm::DevMgrIface::PortStatus port_status);
 
+  void stop_packet_in_thread();
+
   std::unique_ptr<SimpleSwitch> simple_switch;
   std::string grpc_server_addr;
   bm::DevMgrIface::port_t cpu_port;
@@ -90,6 +120,10 @@ class SimpleSwitchGrpcRunner {
   int dp_grpc_server_port;
   DataplaneInterfaceServiceImpl *dp_service;
   std::unique_ptr<grpc::Server> dp_grpc_server;
+  size_t packet_io_queue_size;
+  std::unique_ptr<PortRateLimiter> rate_limiter;
+  std::unique_ptr<PacketSendQueue> packet_in_queue;
+  std::thread packet_in_thread;
 #ifdef WITH_SYSREPO
   std::unique_ptr<SysrepoDriver> sysrepo_driver;
 #endif  // WITH_SYSREPO
@@ -0,0 +1,157 @@
+/* Copyright 2013-present Barefoot Networks, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Antonin Bas (antonin@barefootnetworks.com)
+ *
+ */
+
+// Measures the packet rate of the dataplane gRPC channel of a local
+// simple_switch_grpc instance running the loopback program: packets are sent
+// one per message (PacketStream) and then in batches (PacketStreamBatch), and
+// all the packets reflected by the switch are read back.
+// Usage: bench_packet_io [number of packets] [packets per batch]
+
+#include <bm/bm_sim/options_parse.h>
+
+#include <grpc++/grpc++.h>
+
+#include <p4/bm/dataplane_interface.grpc.pb.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "switch_runner.h"
+
+namespace {
+
+using sswitch_grpc::SimpleSwitchGrpcRunner;
+
+constexpr char loopback_json[] = TESTDATADIR "/loopback.json";
+constexpr char grpc_server_addr[] = "0.0.0.0:50066";
+constexpr char dp_grpc_server_addr[] = "0.0.0.0:50067";
+constexpr uint64_t device_id = 0;
+constexpr uint32_t port = 1;
+constexpr size_t packet_size = 100;
+
+using Clock = std::chrono::steady_clock;
+
+struct Result {
+  size_t received;
+  double seconds;
+};
+
+// batch_size is 0 for PacketStream
+Result
+run(p4::bm::DataplaneInterface::Stub *stub, size_t num_packets,
+    size_t batch_size) {
+  p4::bm::PacketStreamRequest request;
+  request.set_device_id(device_id);
+  request.set_port(port);
+  request.set_packet(std::string(packet_size, '\xab'));
+
+  grpc::ClientContext context;
+  size_t received = 0;
+  auto start = Clock::now();
+  if (batch_size == 0) {
+    auto stream = stub->PacketStream(&context);
+    std::thread reader([&stream, &received]() {
+      p4::bm::PacketStreamResponse response;
+      while (stream->Read(&response)) received++;
+    });
+    for (size_t i = 0; i < num_packets; i++) {
+      request.set_id(i + 1);
+      stream->Write(request);
+    }
+    stream->WritesDone();
+    reader.join();
+    stream->Finish();
+  } else {
+    auto stream = stub->PacketStreamBatch(&context);
+    std::thread reader([&stream, &received]() {
+      p4::bm::PacketStreamBatchResponse response;
+      while (stream->Read(&response)) received += response.packets_size();
+    });
+    p4::bm::PacketStreamBatchRequest batch;
+    for (size_t i = 0; i < num_packets; i++) {
+      request.set_id(i + 1);
+      *batch.add_packets() = request;
+      if (static_cast<size_t>(batch.packets_size()) == batch_size ||
+          i + 1 == num_packets) {
+        stream->Write(batch);
+        batch.clear_packets();
+      }
+    }
+    stream->WritesDone();
+    reader.join();
+    stream->Finish();
+  }
+  std::chrono::duration<double> elapsed = Clock::now() - start;
+  return {received, elapsed.count()};
+}
+
+void
+report(const char *name, size_t num_packets, const Result &result,
+       const SimpleSwitchGrpcRunner::PacketIoStats &before,
+       const SimpleSwitchGrpcRunner::PacketIoStats &after) {
+  std::cout << name << ": " << result.received << " / " << num_packets
+            << " packets received in " << result.seconds << "s ("
+            << static_cast<uint64_t>(result.received / result.seconds)
+            << " pps), " << (after.queue_drops - before.queue_drops)
+            << " dropped by the send queue\n";
+}
+
+}  // namespace
+
+int
+main(int argc, char *argv[]) {
+  size_t num_packets = (argc > 1) ? std::stoul(argv[1]) : 100000;
+  size_t batch_size = (argc > 2) ? std::stoul(argv[2]) : 64;
+
+  auto &runner = SimpleSwitchGrpcRunner::get_instance(
+      16, false, grpc_server_addr, 0, dp_grpc_server_addr);
+  bm::OptionsParser parser;
+  std::vector<const char *> switch_argv = {"bench"};
+#ifdef WITH_THRIFT
+  switch_argv.push_back("--thrift-port");
+  switch_argv.push_back("45469");
+#endif  // WITH_THRIFT
+  switch_argv.push_back(loopback_json);
+  auto switch_argc = static_cast<int>(switch_argv.size());
+  parser.parse(switch_argc, const_cast<char **>(switch_argv.data()), nullptr);
+  if (runner.init_and_start(parser) != 0) return 1;
+
+  auto channel = grpc::CreateChannel(dp_grpc_server_addr,
+                                     grpc::InsecureChannelCredentials());
+  auto stub = p4::bm::DataplaneInterface::NewStub(channel);
+
+  auto stats_0 = runner.get_packet_io_stats(port);
+  auto single = run(stub.get(), num_packets, 0);
+  auto stats_1 = runner.get_packet_io_stats(port);
+  report("PacketStream", num_packets, single, stats_0, stats_1);
+  auto batched = run(stub.get(), num_packets, batch_size);
+  auto stats_2 = runner.get_packet_io_stats(port);
+  report(("PacketStreamBatch (" + std::to_string(batch_size) +
+          " packets per message)").c_str(),
+         num_packets, batched, stats_1, stats_2);
+
+  runner.shutdown();
+  return 0;
+}
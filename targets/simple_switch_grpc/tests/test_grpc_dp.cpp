@@ -26,8 +26,10 @@
 
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "base_test.h"
+#include "switch_runner.h"
 
 namespace sswitch_grpc {
 
@@ -88,6 +90,70 @@ TEST_F(SimpleSwitchGrpcTest_GrpcDataplane, SendAndReceive) {
   EXPECT_TRUE(status.ok());
 }
 
+TEST_F(SimpleSwitchGrpcTest_GrpcDataplane, SendAndReceiveBatch) {
+  p4::bm::PacketStreamBatchRequest request;
+  for (int i = 0; i < 3; i++) {
+    auto packet = request.add_packets();
+    packet->set_id(100 + i);
+    packet->set_device_id(device_id);
+    packet->set_port(9);
+    packet->set_packet(std::string(10 + i, '\xab'));
+  }
+  ClientContext context;
+  auto stream = dataplane_stub->PacketStreamBatch(&context);
+  stream->Write(request);
+  stream->WritesDone();
+  // the server may group the packets differently
+  std::vector<p4::bm::PacketStreamResponse> responses;
+  p4::bm::PacketStreamBatchResponse response;
+  while (stream->Read(&response)) {
+    for (const auto &packet : response.packets()) responses.push_back(packet);
+  }
+  auto status = stream->Finish();
+  EXPECT_TRUE(status.ok());
+  ASSERT_EQ(responses.size(), 3u);
+  for (int i = 0; i < 3; i++) {
+    const auto &packet = request.packets(i);
+    EXPECT_EQ(responses[i].id(), packet.id());
+    EXPECT_EQ(responses[i].device_id(), packet.device_id());
+    EXPECT_EQ(responses[i].port(), packet.port());
+    EXPECT_EQ(responses[i].packet(), packet.packet());
+  }
+}
+
+TEST_F(SimpleSwitchGrpcTest_GrpcDataplane, PortRateLimit) {
+  auto &runner = SimpleSwitchGrpcRunner::get_instance();
+  const uint32_t port = 10;
+  const size_t num_packets = 20;
+  const uint64_t burst = 2;
+  // 1 packet per second: most packets exceed the burst and are dropped
+  runner.set_port_rate_limit(port, 1, burst);
+  auto stats_before = runner.get_packet_io_stats(port);
+
+  ClientContext context;
+  auto stream = dataplane_stub->PacketStream(&context);
+  p4::bm::PacketStreamRequest request;
+  request.set_device_id(device_id);
+  request.set_port(port);
+  request.set_packet(std::string(10, '\xab'));
+  for (size_t i = 0; i < num_packets; i++) stream->Write(request);
+  stream->WritesDone();
+  size_t received = 0;
+  p4::bm::PacketStreamResponse response;
+  while (stream->Read(&response)) received++;
+  auto status = stream->Finish();
+  EXPECT_TRUE(status.ok());
+  runner.set_port_rate_limit(port, 0, 0);
+
+  auto stats = runner.get_packet_io_stats(port);
+  EXPECT_GE(received, burst);
+  EXPECT_LT(received, num_packets);
+  EXPECT_EQ(received, stats.sent - stats_before.sent);
+  EXPECT_EQ(num_packets - received,
+            stats.rate_limit_drops - stats_before.rate_limit_drops);
+  EXPECT_EQ(stats.queue_drops, stats_before.queue_drops);
+}
+
 // This tests ensure that an error status is returned if we try to have multiple
 // connections to the gRPC DataplaneInterface service
 TEST_F(SimpleSwitchGrpcTest_GrpcDataplane, MultipleClients) {
@@ -31,8 +31,8 @@ int bmi_start_mgr(bmi_port_mgr_t *port_mgr) {
   return 0;
 }
 
-int bmi_port_create_mgr(bmi_port_mgr_t **port_mgr) {
-  UNUSED(port_mgr);
+int bmi_port_create_mgr(bmi_port_mgr_t **port_mgr, int nb_rx_threads) {
+  UNUSED(port_mgr); UNUSED(nb_rx_threads);
   return 0;
 }
 
@@ -43,6 +43,13 @@ int bmi_set_packet_handler(bmi_port_mgr_t *port_mgr,
   return 0;
 }
 
+int bmi_set_thread_start_fn(bmi_port_mgr_t *port_mgr,
+                            bmi_thread_start_fn_t thread_start_fn,
+                            void *cookie) {
+  UNUSED(port_mgr); UNUSED(thread_start_fn); UNUSED(cookie);
+  return 0;
+}
+
 int bmi_port_send(bmi_port_mgr_t *port_mgr, int port_num,
                   const char *buffer, int len) {
   UNUSED(port_mgr); UNUSED(port_num); UNUSED(buffer); UNUSED(len);
@@ -0,0 +1,234 @@
+/* Copyright 2013-present Barefoot Networks, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Antonin Bas (antonin@barefootnetworks.com)
+ *
+ */
+
+// Measures how long it takes to load a large P4 JSON config. The config is
+// generated: it has 100 * scale headers (16 fields each), 500 * scale actions
+// and 60 * scale tables.
+
+#include <bm/bm_sim/P4Objects.h>
+#include <bm/bm_sim/_assert.h>
+
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include <cassert>
+
+#include "jsoncpp/json.h"
+
+namespace {
+
+using clock_ = std::chrono::steady_clock;
+
+constexpr int nb_fields = 16;
+
+std::string name(const char *prefix, int i) {
+  return prefix + std::to_string(i);
+}
+
+Json::Value field_ref(const std::string &header, const std::string &field) {
+  Json::Value v(Json::arrayValue);
+  v.append(header);
+  v.append(field);
+  return v;
+}
+
+void add_headers(int nb_headers, Json::Value *root) {
+  Json::Value header_types(Json::arrayValue), headers(Json::arrayValue);
+  for (int i = 0; i < nb_headers; i++) {
+    Json::Value ht;
+    ht["name"] = name("h", i) + "_t";
+    ht["id"] = i;
+    ht["fields"] = Json::Value(Json::arrayValue);
+    for (int j = 0; j < nb_fields; j++) {
+      Json::Value f(Json::arrayValue);
+      f.append(name("f", j));
+      f.append(16);
+      ht["fields"].append(f);
+    }
+    header_types.append(ht);
+    Json::Value h;
+    h["name"] = name("h", i);
+    h["id"] = i;
+    h["header_type"] = ht["name"];
+    h["metadata"] = false;
+    headers.append(h);
+  }
+  (*root)["header_types"] = header_types;
+  (*root)["headers"] = headers;
+}
+
+void add_parser(int nb_headers, Json::Value *root) {
+  Json::Value parser;
+  parser["name"] = "parser";
+  parser["id"] = 0;
+  parser["init_state"] = "s0";
+  parser["parse_states"] = Json::Value(Json::arrayValue);
+  for (int i = 0; i < nb_headers; i++) {
+    Json::Value state;
+    state["name"] = name("s", i);
+    state["id"] = i;
+    Json::Value param;
+    param["type"] = "regular";
+    param["value"] = name("h", i);
+    Json::Value op;
+    op["op"] = "extract";
+    op["parameters"].append(param);
+    state["parser_ops"].append(op);
+    state["transition_key"] = Json::Value(Json::arrayValue);
+    Json::Value transition;
+    transition["value"] = "default";
+    transition["mask"] = Json::Value();
+    transition["next_state"] = (i + 1 < nb_headers) ?
+        Json::Value(name("s", i + 1)) : Json::Value();
+    state["transitions"].append(transition);
+    parser["parse_states"].append(state);
+  }
+  (*root)["parsers"].append(parser);
+  Json::Value deparser;
+  deparser["name"] = "deparser";
+  deparser["id"] = 0;
+  for (int i = 0; i < nb_headers; i++) deparser["order"].append(name("h", i));
+  (*root)["deparsers"].append(deparser);
+}
+
+void add_actions(int nb_headers, int nb_actions, Json::Value *root) {
+  Json::Value actions(Json::arrayValue);
+  for (int a = 0; a < nb_actions; a++) {
+    Json::Value action;
+    action["name"] = name("a", a);
+    action["id"] = a;
+    Json::Value param;
+    param["name"] = "p";
+    param["bitwidth"] = 16;
+    action["runtime_data"].append(param);
+    action["primitives"] = Json::Value(Json::arrayValue);
+    for (int k = 0; k < 4; k++) {
+      Json::Value dst;
+      dst["type"] = "field";
+      dst["value"] = field_ref(name("h", (a + k) % nb_headers),
+                               name("f", k % nb_fields));
+      Json::Value src;
+      src["type"] = "runtime_data";
+      src["value"] = 0;
+      Json::Value primitive;
+      primitive["op"] = "assign";
+      primitive["parameters"].append(dst);
+      primitive["parameters"].append(src);
+      action["primitives"].append(primitive);
+    }
+    actions.append(action);
+  }
+  (*root)["actions"] = actions;
+}
+
+void add_pipeline(int nb_headers, int nb_actions, int nb_tables,
+                  Json::Value *root) {
+  Json::Value tables(Json::arrayValue);
+  for (int t = 0; t < nb_tables; t++) {
+    Json::Value table;
+    table["name"] = name("t", t);
+    table["id"] = t;
+    table["match_type"] = "exact";
+    table["type"] = "simple";
+    table["max_size"] = 1024;
+    table["with_counters"] = false;
+    table["support_timeout"] = false;
+    table["direct_meters"] = Json::Value();
+    for (int k = 0; k < 2; k++) {
+      Json::Value key;
+      key["match_type"] = "exact";
+      key["target"] = field_ref(name("h", (t + k) % nb_headers), name("f", k));
+      key["mask"] = Json::Value();
+      table["key"].append(key);
+    }
+    const auto next = (t + 1 < nb_tables) ?
+        Json::Value(name("t", t + 1)) : Json::Value();
+    for (int k = 0; k < 5; k++) {
+      const int a = (t * 5 + k) % nb_actions;
+      table["actions"].append(name("a", a));
+      table["action_ids"].append(a);
+      table["next_tables"][name("a", a)] = next;
+    }
+    table["base_default_next"] = next;
+    table["default_entry"] = Json::Value();
+    tables.append(table);
+  }
+  Json::Value pipeline;
+  pipeline["name"] = "ingress";
+  pipeline["id"] = 0;
+  pipeline["init_table"] = "t0";
+  pipeline["tables"] = tables;
+  pipeline["action_profiles"] = Json::Value(Json::arrayValue);
+  pipeline["conditionals"] = Json::Value(Json::arrayValue);
+  (*root)["pipelines"].append(pipeline);
+}
+
+std::string make_config(int scale) {
+  const int nb_headers = 100 * scale;
+  const int nb_actions = 500 * scale;
+  const int nb_tables = 60 * scale;
+  Json::Value root(Json::objectValue);
+  add_headers(nb_headers, &root);
+  add_parser(nb_headers, &root);
+  add_actions(nb_headers, nb_actions, &root);
+  add_pipeline(nb_headers, nb_actions, nb_tables, &root);
+  for (const auto *section : {"header_stacks", "meter_arrays", "calculations",
+                              "checksums", "learn_lists", "field_lists",
+                              "counter_arrays", "register_arrays"}) {
+    root[section] = Json::Value(Json::arrayValue);
+  }
+  Json::StreamWriterBuilder builder;
+  builder.settings_["indentation"] = "  ";
+  return Json::writeString(builder, root);
+}
+
+unsigned int elapsed_ms(const clock_::time_point &start) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+      clock_::now() - start).count();
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  int scale = 10;
+  if (argc > 1) scale = std::stoi(argv[1]);
+
+  const auto config = make_config(scale);
+  std::cout << "Config size is " << config.size() / 1024 << " KB.\n";
+
+  {
+    Json::Value root;
+    std::istringstream is(config);
+    const auto start = clock_::now();
+    is >> root;
+    std::cout << "Parsing config took " << elapsed_ms(start) << " ms.\n";
+  }
+
+  bm::LookupStructureFactory factory;
+  bm::P4Objects objects(std::cout, true);
+  std::istringstream is(config);
+  const auto start = clock_::now();
+  const int rc = objects.init_objects(&is, &factory);
+  _BM_UNUSED(rc);
+  assert(rc == 0);
+  std::cout << "Loading config took " << elapsed_ms(start) << " ms.\n";
+}
@@ -0,0 +1,203 @@
+/* Copyright 2013-present Barefoot Networks, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Antonin Bas (antonin@barefootnetworks.com)
+ *
+ */
+
+
+#include <gtest/gtest.h>
+
+#include <bm/bm_sim/dev_mgr.h>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "utils.h"
+
+using namespace bm;
+
+using ReturnCode = PacketDispatcherIface::ReturnCode;
+
+// These tests create a veth pair, which requires CAP_NET_ADMIN. When the veth
+// pair cannot be created, the tests are skipped.
+
+namespace {
+
+constexpr uint16_t kEtherType = 0x88b5;  // local experimental
+
+std::vector<char> make_frame(size_t size, int seq) {
+  std::vector<char> frame(size, static_cast<char>(seq));
+  std::memset(frame.data(), 0xff, 6);
+  std::memset(frame.data() + 6, 0x02, 6);
+  frame[12] = static_cast<char>(kEtherType >> 8);
+  frame[13] = static_cast<char>(kEtherType & 0xff);
+  return frame;
+}
+
+class AfPacketSwitch : public DevMgr { };
+
+class Receiver {
+ public:
+  void receive(int port_num, const char *buffer, int len, void *) {
+    if (len < 14 || buffer[12] != static_cast<char>(kEtherType >> 8) ||
+        buffer[13] != static_cast<char>(kEtherType & 0xff))
+      return;
+    std::unique_lock<std::mutex> lock(mutex);
+    frames.emplace_back(buffer, buffer + len);
+    ports.push_back(port_num);
+    cv.notify_all();
+  }
+
+  bool wait_for(size_t count, unsigned int timeout_ms = 2000) {
+    std::unique_lock<std::mutex> lock(mutex);
+    return cv.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+                       [this, count] { return frames.size() >= count; });
+  }
+
+  std::vector<std::vector<char> > frames{};
+  std::vector<int> ports{};
+
+ private:
+  std::mutex mutex{};
+  std::condition_variable cv{};
+};
+
+}  // namespace
+
+class AfPacketDevMgrTest : public ::testing::Test {
+ protected:
+  static constexpr DevMgr::port_t kPort = 3;
+
+  void SetUp() override {
+    veth.reset(new VethPair(if0, if1));
+    if (!veth->created()) return;
+    peer_fd = veth->open_peer_socket();
+    ASSERT_LE(0, peer_fd);
+
+    sw.set_dev_mgr_af_packet(0);
+    sw.set_packet_handler(
+        std::bind(&Receiver::receive, &receiver, std::placeholders::_1,
+                  std::placeholders::_2, std::placeholders::_3,
+                  std::placeholders::_4),
+        nullptr);
+    ASSERT_EQ(ReturnCode::SUCCESS, sw.port_add(if0, kPort, {}));
+    sw.start();
+    available = true;
+  }
+
+  void TearDown() override {
+    if (peer_fd >= 0) close(peer_fd);
+    veth.reset();
+  }
+
+  // returns the number of frames with our ethertype received by the peer
+  size_t peer_receive(size_t count, std::vector<std::vector<char> > *frames) {
+    char buffer[2048];
+    while (frames->size() < count) {
+      struct pollfd pfd = {peer_fd, POLLIN, 0};
+      if (poll(&pfd, 1, 2000) <= 0) break;
+      auto len = recv(peer_fd, buffer, sizeof(buffer), 0);
+      if (len < 14 || buffer[12] != static_cast<char>(kEtherType >> 8) ||
+          buffer[13] != static_cast<char>(kEtherType & 0xff))
+        continue;
+      frames->emplace_back(buffer, buffer + len);
+    }
+    return frames->size();
+  }
+
+  const std::string if0{"bmv2af0"};
+  const std::string if1{"bmv2af1"};
+  bool available{false};
+  std::unique_ptr<VethPair> veth{};
+  int peer_fd{-1};
+  Receiver receiver{};
+  AfPacketSwitch sw{};
+};
+
+constexpr DevMgr::port_t AfPacketDevMgrTest::kPort;
+
+TEST_F(AfPacketDevMgrTest, Receive) {
+  if (!available) return;
+  constexpr int nb_frames = 200;
+  for (int i = 0; i < nb_frames; i++) {
+    auto frame = make_frame(64 + i, i);
+    ASSERT_EQ(static_cast<ssize_t>(frame.size()),
+              send(peer_fd, frame.data(), frame.size(), 0));
+  }
+  ASSERT_TRUE(receiver.wait_for(nb_frames));
+  for (int i = 0; i < nb_frames; i++) {
+    ASSERT_EQ(static_cast<int>(kPort), receiver.ports[i]);
+    ASSERT_EQ(make_frame(64 + i, i), receiver.frames[i]);
+  }
+  auto stats = sw.get_port_stats(kPort);
+  ASSERT_LE(static_cast<uint64_t>(nb_frames), stats.in_packets);
+}
+
+TEST_F(AfPacketDevMgrTest, Transmit) {
+  if (!available) return;
+  // a single frame, which is sent even though the batch is not full
+  {
+    auto frame = make_frame(100, 0);
+    sw.transmit_fn(kPort, frame.data(), frame.size());
+    std::vector<std::vector<char> > frames;
+    ASSERT_EQ(1u, peer_receive(1, &frames));
+    ASSERT_EQ(frame, frames[0]);
+  }
+
+  // more frames than there are slots in the TX ring
+  constexpr int nb_frames = 2000;
+  std::vector<std::vector<char> > frames;
+  for (int i = 0; i < nb_frames; i++) {
+    auto frame = make_frame(64 + (i % 1000), i);
+    sw.transmit_fn(kPort, frame.data(), frame.size());
+    // prevents the peer's socket buffer from overflowing
+    if (i % 64 == 63) peer_receive(i + 1, &frames);
+  }
+  ASSERT_EQ(static_cast<size_t>(nb_frames), peer_receive(nb_frames, &frames));
+  for (int i = 0; i < nb_frames; i++)
+    ASSERT_EQ(make_frame(64 + (i % 1000), i), frames[i]);
+  auto stats = sw.get_port_stats(kPort);
+  ASSERT_EQ(static_cast<uint64_t>(nb_frames + 1), stats.out_packets);
+
+  // too big for the TX ring
+  auto frame = make_frame(16384, 0);
+  sw.transmit_fn(kPort, frame.data(), frame.size());
+  ASSERT_EQ(static_cast<uint64_t>(nb_frames + 1),
+            sw.get_port_stats(kPort).out_packets);
+}
+
+TEST_F(AfPacketDevMgrTest, PortRemove) {
+  if (!available) return;
+  ASSERT_EQ(ReturnCode::ERROR, sw.port_add(if0, kPort, {}));
+  ASSERT_TRUE(sw.port_is_up(kPort));
+  ASSERT_EQ(ReturnCode::SUCCESS, sw.port_remove(kPort));
+  ASSERT_EQ(ReturnCode::ERROR, sw.port_remove(kPort));
+  auto frame = make_frame(64, 0);
+  ASSERT_EQ(static_cast<ssize_t>(frame.size()),
+            send(peer_fd, frame.data(), frame.size(), 0));
+  ASSERT_FALSE(receiver.wait_for(1, 200));
+  ASSERT_EQ(ReturnCode::ERROR, sw.port_add("bmv2_not_an_iface", kPort, {}));
+}
@@ -0,0 +1,345 @@
+/* Copyright 2013-present Barefoot Networks, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Antonin Bas (antonin@barefootnetworks.com)
+ *
+ */
+
+
+#include <gtest/gtest.h>
+
+#include <bm/bm_sim/dev_mgr.h>
+#include <bm/bm_sim/packet_buffer.h>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "af_xdp.h"
+#include "utils.h"
+
+using namespace bm;
+
+using ReturnCode = PacketDispatcherIface::ReturnCode;
+
+// These tests create a veth pair and attach an XDP program in generic (skb)
+// mode, which requires CAP_NET_ADMIN and CAP_BPF (or root). When the veth pair
+// cannot be created or AF_XDP is not available, the tests are skipped.
+
+namespace {
+
+constexpr uint16_t kEtherType = 0x88b5;  // local experimental
+
+std::vector<char> make_frame(size_t size, int seq) {
+  std::vector<char> frame(size, static_cast<char>(seq));
+  std::memset(frame.data(), 0xff, 6);
+  std::memset(frame.data() + 6, 0x02, 6);
+  frame[12] = static_cast<char>(kEtherType >> 8);
+  frame[13] = static_cast<char>(kEtherType & 0xff);
+  return frame;
+}
+
+bool is_test_frame(const char *buffer, size_t len) {
+  return len >= 14 && buffer[12] == static_cast<char>(kEtherType >> 8) &&
+      buffer[13] == static_cast<char>(kEtherType & 0xff);
+}
+
+// Keeps the PacketBuffer instances it receives (and therefore the UMEM frames)
+// until release() is called.
+class Receiver {
+ public:
+  void receive(int port_num, const char *buffer, int len, void *) {
+    if (!is_test_frame(buffer, len)) return;
+    std::unique_lock<std::mutex> lock(mutex);
+    frames.emplace_back(buffer, buffer + len);
+    ports.push_back(port_num);
+    copied++;
+    cv.notify_all();
+  }
+
+  void receive_buffer(int port_num, PacketBuffer &&buffer, void *) {
+    if (!is_test_frame(buffer.start(), buffer.get_data_size())) return;
+    std::unique_lock<std::mutex> lock(mutex);
+    frames.emplace_back(buffer.start(), buffer.end());
+    ports.push_back(port_num);
+    // UMEM frames are 4096-byte aligned
+    headrooms.push_back(reinterpret_cast<uintptr_t>(buffer.start()) & 4095);
+    buffers.push_back(std::move(buffer));
+    cv.notify_all();
+  }
+
+  bool wait_for(size_t count, unsigned int timeout_ms = 2000) {
+    std::unique_lock<std::mutex> lock(mutex);
+    return cv.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+                       [this, count] { return frames.size() >= count; });
+  }
+
+  void release() {
+    std::unique_lock<std::mutex> lock(mutex);
+    buffers.clear();
+  }
+
+  std::vector<std::vector<char> > frames{};
+  std::vector<int> ports{};
+  std::vector<PacketBuffer> buffers{};
+  std::vector<size_t> headrooms{};
+  size_t copied{0};
+
+ private:
+  std::mutex mutex{};
+  std::condition_variable cv{};
+};
+
+}  // namespace
+
+class AfXdpTest : public ::testing::Test {
+ protected:
+  static constexpr DevMgr::port_t kPort = 3;
+
+  void SetUp() override {
+    veth.reset(new VethPair(if0, if1));
+    if (!veth->created()) return;
+    peer_fd = veth->open_peer_socket();
+    ASSERT_LE(0, peer_fd);
+
+    mgr.set_packet_handler(
+        std::bind(&Receiver::receive, &receiver, std::placeholders::_1,
+                  std::placeholders::_2, std::placeholders::_3,
+                  std::placeholders::_4),
+        nullptr);
+    mgr.set_packet_buffer_handler(
+        std::bind(&Receiver::receive_buffer, &receiver, std::placeholders::_1,
+                  std::placeholders::_2, std::placeholders::_3),
+        nullptr);
+    if (mgr.port_add(if0, kPort, extras) != ReturnCode::SUCCESS) {
+      std::cout << "Cannot open AF_XDP socket, skipping test\n";
+      return;
+    }
+    mgr.start();
+    available = true;
+  }
+
+  void TearDown() override {
+    // frames need to be released before the manager is destroyed
+    receiver.release();
+    if (peer_fd >= 0) close(peer_fd);
+    veth.reset();
+  }
+
+  void peer_send(const std::vector<char> &frame) {
+    ASSERT_EQ(static_cast<ssize_t>(frame.size()),
+              send(peer_fd, frame.data(), frame.size(), 0));
+  }
+
+  // returns the number of frames with our ethertype received by the peer
+  size_t peer_receive(size_t count, std::vector<std::vector<char> > *frames) {
+    char buffer[4096];
+    while (frames->size() < count) {
+      struct pollfd pfd = {peer_fd, POLLIN, 0};
+      if (poll(&pfd, 1, 2000) <= 0) break;
+      auto len = recv(peer_fd, buffer, sizeof(buffer), 0);
+      if (len < 0 || !is_test_frame(buffer, len)) continue;
+      frames->emplace_back(buffer, buffer + len);
+    }
+    return frames->size();
+  }
+
+  const std::string if0{"bmv2xdp0"};
+  const std::string if1{"bmv2xdp1"};
+  const DevMgrIface::PortExtras extras{
+    {DevMgrIface::kPortExtraAfXdp, "skb"}};
+  bool available{false};
+  std::unique_ptr<VethPair> veth{};
+  int peer_fd{-1};
+  Receiver receiver{};
+  AfXdpPortMgr mgr{};
+};
+
+constexpr DevMgr::port_t AfXdpTest::kPort;
+
+TEST_F(AfXdpTest, ZeroCopyReceive) {
+  if (!available) return;
+  constexpr int nb_frames = 200;
+  for (int i = 0; i < nb_frames; i++) peer_send(make_frame(64 + i, i));
+  ASSERT_TRUE(receiver.wait_for(nb_frames));
+  ASSERT_EQ(0u, receiver.copied);
+  for (int i = 0; i < nb_frames; i++) {
+    ASSERT_EQ(static_cast<int>(kPort), receiver.ports[i]);
+    ASSERT_EQ(make_frame(64 + i, i), receiver.frames[i]);
+    // room for the switch to push new headers
+    ASSERT_LE(256u, receiver.headrooms[i]);
+  }
+  DevMgrIface::PortStats stats;
+  ASSERT_TRUE(mgr.get_port_stats(kPort, &stats));
+  ASSERT_LE(static_cast<uint64_t>(nb_frames), stats.in_packets);
+}
+
+// more frames than there are in the UMEM, which only works if the frames
+// released by the switch are given back to the kernel
+TEST_F(AfXdpTest, FrameRecycling) {
+  if (!available) return;
+  constexpr int nb_frames = 8000;
+  constexpr int batch = 500;
+  for (int i = 0; i < nb_frames; i += batch) {
+    for (int j = i; j < i + batch; j++) peer_send(make_frame(64, j));
+    ASSERT_TRUE(receiver.wait_for(i + batch));
+    receiver.release();
+  }
+  ASSERT_EQ(0u, receiver.copied);
+  for (int i = 0; i < nb_frames; i++)
+    ASSERT_EQ(make_frame(64, i), receiver.frames[i]);
+}
+
+// when the switch holds too many frames, packets are copied
+TEST_F(AfXdpTest, CopyFallback) {
+  if (!available) return;
+  constexpr int nb_frames = 1500;
+  for (int i = 0; i < nb_frames; i++) {
+    peer_send(make_frame(64, i));
+    // we do not want the kernel to drop frames when the RX ring is full
+    if (i % 256 == 255) {
+      ASSERT_TRUE(receiver.wait_for(i + 1));
+    }
+  }
+  ASSERT_TRUE(receiver.wait_for(nb_frames));
+  ASSERT_LT(0u, receiver.copied);
+  ASSERT_EQ(static_cast<size_t>(nb_frames),
+            receiver.copied + receiver.buffers.size());
+  for (int i = 0; i < nb_frames; i++)
+    ASSERT_EQ(make_frame(64, i), receiver.frames[i]);
+}
+
+TEST_F(AfXdpTest, Transmit) {
+  if (!available) return;
+  // a single frame, which is sent even though the batch is not full
+  {
+    auto frame = make_frame(100, 0);
+    ASSERT_TRUE(mgr.transmit(kPort, frame.data(), frame.size()));
+    std::vector<std::vector<char> > frames;
+    ASSERT_EQ(1u, peer_receive(1, &frames));
+    ASSERT_EQ(frame, frames[0]);
+  }
+
+  // more frames than there are TX frames in the UMEM
+  constexpr int nb_frames = 3000;
+  std::vector<std::vector<char> > frames;
+  for (int i = 0; i < nb_frames; i++) {
+    auto frame = make_frame(64 + (i % 1000), i);
+    ASSERT_TRUE(mgr.transmit(kPort, frame.data(), frame.size()));
+    // prevents the peer's socket buffer from overflowing
+    if (i % 64 == 63) peer_receive(i + 1, &frames);
+  }
+  ASSERT_EQ(static_cast<size_t>(nb_frames), peer_receive(nb_frames, &frames));
+  for (int i = 0; i < nb_frames; i++)
+    ASSERT_EQ(make_frame(64 + (i % 1000), i), frames[i]);
+  DevMgrIface::PortStats stats;
+  ASSERT_TRUE(mgr.get_port_stats(kPort, &stats));
+  ASSERT_EQ(static_cast<uint64_t>(nb_frames + 1), stats.out_packets);
+
+  // not an AF_XDP port
+  auto frame = make_frame(64, 0);
+  ASSERT_FALSE(mgr.transmit(kPort + 1, frame.data(), frame.size()));
+}
+
+// frames received on the port are sent back out of the same port directly from
+// the UMEM; this uses more frames than there are in the UMEM, which only works
+// if the frames go back to the fill ring once transmitted
+TEST_F(AfXdpTest, ZeroCopyTransmit) {
+  if (!available) return;
+  constexpr int nb_frames = 4000;
+  constexpr int batch = 250;
+  std::vector<std::vector<char> > frames;
+  for (int i = 0; i < nb_frames; i += batch) {
+    for (int j = i; j < i + batch; j++) peer_send(make_frame(64 + j % 100, j));
+    ASSERT_TRUE(receiver.wait_for(i + batch));
+    for (auto &buffer : receiver.buffers) {
+      int len = static_cast<int>(buffer.get_data_size());
+      ASSERT_TRUE(mgr.transmit_buffer(kPort, &buffer, len));
+      // the buffer no longer owns the frame
+      ASSERT_EQ(0u, buffer.get_data_size());
+    }
+    mgr.flush();
+    receiver.release();
+    ASSERT_EQ(static_cast<size_t>(i + batch),
+              peer_receive(i + batch, &frames));
+  }
+  ASSERT_EQ(0u, receiver.copied);
+  for (int i = 0; i < nb_frames; i++)
+    ASSERT_EQ(make_frame(64 + i % 100, i), frames[i]);
+
+  // buffers which do not belong to the port are copied
+  auto frame = make_frame(80, 0);
+  PacketBuffer buffer(512, frame.data(), frame.size());
+  ASSERT_TRUE(mgr.transmit_buffer(kPort, &buffer, frame.size()));
+  ASSERT_EQ(frame.size(), buffer.get_data_size());
+  mgr.flush();
+  frames.clear();
+  ASSERT_EQ(1u, peer_receive(1, &frames));
+  ASSERT_EQ(frame, frames[0]);
+}
+
+TEST_F(AfXdpTest, PortRemove) {
+  if (!available) return;
+  ASSERT_EQ(ReturnCode::ERROR, mgr.port_add(if0, kPort, extras));
+  bool is_up = false;
+  ASSERT_TRUE(mgr.port_is_up(kPort, &is_up));
+  ASSERT_TRUE(is_up);
+
+  // the switch still holds a frame when the port is removed
+  peer_send(make_frame(64, 0));
+  ASSERT_TRUE(receiver.wait_for(1));
+  ASSERT_EQ(1u, receiver.buffers.size());
+  ASSERT_TRUE(mgr.port_remove(kPort));
+  ASSERT_FALSE(mgr.port_remove(kPort));
+  ASSERT_FALSE(mgr.port_is_up(kPort, &is_up));
+  ASSERT_EQ(make_frame(64, 0),
+            std::vector<char>(receiver.buffers[0].start(),
+                              receiver.buffers[0].end()));
+  receiver.release();
+
+  peer_send(make_frame(64, 1));
+  ASSERT_FALSE(receiver.wait_for(2, 200));
+
+  // the port can be added again
+  ASSERT_EQ(ReturnCode::SUCCESS, mgr.port_add(if0, kPort, extras));
+  peer_send(make_frame(64, 2));
+  ASSERT_TRUE(receiver.wait_for(2));
+  ASSERT_EQ(make_frame(64, 2), receiver.frames[1]);
+}
+
+TEST_F(AfXdpTest, InvalidExtras) {
+  if (!available) return;
+  ASSERT_FALSE(AfXdpPortMgr::is_requested({}));
+  ASSERT_TRUE(AfXdpPortMgr::is_requested(extras));
+  ASSERT_EQ(ReturnCode::ERROR,
+            mgr.port_add(if1, kPort + 1,
+                         {{DevMgrIface::kPortExtraAfXdp, "bad_mode"}}));
+  ASSERT_EQ(ReturnCode::ERROR,
+            mgr.port_add(if1, kPort + 1,
+                         {{DevMgrIface::kPortExtraAfXdp, "skb"},
+                          {DevMgrIface::kPortExtraAfXdpQueue, "x"}}));
+  ASSERT_EQ(ReturnCode::ERROR,
+            mgr.port_add("bmv2_not_an_iface", kPort + 1, extras));
+}
@@ -0,0 +1,173 @@
+/* Copyright 2013-present Barefoot Networks, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Antonin Bas (antonin@barefootnetworks.com)
+ *
+ */
+
+#include <gtest/gtest.h>
+
+#include <bm/bm_sim/aqm.h>
+
+#include <vector>
+
+using bm::QueueAQM;
+
+using Verdict = QueueAQM::Verdict;
+
+TEST(QueueAQM, Disabled) {
+  QueueAQM aqm;
+  ASSERT_EQ(QueueAQM::Mode::NONE, aqm.get_mode());
+  for (uint64_t t = 0; t < 1000; t++) {
+    ASSERT_EQ(Verdict::PASS, aqm.on_enqueue(1000, t, false));
+    ASSERT_EQ(Verdict::PASS, aqm.on_dequeue(1000000, 1000, t, false));
+  }
+  auto counters = aqm.get_counters();
+  ASSERT_EQ(0u, counters.drops);
+  ASSERT_EQ(0u, counters.marks);
+}
+
+TEST(QueueAQM, BadConfig) {
+  QueueAQM aqm;
+  ASSERT_EQ(QueueAQM::INVALID_THRESHOLDS, aqm.set_red({20, 10, 0.1, 9, false}));
+  ASSERT_EQ(QueueAQM::INVALID_PROBABILITY,
+            aqm.set_red({10, 20, 1.5, 9, false}));
+  ASSERT_EQ(QueueAQM::INVALID_WEIGHT, aqm.set_red({10, 20, 0.1, 0, false}));
+  ASSERT_EQ(QueueAQM::INVALID_TIME_VALUE, aqm.set_codel({0, 100000, false}));
+  ASSERT_EQ(QueueAQM::INVALID_TIME_VALUE,
+            aqm.set_pie({15000, 0, 150000, false}));
+  ASSERT_EQ(QueueAQM::Mode::NONE, aqm.get_mode());
+}
+
+TEST(QueueAQM, Red) {
+  QueueAQM aqm;
+  // with a weight of 1/2, the average converges quickly to the queue depth
+  ASSERT_EQ(QueueAQM::SUCCESS, aqm.set_red({10, 20, 1.0, 1, true}));
+  ASSERT_EQ(QueueAQM::Mode::RED, aqm.get_mode());
+
+  for (int i = 0; i < 100; i++)
+    ASSERT_EQ(Verdict::PASS, aqm.on_enqueue(5, 0, true));
+
+  // between the thresholds, ECN-capable packets are marked, never dropped
+  size_t marks = 0;
+  for (int i = 0; i < 1000; i++) {
+    auto verdict = aqm.on_enqueue(15, 0, true);
+    ASSERT_NE(Verdict::DROP, verdict);
+    if (verdict == Verdict::MARK) marks++;
+  }
+  ASSERT_LT(0u, marks);
+  ASSERT_GT(1000u, marks);
+  ASSERT_EQ(marks, aqm.get_counters().marks);
+  ASSERT_EQ(0u, aqm.get_counters().drops);
+
+  // other packets are dropped
+  size_t drops = 0;
+  for (int i = 0; i < 1000; i++) {
+    auto verdict = aqm.on_enqueue(15, 0, false);
+    ASSERT_NE(Verdict::MARK, verdict);
+    if (verdict == Verdict::DROP) drops++;
+  }
+  ASSERT_LT(0u, drops);
+  ASSERT_EQ(drops, aqm.get_counters().drops);
+
+  // above the maximum threshold, everything is dropped
+  for (int i = 0; i < 100; i++) aqm.on_enqueue(30, 0, true);
+  for (int i = 0; i < 100; i++)
+    ASSERT_EQ(Verdict::DROP, aqm.on_enqueue(30, 0, true));
+
+  aqm.reset_counters();
+  ASSERT_EQ(0u, aqm.get_counters().drops);
+  ASSERT_EQ(0u, aqm.get_counters().marks);
+
+  // dequeue decisions are not affected by RED
+  ASSERT_EQ(Verdict::PASS, aqm.on_dequeue(1000000, 30, 0, false));
+}
+
+TEST(QueueAQM, Codel) {
+  QueueAQM aqm;
+  const uint64_t target = 5000;
+  const uint64_t interval = 100000;
+  ASSERT_EQ(QueueAQM::SUCCESS, aqm.set_codel({target, interval, true}));
+
+  uint64_t t = 1000;
+  // good queue
+  for (; t < 500000; t += 1000)
+    ASSERT_EQ(Verdict::PASS, aqm.on_dequeue(target - 1, 10, t, true));
+  // the enqueue decision is not affected by CoDel
+  ASSERT_EQ(Verdict::PASS, aqm.on_enqueue(1000, t, true));
+
+  // bad queue: nothing happens for one interval
+  const uint64_t start = t;
+  for (; t < start + interval; t += 1000)
+    ASSERT_EQ(Verdict::PASS, aqm.on_dequeue(2 * target, 10, t, true));
+  ASSERT_EQ(Verdict::MARK, aqm.on_dequeue(2 * target, 10, t, true));
+
+  // the next marks are spaced by interval / sqrt(count)
+  std::vector<uint64_t> marks;
+  for (t += 1000; t < start + 10 * interval; t += 1000) {
+    if (aqm.on_dequeue(2 * target, 10, t, true) == Verdict::MARK)
+      marks.push_back(t);
+  }
+  ASSERT_LE(3u, marks.size());
+  for (size_t i = 1; i < marks.size(); i++)
+    ASSERT_LE(marks[i] - marks[i - 1], marks[0] - start);
+  ASSERT_EQ(marks.size() + 1, aqm.get_counters().marks);
+  ASSERT_EQ(0u, aqm.get_counters().drops);
+
+  // non ECN-capable packets are dropped instead
+  size_t drops = 0;
+  for (; t < start + 20 * interval; t += 1000) {
+    if (aqm.on_dequeue(2 * target, 10, t, false) == Verdict::DROP) drops++;
+  }
+  ASSERT_LT(0u, drops);
+  ASSERT_EQ(drops, aqm.get_counters().drops);
+
+  // a single packet with a small sojourn time ends the dropping state
+  ASSERT_EQ(Verdict::PASS, aqm.on_dequeue(target - 1, 10, t, true));
+  for (uint64_t end = t + interval; t < end; t += 1000)
+    ASSERT_EQ(Verdict::PASS, aqm.on_dequeue(2 * target, 10, t, true));
+}
+
+TEST(QueueAQM, Pie) {
+  QueueAQM aqm;
+  const uint64_t target = 15000;
+  const uint64_t t_update = 15000;
+  const uint64_t max_burst = 150000;
+  ASSERT_EQ(QueueAQM::SUCCESS,
+            aqm.set_pie({target, t_update, max_burst, false}));
+
+  // persistent 100ms queueing delay
+  uint64_t t = 0;
+  for (; t < max_burst; t += 100) {
+    ASSERT_EQ(Verdict::PASS, aqm.on_enqueue(100, t, false));
+    ASSERT_EQ(Verdict::PASS, aqm.on_dequeue(100000, 100, t, false));
+  }
+  size_t drops = 0;
+  for (; t < 20 * max_burst; t += 100) {
+    if (aqm.on_enqueue(100, t, false) == Verdict::DROP) drops++;
+    aqm.on_dequeue(100000, 100, t, false);
+  }
+  ASSERT_LT(0u, drops);
+  ASSERT_EQ(drops, aqm.get_counters().drops);
+
+  // very short queues are never dropped from
+  for (int i = 0; i < 1000; i++)
+    ASSERT_EQ(Verdict::PASS, aqm.on_enqueue(2, t, false));
+
+  aqm.disable();
+  ASSERT_EQ(QueueAQM::Mode::NONE, aqm.get_mode());
+  ASSERT_EQ(Verdict::PASS, aqm.on_enqueue(100, t, false));
+}
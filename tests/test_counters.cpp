@@ -26,6 +26,7 @@
 #include <bm/bm_sim/phv_source.h>
 
 #include <random>
+#include <vector>
 
 using namespace bm;
 
@@ -104,3 +105,35 @@ TEST_F(CountersTest, CounterArray) {
     ASSERT_EQ(0u, packets);
   }
 }
+
+TEST_F(CountersTest, ReadRange) {
+  std::vector<counter_value_t> bytes, packets;
+
+  CounterArray c_array("counter", 0, 16);
+  for (size_t idx = 0; idx < c_array.size(); idx++)
+    c_array.get_counter(idx).write_counter(idx * 100, idx);
+
+  ASSERT_EQ(Counter::SUCCESS, c_array.read_counters(4, 8, &bytes, &packets));
+  ASSERT_EQ(std::vector<counter_value_t>({400, 500, 600, 700}), bytes);
+  ASSERT_EQ(std::vector<counter_value_t>({4, 5, 6, 7}), packets);
+
+  ASSERT_EQ(Counter::SUCCESS,
+            c_array.read_counters(0, 16, &bytes, &packets, true));
+  ASSERT_EQ(16u, bytes.size());
+  ASSERT_EQ(1500u, bytes[15]);
+  ASSERT_EQ(15u, packets[15]);
+
+  // the counters have been cleared by the previous read
+  ASSERT_EQ(Counter::SUCCESS, c_array.read_counters(0, 16, &bytes, &packets));
+  for (size_t idx = 0; idx < c_array.size(); idx++) {
+    ASSERT_EQ(0u, bytes[idx]);
+    ASSERT_EQ(0u, packets[idx]);
+  }
+
+  ASSERT_EQ(Counter::SUCCESS, c_array.read_counters(3, 3, &bytes, &packets));
+  ASSERT_TRUE(bytes.empty());
+  ASSERT_EQ(Counter::INVALID_INDEX,
+            c_array.read_counters(8, 17, &bytes, &packets));
+  ASSERT_EQ(Counter::INVALID_INDEX,
+            c_array.read_counters(8, 4, &bytes, &packets));
+}
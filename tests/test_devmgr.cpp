@@ -260,12 +260,13 @@ class PacketInReceiver {
 // is here because DevMgr has a protected destructor
 class PacketInSwitch : public DevMgr { };
 
-class PacketInDevMgrTest : public ::testing::Test {
+// the parameter is the address used by the packet-in device manager
+class PacketInDevMgrTest : public ::testing::TestWithParam<std::string> {
  protected:
   static constexpr size_t kMaxBufferSize = 512;
 
   PacketInDevMgrTest()
-      : packet_inject(addr) { }
+      : addr(GetParam()), packet_inject(addr) { }
 
   void SetUp_(bool enforce_ports,
               std::shared_ptr<TransportIface> notifications_transport) {
@@ -282,6 +283,11 @@ class PacketInDevMgrTest : public ::testing::Test {
                             std::placeholders::_1, std::placeholders::_2,
                             std::placeholders::_3, std::placeholders::_4);
     packet_inject.set_packet_receiver(cb_lib, nullptr);
+
+    // the round-trip ensures that the client is connected to the switch, which
+    // would otherwise drop packets sent to the client
+    std::string rep_v;
+    packet_inject.request_info(0, 0, &rep_v);
   }
 
   virtual void SetUp() {
@@ -304,7 +310,7 @@ class PacketInDevMgrTest : public ::testing::Test {
     return !memcmp(recv_buffer, send_buffer, size);
   }
 
-  const std::string addr = "ipc:///tmp/test_packet_in_abc123";
+  const std::string addr;
 
   PacketInReceiver recv_switch{kMaxBufferSize};
   PacketInReceiver recv_lib{kMaxBufferSize};
@@ -314,7 +320,7 @@ class PacketInDevMgrTest : public ::testing::Test {
   bm_apps::PacketInject packet_inject;
 };
 
-TEST_F(PacketInDevMgrTest, PacketInTest) {
+TEST_P(PacketInDevMgrTest, PacketInTest) {
   constexpr int port = 2;
   const char pkt[] = {'\x0a', '\xba'};
   ASSERT_EQ(PacketInReceiver::Status::CAN_RECEIVE, recv_switch.check_status());
@@ -329,7 +335,7 @@ TEST_F(PacketInDevMgrTest, PacketInTest) {
   ASSERT_TRUE(check_recv(&recv_switch, port, pkt, sizeof(pkt)));
 }
 
-TEST_F(PacketInDevMgrTest, InfoRequestTest) {
+TEST_P(PacketInDevMgrTest, InfoRequestTest) {
   constexpr int port = 2;
   // using info_type 0 and 1, but can be any integer value at the moment
   // we expect a return value of 1 (error) as bmv2 does not support any request
@@ -339,6 +345,45 @@ TEST_F(PacketInDevMgrTest, InfoRequestTest) {
   ASSERT_EQ(1, packet_inject.request_info(port, 1, &rep_v));
 }
 
+TEST_P(PacketInDevMgrTest, Burst) {
+  constexpr int kNumPackets = 1000;
+  std::vector<std::vector<char> > pkts;
+  std::vector<bm_apps::PacketInject::Packet> burst;
+  for (int i = 0; i < kNumPackets; i++) {
+    pkts.emplace_back(1 + i % kMaxBufferSize, static_cast<char>(i));
+  }
+  for (int i = 0; i < kNumPackets; i++) {
+    burst.push_back({i % 8, pkts[i].data(), static_cast<int>(pkts[i].size())});
+  }
+  // the receiver only holds one packet at a time, so the burst is consumed as
+  // we read, which also exercises the backpressure in the transport
+  std::thread sender([this, &burst] {
+      packet_inject.send_burst(burst.data(), burst.size()); });
+  for (int i = 0; i < kNumPackets; i++) {
+    ASSERT_TRUE(check_recv(&recv_switch, i % 8, pkts[i].data(),
+                           pkts[i].size()));
+  }
+  sender.join();
+}
+
+TEST_P(PacketInDevMgrTest, TransmitBurst) {
+  constexpr int kNumPackets = 100;
+  std::vector<DevMgrIface::TxPacket> burst;
+  std::vector<std::vector<char> > pkts;
+  for (int i = 0; i < kNumPackets; i++) {
+    pkts.emplace_back(1 + i, static_cast<char>(i));
+    burst.push_back({static_cast<DevMgrIface::port_t>(i % 8),
+                     PacketBuffer(512, pkts[i].data(), pkts[i].size()),
+                     static_cast<int>(pkts[i].size())});
+  }
+  std::thread sender([this, &burst] {
+      sw.transmit_burst(burst.data(), burst.size()); });
+  for (int i = 0; i < kNumPackets; i++) {
+    ASSERT_TRUE(check_recv(&recv_lib, i % 8, pkts[i].data(), pkts[i].size()));
+  }
+  sender.join();
+}
+
 class PacketInDevMgrPortStatusTest : public PacketInDevMgrTest {
  protected:
   PacketInDevMgrPortStatusTest() { }
@@ -393,7 +438,7 @@ class PacketInDevMgrPortStatusTest : public PacketInDevMgrTest {
   mutable std::mutex cnt_mutex{};
 };
 
-TEST_F(PacketInDevMgrPortStatusTest, BadPort) {
+TEST_P(PacketInDevMgrPortStatusTest, BadPort) {
   constexpr int port = 2;
   const char pkt[] = {'\x0a', '\xba'};
   ASSERT_EQ(PacketInReceiver::Status::CAN_RECEIVE, recv_switch.check_status());
@@ -403,7 +448,7 @@ TEST_F(PacketInDevMgrPortStatusTest, BadPort) {
   ASSERT_FALSE(check_recv(&recv_switch, port, pkt, sizeof(pkt)));
 }
 
-TEST_F(PacketInDevMgrPortStatusTest, Basic) {
+TEST_P(PacketInDevMgrPortStatusTest, Basic) {
   constexpr int port = 2;
   const char pkt[] = {'\x0a', '\xba'};
   ASSERT_EQ(PacketInReceiver::Status::CAN_RECEIVE, recv_switch.check_status());
@@ -416,7 +461,7 @@ TEST_F(PacketInDevMgrPortStatusTest, Basic) {
   ASSERT_FALSE(check_recv(&recv_switch, port, pkt, sizeof(pkt)));
 }
 
-TEST_F(PacketInDevMgrPortStatusTest, Status) {
+TEST_P(PacketInDevMgrPortStatusTest, Status) {
   constexpr int port = 2;
   const char pkt[] = {'\x0a', '\xba'};
 
@@ -445,6 +490,16 @@ TEST_F(PacketInDevMgrPortStatusTest, Status) {
   check_and_reset_counts(0u, 1u, 0u, 0u);
 }
 
+INSTANTIATE_TEST_CASE_P(
+    PacketInAddrs, PacketInDevMgrTest,
+    ::testing::Values("ipc:///tmp/test_packet_in_abc123",
+                      "shm:///tmp/test_packet_in_shm_abc123"));
+
+INSTANTIATE_TEST_CASE_P(
+    PacketInAddrs, PacketInDevMgrPortStatusTest,
+    ::testing::Values("ipc:///tmp/test_packet_in_abc123",
+                      "shm:///tmp/test_packet_in_shm_abc123"));
+
 #endif  // BMNANOMSG_ON
 
 struct PMActive { };
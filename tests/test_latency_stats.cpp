@@ -0,0 +1,154 @@
+/* Copyright 2013-present Barefoot Networks, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Antonin Bas (antonin@barefootnetworks.com)
+ *
+ */
+
+#include <gtest/gtest.h>
+
+#include <bm/bm_sim/latency_stats.h>
+
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace bm;
+
+TEST(LatencyHistogram, Buckets) {
+  // every value below 128 has its own bucket
+  for (uint64_t v = 0; v < 128; v++) {
+    auto index = LatencyHistogram::bucket_index(v);
+    EXPECT_EQ(v, LatencyHistogram::bucket_lowest_value(index));
+    EXPECT_EQ(v, LatencyHistogram::bucket_highest_value(index));
+  }
+  EXPECT_EQ(128u, LatencyHistogram::bucket_index(128));
+  EXPECT_EQ(129u, LatencyHistogram::bucket_index(130));
+  EXPECT_EQ(LatencyHistogram::kNbBuckets - 1,
+            LatencyHistogram::bucket_index(LatencyHistogram::kMaxValue));
+  EXPECT_EQ(LatencyHistogram::kNbBuckets - 1,
+            LatencyHistogram::bucket_index(UINT64_MAX));
+
+  // buckets are contiguous and the relative error is bounded
+  for (size_t i = 1; i < LatencyHistogram::kNbBuckets; i++) {
+    auto low = LatencyHistogram::bucket_lowest_value(i);
+    auto high = LatencyHistogram::bucket_highest_value(i);
+    ASSERT_EQ(LatencyHistogram::bucket_highest_value(i - 1) + 1, low);
+    ASSERT_LE(low, high);
+    ASSERT_EQ(i, LatencyHistogram::bucket_index(low));
+    ASSERT_EQ(i, LatencyHistogram::bucket_index(high));
+    ASSERT_LE(high - low, low / 64);
+  }
+}
+
+TEST(LatencyHistogram, Values) {
+  LatencyHistogram h;
+  EXPECT_EQ(0u, h.get_count());
+  EXPECT_EQ(0u, h.get_mean());
+  EXPECT_EQ(0u, h.get_min());
+  EXPECT_EQ(0u, h.get_max());
+  EXPECT_EQ(0u, h.get_value_at_percentile(50.));
+
+  // 1us, 2us, ..., 1000us
+  for (uint64_t v = 1; v <= 1000; v++) h.record(v * 1000);
+  EXPECT_EQ(1000u, h.get_count());
+  EXPECT_EQ(500500u, h.get_mean());
+  auto expect_near = [](uint64_t expected, uint64_t v) {
+    EXPECT_LE(expected, v);
+    EXPECT_GE(expected + expected / 64, v);
+  };
+  expect_near(1000, h.get_min());
+  expect_near(1000000, h.get_max());
+  expect_near(500000, h.get_value_at_percentile(50.));
+  expect_near(990000, h.get_value_at_percentile(99.));
+  expect_near(999000, h.get_value_at_percentile(99.9));
+  expect_near(1000000, h.get_value_at_percentile(100.));
+  expect_near(1000, h.get_value_at_percentile(0.));
+
+  LatencyHistogram other;
+  other.record(5000000);
+  h += other;
+  EXPECT_EQ(1001u, h.get_count());
+  expect_near(5000000, h.get_max());
+  h -= other;
+  EXPECT_EQ(1000u, h.get_count());
+  expect_near(1000000, h.get_max());
+}
+
+TEST(LatencyStats, MergeThreads) {
+  LatencyStats stats({"a", "b"});
+  ASSERT_EQ(2u, stats.get_nb_stages());
+  EXPECT_EQ("b", stats.get_stage_name(1));
+
+  const size_t nb_threads = 4;
+  const uint64_t nb_values = 10000;
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < nb_threads; t++) {
+    threads.emplace_back([&stats, t, nb_values]() {
+      for (uint64_t v = 0; v < nb_values; v++) stats.record(0, 100 * (t + 1));
+      stats.record(1, 1000);
+    });
+  }
+  // concurrent reads are allowed
+  auto partial = stats.get_histograms();
+  EXPECT_LE(partial[0].get_count(), nb_threads * nb_values);
+  for (auto &thread : threads) thread.join();
+
+  auto histograms = stats.get_histograms();
+  ASSERT_EQ(2u, histograms.size());
+  EXPECT_EQ(nb_threads * nb_values, histograms[0].get_count());
+  EXPECT_EQ(250u, histograms[0].get_mean());
+  EXPECT_EQ(100u, histograms[0].get_min());
+  EXPECT_EQ(nb_threads, histograms[1].get_count());
+}
+
+TEST(LatencyStats, ResetAndDisable) {
+  LatencyStats stats({"a"});
+  stats.record(0, 1000);
+  stats.record(0, 2000);
+  EXPECT_EQ(2u, stats.get_histograms()[0].get_count());
+
+  stats.reset();
+  EXPECT_EQ(0u, stats.get_histograms()[0].get_count());
+  EXPECT_EQ(0u, stats.get_histograms()[0].get_max());
+  stats.record(0, 3000);
+  auto h = stats.get_histograms()[0];
+  EXPECT_EQ(1u, h.get_count());
+  EXPECT_EQ(3000u, h.get_mean());
+
+  EXPECT_TRUE(stats.is_enabled());
+  stats.set_enabled(false);
+  stats.record(0, 3000);
+  EXPECT_EQ(1u, stats.get_histograms()[0].get_count());
+  stats.set_enabled(true);
+  stats.record(0, 3000);
+  EXPECT_EQ(2u, stats.get_histograms()[0].get_count());
+}
+
+TEST(LatencyStats, SeveralInstances) {
+  // the per-thread cache must not mix up instances
+  LatencyStats stats_1({"a"});
+  LatencyStats stats_2({"a"});
+  stats_1.record(0, 10);
+  stats_2.record(0, 20);
+  stats_2.record(0, 20);
+  stats_1.record(0, 10);
+  EXPECT_EQ(2u, stats_1.get_histograms()[0].get_count());
+  EXPECT_EQ(10u, stats_1.get_histograms()[0].get_mean());
+  EXPECT_EQ(2u, stats_2.get_histograms()[0].get_count());
+  EXPECT_EQ(20u, stats_2.get_histograms()[0].get_mean());
+}
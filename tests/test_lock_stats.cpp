@@ -0,0 +1,140 @@
+/* Copyright 2013-present Barefoot Networks, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Antonin Bas (antonin@barefootnetworks.com)
+ *
+ */
+
+#include <gtest/gtest.h>
+
+#include <bm/bm_sim/lock_stats.h>
+
+#include <boost/thread/shared_mutex.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace bm;
+
+namespace {
+
+// InstrumentedMutex and InstrumentedSharedMutex are the plain mutex types
+// unless BMLOCKSTATS_ON is defined, so we use the wrapper directly
+using TestMutex = InstrumentedLockable<std::mutex>;
+using TestSharedMutex = InstrumentedLockable<boost::shared_mutex>;
+
+LockStats::Snapshot get_snapshot(const std::string &name) {
+  for (const auto &snapshot : LockStats::get_all())
+    if (snapshot.name == name) return snapshot;
+  return LockStats::Snapshot();
+}
+
+}  // namespace
+
+TEST(LockStats, Registry) {
+  {
+    TestMutex m1, m2;
+    m1.set_name("test_b");
+    m2.set_name("test_a");
+    std::vector<std::string> names;
+    for (const auto &snapshot : LockStats::get_all())
+      names.push_back(snapshot.name);
+    auto it_a = std::find(names.begin(), names.end(), "test_a");
+    auto it_b = std::find(names.begin(), names.end(), "test_b");
+    ASSERT_NE(names.end(), it_a);
+    ASSERT_NE(names.end(), it_b);
+    ASSERT_LT(it_a, it_b);  // sorted by name
+  }
+  EXPECT_TRUE(get_snapshot("test_a").name.empty());
+}
+
+TEST(LockStats, Exclusive) {
+  TestMutex m;
+  // not recorded until the lock is named
+  { std::unique_lock<TestMutex> lock(m); }
+  m.set_name("test_exclusive");
+  auto snapshot = get_snapshot("test_exclusive");
+  ASSERT_EQ(LockStats::NB_HISTOGRAMS, snapshot.histograms.size());
+  EXPECT_EQ(0u, snapshot.histograms[LockStats::WRITE_WAIT].get_count());
+
+  { std::unique_lock<TestMutex> lock(m); }
+  snapshot = get_snapshot("test_exclusive");
+  EXPECT_EQ(1u, snapshot.histograms[LockStats::WRITE_WAIT].get_count());
+  EXPECT_EQ(0u, snapshot.histograms[LockStats::WRITE_WAIT].get_max());
+  EXPECT_EQ(1u, snapshot.histograms[LockStats::WRITE_HOLD].get_count());
+  EXPECT_EQ(0u, snapshot.write_contended);
+
+  const auto hold = std::chrono::milliseconds(20);
+  std::thread t;
+  {
+    std::unique_lock<TestMutex> lock(m);
+    t = std::thread([&m]() { std::unique_lock<TestMutex> lock(m); });
+    std::this_thread::sleep_for(hold);
+  }
+  t.join();
+  snapshot = get_snapshot("test_exclusive");
+  const uint64_t hold_ns =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(hold).count();
+  EXPECT_EQ(3u, snapshot.histograms[LockStats::WRITE_HOLD].get_count());
+  EXPECT_GE(snapshot.histograms[LockStats::WRITE_HOLD].get_max(), hold_ns);
+  // the other thread may not have tried to acquire the lock before we release
+  // it, in theory
+  if (snapshot.write_contended == 1u) {
+    EXPECT_GT(snapshot.histograms[LockStats::WRITE_WAIT].get_max(), 0u);
+  }
+  EXPECT_EQ(0u, snapshot.read_contended);
+
+  LockStats::reset_all();
+  snapshot = get_snapshot("test_exclusive");
+  EXPECT_EQ(0u, snapshot.histograms[LockStats::WRITE_HOLD].get_count());
+  EXPECT_EQ(0u, snapshot.write_contended);
+}
+
+TEST(LockStats, Shared) {
+  TestSharedMutex m1, m2;
+  m1.set_name("test_shared_1");
+  m2.set_name("test_shared_2");
+
+  // holds are tracked per thread and per lock, including nested locks
+  {
+    boost::shared_lock<TestSharedMutex> lock1(m1);
+    boost::shared_lock<TestSharedMutex> lock2(m2);
+    boost::shared_lock<TestSharedMutex> lock3(m1);
+  }
+  auto snapshot_1 = get_snapshot("test_shared_1");
+  auto snapshot_2 = get_snapshot("test_shared_2");
+  EXPECT_EQ(2u, snapshot_1.histograms[LockStats::READ_WAIT].get_count());
+  EXPECT_EQ(2u, snapshot_1.histograms[LockStats::READ_HOLD].get_count());
+  EXPECT_EQ(1u, snapshot_2.histograms[LockStats::READ_HOLD].get_count());
+  EXPECT_EQ(0u, snapshot_1.histograms[LockStats::WRITE_WAIT].get_count());
+
+  // a reader has to wait for the writer
+  std::thread t;
+  {
+    boost::unique_lock<TestSharedMutex> lock(m1);
+    t = std::thread([&m1]() { boost::shared_lock<TestSharedMutex> lock(m1); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  }
+  t.join();
+  snapshot_1 = get_snapshot("test_shared_1");
+  EXPECT_EQ(3u, snapshot_1.histograms[LockStats::READ_HOLD].get_count());
+  EXPECT_EQ(1u, snapshot_1.histograms[LockStats::WRITE_HOLD].get_count());
+  EXPECT_LE(snapshot_1.read_contended, 1u);
+}
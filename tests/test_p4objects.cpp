@@ -1094,3 +1094,121 @@ TEST(P4Objects, InvalidReference) {
   ASSERT_NE(0, objects.init_objects(&is, &factory));
   EXPECT_EQ(expected_error_msg, os.str());
 }
+
+TEST(P4Objects, MigrateStateTables) {
+  LookupStructureFactory factory;
+  P4Objects old_objects, new_objects;
+  std::istringstream is_old(JSON_TEST_STRING_2), is_new(JSON_TEST_STRING_2);
+  ASSERT_EQ(0, old_objects.init_objects(&is_old, &factory));
+  ASSERT_EQ(0, new_objects.init_objects(&is_new, &factory));
+
+  const std::vector<MatchKeyParam> key = {
+    MatchKeyParam(MatchKeyParam::Type::EXACT,
+                  std::string("\x00\x00\x00\x01", 4))};
+  auto *old_table = dynamic_cast<MatchTable *>(
+      old_objects.get_abstract_match_table("ExactOne"));
+  ActionData action_data;
+  action_data.push_back_action_data(0xaabb);
+  entry_handle_t handle;
+  ASSERT_EQ(MatchErrorCode::SUCCESS, old_table->add_entry(
+      key, old_objects.get_action("ExactOne", "actionA"), action_data,
+      &handle));
+  ASSERT_EQ(MatchErrorCode::SUCCESS, old_table->write_counters(handle, 100, 2));
+
+  auto *old_indirect = dynamic_cast<MatchTableIndirect *>(
+      old_objects.get_abstract_match_table("Indirect"));
+  ActionProfile::mbr_hdl_t mbr;
+  ASSERT_EQ(MatchErrorCode::SUCCESS,
+            old_objects.get_action_profile("ActProf")->add_member(
+                old_objects.get_action_for_action_profile("ActProf", "actionB"),
+                action_data, &mbr));
+  entry_handle_t indirect_handle;
+  ASSERT_EQ(MatchErrorCode::SUCCESS,
+            old_indirect->add_entry(key, mbr, &indirect_handle));
+
+  auto stats = new_objects.migrate_state(old_objects);
+  EXPECT_EQ(9u, stats.tables);
+  EXPECT_EQ(2u, stats.action_profiles);
+  EXPECT_EQ(2u, stats.entries);
+  EXPECT_EQ(0u, stats.skipped_entries);
+
+  auto *new_table = dynamic_cast<MatchTable *>(
+      new_objects.get_abstract_match_table("ExactOne"));
+  auto entries = new_table->get_entries();
+  ASSERT_EQ(1u, entries.size());
+  EXPECT_EQ(new_objects.get_action("ExactOne", "actionA"),
+            entries[0].action_fn);
+  EXPECT_EQ(0xaabb, entries[0].action_data.get(0).get<int>());
+  Counter::counter_value_t bytes, packets;
+  ASSERT_EQ(MatchErrorCode::SUCCESS,
+            new_table->query_counters(entries[0].handle, &bytes, &packets));
+  EXPECT_EQ(100u, bytes);
+  EXPECT_EQ(2u, packets);
+
+  auto *new_indirect = dynamic_cast<MatchTableIndirect *>(
+      new_objects.get_abstract_match_table("Indirect"));
+  ASSERT_EQ(1u, new_indirect->get_num_entries());
+  ASSERT_EQ(1u, new_indirect->get_entries().size());
+
+  // packets processed by the old objects after the migration, and by the new
+  // objects after the swap
+  ASSERT_EQ(MatchErrorCode::SUCCESS, old_table->write_counters(handle, 150, 3));
+  ASSERT_EQ(MatchErrorCode::SUCCESS,
+            new_table->write_counters(entries[0].handle, 110, 3));
+  new_objects.migrate_packet_state(old_objects);
+  ASSERT_EQ(MatchErrorCode::SUCCESS,
+            new_table->query_counters(entries[0].handle, &bytes, &packets));
+  EXPECT_EQ(160u, bytes);
+  EXPECT_EQ(4u, packets);
+}
+
+TEST(P4Objects, MigrateStateStateful) {
+  fs::path config_path = fs::path(TESTDATADIR) / fs::path("runtime_iface.json");
+  LookupStructureFactory factory;
+  P4Objects old_objects, new_objects;
+  std::ifstream is_old(config_path.string()), is_new(config_path.string());
+  ASSERT_EQ(0, old_objects.init_objects(&is_old, &factory));
+  ASSERT_EQ(0, new_objects.init_objects(&is_new, &factory));
+
+  auto *old_counters = old_objects.get_counter_array("my_indirect_counter");
+  auto *old_registers = old_objects.get_register_array("my_register");
+  (*old_counters)[3].write_counter(64, 1);
+  (*old_registers)[3].set(7);
+  using rate_config_t = Meter::rate_config_t;
+  ASSERT_EQ(Meter::MeterErrorCode::SUCCESS,
+            old_objects.get_meter_array("my_indirect_meter")->get_meter(3)
+            .set_rates({rate_config_t::make(0.1, 10),
+                        rate_config_t::make(0.2, 20)}));
+
+  auto stats = new_objects.migrate_state(old_objects);
+  EXPECT_EQ(1u, stats.counter_arrays);
+  EXPECT_EQ(1u, stats.register_arrays);
+  EXPECT_EQ(1u, stats.meter_arrays);
+
+  auto *new_counters = new_objects.get_counter_array("my_indirect_counter");
+  auto *new_registers = new_objects.get_register_array("my_register");
+  Counter::counter_value_t bytes, packets;
+  (*new_counters)[3].query_counter(&bytes, &packets);
+  EXPECT_EQ(64u, bytes);
+  EXPECT_EQ(1u, packets);
+  EXPECT_EQ(7, (*new_registers)[3].get<int>());
+  auto rates = new_objects.get_meter_array("my_indirect_meter")->get_meter(3)
+      .get_rates();
+  ASSERT_EQ(2u, rates.size());
+  EXPECT_EQ(20u, rates[1].burst_size);
+
+  // packets processed by the old objects after the migration, and by the new
+  // objects after the swap
+  (*old_counters)[3].write_counter(128, 2);
+  (*old_registers)[3].set(9);
+  (*old_registers)[4].set(1);
+  (*new_counters)[3].write_counter(74, 2);
+  (*new_registers)[4].set(2);
+  new_objects.migrate_packet_state(old_objects);
+  (*new_counters)[3].query_counter(&bytes, &packets);
+  EXPECT_EQ(138u, bytes);
+  EXPECT_EQ(3u, packets);
+  EXPECT_EQ(9, (*new_registers)[3].get<int>());
+  // written by both, the new value wins
+  EXPECT_EQ(2, (*new_registers)[4].get<int>());
+}
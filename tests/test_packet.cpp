@@ -23,12 +23,38 @@
 #include <bm/bm_sim/packet.h>
 #include <bm/bm_sim/phv.h>
 #include <bm/bm_sim/phv_source.h>
+#include <bm/bm_sim/field_lists.h>
 
+#include <algorithm>
 #include <vector>
 #include <memory>
+#include <new>
+
+#include <cstdlib>
+#include <cstring>
 
 using namespace bm;
 
+namespace {
+
+// used to count the allocations made by the current thread in a given section
+thread_local bool count_allocations = false;
+thread_local size_t nb_allocations = 0;
+
+}  // namespace
+
+void *operator new(size_t size) {
+  if (count_allocations) nb_allocations++;
+  void *p = std::malloc(size == 0 ? 1 : size);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+
+// noinline prevents spurious -Wmismatched-new-delete warnings with recent gcc
+__attribute__((noinline)) void operator delete(void *p) noexcept {
+  std::free(p);
+}
+
 TEST(CopyIdGenerator, Test) {
   CopyIdGenerator gen;
   packet_id_t packet_id = 0;
@@ -209,3 +235,136 @@ TEST_F(PacketTest, CopyId) {
   auto packet_1_new = packet_0_new->clone_with_phv_ptr();
   ASSERT_EQ(1u, packet_1_new->get_copy_id());
 }
+
+// this is what simple_switch does for resubmit / recirculate
+TEST(PacketResetPHV, NoAllocation) {
+  const header_id_t meta_id = 0;
+  const header_id_t hdr_id = 1;
+  HeaderType meta_type("meta_t", 0);
+  meta_type.push_back_field("f16", 16);
+  meta_type.push_back_field("f32", 32);
+  HeaderType hdr_type("hdr_t", 1);
+  hdr_type.push_back_field("f8", 8);
+  PHVFactory phv_factory;
+  phv_factory.push_back_header("meta", meta_id, meta_type, true);
+  phv_factory.push_back_header("hdr", hdr_id, hdr_type);
+  auto phv_source = PHVSourceIface::make_phv_source(1);
+  phv_source->set_phv_factory(0, &phv_factory);
+
+  FieldList field_list;
+  field_list.push_back_field(meta_id, 0);
+
+  const std::vector<char> data(64, '\xab');
+  std::unique_ptr<Packet> packet(new Packet(Packet::make_new(
+      0, 0, 0, 0, data.size(),
+      PacketBuffer(data.size() + 512, data.data(), data.size()),
+      phv_source.get())));
+
+  auto process = [&packet]() {
+    PHV *phv = packet->get_phv();
+    phv->get_field(meta_id, 0).set(0xab);
+    phv->get_field(meta_id, 1).set(0xcd);
+    phv->get_header(hdr_id).mark_valid();
+    phv->get_field(hdr_id, 0).set(1);
+  };
+
+  // the first iterations fill the PHV pool
+  for (int i = 0; i < 2; i++) {
+    process();
+    packet->reset_phv(&field_list);
+  }
+
+  process();
+  const char *data_ptr = packet->data();
+  nb_allocations = 0;
+  count_allocations = true;
+  packet->reset_phv(&field_list);
+  count_allocations = false;
+  ASSERT_EQ(0u, nb_allocations);
+  ASSERT_EQ(data_ptr, packet->data());
+  ASSERT_EQ(data.size(), packet->get_data_size());
+  ASSERT_EQ(1u, phv_source->phvs_in_use(0));
+
+  PHV *phv = packet->get_phv();
+  ASSERT_EQ(0xabu, phv->get_field(meta_id, 0).get_uint());
+  ASSERT_EQ(0u, phv->get_field(meta_id, 1).get_uint());
+  ASSERT_FALSE(phv->get_header(hdr_id).is_valid());
+
+  packet->reset_phv();
+  ASSERT_EQ(0u, packet->get_phv()->get_field(meta_id, 0).get_uint());
+}
+
+namespace {
+
+struct ExternalMemory {
+  static void release(char *buffer, void *cookie) {
+    auto *mem = static_cast<ExternalMemory *>(cookie);
+    ASSERT_EQ(mem->data.data(), buffer);
+    mem->nb_releases++;
+  }
+
+  std::vector<char> data;
+  int nb_releases{0};
+};
+
+}  // namespace
+
+// this is how port managers hand over packets received in their own buffers
+TEST(PacketBufferTest, ExternalMemory) {
+  ExternalMemory mem;
+  const size_t headroom = 64;
+  const size_t data_size = 100;
+  mem.data.assign(headroom + data_size, '\x00');
+  std::fill(mem.data.begin() + headroom, mem.data.end(), '\xab');
+
+  {
+    PacketBuffer buffer(mem.data.data(), mem.data.size(), data_size,
+                        &ExternalMemory::release, &mem);
+    ASSERT_EQ(data_size, buffer.get_data_size());
+    ASSERT_EQ(mem.data.data() + headroom, buffer.start());
+    ASSERT_EQ(mem.data.data() + mem.data.size(), buffer.end());
+
+    // the headroom can be used to push new headers
+    char *new_start = buffer.push(headroom);
+    ASSERT_EQ(mem.data.data(), new_start);
+    buffer.pop(headroom);
+
+    // moving the buffer does not release the memory
+    PacketBuffer other(std::move(buffer));
+    ASSERT_EQ(0, mem.nb_releases);
+    ASSERT_EQ(mem.data.data() + headroom, other.start());
+
+    // clones own their memory
+    PacketBuffer clone = other.clone(data_size);
+    ASSERT_NE(mem.data.data() + headroom, clone.start());
+    ASSERT_EQ(0, std::memcmp(clone.start(), other.start(), data_size));
+  }
+  ASSERT_EQ(1, mem.nb_releases);
+
+  // a port backend can take back its own memory, e.g. to transmit it directly
+  {
+    PacketBuffer buffer(mem.data.data(), mem.data.size(), data_size,
+                        &ExternalMemory::release, &mem);
+    PacketBuffer heap_buffer(128, mem.data.data(), 16);
+    ASSERT_EQ(nullptr, heap_buffer.release_memory(&ExternalMemory::release,
+                                                  &mem));
+    ASSERT_EQ(nullptr, buffer.release_memory(&ExternalMemory::release,
+                                             nullptr));
+    ASSERT_EQ(mem.data.data(), buffer.release_memory(&ExternalMemory::release,
+                                                     &mem));
+    ASSERT_EQ(0u, buffer.get_data_size());
+  }
+  ASSERT_EQ(1, mem.nb_releases);
+
+  PHVFactory phv_factory;
+  auto phv_source = PHVSourceIface::make_phv_source(1);
+  phv_source->set_phv_factory(0, &phv_factory);
+  std::unique_ptr<Packet> packet(new Packet(Packet::make_new(
+      0, 0, 0, 0, data_size,
+      PacketBuffer(mem.data.data(), mem.data.size(), data_size,
+                   &ExternalMemory::release, &mem),
+      phv_source.get())));
+  ASSERT_EQ(mem.data.data() + headroom, packet->data());
+  packet.reset();
+  ASSERT_EQ(2, mem.nb_releases);
+}
@@ -0,0 +1,306 @@
+/* Copyright 2013-present Barefoot Networks, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Antonin Bas (antonin@barefootnetworks.com)
+ *
+ */
+
+#include <gtest/gtest.h>
+
+#include <bm/bm_sim/dev_mgr.h>
+
+#include <boost/filesystem.hpp>
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "pcap_capture.h"
+
+using namespace bm;
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+using Direction = PcapCapture::Direction;
+
+struct CapturedPacket {
+  uint32_t if_id;
+  uint32_t flags;
+  uint32_t len;
+  std::string data;
+};
+
+std::string read_file(const std::string &path) {
+  std::ifstream fs(path, std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(fs),
+                     std::istreambuf_iterator<char>());
+}
+
+template <typename T>
+T read_at(const std::string &s, size_t offset) {
+  T v;
+  std::memcpy(&v, s.data() + offset, sizeof(v));
+  return v;
+}
+
+// returns false if the file is not a valid (native byte order) pcap file
+bool parse_pcap(const std::string &path,
+                std::vector<CapturedPacket> *packets) {
+  auto s = read_file(path);
+  if (s.size() < 24 || read_at<uint32_t>(s, 0) != 0xa1b2c3d4) return false;
+  size_t offset = 24;
+  while (offset < s.size()) {
+    if (offset + 16 > s.size()) return false;
+    auto caplen = read_at<uint32_t>(s, offset + 8);
+    auto len = read_at<uint32_t>(s, offset + 12);
+    offset += 16;
+    if (offset + caplen > s.size()) return false;
+    packets->push_back({0, 0, len, s.substr(offset, caplen)});
+    offset += caplen;
+  }
+  return true;
+}
+
+// returns false if the file is not a valid (native byte order) pcapng file
+bool parse_pcapng(const std::string &path, std::vector<std::string> *ifaces,
+                  std::vector<CapturedPacket> *packets) {
+  auto s = read_file(path);
+  if (s.size() < 28 || read_at<uint32_t>(s, 0) != 0x0A0D0D0A ||
+      read_at<uint32_t>(s, 8) != 0x1A2B3C4D) {
+    return false;
+  }
+  size_t offset = 0;
+  while (offset < s.size()) {
+    if (offset + 12 > s.size()) return false;
+    auto type = read_at<uint32_t>(s, offset);
+    auto size = read_at<uint32_t>(s, offset + 4);
+    if (size < 12 || size % 4 != 0 || offset + size > s.size() ||
+        read_at<uint32_t>(s, offset + size - 4) != size) {
+      return false;
+    }
+    if (type == 1) {  // IDB, the if_name option comes first
+      std::string name;
+      if (read_at<uint16_t>(s, offset + 16) == 2) {
+        name = s.substr(offset + 20, read_at<uint16_t>(s, offset + 18));
+      }
+      ifaces->push_back(name);
+    } else if (type == 6) {  // EPB
+      auto if_id = read_at<uint32_t>(s, offset + 8);
+      auto caplen = read_at<uint32_t>(s, offset + 20);
+      auto len = read_at<uint32_t>(s, offset + 24);
+      size_t opt = offset + 28 + (caplen + 3) / 4 * 4;
+      if (if_id >= ifaces->size() || read_at<uint16_t>(s, opt) != 2)
+        return false;
+      packets->push_back({if_id, read_at<uint32_t>(s, opt + 4), len,
+                          s.substr(offset + 28, caplen)});
+    }
+    offset += size;
+  }
+  return true;
+}
+
+std::string make_packet(size_t size, int seq) {
+  return std::string(size, static_cast<char>(seq));
+}
+
+}  // namespace
+
+class PcapCaptureTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    dir = fs::temp_directory_path() / fs::unique_path();
+    fs::create_directories(dir);
+  }
+
+  void TearDown() override {
+    fs::remove_all(dir);
+  }
+
+  std::string path(const std::string &name) const {
+    return (dir / fs::path(name)).string();
+  }
+
+  fs::path dir;
+};
+
+TEST_F(PcapCaptureTest, Pcap) {
+  PcapCapture capture;
+  DevMgrIface::PortExtras extras = {
+    {DevMgrIface::kPortExtraInPcap, path("p1_in.pcap")},
+    {DevMgrIface::kPortExtraOutPcap, path("p1_out.pcap")}};
+  ASSERT_TRUE(PcapCapture::is_requested(extras));
+  ASSERT_FALSE(PcapCapture::is_requested({}));
+  ASSERT_TRUE(capture.port_add(1, "p1", extras));
+  ASSERT_FALSE(capture.port_add(1, "p1", extras));
+
+  for (int i = 0; i < 10; i++) {
+    auto packet = make_packet(64 + i, i);
+    capture.capture(1, Direction::IN, packet.data(), packet.size());
+    if (i % 2 == 0)
+      capture.capture(1, Direction::OUT, packet.data(), packet.size());
+    // not captured
+    capture.capture(2, Direction::IN, packet.data(), packet.size());
+  }
+  capture.flush();
+
+  std::vector<CapturedPacket> in_packets, out_packets;
+  ASSERT_TRUE(parse_pcap(path("p1_in.pcap"), &in_packets));
+  ASSERT_TRUE(parse_pcap(path("p1_out.pcap"), &out_packets));
+  ASSERT_EQ(10u, in_packets.size());
+  ASSERT_EQ(5u, out_packets.size());
+  for (int i = 0; i < 10; i++) {
+    EXPECT_EQ(make_packet(64 + i, i), in_packets[i].data);
+    EXPECT_EQ(64u + i, in_packets[i].len);
+  }
+  for (int i = 0; i < 5; i++) {
+    EXPECT_EQ(make_packet(64 + 2 * i, 2 * i), out_packets[i].data);
+  }
+  EXPECT_EQ(0u, capture.get_drops());
+
+  // packets captured before port_remove are written, the others are ignored
+  auto packet = make_packet(100, 0);
+  capture.capture(1, Direction::IN, packet.data(), packet.size());
+  capture.port_remove(1);
+  capture.capture(1, Direction::IN, packet.data(), packet.size());
+  capture.flush();
+  in_packets.clear();
+  ASSERT_TRUE(parse_pcap(path("p1_in.pcap"), &in_packets));
+  EXPECT_EQ(11u, in_packets.size());
+}
+
+TEST_F(PcapCaptureTest, Pcapng) {
+  PcapCapture capture;
+  // both ports and both directions in the same file
+  DevMgrIface::PortExtras extras = {
+    {DevMgrIface::kPortExtraInPcap, path("capture.pcapng")},
+    {DevMgrIface::kPortExtraOutPcap, path("capture.pcapng")}};
+  ASSERT_TRUE(capture.port_add(3, "veth3", extras));
+  ASSERT_TRUE(capture.port_add(7, "veth7", extras));
+
+  auto packet = make_packet(61, 1);  // not a multiple of 4
+  capture.capture(3, Direction::IN, packet.data(), packet.size());
+  capture.capture(7, Direction::OUT, packet.data(), packet.size());
+  capture.capture(7, Direction::IN, packet.data(), packet.size());
+  capture.flush();
+
+  std::vector<std::string> ifaces;
+  std::vector<CapturedPacket> packets;
+  ASSERT_TRUE(parse_pcapng(path("capture.pcapng"), &ifaces, &packets));
+  ASSERT_EQ(2u, ifaces.size());
+  EXPECT_EQ("veth3", ifaces[0]);
+  EXPECT_EQ("veth7", ifaces[1]);
+  ASSERT_EQ(3u, packets.size());
+  EXPECT_EQ(0u, packets[0].if_id);
+  EXPECT_EQ(1u, packets[0].flags);  // inbound
+  EXPECT_EQ(1u, packets[1].if_id);
+  EXPECT_EQ(2u, packets[1].flags);  // outbound
+  EXPECT_EQ(1u, packets[2].if_id);
+  EXPECT_EQ(1u, packets[2].flags);
+  for (const auto &p : packets) EXPECT_EQ(packet, p.data);
+
+  // the file stays open as long as one of the ports is captured
+  capture.port_remove(3);
+  capture.capture(7, Direction::IN, packet.data(), packet.size());
+  capture.flush();
+  ifaces.clear();
+  packets.clear();
+  ASSERT_TRUE(parse_pcapng(path("capture.pcapng"), &ifaces, &packets));
+  EXPECT_EQ(4u, packets.size());
+}
+
+TEST_F(PcapCaptureTest, RotateSize) {
+  PcapCapture capture;
+  // room for 4 packets of 1000 bytes per file
+  DevMgrIface::PortExtras extras = {
+    {DevMgrIface::kPortExtraInPcap, path("p1_in.pcap")},
+    {DevMgrIface::kPortExtraPcapRotateSize, "4100"}};
+  ASSERT_TRUE(capture.port_add(1, "p1", extras));
+  for (int i = 0; i < 10; i++) {
+    auto packet = make_packet(1000, i);
+    capture.capture(1, Direction::IN, packet.data(), packet.size());
+  }
+  capture.flush();
+
+  const char *names[3] = {"p1_in.pcap", "p1_in.1.pcap", "p1_in.2.pcap"};
+  const size_t counts[3] = {4, 4, 2};
+  int seq = 0;
+  for (int i = 0; i < 3; i++) {
+    std::vector<CapturedPacket> packets;
+    ASSERT_TRUE(parse_pcap(path(names[i]), &packets));
+    ASSERT_EQ(counts[i], packets.size());
+    for (const auto &p : packets) EXPECT_EQ(make_packet(1000, seq++), p.data);
+  }
+  EXPECT_FALSE(fs::exists(path("p1_in.3.pcap")));
+}
+
+TEST_F(PcapCaptureTest, InvalidExtras) {
+  PcapCapture capture;
+  EXPECT_FALSE(capture.port_add(
+      1, "p1", {{DevMgrIface::kPortExtraInPcap, path("p1_in.pcap")},
+                {DevMgrIface::kPortExtraPcapRotateSize, "abc"}}));
+  EXPECT_FALSE(capture.port_add(
+      2, "p2", {{DevMgrIface::kPortExtraInPcap,
+                 path("does_not_exist/p2_in.pcap")}}));
+  EXPECT_FALSE(capture.port_add(
+      PcapCapture::kMaxPorts, "p3",
+      {{DevMgrIface::kPortExtraInPcap, path("p3_in.pcap")}}));
+}
+
+// every packet is either written or counted as a drop, even when the ring is
+// too small to keep up with the producers
+TEST_F(PcapCaptureTest, ConcurrentProducers) {
+  const int nb_threads = 4;
+  const int nb_packets = 2000;
+  for (size_t ring_size : {PcapCapture::kDefaultRingSize, size_t(0)}) {
+    PcapCapture capture(ring_size);
+    DevMgrIface::PortExtras extras = {
+      {DevMgrIface::kPortExtraInPcap, path("in.pcap")},
+      {DevMgrIface::kPortExtraOutPcap, path("out.pcap")}};
+    ASSERT_TRUE(capture.port_add(1, "p1", extras));
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < nb_threads; t++) {
+      threads.emplace_back([&capture, t, nb_packets]() {
+        auto dir = (t % 2 == 0) ? Direction::IN : Direction::OUT;
+        for (int i = 0; i < nb_packets; i++) {
+          auto packet = make_packet(64 + (i * 37) % 1400, t);
+          capture.capture(1, dir, packet.data(), packet.size());
+        }
+      });
+    }
+    for (auto &thread : threads) thread.join();
+    capture.flush();
+
+    std::vector<CapturedPacket> packets;
+    ASSERT_TRUE(parse_pcap(path("in.pcap"), &packets));
+    ASSERT_TRUE(parse_pcap(path("out.pcap"), &packets));
+    for (const auto &p : packets) {
+      ASSERT_EQ(p.len, p.data.size());
+      ASSERT_EQ(std::string(p.len, p.data[0]), p.data);
+    }
+    EXPECT_EQ(static_cast<uint64_t>(nb_threads * nb_packets),
+              packets.size() + capture.get_drops());
+    if (ring_size == PcapCapture::kDefaultRingSize) {
+      EXPECT_EQ(0u, capture.get_drops());
+    }
+  }
+}
@@ -0,0 +1,289 @@
+/* Copyright 2013-present Barefoot Networks, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Antonin Bas (antonin@barefootnetworks.com)
+ *
+ */
+
+#include <gtest/gtest.h>
+
+#include <bm/bm_sim/pcap_replay.h>
+
+#include <boost/filesystem.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace bm;
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+using Mode = PcapReplay::Mode;
+
+// (timestamp in ns, packet data)
+using PcapRecords = std::vector<std::pair<uint64_t, std::string> >;
+
+uint32_t bswap(uint32_t v, bool swap) {
+  if (!swap) return v;
+  return ((v & 0xff) << 24) | ((v & 0xff00) << 8) |
+      ((v >> 8) & 0xff00) | (v >> 24);
+}
+
+void write_u32(std::ofstream *fs, uint32_t v, bool swap) {
+  v = bswap(v, swap);
+  fs->write(reinterpret_cast<const char *>(&v), sizeof(v));
+}
+
+void write_u16(std::ofstream *fs, uint16_t v, bool swap) {
+  if (swap) v = static_cast<uint16_t>((v << 8) | (v >> 8));
+  fs->write(reinterpret_cast<const char *>(&v), sizeof(v));
+}
+
+void write_pcap(const std::string &path, const PcapRecords &records,
+                bool nanosecond = false, bool swap = false) {
+  std::ofstream fs(path, std::ios::binary);
+  write_u32(&fs, nanosecond ? 0xa1b23c4d : 0xa1b2c3d4, swap);
+  write_u16(&fs, 2, swap);
+  write_u16(&fs, 4, swap);
+  write_u32(&fs, 0, swap);
+  write_u32(&fs, 0, swap);
+  write_u32(&fs, 65535, swap);
+  write_u32(&fs, 1, swap);
+  for (const auto &r : records) {
+    write_u32(&fs, static_cast<uint32_t>(r.first / 1000000000), swap);
+    auto frac = r.first % 1000000000;
+    write_u32(&fs, static_cast<uint32_t>(nanosecond ? frac : frac / 1000),
+              swap);
+    write_u32(&fs, r.second.size(), swap);
+    write_u32(&fs, r.second.size(), swap);
+    fs.write(r.second.data(), r.second.size());
+  }
+}
+
+struct Received {
+  int port;
+  std::string data;
+};
+
+class Receiver {
+ public:
+  static void handler(int port_num, const char *buffer, int len,
+                      void *cookie) {
+    static_cast<Receiver *>(cookie)->packets.push_back(
+        {port_num, std::string(buffer, len)});
+  }
+
+  std::vector<Received> packets;
+};
+
+}  // namespace
+
+class PcapReplayTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    dir = fs::temp_directory_path() / fs::unique_path();
+    fs::create_directories(dir);
+  }
+
+  void TearDown() override {
+    fs::remove_all(dir);
+  }
+
+  std::string path(const std::string &name) const {
+    return (dir / fs::path(name)).string();
+  }
+
+  std::unique_ptr<PcapReplay> make_replay(const PcapReplay::Config &config) {
+    std::unique_ptr<PcapReplay> replay(new PcapReplay(config));
+    replay->set_packet_handler(&Receiver::handler, &receiver);
+    return replay;
+  }
+
+  fs::path dir;
+  Receiver receiver;
+};
+
+TEST_F(PcapReplayTest, InterleaveByTimestamp) {
+  write_pcap(path("a.pcap"), {{1000, "a1"}, {4000, "a2"}, {5000, "a3"}});
+  write_pcap(path("b.pcap"), {{2000, "b1"}, {3000, "b2"}, {6000, "b3"}});
+  auto replay = make_replay(PcapReplay::Config());
+  ASSERT_TRUE(replay->add_file(1, path("a.pcap")));
+  ASSERT_TRUE(replay->add_file(2, path("b.pcap")));
+  replay->run();
+
+  const std::vector<std::pair<int, std::string> > expected = {
+    {1, "a1"}, {2, "b1"}, {2, "b2"}, {1, "a2"}, {1, "a3"}, {2, "b3"}};
+  ASSERT_EQ(expected.size(), receiver.packets.size());
+  for (size_t i = 0; i < expected.size(); i++) {
+    EXPECT_EQ(expected[i].first, receiver.packets[i].port);
+    EXPECT_EQ(expected[i].second, receiver.packets[i].data);
+  }
+  auto stats = replay->get_stats();
+  EXPECT_EQ(6u, stats.packets);
+  EXPECT_EQ(12u, stats.bytes);
+}
+
+TEST_F(PcapReplayTest, FileFormats) {
+  // nanosecond resolution, in both byte orders
+  write_pcap(path("ns.pcap"), {{1001, "x1"}, {1003, "x3"}}, true, false);
+  write_pcap(path("ns_swapped.pcap"), {{1002, "y2"}}, true, true);
+  write_pcap(path("us_swapped.pcap"), {{0, "z0"}}, false, true);
+  auto replay = make_replay(PcapReplay::Config());
+  ASSERT_TRUE(replay->add_file(0, path("ns.pcap")));
+  ASSERT_TRUE(replay->add_file(1, path("ns_swapped.pcap")));
+  ASSERT_TRUE(replay->add_file(2, path("us_swapped.pcap")));
+  replay->run();
+  ASSERT_EQ(4u, receiver.packets.size());
+  EXPECT_EQ("z0", receiver.packets[0].data);
+  EXPECT_EQ("x1", receiver.packets[1].data);
+  EXPECT_EQ("y2", receiver.packets[2].data);
+  EXPECT_EQ("x3", receiver.packets[3].data);
+}
+
+TEST_F(PcapReplayTest, InvalidFiles) {
+  PcapReplay replay{PcapReplay::Config()};
+  EXPECT_FALSE(replay.add_file(0, path("does_not_exist.pcap")));
+  {
+    std::ofstream fs(path("bad.pcap"), std::ios::binary);
+    fs << std::string(64, 'x');
+  }
+  EXPECT_FALSE(replay.add_file(0, path("bad.pcap")));
+
+  // the packets before the truncated one are replayed
+  write_pcap(path("truncated.pcap"), {{0, "p1"}, {1, "p2"}, {2, "p3"}});
+  fs::resize_file(path("truncated.pcap"),
+                  fs::file_size(path("truncated.pcap")) - 1);
+  auto r = make_replay(PcapReplay::Config());
+  ASSERT_TRUE(r->add_file(0, path("truncated.pcap")));
+  r->run();
+  EXPECT_EQ(2u, receiver.packets.size());
+}
+
+TEST_F(PcapReplayTest, Loops) {
+  write_pcap(path("a.pcap"), {{0, "a1"}, {1000, "a2"}});
+  PcapReplay::Config config;
+  config.loops = 3;
+  auto replay = make_replay(config);
+  ASSERT_TRUE(replay->add_file(0, path("a.pcap")));
+  replay->run();
+  ASSERT_EQ(6u, receiver.packets.size());
+  for (size_t i = 0; i < receiver.packets.size(); i++)
+    EXPECT_EQ((i % 2 == 0) ? "a1" : "a2", receiver.packets[i].data);
+}
+
+TEST_F(PcapReplayTest, Stop) {
+  write_pcap(path("a.pcap"), {{0, "a1"}});
+  PcapReplay::Config config;
+  config.mode = Mode::PPS;
+  config.rate = 1000;
+  config.loops = 0;  // forever
+  PcapReplay replay(config);
+  std::atomic<int> count{0};
+  replay.set_packet_handler(
+      [&count](int, const char *, int, void *) { count++; }, nullptr);
+  ASSERT_TRUE(replay.add_file(0, path("a.pcap")));
+  std::thread thread(&PcapReplay::run, &replay);
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  replay.stop();
+  thread.join();
+  EXPECT_GT(count, 0);
+  EXPECT_EQ(static_cast<uint64_t>(count), replay.get_stats().packets);
+}
+
+#ifndef SKIP_UNDETERMINISTIC_TESTS
+
+TEST_F(PcapReplayTest, RatePps) {
+  PcapRecords records;
+  for (int i = 0; i < 200; i++) records.emplace_back(0, std::string(64, 'a'));
+  write_pcap(path("a.pcap"), records);
+  PcapReplay::Config config;
+  config.mode = Mode::PPS;
+  config.rate = 20000;
+  auto replay = make_replay(config);
+  ASSERT_TRUE(replay->add_file(0, path("a.pcap")));
+  auto start = std::chrono::steady_clock::now();
+  replay->run();
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  ASSERT_EQ(200u, receiver.packets.size());
+  // the last packet is sent 199 * 50us after the first one
+  EXPECT_GE(elapsed, std::chrono::microseconds(9950));
+  EXPECT_LT(elapsed, std::chrono::milliseconds(500));
+}
+
+TEST_F(PcapReplayTest, RateBps) {
+  PcapRecords records;
+  for (int i = 0; i < 100; i++) records.emplace_back(0, std::string(125, 'a'));
+  write_pcap(path("a.pcap"), records);
+  PcapReplay::Config config;
+  config.mode = Mode::BPS;
+  config.rate = 10000000;  // 10Mbps, i.e. 100us per packet of 1000 bits
+  auto replay = make_replay(config);
+  ASSERT_TRUE(replay->add_file(0, path("a.pcap")));
+  auto start = std::chrono::steady_clock::now();
+  replay->run();
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  ASSERT_EQ(100u, receiver.packets.size());
+  EXPECT_GE(elapsed, std::chrono::microseconds(9900));
+  EXPECT_LT(elapsed, std::chrono::milliseconds(500));
+}
+
+TEST_F(PcapReplayTest, Timed) {
+  // 2 loops of 3 packets spaced by 5ms
+  write_pcap(path("a.pcap"), {{1000000000, "a1"}, {1005000000, "a2"},
+                              {1010000000, "a3"}});
+  PcapReplay::Config config;
+  config.mode = Mode::TIMED;
+  config.loops = 2;
+  auto replay = make_replay(config);
+  ASSERT_TRUE(replay->add_file(0, path("a.pcap")));
+  auto start = std::chrono::steady_clock::now();
+  replay->run();
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  ASSERT_EQ(6u, receiver.packets.size());
+  EXPECT_GE(elapsed, std::chrono::milliseconds(20));
+  EXPECT_LT(elapsed, std::chrono::milliseconds(500));
+}
+
+#endif  // SKIP_UNDETERMINISTIC_TESTS
+
+TEST(PcapReplayParseRate, ParseRate) {
+  PcapReplay::Config config;
+  ASSERT_TRUE(PcapReplay::parse_rate("fast", &config));
+  EXPECT_EQ(Mode::FAST, config.mode);
+  ASSERT_TRUE(PcapReplay::parse_rate("timed", &config));
+  EXPECT_EQ(Mode::TIMED, config.mode);
+  ASSERT_TRUE(PcapReplay::parse_rate("1500pps", &config));
+  EXPECT_EQ(Mode::PPS, config.mode);
+  EXPECT_EQ(1500u, config.rate);
+  ASSERT_TRUE(PcapReplay::parse_rate("10Gbps", &config));
+  EXPECT_EQ(Mode::BPS, config.mode);
+  EXPECT_EQ(10000000000u, config.rate);
+  ASSERT_TRUE(PcapReplay::parse_rate("2kpps", &config));
+  EXPECT_EQ(2000u, config.rate);
+  for (const char *spec : {"", "pps", "kpps", "0pps", "-1pps", "10Xbps",
+                           "10 pps", "slow"}) {
+    EXPECT_FALSE(PcapReplay::parse_rate(spec, &config)) << spec;
+  }
+}
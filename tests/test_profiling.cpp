@@ -0,0 +1,151 @@
+/* Copyright 2013-present Barefoot Networks, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Antonin Bas (antonin@barefootnetworks.com)
+ *
+ */
+
+#include <gtest/gtest.h>
+
+#include <bm/bm_sim/profiling.h>
+#include <bm/bm_sim/tables.h>
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace bm;
+
+TEST(ProfilingCounters, Threads) {
+  ProfilingCounters counters(3);
+  EXPECT_EQ(std::vector<uint64_t>({0, 0, 0}), counters.get());
+
+  const size_t nb_threads = 4;
+  const uint64_t nb_iterations = 10000;
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < nb_threads; t++) {
+    threads.emplace_back([&counters, t, nb_iterations]() {
+      for (uint64_t i = 0; i < nb_iterations; i++) {
+        counters.add(0, 1);
+        counters.add(2, t);
+      }
+    });
+  }
+  // concurrent reads are allowed
+  EXPECT_LE(counters.get()[0], nb_threads * nb_iterations);
+  for (auto &thread : threads) thread.join();
+
+  EXPECT_EQ(std::vector<uint64_t>({nb_threads * nb_iterations, 0,
+                                   6 * nb_iterations}),
+            counters.get());
+
+  counters.reset();
+  EXPECT_EQ(std::vector<uint64_t>({0, 0, 0}), counters.get());
+  counters.add(1, 7);
+  EXPECT_EQ(std::vector<uint64_t>({0, 7, 0}), counters.get());
+}
+
+TEST(ProfilingCounters, Sample) {
+  const size_t nb_calls = 64000;
+  size_t nb_samples = 0;
+  for (size_t i = 0; i < nb_calls; i++)
+    if (ProfilingCounters::sample()) nb_samples++;
+  auto expected = nb_calls / ProfilingCounters::kSamplingPeriod;
+  EXPECT_GT(nb_samples, expected / 2);
+  EXPECT_LT(nb_samples, expected * 2);
+}
+
+class TableProfilingTest : public ::testing::Test {
+ protected:
+  TableProfilingTest()
+      : test_header_type("test_t", 0),
+        action_fn("action", 0, 0),
+        phv_source(PHVSourceIface::make_phv_source()) {
+    test_header_type.push_back_field("f16", 16);
+    phv_factory.push_back_header("test", test_header, test_header_type);
+    key_builder.push_back_field(test_header, 0, 16,
+                                MatchKeyParam::Type::EXACT);
+    std::unique_ptr<MatchUnitExact<ActionEntry> > match_unit(
+        new MatchUnitExact<ActionEntry>(16, key_builder, &lookup_factory));
+    table = std::unique_ptr<MatchTable>(
+        new MatchTable("test_table", 0, std::move(match_unit)));
+    table->set_next_node(0, nullptr);
+  }
+
+  void SetUp() override {
+    phv_source->set_phv_factory(0, &phv_factory);
+  }
+
+  void TearDown() override {
+    ProfilingCounters::set_enabled(true);
+  }
+
+  void apply(const std::string &key, size_t times) {
+    for (size_t i = 0; i < times; i++) {
+      auto packet = Packet::make_new(64, PacketBuffer(128), phv_source.get());
+      packet.get_phv()->get_header(test_header).mark_valid();
+      packet.get_phv()->get_field(test_header, 0).set(key);
+      table->apply_action(&packet);
+    }
+  }
+
+  PHVFactory phv_factory{};
+  HeaderType test_header_type;
+  header_id_t test_header{0};
+  MatchKeyBuilder key_builder{};
+  LookupStructureFactory lookup_factory{};
+  ActionFn action_fn;
+  std::unique_ptr<PHVSourceIface> phv_source;
+  std::unique_ptr<MatchTable> table{nullptr};
+};
+
+TEST_F(TableProfilingTest, Counts) {
+  entry_handle_t handle;
+  ASSERT_EQ(MatchErrorCode::SUCCESS, table->add_entry(
+      {MatchKeyParam(MatchKeyParam::Type::EXACT, std::string("\x0a\xba", 2))},
+      &action_fn, ActionData(), &handle));
+
+  apply("0x0aba", 30);
+  apply("0x0abb", 10);
+  auto stats = table->get_profiling_stats();
+  EXPECT_EQ("test_table", stats.name);
+  EXPECT_EQ(40u, stats.lookups);
+  EXPECT_EQ(30u, stats.hits);
+  EXPECT_EQ(10u, stats.misses);
+  // the default action is empty and is not counted
+  EXPECT_EQ(30u, action_fn.get_profiling_stats().executions);
+
+  ProfilingCounters::set_enabled(false);
+  apply("0x0aba", 10);
+  EXPECT_EQ(40u, table->get_profiling_stats().lookups);
+  EXPECT_EQ(30u, action_fn.get_profiling_stats().executions);
+  ProfilingCounters::set_enabled(true);
+
+  table->reset_profiling_stats();
+  action_fn.reset_profiling_stats();
+  EXPECT_EQ(0u, table->get_profiling_stats().lookups);
+  EXPECT_EQ(0u, action_fn.get_profiling_stats().executions);
+
+  // enough lookups for some of them to be timed
+  apply("0x0aba", 2000);
+  stats = table->get_profiling_stats();
+  EXPECT_EQ(2000u, stats.lookups);
+  EXPECT_GT(stats.avg_lookup_ns, 0u);
+  auto action_stats = action_fn.get_profiling_stats();
+  EXPECT_EQ(2000u, action_stats.executions);
+  EXPECT_EQ(action_stats.avg_ns * 2000u, action_stats.total_ns);
+}
@@ -25,6 +25,7 @@
 #include <thread>
 #include <random>
 #include <tuple>
+#include <vector>
 
 using std::unique_ptr;
 
@@ -86,6 +87,24 @@ TEST_P(QueueTest, ProducerConsumer) {
 }
 
 
+TEST_P(QueueTest, ProducerConsumerBurst) {
+  thread producer_thread(producer, this);
+
+  std::vector<int> burst;
+  int i = 0;
+  while (i < iterations) {
+    burst.clear();
+    size_t n = queue->pop_back(&burst, 32);
+    ASSERT_EQ(n, burst.size());
+    ASSERT_LE(1u, n);
+    ASSERT_GE(32u, n);
+    for (int v : burst) ASSERT_EQ(values[i++], v);
+  }
+
+  producer_thread.join();
+}
+
+
 INSTANTIATE_TEST_CASE_P(TestParameters,
                         QueueTest,
                         Combine(Values(16, 1024, 20000),
@@ -215,6 +215,76 @@ TEST_F(QueueingRLTest, RateLimiter) {
   ASSERT_LT(elapsed, expected * 1.1);
 
   // TODO(antonin): better check of times vector?
+
+  // all elements but the first one were delayed by the rate limiter
+  auto stats = queue.get_rate_limiter_stats();
+  // if removed, g++ complains that iterations was not defined
+  const size_t n = iterations;
+  ASSERT_LE(n - 1, stats.count);
+  ASSERT_GE(n, stats.count);
+  uint64_t bucket_sum = 0;
+  for (auto c : stats.buckets) bucket_sum += c;
+  ASSERT_EQ(stats.count, bucket_sum);
+  ASSERT_LE(stats.total_late_ns, stats.max_late_ns * stats.count);
+
+  queue.reset_rate_limiter_stats();
+  ASSERT_EQ(0u, queue.get_rate_limiter_stats().count);
+}
+
+TEST(RateLimiterStats, Buckets) {
+  using std::chrono::nanoseconds;
+  using std::chrono::microseconds;
+  using std::chrono::milliseconds;
+  bm::RateLimiterStats stats;
+  stats.record(nanoseconds(500));
+  stats.record(microseconds(5));
+  stats.record(microseconds(50));
+  stats.record(microseconds(500));
+  stats.record(milliseconds(5));
+  stats.record(milliseconds(50));
+  stats.record(milliseconds(500));
+  stats.record(nanoseconds(-10));
+  ASSERT_EQ(8u, stats.count);
+  std::array<uint64_t, bm::RateLimiterStats::nb_buckets> expected{
+    {2, 1, 1, 1, 1, 2}};
+  ASSERT_EQ(expected, stats.buckets);
+  ASSERT_EQ(500000000u, stats.max_late_ns);
+
+  bm::RateLimiterStats other;
+  other.record(milliseconds(600));
+  stats += other;
+  ASSERT_EQ(9u, stats.count);
+  ASSERT_EQ(600000000u, stats.max_late_ns);
+  ASSERT_EQ(3u, stats.buckets.back());
+}
+
+TEST(QueueingPriRL, StrictPriority) {
+  using T = std::unique_ptr<int>;
+  QueueingLogicPriRL<T, WorkerMapper> queue(2u, 1u, 64u, WorkerMapper(1u), 4u);
+  for (int i = 0; i < 10; i++) {
+    queue.push_front(0u, 3u, unique_ptr<int>(new int(i)));
+    queue.push_front(1u, 2u, unique_ptr<int>(new int(i)));
+  }
+  for (int i = 0; i < 10; i++)
+    queue.push_front(0u, 1u, unique_ptr<int>(new int(i)));
+  ASSERT_EQ(20u, queue.size(0u));
+  ASSERT_EQ(10u, queue.size(0u, 1u));
+  ASSERT_EQ(0u, queue.size(0u, 2u));
+  ASSERT_EQ(10u, queue.size(1u, 2u));
+
+  const size_t expected_priorities[] = {1u, 2u, 3u};
+  const size_t expected_queue_ids[] = {0u, 1u, 0u};
+  for (size_t j = 0; j < 3; j++) {
+    for (int i = 0; i < 10; i++) {
+      size_t queue_id, priority;
+      unique_ptr<int> v;
+      queue.pop_back(0u, &queue_id, &priority, &v);
+      ASSERT_EQ(expected_priorities[j], priority);
+      ASSERT_EQ(expected_queue_ids[j], queue_id);
+      ASSERT_EQ(i, *v);
+    }
+  }
+  ASSERT_EQ(0u, queue.size(0u));
 }
 
 struct RndInputPri {
@@ -328,3 +398,161 @@ TEST_F(QueueingPriRLTest, PriRateLimiter) {
 }
 
 #endif  // SKIP_UNDETERMINISTIC_TESTS
+
+class QueueingHierarchicalTest : public ::testing::Test {
+ protected:
+  using T = std::unique_ptr<int>;
+  using QueueingLogicHierarchical =
+      bm::QueueingLogicHierarchical<T, WorkerMapper>;
+  static constexpr size_t nb_queues = 2u;
+  static constexpr size_t nb_workers = 1u;
+  static constexpr size_t nb_priorities = 4u;
+  static constexpr size_t capacity = 1024u;
+  static constexpr size_t pkt_size = 1000u;
+  QueueingLogicHierarchical queue;
+
+  QueueingHierarchicalTest()
+      : queue(nb_queues, nb_workers, capacity, WorkerMapper(nb_workers),
+              nb_priorities) { }
+
+  void push(size_t queue_id, size_t priority, size_t n,
+            size_t bytes = pkt_size) {
+    for (size_t i = 0; i < n; i++) {
+      ASSERT_EQ(1, queue.push_front(queue_id, priority, bytes,
+                                    unique_ptr<int>(new int(i))));
+    }
+  }
+
+  // returns the number of elements served for each priority
+  std::vector<size_t> pop(size_t n, size_t expected_queue_id = 0u) {
+    std::vector<size_t> counts(nb_priorities, 0);
+    for (size_t i = 0; i < n; i++) {
+      size_t queue_id, priority;
+      unique_ptr<int> v;
+      queue.pop_back(0u, &queue_id, &priority, &v);
+      EXPECT_EQ(expected_queue_id, queue_id);
+      counts.at(priority)++;
+    }
+    return counts;
+  }
+};
+
+TEST_F(QueueingHierarchicalTest, StrictPriority) {
+  push(0u, 3u, 10u);
+  push(0u, 1u, 10u);
+  for (size_t i = 0; i < 20u; i++) {
+    size_t queue_id, priority;
+    unique_ptr<int> v;
+    queue.pop_back(0u, &queue_id, &priority, &v);
+    ASSERT_EQ((i < 10u) ? 1u : 3u, priority);
+    ASSERT_EQ(static_cast<int>(i % 10u), *v);
+  }
+}
+
+TEST_F(QueueingHierarchicalTest, Capacity) {
+  queue.set_capacity(0u, 1u, 4u);
+  push(0u, 1u, 4u);
+  ASSERT_EQ(0, queue.push_front(0u, 1u, pkt_size, unique_ptr<int>()));
+  ASSERT_EQ(4u, queue.size(0u, 1u));
+  ASSERT_EQ(4u, queue.size(0u));
+  ASSERT_EQ(0u, queue.size(0u, 0u));
+}
+
+TEST_F(QueueingHierarchicalTest, DRR) {
+  queue.set_weight(0u, 0u, 1u);
+  queue.set_weight(0u, 1u, 3u);
+  push(0u, 0u, 500u);
+  push(0u, 1u, 500u);
+  auto counts = pop(400u);
+  // 1500 vs 4500 bytes per round, with 1000-byte elements
+  ASSERT_NEAR(100u, counts[0], 2u);
+  ASSERT_NEAR(300u, counts[1], 2u);
+}
+
+TEST_F(QueueingHierarchicalTest, DRRLargeElements) {
+  // elements larger than the quantum still get served, in proportion to the
+  // weights
+  queue.set_weight(0u, 2u, 1u);
+  queue.set_weight(0u, 3u, 2u);
+  push(0u, 2u, 300u, 3000u);
+  push(0u, 3u, 300u, 3000u);
+  auto counts = pop(300u);
+  ASSERT_NEAR(100u, counts[2], 2u);
+  ASSERT_NEAR(200u, counts[3], 2u);
+}
+
+TEST_F(QueueingHierarchicalTest, StrictBeforeDRR) {
+  queue.set_weight(0u, 0u, 1u);
+  push(0u, 0u, 10u);
+  push(0u, 3u, 10u);
+  auto counts = pop(10u);
+  ASSERT_EQ(10u, counts[3]);
+}
+
+TEST_F(QueueingHierarchicalTest, RoundRobinLogicalQueues) {
+  push(0u, 0u, 10u);
+  push(1u, 0u, 10u);
+  for (size_t i = 0; i < 20u; i++) {
+    size_t queue_id;
+    unique_ptr<int> v;
+    queue.pop_back(0u, &queue_id, &v);
+    ASSERT_EQ(i % 2, queue_id);
+  }
+}
+
+TEST_F(QueueingHierarchicalTest, MaxRate) {
+  using std::chrono::duration_cast;
+  using std::chrono::milliseconds;
+  using clock = std::chrono::high_resolution_clock;
+
+  static constexpr size_t iterations = 200u;
+  // 1000 elements per second
+  queue.set_max_rate(0u, 0u, pkt_size * 8 * 1000, 0u);
+  push(0u, 0u, iterations);
+
+  auto start = clock::now();
+  pop(iterations);
+  auto elapsed = duration_cast<milliseconds>(clock::now() - start).count();
+
+  int expected = (iterations * 1000) / 1000;
+  ASSERT_GT(elapsed, expected * 0.9);
+  ASSERT_LT(elapsed, expected * 1.1);
+}
+
+TEST_F(QueueingHierarchicalTest, LogicalQueueMaxRate) {
+  using std::chrono::duration_cast;
+  using std::chrono::milliseconds;
+  using clock = std::chrono::high_resolution_clock;
+
+  static constexpr size_t iterations = 200u;
+  // 1000 elements per second, shared by all priorities
+  queue.set_max_rate(0u, pkt_size * 8 * 1000, 0u);
+  push(0u, 0u, iterations / 2);
+  push(0u, 1u, iterations / 2);
+
+  auto start = clock::now();
+  pop(iterations);
+  auto elapsed = duration_cast<milliseconds>(clock::now() - start).count();
+
+  int expected = (iterations * 1000) / 1000;
+  ASSERT_GT(elapsed, expected * 0.9);
+  ASSERT_LT(elapsed, expected * 1.1);
+}
+
+#ifndef SKIP_UNDETERMINISTIC_TESTS
+
+TEST_F(QueueingHierarchicalTest, MinRate) {
+  // the lowest priority queue is guaranteed 100 elements per second, even
+  // though the highest priority queue is always full and is served at 500
+  // elements per second
+  queue.set_max_rate(0u, pkt_size * 8 * 500, 0u);
+  queue.set_min_rate(0u, 3u, pkt_size * 8 * 100, 0u);
+  push(0u, 0u, 500u);
+  push(0u, 3u, 500u);
+  auto counts = pop(250u);
+  // 500ms of traffic
+  ASSERT_NEAR(50u, counts[3], 10u);
+  ASSERT_NEAR(200u, counts[0], 10u);
+}
+
+#endif  // SKIP_UNDETERMINISTIC_TESTS
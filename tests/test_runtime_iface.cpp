@@ -26,6 +26,7 @@
 #include <bm/bm_sim/switch.h>
 
 #include <string>
+#include <vector>
 
 using namespace::bm;
 
@@ -90,6 +91,27 @@ TEST_F(RuntimeIfaceTest, Counters) {
 
   rc = sw.reset_counters(cxt_id, good_name);
   ASSERT_EQ(ErrorCode::SUCCESS, rc);
+
+  std::vector<MatchTableAbstract::counter_value_t> all_bytes, all_packets;
+  rc = sw.write_counters(cxt_id, good_name, good_idx, 10, 1);
+  ASSERT_EQ(ErrorCode::SUCCESS, rc);
+  rc = sw.read_counters_range(cxt_id, good_name, good_idx, good_idx + 1,
+                              &all_bytes, &all_packets, true);
+  ASSERT_EQ(ErrorCode::SUCCESS, rc);
+  ASSERT_EQ(std::vector<MatchTableAbstract::counter_value_t>({10}),
+            all_bytes);
+  rc = sw.read_all_counters(cxt_id, good_name, &all_bytes, &all_packets,
+                            false);
+  ASSERT_EQ(ErrorCode::SUCCESS, rc);
+  ASSERT_LT(good_idx, all_bytes.size());
+  ASSERT_EQ(0u, all_bytes[good_idx]);
+  ASSERT_EQ(0u, all_packets[good_idx]);
+  rc = sw.read_all_counters(cxt_id, bad_name, &all_bytes, &all_packets,
+                            false);
+  ASSERT_EQ(ErrorCode::INVALID_COUNTER_NAME, rc);
+  rc = sw.read_counters_range(cxt_id, good_name, good_idx, bad_idx,
+                              &all_bytes, &all_packets, false);
+  ASSERT_EQ(ErrorCode::INVALID_INDEX, rc);
 }
 
 TEST_F(RuntimeIfaceTest, Meters) {
@@ -161,3 +183,118 @@ TEST_F(RuntimeIfaceTest, Registers) {
   rc = sw.register_reset(cxt_id, bad_name);
   ASSERT_EQ(ErrorCode::INVALID_REGISTER_NAME, rc);
 }
+
+TEST_F(RuntimeIfaceTest, WriteEntries) {
+  using MtWriteOp = RuntimeInterface::MtWriteOp;
+  MatchErrorCode rc;
+  size_t num_entries;
+
+  auto make_op = [](MtWriteOp::Type type, const std::string &table_name,
+                    const std::string &action_name, entry_handle_t handle) {
+    return MtWriteOp{type, table_name, {}, action_name, ActionData(), -1,
+                     handle, MatchErrorCode::SUCCESS};
+  };
+
+  std::vector<MtWriteOp> ops;
+  ops.push_back(make_op(MtWriteOp::Type::ADD, "m_table", "m_action", 0));
+  ops.push_back(make_op(MtWriteOp::Type::ADD, "bad_table", "m_action", 0));
+  ops.push_back(make_op(MtWriteOp::Type::ADD, "m_table", "bad_action", 0));
+  rc = sw.mt_write_entries(cxt_id, &ops, false);
+  ASSERT_EQ(MatchErrorCode::INVALID_TABLE_NAME, rc);
+  ASSERT_EQ(MatchErrorCode::SUCCESS, ops[0].status);
+  ASSERT_EQ(MatchErrorCode::INVALID_TABLE_NAME, ops[1].status);
+  ASSERT_EQ(MatchErrorCode::INVALID_ACTION_NAME, ops[2].status);
+  ASSERT_EQ(MatchErrorCode::SUCCESS,
+            sw.mt_get_num_entries(cxt_id, "m_table", &num_entries));
+  ASSERT_EQ(1u, num_entries);
+  auto handle = ops[0].handle;
+
+  // with atomic, nothing is applied if a name is invalid
+  ops.clear();
+  ops.push_back(make_op(MtWriteOp::Type::DELETE, "m_table", "", handle));
+  ops.push_back(make_op(MtWriteOp::Type::DELETE, "bad_table", "", handle));
+  rc = sw.mt_write_entries(cxt_id, &ops, true);
+  ASSERT_EQ(MatchErrorCode::INVALID_TABLE_NAME, rc);
+  ASSERT_EQ(MatchErrorCode::BATCH_ABORTED, ops[0].status);
+  ASSERT_EQ(MatchErrorCode::SUCCESS,
+            sw.mt_get_num_entries(cxt_id, "m_table", &num_entries));
+  ASSERT_EQ(1u, num_entries);
+
+  ops.pop_back();
+  rc = sw.mt_write_entries(cxt_id, &ops, true);
+  ASSERT_EQ(MatchErrorCode::SUCCESS, rc);
+  ASSERT_EQ(MatchErrorCode::SUCCESS,
+            sw.mt_get_num_entries(cxt_id, "m_table", &num_entries));
+  ASSERT_EQ(0u, num_entries);
+}
+
+TEST_F(RuntimeIfaceTest, GetEntriesChunks) {
+  MatchErrorCode rc;
+  entry_handle_t handle;
+  rc = sw.mt_add_entry(cxt_id, "m_table", {}, "m_action", ActionData(),
+                       &handle);
+  ASSERT_EQ(MatchErrorCode::SUCCESS, rc);
+
+  std::vector<MatchTable::Entry> entries;
+  size_t cursor = 0;
+  bool more = true;
+  rc = sw.mt_get_entries(cxt_id, "m_table", &cursor, 16, &entries, &more);
+  ASSERT_EQ(MatchErrorCode::SUCCESS, rc);
+  ASSERT_FALSE(more);
+  ASSERT_EQ(1u, entries.size());
+  ASSERT_EQ(handle, entries[0].handle);
+
+  rc = sw.mt_get_entries(cxt_id, "bad_table", &cursor, 16, &entries, &more);
+  ASSERT_EQ(MatchErrorCode::INVALID_TABLE_NAME, rc);
+  std::vector<MatchTableIndirect::Entry> indirect_entries;
+  rc = sw.mt_indirect_get_entries(cxt_id, "m_table", &cursor, 16,
+                                  &indirect_entries, &more);
+  ASSERT_EQ(MatchErrorCode::WRONG_TABLE_TYPE, rc);
+}
+
+TEST_F(RuntimeIfaceTest, Profiling) {
+  auto stats = sw.get_profiling_stats(cxt_id);
+  ASSERT_EQ(1u, stats.tables.size());
+  EXPECT_EQ("m_table", stats.tables[0].name);
+  EXPECT_EQ(0u, stats.tables[0].lookups);
+  ASSERT_EQ(1u, stats.actions.size());
+  EXPECT_EQ("m_action", stats.actions[0].name);
+  EXPECT_TRUE(stats.conditionals.empty());
+
+  sw.reset_profiling_stats(cxt_id);
+  sw.set_profiling_enabled(false);
+  EXPECT_FALSE(ProfilingCounters::is_enabled());
+  sw.set_profiling_enabled(true);
+  EXPECT_TRUE(ProfilingCounters::is_enabled());
+}
+
+TEST_F(RuntimeIfaceTest, LockStats) {
+  auto all_stats = sw.get_lock_stats();
+#ifdef BMLOCKSTATS_ON
+  auto find_stats = [&all_stats](const std::string &name) {
+    for (const auto &stats : all_stats)
+      if (stats.name == name) return &stats;
+    return static_cast<const LockStats::Snapshot *>(nullptr);
+  };
+  ASSERT_NE(nullptr, find_stats("switch_config"));
+
+  entry_handle_t handle;
+  ASSERT_EQ(MatchErrorCode::SUCCESS,
+            sw.mt_add_entry(cxt_id, "m_table", {}, "m_action", ActionData(),
+                            &handle));
+  all_stats = sw.get_lock_stats();
+  const auto *table_stats = find_stats("match_table:m_table");
+  ASSERT_NE(nullptr, table_stats);
+  EXPECT_LE(1u,
+            table_stats->histograms[LockStats::WRITE_HOLD].get_count());
+
+  sw.reset_lock_stats();
+  all_stats = sw.get_lock_stats();
+  table_stats = find_stats("match_table:m_table");
+  ASSERT_NE(nullptr, table_stats);
+  EXPECT_EQ(0u,
+            table_stats->histograms[LockStats::WRITE_HOLD].get_count());
+#else
+  EXPECT_TRUE(all_stats.empty());
+#endif
+}
@@ -65,6 +65,10 @@ class SwitchTest : public Switch {
   int deserialize(std::istream *in) {
     return Switch::deserialize(in);
   }
+
+  int deserialize_from_file(const std::string &state_dump_path) {
+    return Switch::deserialize_from_file(state_dump_path);
+  }
 };
 
 // dummy DevMgrIface implementation for testing
@@ -216,6 +220,198 @@ TEST(Switch, SerializeState2) {
   ASSERT_EQ(s1.str(), s2.str());
 }
 
+TEST(Switch, SnapshotState) {
+  fs::path config_path = fs::path(TESTDATADIR) / fs::path("serialize.json");
+  fs::path snapshot_path = fs::temp_directory_path() / fs::unique_path();
+  SwitchTest sw;
+  sw.init_objects(config_path.string(), 0, nullptr);
+  sw.mt_set_default_action(0, "send_frame", "_drop", ActionData());
+  sw.mt_set_default_action(0, "forward", "_drop", ActionData());
+  sw.mt_set_default_action(0, "ipv4_lpm", "_drop", ActionData());
+  entry_handle_t handle;
+  for (int i = 0; i < 3; i++) {
+    ActionData action_data;
+    action_data.push_back_action_data(Data("0x00aabb00000" +
+                                           std::to_string(i)));
+    const char port[2] = {0, static_cast<char>(i + 1)};
+    ASSERT_EQ(MatchErrorCode::SUCCESS, sw.mt_add_entry(
+        0, "send_frame",
+        {MatchKeyParam(MatchKeyParam::Type::EXACT, std::string(port, 2))},
+        "rewrite_mac", std::move(action_data), &handle));
+  }
+  // leave a hole in the handles
+  ASSERT_EQ(MatchErrorCode::SUCCESS,
+            sw.mt_delete_entry(0, "send_frame", handle - 1));
+  {
+    ActionData action_data;
+    action_data.push_back_action_data(Data("0x0a00000a"));
+    action_data.push_back_action_data(1);
+    ASSERT_EQ(MatchErrorCode::SUCCESS, sw.mt_add_entry(
+        0, "ipv4_lpm",
+        {MatchKeyParam(MatchKeyParam::Type::LPM,
+                       std::string("\x0a\x00\x00\x0a", 4), 24)},
+        "set_nhop", std::move(action_data), &handle));
+  }
+  using rate_config_t = Meter::rate_config_t;
+  ASSERT_EQ(MatchErrorCode::SUCCESS, sw.mt_set_meter_rates(
+      0, "ipv4_lpm", handle,
+      {rate_config_t::make(0.01, 5000), rate_config_t::make(0.1, 20000)}));
+  ASSERT_EQ(Meter::MeterErrorCode::SUCCESS, sw.meter_set_rates(
+      0, "port_meter", 8,
+      {rate_config_t::make(0.000002, 5), rate_config_t::make(0.00001, 25)}));
+  std::stringstream s1;
+  sw.serialize(&s1);
+
+  for (bool background : {false, true}) {
+    ASSERT_EQ(RuntimeInterface::ErrorCode::SUCCESS,
+              sw.snapshot_state(snapshot_path.string(), background));
+    while (sw.get_snapshot_status().in_progress)
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    auto status = sw.get_snapshot_status();
+    ASSERT_TRUE(status.success);
+    ASSERT_EQ(snapshot_path.string(), status.path);
+    ASSERT_EQ(fs::file_size(snapshot_path), status.bytes);
+
+    SwitchTest sw2;
+    sw2.init_objects(config_path.string(), 0, nullptr);
+    ASSERT_EQ(0, sw2.deserialize_from_file(snapshot_path.string()));
+    std::stringstream s2;
+    sw2.serialize(&s2);
+    ASSERT_EQ(s1.str(), s2.str());
+  }
+  fs::remove(snapshot_path);
+
+  ASSERT_EQ(RuntimeInterface::ErrorCode::SNAPSHOT_FILE_ERROR,
+            sw.snapshot_state("/nonexistent_dir/snapshot", false));
+  ASSERT_FALSE(sw.get_snapshot_status().success);
+}
+
+TEST(Switch, SwapMigrateState) {
+  fs::path config_path = fs::path(TESTDATADIR) / fs::path("serialize.json");
+  std::ifstream fs(config_path.string());
+  std::string config((std::istreambuf_iterator<char>(fs)),
+                     std::istreambuf_iterator<char>());
+  using rate_config_t = Meter::rate_config_t;
+  const std::vector<rate_config_t> port_rates = {
+    rate_config_t::make(0.000002, 5), rate_config_t::make(0.00001, 25)};
+  const std::vector<rate_config_t> entry_rates = {
+    rate_config_t::make(0.01, 5000), rate_config_t::make(0.1, 20000)};
+
+  SwitchTest sw;
+  sw.init_objects(config_path.string(), 0, nullptr);
+  sw.enable_config_swap();
+  sw.mt_set_default_action(0, "forward", "_drop", ActionData());
+  entry_handle_t handle;
+  ActionData action_data;
+  action_data.push_back_action_data(Data("0x0a00000a"));
+  action_data.push_back_action_data(1);
+  ASSERT_EQ(MatchErrorCode::SUCCESS, sw.mt_add_entry(
+      0, "ipv4_lpm",
+      {MatchKeyParam(MatchKeyParam::Type::LPM,
+                     std::string("\x0a\x00\x00\x0a", 4), 24)},
+      "set_nhop", std::move(action_data), &handle));
+  ASSERT_EQ(MatchErrorCode::SUCCESS,
+            sw.mt_set_meter_rates(0, "ipv4_lpm", handle, entry_rates));
+  ASSERT_EQ(Meter::MeterErrorCode::SUCCESS,
+            sw.meter_set_rates(0, "port_meter", 8, port_rates));
+
+  auto check_state = [&](bool migrated) {
+    size_t num_entries;
+    ASSERT_EQ(MatchErrorCode::SUCCESS,
+              sw.mt_get_num_entries(0, "ipv4_lpm", &num_entries));
+    MatchTable::Entry default_entry;
+    auto rc = sw.mt_get_default_entry(0, "forward", &default_entry);
+    std::vector<rate_config_t> rates;
+    ASSERT_EQ(Meter::MeterErrorCode::SUCCESS,
+              sw.meter_get_rates(0, "port_meter", 8, &rates));
+    if (!migrated) {
+      ASSERT_EQ(0u, num_entries);
+      ASSERT_NE(MatchErrorCode::SUCCESS, rc);
+      ASSERT_TRUE(rates.empty());
+      return;
+    }
+    ASSERT_EQ(1u, num_entries);
+    ASSERT_EQ(MatchErrorCode::SUCCESS, rc);
+    ASSERT_EQ("_drop", default_entry.action_fn->get_name());
+    auto entries = sw.mt_get_entries(0, "ipv4_lpm");
+    ASSERT_EQ(1u, entries.size());
+    ASSERT_EQ("set_nhop", entries[0].action_fn->get_name());
+    ASSERT_EQ(1, entries[0].action_data.get(1).get<int>());
+    ASSERT_EQ(24, entries[0].match_key.at(0).prefix_length);
+    ASSERT_EQ(MatchErrorCode::SUCCESS, sw.mt_get_meter_rates(
+        0, "ipv4_lpm", entries[0].handle, &rates));
+    ASSERT_EQ(entry_rates.size(), rates.size());
+    ASSERT_EQ(entry_rates[1].info_rate, rates[1].info_rate);
+    ASSERT_EQ(entry_rates[1].burst_size, rates[1].burst_size);
+    ASSERT_EQ(Meter::MeterErrorCode::SUCCESS,
+              sw.meter_get_rates(0, "port_meter", 8, &rates));
+    ASSERT_EQ(port_rates.size(), rates.size());
+    ASSERT_EQ(port_rates[0].info_rate, rates[0].info_rate);
+  };
+
+  const auto *old_pipeline = sw.get_pipeline("ingress");
+  sw.set_swap_mode(SwitchWContexts::SwapMode::MIGRATE_STATE);
+  ASSERT_EQ(RuntimeInterface::ErrorCode::SUCCESS, sw.load_new_config(config));
+  // the state is migrated when loading, the current config is not modified
+  check_state(true);
+  ASSERT_EQ(RuntimeInterface::ErrorCode::SUCCESS, sw.swap_configs());
+  ASSERT_NE(old_pipeline, sw.get_pipeline("ingress"));
+  check_state(true);
+
+  // default mode, everything is reset
+  sw.set_swap_mode(SwitchWContexts::SwapMode::RESET_STATE);
+  ASSERT_EQ(RuntimeInterface::ErrorCode::SUCCESS, sw.load_new_config(config));
+  ASSERT_EQ(RuntimeInterface::ErrorCode::SUCCESS, sw.swap_configs());
+  check_state(false);
+}
+
+TEST(Switch, SwapWithPacketsInFlight) {
+  fs::path config_path = fs::path(TESTDATADIR) / fs::path("serialize.json");
+  std::ifstream fs(config_path.string());
+  std::string config((std::istreambuf_iterator<char>(fs)),
+                     std::istreambuf_iterator<char>());
+  const char data[64] = {0};
+
+  SwitchTest sw;
+  sw.init_objects(config_path.string(), 0, nullptr);
+  sw.enable_config_swap();
+  auto old_packet = sw.new_packet_ptr(0, 0, sizeof(data),
+                                      PacketBuffer(256, data, sizeof(data)));
+  const auto *old_pipeline = sw.get_pipeline("ingress");
+  ASSERT_EQ(old_pipeline, sw.get_pipeline(*old_packet, "ingress"));
+
+  ASSERT_EQ(RuntimeInterface::ErrorCode::SUCCESS, sw.load_new_config(config));
+  // does not wait for old_packet to be destroyed
+  ASSERT_EQ(RuntimeInterface::ErrorCode::SUCCESS, sw.swap_configs());
+  auto new_packet = sw.new_packet_ptr(0, 1, sizeof(data),
+                                      PacketBuffer(256, data, sizeof(data)));
+  const auto *new_pipeline = sw.get_pipeline("ingress");
+  ASSERT_NE(old_pipeline, new_pipeline);
+  ASSERT_EQ(new_pipeline, sw.get_pipeline(*new_packet, "ingress"));
+  ASSERT_NE(old_packet->get_phv()->get_factory(),
+            new_packet->get_phv()->get_factory());
+
+  // the old packet and its clones keep using the old configuration
+  ASSERT_EQ(old_pipeline, sw.get_pipeline(*old_packet, "ingress"));
+  auto clone = old_packet->clone_with_phv_ptr();
+  ASSERT_EQ(old_pipeline, sw.get_pipeline(*clone, "ingress"));
+  ASSERT_EQ(old_packet->get_phv()->get_factory(),
+            clone->get_phv()->get_factory());
+  for (auto *packet : {old_packet.get(), clone.get(), new_packet.get()}) {
+    sw.get_parser(*packet, "parser")->parse(packet);
+    sw.get_pipeline(*packet, "ingress")->apply(packet);
+    sw.get_deparser(*packet, "deparser")->deparse(packet);
+  }
+  clone.reset();
+  old_packet.reset();
+
+  // back to back swaps, the first configuration is retired before the second
+  ASSERT_EQ(RuntimeInterface::ErrorCode::SUCCESS, sw.load_new_config(config));
+  ASSERT_EQ(RuntimeInterface::ErrorCode::SUCCESS, sw.swap_configs());
+  ASSERT_EQ(new_pipeline, sw.get_pipeline(*new_packet, "ingress"));
+  ASSERT_NE(new_pipeline, sw.get_pipeline("ingress"));
+}
+
 // TODO(antonin): unify the code for these three test cases?
 TEST(Switch, ForceArithNone) {
   fs::path config_path = fs::path(TESTDATADIR) / fs::path("one_header.json");
@@ -707,6 +707,21 @@ TYPED_TEST(TableSizeTwo, Counters) {
   ASSERT_EQ(rc, MatchErrorCode::SUCCESS);
   ASSERT_EQ(64u, counter_bytes);
   ASSERT_EQ(1u, counter_packets);
+
+  std::vector<entry_handle_t> handles;
+  std::vector<uint64_t> all_bytes, all_packets;
+  rc = this->table->query_all_counters(&handles, &all_bytes, &all_packets,
+                                       true);
+  ASSERT_EQ(rc, MatchErrorCode::SUCCESS);
+  ASSERT_EQ(std::vector<entry_handle_t>({handle}), handles);
+  ASSERT_EQ(std::vector<uint64_t>({64u}), all_bytes);
+  ASSERT_EQ(std::vector<uint64_t>({1u}), all_packets);
+
+  // cleared by the previous read
+  rc = this->table->query_counters(handle, &counter_bytes, &counter_packets);
+  ASSERT_EQ(rc, MatchErrorCode::SUCCESS);
+  ASSERT_EQ(0u, counter_bytes);
+  ASSERT_EQ(0u, counter_packets);
 }
 
 TYPED_TEST(TableSizeTwo, CountersReset) {
@@ -990,6 +1005,46 @@ TYPED_TEST(TableSizeTwo, GetEntries) {
   }
 }
 
+TYPED_TEST(TableSizeTwo, GetEntriesChunks) {
+  MatchErrorCode rc;
+  entry_handle_t handle_1, handle_2, handle_3;
+  std::string key_1("\xaa\xaa");
+  std::string key_2("\xbb\xbb");
+  std::string key_3("\xcc\xcc");
+
+  rc = this->add_entry(key_1, &handle_1);
+  ASSERT_EQ(MatchErrorCode::SUCCESS, rc);
+  rc = this->add_entry(key_2, &handle_2);
+  ASSERT_EQ(MatchErrorCode::SUCCESS, rc);
+
+  std::vector<MatchTable::Entry> entries;
+  size_t cursor = 0;
+  ASSERT_TRUE(this->table->get_entries(&cursor, 1, &entries));
+  ASSERT_EQ(1u, entries.size());
+  ASSERT_EQ(handle_1, entries[0].handle);
+  ASSERT_EQ(key_1, entries[0].match_key[0].key);
+
+  // the cursor remains valid if entries are modified between 2 chunks
+  rc = this->table->delete_entry(handle_1);
+  ASSERT_EQ(MatchErrorCode::SUCCESS, rc);
+  rc = this->add_entry(key_3, &handle_3);
+  ASSERT_EQ(MatchErrorCode::SUCCESS, rc);
+  ASSERT_FALSE(this->table->get_entries(&cursor, 1, &entries));
+  ASSERT_EQ(2u, entries.size());
+  ASSERT_EQ(handle_2, entries[1].handle);
+
+  entries.clear();
+  cursor = 0;
+  ASSERT_FALSE(this->table->get_entries(&cursor, 16, &entries));
+  ASSERT_EQ(2u, entries.size());
+
+  this->table->reset_state();
+  entries.clear();
+  cursor = 0;
+  ASSERT_FALSE(this->table->get_entries(&cursor, 16, &entries));
+  ASSERT_TRUE(entries.empty());
+}
+
 TYPED_TEST(TableSizeTwo, ImmutableEntries) {
   MatchErrorCode rc;
   entry_handle_t handle_1, handle_2;
@@ -1014,6 +1069,92 @@ TYPED_TEST(TableSizeTwo, ImmutableEntries) {
   ASSERT_EQ(MatchErrorCode::IMMUTABLE_TABLE_ENTRIES, rc);
 }
 
+TYPED_TEST(TableSizeTwo, WriteEntries) {
+  using WriteOp = MatchTable::WriteOp;
+  MatchErrorCode rc;
+  entry_handle_t handle_1;
+  std::string key_1("\xaa\xaa");
+  std::string key_2("\xbb\xbb");
+  std::string key_3("\xcc\xcc");
+  std::string key_4("\xdd\xdd");
+
+  auto make_op = [this](WriteOp::Type type, const std::string &key,
+                        entry_handle_t handle) {
+    WriteOp op{type, this->table.get(), {}, &this->action_fn, ActionData(),
+               this->default_priority, handle, MatchErrorCode::SUCCESS};
+    if (type == WriteOp::Type::ADD) op.match_key = this->make_match_key(key);
+    return op;
+  };
+
+  rc = this->add_entry(key_1, &handle_1);
+  ASSERT_EQ(MatchErrorCode::SUCCESS, rc);
+
+  // not atomic: a failed operation does not prevent the next ones
+  std::vector<WriteOp> ops;
+  ops.push_back(make_op(WriteOp::Type::ADD, key_2, 0));
+  ops.push_back(make_op(WriteOp::Type::ADD, key_3, 0));
+  ops.push_back(make_op(WriteOp::Type::MODIFY, "", handle_1));
+  ops.back().action_fn = &this->action_fn_1;
+  ops.back().action_data.push_back_action_data(0xaba);
+  rc = MatchTable::write_entries(&ops, false);
+  ASSERT_EQ(MatchErrorCode::TABLE_FULL, rc);
+  ASSERT_EQ(MatchErrorCode::SUCCESS, ops[0].status);
+  ASSERT_EQ(MatchErrorCode::TABLE_FULL, ops[1].status);
+  ASSERT_EQ(MatchErrorCode::SUCCESS, ops[2].status);
+  ASSERT_EQ(2u, this->table->get_num_entries());
+  entry_handle_t handle_2 = ops[0].handle;
+  ASSERT_TRUE(this->table->is_valid_handle(handle_2));
+
+  // atomic: the delete is undone when the second add fails
+  ops.clear();
+  ops.push_back(make_op(WriteOp::Type::DELETE, "", handle_1));
+  ops.push_back(make_op(WriteOp::Type::ADD, key_3, 0));
+  ops.push_back(make_op(WriteOp::Type::ADD, key_4, 0));
+  rc = MatchTable::write_entries(&ops, true);
+  ASSERT_EQ(MatchErrorCode::TABLE_FULL, rc);
+  ASSERT_EQ(MatchErrorCode::BATCH_ABORTED, ops[0].status);
+  ASSERT_EQ(MatchErrorCode::BATCH_ABORTED, ops[1].status);
+  ASSERT_EQ(MatchErrorCode::TABLE_FULL, ops[2].status);
+  ASSERT_EQ(2u, this->table->get_num_entries());
+  MatchTable::Entry entry;
+  rc = this->table->get_entry_from_key(this->make_match_key(key_3), &entry,
+                                       this->default_priority);
+  ASSERT_NE(MatchErrorCode::SUCCESS, rc);
+  // the entry is restored with its action, but with a new handle
+  rc = this->table->get_entry_from_key(this->make_match_key(key_1), &entry,
+                                       this->default_priority);
+  ASSERT_EQ(MatchErrorCode::SUCCESS, rc);
+  ASSERT_EQ(&this->action_fn_1, entry.action_fn);
+  ASSERT_EQ(0xabau, entry.action_data.get(0).get_uint());
+  ASSERT_EQ(entry.handle, ops[0].handle);
+  ASSERT_NE(handle_1, ops[0].handle);
+
+  // atomic: a modify is undone when the delete fails
+  ops.clear();
+  ops.push_back(make_op(WriteOp::Type::MODIFY, "", handle_2));
+  ops.back().action_fn = &this->action_fn_1;
+  ops.back().action_data.push_back_action_data(0xbbb);
+  ops.push_back(make_op(WriteOp::Type::DELETE, "", handle_1));
+  rc = MatchTable::write_entries(&ops, true);
+  ASSERT_NE(MatchErrorCode::SUCCESS, rc);
+  ASSERT_EQ(MatchErrorCode::BATCH_ABORTED, ops[0].status);
+  rc = this->table->get_entry(handle_2, &entry);
+  ASSERT_EQ(MatchErrorCode::SUCCESS, rc);
+  ASSERT_EQ(&this->action_fn, entry.action_fn);
+
+  // atomic success
+  ops.clear();
+  ops.push_back(make_op(WriteOp::Type::DELETE, "", handle_2));
+  ops.push_back(make_op(WriteOp::Type::ADD, key_3, 0));
+  rc = MatchTable::write_entries(&ops, true);
+  ASSERT_EQ(MatchErrorCode::SUCCESS, rc);
+  ASSERT_EQ(MatchErrorCode::SUCCESS, ops[0].status);
+  ASSERT_EQ(MatchErrorCode::SUCCESS, ops[1].status);
+  ASSERT_NE(MatchErrorCode::SUCCESS, this->table->get_entry(handle_2, &entry));
+  ASSERT_EQ(MatchErrorCode::SUCCESS,
+            this->table->get_entry(ops[1].handle, &entry));
+}
+
 
 class TableIndirect : public ::testing::Test {
  protected:
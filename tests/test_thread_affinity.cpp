@@ -0,0 +1,84 @@
+/* Copyright 2013-present Barefoot Networks, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Antonin Bas (antonin@barefootnetworks.com)
+ *
+ */
+
+
+#include <gtest/gtest.h>
+
+#include <sched.h>
+
+#include <bm/bm_sim/thread_affinity.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+using bm::ThreadAffinity;
+
+TEST(ThreadAffinity, ParseCpuList) {
+  std::vector<int> cpus;
+  ASSERT_TRUE(ThreadAffinity::parse_cpu_list("0-3,8,10-11", &cpus));
+  ASSERT_EQ(std::vector<int>({0, 1, 2, 3, 8, 10, 11}), cpus);
+  ASSERT_TRUE(ThreadAffinity::parse_cpu_list("5", &cpus));
+  ASSERT_EQ(std::vector<int>({5}), cpus);
+
+  for (const std::string bad : {"", ",", "1,", "3-1", "a", "1-", "-1", "1x"})
+    ASSERT_FALSE(ThreadAffinity::parse_cpu_list(bad, &cpus)) << bad;
+  // the output is not modified on error
+  ASSERT_EQ(std::vector<int>({5}), cpus);
+}
+
+TEST(ThreadAffinity, ThreadClasses) {
+  ASSERT_TRUE(ThreadAffinity::is_valid_thread_class("ingress"));
+  ASSERT_TRUE(ThreadAffinity::is_valid_thread_class("packet_in"));
+  ASSERT_TRUE(ThreadAffinity::is_valid_thread_class("port_rx"));
+  ASSERT_FALSE(ThreadAffinity::is_valid_thread_class("foo"));
+}
+
+TEST(ThreadAffinity, Apply) {
+  cpu_set_t cpuset;
+  ASSERT_EQ(0, sched_getaffinity(0, sizeof(cpuset), &cpuset));
+  std::vector<int> allowed;
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    if (CPU_ISSET(cpu, &cpuset)) allowed.push_back(cpu);
+  ASSERT_FALSE(allowed.empty());
+
+  // nothing configured for this class
+  ThreadAffinity::clear();
+  ASSERT_FALSE(ThreadAffinity::is_placed("egress"));
+  ASSERT_EQ(0, ThreadAffinity::apply("egress", 0));
+
+  ThreadAffinity::set_cpus("egress", allowed);
+  ASSERT_TRUE(ThreadAffinity::is_placed("egress"));
+  ASSERT_FALSE(ThreadAffinity::is_placed("ingress"));
+  // each egress thread is pinned to one CPU, in round-robin order
+  for (size_t idx = 0; idx < allowed.size() + 1; idx++) {
+    cpu_set_t thread_cpuset;
+    int rc = -1;
+    std::thread t([idx, &thread_cpuset, &rc]() {
+      rc = ThreadAffinity::apply("egress", idx);
+      sched_getaffinity(0, sizeof(thread_cpuset), &thread_cpuset);
+    });
+    t.join();
+    ASSERT_EQ(0, rc);
+    ASSERT_EQ(1, CPU_COUNT(&thread_cpuset));
+    ASSERT_TRUE(CPU_ISSET(allowed[idx % allowed.size()], &thread_cpuset));
+  }
+  ThreadAffinity::clear();
+}
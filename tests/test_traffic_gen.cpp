@@ -0,0 +1,275 @@
+/* Copyright 2013-present Barefoot Networks, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Antonin Bas (antonin@barefootnetworks.com)
+ *
+ */
+
+#include <gtest/gtest.h>
+
+#include <bm/bm_sim/dev_mgr.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "traffic_gen.h"
+
+using namespace bm;
+
+namespace {
+
+using PortExtras = DevMgrIface::PortExtras;
+using ReturnCode = PacketDispatcherIface::ReturnCode;
+
+uint64_t read_be(const std::string &s, size_t offset, size_t nbytes) {
+  uint64_t v = 0;
+  for (size_t i = 0; i < nbytes; i++)
+    v = (v << 8) | static_cast<unsigned char>(s[offset + i]);
+  return v;
+}
+
+uint16_t ipv4_checksum(const std::string &s) {
+  uint32_t sum = 0;
+  for (size_t i = 14; i < 34; i += 2) sum += read_be(s, i, 2);
+  while (sum >> 16) sum = (sum & 0xffff) + (sum >> 16);
+  return static_cast<uint16_t>(~sum);
+}
+
+struct Received {
+  int port;
+  std::string data;
+};
+
+class Receiver {
+ public:
+  static void handler(int port_num, const char *buffer, int len,
+                      void *cookie) {
+    static_cast<Receiver *>(cookie)->receive(port_num, buffer, len);
+  }
+
+  void receive(int port_num, const char *buffer, int len) {
+    std::unique_lock<std::mutex> lock(mutex);
+    packets.push_back({port_num, std::string(buffer, len)});
+    cv.notify_all();
+  }
+
+  // returns the packets once at least count of them have been received
+  std::vector<Received> wait(size_t count) {
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait_for(lock, std::chrono::seconds(5),
+                [this, count]() { return packets.size() >= count; });
+    return packets;
+  }
+
+ private:
+  std::mutex mutex{};
+  std::condition_variable cv{};
+  std::vector<Received> packets{};
+};
+
+}  // namespace
+
+class TrafficGenTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    mgr.set_packet_handler(&Receiver::handler, &receiver);
+  }
+
+  // declared first, the generator thread uses it until mgr is destroyed
+  Receiver receiver{};
+  TrafficGenPortMgr mgr{};
+};
+
+TEST_F(TrafficGenTest, Packets) {
+  PortExtras extras = {
+    {DevMgrIface::kPortExtraTrafficGen, "fast"},
+    {DevMgrIface::kPortExtraTrafficGenFlows, "4"},
+    {DevMgrIface::kPortExtraTrafficGenSize, "100-200"},
+    {DevMgrIface::kPortExtraTrafficGenCount, "100"}};
+  ASSERT_TRUE(TrafficGenPortMgr::is_requested(extras));
+  ASSERT_FALSE(TrafficGenPortMgr::is_requested({}));
+  ASSERT_EQ(ReturnCode::SUCCESS, mgr.port_add("gen1", 1, extras));
+  ASSERT_EQ(ReturnCode::ERROR, mgr.port_add("gen1", 1, extras));
+  mgr.start();
+
+  auto packets = receiver.wait(100);
+  ASSERT_EQ(100u, packets.size());
+  std::set<uint64_t> src_ips, src_ports;
+  uint64_t octets = 0;
+  for (size_t i = 0; i < packets.size(); i++) {
+    const auto &p = packets[i];
+    EXPECT_EQ(1, p.port);
+    ASSERT_GE(p.data.size(), 100u);
+    ASSERT_LE(p.data.size(), 200u);
+    octets += p.data.size();
+    EXPECT_EQ(0x0800u, read_be(p.data, 12, 2));
+    EXPECT_EQ(p.data.size() - 14, read_be(p.data, 16, 2));
+    EXPECT_EQ(0u, ipv4_checksum(p.data));
+    EXPECT_EQ(17u, read_be(p.data, 23, 1));
+    EXPECT_EQ(p.data.size() - 34, read_be(p.data, 38, 2));
+    // trailer: magic number, sequence number, timestamp
+    EXPECT_EQ(i, read_be(p.data, p.data.size() - 12, 4));
+    src_ips.insert(read_be(p.data, 26, 4));
+    src_ports.insert(read_be(p.data, 34, 2));
+  }
+  EXPECT_EQ(4u, src_ips.size());
+  EXPECT_EQ(4u, src_ports.size());
+
+  DevMgrIface::PortStats stats;
+  ASSERT_TRUE(mgr.get_port_stats(1, &stats));
+  EXPECT_EQ(100u, stats.in_packets);
+  EXPECT_EQ(octets, stats.in_octets);
+  ASSERT_FALSE(mgr.get_port_stats(2, &stats));
+  bool is_up = false;
+  ASSERT_TRUE(mgr.port_is_up(1, &is_up));
+  EXPECT_TRUE(is_up);
+
+  // no packet after the count is reached
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  EXPECT_EQ(100u, receiver.wait(0).size());
+  EXPECT_TRUE(mgr.port_remove(1));
+  EXPECT_FALSE(mgr.port_remove(1));
+}
+
+TEST_F(TrafficGenTest, Randomize) {
+  PortExtras extras = {
+    {DevMgrIface::kPortExtraTrafficGen, "fast"},
+    {DevMgrIface::kPortExtraTrafficGenRandomize, "dst_mac,dst_ip,dst_port"},
+    {DevMgrIface::kPortExtraTrafficGenSize, "imix"},
+    {DevMgrIface::kPortExtraTrafficGenCount, "200"}};
+  ASSERT_EQ(ReturnCode::SUCCESS, mgr.port_add("gen1", 1, extras));
+  mgr.start();
+  auto packets = receiver.wait(200);
+  ASSERT_EQ(200u, packets.size());
+  std::set<uint64_t> dst_macs, dst_ips, dst_ports, src_ips;
+  std::set<size_t> sizes;
+  for (const auto &p : packets) {
+    // unicast MAC addresses only
+    EXPECT_EQ(0u, read_be(p.data, 0, 1) & 1);
+    EXPECT_EQ(0u, ipv4_checksum(p.data));
+    dst_macs.insert(read_be(p.data, 0, 6));
+    dst_ips.insert(read_be(p.data, 30, 4));
+    dst_ports.insert(read_be(p.data, 36, 2));
+    src_ips.insert(read_be(p.data, 26, 4));
+    sizes.insert(p.data.size());
+  }
+  EXPECT_GT(dst_macs.size(), 100u);
+  EXPECT_GT(dst_ips.size(), 100u);
+  EXPECT_GT(dst_ports.size(), 100u);
+  EXPECT_EQ(1u, src_ips.size());
+  EXPECT_EQ((std::set<size_t>{64, 576, 1500}), sizes);
+}
+
+TEST_F(TrafficGenTest, Sink) {
+  ASSERT_EQ(ReturnCode::SUCCESS, mgr.port_add(
+      "gen1", 1, {{DevMgrIface::kPortExtraTrafficGen, "fast"},
+                  {DevMgrIface::kPortExtraTrafficGenCount, "10"}}));
+  ASSERT_EQ(ReturnCode::SUCCESS, mgr.port_add(
+      "sink2", 2, {{DevMgrIface::kPortExtraTrafficSink, "1"}}));
+  mgr.start();
+  auto packets = receiver.wait(10);
+  ASSERT_EQ(10u, packets.size());
+  std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+  // not a sink port
+  EXPECT_FALSE(mgr.transmit(3, packets[0].data.data(), 64));
+  uint64_t octets = 0;
+  for (const auto &p : packets) {
+    // with some headers added by the switch
+    auto data = std::string(8, 'h') + p.data;
+    ASSERT_TRUE(mgr.transmit(2, data.data(), data.size()));
+    octets += data.size();
+  }
+  // no timestamp
+  std::string other(100, 'x');
+  ASSERT_TRUE(mgr.transmit(2, other.data(), other.size()));
+  octets += other.size();
+
+  TrafficGenPortMgr::SinkStats stats;
+  ASSERT_FALSE(mgr.get_sink_stats(1, &stats));
+  ASSERT_TRUE(mgr.get_sink_stats(2, &stats));
+  EXPECT_EQ(11u, stats.packets);
+  EXPECT_EQ(octets, stats.bytes);
+  EXPECT_EQ(10u, stats.latency_samples);
+  EXPECT_GE(stats.latency_min_ns, 1000000u);
+  EXPECT_LE(stats.latency_min_ns, stats.latency_avg_ns);
+  EXPECT_LE(stats.latency_avg_ns, stats.latency_max_ns);
+  EXPECT_LT(stats.latency_max_ns, 5000000000u);
+
+  DevMgrIface::PortStats port_stats;
+  ASSERT_TRUE(mgr.clear_port_stats(2, &port_stats));
+  EXPECT_EQ(11u, port_stats.out_packets);
+  EXPECT_EQ(octets, port_stats.out_octets);
+  ASSERT_TRUE(mgr.get_port_stats(2, &port_stats));
+  EXPECT_EQ(0u, port_stats.out_packets);
+}
+
+TEST_F(TrafficGenTest, InvalidExtras) {
+  const std::vector<PortExtras> invalid = {
+    {{DevMgrIface::kPortExtraTrafficGen, "timed"}},
+    {{DevMgrIface::kPortExtraTrafficGen, "10Xpps"}},
+    {{DevMgrIface::kPortExtraTrafficGen, "fast"},
+     {DevMgrIface::kPortExtraTrafficGenFlows, "0"}},
+    {{DevMgrIface::kPortExtraTrafficGen, "fast"},
+     {DevMgrIface::kPortExtraTrafficGenSize, "40"}},
+    {{DevMgrIface::kPortExtraTrafficGen, "fast"},
+     {DevMgrIface::kPortExtraTrafficGenSize, "200-100"}},
+    {{DevMgrIface::kPortExtraTrafficGen, "fast"},
+     {DevMgrIface::kPortExtraTrafficGenSize, "64-10000"}},
+    {{DevMgrIface::kPortExtraTrafficGen, "fast"},
+     {DevMgrIface::kPortExtraTrafficGenRandomize, "src_ip,ttl"}},
+    {{DevMgrIface::kPortExtraTrafficGen, "fast"},
+     {DevMgrIface::kPortExtraTrafficGenCount, "-1"}}};
+  for (const auto &extras : invalid) {
+    EXPECT_EQ(ReturnCode::ERROR, mgr.port_add("gen1", 1, extras));
+  }
+}
+
+TEST_F(TrafficGenTest, RemoveStopsGeneration) {
+  ASSERT_EQ(ReturnCode::SUCCESS, mgr.port_add(
+      "gen1", 1, {{DevMgrIface::kPortExtraTrafficGen, "1Mpps"}}));
+  mgr.start();
+  receiver.wait(100);
+  ASSERT_TRUE(mgr.port_remove(1));
+  // let the generator thread notice that the port is gone
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  auto count = receiver.wait(0).size();
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  EXPECT_EQ(count, receiver.wait(0).size());
+}
+
+#ifndef SKIP_UNDETERMINISTIC_TESTS
+
+TEST_F(TrafficGenTest, Rate) {
+  // 20000pps, i.e. 50us per packet
+  ASSERT_EQ(ReturnCode::SUCCESS, mgr.port_add(
+      "gen1", 1, {{DevMgrIface::kPortExtraTrafficGen, "20kpps"},
+                  {DevMgrIface::kPortExtraTrafficGenCount, "200"}}));
+  auto start = std::chrono::steady_clock::now();
+  mgr.start();
+  ASSERT_EQ(200u, receiver.wait(200).size());
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  EXPECT_GE(elapsed, std::chrono::microseconds(9950));
+  EXPECT_LT(elapsed, std::chrono::milliseconds(500));
+}
+
+#endif  // SKIP_UNDETERMINISTIC_TESTS
@@ -117,6 +117,28 @@ class MemoryAccessor : public bm::TransportIface {
   mutable std::condition_variable can_read;
 };
 
+// A pair of connected veth interfaces, for testing the port managers which
+// need real network interfaces (creating them requires CAP_NET_ADMIN). Both
+// interfaces are up, with IPv6 disabled so that the kernel does not send
+// anything on them, and the pair is deleted by the destructor.
+class VethPair {
+ public:
+  VethPair(const std::string &if0, const std::string &if1);
+  ~VethPair();
+
+  // false if the pair could not be created, the test should then be skipped
+  bool created() const { return created_; }
+
+  // Returns a raw AF_PACKET socket bound to the second interface, to send and
+  // receive frames as the peer, or -1 in case of error. The caller owns it.
+  int open_peer_socket() const;
+
+ private:
+  std::string if0;
+  std::string if1;
+  bool created_{false};
+};
+
 class CLIWrapperImp;
 
 class CLIWrapper {
@@ -84,6 +84,21 @@ struct BmCounterValue {
   2:i64 packets;
 }
 
+// packed values for a range of counters, bytes[i] and packets[i] are the
+// values of the i-th counter in the range
+struct BmCounterValues {
+  1:list<i64> bytes;
+  2:list<i64> packets;
+}
+
+// direct counters of a table, entry_handles[i] is the handle of the entry for
+// bytes[i] and packets[i]
+struct BmMtCounterValues {
+  1:list<BmEntryHandle> entry_handles;
+  2:list<i64> bytes;
+  3:list<i64> packets;
+}
+
 struct BmMeterRateConfig {
   1:double units_per_micros;
   2:i32 burst_size;
@@ -116,6 +131,7 @@ enum TableOperationErrorCode {
   NO_ACTION_PROFILE_SELECTION = 24,
   IMMUTABLE_TABLE_ENTRIES = 25,
   BAD_ACTION_DATA = 26,
+  BATCH_ABORTED = 27,
   ERROR = 100,
 }
 
@@ -136,13 +152,24 @@ exception InvalidCounterOperation {
 enum SwapOperationErrorCode {
   CONFIG_SWAP_DISABLED = 1,
   ONGOING_SWAP = 2,
-  NO_ONGOING_SWAP = 3
+  NO_ONGOING_SWAP = 3,
+  INVALID_CONFIG = 7
 }
 
 exception InvalidSwapOperation {
   1:SwapOperationErrorCode code
 }
 
+enum SnapshotOperationErrorCode {
+  ONGOING_SWAP = 2,
+  ONGOING_SNAPSHOT = 4,
+  SNAPSHOT_FILE_ERROR = 5
+}
+
+exception InvalidSnapshotOperation {
+  1:SnapshotOperationErrorCode code
+}
+
 enum MeterOperationErrorCode {
   INVALID_METER_NAME = 1,
   INVALID_INDEX = 2,
@@ -258,6 +285,37 @@ struct BmMtEntry {
  5:optional BmMtEntryLife life
 }
 
+// next_cursor is -1 after the last chunk
+struct BmMtEntriesChunk {
+ 1:list<BmMtEntry> entries,
+ 2:i64 next_cursor
+}
+
+enum BmMtWriteOpType {
+  ADD = 0,
+  MODIFY = 1,
+  DELETE = 2
+}
+
+// match_key and options are only used for ADD, action_name and action_data for
+// ADD and MODIFY, entry_handle for MODIFY and DELETE
+struct BmMtWriteOp {
+ 1:BmMtWriteOpType type,
+ 2:string table_name,
+ 3:BmMatchParams match_key,
+ 4:string action_name,
+ 5:BmActionData action_data,
+ 6:BmAddEntryOptions options,
+ 7:BmEntryHandle entry_handle
+}
+
+// error is not set if the operation succeeded; entry_handle is the handle of
+// the new entry for ADD
+struct BmMtWriteResult {
+ 1:BmEntryHandle entry_handle,
+ 2:optional TableOperationErrorCode error
+}
+
 struct BmMtActProfMember {
  1:BmMemberHandle mbr_handle,
  2:string action_name,
@@ -277,6 +335,82 @@ struct BmConfig {
  5:optional string debugger_socket
 }
 
+# workers is 0 for the "threaded" server (one thread per connection); pending
+# requests are the requests waiting for a free worker
+struct BmRuntimeServerStats {
+ 1:string server_type,
+ 2:i32 workers,
+ 3:i32 idle_workers,
+ 4:i64 open_connections,
+ 5:i64 active_requests,
+ 6:i64 pending_requests,
+ 7:i64 max_pending_requests,
+ 8:i64 total_requests,
+ 9:i64 avg_processing_ns
+}
+
+# lookups, executions and evaluations are exact counts, times (in ns) are
+# measured on a sample of the packets
+struct BmTableProfile {
+ 1:string name,
+ 2:i64 lookups,
+ 3:i64 hits,
+ 4:i64 misses,
+ 5:i64 avg_lookup_ns,
+ 6:i64 avg_action_ns
+}
+
+struct BmActionProfile {
+ 1:string name,
+ 2:i64 executions,
+ 3:i64 avg_ns,
+ 4:i64 total_ns
+}
+
+struct BmConditionalProfile {
+ 1:string name,
+ 2:i64 evaluations,
+ 3:i64 true_count
+}
+
+struct BmProfile {
+ 1:list<BmTableProfile> tables,
+ 2:list<BmActionProfile> actions,
+ 3:list<BmConditionalProfile> conditionals
+}
+
+# see bm::LatencyHistogram, all values are in nanoseconds
+struct BmLockHistogram {
+ 1:i64 count,
+ 2:i64 min_ns,
+ 3:i64 mean_ns,
+ 4:i64 max_ns,
+ 5:i64 p50_ns,
+ 6:i64 p90_ns,
+ 7:i64 p99_ns,
+ 8:i64 p999_ns
+}
+
+# contended counts are the acquisitions which could not get the lock right
+# away; the number of acquisitions is the count of the wait histograms
+struct BmLockStats {
+ 1:string name,
+ 2:i64 read_contended,
+ 3:i64 write_contended,
+ 4:BmLockHistogram read_wait,
+ 5:BmLockHistogram read_hold,
+ 6:BmLockHistogram write_wait,
+ 7:BmLockHistogram write_hold
+}
+
+struct BmSnapshotStatus {
+ 1:bool in_progress,
+ 2:string path,
+ 3:bool success,
+ 4:i64 bytes,
+ 5:i64 duration_ms
+}
+
 enum BmResourceType {
   MATCH_TABLE = 0,
   ACTION_PROFILE = 1,
@@ -356,6 +490,17 @@ service Standard {
     4:i32 timeout_ms
   ) throws (1:InvalidTableOperation ouch),
 
+  // applies the operations in order, taking each table's write lock once; one
+  // result per operation. If atomic is true, the batch stops at the first
+  // error and the operations already applied are reverted (the other
+  // operations fail with BATCH_ABORTED); note that an entry whose deletion is
+  // reverted gets a new handle, reported in its result.
+  list<BmMtWriteResult> bm_mt_write_entries(
+    1:i32 cxt_id,
+    2:list<BmMtWriteOp> ops,
+    3:bool atomic
+  ),
+
   // action profiles
 
   BmMemberHandle bm_mt_act_prof_add_member(
@@ -496,6 +641,12 @@ service Standard {
     3:BmEntryHandle entry_handle
   ) throws (1:InvalidTableOperation ouch),
 
+  BmMtCounterValues bm_mt_read_all_counters(
+    1:i32 cxt_id,
+    2:string table_name,
+    3:bool read_and_clear
+  ) throws (1:InvalidTableOperation ouch),
+
   void bm_mt_reset_counters(
     1:i32 cxt_id,
     2:string table_name
@@ -526,6 +677,15 @@ service Standard {
     2:string table_name
   ) throws (1:InvalidTableOperation ouch),
 
+  // use 0 as the cursor for the first chunk, then the next_cursor returned by
+  // the previous call; the table lock is only held while a chunk is built
+  BmMtEntriesChunk bm_mt_get_entries_chunk(
+    1:i32 cxt_id,
+    2:string table_name,
+    3:i64 cursor,
+    4:i32 max_entries
+  ) throws (1:InvalidTableOperation ouch),
+
   BmMtEntry bm_mt_get_entry(
     1:i32 cxt_id,
     2:string table_name,
@@ -553,6 +713,21 @@ service Standard {
     3:i32 index
   ) throws (1:InvalidCounterOperation ouch),
 
+  // reads the counters with index in [start, end)
+  BmCounterValues bm_counter_read_range(
+    1:i32 cxt_id,
+    2:string counter_name,
+    3:i32 start,
+    4:i32 end_,
+    5:bool read_and_clear
+  ) throws (1:InvalidCounterOperation ouch),
+
+  BmCounterValues bm_counter_read_all(
+    1:i32 cxt_id,
+    2:string counter_name,
+    3:bool read_and_clear
+  ) throws (1:InvalidCounterOperation ouch),
+
   void bm_counter_reset_all(
     1:i32 cxt_id,
     2:string counter_name
@@ -621,6 +796,11 @@ service Standard {
     3:i32 index
   ) throws (1:InvalidMeterOperation ouch)
 
+  list<list<BmMeterRateConfig>> bm_meter_array_get_rates(
+    1:i32 cxt_id,
+    2:string meter_array_name
+  ) throws (1:InvalidMeterOperation ouch)
+
 
   // registers
 
@@ -689,6 +869,8 @@ service Standard {
 
   BmConfig bm_mgmt_get_info()
 
+  BmRuntimeServerStats bm_mgmt_get_runtime_server_stats()
+
   void bm_set_crc16_custom_parameters(
     1:i32 cxt_id,
     2:string calc_name,
@@ -713,4 +895,32 @@ service Standard {
   ) throws (1:InvalidIdLookup ouch)
 
   string bm_serialize_state()
+
+  // binary snapshot, written to a file on the switch host and restored with
+  // --restore-state
+  void bm_snapshot_state(
+    1:string path,
+    2:bool background
+  ) throws (1:InvalidSnapshotOperation ouch)
+
+  BmSnapshotStatus bm_get_snapshot_status()
+
+  // profiling
+
+  BmProfile bm_get_profile(
+    1:i32 cxt_id
+  )
+
+  void bm_reset_profile(
+    1:i32 cxt_id
+  )
+
+  void bm_set_profiling_enabled(
+    1:bool enabled
+  )
+
+  // empty unless bmv2 was configured with --enable-lock-stats
+  list<BmLockStats> bm_get_lock_stats()
+
+  void bm_reset_lock_stats()
 }
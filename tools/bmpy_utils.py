@@ -77,14 +77,19 @@ def get_json_config(standard_client=None, json_path=None, out=sys.stdout):
         return json_cfg
 
 # services is [(service_name, client_class), ...]
-def thrift_connect(thrift_ip, thrift_port, services, out=sys.stdout):
+# framed has to be True if the switch runs the nonblocking Thrift server
+def thrift_connect(thrift_ip, thrift_port, services, out=sys.stdout,
+                   framed=False):
     def my_print(s):
         out.write(s)
 
     # Make socket
     transport = TSocket.TSocket(thrift_ip, thrift_port)
     # Buffering is critical. Raw sockets are very slow
-    transport = TTransport.TBufferedTransport(transport)
+    if framed:
+        transport = TTransport.TFramedTransport(transport)
+    else:
+        transport = TTransport.TBufferedTransport(transport)
     # Wrap in a protocol
     bprotocol = TBinaryProtocol.TBinaryProtocol(transport)
 
@@ -90,6 +90,11 @@ def get_parser():
     parser.add_argument('--thrift-ip', help='Thrift IP address for table updates',
                         type=str, action="store", default='localhost')
 
+    parser.add_argument('--thrift-framed',
+                        help='Use the framed transport, required when the switch '
+                        'runs with --thrift-server nonblocking',
+                        action="store_true", default=False)
+
     parser.add_argument('--json', help='JSON description of P4 program',
                         type=str, action="store", required=False)
 
@@ -635,8 +640,8 @@ BmMatchParamValid.to_str = BmMatchParamValid_to_str
 BmMatchParamRange.to_str = BmMatchParamRange_to_str
 
 # services is [(service_name, client_class), ...]
-def thrift_connect(thrift_ip, thrift_port, services):
-    return utils.thrift_connect(thrift_ip, thrift_port, services)
+def thrift_connect(thrift_ip, thrift_port, services, framed=False):
+    return utils.thrift_connect(thrift_ip, thrift_port, services, framed=framed)
 
 def handle_bad_input(f):
     @wraps(f)
@@ -667,6 +672,9 @@ def handle_bad_input(f):
         except InvalidSwapOperation as e:
             error = SwapOperationErrorCode._VALUES_TO_NAMES[e.code]
             print "Invalid swap operation (%s)" % error
+        except InvalidSnapshotOperation as e:
+            error = SnapshotOperationErrorCode._VALUES_TO_NAMES[e.code]
+            print "Invalid snapshot operation (%s)" % error
         except InvalidDevMgrOperation as e:
             error = DevMgrErrorCode._VALUES_TO_NAMES[e.code]
             print "Invalid device manager operation (%s)" % error
@@ -769,6 +777,8 @@ def parse_bool(s):
 class RuntimeAPI(cmd.Cmd):
     prompt = 'RuntimeCmd: '
     intro = "Control utility for runtime P4 table manipulation"
+    # number of entries retrieved per RPC by table_dump
+    TABLE_DUMP_CHUNK_SIZE = 1024
 
     @staticmethod
     def get_thrift_services(pre_type):
@@ -1880,6 +1890,26 @@ class RuntimeAPI(cmd.Cmd):
     def complete_meter_get_rates(self, text, line, start_index, end_index):
         return self._complete_meters(text)
 
+    @handle_bad_input
+    def do_meter_array_get_rates(self, line):
+        "Retrieve rates for all the meters in an array: meter_array_get_rates <name>"
+        args = line.split()
+        self.exactly_n_args(args, 1)
+        meter_name = args[0]
+        meter = self.get_res("meter", meter_name, ResType.meter_array)
+        if meter.is_direct:
+            raise UIn_Error(
+                "Cannot dump the rates of a direct meter, use meter_get_rates")
+        all_rates = self.client.bm_meter_array_get_rates(0, meter.name)
+        for index, rates in enumerate(all_rates):
+            print "%s[%d]:" % (meter_name, index),
+            print ", ".join("info rate = {}, burst size = {}".format(
+                rate.units_per_micros, rate.burst_size) for rate in rates)
+
+    def complete_meter_array_get_rates(self, text, line, start_index,
+                                       end_index):
+        return self._complete_meters(text)
+
     def _complete_meters(self, text):
         return self._complete_res(METER_ARRAYS, text)
 
@@ -1907,6 +1937,33 @@ class RuntimeAPI(cmd.Cmd):
     def complete_counter_read(self, text, line, start_index, end_index):
         return self._complete_counters(text)
 
+    @handle_bad_input
+    def do_counter_read_all(self, line):
+        "Read all the values of a counter in one call: counter_read_all <name> [clear]"
+        args = line.split()
+        self.at_least_n_args(args, 1)
+        counter_name = args[0]
+        counter = self.get_res("counter", counter_name, ResType.counter_array)
+        if len(args) > 2 or (len(args) == 2 and args[1] != "clear"):
+            raise UIn_Error("Usage: counter_read_all <name> [clear]")
+        read_and_clear = (len(args) == 2)
+        if counter.is_direct:
+            table_name = counter.binding
+            print "this is the direct counter for table", table_name
+            values = self.client.bm_mt_read_all_counters(
+                0, table_name, read_and_clear)
+            indices = values.entry_handles
+        else:
+            values = self.client.bm_counter_read_all(
+                0, counter.name, read_and_clear)
+            indices = range(len(values.bytes))
+        for index, b, p in zip(indices, values.bytes, values.packets):
+            print "%s[%d]= BmCounterValue(bytes=%d, packets=%d)" % (
+                counter_name, index, b, p)
+
+    def complete_counter_read_all(self, text, line, start_index, end_index):
+        return self._complete_counters(text)
+
     @handle_bad_input
     def do_counter_reset(self, line):
         "Reset counter: counter_reset <name>"
@@ -2182,14 +2239,19 @@ class RuntimeAPI(cmd.Cmd):
         self.exactly_n_args(args, 1)
         table_name = args[0]
         table = self.get_res("table", table_name, ResType.table)
-        entries = self.client.bm_mt_get_entries(0, table.name)
-
         print "=========="
         print "TABLE ENTRIES"
 
-        for e in entries:
-            print "**********"
-            self.dump_one_entry(table, e)
+        # entries are retrieved in chunks so that the switch does not hold the
+        # table lock for the whole dump
+        cursor = 0
+        while cursor != -1:
+            chunk = self.client.bm_mt_get_entries_chunk(
+                0, table.name, cursor, self.TABLE_DUMP_CHUNK_SIZE)
+            for e in chunk.entries:
+                print "**********"
+                self.dump_one_entry(table, e)
+            cursor = chunk.next_cursor
 
         if table.type_ == TableType.indirect or\
            table.type_ == TableType.indirect_ws:
@@ -2317,6 +2379,121 @@ class RuntimeAPI(cmd.Cmd):
         with open(filename, 'w') as f:
             f.write(state)
 
+    @handle_bad_input
+    def do_snapshot_state(self, line):
+        "Write a binary snapshot of the switch state to a file on the switch host, which can be restored with --restore-state; with 'background', the snapshot does not block table updates: snapshot_state <path> [background]"
+        args = line.split()
+        self.at_least_n_args(args, 1)
+        if len(args) > 2 or (len(args) == 2 and args[1] != "background"):
+            raise UIn_Error("Expected a path and optionally 'background'")
+        background = len(args) == 2
+        self.client.bm_snapshot_state(args[0], background)
+        if background:
+            print "Snapshot started, use show_snapshot_status to check progress"
+
+    @handle_bad_input
+    def do_show_snapshot_status(self, line):
+        "Show the status of the ongoing or last binary snapshot: show_snapshot_status"
+        self.exactly_n_args(line.split(), 0)
+        status = self.client.bm_get_snapshot_status()
+        if not status.path:
+            print "No snapshot"
+            return
+        if status.in_progress:
+            print "Snapshot to {} in progress".format(status.path)
+        elif status.success:
+            print "Snapshot to {} complete: {} bytes in {} ms".format(
+                status.path, status.bytes, status.duration_ms)
+        else:
+            print "Snapshot to {} failed".format(status.path)
+
+    @handle_bad_input
+    def do_show_profile(self, line):
+        "Show profiling counters for tables, actions and conditionals (times in ns are sampled): show_profile [tables|actions|conditionals]"
+        args = line.split()
+        kinds = ["tables", "actions", "conditionals"]
+        if len(args) > 1 or (args and args[0] not in kinds):
+            raise UIn_Error("Expected one of {}".format(", ".join(kinds)))
+        profile = self.client.bm_get_profile(0)
+        columns = {
+            "tables": ["lookups", "hits", "misses", "avg_lookup_ns",
+                       "avg_action_ns"],
+            "actions": ["executions", "avg_ns", "total_ns"],
+            "conditionals": ["evaluations", "true_count"],
+        }
+        for kind in kinds:
+            if args and args[0] != kind:
+                continue
+            entries = getattr(profile, kind)
+            if not entries:
+                continue
+            name_w = max(len(kind), max(len(e.name) for e in entries))
+            print "{:{w}}".format(kind, w=name_w) + \
+                "".join(["{:>15}".format(c) for c in columns[kind]])
+            for e in entries:
+                print "{:{w}}".format(e.name, w=name_w) + \
+                    "".join(["{:>15}".format(getattr(e, c))
+                             for c in columns[kind]])
+            print
+
+    @handle_bad_input
+    def do_reset_profile(self, line):
+        "Reset profiling counters: reset_profile"
+        self.exactly_n_args(line.split(), 0)
+        self.client.bm_reset_profile(0)
+
+    @handle_bad_input
+    def do_set_profiling(self, line):
+        "Enable / disable profiling counters (enabled by default): set_profiling on|off"
+        args = line.split()
+        self.exactly_n_args(args, 1)
+        if args[0] not in ["on", "off"]:
+            raise UIn_Error("Expected 'on' or 'off'")
+        self.client.bm_set_profiling_enabled(args[0] == "on")
+
+    @handle_bad_input
+    def do_show_lock_stats(self, line):
+        "Show wait and hold times (in ns) of the locks shared with the data plane, requires bmv2 to be configured with --enable-lock-stats: show_lock_stats [<lock name>]"
+        args = line.split()
+        if len(args) > 1:
+            raise UIn_Error("Expected at most one lock name")
+        all_stats = self.client.bm_get_lock_stats()
+        if not all_stats:
+            print "No lock stats, make sure bmv2 was configured with --enable-lock-stats"
+            return
+        columns = ["count", "min_ns", "mean_ns", "max_ns", "p50_ns", "p90_ns",
+                   "p99_ns", "p999_ns"]
+        for stats in all_stats:
+            if args and args[0] != stats.name:
+                continue
+            print "{}: {} contended reads, {} contended writes".format(
+                stats.name, stats.read_contended, stats.write_contended)
+            print "{:12}".format("") + \
+                "".join(["{:>12}".format(c) for c in columns])
+            for h in ["read_wait", "read_hold", "write_wait", "write_hold"]:
+                histogram = getattr(stats, h)
+                print "{:12}".format(h) + \
+                    "".join(["{:>12}".format(getattr(histogram, c))
+                             for c in columns])
+            print
+
+    @handle_bad_input
+    def do_reset_lock_stats(self, line):
+        "Reset lock wait and hold time stats: reset_lock_stats"
+        self.exactly_n_args(line.split(), 0)
+        self.client.bm_reset_lock_stats()
+
+    @handle_bad_input
+    def do_show_runtime_server_stats(self, line):
+        "Show statistics for the Thrift server itself (workers, queued requests, ...): show_runtime_server_stats"
+        self.exactly_n_args(line.split(), 0)
+        stats = self.client.bm_mgmt_get_runtime_server_stats()
+        for name in ["server_type", "workers", "idle_workers",
+                     "open_connections", "active_requests", "pending_requests",
+                     "max_pending_requests", "total_requests",
+                     "avg_processing_ns"]:
+            print "{:25}{}".format(name + ":", getattr(stats, name))
+
     def set_crc_parameters_common(self, line, crc_width=16):
         conversion_fn = {16: hex_to_i16, 32: hex_to_i32}[crc_width]
         config_type = {16: BmCrc16Config, 32: BmCrc32Config}[crc_width]
@@ -2363,7 +2540,7 @@ def main():
 
     standard_client, mc_client = thrift_connect(
         args.thrift_ip, args.thrift_port,
-        RuntimeAPI.get_thrift_services(args.pre)
+        RuntimeAPI.get_thrift_services(args.pre), args.thrift_framed
     )
 
     load_json_config(standard_client, args.json)